@@ -110,6 +110,9 @@ var testListener = function(stel) {
     if (obj.path == 'core.observer' && attr == 'latitude') test++;
   })
   stel.observer.latitude = 33 * stel.D2R;
+  // The changes are only sent once per frame.
+  assert(test == 0);
+  stel._module_flush_changes();
   assert(test == 2);
 };
 
@@ -171,6 +174,7 @@ var testTree = function(stel) {
   });
   stel.setValue('observer.longitude', 0.1);
   assert(stel.getValue('observer.longitude') === 0.1);
+  stel._module_flush_changes();
   assert(test);
   test = undefined; // Prevent future callbacks!
 
@@ -11,11 +11,15 @@
 precision mediump float;
 #endif
 
-uniform highp float u_atm_p[12];
-uniform highp vec3  u_sun;
 uniform highp float u_tm[3]; // Tonemapping koefs.
+uniform highp vec3  u_sun;
+uniform highp vec3  u_moon;
+// Skybrightness model terms: b_night_term, K, b_moon_term, C3,
+// b_twilight_term, C4, then the eclipse factor and light pollution.
+uniform highp float u_sb[8];
+uniform mediump sampler2D u_tex; // Sky chromaticity LUT.
 
-varying lowp    vec4        v_color;
+varying highp   vec3        v_sky_pos;
 
 #ifdef VERTEX_SHADER
 
@@ -23,7 +27,73 @@ varying lowp    vec4        v_color;
 
 attribute highp   vec4       a_pos;
 attribute highp   vec3       a_sky_pos;
-attribute highp   float      a_luminance;
+
+void main()
+{
+    gl_Position = proj(a_pos.xyz);
+    v_sky_pos = a_sky_pos;
+}
+
+#endif
+#ifdef FRAGMENT_SHADER
+
+#define PI 3.14159265358979
+// Must match the values in atmosphere.c.
+#define LUT_W 128.0
+#define LUT_H 32.0
+#define COS_MIN_DIST 0.9659258
+
+// Same as skybrightness_get_luminance, with the eclipse factor and light
+// pollution added.
+highp float sky_luminance(highp vec3 p)
+{
+    highp float cos_moon = min(dot(p, u_moon), COS_MIN_DIST);
+    highp float cos_sun = min(dot(p, u_sun), COS_MIN_DIST);
+    highp float cos_zenith = p.z;
+    highp float moon_dist = acos(cos_moon);
+    highp float sun_dist = acos(cos_sun);
+    highp float K = u_sb[1];
+    highp float bKX, FS, FM, b_daylight, b_twilight_k, b_twilight, b_total;
+
+    // Air mass
+    bKX = pow(10.0, -0.4 * K /
+              (cos_zenith + 0.025 * exp(-11.0 * cos_zenith)));
+
+    // Daylight brightness
+    FS = 18886.28 / (sun_dist * sun_dist) +
+         pow(10.0, 6.15 - (sun_dist + 0.001) * 1.43239) +
+         229086.77 * (1.06 + cos_sun * cos_sun);
+    b_daylight = 9.289663e-12 * (1.0 - bKX) *
+                 (FS * u_sb[5] + 440000.0 * (1.0 - u_sb[5]));
+
+    // Twilight brightness
+    b_twilight_k = u_sb[4] + 0.063661977 * acos(cos_zenith) / max(K, 0.05);
+    b_twilight = 0.0;
+    if (b_twilight_k > -32.0) { // Prevent underflow.
+        b_twilight = pow(10.0, b_twilight_k) * (1.7453293 / sun_dist) *
+                     (1.0 - bKX);
+    }
+    b_total = min(b_twilight, b_daylight);
+
+    // Moonlight brightness
+    FM = 18886.28 / (moon_dist * moon_dist) +
+         pow(10.0, 6.15 - moon_dist * 1.43239) +
+         229086.77 * (1.06 + cos_moon * cos_moon);
+    b_total += u_sb[2] * (1.0 - bKX) *
+               (FM * u_sb[3] + 440000.0 * (1.0 - u_sb[3])) / 1000000.0;
+
+    // Dark night sky brightness, don't compute if less than 1% daylight
+    if (b_total > 0.0 && u_sb[0] * bKX / b_total > 0.01) {
+        b_total += (0.4 + 0.6 / sqrt(0.04 + 0.96 * cos_zenith * cos_zenith)) *
+                   u_sb[0] * bKX;
+        // Ad-hoc addition to make the sky slightly more blueish
+        b_total += 0.0000000000012;
+    }
+    b_total = max(b_total, 0.0);
+
+    // Convert to nano lambert then cd/m2
+    return b_total / 1.11e-15 * 3.183e-6 * u_sb[6] + u_sb[7];
+}
 
 highp float gammaf(highp float c)
 {
@@ -47,26 +117,23 @@ vec3 xyy_to_srgb(highp vec3 xyy)
 void main()
 {
     highp vec3 xyy;
-    highp float cos_gamma, cos_gamma2, gamma, cos_theta;
-    highp vec3 p = a_sky_pos;
-
-    gl_Position = proj(a_pos.xyz);
-
-    // First compute the xy color component (chromaticity) from Preetham model
-    // and re-inject a_luminance for Y component (luminance).
-    p[2] = abs(p[2]); // Mirror below horizon.
-    cos_gamma = dot(p, u_sun);
-    cos_gamma2 = cos_gamma * cos_gamma;
-    gamma = acos(cos_gamma);
-    cos_theta = p[2];
-
-    xyy.x = ((1. + u_atm_p[0] * exp(u_atm_p[1] / cos_theta)) *
-             (1. + u_atm_p[2] * exp(u_atm_p[3] * gamma) +
-              u_atm_p[4] * cos_gamma2)) * u_atm_p[5];
-    xyy.y = ((1. + u_atm_p[6] * exp(u_atm_p[7] / cos_theta)) *
-             (1. + u_atm_p[8] * exp(u_atm_p[9] * gamma) +
-              u_atm_p[10] * cos_gamma2)) * u_atm_p[11];
-    xyy.z = a_luminance;
+    highp vec3 p = normalize(v_sky_pos);
+    highp float az, alt;
+    highp vec2 uv;
+    highp vec4 lut;
+
+    // Lookup the chromaticity in the alt-az LUT.  The last column of the
+    // texture is a copy of the first one.
+    p.z = abs(p.z); // Mirror below horizon.
+    az = atan(p.y, p.x);
+    if (az < 0.0) az += 2.0 * PI;
+    alt = asin(clamp(p.z, 0.0, 1.0));
+    uv.x = (az / (2.0 * PI) * (LUT_W - 1.0) + 0.5) / LUT_W;
+    uv.y = (alt / (PI / 2.0) * (LUT_H - 1.0) + 0.5) / LUT_H;
+    lut = texture2D(u_tex, uv);
+    xyy.x = lut.r;
+    xyy.y = lut.a;
+    xyy.z = sky_luminance(p);
 
     // Ad-hoc tuning. Scaling before the blue shift allows to obtain proper
     // blueish colors at sun set instead of very red, which is a shortcoming
@@ -102,15 +169,7 @@ void main()
     highp vec3 rgb = xyy_to_srgb(xyy);
 
     // Apply gamma correction
-    v_color = vec4(gammaf(rgb.r), gammaf(rgb.g),gammaf(rgb.b), 1.0);
-}
-
-#endif
-#ifdef FRAGMENT_SHADER
-
-void main()
-{
-    gl_FragColor = v_color;
+    gl_FragColor = vec4(gammaf(rgb.r), gammaf(rgb.g), gammaf(rgb.b), 1.0);
 }
 
 #endif
@@ -12,6 +12,14 @@ uniform mediump sampler2D   u_tex;
 
 varying highp   vec2        v_tex_pos;
 
+#ifdef HAS_LAYER
+// Second texture composited over the first one.
+uniform mediump vec4        u_layer_color;
+uniform mediump sampler2D   u_layer_tex;
+
+varying highp   vec2        v_layer_tex_pos;
+#endif
+
 #ifdef VERTEX_SHADER
 
 #ifdef PROJ
@@ -20,6 +28,9 @@ varying highp   vec2        v_tex_pos;
 
 attribute highp     vec3    a_pos;
 attribute mediump   vec2    a_tex_pos;
+#ifdef HAS_LAYER
+attribute mediump   vec2    a_layer_tex_pos;
+#endif
 
 void main()
 {
@@ -29,6 +40,9 @@ void main()
     gl_Position = vec4(a_pos, 1.0);
 #endif
     v_tex_pos = a_tex_pos;
+#ifdef HAS_LAYER
+    v_layer_tex_pos = a_layer_tex_pos;
+#endif
 }
 
 #endif
@@ -43,6 +57,17 @@ void main()
     gl_FragColor = u_color;
     gl_FragColor.a *= texture2D(u_tex, v_tex_pos).r;
 #endif
+
+#ifdef HAS_LAYER
+    // Same result as rendering the layer over the base with the usual
+    // alpha blending, but in a single pass.
+    mediump vec4 base = gl_FragColor;
+    mediump vec4 top = texture2D(u_layer_tex, v_layer_tex_pos) *
+                       u_layer_color;
+    gl_FragColor.a = top.a + base.a * (1.0 - top.a);
+    gl_FragColor.rgb = (top.rgb * top.a + base.rgb * base.a * (1.0 - top.a)) /
+                       max(gl_FragColor.a, 0.001);
+#endif
 }
 
 #endif
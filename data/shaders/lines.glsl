@@ -7,7 +7,7 @@
  * repository.
  */
 
-uniform   lowp      vec2    u_win_size;
+uniform   highp     vec2    u_win_size;
 uniform   lowp      float   u_line_width;
 uniform   lowp      float   u_line_glow;
 uniform   lowp      vec4    u_color;
@@ -32,13 +32,29 @@ varying   mediump   vec2    v_uv;
 #includes "projections.glsl"
 
 attribute highp     vec3    a_pos;
-attribute highp     vec2    a_wpos;
-attribute highp     vec2    a_tex_pos;
+attribute highp     vec3    a_prev_pos;
+attribute highp     vec3    a_next_pos;
+attribute highp     vec2    a_tex_pos; // Length and signed half width.
+
+highp vec2 to_win(highp vec4 p)
+{
+    return (p.xy / p.w * vec2(0.5, -0.5) + 0.5) * u_win_size;
+}
 
 void main()
 {
+    highp vec2 win, dir, n;
+
+    // Extrude the line in window coordinates, along the normal of the
+    // direction between the previous and next points.
     gl_Position = proj(a_pos);
-    gl_Position.xy = (a_wpos / u_win_size - 0.5) * vec2(2.0, -2.0);
+    win = to_win(gl_Position);
+    dir = to_win(proj(a_next_pos)) - to_win(proj(a_prev_pos));
+    n = vec2(-dir.y, dir.x);
+    if (dot(n, n) > 0.000001) n = normalize(n);
+    win += n * a_tex_pos.y;
+
+    gl_Position.xy = (win / u_win_size - 0.5) * vec2(2.0, -2.0);
     gl_Position.xy *= gl_Position.w;
     v_uv = a_tex_pos;
 
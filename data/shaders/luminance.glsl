@@ -0,0 +1,57 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * One step of the reduction of the sky buffer to its average luminance
+ * (see render_measure_luminance).  Each output pixel is the average of a
+ * 4x4 grid of samples of the input.
+ *
+ * The values are stored gamma encoded, so that we keep enough precision
+ * in the 8 bits buffers for the dark skies.  With FIRST_PASS the input is
+ * the rendered sky, and we convert the colors to luminance.
+ */
+
+uniform mediump sampler2D   u_tex;
+uniform highp   vec2        u_step; // Distance between the samples.
+
+varying highp   vec2        v_tex_pos;
+
+#ifdef VERTEX_SHADER
+
+attribute highp     vec3    a_pos;
+attribute mediump   vec2    a_tex_pos;
+
+void main()
+{
+    gl_Position = vec4(a_pos, 1.0);
+    v_tex_pos = a_tex_pos;
+}
+
+#endif
+#ifdef FRAGMENT_SHADER
+
+void main()
+{
+    mediump vec3 c;
+    mediump float sum = 0.0;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            c = texture2D(u_tex, v_tex_pos +
+                          (vec2(i, j) - 1.5) * u_step).rgb;
+#ifdef FIRST_PASS
+            sum += dot(pow(c, vec3(2.2)), vec3(0.2126, 0.7152, 0.0722));
+#else
+            sum += pow(c.r, 2.2);
+#endif
+        }
+    }
+    gl_FragColor = vec4(vec3(pow(sum / 16.0, 1.0 / 2.2)), 1.0);
+}
+
+#endif
@@ -0,0 +1,99 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Elliptic orbits lines, evaluated from their elements in the vertex shader.
+ *
+ * All the orbits share the same strip of vertices, with for each the
+ * eccentric anomaly (in turns) and the side of the line.  The orbits are
+ * instances with the position of their focus (the parent body), their
+ * eccentricity, and their semi-major and semi-minor axes vectors in the
+ * view frame, so that a point of the orbit is:
+ *
+ *   pos = focus + A * (cos(E) - e) + B * sin(E)
+ *
+ * Using the eccentric anomaly as parameter, we don't need to solve the
+ * Kepler equation, and the points get closer together around the
+ * perihelion of the very eccentric orbits, where the curvature is the
+ * highest.
+ */
+
+uniform   highp     vec2    u_win_size;
+uniform   lowp      float   u_line_width;
+uniform   lowp      float   u_line_glow;
+uniform   mediump   float   u_half_width; // Of the extruded line, in pixel.
+uniform   highp     float   u_step; // Eccentric anomaly between two points.
+
+varying   mediump   float   v_dist; // Signed distance to the line in pixel.
+varying   lowp      vec4    v_color;
+
+#ifdef VERTEX_SHADER
+
+#include "projections.glsl"
+
+#define TWO_PI 6.28318530718
+
+attribute highp     vec2    a_tex_pos;  // Eccentric anomaly and side.
+attribute highp     vec4    a_pos;      // Focus and eccentricity.
+attribute highp     vec3    a_axis_a;
+attribute highp     vec3    a_axis_b;
+attribute lowp      vec4    a_color;
+
+highp vec3 orbit_pos(highp float u)
+{
+    highp float ea = u * TWO_PI;
+    return a_pos.xyz + a_axis_a * (cos(ea) - a_pos.w) + a_axis_b * sin(ea);
+}
+
+highp vec2 to_win(highp vec4 p)
+{
+    return (p.xy / p.w * vec2(0.5, -0.5) + 0.5) * u_win_size;
+}
+
+void main()
+{
+    highp vec3 pos = orbit_pos(a_tex_pos.x);
+    highp vec4 prev = proj(orbit_pos(a_tex_pos.x - u_step));
+    highp vec4 next = proj(orbit_pos(a_tex_pos.x + u_step));
+    highp vec2 win, dir, n;
+    highp float a = length(a_axis_a);
+    highp float depth = -a_pos.z;
+
+    // Extrude the line in window coordinates, same as the lines shader.
+    gl_Position = proj(pos);
+    win = to_win(gl_Position);
+    dir = to_win(next) - to_win(prev);
+    n = vec2(-dir.y, dir.x);
+    if (dot(n, n) > 0.000001) n = normalize(n);
+    win += n * a_tex_pos.y * u_half_width;
+    gl_Position.xy = (win / u_win_size - 0.5) * vec2(2.0, -2.0);
+    gl_Position.xy *= gl_Position.w;
+    v_dist = a_tex_pos.y * u_half_width;
+
+    // Fade the far part of the orbit, as paint_orbit does.
+    v_color = a_color;
+    v_color.a *= smoothstep(depth + a * 2.0, depth - a, -pos.z);
+    // Hide the segments that cross behind the viewer.
+    if (prev.w <= 0.0 || next.w <= 0.0 || gl_Position.w <= 0.0)
+        v_color.a = 0.0;
+}
+
+#endif
+#ifdef FRAGMENT_SHADER
+
+void main()
+{
+    mediump float dist = abs(v_dist);
+    mediump float base = smoothstep(u_line_width / 2.0 + 1.2,
+                                    u_line_width / 2.0 - 1.2, dist);
+    mediump float glow = (1.0 - dist / 5.0) * u_line_glow;
+    gl_FragColor = vec4(v_color.rgb, v_color.a * max(glow, base));
+}
+
+#endif
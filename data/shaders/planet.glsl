@@ -35,6 +35,15 @@ uniform lowp    int       u_shadow_spheres_nb;
 uniform highp   mat4      u_shadow_spheres;
 #endif
 
+#ifdef HAS_RINGS
+// Rings casting shadow on the planet, with their opacity profile as a
+// function of the radius in the texture alpha.
+uniform mediump sampler2D u_ring_tex;
+uniform highp   vec3      u_ring_center;
+uniform highp   vec3      u_ring_normal;
+uniform highp   vec2      u_ring_radii; // Inner and outer radius.
+#endif
+
 varying highp   vec3 v_mpos;
 varying mediump vec2 v_tex_pos;
 varying mediump vec2 v_normal_tex_pos;
@@ -162,6 +171,27 @@ float illumination(highp vec3 p)
 #endif
 }
 
+#ifdef HAS_RINGS
+/*
+ * Compute the fraction of the sun light that goes through the rings.
+ * Parameters:
+ *   p       - The surface point where we compute the illumination.
+ */
+float ring_transmission(highp vec3 p)
+{
+    highp vec3 dir = normalize(u_sun.xyz - p);
+    highp float d = dot(dir, u_ring_normal);
+    highp float t, r;
+    if (abs(d) < 0.000001) return 1.0;
+    t = dot(u_ring_center - p, u_ring_normal) / d;
+    if (t <= 0.0) return 1.0; // Rings plane behind the point.
+    r = length(p + dir * t - u_ring_center);
+    if (r < u_ring_radii.x || r > u_ring_radii.y) return 1.0;
+    r = (r - u_ring_radii.x) / (u_ring_radii.y - u_ring_radii.x);
+    return 1.0 - texture2D(u_ring_tex, vec2(0.5, r)).a;
+}
+#endif
+
 void main()
 {
     vec3 light_dir = normalize(u_sun.xyz - v_mpos);
@@ -185,6 +215,9 @@ void main()
         lowp float illu = illumination(v_mpos);
         power *= illu;
         #endif
+        #ifdef HAS_RINGS
+        power *= ring_transmission(v_mpos);
+        #endif
 
         power = max(power, u_min_brightness);
         color *= power;
@@ -204,6 +237,10 @@ void main()
 
     } else if (u_material == 2) { // ring
         lowp float illu = illumination(v_mpos);
+        // When we see the unlit side, we only get the light scattered
+        // through the rings, so the dense parts are the darkest.
+        if (dot(v_normal, u_sun.xyz - v_mpos) * dot(v_normal, v_mpos) > 0.0)
+            illu *= 1.0 - base_color.a;
         illu = max(illu, u_min_brightness);
         color *= illu;
     }
@@ -15,17 +15,35 @@ uniform lowp vec4 u_color;
 uniform lowp float u_core_size;
 
 varying lowp    vec4 v_color;
+varying mediump float v_core_size;
+varying lowp    float v_halo;
+
+// With PICK set, we render the points cores with their object id as color
+// instead, see render_pick.
+#ifdef PICK
+varying mediump vec4 v_id; // Exact 8 bits values.
+#endif
+
+// Relative size of the core of the points without halo, with a margin for
+// the smooth edge.
+#define NO_HALO_CORE_SIZE 0.8
 
 #ifdef VERTEX_SHADER
 
 attribute lowp    vec4  a_color;
 attribute mediump float a_size;
+attribute lowp    float a_halo; // 1 to render the halo, otherwise 0.
+#ifdef PICK
+attribute mediump vec4  a_id;
+#endif
 
 #ifdef IS_3D
     #include "projections.glsl"
     attribute highp   vec3  a_pos;
 #else
     attribute highp   vec2  a_pos;
+    // Late correction of the view, in NDC (see render_set_late_view).
+    uniform highp     mat3  u_ndc_late;
 #endif
 
 void main()
@@ -33,11 +51,22 @@ void main()
     #ifdef IS_3D
         gl_Position = proj(a_pos);
     #else
-        gl_Position = vec4(a_pos, 1.0, 1.0);
+        gl_Position = vec4((u_ndc_late * vec3(a_pos, 1.0)).xy, 1.0, 1.0);
     #endif
 
-    gl_PointSize = a_size * 2.0 / u_core_size;
+    // The points without halo get a much smaller sprite.
+    v_core_size = mix(max(u_core_size, NO_HALO_CORE_SIZE), u_core_size,
+                      a_halo);
+    v_halo = a_halo;
+    gl_PointSize = a_size * 2.0 / v_core_size;
     v_color = a_color * u_color;
+
+    #ifdef PICK
+        // Make sure the small points still cover a few pixels.
+        v_core_size = 1.0;
+        gl_PointSize = max(a_size * 2.0, 3.0);
+        v_id = a_id;
+    #endif
 }
 
 #endif
@@ -49,11 +78,17 @@ void main()
     mediump float k;
     dist = 2.0 * distance(gl_PointCoord, vec2(0.5, 0.5));
 
+    #ifdef PICK
+        if (v_id.a == 0.0 || dist > 1.0) discard;
+        gl_FragColor = v_id;
+        return;
+    #endif
+
     // Center bright point.
-    k = smoothstep(u_core_size * 1.25, u_core_size * 0.75, dist);
+    k = smoothstep(v_core_size * 1.25, v_core_size * 0.75, dist);
 
     // Halo
-    k += smoothstep(1.0, 0.0, dist) * 0.08;
+    k += smoothstep(1.0, 0.0, dist) * 0.08 * v_halo;
     gl_FragColor.rgb = v_color.rgb;
     gl_FragColor.a = v_color.a * clamp(k, 0.0, 1.0);
 }
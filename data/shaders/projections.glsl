@@ -10,30 +10,36 @@
 /*
  * Helper to perform different non linear projection.
  *
- * Define one function: vec4 proj(vec3).
+ * Define one function: vec4 proj(vec3), that first applies the late
+ * view rotation to the view position.
  *
  * PROJ should be defined with the id of the projection used.
  */
 
 #define PROJ_PERSPECTIVE        1
 #define PROJ_STEROGRAPHIC       2
+#define PROJ_MERCATOR           3
+#define PROJ_HAMMER             4
 #define PROJ_MOLLWEIDE          5
+#define PROJ_FISHEYE            6
 
 #ifndef PROJ
 #error PROJ undefined
 #endif
 
 uniform highp mat4 u_proj_mat;
+// Late correction of the view orientation, see render_set_late_view.
+uniform highp mat3 u_view_late;
 
 #if (PROJ == PROJ_PERSPECTIVE)
-highp vec4 proj(highp vec3 pos) {
+highp vec4 proj_(highp vec3 pos) {
     return u_proj_mat * vec4(pos, 1.0);
 }
 #endif
 
 #if (PROJ == PROJ_STEROGRAPHIC)
 
-highp vec4 proj(highp vec3 pos) {
+highp vec4 proj_(highp vec3 pos) {
     highp float dist = length(pos);
     highp vec3 p = pos / dist;
     p.xy /= 0.5 * (1.0 - p.z);
@@ -44,6 +50,51 @@ highp vec4 proj(highp vec3 pos) {
 
 #endif
 
+#if (PROJ == PROJ_MERCATOR)
+
+highp vec4 proj_(highp vec3 v)
+{
+    highp float dist = length(v);
+    highp vec3 p = v / dist;
+    // Avoid the infinite values at the poles.
+    highp float s = clamp(p.y, -0.9999999, 0.9999999);
+
+    p.x = atan(p.x, -p.z);
+    p.y = 0.5 * log((1.0 + s) / (1.0 - s));
+    p.z = -1.0;
+    p *= dist;
+    vec4 ret = u_proj_mat * vec4(p, 1.0);
+    ret.z = 0.0;
+    ret.w = 1.0;
+    return ret;
+}
+
+#endif
+
+#if (PROJ == PROJ_HAMMER)
+
+#define SQRT2 1.4142135623730951
+
+highp vec4 proj_(highp vec3 v)
+{
+    highp float dist = length(v);
+    highp float alpha = atan(v.x, -v.z);
+    highp float cos_delta = sqrt(max(0.0, 1.0 - v.y * v.y / (dist * dist)));
+    highp float z = sqrt(1.0 + cos_delta * cos(alpha / 2.0));
+
+    highp vec3 p;
+    p.x = 2.0 * SQRT2 * cos_delta * sin(alpha / 2.0) / z;
+    p.y = SQRT2 * v.y / dist / z;
+    p.z = -1.0;
+    p *= dist;
+    vec4 ret = u_proj_mat * vec4(p, 1.0);
+    ret.z = 0.0;
+    ret.w = 1.0;
+    return ret;
+}
+
+#endif
+
 #if (PROJ == PROJ_MOLLWEIDE)
 
 #define PI 3.14159265
@@ -51,7 +102,7 @@ highp vec4 proj(highp vec3 pos) {
 #define PRECISION 1e-7
 #define SQRT2 1.4142135623730951
 
-highp vec4 proj(highp vec3 v)
+highp vec4 proj_(highp vec3 v)
 {
     highp float dist = length(v);
     highp float phi, lambda, theta, d, k;
@@ -80,3 +131,24 @@ highp vec4 proj(highp vec3 v)
 }
 
 #endif
+
+#if (PROJ == PROJ_FISHEYE)
+
+highp vec4 proj_(highp vec3 pos) {
+    highp float dist = length(pos);
+    highp vec3 p = pos / dist;
+    highp float r = length(p.xy);
+    // Angle from the view direction.
+    highp float theta = atan(r, -p.z);
+    if (r > 0.0) p.xy *= theta / r;
+    p.z = -1.0;
+    p *= dist;
+    return u_proj_mat * vec4(p, 1.0);
+}
+
+#endif
+
+highp vec4 proj(highp vec3 pos)
+{
+    return proj_(u_view_late * pos);
+}
@@ -0,0 +1,104 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Static mesh rendering.  The vertices are in the mesh frame, with the
+ * feature index in the fourth coordinate.  The features colors and flags
+ * are read from the u_tex texture, four texels per feature: fill color,
+ * stroke color, flags (blink, hidden) and one unused texel.
+ *
+ * STROKE should be defined to use the stroke color instead of the fill
+ * color, and REFRACTION to apply the atmospheric refraction.
+ */
+
+varying   lowp    vec4 v_color;
+
+#ifdef VERTEX_SHADER
+
+#includes "projections.glsl"
+
+#define FEATURES_PER_ROW 256.0
+#define DD2R 0.017453292519943295
+// Same values as in src/algos/refraction.c.
+#define MIN_GEO_ALTITUDE_DEG (-3.54)
+#define TRANSITION_WIDTH_GEO_DEG 1.46
+
+attribute highp   vec4 a_pos;
+
+uniform   highp   mat3 u_mat;   // Mesh frame to view or observed geom.
+uniform   lowp    vec4 u_color;
+uniform   lowp    float u_blink;
+uniform   highp   vec2 u_tex_size;
+uniform   highp   sampler2D u_tex;
+
+#ifdef REFRACTION
+uniform   highp   mat3 u_ro2v;  // Observed to view.
+uniform   highp   vec2 u_refraction; // Pressure and temperature.
+
+// Port of the refraction function of src/algos/refraction.c.
+highp vec3 refraction(highp vec3 v)
+{
+    highp float alt, r;
+    highp float p = 1.02 * u_refraction.x / 1010.0 * 283.0 /
+                    (273.0 + u_refraction.y) / 60.0;
+
+    if (v.z < sin((MIN_GEO_ALTITUDE_DEG - TRANSITION_WIDTH_GEO_DEG) * DD2R))
+        return v;
+    alt = asin(clamp(v.z, -1.0, 1.0)) / DD2R;
+    if (alt > MIN_GEO_ALTITUDE_DEG) {
+        r = p / tan((alt + 10.3 / (alt + 5.11)) * DD2R) + 0.0019279;
+        alt = min(alt + r, 90.0);
+    } else {
+        r = p / tan((MIN_GEO_ALTITUDE_DEG + 10.3 /
+                    (MIN_GEO_ALTITUDE_DEG + 5.11)) * DD2R) + 0.0019279;
+        alt += r * (alt - (MIN_GEO_ALTITUDE_DEG - TRANSITION_WIDTH_GEO_DEG)) /
+               TRANSITION_WIDTH_GEO_DEG;
+    }
+    return normalize(vec3(v.xy, sin(alt * DD2R)));
+}
+#endif
+
+lowp vec4 get_texel(highp float feature, highp float i)
+{
+    highp vec2 p;
+    p.y = floor(feature / FEATURES_PER_ROW);
+    p.x = (feature - p.y * FEATURES_PER_ROW) * 4.0 + i;
+    return texture2D(u_tex, (p + 0.5) / u_tex_size);
+}
+
+void main()
+{
+    highp vec3 pos = u_mat * a_pos.xyz;
+    lowp vec4 flags = get_texel(a_pos.w, 2.0);
+
+#ifdef REFRACTION
+    pos = u_ro2v * refraction(pos);
+#endif
+
+#ifdef STROKE
+    v_color = get_texel(a_pos.w, 1.0) * u_color;
+#else
+    v_color = get_texel(a_pos.w, 0.0) * u_color;
+    if (flags.r > 0.5) v_color.a *= u_blink;
+#endif
+
+    gl_Position = proj(pos);
+    // Move the hidden features outside of the clipping volume.
+    if (flags.g > 0.5) gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+}
+
+#endif
+#ifdef FRAGMENT_SHADER
+
+void main()
+{
+    gl_FragColor = v_color;
+}
+
+#endif
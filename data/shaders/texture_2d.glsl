@@ -23,6 +23,10 @@ varying highp   vec2        v_tex_pos;
 attribute highp     vec2    a_wpos;
 attribute mediump   vec2    a_tex_pos;
 
+// Late correction of the view, in window coordinates (see
+// render_set_late_view).
+uniform highp       mat3    u_win_late;
+
 void main()
 {
     #ifdef HAS_VIEW_POS
@@ -30,7 +34,8 @@ void main()
     #else
         gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
     #endif
-    gl_Position.xy = (a_wpos / u_win_size - 0.5) * vec2(2.0, -2.0);
+    highp vec2 wpos = (u_win_late * vec3(a_wpos, 1.0)).xy;
+    gl_Position.xy = (wpos / u_win_size - 0.5) * vec2(2.0, -2.0);
     gl_Position.xy *= gl_Position.w;
     v_tex_pos = a_tex_pos;
 }
@@ -0,0 +1,67 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Upsample of the reduced resolution atmosphere and fog buffer (see
+ * atm_fb_begin in render_gl.c).
+ *
+ * A plain bilinear upsample would blur the sharp edges of the atmosphere
+ * and fog meshes at the horizon.  Instead we weight the four nearest
+ * texels both by their bilinear weight and by how close their color is to
+ * the nearest texel, so that we don't mix the values across an edge.
+ */
+
+uniform mediump sampler2D   u_tex;
+uniform highp   vec2        u_size; // Size of the texture in pixels.
+
+varying highp   vec2        v_tex_pos;
+
+#ifdef VERTEX_SHADER
+
+attribute highp     vec3    a_pos;
+attribute mediump   vec2    a_tex_pos;
+
+void main()
+{
+    gl_Position = vec4(a_pos, 1.0);
+    v_tex_pos = a_tex_pos;
+}
+
+#endif
+#ifdef FRAGMENT_SHADER
+
+// Edge stopping weight.  A difference of 0.1 in all the channels gives a
+// weight of about 0.1.
+mediump float similarity(mediump vec4 c, mediump vec4 ref)
+{
+    mediump vec4 d = c - ref;
+    return exp(-dot(d, d) * 60.0);
+}
+
+void main()
+{
+    highp vec2 p = v_tex_pos * u_size - 0.5;
+    highp vec2 f = fract(p);
+    highp vec2 base = (floor(p) + 0.5) / u_size;
+    highp vec2 texel = 1.0 / u_size;
+    mediump vec4 c00 = texture2D(u_tex, base);
+    mediump vec4 c10 = texture2D(u_tex, base + vec2(texel.x, 0.0));
+    mediump vec4 c01 = texture2D(u_tex, base + vec2(0.0, texel.y));
+    mediump vec4 c11 = texture2D(u_tex, base + texel);
+    mediump vec4 ref = f.x < 0.5 ? (f.y < 0.5 ? c00 : c01) :
+                                   (f.y < 0.5 ? c10 : c11);
+    mediump vec4 w = vec4((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y),
+                          (1.0 - f.x) * f.y, f.x * f.y);
+    w *= vec4(similarity(c00, ref), similarity(c10, ref),
+              similarity(c01, ref), similarity(c11, ref));
+    gl_FragColor = (c00 * w.x + c10 * w.y + c01 * w.z + c11 * w.w) /
+                   max(dot(w, vec4(1.0)), 0.0001);
+}
+
+#endif
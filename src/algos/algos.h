@@ -93,6 +93,21 @@ int moon_pos(double jde, double *lambda, double *beta, double *dist);
 int pluto_pos(double tt_mjd, double pos[3]);
 
 
+/*
+ * Function: eclipse_factor
+ * Compute the visible fraction of a disk partially covered by an other one.
+ *
+ * Parameters:
+ *   r      - Angular radius of the covered disk (rad).
+ *   br     - Angular radius of the blocking disk (rad).
+ *   sep    - Separation between the two disks centers (rad).
+ *
+ * Return:
+ *   The visible fraction of the covered disk, from 0 (totally covered)
+ *   to 1 (no eclipse).
+ */
+double eclipse_factor(double r, double br, double sep);
+
 /* Compute delta-t
  *
  * inputs:
@@ -168,6 +183,29 @@ void refraction_inv(const double v[3], double refa, double refb,
 void refraction_prepare(double phpa, double tc, double rh,
                         double *refa, double *refb);
 
+/*
+ * Function: refraction_lut_init
+ * Tabulate the refraction for the <refraction_lut> and <refraction_lut_inv>
+ * functions.
+ *
+ * Parameters:
+ *   refa   - Refraction A argument.
+ *   refb   - Refraction B argument.
+ *   n      - Size of the table.
+ *   lut    - Output table.
+ */
+void refraction_lut_init(double refa, double refb, int n, double (*lut)[2]);
+
+/*
+ * Function: refraction_lut
+ * Same as <refraction>, but using linear interpolation in a table
+ * computed with <refraction_lut_init>.
+ */
+void refraction_lut(const double v[3], int n, const double (*lut)[2],
+                    double out[3]);
+void refraction_lut_inv(const double v[3], int n, const double (*lut)[2],
+                        double out[3]);
+
 
 /* Galilean satellites positions using l1.2 semi-analytic theory by
  * L.Duriez.
@@ -213,6 +251,8 @@ void gust86(double jd, int body, double xyz[3], double xyzdot[3]);
  * Returns:
  *   The index of the constellation.
  *
+ * The first call builds a lookup table of the constellations per healpix
+ * pixel, after that the function is fast and thread safe.
  */
 int find_constellation_at(const double pos[3], char id[5]);
 
@@ -254,6 +294,24 @@ int orbit_compute_pv(
         double od,        // variation of o in time (rad/day).
         double wd);       // variation of w in time (rad/day).
 
+/*
+ * Function: orbit_compute_pv_batch
+ * Compute positions and speeds of several bodies from their orbit elements.
+ *
+ * Same as calling <orbit_compute_pv> with a zero precision and no elements
+ * variations for each body, but written so that the loop can be
+ * vectorized.
+ *
+ * Parameters:
+ *   nb         - Number of bodies.
+ *   mjd        - Time of the positions (MJD).
+ *   elements   - For each body: d, i, o, w, a, n, e, ma, with the same
+ *                units as for <orbit_compute_pv>.
+ *   pv         - Get the computed positions and speeds.
+ */
+void orbit_compute_pv_batch(int nb, double mjd, const double (*elements)[8],
+                            double (*pv)[2][3]);
+
 /*
  * Function: orbit_elements_from_pv
  * Compute Kepler orbit element from a body positon and speed.
@@ -287,3 +345,18 @@ int orbit_elements_from_pv(const double p[3], const double v[3], double mu,
  * Convert a B-V color index value to an RGB color.
  */
 void bv_to_rgb(double bv, double rgb[3]);
+
+/*
+ * Function: chebyshev_eval_pv
+ * Evaluate a 3d Chebyshev series and its time derivative.
+ *
+ * Parameters:
+ *   nb     - Number of coefficients per axis.
+ *   coefs  - The x, y and z axes coefficients (3 * nb values).
+ *   x      - Normalized time in the series interval, in [-1, 1].
+ *   scale  - Derivative of x with respect to the time, to compute the
+ *            speed (2 / interval length).
+ *   pv     - Output position and speed.
+ */
+void chebyshev_eval_pv(int nb, const double *coefs, double x, double scale,
+                       double pv[2][3]);
@@ -0,0 +1,314 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Microbenchmarks of the algos functions.
+ *
+ * Each benchmark runs a single function over a table of inputs generated
+ * once with a fixed seed, and distributed like the values the engine
+ * actually uses (uniform directions on the sky, asteroids and comets
+ * eccentricities, dates around now...), so that the timings don't depend
+ * on a lucky branch.  The loop is repeated until it ran for at least
+ * BENCH_MIN_TIME, so that the timer resolution doesn't matter.
+ *
+ * Only compiled in profile mode, see apps/simple-html/bench.html and
+ * tools/bench.py for how the results are collected and compared with a
+ * baseline.
+ */
+
+#if COMPILE_BENCH
+
+#include "algos.h"
+#include "erfa.h"
+#include "sgp4.h"
+#include "utils/utils.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __EMSCRIPTEN__
+#   include <emscripten.h>
+#else
+#   define EMSCRIPTEN_KEEPALIVE
+#endif
+
+#define NB_INPUTS 1024 // Must be a power of two.
+#define BENCH_MIN_TIME 0.05 // sec.
+#define MJD_2020 58849.0
+#define DJM0 2400000.5
+
+typedef struct {
+    double v[3];    // Unit vector.
+    double t;       // MJD.
+    double x;       // Generic scalar, depends on the benchmark.
+    int    n;       // Generic integer, depends on the benchmark.
+} input_t;
+
+typedef struct {
+    const char *name;
+    // Run the function on the input i, and return a value that we sum, so
+    // that the compiler doesn't optimize the call away.
+    double (*fn)(const input_t *in);
+} bench_t;
+
+static input_t g_inputs[NB_INPUTS];
+static double g_refa, g_refb;
+static double g_refraction_lut[1024][2];
+static sgp4_elsetrec_t *g_iss;
+
+// Xorshift, so that the inputs are the same on all the platforms.
+static double rand_uniform(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s / 4294967296.0;
+}
+
+static void init_inputs(void)
+{
+    int i;
+    uint32_t s = 0x12345678;
+    double z, a, r;
+    double tc = 15, rh = 0.5, phpa = 1013.25;
+    double startmfe, stopmfe, deltamin;
+    // The sgp4 parser reads 130 bytes per line.
+    static const char tle1[130] =
+        "1 25544U 98067A   20001.50000000  .00000600  00000-0  18000-4 0  9990";
+    static const char tle2[130] =
+        "2 25544  51.6440 120.0000 0005000 100.0000 260.0000 15.49000000 10000";
+
+    for (i = 0; i < NB_INPUTS; i++) {
+        z = rand_uniform(&s) * 2 - 1;
+        a = rand_uniform(&s) * 2 * M_PI;
+        r = sqrt(1 - z * z);
+        g_inputs[i].v[0] = r * cos(a);
+        g_inputs[i].v[1] = r * sin(a);
+        g_inputs[i].v[2] = z;
+        // Dates spread over +/- 50 years around 2020.
+        g_inputs[i].t = MJD_2020 + (rand_uniform(&s) - 0.5) * 36525;
+        g_inputs[i].x = rand_uniform(&s);
+        g_inputs[i].n = (int)(rand_uniform(&s) * 65536);
+    }
+    refraction_prepare(phpa, tc, rh, &g_refa, &g_refb);
+    refraction_lut_init(g_refa, g_refb, 1024, g_refraction_lut);
+    g_iss = sgp4_twoline2rv(tle1, tle2, 'c', 'm', 'i',
+                            &startmfe, &stopmfe, &deltamin);
+}
+
+static double bench_healpix_vec2pix(const input_t *in)
+{
+    return healpix_vec2pix(1 << (in->n % 10), in->v);
+}
+
+static double bench_healpix_pix2vec(const input_t *in)
+{
+    double v[3];
+    int nside = 1 << (in->n % 10);
+    healpix_pix2vec(nside, in->n % (12 * nside * nside), v);
+    return v[0];
+}
+
+static double bench_healpix_get_boundaries(const input_t *in)
+{
+    double v[4][3];
+    int nside = 1 << (in->n % 10);
+    healpix_get_boundaries(nside, in->n % (12 * nside * nside), v);
+    return v[0][0];
+}
+
+// Main belt asteroid like orbit.
+static double bench_orbit_asteroid(const input_t *in)
+{
+    double p[3], v[3];
+    double a = 2.2 + in->x * 1.2;
+    orbit_compute_pv(0, in->t, p, v, MJD_2020, 0.1, 1.0, 2.0, a,
+                     0.01720209895 / pow(a, 1.5), in->x * 0.3,
+                     in->v[0] * M_PI, 0, 0);
+    return p[0];
+}
+
+// Long period comet like orbit, where the Kepler equation is the hardest.
+static double bench_orbit_comet(const input_t *in)
+{
+    double p[3], v[3];
+    double a = 50 + in->x * 200;
+    orbit_compute_pv(0, in->t, p, v, MJD_2020, 1.0, 1.0, 2.0, a,
+                     0.01720209895 / pow(a, 1.5), 0.9 + in->x * 0.099,
+                     in->v[0] * M_PI, 0, 0);
+    return p[0];
+}
+
+static double bench_tass17(const input_t *in)
+{
+    double p[3], v[3];
+    tass17(DJM0 + in->t, in->n % 8, p, v);
+    return p[0];
+}
+
+static double bench_gust86(const input_t *in)
+{
+    double p[3], v[3];
+    gust86(DJM0 + in->t, in->n % 5, p, v);
+    return p[0];
+}
+
+static double bench_l12(const input_t *in)
+{
+    double pv[2][3];
+    l12(DJM0, in->t, in->n % 4 + 1, pv);
+    return pv[0][0];
+}
+
+static double bench_moon_pos(const input_t *in)
+{
+    double lambda, beta, dist;
+    moon_pos(DJM0 + in->t, &lambda, &beta, &dist);
+    return lambda;
+}
+
+static double bench_refraction(const input_t *in)
+{
+    double v[3];
+    refraction(in->v, g_refa, g_refb, v);
+    return v[2];
+}
+
+static double bench_refraction_lut(const input_t *in)
+{
+    double v[3];
+    refraction_lut(in->v, 1024, g_refraction_lut, v);
+    return v[2];
+}
+
+static double bench_bv_to_rgb(const input_t *in)
+{
+    double rgb[3];
+    bv_to_rgb(-0.4 + in->x * 2.4, rgb);
+    return rgb[0];
+}
+
+static double bench_find_constellation_at(const input_t *in)
+{
+    char id[5];
+    return find_constellation_at(in->v, id);
+}
+
+// Within three days of the TLE epoch, as for the visible satellites.
+static double bench_sgp4(const input_t *in)
+{
+    double r[3], v[3];
+    sgp4(g_iss, MJD_2020 + 0.5 + (in->x - 0.5) * 6, r, v);
+    return r[0];
+}
+
+static double bench_era_epv00(const input_t *in)
+{
+    double pvh[2][3], pvb[2][3];
+    eraEpv00(DJM0, in->t, pvh, pvb);
+    return pvh[0][0];
+}
+
+static double bench_era_pnm06a(const input_t *in)
+{
+    double rnpb[3][3];
+    eraPnm06a(DJM0, in->t, rnpb);
+    return rnpb[0][0];
+}
+
+static const bench_t BENCHS[] = {
+    {"healpix_vec2pix",         bench_healpix_vec2pix},
+    {"healpix_pix2vec",         bench_healpix_pix2vec},
+    {"healpix_get_boundaries",  bench_healpix_get_boundaries},
+    {"orbit_asteroid",          bench_orbit_asteroid},
+    {"orbit_comet",             bench_orbit_comet},
+    {"tass17",                  bench_tass17},
+    {"gust86",                  bench_gust86},
+    {"l12",                     bench_l12},
+    {"moon_pos",                bench_moon_pos},
+    {"refraction",              bench_refraction},
+    {"refraction_lut",          bench_refraction_lut},
+    {"bv_to_rgb",               bench_bv_to_rgb},
+    {"find_constellation_at",   bench_find_constellation_at},
+    {"sgp4",                    bench_sgp4},
+    {"era_epv00",               bench_era_epv00},
+    {"era_pnm06a",              bench_era_pnm06a},
+};
+
+static double get_time(void)
+{
+#ifdef __EMSCRIPTEN__
+    return emscripten_get_now() / 1000.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static volatile double g_sink;
+
+// Return the time in sec of nb calls to the function.
+static double run_bench(const bench_t *bench, int nb)
+{
+    int i;
+    double start, sum = 0;
+    start = get_time();
+    for (i = 0; i < nb; i++)
+        sum += bench->fn(&g_inputs[i & (NB_INPUTS - 1)]);
+    g_sink = sum;
+    return get_time() - start;
+}
+
+/*
+ * Function: algos_bench_run
+ * Run the algos microbenchmarks.
+ *
+ * Parameters:
+ *   filter - If set, only run the benchmarks whose name contains this
+ *            string.
+ *
+ * Return:
+ *   A newly allocated json string with for each benchmark the attributes:
+ *   ns_per_op, ops_per_sec and nb (number of calls timed).
+ */
+EMSCRIPTEN_KEEPALIVE
+char *algos_bench_run(const char *filter)
+{
+    int i, nb, size = 0;
+    double t;
+    char *ret;
+    const bench_t *bench;
+    const int nb_benchs = ARRAY_SIZE(BENCHS);
+
+    if (!g_iss) init_inputs();
+    ret = calloc(nb_benchs, 128);
+    size += sprintf(ret, "{");
+    for (i = 0; i < nb_benchs; i++) {
+        bench = &BENCHS[i];
+        if (filter && !strstr(bench->name, filter)) continue;
+        run_bench(bench, NB_INPUTS); // Warm up the caches and tables.
+        for (nb = NB_INPUTS; ; nb *= 2) {
+            t = run_bench(bench, nb);
+            if (t >= BENCH_MIN_TIME || nb >= (1 << 28)) break;
+        }
+        size += sprintf(ret + size,
+                "%s\"%s\": {\"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, "
+                "\"nb\": %d}", size > 1 ? ", " : "", bench->name,
+                t * 1e9 / nb, nb / t, nb);
+    }
+    sprintf(ret + size, "}");
+    return ret;
+}
+
+#endif // COMPILE_BENCH
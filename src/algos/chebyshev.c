@@ -0,0 +1,78 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "swe.h"
+
+void chebyshev_eval_pv(int nb, const double *coefs, double x, double scale,
+                       double pv[2][3])
+{
+    int i, k;
+    double t[2], dt[2], tn, dtn; // T(n-2), T(n-1) and their derivatives.
+
+    for (i = 0; i < 3; i++) {
+        pv[0][i] = coefs[i * nb];
+        pv[1][i] = 0;
+    }
+    if (nb < 2) return;
+    t[0] = 1;
+    t[1] = x;
+    dt[0] = 0;
+    dt[1] = 1;
+    for (i = 0; i < 3; i++) {
+        pv[0][i] += coefs[i * nb + 1] * x;
+        pv[1][i] += coefs[i * nb + 1];
+    }
+    for (k = 2; k < nb; k++) {
+        tn = 2 * x * t[1] - t[0];
+        dtn = 2 * t[1] + 2 * x * dt[1] - dt[0];
+        for (i = 0; i < 3; i++) {
+            pv[0][i] += coefs[i * nb + k] * tn;
+            pv[1][i] += coefs[i * nb + k] * dtn;
+        }
+        t[0] = t[1];
+        t[1] = tn;
+        dt[0] = dt[1];
+        dt[1] = dtn;
+    }
+    for (i = 0; i < 3; i++) pv[1][i] *= scale;
+}
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+static void test_chebyshev(void)
+{
+    int i, k;
+    const int nb = 6;
+    double coefs[3 * 6], x, v, dv, pv[2][3];
+
+    for (i = 0; i < 3 * nb; i++) coefs[i] = 1.0 / (i + 1);
+    for (x = -1; x <= 1; x += 0.125) {
+        chebyshev_eval_pv(nb, coefs, x, 0.5, pv);
+        for (i = 0; i < 3; i++) {
+            // Direct computation using T(n)(cos(t)) = cos(nt).
+            v = dv = 0;
+            for (k = 0; k < nb; k++) {
+                v += coefs[i * nb + k] * cos(k * acos(x));
+                if (fabs(x) < 1)
+                    dv += coefs[i * nb + k] * k * sin(k * acos(x)) /
+                          sqrt(1 - x * x);
+                else
+                    dv += coefs[i * nb + k] * k * k * pow(x, k + 1);
+            }
+            assert(fabs(pv[0][i] - v) < 1e-12);
+            assert(fabs(pv[1][i] - dv * 0.5) < 1e-9);
+        }
+    }
+}
+
+TEST_REGISTER(NULL, test_chebyshev, TEST_AUTO)
+
+#endif
@@ -8,9 +8,15 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "algos/algos.h"
 #include "utils/vec.h"
 #include "erfa_wrap.h"
 
@@ -2344,65 +2350,149 @@ static bool test_cst(const struct cst *cst, double ra, double dec)
     return n % 2 == 1;
 }
 
-static bool cache_contains(const int cache[4], int value)
+/*
+ * Lookup table of the constellation of each healpix pixel of order
+ * TABLE_ORDER in B1875 coordinates, as the constellation index + 1.  The
+ * pixels crossed by a boundary are set to zero, and use the exact test.
+ */
+#define TABLE_ORDER 8
+#define TABLE_NSIDE (1 << TABLE_ORDER)
+#define TABLE_NPIX (12 * TABLE_NSIDE * TABLE_NSIDE)
+
+static uint8_t *g_table = NULL;
+
+// Rotation matrix from J2000 to 1875.0.  Computed with erfa:
+//     eraEpb2jd(1875.0, &djm0, &djm);
+//     eraPnm06a(djm0, djm, rnpb);
+static const double RNPB[3][3] = {
+    {0.999535020565168, 0.027962538774844, 0.012158909862936},
+    {-0.027962067406873, 0.999608963139696, -0.000208799220464},
+    {-0.012159993837296, -0.000131286124061, 0.999926055923052},
+};
+
+static int find_exact(const double pos_b1875[3])
 {
     int i;
-    for (i = 0; i < 4; i++) {
-        if (cache[i] == -1) return false;
-        if (cache[i] == value) return true;
+    double ra, dec;
+
+    vec3_to_sphe(pos_b1875, &ra, &dec);
+    for (i = 0; CSTS[i].id[0]; i++) {
+        if (test_cst(&CSTS[i], ra, dec)) return i;
     }
-    return false;
+    return -1;
 }
 
-static void add_to_cache(int cache[4], int value)
+// Mark a pixel and all its neighbours as crossed by a boundary.
+static void mark_boundary(uint8_t *table, double ra, double dec)
 {
-    int i;
-    if (cache_contains(cache, value)) return;
-    for (i = 3; i > 0; i--)
-        cache[i] = cache[i - 1];
-    cache[0] = value;
+    int pix, neighbours[8], i;
+    healpix_ang2pix(TABLE_NSIDE, M_PI / 2 - dec, ra, &pix);
+    table[pix] = 0;
+    healpix_get_neighbours(TABLE_NSIDE, pix, neighbours);
+    for (i = 0; i < 8; i++) {
+        if (neighbours[i] != -1) table[neighbours[i]] = 0;
+    }
 }
 
-int find_constellation_at(const double pos[3], char id[5])
+/*
+ * Build the lookup table.  All the boundaries are along constant ra or
+ * constant dec lines, so we sample them with a step smaller than the
+ * pixels to mark the boundary pixels, and then flood fill the regions in
+ * between, with only one exact test per region.
+ */
+static void build_table(void)
 {
-    const struct cst *cst;
-    int i, ret;
-    double pos_b1875[3];
-    double ra, dec;
-    // Cache of last results for faster computation.
-    static int cache[4] = {-1, -1, -1, -1};
+    const double step = sqrt(4 * M_PI / TABLE_NPIX) / 4;
+    const double *a, *b;
+    double da, dd, len, pos[3];
+    int c, i, j, n, nb, pix, neighbours[8], *stack, sp, v;
+    uint8_t *table;
 
-    // Rotation matrix from J2000 to 1875.0.  Computed with erfa:
-    //     eraEpb2jd(1875.0, &djm0, &djm);
-    //     eraPnm06a(djm0, djm, rnpb);
-    const double rnpb[3][3] = {
-        {0.999535020565168, 0.027962538774844, 0.012158909862936},
-        {-0.027962067406873, 0.999608963139696, -0.000208799220464},
-        {-0.012159993837296, -0.000131286124061, 0.999926055923052},
-    };
-    eraRxp(rnpb, pos, pos_b1875);
-    vec3_to_sphe(pos_b1875, &ra, &dec);
-
-    // Test the last cached values first.
-    for (i = 0; i < 4; i++) {
-        if (cache[i] == -1) break;
-        if (test_cst(&CSTS[cache[i]], ra, dec)) {
-            ret = cache[i];
-            if (id) memcpy(id, CSTS[ret].id, 5);
-            add_to_cache(cache, ret);
-            return ret;
+    table = malloc(TABLE_NPIX);
+    memset(table, 255, TABLE_NPIX); // 255: not computed yet.
+    for (c = 0; CSTS[c].id[0]; c++) {
+        for (i = 0; i < CSTS[c].n; i++) {
+            a = CSTS[c].points[i];
+            b = CSTS[c].points[(i + 1) % CSTS[c].n];
+            // Smallest arc in ra, as for arc_contains.
+            da = fmod(b[0] - a[0] + 3 * M_PI, 2 * M_PI) - M_PI;
+            dd = b[1] - a[1];
+            len = fabs(dd) + fabs(da) * cos(fmin(fabs(a[1]), M_PI / 2));
+            n = ceil(len / step) + 1;
+            for (j = 0; j <= n; j++)
+                mark_boundary(table, a[0] + da * j / n, a[1] + dd * j / n);
         }
     }
 
-    for (i = 0; ((cst = &CSTS[i]))->id[0]; i++) {
-        if (cache_contains(cache, i)) continue;
-        if (test_cst(cst, ra, dec)) {
-            ret = i;
-            add_to_cache(cache, ret);
-            if (id) memcpy(id, cst->id, 5);
-            return ret;
+    stack = malloc(TABLE_NPIX * sizeof(*stack));
+    for (pix = 0; pix < TABLE_NPIX; pix++) {
+        if (table[pix] != 255) continue;
+        healpix_pix2vec(TABLE_NSIDE, pix, pos);
+        v = find_exact(pos) + 1;
+        table[pix] = v;
+        stack[0] = pix;
+        sp = 1;
+        while (sp) {
+            healpix_get_neighbours(TABLE_NSIDE, stack[--sp], neighbours);
+            for (nb = 0; nb < 8; nb++) {
+                if (neighbours[nb] == -1) continue;
+                if (table[neighbours[nb]] != 255) continue;
+                table[neighbours[nb]] = v;
+                stack[sp++] = neighbours[nb];
+            }
         }
     }
-    memcpy(id, "???", 4);
-    return -1;
+    free(stack);
+    g_table = table;
+}
+
+int find_constellation_at(const double pos[3], char id[5])
+{
+    int ret;
+    double pos_b1875[3];
+#ifdef HAVE_PTHREAD
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, build_table);
+#else
+    if (!g_table) build_table();
+#endif
+
+    eraRxp(RNPB, pos, pos_b1875);
+    ret = g_table[healpix_vec2pix(TABLE_NSIDE, pos_b1875)] - 1;
+    if (ret == -1) ret = find_exact(pos_b1875);
+    if (ret == -1) {
+        if (id) memcpy(id, "???", 4);
+        return -1;
+    }
+    if (id) memcpy(id, CSTS[ret].id, 5);
+    return ret;
 }
+
+#if COMPILE_TESTS
+
+#include "tests.h"
+#include <assert.h>
+
+// Compare the table lookups with the exact test.
+static void test_find_constellation_at(void)
+{
+    int i, k;
+    double pos[3], pos_b1875[3];
+    char id[5];
+
+    srand(1);
+    for (i = 0; i < 10000; i++) {
+        for (k = 0; k < 3; k++) pos[k] = (double)rand() / RAND_MAX - 0.5;
+        vec3_normalize(pos, pos);
+        eraRxp(RNPB, pos, pos_b1875);
+        assert(find_constellation_at(pos, NULL) == find_exact(pos_b1875));
+    }
+    // Polaris.
+    vec3_from_sphe(37.95 * ERFA_DD2R, 89.26 * ERFA_DD2R, pos);
+    find_constellation_at(pos, id);
+    assert(strcmp(id, "UMI") == 0);
+}
+
+TEST_REGISTER(NULL, test_find_constellation_at, TEST_AUTO);
+
+#endif
@@ -92,9 +92,13 @@ double deltat(double ut)
         double dt2016 = 62.92 + 0.32217 * 16 + 0.005589 * 16 * 16;
         return 62.92 + 0.32217 * t + 0.005589 * t * t - (dt2016 - 68.1024);
     }
-    int i=0;
-    while (smh2016[i][1]<y) i++;
-    assert(i<54);
+    // Binary search of the segment.
+    int i = 0, j = 53, m;
+    while (i < j) {
+        m = (i + j) / 2;
+        if (smh2016[m][1] < y) i = m + 1;
+        else j = m;
+    }
     t=(y-smh2016[i][0]) / (smh2016[i][1]-smh2016[i][0]);
     return ((smh2016[i][5]*t + smh2016[i][4])*t
         + smh2016[i][3])*t + smh2016[i][2];
@@ -0,0 +1,40 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include <math.h>
+
+/*
+ * Function: eclipse_factor
+ * Compute the visible fraction of a disk partially covered by an other one.
+ *
+ * Parameters:
+ *   r      - Angular radius of the covered disk (rad).
+ *   br     - Angular radius of the blocking disk (rad).
+ *   sep    - Separation between the two disks centers (rad).
+ *
+ * Return:
+ *   The visible fraction of the covered disk, from 0 (totally covered)
+ *   to 1 (no eclipse).
+ */
+double eclipse_factor(double r, double br, double sep)
+{
+    double x, alpha, beta, ar, abr;
+
+    if (sep >= r + br) return 1.0; // Outside of shadow.
+    if (sep <= br - r) return 0.0; // Umbra.
+    if (sep <= r - br) // Penumbra completely inside.
+        return 1.0 - br * br / (r * r);
+    // Penumbra partially inside.
+    x = (r * r + sep * sep - br * br) / (2.0 * sep);
+    alpha = acos(x / r);
+    beta = acos((sep - x) / br);
+    ar = r * r * (alpha - 0.5 * sin(2.0 * alpha));
+    abr = br * br * (beta - 0.5 * sin(2.0 * beta));
+    return 1.0 - (ar + abr) / (M_PI * r * r);
+}
@@ -13,6 +13,14 @@
 
 // Some of the code comes from the official healpix C implementation.
 
+// Max order of the bounding caps table.
+#define CAPS_MAX_ORDER 5
+
+// Bounding caps of all the pixels up to CAPS_MAX_ORDER, order after order,
+// filled on demand.  A null cos value means that the cap hasn't been
+// computed yet.
+static double g_caps[4 * ((1 << (2 * (CAPS_MAX_ORDER + 1))) - 1)][4];
+
 /*
    utab[m] = (short)(
       (m&0x1 )       | ((m&0x2 ) << 1) | ((m&0x4 ) << 2) | ((m&0x8 ) << 3)
@@ -313,7 +321,7 @@ void healpix_get_boundaries(int nside, int pix, double out[4][3])
     }
 }
 
-void healpix_get_bounding_cap(int nside, int pix, double out[4])
+static void compute_bounding_cap(int nside, int pix, double out[4])
 {
     int ix, iy, face, i;
     double corners[4][3], d;
@@ -332,3 +340,25 @@ void healpix_get_bounding_cap(int nside, int pix, double out[4])
             out[3] = d;
     }
 }
+
+void healpix_get_bounding_cap(int nside, int pix, double out[4])
+{
+    int order = ilog2(nside);
+    double *cap;
+
+    if (order > CAPS_MAX_ORDER) {
+        compute_bounding_cap(nside, pix, out);
+        return;
+    }
+    // The pixels of order n start after the 4 * (4^n - 1) pixels of the
+    // lower orders.
+    cap = g_caps[4 * ((1 << (2 * order)) - 1) + pix];
+    if (cap[3] != 0.0) {
+        vec4_copy(cap, out);
+        return;
+    }
+    compute_bounding_cap(nside, pix, out);
+    // Set the cos value last, so that the cap is never seen half written.
+    vec3_copy(out, cap);
+    cap[3] = out[3];
+}
@@ -128,6 +128,62 @@ int orbit_compute_pv(
     return 0;
 }
 
+/*
+ * Function: orbit_compute_pv_batch
+ * Compute positions and speeds of several bodies from their orbit elements.
+ *
+ * Same as calling orbit_compute_pv with a zero precision and no elements
+ * variations for each body, but the loop has no branch so that the
+ * compiler can vectorize it.
+ *
+ * Parameters:
+ *   nb         - Number of bodies.
+ *   mjd        - Time of the positions (MJD).
+ *   elements   - For each body: d, i, o, w, a, n, e, ma, with the same
+ *                units as for orbit_compute_pv.
+ *   pv         - Get the computed positions and speeds.
+ */
+void orbit_compute_pv_batch(int nb, double mjd, const double (*elements)[8],
+                            double (*pv)[2][3])
+{
+    int k;
+    double i, o, w, a, n, e, m, v, r, rdot, rfdot, u, q;
+    double cosi, sini, coso, sino, cosu, sinu;
+
+    for (k = 0; k < nb; k++) {
+        i = elements[k][1];
+        o = elements[k][2];
+        w = elements[k][3];
+        a = elements[k][4];
+        n = elements[k][5];
+        e = elements[k][6];
+        m = fmod(n * (mjd - elements[k][0]) + elements[k][7], 2.0 * PI);
+        v = m + ((2.0 * e - e * e * e / 4) * sin(m) +
+                  5.0 / 4 * e * e * sin(2 * m) +
+                  13.0 / 12 * e * e * e * sin(3 * m));
+        r = a * (1 - e * e) / (1 + e * cos(v));
+        u = v + w;
+        cosi = cos(i);
+        sini = sin(i);
+        coso = cos(o);
+        sino = sin(o);
+        cosu = cos(u);
+        sinu = sin(u);
+        pv[k][0][0] = r * (coso * cosu - sino * sinu * cosi);
+        pv[k][0][1] = r * (sino * cosu + coso * sinu * cosi);
+        pv[k][0][2] = r * (sinu * sini);
+
+        q = n * a / sqrt(1.0 - e * e);
+        rdot = q * e * sin(v);
+        rfdot = q * (1.0 + e * cos(v));
+        pv[k][1][0] = rdot * (cosu * coso - sinu * sino * cosi) +
+                      rfdot * (-sinu * coso - cosu * sino * cosi);
+        pv[k][1][1] = rdot * (cosu * sino + sinu * coso * cosi) +
+                      rfdot * (-sinu * sino + cosu * coso * cosi);
+        pv[k][1][2] = rdot * (sinu * sini) + rfdot * (cosu * sini);
+    }
+}
+
 /*
  * Function: orbit_elements_from_pv
  * Compute Kepler orbit element from a body positon and speed.
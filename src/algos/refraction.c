@@ -106,3 +106,88 @@ void refraction_inv(const double v[3], double pressure, double temperature,
     vec3_copy(a, out);
     assert(vec3_is_normalized(out));
 }
+
+// Lowest sin(altitude) where the refraction is not null.
+static double refraction_lut_min_z(void)
+{
+    return sin((-3.54 - 1.46) * DD2R);
+}
+
+/*
+ * Function: refraction_lut_init
+ * Tabulate the refraction as a function of the vectors z value.
+ *
+ * The refraction doesn't change the azimuth, so it can be expressed as a
+ * function of z only, which we sample from the lowest refracted altitude
+ * to the zenith.  With 1024 values the linear interpolation error is below
+ * 0.2 arcsec above the horizon, and a few arcsec around the -3.54° kink of
+ * the model.
+ *
+ * Parameters:
+ *   refa   - Refraction A argument.
+ *   refb   - Refraction B argument.
+ *   n      - Size of the table.
+ *   lut    - Output table of the refracted z values (index 0), and of the
+ *            inverse refraction z values (index 1).
+ */
+void refraction_lut_init(double refa, double refb, int n, double (*lut)[2])
+{
+    int i;
+    double z, z0, v[3];
+
+    z0 = refraction_lut_min_z();
+    for (i = 0; i < n; i++) {
+        z = z0 + (1.0 - z0) * i / (n - 1);
+        vec3_set(v, sqrt(1.0 - z * z), 0, z);
+        refraction(v, refa, refb, v);
+        lut[i][0] = v[2];
+        vec3_set(v, sqrt(1.0 - z * z), 0, z);
+        refraction_inv(v, refa, refb, v);
+        lut[i][1] = v[2];
+    }
+}
+
+static void refraction_lut_apply(const double v[3], int n,
+                                 const double (*lut)[2], int k,
+                                 double out[3])
+{
+    double z0, f, z, r2, s;
+    int i;
+
+    z0 = refraction_lut_min_z();
+    r2 = v[0] * v[0] + v[1] * v[1];
+    vec3_copy(v, out);
+    if (v[2] < z0 || r2 == 0.0) return;
+    f = (v[2] - z0) / (1.0 - z0) * (n - 1);
+    i = fmin(f, n - 2);
+    f -= i;
+    z = lut[i][k] * (1.0 - f) + lut[i + 1][k] * f;
+    z = fmin(z, 1.0);
+    s = sqrt((1.0 - z * z) / r2);
+    out[0] = v[0] * s;
+    out[1] = v[1] * s;
+    out[2] = z;
+}
+
+/*
+ * Function: refraction_lut
+ * Fast refraction computation using a table from <refraction_lut_init>.
+ */
+void refraction_lut(const double v[3], int n, const double (*lut)[2],
+                    double out[3])
+{
+    assert(vec3_is_normalized(v));
+    refraction_lut_apply(v, n, lut, 0, out);
+}
+
+/*
+ * Function: refraction_lut_inv
+ * Fast inverse refraction computation using a table from
+ * <refraction_lut_init>.
+ */
+void refraction_lut_inv(const double v[3], int n, const double (*lut)[2],
+                        double out[3])
+{
+    assert(vec3_is_normalized(v));
+    refraction_lut_apply(v, n, lut, 1, out);
+}
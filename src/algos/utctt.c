@@ -11,6 +11,92 @@
 #include "algos.h"
 #include "erfa_wrap.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// TT - TAI (sec).
+#define TTMTAI 32.184
+// 1972 January 1, start of the integer leap seconds (MJD).
+#define LEAP_START 41317.0
+// Max number of half years in the leap seconds table.
+#define LEAP_MAX 256
+
+/*
+ * Table of TAI - UTC for each half year since 1972, the only dates where
+ * erfa can insert a leap second.  This allows to get the leap seconds with
+ * a direct lookup instead of calling eraDat, that also needs a calendar
+ * date.  We stop the table at the first date erfa considers dubious.
+ */
+static struct {
+    int     nb;
+    double  mjd[LEAP_MAX];  // UTC start date of each half year.
+    double  dat[LEAP_MAX];  // TAI - UTC (sec).
+} g_leap = {};
+
+static void build_leap_table(void)
+{
+    int i, r;
+    double djm0, djm, dat;
+
+    for (i = 0; i < LEAP_MAX; i++) {
+        r = eraCal2jd(1972 + i / 2, 1 + (i % 2) * 6, 1, &djm0, &djm);
+        if (r != 0) break;
+        r = eraDat(1972 + i / 2, 1 + (i % 2) * 6, 1, 0, &dat);
+        if (r != 0) break;
+        g_leap.mjd[i] = djm;
+        g_leap.dat[i] = dat;
+    }
+    g_leap.nb = i;
+}
+
+/*
+ * Get TAI - UTC for a given UTC date from the table.
+ *
+ * Return false if the date is not in the table, or is in the last day of
+ * a half year, since in case of a leap second erfa gives a fraction of
+ * the second to all the day.
+ */
+static bool get_leap_seconds(double utc, double *dat)
+{
+    int i;
+
+#ifdef HAVE_PTHREAD
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, build_leap_table);
+#else
+    if (!g_leap.nb) build_leap_table();
+#endif
+
+    if (utc < LEAP_START) return false;
+    // Half years are between 181 and 184 days long.
+    i = (utc - LEAP_START) / 182.625;
+    if (i >= g_leap.nb) return false;
+    while (i > 0 && g_leap.mjd[i] > utc) i--;
+    while (i < g_leap.nb - 1 && g_leap.mjd[i + 1] <= utc) i++;
+    if (i == g_leap.nb - 1) return false;
+    if (utc >= g_leap.mjd[i + 1] - 1 && g_leap.dat[i + 1] != g_leap.dat[i])
+        return false;
+    *dat = g_leap.dat[i];
+    return true;
+}
+
+// Fast version of tt2utc using the leap seconds table.
+static bool tt2utc_table(double tt, double ut1, double *utc, double *dut1)
+{
+    double tai, dat;
+
+    tai = tt - TTMTAI / ERFA_DAYSEC;
+    // The leap seconds of TAI as an UTC guess.  Since we refuse the days
+    // before a leap second the result is the same.
+    if (!get_leap_seconds(tai, &dat)) return false;
+    *utc = tai - dat / ERFA_DAYSEC;
+    if (!get_leap_seconds(*utc, &dat)) return false;
+    *utc = tai - dat / ERFA_DAYSEC;
+    *dut1 = (ut1 - *utc) * ERFA_DAYSEC;
+    return true;
+}
+
 double tt2utc(double tt, double *dut1)
 {
     double dt, utc1, utc2, ut11, ut12, tai1, tai2, utc, ut1, dut1_;
@@ -20,6 +106,7 @@ double tt2utc(double tt, double *dut1)
 
     dt = deltat(tt);
     eraTtut1(ERFA_DJM0, tt, dt, &ut11, &ut12);
+    if (tt2utc_table(tt, ut11 - ERFA_DJM0 + ut12, &utc, dut1)) goto end;
     eraTttai(ERFA_DJM0, tt, &tai1, &tai2);
     r = eraTaiutc(tai1, tai2, &utc1, &utc2);
 
@@ -33,6 +120,7 @@ double tt2utc(double tt, double *dut1)
     ut1 = ut11 - ERFA_DJM0 + ut12;
     *dut1 = (ut1 - utc) * ERFA_DAYSEC;
 
+end:
     if (fabs(*dut1) > 1) {
         LOG_W_ONCE("DUT1 = %fs", *dut1);
     }
@@ -42,9 +130,12 @@ double tt2utc(double tt, double *dut1)
 
 double utc2tt(double utc)
 {
-    double tai1, tai2, tt1, tt2, dt, tt;
+    double tai1, tai2, tt1, tt2, dt, tt, dat;
     int r;
 
+    if (get_leap_seconds(utc, &dat))
+        return utc + (dat + TTMTAI) / ERFA_DAYSEC;
+
     r = eraUtctai(ERFA_DJM0, utc, &tai1, &tai2);
 
     // If we don't know the leap seconds, assume UTC = UT1 and use ΔT to
@@ -61,3 +152,57 @@ double utc2tt(double utc)
     eraTaitt(tai1, tai2, &tt1, &tt2);
     return tt1 - ERFA_DJM0 + tt2;
 }
+
+void tt2utc_n(int n, const double *tt, double *utc, double *dut1)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        utc[i] = tt2utc(tt[i], dut1 ? &dut1[i] : NULL);
+}
+
+void utc2tt_n(int n, const double *utc, double *tt)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        tt[i] = utc2tt(utc[i]);
+}
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+#include "tests.h"
+#include <assert.h>
+
+// Compare the leap seconds table with erfa, including around the leap
+// seconds.
+static void test_utctt(void)
+{
+    double utc, tt, tai1, tai2, tt1, tt2, utc1, utc2, ut1[2], dut1, dt;
+    double tts[3], utcs[3];
+    int i;
+
+    for (utc = 41000; utc < 61000; utc += 0.37) {
+        eraUtctai(ERFA_DJM0, utc, &tai1, &tai2);
+        eraTaitt(tai1, tai2, &tt1, &tt2);
+        tt = tt1 - ERFA_DJM0 + tt2;
+        assert(fabs(utc2tt(utc) - tt) * ERFA_DAYSEC < 1e-5);
+
+        dt = deltat(tt);
+        eraTtut1(ERFA_DJM0, tt, dt, &ut1[0], &ut1[1]);
+        eraTttai(ERFA_DJM0, tt, &tai1, &tai2);
+        eraTaiutc(tai1, tai2, &utc1, &utc2);
+        assert(fabs(tt2utc(tt, &dut1) - (utc1 - ERFA_DJM0 + utc2)) *
+               ERFA_DAYSEC < 1e-5);
+    }
+
+    for (i = 0; i < 3; i++) utcs[i] = 57754 + i * 0.5 - 0.25;
+    utc2tt_n(3, utcs, tts);
+    tt2utc_n(3, tts, utcs, NULL);
+    for (i = 0; i < 3; i++)
+        assert(fabs(utcs[i] - (57754 + i * 0.5 - 0.25)) * ERFA_DAYSEC < 1e-5);
+}
+
+TEST_REGISTER(NULL, test_utctt, TEST_AUTO)
+
+#endif
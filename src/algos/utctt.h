@@ -35,4 +35,27 @@ double tt2utc(double tt, double *dut1);
  */
 double utc2tt(double utc);
 
+/*
+ * Function: tt2utc_n
+ * Convert an array of times from TT to UTC
+ *
+ * Parameters:
+ *   n      - Number of times.
+ *   tt     - TT times (MJD).
+ *   utc    - Output UTC times (MJD).
+ *   dut1   - If not NULL, output of DUT1 for each time (sec).
+ */
+void tt2utc_n(int n, const double *tt, double *utc, double *dut1);
+
+/*
+ * Function: utc2tt_n
+ * Convert an array of times from UTC to TT
+ *
+ * Parameters:
+ *   n      - Number of times.
+ *   utc    - UTC times (MJD).
+ *   tt     - Output TT times (MJD).
+ */
+void utc2tt_n(int n, const double *utc, double *tt);
+
 #endif // UTCTT_H
@@ -17,6 +17,15 @@
 #include <assert.h>
 #include <math.h>
 
+/*
+ * The items are indexed in a hashed grid of CELL_SIZE pixels cells, so that
+ * a lookup only has to test the items close to the search position.  Items
+ * covering too many cells are kept in a separate list always tested.
+ */
+#define CELL_SIZE 32
+#define NB_BUCKETS 4096
+#define MAX_ITEM_CELLS 16
+
 typedef struct item item_t;
 
 struct item
@@ -26,11 +35,20 @@ struct item
     double b; // Semi-minor axis.
     double angle;
     obj_t  *obj;
+    const void *source; // Optional catalog record in obj.
 };
 
+typedef struct entry {
+    int item;   // Index of the item in the items array.
+    int next;   // Index of the next entry in the bucket, or -1.
+} entry_t;
+
 struct areas
 {
     UT_array *items;
+    UT_array *entries;
+    int buckets[NB_BUCKETS];    // First entry of each bucket, or -1.
+    int large;                  // First entry of large items, or -1.
 };
 
 /*
@@ -57,23 +75,77 @@ static double ellipse_dist(const double center[2], double angle,
     return vec2_norm(p) - vec2_norm(p2);
 }
 
+static void add_entry(areas_t *areas, int *head, int item)
+{
+    entry_t entry = {item, *head};
+    *head = utarray_len(areas->entries);
+    utarray_push_back(areas->entries, &entry);
+}
+
+static int get_bucket(int x, int y)
+{
+    return ((unsigned)x * 73856093u ^ (unsigned)y * 19349663u) % NB_BUCKETS;
+}
+
+/*
+ * Compute the range of cells covering a square area.
+ * Return false if the range is too large to be indexed.
+ */
+static bool get_cells_range(const double pos[2], double r, int range[4])
+{
+    double x0, y0, x1, y1;
+    x0 = floor((pos[0] - r) / CELL_SIZE);
+    y0 = floor((pos[1] - r) / CELL_SIZE);
+    x1 = floor((pos[0] + r) / CELL_SIZE);
+    y1 = floor((pos[1] + r) / CELL_SIZE);
+    // Also make sure we don't index invalid or very far away positions.
+    if (!((x1 - x0 + 1) * (y1 - y0 + 1) <= MAX_ITEM_CELLS)) return false;
+    if (fabs(x0) > (1 << 20) || fabs(y0) > (1 << 20)) return false;
+    range[0] = x0;
+    range[1] = y0;
+    range[2] = x1;
+    range[3] = y1;
+    return true;
+}
+
+static void index_item(areas_t *areas, const item_t *item)
+{
+    int idx = utarray_len(areas->items) - 1;
+    int range[4], x, y;
+
+    if (!get_cells_range(item->pos, fmax(item->a, item->b), range)) {
+        add_entry(areas, &areas->large, idx);
+        return;
+    }
+    for (y = range[1]; y <= range[3]; y++)
+    for (x = range[0]; x <= range[2]; x++) {
+        add_entry(areas, &areas->buckets[get_bucket(x, y)], idx);
+    }
+}
+
 areas_t *areas_create(void)
 {
     static UT_icd item_icd = {sizeof(item_t), NULL, NULL, NULL};
+    static UT_icd entry_icd = {sizeof(entry_t), NULL, NULL, NULL};
     areas_t *areas;
     areas = calloc(1, sizeof(*areas));
     utarray_new(areas->items, &item_icd);
+    utarray_new(areas->entries, &entry_icd);
+    memset(areas->buckets, -1, sizeof(areas->buckets));
+    areas->large = -1;
     return areas;
 }
 
 void areas_add_circle(areas_t *areas, const double pos[2], double r,
-                      const obj_t *obj)
+                      const obj_t *obj, const void *source)
 {
     item_t item = {};
     memcpy(item.pos, pos, sizeof(item.pos));
     item.a = item.b = r;
     item.obj = obj_retain(obj);
+    item.source = source;
     utarray_push_back(areas->items, &item);
+    index_item(areas, &item);
 }
 
 void areas_add_ellipse(areas_t *areas, const double pos[2], double angle,
@@ -86,6 +158,7 @@ void areas_add_ellipse(areas_t *areas, const double pos[2], double angle,
     item.b = b;
     item.obj = obj_retain(obj);
     utarray_push_back(areas->items, &item);
+    index_item(areas, &item);
 }
 
 void areas_clear_all(areas_t *areas)
@@ -95,6 +168,9 @@ void areas_clear_all(areas_t *areas)
         obj_release(item->obj);
     }
     utarray_clear(areas->items);
+    utarray_clear(areas->entries);
+    memset(areas->buckets, -1, sizeof(areas->buckets));
+    areas->large = -1;
 }
 
 /*
@@ -126,18 +202,56 @@ static double lookup_score(const item_t *item, const double pos[static 2],
 
 }
 
-obj_t *areas_lookup(const areas_t *areas, const double pos[2], double max_dist)
+// Test all the items of a bucket list, keeping the best one.  In case of
+// equal scores we keep the item added first, as if we were testing all the
+// items in order.
+static void lookup_list(const areas_t *areas, int i,
+                        const double pos[2], double max_dist,
+                        int *best, double *best_score)
 {
-    item_t *item = NULL, *best = NULL;
-    double score, best_score = 0.0;
+    const entry_t *entry;
+    const item_t *item;
+    double score;
 
-    while ( (item = (item_t*)utarray_next(areas->items, item)) ) {
+    for (; i != -1; i = entry->next) {
+        entry = (entry_t*)utarray_eltptr(areas->entries, i);
+        item = (item_t*)utarray_eltptr(areas->items, entry->item);
         score = lookup_score(item, pos, max_dist);
-        if (score > best_score) {
-            best_score = score;
-            best = item;
+        if (score > *best_score ||
+                (score == *best_score && score > 0 && entry->item < *best)) {
+            *best_score = score;
+            *best = entry->item;
+        }
+    }
+}
+
+obj_t *areas_lookup(const areas_t *areas, const double pos[2], double max_dist)
+{
+    const item_t *item;
+    double best_score = 0.0;
+    int best = -1, range[4], x, y, b, buckets[MAX_ITEM_CELLS], nb = 0, i;
+
+    lookup_list(areas, areas->large, pos, max_dist, &best, &best_score);
+    if (get_cells_range(pos, max_dist, range)) {
+        for (y = range[1]; y <= range[3]; y++)
+        for (x = range[0]; x <= range[2]; x++) {
+            // Different cells can share the same bucket.
+            b = get_bucket(x, y);
+            for (i = 0; i < nb; i++) if (buckets[i] == b) break;
+            if (i < nb) continue;
+            buckets[nb++] = b;
+            lookup_list(areas, areas->buckets[b], pos, max_dist,
+                        &best, &best_score);
         }
+    } else {
+        // Large search area: test all the items.
+        for (i = 0; i < NB_BUCKETS; i++)
+            lookup_list(areas, areas->buckets[i], pos, max_dist,
+                        &best, &best_score);
     }
-    if (!best) return NULL;
-    return obj_retain(best->obj);
+    if (best == -1) return NULL;
+    item = (item_t*)utarray_eltptr(areas->items, best);
+    if (item->source && item->obj->klass->get_source)
+        return item->obj->klass->get_source(item->obj, item->source);
+    return obj_retain(item->obj);
 }
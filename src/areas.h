@@ -33,9 +33,12 @@ areas_t *areas_create(void);
  *   pos    - a 2d position in window space.
  *   r      - radius in window space.
  *   obj    - object associated with the area.
+ *   source - optional catalog record stored in obj.  If set, the lookup
+ *            returns the object given by the obj klass get_source method
+ *            instead of obj itself.
  */
 void areas_add_circle(areas_t *areas, const double pos[2], double r,
-                      const obj_t *obj);
+                      const obj_t *obj, const void *source);
 
 void areas_add_ellipse(areas_t *areas, const double pos[2], double angle,
                        double a, double b,
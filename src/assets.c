@@ -10,6 +10,13 @@
 #include "swe.h"
 #include <sys/stat.h>
 
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+#   define HAS_MMAP 1
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
 static const int DEFAULT_DELAY = 60;
 
 #ifdef __EMSCRIPTEN__
@@ -18,7 +25,15 @@ static const bool HAS_FS = false;
 static const bool HAS_FS = true;
 #endif
 
-static void assets_update(void);
+// Version of the tile archive format.
+#define ARCHIVE_VERSION 1
+
+// Max memory of the non static assets data before we start to evict the
+// least recently used ones.
+#define CACHE_SIZE (128 * (1 << 20))
+// Number of frames an asset has to stay unused before we can evict it, so
+// that the modules can keep using its data for a while after they got it.
+#define EVICT_MIN_FRAMES 600
 
 enum {
     STATIC      = 1 << 8,
@@ -26,8 +41,23 @@ enum {
     FREE_DATA   = 1 << 10,
     LOGGED      = 1 << 11,
     CAN_RELEASE = 1 << 12,
+    MAPPED      = 1 << 13, // Data points into an archive mapping.
+    UNCOMPRESSED = 1 << 14, // ASSET_GZ data has been uncompressed.
 };
 
+/*
+ * Type: uncompress_t
+ * Uncompression of an asset data, possibly running in a worker thread.
+ */
+typedef struct uncompress {
+    worker_t    worker;
+    bool        gz;         // gz data, otherwise we use the bundled format.
+    const void  *src;
+    int         src_size;
+    void        *data;      // Output, NULL in case of error.
+    int         size;
+} uncompress_t;
+
 typedef struct asset asset_t;
 struct asset
 {
@@ -39,13 +69,65 @@ struct asset
     void            *compressed_data;
     void            *data;
     int             size;
-    int             last_used;
+    int             last_used;  // Frame of the last use.
     int             delay;
+    uncompress_t    *uncompress;
+    int             cost;       // Memory counted for the eviction.
+    char            *etag;      // ETag of the downloaded data, or NULL.
+    asset_t         *lru_prev, *lru_next;
+    asset_t         *release_prev, *release_next;
 };
 
 // Global map of all the assets.
 static asset_t *g_assets = NULL;
 
+/*
+ * Global state of the assets housekeeping, done once per frame in
+ * assets_update.
+ *
+ * Attributes:
+ *   frame      - Frame counter.
+ *   size       - Total cost of the assets in the lru list.
+ *   nb         - Number of assets in the lru list.
+ *   lru        - Assets with some data we can evict, the least recently
+ *                used first.
+ *   releases   - Assets flagged with CAN_RELEASE.
+ */
+static struct {
+    int         frame;
+    int64_t     size;
+    int         nb;
+    asset_t     *lru;
+    asset_t     *releases;
+} g_gc = {};
+
+/*
+ * Type: archive_entry_t
+ * A single file in a tile archive.
+ */
+typedef struct archive_entry {
+    UT_hash_handle  hh;
+    char            *path;  // Relative to the archive base.
+    const void      *data;
+    int             size;
+} archive_entry_t;
+
+/*
+ * Type: archive_t
+ * A local archive file mapped in memory, see <asset_add_archive>.
+ */
+typedef struct archive archive_t;
+struct archive {
+    char            *base;
+    void            *map;
+    size_t          map_size;
+    archive_entry_t *entries;
+    archive_t       *next;
+};
+
+// Global list of all the archives.
+static archive_t *g_archives = NULL;
+
 // Global hook function.
 static struct {
     void *user;
@@ -87,6 +169,49 @@ static bool file_exists(const char *path)
     return false;
 }
 
+/*
+ * Find a local path in the mapped archives.
+ */
+static const archive_entry_t *archives_find(const char *path)
+{
+    archive_t *archive;
+    archive_entry_t *entry;
+    int len;
+
+    for (archive = g_archives; archive; archive = archive->next) {
+        len = strlen(archive->base);
+        if (strncmp(path, archive->base, len) != 0 || path[len] != '/')
+            continue;
+        HASH_FIND_STR(archive->entries, path + len + 1, entry);
+        if (entry) return entry;
+    }
+    return NULL;
+}
+
+// Mark an asset to be released at the next assets_update.
+static void asset_schedule_release(asset_t *asset)
+{
+    if (asset->flags & CAN_RELEASE) return;
+    asset->flags |= CAN_RELEASE;
+    DL_APPEND2(g_gc.releases, asset, release_prev, release_next);
+}
+
+// Set the memory cost of an asset, and put it in the lru list if needed.
+static void asset_set_cost(asset_t *asset, int cost)
+{
+    if (asset->cost) {
+        DL_DELETE2(g_gc.lru, asset, lru_prev, lru_next);
+        g_gc.size -= asset->cost;
+        g_gc.nb--;
+    }
+    asset->cost = cost;
+    if (asset->cost) {
+        DL_APPEND2(g_gc.lru, asset, lru_prev, lru_next);
+        g_gc.size += asset->cost;
+        g_gc.nb++;
+    }
+}
+
 static asset_t *asset_get(const char *url, int flags)
 {
     asset_t *asset;
@@ -99,7 +224,12 @@ static asset_t *asset_get(const char *url, int flags)
         if (flags & ASSET_DELAY) asset->delay = DEFAULT_DELAY;
         HASH_ADD_KEYPTR(hh, g_assets, asset->url, strlen(asset->url), asset);
     }
-    asset->last_used = 0;
+    asset->last_used = g_gc.frame;
+    // Move to the end of the lru list.
+    if (asset->cost && asset->lru_next) {
+        DL_DELETE2(g_gc.lru, asset, lru_prev, lru_next);
+        DL_APPEND2(g_gc.lru, asset, lru_prev, lru_next);
+    }
     return asset;
 }
 
@@ -123,23 +253,87 @@ void asset_register(const char *url, const void *data, int size,
                     strlen(asset->url), asset);
 }
 
+static int uncompress_worker(worker_t *w)
+{
+    uncompress_t *u = (void*)w;
+    int r;
+
+    trace_begin("assets", "uncompress");
+    if (u->gz) {
+        u->data = z_uncompress_gz(u->src, u->src_size, &u->size);
+        trace_end("assets", "uncompress");
+        return 0;
+    }
+    // Bundled assets start with the uncompressed size.
+    u->size = ((uint32_t*)u->src)[0];
+    assert(u->size > 0);
+    // Always add a NULL byte at the end so that text data are properly
+    // null terminated.
+    u->data = malloc(u->size + 1);
+    ((char*)u->data)[u->size] = '\0';
+    r = z_uncompress(u->data, u->size, u->src + 4, u->src_size - 4);
+    assert(r == 0);
+    (void)r;
+    trace_end("assets", "uncompress");
+    return 0;
+}
+
+/*
+ * Uncompress some data into the asset data.
+ *
+ * If ASSET_ASYNC is set, this runs in a worker and needs to be called
+ * until it returns a non zero value.
+ *
+ * Return:
+ *   0 if still in progress, 1 when done, -1 in case of error.
+ */
+static int asset_uncompress(asset_t *asset, int flags, bool gz,
+                            const void *src, int src_size)
+{
+    uncompress_t *u = asset->uncompress;
+    bool started = u != NULL;
+    if (!u) {
+        u = asset->uncompress = calloc(1, sizeof(*u));
+        worker_init(&u->worker, uncompress_worker);
+        u->gz = gz;
+        u->src = src;
+        u->src_size = src_size;
+    }
+    if (flags & ASSET_ASYNC) {
+        if (!worker_iter(&u->worker)) return 0;
+    } else if (started) {
+        // Block on the worker started by a previous async call, without
+        // spinning on worker_iter.
+        worker_wait(&u->worker);
+    } else {
+        // No worker started: no need to go through the pool.
+        uncompress_worker(&u->worker);
+    }
+    asset->uncompress = NULL;
+    asset->data = u->data;
+    asset->size = u->size;
+    free(u);
+    if (!asset->data) return -1;
+    asset->flags |= FREE_DATA;
+    return 1;
+}
+
 const void *asset_get_data(const char *url, int *size, int *code)
 {
     return asset_get_data2(url, 0, size, code);
 }
 
-const void *asset_get_data2(const char *url, int flags, int *size, int *code)
+static const void *asset_get_data_(const char *url, int flags,
+                                   int *size, int *code)
 {
     asset_t *asset;
-    int r, default_size, default_code;
+    int r;
     const void *data = NULL;
-    (void)r;
+    void *raw;
+    bool free_raw;
+    const archive_entry_t *entry;
     char path[1204];
 
-    size = size ?: &default_size;
-    code = code ?: &default_code;
-
-    assets_update();
     asset = asset_get(url, flags);
     *code = 0;
     *size = 0;
@@ -150,17 +344,9 @@ const void *asset_get_data2(const char *url, int flags, int *size, int *code)
     }
 
     if (!asset->data && asset->compressed_data) {
-        asset->size = ((uint32_t*)asset->compressed_data)[0];
-        assert(asset->size > 0);
-        // Always add a NULL byte at the end so that text data are properly
-        // null terminated.
-        asset->data = malloc(asset->size + 1);
-        ((char*)asset->data)[asset->size] = '\0';
-        r = z_uncompress(asset->data, asset->size,
-                         asset->compressed_data + 4,
-                         asset->compressed_size - 4);
-        asset->flags |= FREE_DATA;
-        assert(r == 0);
+        if (!asset_uncompress(asset, flags, false, asset->compressed_data,
+                              asset->compressed_size))
+            return NULL;
     }
 
     // Apply hook if set.
@@ -178,17 +364,40 @@ const void *asset_get_data2(const char *url, int flags, int *size, int *code)
     // Special handler for local files.
     if (HAS_FS && !asset->data && !strchr(url, ':')) {
         remove_url_parameters(url, path, sizeof(path));
-        if (!file_exists(path)) {
+        // Archived files are served directly from the mapping.
+        if (g_archives && (entry = archives_find(path))) {
+            asset->data = (void*)entry->data;
+            asset->size = entry->size;
+            asset->flags |= MAPPED;
+        } else if (!file_exists(path)) {
             *code = 404;
             goto end;
+        } else {
+            asset->data = read_file(path, &asset->size);
+            asset->flags |= FREE_DATA;
+        }
+        // Local files are read synchronously anyway, so no need to
+        // uncompress them in a worker.
+        if ((flags & ASSET_GZ) && asset->data) {
+            raw = asset->data;
+            free_raw = asset->flags & FREE_DATA;
+            asset->data = NULL;
+            asset->flags &= ~(FREE_DATA | MAPPED);
+            r = asset_uncompress(asset, flags & ~ASSET_ASYNC, true,
+                                 raw, asset->size);
+            if (free_raw) free(raw);
+            if (r < 0) {
+                *code = 415;
+                goto end;
+            }
         }
-        asset->data = read_file(path, &asset->size);
-        asset->flags |= FREE_DATA;
     }
 
     if (asset->data) {
         *code = 200;
         *size = asset->size;
+        if (!asset->cost && !(asset->flags & (STATIC | MAPPED)))
+            asset_set_cost(asset, asset->size);
         return asset->data;
     }
 
@@ -199,10 +408,46 @@ const void *asset_get_data2(const char *url, int flags, int *size, int *code)
             return NULL;
         }
         asset->request = request_create(asset->url);
+        if (flags & ASSET_PRIORITY_HIGH)
+            request_set_priority(asset->request, REQUEST_PRIORITY_HIGH);
+        if (flags & ASSET_PRIORITY_LOW)
+            request_set_priority(asset->request, REQUEST_PRIORITY_LOW);
     }
     data = request_get_data(asset->request, size, code);
+    if (*code && !asset->etag && request_get_etag(asset->request))
+        asset->etag = strdup(request_get_etag(asset->request));
+
+    if (data && *code / 100 == 2 && (flags & ASSET_GZ)) {
+        // Already tried and failed.
+        if (asset->flags & UNCOMPRESSED) {
+            *code = 415;
+            *size = 0;
+            goto end;
+        }
+        r = asset_uncompress(asset, flags, true, data, *size);
+        if (r == 0) { // Still uncompressing.
+            *code = 0;
+            *size = 0;
+            return NULL;
+        }
+        asset->flags |= UNCOMPRESSED;
+        if (r < 0) {
+            *code = 415;
+            *size = 0;
+            data = NULL;
+            goto end;
+        }
+        // We don't need the compressed data anymore.
+        request_delete(asset->request);
+        asset->request = NULL;
+        data = asset->data;
+        *size = asset->size;
+    }
+
     if (*code && data && (flags & ASSET_USED_ONCE))
-        asset->flags |= CAN_RELEASE;
+        asset_schedule_release(asset);
+    if (*code / 100 == 2 && data && !asset->cost)
+        asset_set_cost(asset, *size);
 
     // All error return codes return NULL data.
     if (*code >= 400) data = NULL;
@@ -212,8 +457,37 @@ end:
     return data;
 }
 
+const void *asset_get_data2(const char *url, int flags, int *size, int *code)
+{
+    const void *data;
+    int default_size, default_code;
+
+    size = size ?: &default_size;
+    code = code ?: &default_code;
+    data = asset_get_data_(url, flags, size, code);
+    // Keep rendering until the asset is loaded.
+    if (!(*code)) core_request_redraw();
+    return data;
+}
+
 static int asset_release_(asset_t *asset)
 {
+    // Can't release the asset while a worker is still using its data, we
+    // will try again in assets_update.
+    if (asset->uncompress && worker_is_running(&asset->uncompress->worker)) {
+        asset_schedule_release(asset);
+        return 0;
+    }
+    if (asset->flags & CAN_RELEASE) {
+        DL_DELETE2(g_gc.releases, asset, release_prev, release_next);
+        asset->flags &= ~CAN_RELEASE;
+    }
+    asset_set_cost(asset, 0);
+    if (asset->uncompress) {
+        free(asset->uncompress->data);
+        free(asset->uncompress);
+        asset->uncompress = NULL;
+    }
     if (asset->flags & FREE_DATA) {
         free(asset->data);
         asset->data = NULL;
@@ -221,28 +495,39 @@ static int asset_release_(asset_t *asset)
     }
     if (asset->request)
         request_delete(asset->request);
+    asset->request = NULL;
     if (!(asset->flags & STATIC)) {
         HASH_DEL(g_assets, asset);
         free(asset->url);
+        free(asset->etag);
         free(asset);
     }
     return 0;
 }
 
-static void assets_update(void)
+void assets_update(void)
 {
     asset_t *asset, *tmp;
-    HASH_ITER(hh, g_assets, asset, tmp) {
-        if ((asset->flags & CAN_RELEASE)) {
-            asset_release_(asset);
-            continue;
-        }
-        if (asset->flags & STATIC) continue;
-        if (asset->last_used++ < 128) continue;
-        // XXX: to finish: delete unused assets.
+
+    g_gc.frame++;
+    DL_FOREACH_SAFE2(g_gc.releases, asset, tmp, release_next)
+        asset_release_(asset);
+
+    // Evict the least recently used assets until we are below the budget.
+    DL_FOREACH_SAFE2(g_gc.lru, asset, tmp, lru_next) {
+        if (g_gc.size <= CACHE_SIZE) break;
+        if (g_gc.frame - asset->last_used < EVICT_MIN_FRAMES) break;
+        asset_release_(asset);
     }
 }
 
+int assets_get_total_size(int *nb, int *max_size)
+{
+    if (nb) *nb = g_gc.nb;
+    if (max_size) *max_size = CACHE_SIZE;
+    return g_gc.size;
+}
+
 const char *asset_iter_(const char *base, void **i)
 {
     asset_t *asset = (*i);
@@ -255,6 +540,20 @@ const char *asset_iter_(const char *base, void **i)
     return asset ? asset->url : NULL;
 }
 
+bool asset_is_mapped(const char *url)
+{
+    asset_t *asset;
+    HASH_FIND_STR(g_assets, url, asset);
+    return asset && (asset->flags & MAPPED);
+}
+
+const char *asset_get_etag(const char *url)
+{
+    asset_t *asset;
+    HASH_FIND_STR(g_assets, url, asset);
+    return asset ? asset->etag : NULL;
+}
+
 void asset_release(const char *url)
 {
     asset_t *asset;
@@ -263,6 +562,95 @@ void asset_release(const char *url)
     asset_release_(asset);
 }
 
+#if HAS_MMAP
+
+// Read an archive index, see tools/make-archive.py for the format.
+static int archive_read_index(archive_t *archive)
+{
+    const uint8_t *data = archive->map;
+    size_t ofs = 12, size = archive->map_size;
+    uint32_t version, nb, i, entry_size;
+    uint64_t entry_ofs;
+    uint16_t path_len;
+    archive_entry_t *entry;
+
+    if (size < 12 || memcmp(data, "SWAR", 4) != 0) return -1;
+    memcpy(&version, data + 4, 4);
+    memcpy(&nb, data + 8, 4);
+    if (version != ARCHIVE_VERSION) return -1;
+    for (i = 0; i < nb; i++) {
+        if (ofs + 14 > size) return -1;
+        memcpy(&entry_ofs, data + ofs, 8);
+        memcpy(&entry_size, data + ofs + 8, 4);
+        memcpy(&path_len, data + ofs + 12, 2);
+        ofs += 14;
+        // The data is followed by a null byte that we also need to map.
+        if (ofs + path_len > size || entry_ofs + entry_size + 1 > size ||
+            data[entry_ofs + entry_size] != '\0')
+            return -1;
+        entry = calloc(1, sizeof(*entry));
+        entry->path = strndup((const char*)data + ofs, path_len);
+        entry->data = data + entry_ofs;
+        entry->size = entry_size;
+        HASH_ADD_KEYPTR(hh, archive->entries, entry->path,
+                        strlen(entry->path), entry);
+        ofs += path_len;
+    }
+    return 0;
+}
+
+int asset_add_archive(const char *base, const char *path)
+{
+    int fd;
+    struct stat st;
+    archive_t *archive;
+    archive_entry_t *entry, *tmp;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        LOG_E("Cannot open archive %s", path);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    archive = calloc(1, sizeof(*archive));
+    archive->map_size = st.st_size;
+    archive->map = mmap(NULL, archive->map_size, PROT_READ, MAP_PRIVATE,
+                        fd, 0);
+    close(fd); // The mapping keeps the file open.
+    if (archive->map == MAP_FAILED || archive_read_index(archive) != 0) {
+        LOG_E("Cannot read archive %s", path);
+        HASH_ITER(hh, archive->entries, entry, tmp) {
+            HASH_DEL(archive->entries, entry);
+            free(entry->path);
+            free(entry);
+        }
+        if (archive->map != MAP_FAILED)
+            munmap(archive->map, archive->map_size);
+        free(archive);
+        return -1;
+    }
+    archive->base = strdup(base);
+    // Remove trailing slash from the base.
+    if (*archive->base && archive->base[strlen(archive->base) - 1] == '/')
+        archive->base[strlen(archive->base) - 1] = '\0';
+    LL_PREPEND(g_archives, archive);
+    LOG_I("Add archive %s (%d files)", path, HASH_COUNT(archive->entries));
+    return 0;
+}
+
+#else
+
+int asset_add_archive(const char *base, const char *path)
+{
+    LOG_E("Archives are not supported on this platform");
+    return -1;
+}
+
+#endif
+
 /*
  * Function: asset_set_hook
  * Set a global function to handle special urls.
@@ -284,3 +672,75 @@ void asset_set_hook(void *user,
 #include "assets/shaders.inl"
 #include "assets/symbols.png.inl"
 #include "assets/textures.inl"
+
+
+#if COMPILE_TESTS && HAS_MMAP
+
+// Write an archive file with a single entry, as done by make-archive.py.
+static void write_archive(const char *path, const char *name,
+                          const char *data, int size, int file_size)
+{
+    FILE *file;
+    uint32_t v;
+    uint64_t ofs;
+    uint16_t len = strlen(name);
+
+    file = fopen(path, "wb");
+    assert(file);
+    fwrite("SWAR", 4, 1, file);
+    v = ARCHIVE_VERSION;
+    fwrite(&v, 4, 1, file);
+    v = 1;
+    fwrite(&v, 4, 1, file);
+    ofs = 12 + 14 + len;
+    fwrite(&ofs, 8, 1, file);
+    v = size;
+    fwrite(&v, 4, 1, file);
+    fwrite(&len, 2, 1, file);
+    fwrite(name, len, 1, file);
+    fwrite(data, file_size, 1, file);
+    fclose(file);
+}
+
+static void test_archive(void)
+{
+    const char *data;
+    int size, code, r;
+    archive_t *archive;
+    archive_entry_t *entry, *tmp;
+
+    // Missing the last null byte.
+    write_archive("/tmp/swe_test_archive.bin", "dir/test.txt", "hello", 5, 5);
+    r = asset_add_archive("/tmp/swe_test_archive",
+                          "/tmp/swe_test_archive.bin");
+    assert(r == -1 && !g_archives);
+
+    write_archive("/tmp/swe_test_archive.bin", "dir/test.txt", "hello", 5, 6);
+    r = asset_add_archive("/tmp/swe_test_archive/",
+                          "/tmp/swe_test_archive.bin");
+    assert(r == 0);
+    data = asset_get_data("/tmp/swe_test_archive/dir/test.txt", &size, &code);
+    assert(code == 200 && size == 5 && strcmp(data, "hello") == 0);
+    assert(asset_is_mapped("/tmp/swe_test_archive/dir/test.txt"));
+    asset_release("/tmp/swe_test_archive/dir/test.txt");
+    data = asset_get_data("/tmp/swe_test_archive/other.txt", &size, &code);
+    assert(!data && code == 404);
+    asset_release("/tmp/swe_test_archive/other.txt");
+
+    // Remove the archive.
+    archive = g_archives;
+    LL_DELETE(g_archives, archive);
+    HASH_ITER(hh, archive->entries, entry, tmp) {
+        HASH_DEL(archive->entries, entry);
+        free(entry->path);
+        free(entry);
+    }
+    munmap(archive->map, archive->map_size);
+    free(archive->base);
+    free(archive);
+    remove("/tmp/swe_test_archive.bin");
+}
+
+TEST_REGISTER(NULL, test_archive, TEST_AUTO);
+
+#endif
@@ -36,11 +36,25 @@
  *   ASSET_ACCEPT_404   - Do not log error on a 404 return.
  *   ASSET_USED_ONCE    - Hint that the data can be release after it has
  *                        been read.
+ *   ASSET_GZ           - The data is gzip compressed, return the uncompressed
+ *                        data instead.
+ *   ASSET_ASYNC        - Uncompress the data (bundled compressed assets, or
+ *                        ASSET_GZ data) in a worker thread.  Until this is
+ *                        done we return NULL with a code of 0, like for a
+ *                        pending online request.
+ *   ASSET_PRIORITY_HIGH - Hint that the network request is more urgent
+ *                        than the others.  Only used with the js backend.
+ *   ASSET_PRIORITY_LOW  - Hint that the network request is less urgent
+ *                        than the others.
  */
 enum {
     ASSET_DELAY             = 1 << 0,
     ASSET_ACCEPT_404        = 1 << 1,
     ASSET_USED_ONCE         = 1 << 2,
+    ASSET_GZ                = 1 << 3,
+    ASSET_ASYNC             = 1 << 4,
+    ASSET_PRIORITY_HIGH     = 1 << 5,
+    ASSET_PRIORITY_LOW      = 1 << 6,
 };
 
 /*
@@ -76,6 +90,26 @@ const void *asset_get_data(const char *url, int *size, int *code);
  */
 const void *asset_get_data2(const char *url, int flags, int *size, int *code);
 
+/*
+ * Function: assets_update
+ * Assets housekeeping, called once per frame by the core.
+ *
+ * Release the assets data that we don't need anymore (see ASSET_USED_ONCE),
+ * and if the assets use more memory than the budget, evict the least
+ * recently used ones that have not been used for a while.
+ */
+void assets_update(void);
+
+/*
+ * Function: assets_get_total_size
+ * Return the memory used by the evictable assets data.
+ *
+ * Parameters:
+ *   nb         - Output number of assets.  Can be NULL.
+ *   max_size   - Output of the eviction budget.  Can be NULL.
+ */
+int assets_get_total_size(int *nb, int *max_size);
+
 /*
  * Function: asset_release
  * Release the memory associated with an asset.
@@ -85,6 +119,42 @@ const void *asset_get_data2(const char *url, int flags, int *size, int *code);
  */
 void asset_release(const char *url);
 
+/*
+ * Function: asset_is_mapped
+ * Return whether an asset data comes from an archive mapping.
+ *
+ * In that case the data stays valid even after <asset_release>, so there
+ * is no need to copy it.
+ */
+bool asset_is_mapped(const char *url);
+
+/*
+ * Function: asset_get_etag
+ * Return the ETag of a downloaded asset, or NULL if not known.
+ *
+ * This allows to check if the data we parsed in a previous run is still
+ * up to date (see snapshot.h).  Only valid until the asset is released.
+ */
+const char *asset_get_etag(const char *url);
+
+/*
+ * Function: asset_add_archive
+ * Serve all the local files under a given path from a single archive.
+ *
+ * The archive file is mapped in memory, and the assets data point directly
+ * into the mapping, so this is much faster than reading many small files
+ * for local HiPS surveys.  The archives can be created with
+ * tools/make-archive.py.
+ *
+ * Parameters:
+ *   base   - Local path the archive files are relative to.
+ *   path   - Path of the archive file.
+ *
+ * Return:
+ *   0 on success.
+ */
+int asset_add_archive(const char *base, const char *path);
+
 /*
  * Macro: ASSET_ITER
  * Iter all the asset url that start with a given prefix.
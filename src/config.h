@@ -25,6 +25,17 @@ extern "C" {
 #   endif
 #endif
 
+// Enable the trace events (see utils/trace.h).  Compiled out in release
+// unless explicitly set.
+#ifndef SWE_TRACE
+#   define SWE_TRACE DEBUG
+#endif
+
+// Count the heap allocations per call site (see utils/alloc_track.h).
+#ifndef SWE_ALLOC_TRACK
+#   define SWE_ALLOC_TRACK 0
+#endif
+
 // Force imgui to only compile stb image for jpeg and png.
 #define STBI_ONLY_JPEG
 #define STBI_ONLY_PNG
@@ -52,6 +63,17 @@ extern "C" {
 #   define snprintf stbsp_snprintf
 #endif
 
+// Replace the allocation functions by the tracking versions.  We include
+// stdlib.h first so that its declarations are not affected.
+#if SWE_ALLOC_TRACK && !defined(__cplusplus)
+#   include <stdlib.h>
+#   include "utils/alloc_track.h"
+#   define malloc(size) alloc_track_malloc(size, __FILE__, __LINE__)
+#   define calloc(n, size) alloc_track_calloc(n, size, __FILE__, __LINE__)
+#   define realloc(ptr, size) \
+        alloc_track_realloc(ptr, size, __FILE__, __LINE__)
+#endif
+
 // Ini config.
 #define INI_MAX_LINE 512
 
@@ -11,11 +11,60 @@
 #include "algos/utctt.h"
 #include "navigation.h"
 #include "render.h"
+#include "shader_cache.h"
+#include "static_mesh.h"
 
 core_t *core;   // The global core object.
 
 #define exp10(x) exp((x) * log(10.))
 
+// Number of frames we keep rendering after the last detected change, so that
+// the textures fade in and the eye adaptation have time to settle.
+#define REDRAW_SETTLE_FRAMES 30
+
+// Target display value of the average sky with the GPU eye adaptation.
+// Ad-hoc value.
+#define GPU_ADAPTATION_KEY 0.5
+
+// Lookup table of points radius and luminance by magnitude, from -5 to 36,
+// updated by core_render when its inputs change.  See
+// core_get_point_for_mag.
+#define POINT_LUT_MIN_MAG   -5.0
+#define POINT_LUT_STEP      0.01
+#define POINT_LUT_SIZE      4101
+
+// Size of the tiles we always keep in each of the stars, dsos and geojson
+// caches when releasing memory, so that the sky stays usable until the
+// tiles are loaded again.
+#define MEMORY_TILES_FLOOR (4 * (1 << 20))
+
+// Limits of the cooperative tasks time budget per frame (sec).
+#define TASKS_MIN_BUDGET 0.001
+#define TASKS_MAX_BUDGET 0.008
+
+// All the core values used by compute_point_for_mag.
+typedef struct {
+    double  tonemapper[3]; // p, lwmax and exposure.
+    double  light_grasp;
+    double  magnification;
+    double  star_linear_scale;
+    double  star_scale_screen_factor;
+    double  star_relative_scale;
+    double  bortle_index;
+    double  max_point_radius;
+    double  min_point_radius;
+    double  skip_point_radius;
+    double  win_pixels_scale;
+} point_lut_inputs_t;
+
+static struct {
+    bool    valid; // Only set during the rendering.
+    bool    computed;
+    point_lut_inputs_t inputs;
+    float   radius[POINT_LUT_SIZE];
+    float   luminance[POINT_LUT_SIZE];
+} g_point_lut;
+
 static void core_on_fov_changed(obj_t *obj, const attribute_t *attr)
 {
     // For the moment there is not point going further than 0.5°.
@@ -50,6 +99,223 @@ static json_value *core_fn_progressbars(obj_t *obj, const attribute_t *attr,
     return ret;
 }
 
+static void add_cache_stats(void *user, const char *name,
+                            const cache_stats_t *stats)
+{
+    json_value *obj = user, *val;
+    val = json_object_new(0);
+    json_object_push(val, "nb_items", json_integer_new(stats->nb_items));
+    json_object_push(val, "size", json_integer_new(stats->size));
+    json_object_push(val, "max_size", json_integer_new(stats->max_size));
+    json_object_push(val, "hits", json_integer_new(stats->hits));
+    json_object_push(val, "misses", json_integer_new(stats->misses));
+    json_object_push(val, "evictions", json_integer_new(stats->evictions));
+    json_object_push(obj, name, val);
+}
+
+// Add the size of a tiles cache to the memory tiers usage.
+static void add_tiles_usage(void *user, const char *name,
+                            const cache_stats_t *stats)
+{
+    int *usage = user;
+    if (strcmp(name, "images") == 0)
+        usage[MEMORY_TIER_TEXTURES] += stats->size;
+    else
+        usage[MEMORY_TIER_TILES] += stats->size;
+}
+
+/*
+ * Get the stats of the tiles caches, or set their max sizes.
+ * The returned object also has a "textures" entry with the GPU memory used
+ * by all the textures.
+ *
+ * To change the sizes, pass an object of cache name to max size in bytes,
+ * e.g: {"images": 67108864, "stars": 33554432}.
+ */
+static json_value *core_fn_caches(obj_t *obj, const attribute_t *attr,
+                                  const json_value *args)
+{
+    const json_value *val = args;
+    json_value *ret;
+    int i;
+    cache_stats_t tex_stats = {}, assets_stats = {};
+
+    if (val && val->type == json_array)
+        val = val->u.array.length ? val->u.array.values[0] : NULL;
+    if (val && val->type == json_object) {
+        for (i = 0; i < val->u.object.length; i++) {
+            if (val->u.object.values[i].value->type != json_integer) continue;
+            if (hips_set_cache_size(val->u.object.values[i].name,
+                        val->u.object.values[i].value->u.integer)) {
+                LOG_W("Unknown cache: %s", val->u.object.values[i].name);
+            }
+        }
+    }
+    ret = json_object_new(0);
+    hips_list_caches(ret, add_cache_stats);
+    // Also add the GPU textures memory.
+    tex_stats.size = texture_get_total_size(&tex_stats.nb_items);
+    tex_stats.max_size = core->textures_budget;
+    add_cache_stats(ret, "textures", &tex_stats);
+    // And the assets data.
+    assets_stats.size = assets_get_total_size(&assets_stats.nb_items,
+                                              &assets_stats.max_size);
+    add_cache_stats(ret, "assets", &assets_stats);
+    return ret;
+}
+
+// Usage of the memory tiers, see <core_release_memory>.
+static void get_memory_usage(int usage[MEMORY_TIER_COUNT + 1])
+{
+    obj_t *module;
+
+    memset(usage, 0, (MEMORY_TIER_COUNT + 1) * sizeof(*usage));
+    hips_list_caches(usage, add_tiles_usage);
+    DL_FOREACH(core->obj.children, module) {
+        if (!module->klass->release_data) continue;
+        usage[MEMORY_TIER_CATALOGS] += module->klass->release_data(module,
+                                                                   true);
+    }
+    if (core->rend)
+        usage[MEMORY_TIER_TEXT] = render_release_caches(core->rend, true);
+}
+
+void core_list_memory(void *user,
+                      void (*f)(void *user, const char *id,
+                                int64_t cpu, int64_t gpu))
+{
+    obj_t *module;
+    int64_t cpu, gpu;
+
+    DL_FOREACH(core->obj.children, module) {
+        if (!module->id) continue;
+        cpu = gpu = 0;
+        module_get_memory(module, &cpu, &gpu);
+        f(user, module->id, cpu, gpu);
+    }
+    f(user, "assets", assets_get_total_size(NULL, NULL), 0);
+    f(user, "renderer", 0,
+      core->rend ? render_release_caches(core->rend, true) : 0);
+}
+
+static void add_module_memory(void *user, const char *id,
+                              int64_t cpu, int64_t gpu)
+{
+    json_value *val = json_object_new(0);
+    json_object_push(val, "cpu", json_integer_new(cpu));
+    json_object_push(val, "gpu", json_integer_new(gpu));
+    json_object_push(user, id, val);
+}
+
+/*
+ * Get the usage in bytes of all the memory tiers released by
+ * core_release_memory, e.g: {"textures": 1234, "tiles": 5678, ...}.
+ * For the catalogs this is only the data of the hidden modules.
+ *
+ * The "modules" entry has the CPU and GPU memory of each module (see
+ * core_list_memory), e.g: {"stars": {"cpu": 1234, "gpu": 0}, ...}.
+ */
+static json_value *core_fn_memory(obj_t *obj, const attribute_t *attr,
+                                  const json_value *args)
+{
+    const char *names[] = {NULL, "textures", "tiles", "catalogs", "text"};
+    int i, usage[MEMORY_TIER_COUNT + 1];
+    json_value *ret, *modules;
+
+    get_memory_usage(usage);
+    ret = json_object_new(0);
+    for (i = MEMORY_TIER_TEXTURES; i <= MEMORY_TIER_COUNT; i++)
+        json_object_push(ret, names[i], json_integer_new(usage[i]));
+    modules = json_object_new(0);
+    core_list_memory(modules, add_module_memory);
+    json_object_push(ret, "modules", modules);
+    return ret;
+}
+
+/*
+ * Get the rendering stats of the last frame.
+ */
+static json_value *core_fn_render_stats(obj_t *obj, const attribute_t *attr,
+                                        const json_value *args)
+{
+    json_value *ret;
+    render_stats_t stats = {};
+    if (core->rend) render_get_stats(core->rend, &stats);
+    ret = json_object_new(0);
+    json_object_push(ret, "items", json_integer_new(stats.items));
+    json_object_push(ret, "draw_calls", json_integer_new(stats.draw_calls));
+    json_object_push(ret, "program_changes",
+                     json_integer_new(stats.program_changes));
+    json_object_push(ret, "vertices", json_integer_new(stats.vertices));
+    json_object_push(ret, "bytes", json_integer_new(stats.bytes));
+    return ret;
+}
+
+static void add_profile_timer(void *user, const char *id,
+                              double last, double avg, double max)
+{
+    json_value *obj = user, *val;
+    val = json_object_new(0);
+    json_object_push(val, "last", json_double_new(last * 1000));
+    json_object_push(val, "avg", json_double_new(avg * 1000));
+    json_object_push(val, "max", json_double_new(max * 1000));
+    json_object_push(obj, id, val);
+}
+
+/*
+ * Get the profiler timers, as an object of timer id to an object with
+ * the last, average and max durations in ms over the last frames.
+ */
+static json_value *core_fn_profile(obj_t *obj, const attribute_t *attr,
+                                   const json_value *args)
+{
+    json_value *ret;
+    ret = json_object_new(0);
+    profiler_list(ret, add_profile_timer);
+    return ret;
+}
+
+// Name of the instruction set of the SIMD kernels (see simd.h).
+static json_value *core_fn_simd(obj_t *obj, const attribute_t *attr,
+                                const json_value *args)
+{
+    return args_value_new(TYPE_STRING, simd_get_name());
+}
+
+static void add_alloc_site(void *user, const char *file, int line,
+                           int count, double bytes)
+{
+    json_value *obj = user, *val;
+    char buf[256];
+    val = json_object_new(0);
+    json_object_push(val, "count", json_integer_new(count));
+    json_object_push(val, "bytes", json_double_new(bytes));
+    snprintf(buf, sizeof(buf), "%s:%d", file, line);
+    json_object_push(obj, buf, val);
+}
+
+/*
+ * Get the heap allocations of the last frame, as an object of call site
+ * ('file:line') to an object with the number of allocations and their
+ * total size in bytes.  Always empty unless compiled with SWE_ALLOC_TRACK.
+ */
+static json_value *core_fn_allocations(obj_t *obj, const attribute_t *attr,
+                                       const json_value *args)
+{
+    json_value *ret;
+    ret = json_object_new(0);
+    alloc_track_list(ret, add_alloc_site);
+    return ret;
+}
+
+// Add a profiler sample for a given frame phase.
+static void profile(const char *phase, const char *id, double start)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s/%s", phase, id);
+    profiler_add(buf, sys_get_unix_time() - start);
+}
+
 EMSCRIPTEN_KEEPALIVE
 obj_t *core_get_module(const char *id)
 {
@@ -132,6 +398,28 @@ void core_get_proj(projection_t *proj)
     mat4_mul(mat, proj->mat, proj->mat);
 }
 
+EMSCRIPTEN_KEEPALIVE
+bool core_get_rect_corners(double x1, double y1, double x2, double y2,
+                           double out[4][3])
+{
+    const double corners[4][2] = {{x1, y1}, {x2, y1}, {x2, y2}, {x1, y2}};
+    projection_t proj;
+    double p[3];
+    bool ret = true;
+    int i;
+
+    core_get_proj(&proj);
+    observer_update(core->observer, true);
+    for (i = 0; i < 4; i++) {
+        vec3_set(p, corners[i][0], corners[i][1], 0);
+        ret = unproject(&proj, p, p) && ret;
+        vec3_normalize(p, p);
+        convert_frame(core->observer, FRAME_VIEW, FRAME_ICRF, true, p,
+                      out[i]);
+    }
+    return ret;
+}
+
 obj_t *core_get_obj_at(double x, double y, double max_dist)
 {
     double pos[2] = {x, y};
@@ -140,6 +428,10 @@ obj_t *core_get_obj_at(double x, double y, double max_dist)
     // First test the labels, and then the global shape area.
     obj = labels_get_obj_at(pos, 0);
     if (obj) return obj;
+    // With the GPU picking the points are not in the areas.
+    if (core->gpu_picking && core->rend &&
+            render_pick(core->rend, pos, max_dist, &obj) && obj)
+        return obj;
     obj = areas_lookup(core->areas, pos, max_dist);
     if (obj) return obj;
     return NULL;
@@ -185,6 +477,10 @@ static void core_set_default(void)
     core->tonemapper_p = 2.2;     // Setup using atmosphere as reference
 
     tonemapper_update(&core->tonemapper, core->tonemapper_p, 1, 1, core->lwmax);
+    core->redraw.lwmax = core->tonemapper.lwmax;
+    core->redraw.frames = REDRAW_SETTLE_FRAMES;
+    quality_init(&core->quality, 1 / 30.0);
+    core->sky_resolution = 1.0;
 
     core->telescope_auto = true;
     core->mount_frame = FRAME_OBSERVED;
@@ -217,6 +513,7 @@ void core_init(double win_w, double win_h, double pixel_scale)
     char cache_dir[1024];
     obj_klass_t *module;
     obj_t *m;
+    double start, t;
 
     // Why do we even need those attributes?
     assert(!isnan(win_w) && !isnan(win_h) && !isnan(pixel_scale));
@@ -226,10 +523,20 @@ void core_init(double win_w, double win_h, double pixel_scale)
         core_set_default();
         return;
     }
+    start = sys_get_unix_time();
+    simd_init();
+    LOG_I("Startup: SIMD kernels: %s", simd_get_name());
     texture_set_load_callback(NULL, texture_load_function);
     snprintf(cache_dir, sizeof(cache_dir), "%s/%s",
              sys_get_user_dir(), ".cache");
     request_init(cache_dir);
+#ifndef __EMSCRIPTEN__
+    // On the web the tiles are already cached by tiles-cache.js, and we
+    // cannot map files anyway.
+    snprintf(cache_dir, sizeof(cache_dir), "%s/%s",
+             sys_get_user_dir(), ".cache/decoded");
+    hips_set_decoded_cache_dir(cache_dir);
+#endif
 
     core = (core_t*)obj_create("core", NULL);
     core->obj.id = "core";
@@ -237,14 +544,21 @@ void core_init(double win_w, double win_h, double pixel_scale)
     core->win_size[1] = win_h;
     core->win_pixels_scale = pixel_scale;
     core->display_limit_mag = 99;
+    core->textures_budget = 256 * (1 << 20);
 
     core->observer = (observer_t*)obj_create("observer", NULL);
     core->observer->obj.id = "observer";
 
+    // Log the modules that are slow to init, so that we can track the
+    // startup regressions.
     for (module = obj_get_all_klasses(); module; module = module->next) {
         if (!(module->flags & OBJ_MODULE)) continue;
+        t = sys_get_unix_time();
         m = module_add_new(&core->obj, module->id, NULL);
         m->id = module->id;
+        t = sys_get_unix_time() - t;
+        if (t > 0.001)
+            LOG_D("Startup: %s init %.1f ms", module->id, t * 1000);
     }
     DL_SORT(core->obj.children, modules_sort_cmp);
 
@@ -252,6 +566,34 @@ void core_init(double win_w, double win_h, double pixel_scale)
     progressbar_add_listener(on_progressbar);
 
     core_set_default();
+    LOG_I("Startup: core init %.1f ms", (sys_get_unix_time() - start) * 1000);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int core_set_renderer(const char *backend, const char *record_path)
+{
+    renderer_t *rend, *rec;
+
+    if (strcmp(backend, "gl") == 0) {
+        rend = render_create();
+    } else if (strcmp(backend, "null") == 0) {
+        rend = render_create_null();
+    } else {
+        LOG_E("Unknown renderer backend: %s", backend);
+        return -1;
+    }
+    if (record_path) {
+        rec = render_create_recorder(record_path, rend);
+        if (!rec) {
+            render_release(rend);
+            return -1;
+        }
+        rend = rec;
+    }
+    render_release(core->rend);
+    core->rend = rend;
+    core_request_redraw();
+    return 0;
 }
 
 void core_release(void)
@@ -282,19 +624,162 @@ static void update_refraction(double dt, bool on)
     obs->pressure *= core->refraction.value;
 }
 
+EMSCRIPTEN_KEEPALIVE
+void core_request_redraw(void)
+{
+    if (!core) return; // Can happen in the unit tests.
+    core->redraw.frames = REDRAW_SETTLE_FRAMES;
+}
+
+/*
+ * Compute the lwmax that would give a display value of GPU_ADAPTATION_KEY
+ * to the average sky, from a measured average display value.
+ *
+ * The tonemapper maps a luminance to log(1 + p * lw) / log(1 + p * lwmax),
+ * so that we don't even need to know the measured luminance itself.  We
+ * use the current tonemapper even though the measure is a few frames old,
+ * the adaptation is smooth enough for this not to matter.
+ */
+static double lwmax_for_luminance(double value)
+{
+    const double p = core->tonemapper.p;
+    return (pow(1.0 + p * core->tonemapper.lwmax,
+                value / GPU_ADAPTATION_KEY) - 1.0) / p;
+}
+
+// Resolution factor of the sky rendering.
+static double get_sky_scale(void)
+{
+    // The adaptive quality can go down to half the resolution, by steps of
+    // 1/8 so that the renderer doesn't have to resize its buffers at each
+    // frame.
+    double q = quality_get(&core->quality, QUALITY_RESOLUTION);
+    return core->sky_resolution * (1.0 - round((1 - q) * 4) / 8);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int core_release_memory(int tier)
+{
+    const char *caches[] = {"stars", "dsos", "geojson"};
+    int i, ret = 0;
+    obj_t *module;
+
+    if (tier >= MEMORY_TIER_TEXTURES)
+        ret += hips_trim_cache("images", 0);
+    if (tier >= MEMORY_TIER_TILES) {
+        for (i = 0; i < ARRAY_SIZE(caches); i++)
+            ret += hips_trim_cache(caches[i], MEMORY_TILES_FLOOR);
+    }
+    if (tier >= MEMORY_TIER_CATALOGS) {
+        DL_FOREACH(core->obj.children, module) {
+            if (module->klass->release_data)
+                ret += module->klass->release_data(module, false);
+        }
+    }
+    if (tier >= MEMORY_TIER_TEXT && core->rend)
+        ret += render_release_caches(core->rend, false);
+    LOG_I("Memory pressure (tier %d): released %d bytes", tier, ret);
+    return ret;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void *core_save_snapshot(int *size)
+{
+    return snapshot_save(&core->obj, size);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int core_load_snapshot(const void *data, int size)
+{
+    int ret = snapshot_load(&core->obj, data, size);
+    if (ret > 0) core_request_redraw();
+    return ret;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void core_on_gl_context_restored(void)
+{
+    LOG_I("GL context restored");
+    texture_on_context_lost();
+    shader_cache_on_context_lost();
+    static_mesh_on_context_lost();
+    if (core->rend) render_context_restored(core->rend);
+    core_request_redraw();
+}
+
+EMSCRIPTEN_KEEPALIVE
+bool core_needs_render(void)
+{
+    return core->redraw.frames > 0;
+}
+
+// Compute the cooperative tasks budget from the frame headroom.
+static double get_tasks_budget(void)
+{
+    double update = 0, render = 0, tasks = 0;
+    profiler_get("frame/update", &update, NULL);
+    profiler_get("frame/render", &render, NULL);
+    profiler_get("frame/tasks", &tasks, NULL);
+    // The update time includes the tasks themselves.
+    return clamp(core->quality.budget - (update - tasks) - render,
+                 TASKS_MIN_BUDGET, TASKS_MAX_BUDGET);
+}
+
+// Run all the tasks, the cooperative ones within the frame budget.
+static void run_tasks(double dt)
+{
+    double start, deadline;
+    task_t *task, *task_tmp;
+
+    if (!core->tasks) return;
+    start = sys_get_unix_time();
+    core->tasks_budget = get_tasks_budget();
+    deadline = start + core->tasks_budget;
+    DL_FOREACH_SAFE(core->tasks, task, task_tmp) {
+        if (task->cooperative) {
+            if (sys_get_unix_time() >= deadline) continue;
+            task->deadline = deadline;
+        }
+        if (task->fun(task, dt) != 0) {
+            DL_DELETE(core->tasks, task);
+            free(task);
+        }
+    }
+    profile("frame", "tasks", start);
+}
+
+/*
+ * Check if anything changed since the last update that requires to render
+ * the next frames.
+ */
+static void update_redraw(bool changed)
+{
+    observer_update(core->observer, true);
+    changed = changed || core->tasks ||
+              core->observer->hash != core->redraw.obs_hash ||
+              core->fov != core->redraw.fov ||
+              fabs(core->tonemapper.lwmax / core->redraw.lwmax - 1) > 0.001;
+    core->redraw.obs_hash = core->observer->hash;
+    core->redraw.fov = core->fov;
+    core->redraw.lwmax = core->tonemapper.lwmax;
+    if (changed) core_request_redraw();
+}
+
 EMSCRIPTEN_KEEPALIVE
 int core_update(void)
 {
-    bool atm_visible;
-    double lwmax, now, dt;
+    bool atm_visible, changed = false;
+    double lwmax, now, dt, t;
     int r;
     obj_t *atm, *module;
-    task_t *task, *task_tmp;
 
+    trace_begin("core", "update");
     now = sys_get_unix_time();
     dt = now - core->clock;
     dt = fmax(dt, 0.001); // Prevent bug in case the clock goes backward.
     core->clock = now;
+    core->pipeline.frame_dt = mix(core->pipeline.frame_dt ?: dt, dt, 0.1);
+    core->pipeline.done = false;
 
     atm = core_get_module("atmosphere");
     assert(atm);
@@ -305,6 +790,9 @@ int core_update(void)
     if (core->telescope_auto)
         telescope_auto(&core->telescope, core->fov);
     progressbar_update();
+    assets_update();
+    // Delete the objects whose last reference was released by a worker.
+    worker_run_deferred();
 
     // Update eye adaptation.
     if (core->fast_adaptation && core->lwmax > core->tonemapper.lwmax) {
@@ -317,7 +805,6 @@ int core_update(void)
 
     tonemapper_update(&core->tonemapper, core->tonemapper_p, -1,
                       core->exposure_scale, lwmax);
-    core->lwmax = core->lwmax_min; // Reset for next frame.
 
     // Adjust star linear scale in function of screen pixel size
     // It ranges from 0.7 for a small screen to 1.5 for large screens
@@ -327,22 +814,28 @@ int core_update(void)
 
     // Defined in navigation.c
     core_update_observer(dt);
-
-    DL_FOREACH_SAFE(core->tasks, task, task_tmp) {
-        if (task->fun(task, dt) != 0) {
-            DL_DELETE(core->tasks, task);
-            free(task);
-        }
-    }
+    changed = quality_update(&core->quality, dt);
+    run_tasks(dt);
 
     DL_SORT(core->obj.children, modules_sort_cmp);
     DL_FOREACH(core->obj.children, module) {
         if (module->klass->update) {
+            t = sys_get_unix_time();
             r = module->klass->update(module, dt);
             if (r < 0) LOG_E("Error updating module '%s'", module->id);
+            // A positive value means that something is still moving.
+            if (r > 0) changed = true;
+            profile("update", module->id, t);
         }
     }
-
+    // Also catch the faders updated during the last render.
+    if (faders_animating()) changed = true;
+    update_redraw(changed);
+    // Changes done during the render are sent at the next frame.
+    module_flush_changes();
+
+    profile("frame", "update", now);
+    trace_end("core", "update");
     return 0;
 }
 
@@ -403,7 +896,8 @@ static void core_get_point_for_mag_(
  *   luminance - Output luminance from 0 to 1, gamma corrected.  Ignored if
  *               set to NULL.
  */
-bool core_get_point_for_mag(double mag, double *radius, double *luminance)
+static bool compute_point_for_mag(double mag, double *radius,
+                                  double *luminance)
 {
     double ld, r;
     double r_min = core->min_point_radius;
@@ -438,6 +932,67 @@ bool core_get_point_for_mag(double mag, double *radius, double *luminance)
     return true;
 }
 
+static void point_lut_update(void)
+{
+    int i;
+    double r, ld;
+    const point_lut_inputs_t inputs = {
+        .tonemapper = {core->tonemapper.p, core->tonemapper.lwmax,
+                       core->tonemapper.exposure},
+        .light_grasp = core->telescope.light_grasp,
+        .magnification = core->telescope.magnification,
+        .star_linear_scale = core->star_linear_scale,
+        .star_scale_screen_factor = core->star_scale_screen_factor,
+        .star_relative_scale = core->star_relative_scale,
+        .bortle_index = core->bortle_index,
+        .max_point_radius = core->max_point_radius,
+        .min_point_radius = core->min_point_radius,
+        .skip_point_radius = core->skip_point_radius,
+        .win_pixels_scale = core->win_pixels_scale,
+    };
+
+    g_point_lut.valid = true;
+    // The inputs usually only change while zooming or during the eye
+    // adaptation, so most frames can keep the same table.
+    if (g_point_lut.computed &&
+            memcmp(&inputs, &g_point_lut.inputs, sizeof(inputs)) == 0)
+        return;
+    for (i = 0; i < POINT_LUT_SIZE; i++) {
+        compute_point_for_mag(POINT_LUT_MIN_MAG + i * POINT_LUT_STEP,
+                              &r, &ld);
+        g_point_lut.radius[i] = r;
+        g_point_lut.luminance[i] = ld;
+    }
+    g_point_lut.inputs = inputs;
+    g_point_lut.computed = true;
+}
+
+bool core_get_point_for_mag(double mag, double *radius, double *luminance)
+{
+    double x, k;
+    int i;
+
+    x = (mag - POINT_LUT_MIN_MAG) / POINT_LUT_STEP;
+    if (!g_point_lut.valid || !(x >= 0 && x < POINT_LUT_SIZE - 1))
+        return compute_point_for_mag(mag, radius, luminance);
+
+    // Interpolate between the two closest values, except around the skip
+    // radius where we just use the closest one.
+    i = x;
+    k = x - i;
+    if (!g_point_lut.radius[i] || !g_point_lut.radius[i + 1]) {
+        if (k >= 0.5) i++;
+        *radius = g_point_lut.radius[i];
+        if (luminance) *luminance = g_point_lut.luminance[i];
+        return *radius != 0;
+    }
+    *radius = mix(g_point_lut.radius[i], g_point_lut.radius[i + 1], k);
+    if (luminance)
+        *luminance = mix(g_point_lut.luminance[i],
+                         g_point_lut.luminance[i + 1], k);
+    return *radius != 0;
+}
+
 double core_get_hints_mag_offset(const double win_pos[2])
 {
     const double center[2] = {core->win_size[0] / 2, core->win_size[1] / 2};
@@ -516,13 +1071,105 @@ static void render_proj_markers(const painter_t *painter_)
     }
 }
 
+/*
+ * Late latching of the view orientation.
+ *
+ * Let the client process the inputs received while we were traversing the
+ * catalogs, and if the view orientation changed, apply the rotation to the
+ * items already sent to the renderer instead of waiting for the next frame.
+ * The items in window coordinates get an affine approximation of the
+ * motion, fitted at the center of the screen.  The other changes (like the
+ * fov) only apply at the next frame.
+ */
+static void late_latch_view(const painter_t *painter)
+{
+    observer_t *obs = core->observer;
+    const projection_t *proj = painter->proj;
+    const double d = 32; // Size of the fit, in window units.
+    double yaw = obs->yaw, pitch = obs->pitch;
+    double rv2o[3][3], rot[3][3], win[3][3], p[3][3], q[3][2];
+    int i;
+
+    mat3_copy(obs->rv2o, rv2o);
+    core->on_late_input();
+    if (obs->yaw == yaw && obs->pitch == pitch) return;
+    observer_update(obs, true);
+    mat3_mul(obs->ro2v, rv2o, rot);
+
+    mat3_set_identity(win);
+    for (i = 0; i < 3; i++) {
+        p[i][0] = proj->window_size[0] / 2 + (i == 1 ? d : 0);
+        p[i][1] = proj->window_size[1] / 2 + (i == 2 ? d : 0);
+        p[i][2] = 0.5;
+        if (!unproject(proj, p[i], p[i])) goto end;
+        mat3_mul_vec3(rot, p[i], p[i]);
+        if (!project_to_win_xy(proj, p[i], q[i])) goto end;
+    }
+    for (i = 0; i < 2; i++) {
+        win[0][i] = (q[1][i] - q[0][i]) / d;
+        win[1][i] = (q[2][i] - q[0][i]) / d;
+    }
+    for (i = 0; i < 2; i++) {
+        win[2][i] = q[0][i] - win[0][i] * proj->window_size[0] / 2
+                            - win[1][i] * proj->window_size[1] / 2;
+    }
+end:
+    render_set_late_view(painter->rend, rot, win);
+}
+
+/*
+ * Pipelined mode: give the modules a chance to start the background work
+ * of the next update (positions batches...) before we flush the render,
+ * so that it runs in the workers pool while the renderer submits the
+ * commands, instead of after the next update.
+ *
+ * The modules get a copy of the observer advanced to the predicted time of
+ * the next update.  Only the view independent work should be started from
+ * it: the culling is still done at render time with the latest view, so
+ * that the inputs get no extra frame of latency.  If the next update
+ * doesn't match the prediction (time jump, new location...), the modules
+ * see that their results are outdated and compute them again, as they
+ * would without the pipelined mode.
+ */
+static void pipeline_update_ahead(void)
+{
+    observer_t *next = &core->pipeline.obs;
+    obj_t *module;
+    double dut1, t;
+
+    // Only once per update, even if we render several views.
+    if (core->pipeline.done) return;
+    core->pipeline.done = true;
+    // We can't predict the time animations.
+    if (core->time_animation.src_time) return;
+
+    trace_begin("core", "update_ahead");
+    // Plain copy, without the object attributes.
+    memcpy((char*)next + sizeof(obj_t), (char*)core->observer + sizeof(obj_t),
+           sizeof(*next) - sizeof(obj_t));
+    next->obj.klass = core->observer->obj.klass;
+    next->tt += core->pipeline.frame_dt * core->time_speed / 86400;
+    next->utc = tt2utc(next->tt, &dut1);
+    next->ut1 = next->utc + dut1 / ERFA_DAYSEC;
+    observer_update(next, true);
+
+    DL_FOREACH(core->obj.children, module) {
+        if (!module->klass->update_ahead) continue;
+        t = sys_get_unix_time();
+        if (module->klass->update_ahead(module, next) < 0)
+            LOG_E("Error updating ahead module '%s'", module->id);
+        profile("update_ahead", module->id, t);
+    }
+    trace_end("core", "update_ahead");
+}
 
 EMSCRIPTEN_KEEPALIVE
 int core_render(double win_w, double win_h, double pixel_scale)
 {
     obj_t *module;
     projection_t proj;
-    double max_vmag, hints_vmag;
+    painter_clip_t clip;
+    double max_vmag, hints_vmag, start, t, lum;
 
     // Used to make sure some values are not touched during render.
     struct {
@@ -534,6 +1181,18 @@ int core_render(double win_w, double win_h, double pixel_scale)
     };
     (void)bck;
 
+    trace_begin("core", "render");
+    start = sys_get_unix_time();
+    alloc_track_frame();
+    quality_on_render(&core->quality, start);
+    if (core->redraw.frames > 0) core->redraw.frames--;
+    if (    win_w != core->win_size[0] || win_h != core->win_size[1] ||
+            pixel_scale != core->win_pixels_scale)
+        core_request_redraw();
+    // Reset for this frame, the rendered objects report their luminance.
+    // We don't do it in core_update so that the eye adaptation still uses
+    // the last rendered value when the client skips some frames.
+    core->lwmax = core->lwmax_min;
     core->win_size[0] = win_w;
     core->win_size[1] = win_h;
     core->win_pixels_scale = pixel_scale;
@@ -541,6 +1200,8 @@ int core_render(double win_w, double win_h, double pixel_scale)
 
     observer_update(core->observer, true);
     max_vmag = compute_vmag_for_radius(core->skip_point_radius);
+    // Lose up to two magnitudes of stars if we need to go faster.
+    max_vmag -= 2 * (1 - quality_get(&core->quality, QUALITY_STARS));
     hints_vmag = compute_vmag_for_radius(core->show_hints_radius);
 
     fps_tick(&core->fps, sys_get_unix_time());
@@ -548,6 +1209,17 @@ int core_render(double win_w, double win_h, double pixel_scale)
 
     if (!core->rend)
         core->rend = render_create();
+    render_set_sky_scale(core->rend, get_sky_scale());
+    core->luminance_measured = core->gpu_adaptation &&
+            render_measure_luminance(core->rend, &lum);
+    // Keep the ids buffer around the pointer, so that a click or a hover
+    // there gets a result without waiting for the read back.
+    if (core->gpu_picking)
+        render_pick(core->rend, core->pointer_pos, 0, NULL);
+    if (core->luminance_measured) {
+        core->lwmax = fmax(core->lwmax_min, lwmax_for_luminance(lum));
+        core->fast_adaptation = false;
+    }
     labels_reset();
 
     painter_t painter = {
@@ -566,25 +1238,45 @@ int core_render(double win_w, double win_h, double pixel_scale)
         .lines.glow = 0.2,
         .flags = (is_below_horizon_hidden() ? PAINTER_HIDE_BELOW_HORIZON : 0),
     };
-    painter_update_clip_info(&painter);
+    painter_update_clip_info(&painter, &clip);
     paint_prepare(&painter, win_w, win_h, pixel_scale);
+    point_lut_update();
 
     DL_FOREACH(core->obj.children, module) {
+        t = sys_get_unix_time();
         obj_render(module, &painter);
+        profile("render", module->id, t);
     }
 
     // Render the viewport cap for debugging.
     if ((0)) {
         paint_cap(&painter, FRAME_ICRF,
-                  painter.clip_info[FRAME_ICRF].bounding_cap);
+                  clip.frames[FRAME_ICRF].bounding_cap);
     }
 
     if ((0)) {
         render_proj_markers(&painter);
     }
 
+    if (core->on_late_input) {
+        late_latch_view(&painter);
+        bck.obs.yaw = core->observer->yaw;
+        bck.obs.pitch = core->observer->pitch;
+    }
+
+    if (core->pipelined) pipeline_update_ahead();
+
     // Flush all rendering pipeline
+    t = sys_get_unix_time();
+    trace_begin("core", "paint_finish");
     paint_finish(&painter);
+    trace_end("core", "paint_finish");
+    profile("render", "paint_finish", t);
+
+    // Start the tile requests collected during the rendering.
+    hips_update_fetch_queue();
+    hips_apply_textures_budget(core->textures_budget);
+    hips_update_decoded_saves(false);
 
     assert(bck.obs.tt == core->observer->tt);
     assert(bck.obs.yaw == core->observer->yaw);
@@ -597,14 +1289,36 @@ int core_render(double win_w, double win_h, double pixel_scale)
             module->klass->post_render(module, &painter);
     }
 
+    // The core values can change until next frame.
+    g_point_lut.valid = false;
+    profile("frame", "render", start);
+    trace_end("core", "render");
     return 0;
 }
 
+EMSCRIPTEN_KEEPALIVE
+uint8_t *core_render_to_png(double win_w, double win_h, double pixel_scale,
+                            int *size)
+{
+    int w = win_w * pixel_scale, h = win_h * pixel_scale;
+    uint8_t *img, *ret = NULL;
+
+    core_render(win_w, win_h, pixel_scale);
+    img = malloc(w * h * 4);
+    if (render_read_pixels(core->rend, w, h, img))
+        ret = img_write_to_mem(img, w, h, 4, size);
+    free(img);
+    return ret;
+}
+
 EMSCRIPTEN_KEEPALIVE
 void core_on_mouse(int id, int state, double x, double y, int buttons)
 {
     obj_t *module;
     int r;
+    core_request_redraw();
+    core->pointer_pos[0] = x;
+    core->pointer_pos[1] = y;
     DL_FOREACH(core->obj.children, module) {
         if (!module->klass->on_mouse) continue;
         r = module->klass->on_mouse(module, id, state, x, y, buttons);
@@ -618,6 +1332,7 @@ void core_on_pinch(int state, double x, double y, double scale,
 {
     obj_t *module;
     int r;
+    core_request_redraw();
     DL_FOREACH(core->obj.children, module) {
         if (!module->klass->on_pinch) continue;
         r = module->klass->on_pinch(module, state, x, y, scale, points_count);
@@ -650,6 +1365,7 @@ void core_on_key(int key, int action)
     char buf[128];
 
     core->inputs.keys[key] = (action != KEY_ACTION_UP);
+    core_request_redraw();
 
     if (core->gui_want_capture_mouse) return;
     if (action != KEY_ACTION_DOWN) return;
@@ -671,6 +1387,7 @@ void core_on_key(int key, int action)
 void core_on_char(uint32_t c)
 {
     int i;
+    core_request_redraw();
     if (c > 0 && c < 0x10000) {
         for (i = 0; i < ARRAY_SIZE(core->inputs.chars); i++) {
             if (!core->inputs.chars[i]) {
@@ -685,6 +1402,7 @@ EMSCRIPTEN_KEEPALIVE
 void core_on_zoom(double k, double x, double y)
 {
     obj_t *module;
+    core_request_redraw();
     DL_FOREACH(core->obj.children, module) {
         if (module->klass->on_zoom) {
             if (module->klass->on_zoom(module, k, x, y) == 0)
@@ -774,6 +1492,12 @@ double core_mag_to_lum_apparent(double mag, double surf)
  *   Angular radius in radian.  This is the physical radius, not scaled by
  *   the fov.
  */
+bool core_is_outdated_at_time_speed(double duration, double max_age)
+{
+    // Keep at least half of the max age to actually use the results.
+    return duration / 86400 * fabs(core->time_speed) > max_age / 2;
+}
+
 double core_get_apparent_angle_for_point(const projection_t *proj, double r)
 {
     const double win_h = proj->window_size[1];
@@ -818,6 +1542,8 @@ void core_report_vmag_in_fov(double vmag, double r, double sep)
 {
     double lf, lum, r2;
 
+    if (core->luminance_measured) return;
+
     // Compute flux and luminance.
     vmag -= core->telescope.gain_mag;
     // E = 10.8e4 / R2AS^2 * 10^(-0.4 * m)
@@ -851,6 +1577,7 @@ void core_report_vmag_in_fov(double vmag, double r, double sep)
 
 void core_report_luminance_in_fov(double lum, bool fast_adaptation)
 {
+    if (core->luminance_measured) return;
     if (lum > core->lwmax) {
         core->fast_adaptation = fast_adaptation;
         core->lwmax = lum;
@@ -971,12 +1698,144 @@ const char *otype_to_str(const char *otype)
     return res ? res : "";
 }
 
-void core_add_task(int (*fun)(task_t *task, double dt), void *user)
+static void add_task(int (*fun)(task_t *task, double dt), void *user,
+                     int priority, bool cooperative)
 {
-    task_t *task = calloc(1, sizeof(*task));
+    task_t *task = calloc(1, sizeof(*task)), *other;
     task->fun = fun;
     task->user = user;
-    DL_APPEND(core->tasks, task);
+    task->cooperative = cooperative;
+    task->priority = priority;
+    // Keep the list sorted by priority, and by order of addition.
+    DL_FOREACH(core->tasks, other) {
+        if (other->priority < priority) break;
+    }
+    if (other)
+        DL_PREPEND_ELEM(core->tasks, other, task);
+    else
+        DL_APPEND(core->tasks, task);
+}
+
+void core_add_task(int (*fun)(task_t *task, double dt), void *user)
+{
+    add_task(fun, user, TASK_PRIORITY_NORMAL, false);
+}
+
+void core_add_task2(int (*fun)(task_t *task, double dt), void *user,
+                    int priority)
+{
+    add_task(fun, user, priority, true);
+}
+
+bool core_task_should_yield(const task_t *task)
+{
+    return task->cooperative && sys_get_unix_time() >= task->deadline;
+}
+
+/*
+ * Index of the designations of all the modules children, used to make
+ * core_search and core_search_prefix fast.  The entries only keep weak
+ * pointers to the objects, so the index is rebuilt each time a module
+ * child is added or removed.
+ */
+typedef struct dsgn_entry {
+    UT_hash_handle  hh;
+    obj_t           *obj;
+    const char      *dsgn;
+    char            key[]; // Normalized designation, followed by dsgn.
+} dsgn_entry_t;
+
+static struct {
+    bool            valid;
+    int             version;
+    dsgn_entry_t    *map;
+    dsgn_entry_t    **sorted;   // Entries sorted by key for prefix lookup.
+    int             nb;
+} g_search_index = {};
+
+// Normalize a designation for the index: lower case, with the multiple
+// spaces collapsed.  Return the length, or -1 if it doesn't fit in out.
+static int dsgn_normalize(const char *dsgn, char *out, int size)
+{
+    int len = 0;
+    bool space = false;
+    for (; *dsgn; dsgn++) {
+        if (*dsgn == ' ' || *dsgn == '\t') {
+            space = len > 0;
+            continue;
+        }
+        if (len + 2 >= size) return -1;
+        if (space) out[len++] = ' ';
+        space = false;
+        out[len++] = (*dsgn >= 'A' && *dsgn <= 'Z') ? *dsgn + 32 : *dsgn;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static void search_index_clear(void)
+{
+    dsgn_entry_t *entry, *tmp;
+    HASH_ITER(hh, g_search_index.map, entry, tmp) {
+        HASH_DEL(g_search_index.map, entry);
+        free(entry);
+    }
+    free(g_search_index.sorted);
+    g_search_index.sorted = NULL;
+    g_search_index.nb = 0;
+    g_search_index.valid = false;
+}
+
+static void search_index_on_dsgn(const obj_t *obj, void *user,
+                                 const char *dsgn)
+{
+    char key[256];
+    int len;
+    dsgn_entry_t *entry;
+
+    len = dsgn_normalize(dsgn, key, sizeof(key));
+    if (len <= 0) return;
+    HASH_FIND(hh, g_search_index.map, key, len, entry);
+    if (entry) return; // First object added wins.
+    entry = calloc(1, sizeof(*entry) + len + 1 + strlen(dsgn) + 1);
+    entry->obj = (obj_t*)obj;
+    memcpy(entry->key, key, len + 1);
+    entry->dsgn = entry->key + len + 1;
+    strcpy((char*)entry->dsgn, dsgn);
+    HASH_ADD_KEYPTR(hh, g_search_index.map, entry->key, len, entry);
+}
+
+static void search_index_add_children(const obj_t *obj)
+{
+    obj_t *child;
+    DL_FOREACH(obj->children, child) {
+        obj_get_designations(child, NULL, search_index_on_dsgn);
+        search_index_add_children(child);
+    }
+}
+
+static int dsgn_entry_cmp(const void *a, const void *b)
+{
+    return strcmp((*(dsgn_entry_t**)a)->key, (*(dsgn_entry_t**)b)->key);
+}
+
+static void search_index_update(void)
+{
+    int i = 0, version = module_get_children_version();
+    dsgn_entry_t *entry;
+
+    if (g_search_index.valid && g_search_index.version == version) return;
+    search_index_clear();
+    search_index_add_children(&core->obj);
+    g_search_index.nb = HASH_COUNT(g_search_index.map);
+    g_search_index.sorted = calloc(g_search_index.nb,
+                                   sizeof(*g_search_index.sorted));
+    for (entry = g_search_index.map; entry; entry = entry->hh.next)
+        g_search_index.sorted[i++] = entry;
+    qsort(g_search_index.sorted, g_search_index.nb,
+          sizeof(*g_search_index.sorted), dsgn_entry_cmp);
+    g_search_index.version = version;
+    g_search_index.valid = true;
 }
 
 static void on_designation(const obj_t *obj, void *user, const char *dsgn)
@@ -1001,13 +1860,59 @@ EMSCRIPTEN_KEEPALIVE
 obj_t *core_search(const char *query)
 {
     obj_t *module, *ret = NULL;
+    char key[256];
+    int len;
+    dsgn_entry_t *entry = NULL;
+
+    search_index_update();
+    len = dsgn_normalize(query, key, sizeof(key));
+    if (len > 0) HASH_FIND(hh, g_search_index.map, key, len, entry);
+    // Make sure the object didn't change its designations since we
+    // built the index.
+    if (entry) obj_get_designations(entry->obj,
+                                    USER_PASS(entry->dsgn, &ret),
+                                    on_designation);
+    if (ret) return ret;
+
     DL_FOREACH(core->obj.children, module) {
         module_list_objs(module, NAN, 0, NULL, USER_PASS((void*)query, &ret),
                          on_search);
     }
+    // If we found a module child that was not in the index, its
+    // designations changed after it was added, so rebuild the index.
+    if (ret && ret->parent && !entry) g_search_index.valid = false;
     return ret;
 }
 
+EMSCRIPTEN_KEEPALIVE
+int core_search_prefix(const char *prefix, int max, void *user,
+                       void (*f)(const obj_t *obj, void *user,
+                                 const char *dsgn))
+{
+    char key[256];
+    int len, i, lo, hi, nb = 0;
+    dsgn_entry_t *entry;
+
+    search_index_update();
+    len = dsgn_normalize(prefix, key, sizeof(key));
+    if (len < 0) return 0;
+    // Binary search of the first key not smaller than the prefix.
+    lo = 0;
+    hi = g_search_index.nb;
+    while (lo < hi) {
+        i = (lo + hi) / 2;
+        if (strcmp(g_search_index.sorted[i]->key, key) < 0) lo = i + 1;
+        else hi = i;
+    }
+    for (i = lo; i < g_search_index.nb && (max <= 0 || nb < max); i++) {
+        entry = g_search_index.sorted[i];
+        if (strncmp(entry->key, key, len) != 0) break;
+        if (f) f(entry->obj, user, entry->dsgn);
+        nb++;
+    }
+    return nb;
+}
+
 static obj_klass_t core_klass = {
     .id = "core",
     .size = sizeof(core_t),
@@ -1020,6 +1925,12 @@ static obj_klass_t core_klass = {
         PROPERTY(selection, TYPE_OBJ, MEMBER(core_t, selection)),
         PROPERTY(lock, TYPE_OBJ, MEMBER(core_t, target.lock)),
         PROPERTY(progressbars, TYPE_JSON, .fn = core_fn_progressbars),
+        PROPERTY(caches, TYPE_JSON, .fn = core_fn_caches),
+        PROPERTY(memory, TYPE_JSON, .fn = core_fn_memory),
+        PROPERTY(render_stats, TYPE_JSON, .fn = core_fn_render_stats),
+        PROPERTY(profile, TYPE_JSON, .fn = core_fn_profile),
+        PROPERTY(simd, TYPE_STRING, .fn = core_fn_simd),
+        PROPERTY(allocations, TYPE_JSON, .fn = core_fn_allocations),
         PROPERTY(fps, TYPE_INT, MEMBER(core_t, fps.avg)),
         PROPERTY(clicks, TYPE_INT, MEMBER(core_t, clicks)),
         PROPERTY(zoom, TYPE_FLOAT, MEMBER(core_t, zoom)),
@@ -1033,6 +1944,8 @@ static obj_klass_t core_klass = {
         PROPERTY(tonemapper_p, TYPE_FLOAT, MEMBER(core_t, tonemapper_p)),
         PROPERTY(display_limit_mag, TYPE_FLOAT,
                  MEMBER(core_t, display_limit_mag)),
+        PROPERTY(textures_budget, TYPE_INT,
+                 MEMBER(core_t, textures_budget)),
         PROPERTY(center_hints_mag_offset, TYPE_FLOAT,
                  MEMBER(core_t, center_hints_mag_offset)),
         PROPERTY(flip_view_vertical, TYPE_BOOL,
@@ -1042,10 +1955,20 @@ static obj_klass_t core_klass = {
         PROPERTY(mount_frame, TYPE_ENUM, MEMBER(core_t, mount_frame)),
         PROPERTY(on_click, TYPE_FUNC, MEMBER(core_t, on_click)),
         PROPERTY(on_rect, TYPE_FUNC, MEMBER(core_t, on_rect)),
+        PROPERTY(on_late_input, TYPE_FUNC, MEMBER(core_t, on_late_input)),
         PROPERTY(time_animation_target, TYPE_MJD,
                  MEMBER(core_t, time_animation.dst_utc)),
         PROPERTY(time_speed, TYPE_FLOAT, MEMBER(core_t, time_speed)),
         PROPERTY(y_offset, TYPE_FLOAT, MEMBER(core_t, y_offset)),
+        PROPERTY(quality, TYPE_FLOAT, MEMBER(core_t, quality.level)),
+        PROPERTY(quality_auto, TYPE_BOOL, MEMBER(core_t, quality.enabled)),
+        PROPERTY(quality_budget, TYPE_FLOAT, MEMBER(core_t, quality.budget)),
+        PROPERTY(sky_resolution, TYPE_FLOAT,
+                 MEMBER(core_t, sky_resolution)),
+        PROPERTY(gpu_adaptation, TYPE_BOOL,
+                 MEMBER(core_t, gpu_adaptation)),
+        PROPERTY(gpu_picking, TYPE_BOOL, MEMBER(core_t, gpu_picking)),
+        PROPERTY(pipelined, TYPE_BOOL, MEMBER(core_t, pipelined)),
         {}
     }
 };
@@ -1085,6 +2008,55 @@ static void test_core(void)
     obj_get_attr(obs, "utc", &v);
 }
 
+// Render a frame with the recorder over the null renderer.
+static void test_record_renderer(void)
+{
+    const char *path = "/tmp/swe_test_record.bin";
+    char *data;
+    int size;
+    uint32_t header[2];
+    render_stats_t stats;
+
+    assert(core_set_renderer("vulkan", NULL) == -1);
+    assert(core_set_renderer("null", path) == 0);
+    core_update();
+    core_render(100, 100, 1.0);
+    render_get_stats(core->rend, &stats);
+    assert(stats.items > 0);
+    render_release(core->rend);
+    core->rend = NULL;
+    texture_set_headless(false);
+
+    // The file starts with the magic and version, then the first frame.
+    data = read_file(path, &size);
+    assert(data && size > 16);
+    assert(memcmp(data, "SWRR", 4) == 0);
+    memcpy(header, data + 8, sizeof(header));
+    assert(header[0] == 1); // REC_PREPARE.
+    free(data);
+    remove(path);
+}
+
+// Check that the points lookup table follows the changes of its inputs.
+static void test_point_lut(void)
+{
+    const double mags[] = {-5, 0.123, 6.5, 35.999};
+    double scale = core->star_linear_scale, r1, r2, l1, l2;
+    int i, j;
+
+    for (i = 0; i < 2; i++) {
+        core->star_linear_scale = scale * (i + 1);
+        point_lut_update();
+        for (j = 0; j < ARRAY_SIZE(mags); j++) {
+            compute_point_for_mag(mags[j], &r1, &l1);
+            core_get_point_for_mag(mags[j], &r2, &l2);
+            assert(fabs(r1 - r2) < 0.01 && fabs(l1 - l2) < 0.01);
+        }
+    }
+    core->star_linear_scale = scale;
+    g_point_lut.valid = false;
+}
+
 static void test_basic(void)
 {
     obj_t *obj;
@@ -1092,6 +2064,10 @@ static void test_basic(void)
     obj = core_search("NAME Sun");
     assert(obj);
     obj_release(obj);
+    obj = core_search("name  sun");
+    assert(obj);
+    obj_release(obj);
+    assert(core_search_prefix("NAME Su", 0, NULL, NULL) >= 1);
 }
 
 static void test_info(void)
@@ -1105,6 +2081,8 @@ static void test_info(void)
 }
 
 TEST_REGISTER(NULL, test_core, TEST_AUTO);
+TEST_REGISTER(NULL, test_record_renderer, TEST_AUTO);
+TEST_REGISTER(NULL, test_point_lut, TEST_AUTO);
 TEST_REGISTER(NULL, test_vec, TEST_AUTO);
 TEST_REGISTER(NULL, test_basic, TEST_AUTO);
 TEST_REGISTER(NULL, test_info, TEST_AUTO);
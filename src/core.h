@@ -19,6 +19,7 @@
 #include "obj.h"
 #include "module.h"
 #include "otypes.h"
+#include "quality.h"
 #include "telescope.h"
 #include "tonemapper.h"
 
@@ -34,18 +35,32 @@ extern core_t *core;    // Global core object.
 
 /******* Section: Core ****************************************************/
 
+// Priorities of the cooperative tasks, see <core_add_task2>.
+enum {
+    TASK_PRIORITY_LOW       = -1,
+    TASK_PRIORITY_NORMAL    = 0,
+    TASK_PRIORITY_HIGH      = 1,
+};
+
 /*
  * Type: task_t
  * Contains info about some extra running tasks.
  *
  * All the tasks will be called once before the module update.  A task runs
  * as long as it returns zero.
+ *
+ * The cooperative tasks (added with <core_add_task2>) share a single time
+ * budget per frame, and should return as soon as <core_task_should_yield>
+ * is true.
  */
 struct task
 {
     task_t *next, *prev;
     int (*fun)(task_t *task, double dt);
     void *user;
+    bool cooperative;
+    int priority;
+    double deadline; // Time at which a cooperative task should yield.
 };
 
 /* Type: core_t
@@ -69,6 +84,10 @@ struct core
     // of zoom/exposure levels. Set to e.g. 99 to practically disable.
     double          display_limit_mag;
 
+    // Max GPU memory used by the textures in bytes (0 for no limit).  We
+    // release the images tiles to stay below it.
+    int             textures_budget;
+
     // Extra hints mag offset applied around the center of the screen, to
     // show more labels near the center if needed.  See
     // core_get_hints_mat_offset for detail on the algo used.
@@ -79,6 +98,15 @@ struct core
     double          tonemapper_p;
     double          lwmax; // Max visible luminance.
     double          lwmax_min; // Min value for lwmax.
+    // Use the luminance measured on the GPU for the eye adaptation,
+    // instead of the values reported by the modules.  See
+    // <render_measure_luminance>.
+    bool            gpu_adaptation;
+    bool            luminance_measured; // Set if we got a measure.
+    // Pick the points with the object ids buffer rendered on the GPU,
+    // instead of the areas.  See <render_pick>.
+    bool            gpu_picking;
+    double          pointer_pos[2]; // Last mouse or touch position.
     double          lwsky_average;  // Current average sky luminance
     double          max_point_radius; // Max radius in pixel.
     double          min_point_radius;
@@ -161,9 +189,43 @@ struct core
     bool (*on_click)(double x, double y);
     // Callback called if we do a rectangle selection.
     bool (*on_rect)(double x1, double y1, double x2, double y2);
+    // Callback called just before the render flush, so that the client
+    // can process the latest inputs.  If the view orientation changed we
+    // apply the new one to the rendered frame (late latching).
+    void (*on_late_input)(void);
 
-    // List of running tasks.
+    // List of running tasks, sorted by priority.
     task_t *tasks;
+    // Time budget of the cooperative tasks for the current frame (sec).
+    double tasks_budget;
+
+    // Adaptive rendering quality, lowered when the frames are too slow.
+    quality_t quality;
+
+    // Resolution factor of the sky rendering.  The texts and vector
+    // graphics are always rendered at the native resolution.  See
+    // <render_set_sky_scale>.
+    double sky_resolution;
+
+    // Pipelined mode: let the modules start the background work of the
+    // next frame just before the render flush, so that the workers run
+    // while the renderer submits the commands.  See <obj_klass_t>
+    // update_ahead.
+    bool pipelined;
+    struct {
+        observer_t  obs;        // Predicted observer of the next update.
+        double      frame_dt;   // Average real time between updates (s).
+        bool        done;       // Set once started for the last update.
+    } pipeline;
+
+    // State of the last update, used to tell if the next frame would be
+    // any different from the last rendered one.  See <core_needs_render>.
+    struct {
+        uint64_t    obs_hash;
+        double      fov;
+        double      lwmax;
+        int         frames; // Number of frames we still have to render.
+    } redraw;
 
     // Can be used for debugging.  It's convenient to have an exposed test
     // attribute.
@@ -197,6 +259,25 @@ enum {
 
 void core_init(double win_w, double win_h, double pixel_scale);
 
+/*
+ * Function: core_set_renderer
+ * Change the renderer backend used by <core_render>.
+ *
+ * By default the core creates the OpenGL renderer at the first render.
+ *
+ * Parameters:
+ *   backend     - "gl" for the OpenGL renderer, or "null" for a renderer
+ *                 that only counts the render calls (see
+ *                 <render_create_null>).
+ *   record_path - If set, also save all the render calls into this file
+ *                 (see <render_create_recorder>).
+ *
+ * Return:
+ *   0 on success, or -1 if the backend is unknown or the record file
+ *   cannot be created.  In that case the current renderer is kept.
+ */
+int core_set_renderer(const char *backend, const char *record_path);
+
 void core_release(void);
 
 /*
@@ -205,7 +286,152 @@ void core_release(void);
  */
 int core_update(void);
 
+/*
+ * Function: core_render
+ * Render the sky with the current observer and projection.
+ *
+ * To render several views of the same instant (for example for a dome or
+ * a multi screen setup), call it once per view, only changing the observer
+ * direction and the fov in between: the observer then only updates its
+ * view matrices, and the modules reuse the positions and magnitudes they
+ * cached for the same observer hash_sky value.
+ */
 int core_render(double win_w, double win_h, double pixel_scale);
+
+/*
+ * Function: core_render_to_png
+ * Render the sky and return the framebuffer content as a png image.
+ *
+ * This is meant for the native headless clients generating images, with
+ * an offscreen GL context current.  Since the data and tiles are loaded
+ * asynchronously, the client should first call <core_update> and
+ * <core_render> until <core_needs_render> returns false.  The loaded
+ * catalogs and tiles stay in the cache for the next images.
+ *
+ * Parameters:
+ *   win_w       - Width of the image (in window units).
+ *   win_h       - Height of the image (in window units).
+ *   pixel_scale - Ratio of the framebuffer size to the window size.
+ *   size        - Output size of the returned data.
+ *
+ * Return:
+ *   The png data, to be freed by the caller, or NULL if the renderer
+ *   doesn't support reading back the pixels.
+ */
+uint8_t *core_render_to_png(double win_w, double win_h, double pixel_scale,
+                            int *size);
+
+/*
+ * Function: core_needs_render
+ * Test whether the next frame would differ from the last rendered one.
+ *
+ * This is meant to be called after <core_update>, so that the client can
+ * skip the call to <core_render> when nothing changed: the observer and
+ * fov are the same, no fader or animation is running, and no data is still
+ * loading.  After a change we keep rendering a few frames to let the newly
+ * loaded textures and fading effects settle.
+ */
+bool core_needs_render(void);
+
+/*
+ * Function: core_request_redraw
+ * Force the next frames to be rendered.
+ *
+ * Called by anything that modifies the scene in a way that <core_update>
+ * cannot detect, like user inputs, attribute changes or pending data.
+ */
+void core_request_redraw(void);
+/*
+ * Enum: MEMORY_TIER
+ * The tiers of data released by <core_release_memory>, in order.
+ *
+ *   MEMORY_TIER_TEXTURES - HiPS images tiles not rendered recently, with
+ *                          their textures.
+ *   MEMORY_TIER_TILES    - Other tiles not rendered recently, keeping a
+ *                          few MB per cache.
+ *   MEMORY_TIER_CATALOGS - Parsed catalog data of the hidden modules.
+ *   MEMORY_TIER_TEXT     - Text textures and metrics caches.
+ */
+enum {
+    MEMORY_TIER_TEXTURES = 1,
+    MEMORY_TIER_TILES,
+    MEMORY_TIER_CATALOGS,
+    MEMORY_TIER_TEXT,
+    MEMORY_TIER_COUNT = MEMORY_TIER_TEXT,
+};
+
+/*
+ * Function: core_release_memory
+ * Release the data we can reload later, up to a given tier.
+ *
+ * To be called when the client is short of memory, for example when the
+ * page gets hidden, or when the heap grows too much: the wasm heap never
+ * shrinks, but the released memory is reused instead of growing it.  The
+ * current usage of each tier can be read with the core 'memory' attribute.
+ *
+ * Parameters:
+ *   tier   - Last MEMORY_TIER value to release, all the previous tiers are
+ *            released too.
+ *
+ * Return:
+ *   The size in bytes of the released data.
+ */
+int core_release_memory(int tier);
+
+/*
+ * Function: core_save_snapshot
+ * Save the parsed data of the modules, for a fast restart.
+ *
+ * The client stores the returned blob, and passes it to
+ * <core_load_snapshot> on the next start, after the data sources have been
+ * added.  See snapshot.h for the details.
+ *
+ * Parameters:
+ *   size   - Output size of the returned data.
+ *
+ * Return:
+ *   A newly allocated blob, or NULL if there was nothing to save.
+ */
+void *core_save_snapshot(int *size);
+
+/*
+ * Function: core_load_snapshot
+ * Restore the modules data from a blob saved with <core_save_snapshot>.
+ *
+ * Return:
+ *   The number of restored chunks, or -1 if the snapshot is not valid.
+ */
+int core_load_snapshot(const void *data, int size);
+
+/*
+ * Function: core_on_gl_context_restored
+ * Rebuild the GPU state after the GL context was lost and restored.
+ *
+ * All the GL objects of the lost context are forgotten without deleting
+ * them.  The shaders are compiled again from the assets, the textures are
+ * restored from their CPU copy when they have one (urls, atlases, and the
+ * compressed source of the HiPS tiles), and the renderer recreates its own
+ * objects.  Textures are restored lazily as they get rendered, with the
+ * usual upload budget, so the visible region comes back first.
+ */
+void core_on_gl_context_restored(void);
+
+/*
+ * Function: core_list_memory
+ * List the resident memory of all the modules, in bytes.
+ *
+ * See <module_get_memory>.  After the modules we also list the shared
+ * data as two extra entries: "assets" for the loaded assets data, and
+ * "renderer" for the renderer text caches.
+ *
+ * Parameters:
+ *   user   - Data passed to the callback.
+ *   f      - Callback called for each module with its id and memory.
+ */
+void core_list_memory(void *user,
+                      void (*f)(void *user, const char *id,
+                                int64_t cpu, int64_t gpu));
+
 // x and y in screen coordinates.
 void core_on_mouse(int id, int state, double x, double y, int buttons);
 void core_on_key(int key, int action);
@@ -238,6 +464,24 @@ void core_on_pinch(int state, double x, double y, double scale,
  */
 void core_get_proj(projection_t *proj);
 
+/*
+ * Function: core_get_rect_corners
+ * Get the ICRF directions of the corners of a rectangle of the view.
+ *
+ * Used to list the objects in a selection rectangle, like the ones of
+ * the drag_selection module, with a polygon <sky_region_t>.
+ *
+ * Parameters:
+ *   x1, y1 - First corner of the rectangle, in window coordinates.
+ *   x2, y2 - Opposite corner of the rectangle.
+ *   out    - Output ICRF directions of the four corners.
+ *
+ * Return:
+ *   False if some corners are outside of the projection.
+ */
+bool core_get_rect_corners(double x1, double y1, double x2, double y2,
+                           double out[4][3]);
+
 /*
  * Function: core_get_obj_at
  * Get the object at a given screen position.
@@ -287,6 +531,9 @@ void core_report_luminance_in_fov(double lum, bool fast_adaptation);
  * Function: core_get_point_for_mag
  * Compute a point radius and luminosity from a visual magnitude.
  *
+ * During rendering the values are interpolated from a lookup table computed
+ * once per frame.
+ *
  * Parameters:
  *   mag       - The visual magnitude.
  *   radius    - Output radius in window pixels.
@@ -408,6 +655,22 @@ double core_get_apparent_angle_for_point(const projection_t *proj, double r);
 double core_get_point_for_apparent_angle(const projection_t *proj,
                                          double angle);
 
+/*
+ * Function: core_is_outdated_at_time_speed
+ * Test if the result of a background computation would be outdated
+ * before the end of the computation at the current time speed.
+ *
+ * At high time speeds (time lapse), the modules use this to skip the
+ * batch computations of positions they couldn't use anyway, until the
+ * time slows down again.
+ *
+ * Parameters:
+ *   duration   - Real time duration of the computation (s).
+ *   max_age    - Max age of the results after which they are not used
+ *                anymore, in simulation time (days).
+ */
+bool core_is_outdated_at_time_speed(double duration, double max_age);
+
 /*
  * Function: core_lookat
  * Move view direction to the given position.
@@ -537,6 +800,34 @@ char *skycultures_md_2_html(const char *md);
  */
 void core_add_task(int (*fun)(task_t *task, double dt), void *user);
 
+/*
+ * Function: core_add_task2
+ * Add a cooperative task, for long background jobs.
+ *
+ * Contrary to <core_add_task>, the task function is only called while
+ * there is some time left in the frame tasks budget, by order of priority.
+ * The budget comes from the measured frame headroom: what is left of the
+ * frame target duration (core.quality_budget) after the update and the
+ * rendering, within [1ms, 8ms].  The task should do its work in small
+ * steps, and return once <core_task_should_yield> is true.
+ *
+ * Parameters:
+ *   fun      - The task function.  The task runs as long as it returns
+ *              zero.
+ *   user     - User data, available as task->user.
+ *   priority - One of the TASK_PRIORITY_ values.
+ */
+void core_add_task2(int (*fun)(task_t *task, double dt), void *user,
+                    int priority);
+
+/*
+ * Function: core_task_should_yield
+ * Check if a cooperative task used up its time of the frame.
+ *
+ * Always false for the tasks added with <core_add_task>.
+ */
+bool core_task_should_yield(const task_t *task);
+
 /*
  * Function: core_get_planet
  * Return a planet from its HORIZONS id
@@ -549,7 +840,10 @@ obj_t *core_get_planet(int horizons_id);
  * Function: core_search
  * Search for an object by designation
  *
- * This only tests for the objects currently loaded in the core.
+ * This only tests for the objects currently loaded in the core.  The
+ * designations of the modules children are looked up in an index, the
+ * other objects (like the stars and dsos tiles) are searched for
+ * sequentially.
  *
  * Parameters:
  *   dsgn   - A designation.
@@ -561,6 +855,27 @@ obj_t *core_get_planet(int horizons_id);
  */
 obj_t *core_search(const char *dsgns);
 
+/*
+ * Function: core_search_prefix
+ * List the indexed designations starting with a given prefix
+ *
+ * This can be used for autocompletion.  Only the modules children
+ * designations are considered, the comparison is case insensitive and
+ * ignores repeated spaces.  The matches are returned in alphabetical order.
+ *
+ * Parameters:
+ *   prefix - Start of a designation.
+ *   max    - Maximum number of results, or zero for no limit.
+ *   user   - Data passed to the callback.
+ *   f      - Callback called for each matching designation.
+ *
+ * Return:
+ *   The number of matches returned.
+ */
+int core_search_prefix(const char *prefix, int max, void *user,
+                       void (*f)(const obj_t *obj, void *user,
+                                 const char *dsgn));
+
 // Just for convenience: horizons ids for a few common bodies.
 enum {
     PLANET_SUN = 10,
@@ -338,62 +338,92 @@ static const char * to_exponent(char c) {
 }
 
 /*
- * Function: designation_cleanup
- * Create a printable version of a designation
+ * Function: designation_parse
+ * Parse a bayer, flamsteed or variable star designation
  *
- * This can be used for example to compute the label to render for an object.
+ * See <designation.h>
  */
-EMSCRIPTEN_KEEPALIVE
-void designation_cleanup(const char *dsgn, char *out, int size, int flags)
+int designation_parse(const char *dsgn, designation_t *d)
 {
-    int cst;
-    int i, g, nb;
+    int cst = 0, number = 0, nb = 0;
+    const char *suffix = NULL;
+
+    memset(d, 0, sizeof(*d));
+    if (designation_parse_bayer(dsgn, &cst, &number, &nb, &suffix))
+        d->type = DSGN_TYPE_BAYER;
+    else if (designation_parse_flamsteed(dsgn, &cst, &number, &suffix))
+        d->type = DSGN_TYPE_FLAMSTEED;
+    else if (designation_parse_variable_star(dsgn, &cst, d->var, &suffix))
+        d->type = DSGN_TYPE_VARIABLE;
+    else
+        return DSGN_TYPE_OTHER;
+    d->cst = cst;
+    d->number = number;
+    d->nb = nb;
+    d->suffix = suffix - dsgn;
+    return d->type;
+}
+
+/*
+ * Function: designation_format
+ * Same as designation_cleanup, using an already parsed designation
+ *
+ * See <designation.h>
+ */
+void designation_format(const char *dsgn, const designation_t *d,
+                        char *out, int size, int flags)
+{
+    int i;
     const char *remove[] = {"NAME ", "* ", "Cl ", "Cl* ", "** ", "MPC ",
                             "LATIN "};
     const char *greek;
-    const char *cstname;
-    const char *suffix;
+    const char *cstname = NULL;
+    const char *suffix = dsgn + d->suffix;
     char tmp[64], tmp_letter[32];
-    char exponent[256], var[8];
+    char exponent[256];
+
+    if (d->type != DSGN_TYPE_OTHER &&
+            (flags & (BAYER_CONST_SHORT | BAYER_CONST_LONG))) {
+        cstname = (flags & BAYER_CONST_SHORT) ? CSTS[d->cst][0] :
+                                                CSTS[d->cst][1];
+    }
 
-    if (designation_parse_bayer(dsgn, &cst, &g, &nb, &suffix)) {
+    switch (d->type) {
+    case DSGN_TYPE_BAYER:
         exponent[0] = 0;
         tmp[0] = 0;
-        if (g >= 'A' && g <= 'z') {
-            snprintf(tmp_letter, sizeof(tmp_letter), "%c", g);
+        if (d->number >= 'A' && d->number <= 'z') {
+            snprintf(tmp_letter, sizeof(tmp_letter), "%c", d->number);
             greek = tmp_letter;
         } else {
-            greek = (flags & BAYER_LATIN_SHORT) ? GREEK[g - 1][2] :
-                    (flags & BAYER_LATIN_LONG) ? GREEK[g - 1][3] :
-                    GREEK[g - 1][0];
+            greek = (flags & BAYER_LATIN_SHORT) ? GREEK[d->number - 1][2] :
+                    (flags & BAYER_LATIN_LONG) ? GREEK[d->number - 1][3] :
+                    GREEK[d->number - 1][0];
         }
-        if (nb) {
-            snprintf(tmp, sizeof(tmp), "%d", nb);
+        if (d->nb) {
+            snprintf(tmp, sizeof(tmp), "%d", d->nb);
             for (i = 0; i < strlen(tmp); ++i)
                 strncat(exponent, to_exponent(tmp[i]),
                         sizeof(exponent) - strlen(exponent) - 1);
         }
-        if (flags & BAYER_CONST_SHORT || flags & BAYER_CONST_LONG) {
-            cstname = (flags & BAYER_CONST_SHORT) ? CSTS[cst][0] : CSTS[cst][1];
+        if (cstname)
             snprintf(out, size, "%s%s %s%s", greek, exponent, cstname, suffix);
-        } else
+        else
             snprintf(out, size, "%s%s%s", greek, exponent, suffix);
         return;
-    }
-    if (designation_parse_flamsteed(dsgn, &cst, &g, &suffix)) {
-        if (flags & BAYER_CONST_SHORT || flags & BAYER_CONST_LONG) {
-            cstname = (flags & BAYER_CONST_SHORT) ? CSTS[cst][0] : CSTS[cst][1];
-            snprintf(out, size, "%d %s%s", g, cstname, suffix);
-        } else
-            snprintf(out, size, "%d%s", g, suffix);
+    case DSGN_TYPE_FLAMSTEED:
+        if (cstname)
+            snprintf(out, size, "%d %s%s", d->number, cstname, suffix);
+        else
+            snprintf(out, size, "%d%s", d->number, suffix);
         return;
-    }
-    if (designation_parse_variable_star(dsgn, &cst, var, &suffix)) {
-        if (flags & (BAYER_CONST_SHORT | BAYER_CONST_LONG)) {
-            cstname = (flags & BAYER_CONST_LONG) ? CSTS[cst][1] : CSTS[cst][0];
-            snprintf(out, size, "%s %s%s", var, cstname, suffix);
+    case DSGN_TYPE_VARIABLE:
+        if (cstname) {
+            cstname = (flags & BAYER_CONST_LONG) ? CSTS[d->cst][1] :
+                                                   CSTS[d->cst][0];
+            snprintf(out, size, "%s %s%s", d->var, cstname, suffix);
         } else {
-            snprintf(out, size, "%s%s", var, suffix);
+            snprintf(out, size, "%s%s", d->var, suffix);
         }
         return;
     }
@@ -430,6 +460,20 @@ void designation_cleanup(const char *dsgn, char *out, int size, int flags)
     snprintf(out, size, "%s", dsgn);
 }
 
+/*
+ * Function: designation_cleanup
+ * Create a printable version of a designation
+ *
+ * This can be used for example to compute the label to render for an object.
+ */
+EMSCRIPTEN_KEEPALIVE
+void designation_cleanup(const char *dsgn, char *out, int size, int flags)
+{
+    designation_t d;
+    designation_parse(dsgn, &d);
+    designation_format(dsgn, &d, out, size, flags);
+}
+
 /*
  * Function: designations_get_tyc
  * Extract a TYC number from a designations list.
@@ -461,6 +505,7 @@ static void test_designations(void)
     int n, cst, nb;
     int tyc1, tyc2, tyc3;
     bool r;
+    designation_t d;
 
     r = designation_parse_bayer("* alf Aqr", &cst, &n, &nb, &suffix);
     assert(r && strcmp(CSTS[cst][0], "Aqr") == 0 && n == 1);
@@ -525,6 +570,15 @@ static void test_designations(void)
     designation_cleanup("* K Vel", buf, sizeof(buf), BAYER_CONST_LONG);
     assert(strcmp(buf, "K Velorum") == 0);
 
+    // Parse once, format several times.
+    assert(designation_parse("* tet01 Ori C", &d) == DSGN_TYPE_BAYER);
+    designation_format("* tet01 Ori C", &d, buf, sizeof(buf), 0);
+    assert(strcmp(buf, "θ¹ C") == 0);
+    designation_format("* tet01 Ori C", &d, buf, sizeof(buf),
+                       BAYER_LATIN_SHORT | BAYER_CONST_SHORT);
+    assert(strcmp(buf, "Tet¹ Ori C") == 0);
+    assert(designation_parse("NAME Vega", &d) == DSGN_TYPE_OTHER);
+
     r = designations_get_tyc("TYC 8841-489-2\0", &tyc1, &tyc2, &tyc3);
     assert(r && tyc1 == 8841 && tyc2 == 489 && tyc3 == 2);
 }
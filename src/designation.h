@@ -13,6 +13,7 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 
 /*
  * Enum: DESIGNATION_FLAGS
@@ -42,6 +43,68 @@ enum {
     DSGN_EXPAND_CAT         = 1 << 5
 };
 
+/*
+ * Enum: DESIGNATION_TYPE
+ * The type of a parsed designation.
+ *
+ * Values:
+ *   DSGN_TYPE_OTHER     - Any designation that is not one of the following.
+ *   DSGN_TYPE_BAYER     - Bayer designation, e.g. '* alf Cen'.
+ *   DSGN_TYPE_FLAMSTEED - Flamsteed designation, e.g. '* 49 Aqr'.
+ *   DSGN_TYPE_VARIABLE  - Variable star designation, e.g. 'V* VX Sgr'.
+ */
+enum {
+    DSGN_TYPE_OTHER         = 0,
+    DSGN_TYPE_BAYER,
+    DSGN_TYPE_FLAMSTEED,
+    DSGN_TYPE_VARIABLE,
+};
+
+/*
+ * Type: designation_t
+ * A parsed designation, so that we can format it several times without
+ * parsing the string again.
+ *
+ * Attributes:
+ *   type   - One of the <DESIGNATION_TYPE> values.
+ *   cst    - Constellation index.
+ *   suffix - Offset of the suffix in the designation string.
+ *   number - Bayer number (1 -> α, 2 -> β, etc.) or letter, or Flamsteed
+ *            number.
+ *   nb     - Bayer exponent, 0 for none.
+ *   var    - Variable star id, e.g. 'VX'.
+ */
+typedef struct designation {
+    uint8_t     type;
+    uint8_t     cst;
+    uint16_t    suffix;
+    int         number;
+    int         nb;
+    char        var[8];
+} designation_t;
+
+/*
+ * Function: designation_parse
+ * Parse a bayer, flamsteed or variable star designation.
+ *
+ * Parameters:
+ *   dsgn   - A designation (eg: '* alf Aqr').
+ *   d      - Output parsed designation.
+ *
+ * Return:
+ *   The type of the designation, DSGN_TYPE_OTHER if it is not a bayer,
+ *   flamsteed or variable star designation.
+ */
+int designation_parse(const char *dsgn, designation_t *d);
+
+/*
+ * Function: designation_format
+ * Same as <designation_cleanup>, for a designation already parsed with
+ * <designation_parse>.
+ */
+void designation_format(const char *dsgn, const designation_t *d,
+                        char *out, int size, int flags);
+
 /*
  * Function: designation_cleanup
  * Create a printable version of a designation
@@ -42,16 +42,24 @@
  *   n bytes: compressed data
  *
  * Tabular data:
- *   4 bytes: flags (1: data is shuffled)
+ *   4 bytes: flags (1: data is shuffled, 2: quantized columns)
  *   4 bytes: row size in bytes
  *   4 bytes: columns number
  *   4 bytes: row number
  *   Then for each column:
  *     4 bytes: id string
- *     4 bytes: type ('f', 'i', 'Q', 's')
+ *     4 bytes: type ('f', 'd', 'i', 'Q', 's', or 'h' for quantized int16)
  *     4 bytes: unit (one of EPH_UNIT value, e.g EPH_RAD or 0 to ignore)
  *     4 bytes: start offset in bytes
  *     4 bytes: data size
+ *     Only if the quantized columns flag is set:
+ *     8 bytes: scale (double)
+ *     8 bytes: offset (double)
+ *
+ * A column with a non zero scale stores a float value as an 'h' or 'i'
+ * integer q, the value being offset + q * scale.  The min integer value
+ * encodes NAN.  This allows for example to store positions relative to the
+ * tile center with a precision adapted to the tile size.
  */
 
 #define FILE_VERSION 2
@@ -152,8 +160,10 @@ int eph_read_table_header(int version, const void *data, int data_size,
                           int *data_ofs, int *row_size, int *flags,
                           int nb_columns, eph_table_column_t *columns)
 {
-    int i, j, n_col, n_row;
+    int i, j, n_col, n_row, col_size;
     char name[4], type[4];
+    double scale = 0, offset = 0;
+    const void *col;
 
     assert(version >= 3);
     data += *data_ofs;
@@ -162,30 +172,75 @@ int eph_read_table_header(int version, const void *data, int data_size,
     memcpy(&n_col,    data + 8 , 4);
     memcpy(&n_row,    data + 12, 4);
 
+    col_size = (*flags & 2) ? 36 : 20;
     for (i = 0; i < n_col; i++) {
-        memcpy(name, data + 16 + i * 20, 4);
-        memcpy(type, data + 20 + i * 20, 4);
+        col = data + 16 + i * col_size;
+        memcpy(name, col, 4);
+        memcpy(type, col + 4, 4);
+        if (*flags & 2) {
+            memcpy(&scale, col + 20, 8);
+            memcpy(&offset, col + 28, 8);
+        }
         for (j = 0; j < nb_columns; j++) {
             if (strncmp(columns[j].name, name, 4) == 0) break;
         }
         if (j == nb_columns) continue;
-        if (columns[j].type != *type) {
+        // Quantized values can be read as float or double.
+        if (columns[j].type != *type &&
+                !(scale && (*type == 'h' || *type == 'i') &&
+                  (columns[j].type == 'f' || columns[j].type == 'd'))) {
             LOG_E("Wrong type");
             return -1;
         }
         columns[j].got = true;
-        memcpy(&columns[j].src_unit, data + 24 + i * 20, 4);
-        memcpy(&columns[j].start, data + 28 + i * 20, 4);
-        memcpy(&columns[j].size, data + 32 + i * 20, 4);
+        columns[j].src_type = *type;
+        columns[j].scale = scale;
+        columns[j].offset = offset;
+        memcpy(&columns[j].src_unit, col + 8, 4);
+        memcpy(&columns[j].start, col + 12, 4);
+        memcpy(&columns[j].size, col + 16, 4);
         // Fix legacy units.
         if (columns[j].src_unit == EPH_ARCSEC_)
             columns[j].src_unit = EPH_ARCSEC;
+        columns[j].factor = eph_convert_f(columns[j].src_unit,
+                                          columns[j].unit, 1.0);
     }
     for (i = 0; i < nb_columns; i++) columns[i].row_size = *row_size;
-    *data_ofs += 16 + n_col * 20;
+    *data_ofs += 16 + n_col * col_size;
     return n_row;
 }
 
+// Decode a 'f' or 'd' column value, possibly quantized.
+static inline double get_float(const eph_table_column_t *column,
+                               const void *data)
+{
+    int16_t h;
+    int32_t i;
+    float f;
+    double d;
+
+    switch (column->src_type) {
+    case 'h':
+        memcpy(&h, data, 2);
+        if (h == INT16_MIN) return NAN;
+        d = column->offset + h * column->scale;
+        break;
+    case 'i':
+        memcpy(&i, data, 4);
+        if (i == INT32_MIN) return NAN;
+        d = column->offset + i * column->scale;
+        break;
+    case 'd':
+        memcpy(&d, data, 8);
+        break;
+    default:
+        memcpy(&f, data, 4);
+        d = f;
+        break;
+    }
+    return d * column->factor;
+}
+
 double eph_convert_f(int src_unit, int unit, double v)
 {
     if (!unit || src_unit == unit) return v; // Most common case.
@@ -216,7 +271,7 @@ int eph_read_table_row(const void *data, int data_size, int *data_ofs,
     union {
         char    *s;
         int      i;
-        float    f;
+        double   d;
         uint64_t q;
     } v;
     bool got;
@@ -233,11 +288,9 @@ int eph_read_table_row(const void *data, int data_size, int *data_ofs,
             *va_arg(ap, int*) = v.i;
             break;
         case 'f':
-            if (got) {
-                memcpy(&v.f, data + columns[i].start, 4);
-                v.f = eph_convert_f(columns[i].src_unit, columns[i].unit, v.f);
-            }
-            *va_arg(ap, double*) = v.f;
+        case 'd':
+            if (got) v.d = get_float(&columns[i], data + columns[i].start);
+            *va_arg(ap, double*) = v.d;
             break;
         case 'Q':
             if (got) memcpy(&v.q, data + columns[i].start, 8);
@@ -256,3 +309,62 @@ int eph_read_table_row(const void *data, int data_size, int *data_ofs,
     *data_ofs += columns[0].row_size;
     return 0;
 }
+
+// Get the bytes of a table value, from shuffled or non shuffled data.
+static inline void get_value_bytes(const uint8_t *data, int nb, int row_size,
+                                   bool shuffled, int row, int start,
+                                   int size, uint8_t *out)
+{
+    int i;
+    if (!shuffled) {
+        memcpy(out, data + row * row_size + start, size);
+        return;
+    }
+    for (i = 0; i < size; i++)
+        out[i] = data[(start + i) * nb + row];
+}
+
+int eph_read_table_column(const void *data, int data_size, int nb,
+                          bool shuffled, const eph_table_column_t *column,
+                          void *out, int stride)
+{
+    int i, size, rs = column->row_size;
+    uint8_t *dst = out, buf[8];
+    double d;
+
+    switch (column->type) {
+    case 'i': size = 4; break;
+    case 'f': size = sizeof(double); break;
+    case 'd': size = 8; break;
+    case 'Q': size = 8; break;
+    case 's': size = column->size; break;
+    default: assert(false); return -1;
+    }
+    stride = stride ?: size;
+    CHECK(nb * rs <= data_size);
+
+    if (!column->got) {
+        for (i = 0; i < nb; i++) memset(dst + i * stride, 0, size);
+        return 0;
+    }
+
+    switch (column->type) {
+    case 'f':
+    case 'd':
+        CHECK(column->size <= sizeof(buf));
+        for (i = 0; i < nb; i++) {
+            get_value_bytes(data, nb, rs, shuffled, i, column->start,
+                            column->size, buf);
+            d = get_float(column, buf);
+            memcpy(dst + i * stride, &d, sizeof(d));
+        }
+        break;
+    default:
+        for (i = 0; i < nb; i++) {
+            get_value_bytes(data, nb, rs, shuffled, i, column->start, size,
+                            dst + i * stride);
+        }
+        break;
+    }
+    return 0;
+}
@@ -10,6 +10,7 @@
 #ifndef EPH_FILE_H
 #define EPH_FILE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "json.h"
@@ -64,6 +65,12 @@ enum {
     EPH_ARCSEC_         = 5 << 16 | 1 | 2 | 4,
 };
 
+/*
+ * Function: eph_convert_f
+ * Convert a value between two related EPH_UNIT units.
+ */
+double eph_convert_f(int src_unit, int unit, double v);
+
 typedef struct eph_table_column {
     char        name[4];
     char        type;
@@ -75,6 +82,10 @@ typedef struct eph_table_column {
     int         size;
     int         src_unit;
     int         row_size;
+    double      factor; // Conversion factor from src_unit to unit.
+    char        src_type; // Type in the file, different if quantized.
+    double      scale;  // Quantization scale, or zero.
+    double      offset; // Quantization offset.
 } eph_table_column_t;
 
 int eph_read_table_header(int version, const void *data, int data_size,
@@ -85,4 +96,27 @@ int eph_read_table_row(const void *data, int data_size, int *data_ofs,
                        int nb_columns, const eph_table_column_t *columns,
                        ...);
 
+/*
+ * Function: eph_read_table_column
+ * Read all the values of a table column at once.
+ *
+ * This is faster than reading the table row by row, and works directly on
+ * the shuffled data, so there is no need to call <eph_shuffle_bytes>.
+ *
+ * Parameters:
+ *   data       - The table data.
+ *   data_size  - Size of the table data.
+ *   nb         - Number of rows.
+ *   shuffled   - Set if the data is shuffled (header flag 1).
+ *   column     - A column filled by <eph_read_table_header>.
+ *   out        - Output values, with the same types as for
+ *                <eph_read_table_row>: double for 'f' and 'd' columns,
+ *                int for 'i', uint64_t for 'Q' and chars for 's'.
+ *   stride     - Offset in bytes between two output values, or zero for
+ *                packed values.  Allows to fill an array of structs.
+ */
+int eph_read_table_column(const void *data, int data_size, int nb,
+                          bool shuffled, const eph_table_column_t *column,
+                          void *out, int stride);
+
 #endif // EPH_FILE_H
@@ -18,8 +18,20 @@
 enum {
     EVENT_RISE      = 1 << 0,
     EVENT_SET       = 1 << 1,
+    EVENT_TRANSIT   = 1 << 2, // Upper meridian transit.
+
+    // Events searched by <search_events>, between a reference object and
+    // other objects.
+    EVENT_CONJUNCTION   = 1 << 3, // Min separation below max_sep.
+    EVENT_OPPOSITION    = 1 << 4, // Max geocentric elongation from the Sun.
+    EVENT_OCCULTATION   = 1 << 5, // Object covered by the reference disk.
+    EVENT_SOLAR_ECLIPSE = 1 << 6, // Sun covered by the Moon.
+    EVENT_LUNAR_ECLIPSE = 1 << 7, // Moon in the Earth penumbra.
 };
 
+// Max number of objects searched together in compute_events.
+#define EVENTS_MAX_OBJS 256
+
 // Newton algo.
 #define NEWTON_MAX_STEPS 20
 static double newton(double (*f)(double x, void *user),
@@ -50,46 +62,118 @@ static int sign(double x)
     return x < 0 ? -1 : 1;
 }
 
-static double find_zero(double (*f)(double x, void *user),
-                        double x0, double x1, double step, double precision,
-                        int rising, void *user)
+/*
+ * Function: event_dist
+ * Return a value that changes sign at the event time
+ *
+ * For rise and set, this is the altitude of the object upper limb above
+ * the observer horizon.  For transit, this is the east component of the
+ * observed direction, that goes from positive to negative when the object
+ * crosses the meridian at its upper culmination.
+ *
+ * The observer must already be updated at the wanted time.
+ */
+static double event_dist(const observer_t *obs, obj_t *obj, int event)
 {
-    int last_sign = 0;
-    double x, fx;
-    bool found = false;
-    // First find an approximate answer simply by stepping.  Not very clever.
-    // Make sure the last iteration is exactly at x1.
-    for (x = x0;; x += step) {
-        if (x > x1) x = x1; // Clamp to x1.
-        fx = f(x, user);
-        if (sign(fx) * last_sign == -1 && sign(fx) == rising) {
-            found = true;
-            break;
-        }
-        last_sign = sign(fx);
-        if (x == x1) break;
+    double radius = 0, pvo[2][4], observed[4], az, alt;
+
+    obj_get_pvo(obj, obs, pvo);
+    convert_framev4(obs, FRAME_ICRF, FRAME_OBSERVED, pvo[0], observed);
+    if (event == EVENT_TRANSIT) {
+        vec3_normalize(observed, observed);
+        return observed[1];
     }
-    if (!found) return NAN;
-    // Once we are near the value, use newton algorithm.
-    return newton(f, x - step, x, precision, user);
+    vec3_to_sphe(observed, &az, &alt);
+    obj_get_info(obj, obs, INFO_RADIUS, &radius);
+    return alt + radius - obs->horizon;
 }
 
-static double rise_dist(double time, void *user)
+static double event_dist_at(double time, void *user)
 {
     struct {
         observer_t *obs;
         obj_t *obj;
+        int event;
     } *data = user;
-    double radius = 0, pvo[2][4], observed[4], az, alt;
 
     data->obs->tt = time;
     observer_update(data->obs, false);
-    obj_get_pvo(data->obj, data->obs, pvo);
-    convert_framev4(data->obs, FRAME_ICRF, FRAME_OBSERVED, pvo[0], observed);
-    vec3_to_sphe(observed, &az, &alt);
-    az = eraAnp(az);
-    obj_get_info(data->obj, data->obs, INFO_RADIUS, &radius);
-    return alt + radius - data->obs->horizon;
+    return event_dist(data->obs, data->obj, data->event);
+}
+
+/*
+ * Function: compute_events
+ * Search the first occurrence of an event for several objects at once
+ *
+ * The time range is first stepped with a coarse step, evaluating all the
+ * objects for each observer update, until each object has a bracketing
+ * sign change.  Each bracket is then refined with a secant search.
+ *
+ * Parameters:
+ *   obs        - The observer.  Not modified.
+ *   nb_objs    - Number of objects (at most 256).
+ *   objs       - The objects.
+ *   event      - EVENT_RISE, EVENT_SET or EVENT_TRANSIT.
+ *   start_time - Start of the search range (TT MJD).
+ *   end_time   - End of the search range (TT MJD).
+ *   step       - Coarse search step (days).  Must be smaller than the
+ *                shortest interval between two events.
+ *   precision  - Wanted precision on the event times (days).
+ *   out        - Receives the event time of each object (TT MJD), or NAN
+ *                if the event was not found in the range.
+ *
+ * Return:
+ *   The number of events found.
+ */
+EMSCRIPTEN_KEEPALIVE
+int compute_events(const observer_t *obs, int nb_objs, obj_t *const *objs,
+                   int event, double start_time, double end_time,
+                   double step, double precision, double *out)
+{
+    observer_t obs2 = *obs;
+    int i, nb_left, nb_found = 0, want;
+    double t, fx;
+    int8_t last_sign[EVENTS_MAX_OBJS] = {};
+    struct {
+        observer_t *obs;
+        obj_t *obj;
+        int event;
+    } data = {&obs2, NULL, event};
+
+    assert(nb_objs <= EVENTS_MAX_OBJS);
+    assert(step > 0);
+    want = event == EVENT_RISE ? +1 : -1;
+    for (i = 0; i < nb_objs; i++) out[i] = NAN;
+
+    // First bracket the events by stepping, with a single observer update
+    // per step for all the objects.  Make sure the last iteration is
+    // exactly at end_time.
+    nb_left = nb_objs;
+    for (t = start_time; nb_left; t += step) {
+        if (t > end_time) t = end_time; // Clamp to end_time.
+        obs2.tt = t;
+        observer_update(&obs2, false);
+        for (i = 0; i < nb_objs; i++) {
+            if (!isnan(out[i])) continue;
+            fx = event_dist(&obs2, objs[i], event);
+            if (sign(fx) * last_sign[i] == -1 && sign(fx) == want) {
+                out[i] = t;
+                nb_left--;
+            }
+            last_sign[i] = sign(fx);
+        }
+        if (t == end_time) break;
+    }
+
+    // Refine each bracket with the secant method.
+    for (i = 0; i < nb_objs; i++) {
+        if (isnan(out[i])) continue;
+        data.obj = objs[i];
+        out[i] = newton(event_dist_at, out[i] - step, out[i], precision,
+                        &data);
+        if (!isnan(out[i])) nb_found++;
+    }
+    return nb_found;
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -100,16 +184,303 @@ double compute_event(observer_t *obs,
                      double end_time,
                      double precision)
 {
-    observer_t obs2 = *obs;
     double ret;
-    int rising;
-    struct {
-        observer_t *obs;
-        obj_t *obj;
-    } data = {&obs2, obj};
-    rising = event == EVENT_RISE ? +1 : -1;
-    ret = find_zero(rise_dist, start_time, end_time,
-                    (end_time - start_time) / 24, precision,
-                    rising, &data);
+    compute_events(obs, 1, &obj, event, start_time, end_time,
+                   (end_time - start_time) / 24, precision, &ret);
     return ret;
 }
+
+/******** Events between pairs of objects *********************************/
+
+// Position and apparent radius of an object.
+typedef struct {
+    double pos[3];
+    double radius;
+} body_t;
+
+typedef struct {
+    const observer_t *obs;
+    int event;
+    double max_sep;
+    obj_t *ref;
+    obj_t *obj;
+} pair_search_t;
+
+// Search state of each object in search_events.
+typedef struct {
+    double t[3];        // Last three samples times.
+    double m[3];        // Last three samples margins.
+    int nb;             // Number of samples.
+    double next;        // Time of the next sample.
+    double max_rate;    // Max seen margin change rate (rad/day).
+} pair_state_t;
+
+// The geocentric events only make sense without the observer parallax.
+static bool event_is_geocentric(int event)
+{
+    return event == EVENT_OPPOSITION || event == EVENT_LUNAR_ECLIPSE;
+}
+
+static void get_body(const observer_t *obs, obj_t *obj, bool geocentric,
+                     body_t *out)
+{
+    double pvo[2][4];
+
+    obj_get_pvo(obj, obs, pvo);
+    vec3_copy(pvo[0], out->pos);
+    // Objects at infinity only have a direction.
+    if (geocentric && pvo[0][3])
+        vec3_add(out->pos, obs->obs_pvg[0], out->pos);
+    out->radius = 0;
+    obj_get_info(obj, obs, INFO_RADIUS, &out->radius);
+}
+
+/*
+ * Function: pair_margin
+ * Return how far (rad) two objects are from the event.
+ *
+ * The value is negative during the event, and the event times we search
+ * are the minima of this value.  If value is set, it receives the event
+ * value: the separation for conjunctions and occultations, the elongation
+ * for oppositions, the obscuration for solar eclipses and the umbral
+ * magnitude for lunar eclipses.
+ */
+static double pair_margin(int event, double max_sep, const body_t *ref,
+                          const body_t *obj, double *value)
+{
+    const double EARTH_RADIUS = 6378137 * DM2AU;
+    double sep, anti_sun[3], par, umbra, penumbra, v;
+
+    switch (event) {
+    case EVENT_OPPOSITION:
+        // The reference is the Sun.
+        sep = vec3_sep(ref->pos, obj->pos);
+        if (value) *value = sep;
+        return (M_PI - sep) - max_sep;
+    case EVENT_OCCULTATION:
+    case EVENT_SOLAR_ECLIPSE:
+        sep = vec3_sep(ref->pos, obj->pos);
+        if (value && event == EVENT_OCCULTATION) *value = sep;
+        if (value && event == EVENT_SOLAR_ECLIPSE)
+            *value = 1.0 - eclipse_factor(obj->radius, ref->radius, sep);
+        return sep - (ref->radius + obj->radius);
+    case EVENT_LUNAR_ECLIPSE:
+        // The reference is the Moon, and the object the Sun.  The Earth
+        // shadow radii with the usual 2% enlargement for the atmosphere.
+        vec3_mul(-1, obj->pos, anti_sun);
+        sep = vec3_sep(ref->pos, anti_sun);
+        par = asin(EARTH_RADIUS / vec3_norm(ref->pos)) +
+              asin(EARTH_RADIUS / vec3_norm(obj->pos));
+        umbra = 1.02 * (par - obj->radius);
+        penumbra = 1.02 * (par + obj->radius);
+        v = (umbra + ref->radius - sep) / (2 * ref->radius);
+        if (value) *value = v;
+        return sep - (penumbra + ref->radius);
+    default: // EVENT_CONJUNCTION.
+        sep = vec3_sep(ref->pos, obj->pos);
+        if (value) *value = sep;
+        return sep - max_sep;
+    }
+}
+
+static double pair_margin_at(double time, void *user)
+{
+    pair_search_t *s = user;
+    observer_t obs = *s->obs;
+    body_t ref, obj;
+    bool geo = event_is_geocentric(s->event);
+
+    obs.tt = time;
+    observer_update(&obs, false);
+    get_body(&obs, s->ref, geo, &ref);
+    get_body(&obs, s->obj, geo, &obj);
+    return pair_margin(s->event, s->max_sep, &ref, &obj, NULL);
+}
+
+// Golden section search of a function minimum.
+static double golden_search(double (*f)(double x, void *user),
+                            double a, double b, double precision,
+                            void *user)
+{
+    const double k = (sqrt(5) - 1) / 2;
+    double c, d, fc, fd;
+
+    c = b - k * (b - a);
+    d = a + k * (b - a);
+    fc = f(c, user);
+    fd = f(d, user);
+    while (fabs(b - a) > precision) {
+        if (fc < fd) {
+            b = d;
+            d = c;
+            fd = fc;
+            c = b - k * (b - a);
+            fc = f(c, user);
+        } else {
+            a = c;
+            c = d;
+            fc = fd;
+            d = a + k * (b - a);
+            fd = f(d, user);
+        }
+    }
+    return (a + b) / 2;
+}
+
+static int event_cmp(const void *a, const void *b)
+{
+    return cmp(((const double*)a)[0], ((const double*)b)[0]);
+}
+
+/*
+ * Function: search_events
+ * Search all the events between a reference object and several objects
+ *
+ * Each event is a minimum of the 'margin' between the two objects (see
+ * <pair_margin>), that is negative during the event.  Each object is
+ * stepped with its own adaptive step: as long as the margin is positive,
+ * we know from the max speed at which it changed so far that the event
+ * cannot start before a given time.  The objects that need a new sample
+ * at about the same time are evaluated together with a single observer
+ * update, and the bracketed minima are refined with a golden section
+ * search.
+ *
+ * Use the reference and objects:
+ *   EVENT_CONJUNCTION   - Any, e.g. the Moon and the planets.
+ *   EVENT_OPPOSITION    - The Sun and the planets.
+ *   EVENT_OCCULTATION   - The Moon and the stars or planets.
+ *   EVENT_SOLAR_ECLIPSE - The Moon and the Sun.
+ *   EVENT_LUNAR_ECLIPSE - The Moon and the Sun.
+ *
+ * Parameters:
+ *   obs        - The observer.  Not modified.
+ *   event      - One of the EVENT_ values above.
+ *   ref        - The reference object.
+ *   nb_objs    - Number of objects.
+ *   objs       - The objects.
+ *   start_time - Start of the search range (TT MJD).
+ *   end_time   - End of the search range (TT MJD).
+ *   step       - Min search step (days).  Must be smaller than the
+ *                duration of the events.
+ *   precision  - Wanted precision on the event times (days).
+ *   max_sep    - For conjunctions, the max separation (rad).  For
+ *                oppositions the max distance from the anti-sun (rad).
+ *   max_events - Size of the out buffer.
+ *   out        - Receives the events sorted by time, as (time (TT MJD),
+ *                object index, value) triplets.  See <pair_margin> for
+ *                the values.
+ *
+ * Return:
+ *   The number of events found.
+ */
+EMSCRIPTEN_KEEPALIVE
+int search_events(const observer_t *obs, int event, obj_t *ref,
+                  int nb_objs, obj_t *const *objs,
+                  double start_time, double end_time, double step,
+                  double precision, double max_sep,
+                  int max_events, double *out)
+{
+    observer_t obs2 = *obs;
+    pair_state_t *states, *st;
+    pair_search_t search = {obs, event, max_sep, ref};
+    body_t ref_body, obj_body;
+    double t, m, dt, value;
+    int i, nb = 0;
+    bool geo = event_is_geocentric(event);
+
+    assert(step > 0);
+    states = calloc(nb_objs, sizeof(*states));
+    for (i = 0; i < nb_objs; i++) states[i].next = start_time;
+
+    while (true) {
+        t = INFINITY;
+        for (i = 0; i < nb_objs; i++) t = fmin(t, states[i].next);
+        if (t > end_time) break;
+        obs2.tt = t;
+        observer_update(&obs2, false);
+        get_body(&obs2, ref, geo, &ref_body);
+
+        for (i = 0; i < nb_objs; i++) {
+            st = &states[i];
+            if (st->next > t + step / 2) continue;
+            get_body(&obs2, objs[i], geo, &obj_body);
+            m = pair_margin(event, max_sep, &ref_body, &obj_body, NULL);
+            if (st->nb) {
+                st->max_rate = fmax(st->max_rate,
+                        fabs(m - st->m[2]) / (t - st->t[2]));
+            }
+            memmove(st->t, st->t + 1, 2 * sizeof(*st->t));
+            memmove(st->m, st->m + 1, 2 * sizeof(*st->m));
+            st->t[2] = t;
+            st->m[2] = m;
+            st->nb++;
+
+            // Refine the bracketed minima where the event happens.
+            if (st->nb >= 3 && st->m[1] < 0 && st->m[1] <= st->m[0] &&
+                    st->m[1] < st->m[2] && nb < max_events) {
+                search.obj = objs[i];
+                out[nb * 3 + 0] = golden_search(pair_margin_at, st->t[0],
+                                                st->t[2], precision,
+                                                &search);
+                obs2.tt = out[nb * 3 + 0];
+                observer_update(&obs2, false);
+                get_body(&obs2, ref, geo, &ref_body);
+                get_body(&obs2, objs[i], geo, &obj_body);
+                pair_margin(event, max_sep, &ref_body, &obj_body,
+                            &value);
+                out[nb * 3 + 1] = i;
+                out[nb * 3 + 2] = value;
+                nb++;
+                // Put back the observer for the other objects.
+                obs2.tt = t;
+                observer_update(&obs2, false);
+                get_body(&obs2, ref, geo, &ref_body);
+            }
+
+            dt = step;
+            if (m > 0 && st->max_rate > 0)
+                dt = fmax(dt, m / (2 * st->max_rate));
+            st->next = t + dt;
+        }
+    }
+
+    free(states);
+    qsort(out, nb, 3 * sizeof(*out), event_cmp);
+    return nb;
+}
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+static void test_lunar_eclipses(void)
+{
+    obj_t *moon, *sun;
+    observer_t *obs;
+    double out[3 * 8], d1, d2, t;
+    int nb;
+
+    core_init(100, 100, 1.0);
+    obs = core->observer;
+    moon = core_get_planet(301);
+    sun = core_get_planet(10);
+    eraDtf2d("UTC", 2022, 1, 1, 0, 0, 0, &d1, &d2);
+    obj_set_attr((obj_t*)obs, "utc", d1 - DJM0 + d2);
+    observer_update(obs, false);
+    nb = search_events(obs, EVENT_LUNAR_ECLIPSE, moon, 1, &sun,
+                       obs->tt, obs->tt + 365, 1. / 24, 1. / 1440, 0,
+                       8, out);
+    // Total eclipses of 2022-05-16 04:11 and 2022-11-08 10:59 UTC, with
+    // umbral magnitudes 1.41 and 1.36.
+    assert(nb == 2);
+    eraDtf2d("UTC", 2022, 5, 16, 4, 11, 0, &d1, &d2);
+    t = d1 - DJM0 + d2 + (obs->tt - obs->utc);
+    assert(fabs(out[0] - t) * 1440 < 5 && fabs(out[2] - 1.41) < 0.03);
+    eraDtf2d("UTC", 2022, 11, 8, 10, 59, 0, &d1, &d2);
+    t = d1 - DJM0 + d2 + (obs->tt - obs->utc);
+    assert(fabs(out[3] - t) * 1440 < 5 && fabs(out[5] - 1.36) < 0.03);
+}
+
+TEST_REGISTER(NULL, test_lunar_eclipses, TEST_AUTO);
+
+#endif
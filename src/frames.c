@@ -95,7 +95,8 @@ static void convert_frame_forward(const observer_t *obs,
     if (origin < FRAME_OBSERVED && dest >= FRAME_OBSERVED) {
         if (obs->pressure) {
             if (at_inf) {
-                refraction(p, obs->refa, obs->refb, p);
+                refraction_lut(p, OBSERVER_REFRACTION_LUT_SIZE,
+                               obs->refraction_lut, p);
             } else {
                 // Special case for null's vectors
                 double dist = vec3_norm(p);
@@ -104,7 +105,8 @@ static void convert_frame_forward(const observer_t *obs,
                     return;
                 }
                 vec3_mul(1.0 / dist, p, p);
-                refraction(p, obs->refa, obs->refb, p);
+                refraction_lut(p, OBSERVER_REFRACTION_LUT_SIZE,
+                               obs->refraction_lut, p);
                 vec3_mul(dist, p, p);
             }
         }
@@ -140,7 +142,8 @@ static void convert_frame_backward(const observer_t *obs,
     if (origin >= FRAME_OBSERVED && dest < FRAME_OBSERVED) {
         if (obs->pressure){
             if (at_inf) {
-                refraction_inv(p, obs->refa, obs->refb, p);
+                refraction_lut_inv(p, OBSERVER_REFRACTION_LUT_SIZE,
+                                   obs->refraction_lut, p);
             } else {
                 // Special case for null's vectors
                 double dist = vec3_norm(p);
@@ -149,7 +152,8 @@ static void convert_frame_backward(const observer_t *obs,
                     return;
                 }
                 vec3_mul(1.0 / dist, p, p);
-                refraction_inv(p, obs->refa, obs->refb, p);
+                refraction_lut_inv(p, OBSERVER_REFRACTION_LUT_SIZE,
+                                   obs->refraction_lut, p);
                 vec3_mul(dist, p, p);
             }
         }
@@ -214,6 +218,53 @@ int convert_frame(const observer_t *obs,
     return 0;
 }
 
+/*
+ * Check if a frame conversion is a pure rotation, and if the output of
+ * convert_frame gets normalized in that case.
+ */
+static bool frame_is_rotation(const observer_t *obs, int origin, int dest,
+                              bool *normalize)
+{
+    // Ecliptic conversions go through ICRF with an extra rotation.
+    if (origin == FRAME_ECLIPTIC) origin = FRAME_ICRF;
+    if (dest == FRAME_ECLIPTIC) dest = FRAME_ICRF;
+    if (origin == FRAME_ASTROM || dest == FRAME_ASTROM) return false;
+    if (obs->pressure &&
+            (origin < FRAME_OBSERVED) != (dest < FRAME_OBSERVED))
+        return false;
+    *normalize = dest < origin && dest != FRAME_MOUNT;
+    return true;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int convert_frame_batch(const observer_t *obs,
+                        int origin, int dest, bool at_inf, int n,
+                        const double (*in)[3], double (*out)[3])
+{
+    int i;
+    bool normalize;
+    double mat[3][3], v[3];
+
+    if (!frame_is_rotation(obs, origin, dest, &normalize)) {
+        for (i = 0; i < n; i++)
+            convert_frame(obs, origin, dest, at_inf, in[i], out[i]);
+        return 0;
+    }
+
+    for (i = 0; i < 3; i++) {
+        vec3_set(v, i == 0, i == 1, i == 2);
+        convert_frame(obs, origin, dest, true, v, v);
+        mat[i][0] = v[0];
+        mat[i][1] = v[1];
+        mat[i][2] = v[2];
+    }
+    simd_mat3_mul_vec3_n(mat, n, in, out);
+    if (normalize) {
+        for (i = 0; i < n; i++) vec3_normalize(out[i], out[i]);
+    }
+    return 0;
+}
+
 EMSCRIPTEN_KEEPALIVE
 int convert_framev4(const observer_t *obs,
                         int origin, int dest,
@@ -494,4 +545,41 @@ static void test_convert_origin(void)
 
 TEST_REGISTER(NULL, test_convert_origin, TEST_AUTO)
 
+static void test_convert_frame_batch(void)
+{
+    observer_t *obs;
+    int origin, dest, at_inf, i, k;
+    double out[3];
+    double vs[3][3] = {{1, 0, 0}, {0.3, -0.5, 0.8}, {-2.0, 1.0, 0.5}};
+    double res[3][3];
+
+    core_init(100, 100, 1.0);
+    obs = core->observer;
+    obj_set_attr((obj_t*)obs, "utc", 58450.0);
+    obj_set_attr((obj_t*)obs, "latitude", 33.7490 * DD2R);
+    for (k = 0; k < 2; k++) {
+        obs->pressure = k ? 1013.25 : 0;
+        observer_update(obs, false);
+        for (origin = FRAME_ASTROM; origin <= FRAME_ECLIPTIC; origin++)
+        for (dest = FRAME_ASTROM; dest <= FRAME_ECLIPTIC; dest++)
+        for (at_inf = 0; at_inf < 2; at_inf++) {
+            // Astrometric conversion only supports objects at infinity.
+            if (dest == FRAME_ASTROM && !at_inf) continue;
+            for (i = 0; i < 3; i++) {
+                vec3_copy(vs[i], res[i]);
+                if (at_inf) vec3_normalize(res[i], res[i]);
+            }
+            convert_frame_batch(obs, origin, dest, at_inf, 3, res, res);
+            for (i = 0; i < 3; i++) {
+                vec3_copy(vs[i], out);
+                if (at_inf) vec3_normalize(out, out);
+                convert_frame(obs, origin, dest, at_inf, out, out);
+                assert(vec3_dist(out, res[i]) < 1e-12);
+            }
+        }
+    }
+}
+
+TEST_REGISTER(NULL, test_convert_frame_batch, TEST_AUTO)
+
 #endif
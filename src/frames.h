@@ -129,6 +129,31 @@ int convert_frame(const observer_t *obs,
                         int origin, int dest, bool at_inf,
                         const double in[3], double out[3]);
 
+/*
+ * Function: convert_frame_batch
+ * Convert an array of vectors from a frame to an other.
+ *
+ * This gives the same result as calling <convert_frame> on each vector, but
+ * when the conversion is a pure rotation (no astrometric correction and no
+ * refraction) we compute the composed matrix only once.
+ *
+ * Parameters:
+ *   obs    - The observer.
+ *   origin - Origin coordinates.  One of the <FRAME> enum values.
+ *   dest   - Destination coordinates.  One of the <FRAME> enum values.
+ *   at_inf - true for fixed objects, see <convert_frame>.
+ *   n      - Number of vectors.
+ *   in     - The input coordinates.
+ *   out    - The output coordinates.  Can be the same as in.
+ *
+ * Return:
+ *  0 for success.
+ */
+__attribute__((nonnull))
+int convert_frame_batch(const observer_t *obs,
+                        int origin, int dest, bool at_inf, int n,
+                        const double (*in)[3], double (*out)[3]);
+
 /*
  * Function: convert_framev4
  * Rotate a 4D vector from a frame to an other.
@@ -12,14 +12,42 @@
 #include <string.h>
 #include <zlib.h> // For crc32.
 
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+#   define HAS_MMAP 1
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
 // Should be good enough...
 #define URL_MAX_SIZE 4096
 
-// Size of the cache allocated to all the hips tiles.
-// Note: we get into trouble if the tiles visible on screen actually use
-// more space than that.  We could use a more clever cache that can grow
-// past its limit if the items are still in use!
-#define CACHE_SIZE (256 * (1 << 20))
+
+// Max number of tile requests the fetch scheduler keeps running at the
+// same time.  Leave some of the connection slots to the other assets.
+#define FETCH_MAX_ACTIVE 12
+
+// Number of frames after which a tile that was not requested anymore gets
+// removed from the fetch queue (and its request aborted).
+#define FETCH_MAX_IDLE_FRAMES 8
+
+// Max number of tiles we prefetch per frame during a navigation animation.
+#define PREFETCH_MAX_TILES 64
+
+// Max number of upcoming views registered with hips_prefetch_view.
+#define PREFETCH_MAX_VIEWS 8
+
+// Max number of entries of the resolved tiles map before we flush it.
+#define RESOLVED_MAX_ENTRIES 4096
+
+// Max number of split tiles we remember for the render order hysteresis.
+#define SPLIT_MAX_ENTRIES 4096
+
+// Max order of the survey coverage bit fields.  The MOC cells of higher
+// orders are merged into their order 7 parent, which makes the coverage a
+// bit conservative, but only takes 32KB per survey.
+#define HIPS_MOC_MAX_ORDER 7
 
 // Flags of the tiles:
 enum {
@@ -33,6 +61,10 @@ enum {
     TILE_LOAD_ERROR     = 1 << 4,
 };
 
+// Max min order of the surveys for which we use the allsky image.  At
+// order 3 the allsky is a mosaic of 768 tiles of 64x64 pixels.
+#define HIPS_ALLSKY_MAX_ORDER 3
+
 #define TILE_NO_CHILD_ALL \
     (TILE_NO_CHILD_0 | TILE_NO_CHILD_1 | TILE_NO_CHILD_2 | TILE_NO_CHILD_3)
 
@@ -46,6 +78,7 @@ struct tile {
     fader_t     fader;
     int         flags;
     void        *data;
+    int         cost; // Current cost in the cache.
 
     // Loader to parse the image in a thread.
     struct {
@@ -54,6 +87,7 @@ struct tile {
         void *data;
         int size;
         int cost;
+        bool own_data; // Not set if the data comes from an archive.
     } *loader;
 };
 
@@ -74,11 +108,167 @@ typedef struct {
 typedef struct {
     void        *img;
     int         w, h, bpp;
+    void        *ktx;       // KTX2 data, used instead of img if set.
+    int         ktx_size;
     texture_t   *tex;
+    // Compressed source data, to create the texture again after a GL
+    // context loss.
+    void        *src;
+    int         src_size;
 } img_tile_t;
 
-// Gobal cache for all the tiles.
-static cache_t *g_cache = NULL;
+// Keep a copy of the compressed data, that is much smaller than the
+// texture.
+static void tile_keep_src(img_tile_t *tile, const void *data, int size)
+{
+    tile->src = malloc(size);
+    memcpy(tile->src, data, size);
+    tile->src_size = size;
+}
+
+static bool is_ktx(const void *data, int size)
+{
+    return size >= 12 && memcmp(data, "\xABKTX 20\xBB\r\n\x1A\n", 12) == 0;
+}
+
+// Global caches for all the tiles.  We use one cache per kind of survey,
+// so that a heavy images survey cannot evict the stars tiles.
+// Note: we get into trouble if the tiles visible on screen actually use
+// more space than that.  We could use a more clever cache that can grow
+// past its limit if the items are still in use!
+static struct {
+    const char  *name;
+    int         size;   // Default max size.
+    cache_t     *cache;
+} g_caches[] = {
+    {"images",  176 * (1 << 20)},
+    {"stars",   48 * (1 << 20)},
+    {"dsos",    16 * (1 << 20)},
+    {"geojson", 16 * (1 << 20)},
+};
+
+/*
+ * Type: fetch_t
+ * A tile request in the fetch scheduler queue.
+ */
+typedef struct fetch fetch_t;
+struct fetch {
+    UT_hash_handle  hh;
+    char            *url;
+    int             asset_flags;
+    double          priority;   // Lower values are fetched first.
+    int             order;
+    int             frame;      // Last frame the tile was requested.
+    bool            started;
+};
+
+// Global fetch scheduler.  All the tiles requested by the render loop are
+// added to this queue, and <hips_update_fetch_queue> starts the requests
+// of the highest priority tiles first.
+static struct {
+    fetch_t     *fetches;
+    int         frame;
+} g_fetch = {};
+
+// Upcoming views registered with hips_prefetch_view.
+static struct {
+    double      dir[3]; // ICRF.
+    double      fov;
+    int         frame;  // Fetch frame when the view was registered.
+} g_prefetch_views[PREFETCH_MAX_VIEWS] = {};
+
+/*
+ * Type: resolved_tile_t
+ * Memoized parent fallback of a missing tile.
+ */
+typedef struct resolved_tile resolved_tile_t;
+struct resolved_tile {
+    UT_hash_handle  hh;
+    struct {
+        uint32_t    hips_hash;
+        int         order;
+        int         pix;
+        int         flags;
+    } key;
+    int             order;  // Order of the parent tile we use.
+    texture_t       *tex;   // Texture of the parent tile, or NULL.
+};
+
+// Map of the resolved fallbacks of the missing tiles.  The map is flushed
+// every time the set of loaded textures changes, that is when a tile is
+// loaded or evicted from the cache.
+static struct {
+    resolved_tile_t *map;
+    int             count;
+    bool            dirty;
+} g_resolved = {};
+
+/*
+ * Type: split_tile_t
+ * Tiles of the sky surveys that got rendered with their children tiles.
+ *
+ * We keep splitting them until they are clearly small enough on screen,
+ * so that the tiles don't flip between two orders when their screen size
+ * is close to the limit.
+ */
+typedef struct split_tile split_tile_t;
+struct split_tile {
+    UT_hash_handle  hh;
+    struct {
+        uint32_t    hips_hash;
+        int         order;
+        int         pix;
+    } key;
+    int             frame; // Last frame the tile was split.
+};
+
+static struct {
+    split_tile_t    *map;
+    int             count;
+} g_split = {};
+
+// Header of the decoded tiles cache files, followed by the module data.
+typedef struct {
+    char        magic[4] NONSTRING; // "SWDT"
+    uint32_t    version;
+    uint32_t    size; // Size of the data after the header.
+    uint32_t    pad;  // Keep the data 8 bytes aligned.
+} decoded_header_t;
+
+// Directory of the decoded tiles cache, or NULL if disabled.
+static char *g_decoded_dir = NULL;
+
+/*
+ * Type: decoded_save_t
+ * A decoded tile file written in the worker pool.
+ */
+typedef struct decoded_save decoded_save_t;
+struct decoded_save {
+    worker_t        worker;
+    char            *path;
+    uint8_t         *data; // Full file content, header included.
+    int             size;
+    decoded_save_t  *next;
+};
+
+// List of the decoded tile files not written yet.
+static decoded_save_t *g_decoded_saves = NULL;
+
+static void resolved_tiles_invalidate(void)
+{
+    g_resolved.dirty = true;
+}
+
+static void resolved_tiles_flush(void)
+{
+    resolved_tile_t *e, *tmp;
+    HASH_ITER(hh, g_resolved.map, e, tmp) {
+        HASH_DEL(g_resolved.map, e);
+        free(e);
+    }
+    g_resolved.count = 0;
+    g_resolved.dirty = false;
+}
 
 
 static void *create_img_tile(
@@ -86,6 +276,249 @@ static void *create_img_tile(
         int *cost, int *transparency);
 static int delete_img_tile(void *tile);
 
+static cache_t *get_cache(const char *name)
+{
+    int i;
+    for (i = 0; i < ARRAY_SIZE(g_caches); i++) {
+        if (strcmp(g_caches[i].name, name) == 0) break;
+    }
+    if (i == ARRAY_SIZE(g_caches)) {
+        LOG_W("Unknown hips cache: %s", name);
+        i = 0;
+    }
+    if (!g_caches[i].cache)
+        g_caches[i].cache = cache_create(g_caches[i].size, 1);
+    return g_caches[i].cache;
+}
+
+/*
+ * Function: hips_set_cache_size
+ * Set the max size of one of the global tiles caches.
+ *
+ * Parameters:
+ *   name   - Name of the cache ("images", "stars", "dsos" or "geojson").
+ *   size   - New max size in bytes.
+ *
+ * Return:
+ *   0 on success, -1 if the cache doesn't exist.
+ */
+int hips_set_cache_size(const char *name, int size)
+{
+    int i;
+    for (i = 0; i < ARRAY_SIZE(g_caches); i++) {
+        if (strcmp(g_caches[i].name, name) != 0) continue;
+        g_caches[i].size = size;
+        if (g_caches[i].cache) cache_set_max_size(g_caches[i].cache, size);
+        return 0;
+    }
+    return -1;
+}
+
+int hips_trim_cache(const char *name, int size)
+{
+    int i;
+    for (i = 0; i < ARRAY_SIZE(g_caches); i++) {
+        if (strcmp(g_caches[i].name, name) != 0) continue;
+        if (!g_caches[i].cache) return 0;
+        return cache_trim(g_caches[i].cache, size);
+    }
+    return 0;
+}
+
+/*
+ * Function: hips_list_caches
+ * Iter the usage stats of all the global tiles caches.
+ */
+void hips_list_caches(void *user,
+                      void (*f)(void *user, const char *name,
+                                const cache_stats_t *stats))
+{
+    int i;
+    cache_stats_t stats;
+    for (i = 0; i < ARRAY_SIZE(g_caches); i++) {
+        if (g_caches[i].cache) {
+            cache_get_stats(g_caches[i].cache, &stats);
+        } else {
+            memset(&stats, 0, sizeof(stats));
+            stats.max_size = g_caches[i].size;
+        }
+        f(user, g_caches[i].name, &stats);
+    }
+}
+
+void hips_set_decoded_cache_dir(const char *dir)
+{
+#ifndef HAS_MMAP
+    if (dir) LOG_W("Decoded tiles cache not supported");
+    return;
+#endif
+    free(g_decoded_dir);
+    g_decoded_dir = dir ? strdup(dir) : NULL;
+}
+
+bool hips_get_decoded_path(const hips_t *hips, int order, int pix,
+                           char *buf, int size)
+{
+    uint32_t hash;
+    if (!g_decoded_dir || !hips->release_date) return false;
+    hash = crc32(0, (const void*)hips->url, strlen(hips->url));
+    snprintf(buf, size, "%s/%08x-%d/Norder%d/Npix%d.bin", g_decoded_dir,
+             hash, (int)hips->release_date, order, pix);
+    return true;
+}
+
+// Write a decoded tile file.
+static int decoded_save_write(const decoded_save_t *save)
+{
+    char tmp[1024];
+    bool ok;
+    FILE *file;
+
+    if (sys_make_dir(save->path)) return -1;
+    // Write into a temporary file first, so that we never map a partially
+    // written file.
+    snprintf(tmp, sizeof(tmp), "%s.tmp", save->path);
+    file = fopen(tmp, "wb");
+    if (!file) return -1;
+    ok = fwrite(save->data, save->size, 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tmp, save->path) != 0) {
+        LOG_W("Cannot write decoded tile %s", save->path);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static int decoded_save_worker(worker_t *worker)
+{
+    decoded_save_write((decoded_save_t*)worker);
+    return 0;
+}
+
+static void decoded_save_delete(decoded_save_t *save)
+{
+    free(save->path);
+    free(save->data);
+    free(save);
+}
+
+int hips_save_decoded_tile(const char *path, uint32_t version, int nb,
+                           const void *const *blocks, const int *sizes)
+{
+    int i, ofs, ret;
+    decoded_save_t *save;
+    decoded_header_t header = {{'S', 'W', 'D', 'T'}, version};
+
+    for (i = 0; i < nb; i++) header.size += (sizes[i] + 7) / 8 * 8;
+    // Copy all the data, since the blocks can change before we write them.
+    save = calloc(1, sizeof(*save));
+    save->path = strdup(path);
+    save->size = sizeof(header) + header.size;
+    save->data = calloc(1, save->size);
+    memcpy(save->data, &header, sizeof(header));
+    for (i = 0, ofs = sizeof(header); i < nb; i++) {
+        if (sizes[i]) memcpy(save->data + ofs, blocks[i], sizes[i]);
+        ofs += (sizes[i] + 7) / 8 * 8;
+    }
+
+    // Already running in the worker pool, no need for an other worker.
+    if (!worker_is_main_thread()) {
+        ret = decoded_save_write(save);
+        decoded_save_delete(save);
+        return ret;
+    }
+    worker_init(&save->worker, decoded_save_worker);
+    LL_APPEND(g_decoded_saves, save);
+    hips_update_decoded_saves(false);
+    return 0;
+}
+
+void hips_update_decoded_saves(bool wait)
+{
+    decoded_save_t *save, *tmp;
+    LL_FOREACH_SAFE(g_decoded_saves, save, tmp) {
+        if (wait) worker_wait(&save->worker);
+        else if (!worker_iter(&save->worker)) continue;
+        LL_DELETE(g_decoded_saves, save);
+        decoded_save_delete(save);
+    }
+}
+
+#ifdef HAS_MMAP
+
+void *hips_map_decoded_tile(const char *path, uint32_t version, int *size)
+{
+    int fd;
+    struct stat st;
+    uint8_t *map;
+    const decoded_header_t *header;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(*header)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file open.
+    if (map == MAP_FAILED) return NULL;
+    header = (void*)map;
+    if (    memcmp(header->magic, "SWDT", 4) != 0 ||
+            header->version != version ||
+            header->size != st.st_size - sizeof(*header)) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *size = header->size;
+    return map + sizeof(*header);
+}
+
+void hips_unmap_decoded_tile(void *data, int size)
+{
+    munmap((uint8_t*)data - sizeof(decoded_header_t),
+           size + sizeof(decoded_header_t));
+}
+
+#else
+
+void *hips_map_decoded_tile(const char *path, uint32_t version, int *size)
+{
+    return NULL;
+}
+
+void hips_unmap_decoded_tile(void *data, int size)
+{
+    assert(false);
+}
+
+#endif
+
+void hips_apply_textures_budget(int64_t budget)
+{
+    // Don't go below this size, so that we can at least render a full
+    // screen of tiles.
+    const int64_t min_size = 16 * (1 << 20);
+    int64_t target, others;
+    cache_t *cache = get_cache("images");
+    cache_stats_t stats;
+
+    cache_get_stats(cache, &stats);
+    target = g_caches[0].size;
+    assert(strcmp(g_caches[0].name, "images") == 0);
+    if (budget) {
+        others = texture_get_total_size(NULL) - stats.size;
+        target = fmin(target, fmax(budget - others, min_size));
+    }
+    if (target != stats.max_size) cache_set_max_size(cache, target);
+}
+
+// Get the url for a given file in the survey.
+// Automatically add ?v=<release_date> for online surveys.
+static const char *get_url_for(const hips_t *hips, char *buf, int len,
+                               const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
 hips_t *hips_create(const char *url, double release_date,
                     const hips_settings_t *settings)
 {
@@ -94,46 +527,88 @@ hips_t *hips_create(const char *url, double release_date,
         .delete_tile = delete_img_tile,
     };
     hips_t *hips = calloc(1, sizeof(*hips));
+    int len = strlen(url);
     if (!settings) settings = &default_settings;
 
+    // Ignore the trailing slashes, so that all the urls of a survey end up
+    // requesting the same tiles.
+    while (len > 1 && url[len - 1] == '/') len--;
     hips->ref = 1;
     hips->settings = *settings;
-    hips->url = strdup(url);
-    hips->service_url = strdup(url);
+    if (!hips->settings.create_tile) {
+        hips->settings.create_tile = create_img_tile;
+        hips->settings.delete_tile = delete_img_tile;
+    }
+    hips->url = strndup(url, len);
+    hips->service_url = strndup(url, len);
     hips->ext = settings->ext ?: "jpg";
     hips->order_min = 3;
+    hips->bundle_order = -1;
     hips->release_date = release_date;
     hips->frame = FRAME_ASTROM;
-    hips->hash = crc32(0, (const void*)url, strlen(url));
+    // The tiles are stored in the global caches by hash, so that all the
+    // surveys with the same url and settings share the same decoded tiles
+    // and textures, whatever their user pointer.
+    hips->hash = crc32(0, (const void*)url, len);
+    hips->hash = crc32(hips->hash, (const void*)&hips->settings.create_tile,
+                       sizeof(hips->settings.create_tile));
+    hips->hash = crc32(hips->hash,
+                       (const void*)&hips->settings.load_decoded_tile,
+                       sizeof(hips->settings.load_decoded_tile));
+    hips->hash = crc32(hips->hash, (const void*)hips->ext, strlen(hips->ext));
+    hips->cache = get_cache(settings->cache ?: "images");
     return hips;
 }
 
-void hips_delete(hips_t *hips)
+static void hips_retain(hips_t *hips)
+{
+    __atomic_add_fetch(&hips->ref, 1, __ATOMIC_RELAXED);
+}
+
+static void hips_destroy(void *user)
 {
+    hips_t *hips = user;
     int i;
-    if (!hips) return;
-    hips->ref--;
-    assert(hips->ref >= 0);
-    if (hips->ref > 0) return;
+    char url[URL_MAX_SIZE];
+    for (i = 0; i < 12; i++) {
+        if (!(hips->bundles.loaded & (1 << i))) continue;
+        get_url_for(hips, url, sizeof(url), "Bundle/Npix%d.bundle", i);
+        asset_release(url);
+    }
     free(hips->url);
     free(hips->service_url);
-    for (i = 0; i < 12; i++)
-        texture_release(hips->allsky.textures[i]);
+    if (hips->allsky.textures) {
+        for (i = 0; i < 12 * (1 << (2 * hips->order_min)); i++)
+            texture_release(hips->allsky.textures[i]);
+        free(hips->allsky.textures);
+    }
+    free(hips->allsky.data);
+    free(hips->moc.bits);
+    resolved_tiles_invalidate();
     json_builder_free(hips->properties);
     free(hips);
 }
 
+void hips_delete(hips_t *hips)
+{
+    int ref;
+    if (!hips) return;
+    ref = __atomic_sub_fetch(&hips->ref, 1, __ATOMIC_ACQ_REL);
+    assert(ref >= 0);
+    if (ref > 0) return;
+    // The tiles and textures caches are only used on the main thread.
+    if (!worker_is_main_thread()) {
+        worker_defer_to_main(hips_destroy, hips);
+        return;
+    }
+    hips_destroy(hips);
+}
+
 void hips_set_frame(hips_t *hips, int frame)
 {
     hips->frame = frame;
 }
 
-// Get the url for a given file in the survey.
-// Automatically add ?v=<release_date> for online surveys.
-static const char *get_url_for(const hips_t *hips, char *buf, int len,
-                               const char *format, ...)
-    __attribute__((format(printf, 4, 5)));
-
 static const char *get_url_for(const hips_t *hips, char *buf, int len,
                                const char *format, ...)
 {
@@ -167,12 +642,20 @@ static int property_handler(void* user, const char* section,
         hips->order = atoi(value);
     if (strcmp(name, "hips_order_min") == 0)
         hips->order_min = atoi(value);
+    if (strcmp(name, "hips_bundle_order") == 0)
+        hips->bundle_order = atoi(value);
     if (strcmp(name, "hips_tile_width") == 0)
         hips->tile_width = atoi(value);
     if (strcmp(name, "hips_release_date") == 0)
         hips->release_date = hips_parse_date(value);
+    // No need to get the MOC of a full sky survey.
+    if (strcmp(name, "moc_sky_fraction") == 0 && atof(value) >= 1.0)
+        hips->moc.loaded = true;
     if (strcmp(name, "hips_tile_format") == 0) {
-             if (strstr(value, "webp")) hips->ext = "webp";
+        // Prefer the GPU compressed tiles if we can use them.
+             if (strstr(value, "ktx2") && texture_has_compression_support())
+            hips->ext = "ktx2";
+        else if (strstr(value, "webp")) hips->ext = "webp";
         else if (strstr(value, "jpeg")) hips->ext = "jpg";
         else if (strstr(value, "png"))  hips->ext = "png";
         else if (strstr(value, "eph"))  {
@@ -223,19 +706,129 @@ static int parse_properties(hips_t *hips)
 }
 
 
+// Index of the coverage bit of a pixel.  The bit fields of all the orders
+// are stored one after the other.
+static inline int moc_bit(int order, int pix)
+{
+    return 4 * ((1 << (2 * order)) - 1) + pix;
+}
+
+/*
+ * Build the coverage bit fields from a MOC in the json serialization:
+ * {"order": [pix, ...], ...}.
+ */
+static uint64_t *moc_parse(const char *data, int size)
+{
+    const int max = HIPS_MOC_MAX_ORDER;
+    json_value *json;
+    const json_value *cells;
+    uint64_t *bits;
+    int i, j, order, nb, pix, child;
+    int64_t cell, start, end;
+    char *end_str;
+
+    json = json_parse(data, size);
+    if (!json || json->type != json_object) {
+        json_value_free(json);
+        return NULL;
+    }
+    bits = calloc((moc_bit(max + 1, 0) + 63) / 64, sizeof(*bits));
+    for (i = 0; i < json->u.object.length; i++) {
+        order = strtol(json->u.object.values[i].name, &end_str, 10);
+        cells = json->u.object.values[i].value;
+        if (*end_str || order < 0 || order > 29) continue;
+        if (cells->type != json_array) continue;
+        for (j = 0; j < cells->u.array.length; j++) {
+            if (cells->u.array.values[j]->type != json_integer) continue;
+            cell = cells->u.array.values[j]->u.integer;
+            // Mark all the covered pixels at the max order.
+            if (order > max) {
+                start = cell >> (2 * (order - max));
+                end = start + 1;
+            } else {
+                start = cell << (2 * (max - order));
+                end = (cell + 1) << (2 * (max - order));
+            }
+            if (start < 0 || end > 12 << (2 * max)) continue;
+            for (pix = start; pix < end; pix++) {
+                nb = moc_bit(max, pix);
+                bits[nb / 64] |= 1ULL << (nb % 64);
+            }
+        }
+    }
+    json_value_free(json);
+
+    // A pixel is covered if any of its children is.
+    for (order = max - 1; order >= 0; order--) {
+        for (pix = 0; pix < 12 << (2 * order); pix++) {
+            for (i = 0; i < 4; i++) {
+                child = moc_bit(order + 1, pix * 4 + i);
+                if (!(bits[child / 64] & (1ULL << (child % 64)))) continue;
+                nb = moc_bit(order, pix);
+                bits[nb / 64] |= 1ULL << (nb % 64);
+                break;
+            }
+        }
+    }
+    return bits;
+}
+
+/*
+ * Start to load the survey MOC.
+ *
+ * Return true once we know the coverage, or that there is no MOC.
+ * We only support the json MOC serialization for the moment.
+ */
+static bool load_moc(hips_t *hips)
+{
+    const char *data;
+    char url[URL_MAX_SIZE];
+    int size, code;
+
+    if (hips->moc.loaded) return true;
+    get_url_for(hips, url, sizeof(url), "Moc.json");
+    data = asset_get_data2(url, ASSET_ACCEPT_404 | ASSET_USED_ONCE,
+                           &size, &code);
+    if (!code) return false;
+    hips->moc.loaded = true;
+    if (!data) return true;
+    hips->moc.bits = moc_parse(data, size);
+    if (!hips->moc.bits) LOG_W("Cannot parse hips MOC file '%s'", url);
+    return true;
+}
+
+bool hips_is_covered(const hips_t *hips, int order, int pix)
+{
+    int nb;
+    if (!hips->moc.bits) return true;
+    if (order > HIPS_MOC_MAX_ORDER) {
+        pix >>= 2 * (order - HIPS_MOC_MAX_ORDER);
+        order = HIPS_MOC_MAX_ORDER;
+    }
+    nb = moc_bit(order, pix);
+    return hips->moc.bits[nb / 64] & (1ULL << (nb % 64));
+}
+
 // Used by the cache.
 static int del_tile(void *data)
 {
     tile_t *tile = data;
-    // XXX: why the worker_is_running?
+    // Can't delete the tile while a thread is still parsing it.
     if (tile->loader && worker_is_running(&tile->loader->worker))
         return CACHE_KEEP;
+    if (tile->loader) {
+        if (tile->loader->own_data) free(tile->loader->data);
+        free(tile->loader);
+        tile->loader = NULL;
+    }
     if (tile->data) {
         if (tile->hips->settings.delete_tile(tile->data) == CACHE_KEEP)
             return CACHE_KEEP;
     }
+    tile->hips->stats.bytes -= tile->cost;
     hips_delete(tile->hips);
     free(tile);
+    resolved_tiles_invalidate();
     return 0;
 }
 
@@ -311,12 +904,20 @@ void hips_iter_init(hips_iterator_t *iter)
  * Return false if there are no more pixel enqueued.
  */
 bool hips_iter_next(hips_iterator_t *iter, int *order, int *pix)
+{
+    uint32_t flags;
+    return hips_iter_next2(iter, order, pix, &flags);
+}
+
+bool hips_iter_next2(hips_iterator_t *iter, int *order, int *pix,
+                     uint32_t *flags)
 {
     const int n = ARRAY_SIZE(iter->queue);
     if (!iter->size) return false;
     // Get the first tile from the queue.
     *order = iter->queue[iter->start % n].order;
     *pix = iter->queue[iter->start % n].pix;
+    *flags = iter->queue[iter->start % n].flags;
     iter->start++;
     iter->size--;
     return true;
@@ -330,6 +931,12 @@ bool hips_iter_next(hips_iterator_t *iter, int *order, int *pix)
  * from the iterator have been processed.
  */
 void hips_iter_push_children(hips_iterator_t *iter, int order, int pix)
+{
+    hips_iter_push_children2(iter, order, pix, 0);
+}
+
+void hips_iter_push_children2(hips_iterator_t *iter, int order, int pix,
+                              uint32_t flags)
 {
     typedef __typeof__(iter->queue[0]) node_t;
     const int n = ARRAY_SIZE(iter->queue);
@@ -342,13 +949,134 @@ void hips_iter_push_children(hips_iterator_t *iter, int order, int pix)
     }
     for (i = 0; i < 4; i++) {
         iter->queue[(iter->start + iter->size) % n] = (node_t) {
-            order + 1, pix * 4 + i
+            order + 1, pix * 4 + i, flags
         };
         iter->size++;
     }
 }
 
 
+// Return the texture of a tile, or of the allsky image, without looking
+// for a parent fallback.
+static texture_t *get_tile_texture_(hips_t *hips, int order, int pix,
+                                    int flags, bool *loading_complete)
+{
+    int code, x, y, nbw;
+    img_tile_t *tile = NULL;
+
+    if (order <= hips->order && !(flags & HIPS_FORCE_USE_ALLSKY)) {
+        tile = hips_get_tile(hips, order, pix, flags, &code);
+        if (!tile && code && code != 598)
+            *loading_complete = true;
+    }
+
+    // The texture was lost with the GL context: decode the source again.
+    // Since we only get here for the rendered tiles, the visible region is
+    // restored first.
+    if (tile && tile->tex && !tile->tex->id && tile->src &&
+        texture_upload_take(tile->src_size)) {
+        texture_release(tile->tex);
+        tile->tex = NULL;
+        if (is_ktx(tile->src, tile->src_size)) {
+            tile->ktx = malloc(tile->src_size);
+            memcpy(tile->ktx, tile->src, tile->src_size);
+            tile->ktx_size = tile->src_size;
+        } else {
+            tile->img = img_read_from_mem(tile->src, tile->src_size,
+                                          &tile->w, &tile->h, &tile->bpp);
+        }
+    }
+
+    // Create texture if needed, within the frame upload budget so that
+    // many tiles arriving at once don't stall a single frame.  Until then
+    // we use the parent tile texture.
+    if (tile && (tile->ktx || tile->img) && !tile->tex &&
+        !texture_upload_take(tile->ktx ? tile->ktx_size :
+                             tile->w * tile->h * tile->bpp)) {
+        core_request_redraw();
+        return NULL;
+    }
+    if (tile && tile->ktx && !tile->tex) {
+        tile->tex = texture_from_ktx2(tile->ktx, tile->ktx_size, 0);
+        if (!tile->tex) LOG_W_ONCE("Cannot create texture from ktx2 tile");
+        free(tile->ktx);
+        tile->ktx = NULL;
+        resolved_tiles_invalidate();
+    }
+    if (tile && tile->img && !tile->tex) {
+        tile->tex = texture_from_data(tile->img, tile->w, tile->h, tile->bpp,
+                                      0, 0, tile->w, tile->h, 0);
+        img_pool_release(tile->img, tile->w * tile->h * tile->bpp);
+        tile->img = NULL;
+        resolved_tiles_invalidate();
+    }
+    if (tile && tile->tex) {
+        *loading_complete = true;
+        return tile->tex;
+    }
+
+    // Return the allsky texture if the tile is not ready yet.
+    if (!tile && order == hips->order_min && hips->allsky.data) {
+        if (!hips->allsky.textures) {
+            hips->allsky.textures = calloc(12 * (1 << (2 * order)),
+                                           sizeof(*hips->allsky.textures));
+        }
+        if (hips->allsky.textures[pix] && !hips->allsky.textures[pix]->id) {
+            texture_release(hips->allsky.textures[pix]);
+            hips->allsky.textures[pix] = NULL;
+        }
+        if (!hips->allsky.textures[pix]) {
+            nbw = (int)sqrt(12 * (1 << (2 * hips->order_min)));
+            x = (pix % nbw) * hips->allsky.w / nbw;
+            y = (pix / nbw) * hips->allsky.w / nbw;
+            hips->allsky.textures[pix] = texture_from_data(
+                    hips->allsky.data, hips->allsky.w, hips->allsky.h,
+                    hips->allsky.bpp,
+                    x, y, hips->allsky.w / nbw, hips->allsky.w / nbw, 0);
+        }
+        if (flags & HIPS_FORCE_USE_ALLSKY) *loading_complete = true;
+        return hips->allsky.textures[pix];
+    }
+    return NULL;
+}
+
+// Find the closest parent tile with a texture, using the resolved tiles
+// map to avoid walking up the orders every frame.
+static texture_t *get_parent_texture(hips_t *hips, int order, int pix,
+                                     int flags, int *parent_order)
+{
+    resolved_tile_t *e, key = {};
+    texture_t *tex = NULL;
+    bool loading_complete;
+    int i;
+
+    if (g_resolved.dirty || g_resolved.count >= RESOLVED_MAX_ENTRIES)
+        resolved_tiles_flush();
+    key.key.hips_hash = hips->hash;
+    key.key.order = order;
+    key.key.pix = pix;
+    key.key.flags = flags;
+    HASH_FIND(hh, g_resolved.map, &key.key, sizeof(key.key), e);
+    if (e) {
+        *parent_order = e->order;
+        return e->tex;
+    }
+
+    for (i = order - 1; i >= hips->order_min; i--) {
+        tex = get_tile_texture_(hips, i, pix >> (2 * (order - i)), flags,
+                                &loading_complete);
+        if (tex) break;
+    }
+    e = calloc(1, sizeof(*e));
+    e->key = key.key;
+    e->order = i;
+    e->tex = tex;
+    HASH_ADD(hh, g_resolved.map, key, sizeof(e->key), e);
+    g_resolved.count++;
+    *parent_order = i;
+    return tex;
+}
+
 /*
  * Function: hips_get_tile_texture
  * Get the texture for a given hips tile.
@@ -360,6 +1088,8 @@ void hips_iter_push_children(hips_iterator_t *iter, int order, int pix)
  *   - If all else failed, return NULL.  In that case the UV and projection
  *     are still set, so that the client can still render a fallback texture.
  *
+ * The parent fallbacks are memoized until a tile gets loaded or evicted.
+ *
  * Parameters:
  *   order   - Order of the tile we are looking for.
  *   pix     - Pixel index of the tile we are looking for.
@@ -379,8 +1109,7 @@ texture_t *hips_get_tile_texture(
         bool *loading_complete)
 {
     bool loading_complete_;
-    int code, x, y, nbw;
-    img_tile_t *tile = NULL;
+    int i, p, parent_order;
     texture_t *tex;
 
     if (!loading_complete) loading_complete = &loading_complete_;
@@ -391,55 +1120,87 @@ texture_t *hips_get_tile_texture(
     if (!hips_is_ready(hips)) return NULL;
     if (order < hips->order_min) return NULL;
 
-    if (order <= hips->order && !(flags & HIPS_FORCE_USE_ALLSKY)) {
-        tile = hips_get_tile(hips, order, pix, flags, &code);
-        if (!tile && code && code != 598)
-            *loading_complete = true;
-    }
-
-    // Create texture if needed.
-    if (tile && tile->img && !tile->tex) {
-        tile->tex = texture_from_data(tile->img, tile->w, tile->h, tile->bpp,
-                                      0, 0, tile->w, tile->h, 0);
-        free(tile->img);
-        tile->img = NULL;
-    }
-    if (tile && tile->tex) {
-        *loading_complete = true;
-        return tile->tex;
-    }
-
-
-    // Return the allsky texture if the tile is not ready yet.  Only do
-    // it for level 0 allsky for the moment.
-    if (!tile && order == 0 && hips->allsky.data) {
-        if (!hips->allsky.textures[pix]) {
-            nbw = (int)sqrt(12 * (1 << (2 * hips->order_min)));
-            x = (pix % nbw) * hips->allsky.w / nbw;
-            y = (pix / nbw) * hips->allsky.w / nbw;
-            hips->allsky.textures[pix] = texture_from_data(
-                    hips->allsky.data, hips->allsky.w, hips->allsky.h,
-                    hips->allsky.bpp,
-                    x, y, hips->allsky.w / nbw, hips->allsky.w / nbw, 0);
-        }
-        if (flags & HIPS_FORCE_USE_ALLSKY) *loading_complete = true;
-        return hips->allsky.textures[pix];
-    }
+    tex = get_tile_texture_(hips, order, pix, flags, loading_complete);
+    if (tex) return tex;
 
     // If we didn't find the tile, or the texture is not loaded yet,
     // fallback to one of the parent tile texture.
     if (order == hips->order_min) return NULL; // No parent.
-    tex = hips_get_tile_texture(
-            hips, order - 1, pix / 4, flags, transf, NULL, NULL);
+    tex = get_parent_texture(hips, order, pix, flags, &parent_order);
     if (!tex) return NULL;
     if (transf) {
-        mat3_iscale(transf, 0.5, 0.5, 1.0);
-        mat3_itranslate(transf, (pix % 4) / 2, (pix % 4) % 2);
+        for (i = parent_order + 1; i <= order; i++) {
+            p = pix >> (2 * (order - i));
+            mat3_iscale(transf, 0.5, 0.5, 1.0);
+            mat3_itranslate(transf, (p % 4) / 2, (p % 4) % 2);
+        }
     }
     return tex;
 }
 
 
+hips_stats_t *hips_frame_stats(hips_t *hips)
+{
+    if (hips->stats.frame != g_fetch.frame) {
+        // Only keep the last stats if they are from the previous frame.
+        if (hips->stats.frame == g_fetch.frame - 1)
+            hips->stats.last = hips->stats.current;
+        else
+            memset(&hips->stats.last, 0, sizeof(hips->stats.last));
+        memset(&hips->stats.current, 0, sizeof(hips->stats.current));
+        hips->stats.current.render_order = -1;
+        hips->stats.frame = g_fetch.frame;
+    }
+    return &hips->stats.current;
+}
+
+void hips_get_stats(const hips_t *hips, hips_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->render_order = -1;
+    // Note: g_fetch.frame is incremented at the end of each frame.
+    if (hips->stats.frame == g_fetch.frame - 1)
+        *stats = hips->stats.current;
+    else if (hips->stats.frame == g_fetch.frame)
+        *stats = hips->stats.last;
+    stats->bytes = hips->stats.bytes;
+}
+
+void hips_get_memory(const hips_t *hips, int64_t *cpu, int64_t *gpu)
+{
+    int i;
+    if (hips->settings.create_tile == create_img_tile)
+        *gpu += hips->stats.bytes;
+    else
+        *cpu += hips->stats.bytes;
+    if (hips->allsky.data)
+        *cpu += hips->allsky.w * hips->allsky.h * hips->allsky.bpp;
+    if (hips->allsky.src_data) *cpu += hips->allsky.size;
+    if (hips->allsky.textures) {
+        for (i = 0; i < 12 * (1 << (2 * hips->order_min)); i++) {
+            if (hips->allsky.textures[i])
+                *gpu += hips->allsky.textures[i]->size;
+        }
+    }
+}
+
+json_value *hips_get_stats_json(const hips_t *hips)
+{
+    hips_stats_t stats;
+    json_value *ret;
+
+    hips_get_stats(hips, &stats);
+    ret = json_object_new(0);
+    json_object_push(ret, "visited", json_integer_new(stats.visited));
+    json_object_push(ret, "clipped", json_integer_new(stats.clipped));
+    json_object_push(ret, "rendered", json_integer_new(stats.rendered));
+    json_object_push(ret, "missing", json_integer_new(stats.missing));
+    json_object_push(ret, "render_order",
+                     json_integer_new(stats.render_order));
+    json_object_push(ret, "bytes", json_integer_new(stats.bytes));
+    return ret;
+}
+
 static int render_visitor(hips_t *hips, const painter_t *painter_,
                           const double transf[4][4],
                           int order, int pix, int split,
@@ -459,7 +1220,9 @@ static int render_visitor(hips_t *hips, const painter_t *painter_,
     tex = hips_get_tile_texture(hips, order, pix, flags, uv, &fade, &loaded);
     mat3_mul(uv, uv_swap, uv);
     if (loaded) (*nb_loaded)++;
+    else hips_frame_stats(hips)->missing++;
     if (!tex) return 0;
+    hips_frame_stats(hips)->rendered++;
     painter.color[3] *= fade;
     painter_set_texture(&painter, PAINTER_TEX_COLOR, tex, uv);
     uv_map_init_healpix(&map, order, pix, false, true);
@@ -469,47 +1232,354 @@ static int render_visitor(hips_t *hips, const painter_t *painter_,
     return 0;
 }
 
+/*
+ * Get the view direction and fov at the end of the current navigation
+ * animation.
+ *
+ * Return false if there is no animation running.
+ */
+static bool get_animation_target(double dir[3], double *fov)
+{
+    const double x[3] = {1, 0, 0};
+    bool moving, zooming;
+
+    moving = core->target.src_time &&
+             (!core->target.lock || core->target.move_to_lock);
+    zooming = core->fov_animation.src_time && core->fov_animation.dst_fov;
+    if (!moving && !zooming) return false;
+
+    *fov = zooming ? core->fov_animation.dst_fov : core->fov;
+    if (moving) {
+        quat_mul_vec3(core->target.dst_q, x, dir);
+        convert_frame(core->observer, FRAME_MOUNT, FRAME_ICRF, true, dir, dir);
+    } else {
+        convert_frame(core->observer, FRAME_VIEW, FRAME_ICRF, true,
+                      VEC(0, 0, -1), dir);
+    }
+    return true;
+}
+
+/*
+ * Prefetch the tiles that will be visible in a view with a given ICRF
+ * direction and fov.  If the fov is smaller than the current one we also
+ * prefetch one order deeper around the target center.
+ *
+ * The tiles go through the normal fetch queue, and since they are usually
+ * far from the current view center they get a lower priority than the
+ * visible tiles.
+ */
+static void prefetch_view(hips_t *hips, int render_order,
+                          const double icrf_dir[3], double fov)
+{
+    double dir[3], aspect, radius, cap[4], tile_cap[4];
+    int order, pix, code, target_order, max_order, nb = 0;
+    hips_iterator_t iter;
+
+    convert_frame(core->observer, FRAME_ICRF, hips->frame, true, icrf_dir,
+                  dir);
+
+    max_order = fmin(hips->order, 9);
+    target_order = render_order + round(log2(core->fov / fov));
+    target_order = clamp(target_order, hips->order_min, max_order);
+    if (fov < core->fov) max_order = fmin(max_order, target_order + 1);
+    else max_order = target_order;
+
+    aspect = core->win_size[0] / core->win_size[1];
+    radius = fmin(M_PI, fov / 2 * sqrt(1 + aspect * aspect));
+
+    hips_iter_init(&iter);
+    while (hips_iter_next(&iter, &order, &pix)) {
+        vec3_copy(dir, cap);
+        // Only go deeper than the target order near the center.
+        cap[3] = cos(order > target_order ? radius / 2 : radius);
+        healpix_get_bounding_cap(1 << order, pix, tile_cap);
+        if (!cap_intersects_cap(cap, tile_cap)) continue;
+        if (order < hips->order_min) {
+            hips_iter_push_children(&iter, order, pix);
+            continue;
+        }
+        if (nb++ >= PREFETCH_MAX_TILES) break;
+        // Note: this also makes sure the parent tiles are loaded first.
+        if (!hips_get_tile(hips, order, pix, HIPS_LOAD_IN_THREAD, &code))
+            continue;
+        if (order < max_order)
+            hips_iter_push_children(&iter, order, pix);
+    }
+}
+
+/*
+ * Prefetch the tiles that will be visible at the end of the current
+ * navigation animation, so that the destination is already sharp when we
+ * get there, as well as the tiles of the views registered with
+ * hips_prefetch_view.
+ */
+static void prefetch_animation_target(hips_t *hips, int render_order)
+{
+    double dir[3], fov;
+    int i;
+
+    if (get_animation_target(dir, &fov))
+        prefetch_view(hips, render_order, dir, fov);
+    for (i = 0; i < PREFETCH_MAX_VIEWS; i++) {
+        if (!g_prefetch_views[i].fov) continue;
+        if (g_prefetch_views[i].frame < g_fetch.frame - 1) continue;
+        prefetch_view(hips, render_order, g_prefetch_views[i].dir,
+                      g_prefetch_views[i].fov);
+    }
+}
+
+void hips_prefetch_view(const double dir[3], double fov)
+{
+    int i;
+    for (i = 0; i < PREFETCH_MAX_VIEWS; i++) {
+        if (g_prefetch_views[i].fov &&
+            g_prefetch_views[i].frame >= g_fetch.frame - 1) continue;
+        vec3_normalize(dir, g_prefetch_views[i].dir);
+        g_prefetch_views[i].fov = fov;
+        g_prefetch_views[i].frame = g_fetch.frame;
+        return;
+    }
+}
+
+// Render order clamped into the physically possible range.
+static int get_clamped_render_order(const hips_t *hips,
+                                    const painter_t *painter)
+{
+    int render_order = hips_get_render_order(hips, painter);
+    render_order = clamp(render_order, hips->order_min, hips->order);
+    return fmin(render_order, 9); // Hard limit.
+}
+
+// Find the split_tile_t entry of a tile, and create it if needed.
+static split_tile_t *get_split_tile(const hips_t *hips, int order, int pix,
+                                    bool create)
+{
+    split_tile_t *e, *tmp, key = {};
+
+    key.key.hips_hash = hips->hash;
+    key.key.order = order;
+    key.key.pix = pix;
+    HASH_FIND(hh, g_split.map, &key.key, sizeof(key.key), e);
+    if (e || !create) return e;
+    if (g_split.count >= SPLIT_MAX_ENTRIES) {
+        HASH_ITER(hh, g_split.map, e, tmp) {
+            HASH_DEL(g_split.map, e);
+            free(e);
+        }
+        g_split.count = 0;
+    }
+    e = calloc(1, sizeof(*e));
+    e->key = key.key;
+    HASH_ADD(hh, g_split.map, key, sizeof(e->key), e);
+    g_split.count++;
+    return e;
+}
+
+/*
+ * Test if a sky survey tile should be rendered with its children tiles,
+ * from the size of the tile on screen.
+ *
+ * The tiles can go up to two orders lower, or one order higher, than the
+ * global render order, so that the areas where the projection stretches
+ * the sky (like the edges of the mollweide projection, or the horizon in
+ * stereographic) get the resolution they need.  If we can't project the
+ * tile corners, we just use the global render order.
+ */
+static bool tile_needs_split(hips_t *hips, const painter_t *painter,
+                             int order, int pix, int render_order)
+{
+    double corners[4][3], win[4][2], size = 0, limit;
+    split_tile_t *e;
+    bool was_split;
+    int i;
+
+    if (order < render_order - 2) return true;
+    if (order > render_order) return false;
+
+    healpix_get_boundaries(1 << order, pix, corners);
+    for (i = 0; i < 4; i++) {
+        if (!painter_project(painter, hips->frame, corners[i], true, false,
+                             win[i]))
+            return order < render_order;
+    }
+    for (i = 0; i < 4; i++)
+        size = fmax(size, vec2_dist(win[i], win[(i + 1) % 4]));
+
+    // Split when the texture pixels get larger than the screen pixels,
+    // with some margin depending on the last frame choice.
+    e = get_split_tile(hips, order, pix, false);
+    was_split = e && e->frame >= g_fetch.frame - 1;
+    limit = (hips->tile_width ?: 256) * (was_split ? 1.1 : 1.5);
+    // Go up to one order lower if we need to render faster.
+    limit *= pow(2, 1 - quality_get(&core->quality, QUALITY_HIPS));
+    if (size <= limit) return false;
+    get_split_tile(hips, order, pix, true)->frame = g_fetch.frame;
+    return true;
+}
+
 int hips_render(hips_t *hips, const painter_t *painter,
                 const double transf[4][4], int split_order)
 {
     int nb_tot = 0, nb_loaded = 0;
-    int render_order, order, pix, split;
+    int render_order, order, pix, split, max_order;
+    bool split_tile;
     hips_iterator_t iter;
     uv_map_t map;
+    hips_stats_t *stats;
 
     assert(split_order >= 0);
     if (painter->color[3] == 0.0) return 0;
     if (!hips_is_ready(hips)) return 0;
 
-    render_order = hips_get_render_order(hips, painter);
-    // Clamp the render order into physically possible range.
-    render_order = clamp(render_order, hips->order_min, hips->order);
-    render_order = fmin(render_order, 9); // Hard limit.
+    render_order = get_clamped_render_order(hips, painter);
 
     // Can't split less than the rendering order.
     split_order = fmax(split_order, render_order);
+    stats = hips_frame_stats(hips);
+    stats->render_order = render_order;
+    max_order = fmin(hips->order, 9);
 
     // Breath first traversal of all the tiles.
     hips_iter_init(&iter);
     while (hips_iter_next(&iter, &order, &pix)) {
+        stats->visited++;
         // Early exit if the tile is clipped.
         uv_map_init_healpix(&map, order, pix, false, false);
         map.transf = (const void*)transf;
-        if (painter_is_quad_clipped(painter, hips->frame, &map))
+        if (painter_is_quad_clipped(painter, hips->frame, &map)) {
+            stats->clipped++;
             continue;
-        if (order < render_order) { // Keep going.
+        }
+        // Nothing to render outside of the survey coverage.
+        if (!hips_is_covered(hips, order, pix)) continue;
+        // The sky surveys select the order of each tile from its size on
+        // screen, the others use the global render order.
+        if (order < hips->order_min)
+            split_tile = true;
+        else if (transf)
+            split_tile = order < render_order;
+        else
+            split_tile = order < max_order &&
+                tile_needs_split(hips, painter, order, pix, render_order);
+        if (split_tile) { // Keep going.
             hips_iter_push_children(&iter, order, pix);
             continue;
         }
-        split = 1 << (split_order - render_order);
+        split = 1 << (int)fmax(split_order - order, 0);
         render_visitor(hips, painter, transf, order, pix, split,
                        &nb_tot, &nb_loaded);
     }
 
+    // Only sky surveys can anticipate the view movements.
+    if (!transf) prefetch_animation_target(hips, render_order);
+
     progressbar_report(hips->url, hips->label, nb_loaded, nb_tot, -1);
     return 0;
 }
 
+/*
+ * Get the texture of a tile for a survey rendered at a lower order than
+ * the tile, in which case we use the texture of the parent tile at the
+ * survey render order.  The uv matrix is set as in render_visitor.
+ */
+static texture_t *get_layer_texture(hips_t *hips, int render_order,
+                                    int order, int pix, double uv[3][3],
+                                    double *fade, int *nb_tot,
+                                    int *nb_loaded)
+{
+    const double uv_swap[3][3] = {{0, 1, 0}, {1, 0, 0}, {0, 0, 1}};
+    int i, p, tex_order = fmin(order, render_order);
+    bool loaded;
+    texture_t *tex;
+
+    (*nb_tot)++;
+    mat3_set_identity(uv);
+    tex = hips_get_tile_texture(hips, tex_order,
+                                pix >> (2 * (order - tex_order)),
+                                HIPS_LOAD_IN_THREAD, uv, fade, &loaded);
+    if (loaded) (*nb_loaded)++;
+    else hips_frame_stats(hips)->missing++;
+    if (!tex) return NULL;
+    for (i = tex_order + 1; i <= order; i++) {
+        p = pix >> (2 * (order - i));
+        mat3_iscale(uv, 0.5, 0.5, 1.0);
+        mat3_itranslate(uv, (p % 4) / 2, (p % 4) % 2);
+    }
+    mat3_mul(uv, uv_swap, uv);
+    hips_frame_stats(hips)->rendered++;
+    return tex;
+}
+
+int hips_render_composite(const hips_layer_t *base, const hips_layer_t *top)
+{
+    int nb_tot[2] = {}, nb_loaded[2] = {};
+    int render_order[2], order, pix, split_order, max_order, i;
+    double uv[2][3][3], fade[2];
+    const hips_layer_t *layers[2] = {base, top};
+    texture_t *tex[2];
+    hips_iterator_t iter;
+    uv_map_t map;
+    painter_t painter;
+
+    if (    base->painter.color[3] == 0.0 || !hips_is_ready(base->hips) ||
+            top->painter.color[3] == 0.0 || !hips_is_ready(top->hips) ||
+            base->hips->frame != top->hips->frame) {
+        hips_render(base->hips, &base->painter, NULL, base->split_order);
+        hips_render(top->hips, &top->painter, NULL, top->split_order);
+        return 0;
+    }
+
+    for (i = 0; i < 2; i++) {
+        render_order[i] = get_clamped_render_order(layers[i]->hips,
+                                                   &layers[i]->painter);
+        hips_frame_stats(layers[i]->hips)->render_order = render_order[i];
+    }
+    max_order = fmax(render_order[0], render_order[1]);
+    split_order = fmax(fmax(base->split_order, top->split_order), max_order);
+
+    hips_iter_init(&iter);
+    while (hips_iter_next(&iter, &order, &pix)) {
+        for (i = 0; i < 2; i++) hips_frame_stats(layers[i]->hips)->visited++;
+        uv_map_init_healpix(&map, order, pix, false, false);
+        if (painter_is_quad_clipped(&top->painter, top->hips->frame, &map)) {
+            for (i = 0; i < 2; i++)
+                hips_frame_stats(layers[i]->hips)->clipped++;
+            continue;
+        }
+        if (order < max_order) {
+            hips_iter_push_children(&iter, order, pix);
+            continue;
+        }
+        for (i = 0; i < 2; i++) {
+            tex[i] = get_layer_texture(layers[i]->hips, render_order[i],
+                                       order, pix, uv[i], &fade[i],
+                                       &nb_tot[i], &nb_loaded[i]);
+        }
+        if (!tex[0] && !tex[1]) continue;
+        // Use the base texture if we have it, with the top one composited
+        // over it, otherwise only the top one.
+        i = tex[0] ? 0 : 1;
+        painter = layers[i]->painter;
+        painter.color[3] *= fade[i];
+        painter_set_texture(&painter, PAINTER_TEX_COLOR, tex[i], uv[i]);
+        if (tex[0] && tex[1]) {
+            painter_set_texture(&painter, PAINTER_TEX_LAYER, tex[1], uv[1]);
+            vec4_copy(top->painter.color, painter.layer_color);
+            painter.layer_color[3] *= fade[1];
+        }
+        uv_map_init_healpix(&map, order, pix, false, true);
+        paint_quad(&painter, base->hips->frame, &map,
+                   1 << (split_order - max_order));
+    }
+
+    for (i = 0; i < 2; i++) {
+        prefetch_animation_target(layers[i]->hips, render_order[i]);
+        progressbar_report(layers[i]->hips->url, layers[i]->hips->label,
+                           nb_loaded[i], nb_tot[i], -1);
+    }
+    return 0;
+}
+
 static void init_label(hips_t *hips)
 {
     const char *collection;
@@ -544,6 +1614,7 @@ bool hips_update(hips_t *hips)
     int code, err, size;
     char url[1024];
     const char *data;
+    bool moc_ready;
     if (hips->error) return false;
     if (!hips->properties) {
         err = parse_properties(hips);
@@ -555,20 +1626,26 @@ bool hips_update(hips_t *hips)
         init_label(hips);
     }
 
+    // We need the coverage before we start to request the tiles, but we
+    // can load it at the same time as the allsky.
+    moc_ready = load_moc(hips);
+
     // Get the allsky before anything else if available.
-    // Only for level zero allsky images.  We don't use the other ones.
     if (!hips->allsky.worker.fn &&
             !hips->allsky.not_available && !hips->allsky.data &&
-            hips->order_min == 0) {
+            hips->order_min <= HIPS_ALLSKY_MAX_ORDER) {
         snprintf(url, sizeof(url), "%s/Norder%d/Allsky.%s?v=%d",
                  hips->service_url, hips->order_min, hips->ext,
                  (int)hips->release_date);
         data = asset_get_data2(url, ASSET_USED_ONCE, &size, &code);
-        if (!code) return false;
+        // Only the small order zero allsky images (planets) block the
+        // rendering.  For the others we start to load the tiles at the
+        // same time, and use the allsky as a preview once it's ready.
+        if (!code) return moc_ready && hips->order_min > 0;
         if (!data) hips->allsky.not_available = true;
         if (data) {
             worker_init(&hips->allsky.worker, load_allsky_worker);
-            hips->ref++;
+            hips_retain(hips);
             hips->allsky.src_data = malloc(size);
             hips->allsky.size = size;
             memcpy(hips->allsky.src_data, data, size);
@@ -577,13 +1654,22 @@ bool hips_update(hips_t *hips)
 
     // If the allsky image is loading wait for it to finish.
     if (hips->allsky.worker.fn) {
-        if (!worker_iter(&hips->allsky.worker)) return false;
+        if (!worker_iter(&hips->allsky.worker))
+            return moc_ready && hips->order_min > 0;
         hips_delete(hips); // Release ref from worker.
         if (!hips->allsky.data) hips->allsky.not_available = true;
         hips->allsky.worker.fn = NULL;
+        resolved_tiles_invalidate();
     }
 
-    return true;
+    return moc_ready;
+}
+
+void hips_prefetch(hips_t *hips)
+{
+    // If the properties are already available (in the persistent cache),
+    // this also starts the allsky request.
+    hips_update(hips);
 }
 
 bool hips_is_ready(hips_t *hips)
@@ -607,7 +1693,9 @@ int hips_get_render_order(const hips_t *hips, const painter_t *painter)
     double w = hips->tile_width ?: 256;
     double win_h = painter->proj->window_size[1];
     double f = fabs(painter->proj->mat[1][1]);
-    return round(log2(M_PI * f * win_h / (4.0 * sqrt(2.0) * w)));
+    // Go up to one order lower if we need to render faster.
+    double lower = 1 - quality_get(&core->quality, QUALITY_HIPS);
+    return round(log2(M_PI * f * win_h / (4.0 * sqrt(2.0) * w)) - lower);
 }
 
 int hips_get_render_order_planet(const hips_t *hips, const painter_t *painter,
@@ -637,6 +1725,7 @@ int hips_get_render_order_planet(const hips_t *hips, const painter_t *painter,
     double d = vec3_norm(mat[3]);
     double order;
     order = log2(f * win_h * M_PI * r / (4.0 * sqrt(2.0) * w * (d - r)));
+    order -= 1 - quality_get(&core->quality, QUALITY_HIPS);
     // Note: I add 1 to make sure the planets look sharp.  Note sure why
     // this is needed (because of the interpolation?)
     return ceil(order + 1);
@@ -648,15 +1737,231 @@ static int load_tile_worker(worker_t *worker)
     typeof(((tile_t*)0)->loader) loader = (void*)worker;
     tile_t *tile = loader->tile;
     hips_t *hips = tile->hips;
+    trace_begin("hips", "load_tile");
     tile->data = hips->settings.create_tile(
                     hips->settings.user, tile->pos.order, tile->pos.pix,
                     loader->data, loader->size, &loader->cost, &transparency);
     if (!tile->data) tile->flags |= TILE_LOAD_ERROR;
     tile->flags |= (transparency * TILE_NO_CHILD_0);
-    free(loader->data);
+    if (loader->own_data) free(loader->data);
+    loader->data = NULL;
+    trace_end("hips", "load_tile");
     return 0;
 }
 
+/*
+ * Compute the fetch priority of a tile.  Lower values get fetched first.
+ *
+ * We use the order of the tile, since larger tiles cover more of the screen
+ * and are needed first anyway to load their children, plus the angular
+ * distance of the tile center to the view center, in fov unit.
+ */
+static double get_tile_priority(const hips_t *hips, int order, int pix)
+{
+    double pos[3], dist;
+    if (!core || !core->observer) return order;
+    healpix_pix2vec(1 << order, pix, pos);
+    convert_frame(core->observer, hips->frame, FRAME_VIEW, true, pos, pos);
+    dist = acos(clamp(-pos[2], -1.0, 1.0));
+    return order + dist / fmax(core->fov, CORE_MIN_FOV);
+}
+
+static bool url_is_remote(const char *url)
+{
+    return str_startswith(url, "http://") || str_startswith(url, "https://");
+}
+
+/*
+ * Get the data of a tile through the fetch scheduler.
+ *
+ * Same as asset_get_data2, except that the request won't be started
+ * until the scheduler decides so in <hips_update_fetch_queue>.
+ */
+static const void *fetch_get_data(const char *url, int asset_flags,
+                                  int order, double priority,
+                                  int *size, int *code)
+{
+    fetch_t *fetch;
+    const void *data;
+
+    HASH_FIND_STR(g_fetch.fetches, url, fetch);
+    if (!fetch) {
+        fetch = calloc(1, sizeof(*fetch));
+        fetch->url = strdup(url);
+        fetch->priority = priority;
+        HASH_ADD_KEYPTR(hh, g_fetch.fetches, fetch->url, strlen(fetch->url),
+                        fetch);
+    }
+    // The same tile can be requested several times per frame, keep the
+    // highest priority.
+    if (fetch->frame != g_fetch.frame) fetch->priority = priority;
+    fetch->priority = fmin(fetch->priority, priority);
+    fetch->frame = g_fetch.frame;
+    fetch->asset_flags = asset_flags;
+    fetch->order = order;
+
+    *code = 0;
+    *size = 0;
+    if (!fetch->started) return NULL;
+    data = asset_get_data2(url, asset_flags, size, code);
+    if (*code) {
+        HASH_DEL(g_fetch.fetches, fetch);
+        free(fetch->url);
+        free(fetch);
+    }
+    return data;
+}
+
+static uint32_t read_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Get the data of a tile from its bundle.
+ *
+ * The surveys can set the non standard 'hips_bundle_order' property, in
+ * which case all the tiles up to this order are also available in a
+ * single file per order zero pixel, 'Bundle/Npix<pix>.bundle'.  This saves
+ * a lot of requests for the surveys with many small low order tiles, like
+ * the stars (see tools/make-hips-bundles.py).
+ *
+ * The format, with all the values as little endian uint32:
+ *   'HBDL', version (1), number of tiles,
+ *   for each tile: order, pix, offset in the file, size,
+ *   the tiles data.
+ * The tiles that don't exist are not in the index.
+ *
+ * The bundle data stays in the assets until the survey is deleted, so
+ * that it's cheap to reload a tile evicted from the cache.
+ *
+ * Return false if the tile is not bundled, otherwise the same as
+ * asset_get_data2, with the bundle url put into url.
+ */
+static bool bundle_get_tile(hips_t *hips, int order, int pix, int flags,
+                            char *url, int url_size,
+                            const void **data, int *size, int *code)
+{
+    int bpix = pix >> (2 * order);
+    int bsize, nb, i;
+    const uint8_t *bundle, *entry;
+
+    if (order > hips->bundle_order) return false;
+    if (hips->bundles.missing & (1 << bpix)) return false;
+    get_url_for(hips, url, url_size, "Bundle/Npix%d.bundle", bpix);
+    if (!(hips->bundles.loaded & (1 << bpix)) &&
+            (flags & HIPS_LOAD_IN_THREAD) && url_is_remote(url)) {
+        bundle = fetch_get_data(url, ASSET_ACCEPT_404, 0, 0.0, &bsize, code);
+    } else {
+        bundle = asset_get_data2(url, ASSET_ACCEPT_404, &bsize, code);
+    }
+    *data = NULL;
+    *size = 0;
+    if (!(*code)) return true;
+    if (bundle && (bsize < 12 || memcmp(bundle, "HBDL", 4) != 0 ||
+                   read_u32(bundle + 4) != 1 ||
+                   12 + read_u32(bundle + 8) * 16 > bsize)) {
+        LOG_W("Invalid tiles bundle %s", url);
+        bundle = NULL;
+    }
+    if (!bundle) {
+        hips->bundles.missing |= 1 << bpix;
+        asset_release(url);
+        return false;
+    }
+    hips->bundles.loaded |= 1 << bpix;
+
+    nb = read_u32(bundle + 8);
+    for (i = 0; i < nb; i++) {
+        entry = bundle + 12 + i * 16;
+        if (read_u32(entry) != order || read_u32(entry + 4) != pix)
+            continue;
+        if (read_u32(entry + 8) + read_u32(entry + 12) > bsize) break;
+        *data = bundle + read_u32(entry + 8);
+        *size = read_u32(entry + 12);
+        *code = 200;
+        return true;
+    }
+    *code = 404;
+    return true;
+}
+
+static int fetch_cmp(const void *a, const void *b)
+{
+    const fetch_t *f1 = *(const fetch_t**)a;
+    const fetch_t *f2 = *(const fetch_t**)b;
+    return cmp(f1->priority, f2->priority);
+}
+
+/*
+ * Function: hips_update_fetch_queue
+ * Start the pending tile requests in order of priority.
+ *
+ * Tiles that have not been requested for the last few frames are removed
+ * from the queue, and their requests aborted if they were already started.
+ */
+void hips_update_fetch_queue(void)
+{
+    fetch_t *fetch, *tmp, **pending;
+    int nb_active = 0, nb_pending = 0, i, size, code, flags;
+    double dist;
+
+    HASH_ITER(hh, g_fetch.fetches, fetch, tmp) {
+        if (g_fetch.frame - fetch->frame > FETCH_MAX_IDLE_FRAMES) {
+            if (fetch->started) asset_release(fetch->url);
+            HASH_DEL(g_fetch.fetches, fetch);
+            free(fetch->url);
+            free(fetch);
+            continue;
+        }
+        if (fetch->started) nb_active++;
+        else nb_pending++;
+    }
+    g_fetch.frame++;
+    trace_counter("hips", "fetch_pending", nb_pending);
+    if (!nb_pending || nb_active >= FETCH_MAX_ACTIVE) return;
+
+    pending = malloc(nb_pending * sizeof(*pending));
+    i = 0;
+    HASH_ITER(hh, g_fetch.fetches, fetch, tmp) {
+        if (!fetch->started) pending[i++] = fetch;
+    }
+    qsort(pending, nb_pending, sizeof(*pending), fetch_cmp);
+    for (i = 0; i < nb_pending && nb_active < FETCH_MAX_ACTIVE; i++) {
+        fetch = pending[i];
+        fetch->started = true;
+        // Hint the browser about the tiles at the center of the view, and
+        // the ones that are probably out of the screen (the priority is
+        // the order plus the distance to the center in fov unit).
+        flags = fetch->asset_flags;
+        dist = fetch->priority - fetch->order;
+        if (dist < 0.25) flags |= ASSET_PRIORITY_HIGH;
+        if (dist > 0.75) flags |= ASSET_PRIORITY_LOW;
+        asset_get_data2(fetch->url, flags, &size, &code);
+        nb_active++;
+    }
+    free(pending);
+}
+
+// Pass the decoded image of a newly loaded tile to the on_image callback.
+static void tile_on_loaded(hips_t *hips, tile_t *tile)
+{
+    const img_tile_t *img = tile->data;
+    if (!hips->settings.on_image || !img) return;
+    if (hips->settings.create_tile != create_img_tile || !img->img) return;
+    hips->settings.on_image(hips->settings.user, tile->pos.order,
+                            tile->pos.pix, img->img, img->w, img->h,
+                            img->bpp);
+}
+
+// Update the cost of a tile in the cache.
+static void set_tile_cost(tile_t *tile, const tile_key_t *key, int cost)
+{
+    tile->hips->stats.bytes += cost - tile->cost;
+    tile->cost = cost;
+    cache_set_cost(tile->hips->cache, key, sizeof(*key), cost);
+}
+
 static tile_t *hips_get_tile_(hips_t *hips, int order, int pix, int flags,
                               int *code)
 {
@@ -665,19 +1970,24 @@ static tile_t *hips_get_tile_(hips_t *hips, int order, int pix, int flags,
     char url[URL_MAX_SIZE];
     tile_t *tile, *parent;
     tile_key_t key = {hips->hash, order, pix};
+    bool bundled;
 
     assert(order >= 0);
     *code = 0;
 
-    if (!g_cache) g_cache = cache_create(CACHE_SIZE, 1);
-    tile = cache_get(g_cache, &key, sizeof(key));
+    tile = cache_get(hips->cache, &key, sizeof(key));
 
     // Got a tile but it is still loading.
     if (tile && tile->loader) {
-        if (!worker_iter(&tile->loader->worker)) return NULL;
-        cache_set_cost(g_cache, &key, sizeof(key), tile->loader->cost);
+        if (!worker_iter(&tile->loader->worker)) {
+            core_request_redraw();
+            return NULL;
+        }
+        set_tile_cost(tile, &key, tile->loader->cost);
         free(tile->loader);
         tile->loader = NULL;
+        resolved_tiles_invalidate();
+        tile_on_loaded(tile->hips, tile);
     }
     if (tile) {
         *code = 200;
@@ -691,6 +2001,11 @@ static tile_t *hips_get_tile_(hips_t *hips, int order, int pix, int flags,
         *code = 404;
         return NULL;
     }
+    // Nor for the tiles outside of the survey coverage.
+    if (!hips_is_covered(hips, order, pix)) {
+        *code = 404;
+        return NULL;
+    }
 
     // Skip if we already know that this tile doesn't exists.
     if (order > hips->order_min) {
@@ -704,13 +2019,51 @@ static tile_t *hips_get_tile_(hips_t *hips, int order, int pix, int flags,
             return NULL;
         }
     }
-    get_url_for(hips, url, sizeof(url), "Norder%d/Dir%d/Npix%d.%s",
-                order, (pix / 10000) * 10000, pix, hips->ext);
-    asset_flags = ASSET_ACCEPT_404;
-    if (order > 0 && !(flags & HIPS_NO_DELAY))
-        asset_flags |= ASSET_DELAY;
-    data = asset_get_data2(url, asset_flags, &size, code);
-    if (!(*code)) return NULL; // Still loading the file.
+
+    // Try the decoded tiles cache first, before getting the source data.
+    if (    hips->settings.load_decoded_tile &&
+            hips_get_decoded_path(hips, order, pix, url, sizeof(url))) {
+        data = hips->settings.load_decoded_tile(
+                hips->settings.user, order, pix, url, &cost, &transparency);
+        if (data) {
+            tile = calloc(1, sizeof(*tile));
+            tile->pos.order = order;
+            tile->pos.pix = pix;
+            tile->hips = hips;
+            tile->data = (void*)data;
+            tile->cost = sizeof(*tile) + cost;
+            tile->flags |= (transparency * TILE_NO_CHILD_0);
+            hips_retain(hips);
+            hips->stats.bytes += tile->cost;
+            cache_add(hips->cache, &key, sizeof(key), tile, tile->cost,
+                      del_tile);
+            resolved_tiles_invalidate();
+            *code = 200;
+            return tile;
+        }
+    }
+    bundled = bundle_get_tile(hips, order, pix, flags, url, sizeof(url),
+                              &data, &size, code);
+    if (!bundled) {
+        get_url_for(hips, url, sizeof(url), "Norder%d/Dir%d/Npix%d.%s",
+                    order, (pix / 10000) * 10000, pix, hips->ext);
+        asset_flags = ASSET_ACCEPT_404;
+        if (order > 0 && !(flags & HIPS_NO_DELAY))
+            asset_flags |= ASSET_DELAY;
+        // Only the tiles requested by the render loop go through the fetch
+        // scheduler.  Direct queries start the requests right away.
+        if ((flags & HIPS_LOAD_IN_THREAD) && url_is_remote(url)) {
+            data = fetch_get_data(url, asset_flags, order,
+                                  get_tile_priority(hips, order, pix),
+                                  &size, code);
+        } else {
+            data = asset_get_data2(url, asset_flags, &size, code);
+        }
+    }
+    if (!(*code)) { // Still loading the file.
+        core_request_redraw();
+        return NULL;
+    }
 
     // If the tile doesn't exists, mark it in the parent tile so that we
     // won't have to search for it again.
@@ -735,28 +2088,38 @@ static tile_t *hips_get_tile_(hips_t *hips, int order, int pix, int flags,
     tile->pos.order = order;
     tile->pos.pix = pix;
     tile->hips = hips;
-    hips->ref++;
-    cache_add(g_cache, &key, sizeof(key), tile, sizeof(*tile) + cost,
-              del_tile);
+    tile->cost = sizeof(*tile);
+    hips_retain(hips);
+    hips->stats.bytes += tile->cost;
+    cache_add(hips->cache, &key, sizeof(key), tile, tile->cost, del_tile);
 
     if (!(flags & HIPS_LOAD_IN_THREAD)) {
         tile->data = hips->settings.create_tile(
                 hips->settings.user, order, pix, data, size,
                 &cost, &transparency);
+        set_tile_cost(tile, &key, sizeof(*tile) + cost);
         tile->flags |= (transparency * TILE_NO_CHILD_0);
+        resolved_tiles_invalidate();
+        tile_on_loaded(tile->hips, tile);
         if (!tile->data) {
             LOG_W("Cannot parse tile %s", url);
             tile->flags |= TILE_LOAD_ERROR;
         }
-        asset_release(url);
+        if (!bundled) asset_release(url);
     } else {
         tile->loader = calloc(1, sizeof(*tile->loader));
         worker_init(&tile->loader->worker, load_tile_worker);
-        tile->loader->data = malloc(size);
         tile->loader->size = size;
         tile->loader->tile = tile;
-        memcpy(tile->loader->data, data, size);
-        asset_release(url);
+        // Data mapped from an archive stays valid, no need to copy it.
+        if (asset_is_mapped(url)) {
+            tile->loader->data = (void*)data;
+        } else {
+            tile->loader->data = malloc(size);
+            tile->loader->own_data = true;
+            memcpy(tile->loader->data, data, size);
+        }
+        if (!bundled) asset_release(url);
         *code = 0;
         return NULL;
     }
@@ -787,6 +2150,18 @@ static void *create_img_tile(
         return tile;
     }
 
+    // GPU compressed tiles are directly uploaded to the texture.  We don't
+    // know the transparency of those tiles.
+    if (is_ktx(data, size)) {
+        tile = calloc(1, sizeof(*tile));
+        tile->ktx = malloc(size);
+        memcpy(tile->ktx, data, size);
+        tile->ktx_size = size;
+        tile_keep_src(tile, data, size);
+        *cost = 2 * size;
+        return tile;
+    }
+
     img = img_read_from_mem(data, size, &w, &h, &bpp);
     if (!img) {
         LOG_W("Cannot parse img");
@@ -797,6 +2172,7 @@ static void *create_img_tile(
     tile->w = w;
     tile->h = h;
     tile->bpp = bpp;
+    tile_keep_src(tile, data, size);
     // Compute transparency.
     for (i = 0; i < 4; i++) {
         if (img_is_transparent(img, w, h, bpp,
@@ -804,7 +2180,7 @@ static void *create_img_tile(
                 *transparency |= 1 << i;
         }
     }
-    *cost = w * h * bpp;
+    *cost = w * h * bpp + size;
     return tile;
 }
 
@@ -812,6 +2188,9 @@ static int delete_img_tile(void *tile_)
 {
     img_tile_t *tile = tile_;
     texture_release(tile->tex);
+    img_pool_release(tile->img, tile->w * tile->h * tile->bpp);
+    free(tile->ktx);
+    free(tile->src);
     free(tile);
     return 0;
 }
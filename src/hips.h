@@ -43,7 +43,15 @@ enum {
  *                 can be anything.  This is called every time the survey
  *                 load a tile that is not in the cache.  See note [1]
  *   delete_tile - function used to delete the data returned by create_tile.
- *   user        - pointer passed to create_tile.
+ *   user        - pointer passed to create_tile.  The tiles are shared
+ *                 by all the surveys with the same url and settings, so
+ *                 they should not depend on it.
+ *   cache       - name of the global cache used to store the tiles
+ *                 (see <hips_set_cache_size>).  Default to "images".
+ *   load_decoded_tile - optional function used to create a tile from a
+ *                 file of the decoded tiles cache, before we even try to
+ *                 get the source data.  Same returned values as
+ *                 create_tile.  See <hips_get_decoded_path>.
  *
  * Note 1:
  *   The create_tile function needs to return a cost value (in bytes) for the
@@ -54,10 +62,39 @@ typedef struct hips_settings {
     void *(*create_tile)(void *user, int order, int pix, const void *data,
                                int size, int *cost, int *transparency);
     int (*delete_tile)(void *tile);
+    // Optional, only for the default images tiles: called on the main
+    // thread with the decoded image of each tile once it is loaded.
+    void (*on_image)(void *user, int order, int pix, const uint8_t *img,
+                     int w, int h, int bpp);
     const char *ext; // If set, force the files extension.
     void *user;
+    const char *cache;
+    void *(*load_decoded_tile)(void *user, int order, int pix,
+                               const char *path, int *cost,
+                               int *transparency);
 } hips_settings_t;
 
+/*
+ * Type: hips_stats_t
+ * Tiles visit counters of a survey for one frame.
+ *
+ * Attributes:
+ *   visited      - Number of tiles tested during the traversal.
+ *   clipped      - Number of tiles skipped because outside of the view.
+ *   rendered     - Number of tiles actually rendered.
+ *   missing      - Number of tiles we wanted to render but that are not
+ *                  loaded yet.
+ *   render_order - Render order used in the frame, or -1 if unknown.
+ *   bytes        - Total cost of the survey tiles resident in the cache.
+ */
+typedef struct hips_stats {
+    int         visited;
+    int         clipped;
+    int         rendered;
+    int         missing;
+    int         render_order;
+    int64_t     bytes;
+} hips_stats_t;
 
 struct hips {
     char        *url;
@@ -70,14 +107,14 @@ struct hips {
     uint32_t    hash; // Hash of the url.
 
     // Stores the allsky image if available.
-    // We only do it for order zero allsky.
+    // We only do it for surveys with a min order up to 3.
     struct {
         worker_t    worker; // Worker to load the image in a thread.
         bool        not_available;
         uint8_t     *src_data; // Encoded image data (png, webp...)
         uint8_t     *data;     // RGB[A] image data.
         int         w, h, bpp, size;
-        texture_t   *textures[12];
+        texture_t   **textures; // One per pixel of the min order.
     }           allsky;
 
     // Contains all the properties as a json object.
@@ -85,10 +122,35 @@ struct hips {
     int order;
     int order_min;
     int tile_width;
+    int bundle_order; // Max order of the bundled tiles, or -1.
+
+    // Bit fields of the bundles (one per order zero pixel).
+    struct {
+        uint16_t    loaded;
+        uint16_t    missing; // Use the tiles files instead.
+    } bundles;
+
+    // Coverage of the survey from its MOC file, as one bit field per
+    // order up to HIPS_MOC_MAX_ORDER.  NULL if we don't have a MOC, in
+    // which case we consider that all the tiles can exist.
+    struct {
+        bool        loaded;
+        uint64_t    *bits;
+    } moc;
 
     // The settings as passed in the create function.
     hips_settings_t settings;
+    cache_t *cache; // Global cache the tiles are stored in.
     int ref; // Ref counting of hips survey.
+
+    // Tiles stats of the current and last frames.  Use <hips_frame_stats>
+    // to update them.
+    struct {
+        hips_stats_t    current;
+        hips_stats_t    last;
+        int             frame;
+        int64_t         bytes;
+    } stats;
 };
 
 
@@ -96,6 +158,9 @@ struct hips {
  * Function: hips_create
  * Create a new hips survey.
  *
+ * All the surveys created with the same url and tile settings share their
+ * tiles, so that a tile is only decoded and uploaded to the GPU once.
+ *
  * Parameters:
  *   url          - URL to the root of the survey.
  *   release_date - If known, release date in utc.  Otherwise 0.
@@ -109,6 +174,15 @@ hips_t *hips_create(const char *url, double release_date,
  */
 void hips_delete(hips_t *hips);
 
+/*
+ * Function: hips_is_covered
+ * Check if a tile of a survey is covered by the survey MOC.
+ *
+ * Return false only if we know for sure that neither the tile nor any of
+ * its descendants exist, so that we don't have to request them.
+ */
+bool hips_is_covered(const hips_t *hips, int order, int pix);
+
 /*
  * Function: hips_get_tile
  * Get a given tile of a hips survey.
@@ -136,13 +210,42 @@ void *hips_get_tile(hips_t *hips, int order, int pix, int flags, int *code);
  *
  * The return true if:
  * - the property file has been parsed.
- * - the allsky image has been loaded (if there is one).
+ * - the order zero allsky image has been loaded (if there is one).
+ *
+ * The allsky images of higher orders are loaded in the background, and
+ * used as a preview of the tiles once they are ready.
  */
 bool hips_is_ready(hips_t *hips);
 
 // Same as hips_is_ready.
 bool hips_update(hips_t *hips);
 
+/*
+ * Function: hips_prefetch
+ * Start to load the survey properties file right away.
+ *
+ * Normally a survey only requests its properties the first time it gets
+ * rendered, and so cannot request any tile before a full round trip.  The
+ * modules call this when a survey is added, so that all the properties
+ * files of the startup surveys are requested in parallel.
+ */
+void hips_prefetch(hips_t *hips);
+
+/*
+ * Function: hips_prefetch_view
+ * Prefetch the sky surveys tiles of an upcoming view.
+ *
+ * The tiles are requested with the ones of the navigation animation target
+ * the next time each survey gets rendered.  The view is forgotten after one
+ * frame, so the callers should register it again at each update as long as
+ * they expect to move there.
+ *
+ * Parameters:
+ *   dir    - View direction in ICRF.
+ *   fov    - Expected fov of the view (rad).
+ */
+void hips_prefetch_view(const double dir[3], double fov);
+
 /*
  * Function: hips_traverse
  * Breadth first traversal of healpix grid.
@@ -186,6 +289,7 @@ typedef struct hips_iterator
     struct {
         int order;
         int pix;
+        uint32_t flags; // User flags, see <hips_iter_push_children2>.
     } queue[1024]; // Todo: make it dynamic?
     int size;
     int start;
@@ -214,6 +318,26 @@ bool hips_iter_next(hips_iterator_t *iter, int *order, int *pix);
  */
 void hips_iter_push_children(hips_iterator_t *iter, int order, int pix);
 
+/*
+ * Function: hips_iter_next2
+ * Same as <hips_iter_next>, but also return the pixel user flags.
+ *
+ * The initial pixels have the flags set to zero.
+ */
+bool hips_iter_next2(hips_iterator_t *iter, int *order, int *pix,
+                     uint32_t *flags);
+
+/*
+ * Function: hips_iter_push_children2
+ * Same as <hips_iter_push_children>, but set some user flags to the
+ * children.
+ *
+ * This can be used to share a single traversal between several surveys,
+ * with the flags telling which ones we still need to go deeper into.
+ */
+void hips_iter_push_children2(hips_iterator_t *iter, int order, int pix,
+                              uint32_t flags);
+
 /*
  * Function: hips_get_tile_texture
  * Get the texture for a given hips tile.
@@ -306,6 +430,225 @@ int hips_get_render_order_planet(const hips_t *hips, const painter_t *painter,
 int hips_render(hips_t *hips, const painter_t *painter,
                 const double transf[4][4], int split_order);
 
+/*
+ * Type: hips_layer_t
+ * A sky survey to render with <hips_render_composite>.
+ *
+ * Attributes:
+ *   hips        - The survey.
+ *   painter     - The painter used to render it.
+ *   split_order - Same as for <hips_render>.
+ */
+typedef struct hips_layer {
+    hips_t      *hips;
+    painter_t   painter;
+    int         split_order;
+} hips_layer_t;
+
+/*
+ * Function: hips_render_composite
+ * Render two sky surveys on top of each other in a single pass.
+ *
+ * This gives the same result as calling <hips_render> for the base and
+ * then for the top survey, but the areas covered by both surveys are only
+ * rendered once, the top texture being composited in the shader.  The
+ * quads are rendered at the highest render order of the two surveys, with
+ * the other survey texture taken from its parent tile.
+ *
+ * If the surveys don't use the same frame we just render them one after
+ * the other.
+ */
+int hips_render_composite(const hips_layer_t *base, const hips_layer_t *top);
+
+/*
+ * Function: hips_frame_stats
+ * Return the tiles visit counters of the current frame.
+ *
+ * The surveys rendered with <hips_render> update the counters already,
+ * the modules that do their own traversal should update them too.
+ */
+hips_stats_t *hips_frame_stats(hips_t *hips);
+
+/*
+ * Function: hips_get_stats
+ * Get the tiles visit counters of the last rendered frame.
+ *
+ * All the counters are zero if the survey was not rendered in the last
+ * frame.  The bytes attribute is always the current resident size.
+ */
+void hips_get_stats(const hips_t *hips, hips_stats_t *stats);
+
+/*
+ * Function: hips_get_memory
+ * Add the resident memory of a survey tiles and allsky image, in bytes.
+ *
+ * The images tiles are counted as GPU memory, since we release their
+ * pixels once they are uploaded into a texture.
+ */
+void hips_get_memory(const hips_t *hips, int64_t *cpu, int64_t *gpu);
+
+/*
+ * Function: hips_get_stats_json
+ * Same as <hips_get_stats>, but return a new json object.
+ */
+json_value *hips_get_stats_json(const hips_t *hips);
+
+/*
+ * Function: hips_set_cache_size
+ * Set the max size of one of the global tiles caches.
+ *
+ * The tiles are stored in different caches depending on the survey kind,
+ * so that one heavy survey won't evict the tiles of the others.
+ *
+ * Parameters:
+ *   name   - Name of the cache ("images", "stars", "dsos" or "geojson").
+ *   size   - New max size in bytes.
+ *
+ * Return:
+ *   0 on success, -1 if the cache doesn't exist.
+ */
+int hips_set_cache_size(const char *name, int size);
+
+/*
+ * Function: hips_trim_cache
+ * Evict the least recently used tiles of one of the global tiles caches.
+ *
+ * The tiles used during the last second (so those currently rendered) are
+ * never evicted, and the cache max size is not changed.
+ *
+ * Parameters:
+ *   name   - Name of the cache ("images", "stars", "dsos" or "geojson").
+ *   size   - Size in bytes to reach.
+ *
+ * Return:
+ *   The size in bytes of the evicted tiles.
+ */
+int hips_trim_cache(const char *name, int size);
+
+/*
+ * Function: hips_list_caches
+ * Iter the usage stats of all the global tiles caches.
+ */
+void hips_list_caches(void *user,
+                      void (*f)(void *user, const char *name,
+                                const cache_stats_t *stats));
+
+/*
+ * Function: hips_set_decoded_cache_dir
+ * Enable the on-disk cache of the decoded tiles.
+ *
+ * Some custom surveys (stars, DSOs) spend more time decoding their tiles
+ * than getting them.  With this cache they can save the decoded data of
+ * their tiles in files that are memory mapped back directly the next time
+ * (see <hips_save_decoded_tile> and <hips_map_decoded_tile>).  Only
+ * supported on the platforms with mmap.
+ *
+ * Parameters:
+ *   dir    - Directory of the cache, or NULL to disable it.
+ */
+void hips_set_decoded_cache_dir(const char *dir);
+
+/*
+ * Function: hips_get_decoded_path
+ * Get the path of a tile file in the decoded tiles cache.
+ *
+ * The path contains the survey release date, so that the new releases
+ * don't use the old files.
+ *
+ * Return:
+ *   false if the cache is disabled, or if the survey doesn't have a
+ *   release date.
+ */
+bool hips_get_decoded_path(const hips_t *hips, int order, int pix,
+                           char *buf, int size);
+
+/*
+ * Function: hips_save_decoded_tile
+ * Save the decoded data of a tile into the decoded tiles cache.
+ *
+ * The file contains a small header followed by the blocks, each padded
+ * to 8 bytes, so that the arrays are still aligned after mapping.  Can be
+ * called from a worker thread.  On the main thread the blocks are copied
+ * and the file is written later in the worker pool (see
+ * <hips_update_decoded_saves>).
+ *
+ * Parameters:
+ *   path       - Path from <hips_get_decoded_path>.
+ *   version    - Version of the data layout, checked when we map it back.
+ *   nb         - Number of blocks.
+ *   blocks     - Data of the blocks.
+ *   sizes      - Size of the blocks in bytes.
+ *
+ * Return:
+ *   0 on success, -1 in case of error.  Always 0 when the file is written
+ *   in a worker.
+ */
+int hips_save_decoded_tile(const char *path, uint32_t version, int nb,
+                           const void *const *blocks, const int *sizes);
+
+/*
+ * Function: hips_update_decoded_saves
+ * Release the decoded tile files that have been written.
+ *
+ * Should be called once per frame on the main thread.
+ *
+ * Parameters:
+ *   wait   - If set, wait for all the pending files to be written.
+ */
+void hips_update_decoded_saves(bool wait);
+
+/*
+ * Function: hips_map_decoded_tile
+ * Map a file of the decoded tiles cache in memory.
+ *
+ * The mapping is private and writable: the modules can modify the data in
+ * place without affecting the file.
+ *
+ * Parameters:
+ *   path       - Path from <hips_get_decoded_path>.
+ *   version    - Expected version of the data layout.
+ *   size       - Get the size of the data.
+ *
+ * Return:
+ *   The data after the file header, or NULL if the file doesn't exist or
+ *   has a different version.  Release it with <hips_unmap_decoded_tile>.
+ */
+void *hips_map_decoded_tile(const char *path, uint32_t version, int *size);
+
+/*
+ * Function: hips_unmap_decoded_tile
+ * Release the data returned by <hips_map_decoded_tile>.
+ */
+void hips_unmap_decoded_tile(void *data, int size);
+
+/*
+ * Function: hips_update_fetch_queue
+ * Start the pending tile requests in order of priority.
+ *
+ * The tiles requested by the render loop (with the HIPS_LOAD_IN_THREAD
+ * flag) are not fetched immediately, but added to a global queue sorted by
+ * order and distance to the center of the view.  This should be called
+ * once per frame to start the requests of the highest priority tiles, and
+ * abort the requests of tiles that are not used anymore.
+ */
+void hips_update_fetch_queue(void);
+
+/*
+ * Function: hips_apply_textures_budget
+ * Limit the images tiles cache so that all the textures fit in a budget.
+ *
+ * The images tiles are the only textures we can release at any time.  So
+ * if the total textures memory gets over the budget, we lower the images
+ * cache max size (never above the size set with <hips_set_cache_size>), and
+ * the least recently rendered tiles get evicted.  Should be called once per
+ * frame.
+ *
+ * Parameters:
+ *   budget - Max GPU memory for all the textures in bytes, or 0 for no
+ *            limit.
+ */
+void hips_apply_textures_budget(int64_t budget);
+
 /*
  * Function: hips_parse_date
  * Parse a date in the format supported for HiPS property files
@@ -10,11 +10,47 @@
 Module.afterInit(function() {
   if (!Module.canvas) return;
 
+  // When running in a worker we render into an OffscreenCanvas: there is
+  // no DOM, the canvas size and the inputs are forwarded by the page (see
+  // worker.js).
+  var offscreen = typeof OffscreenCanvas !== 'undefined' &&
+                  Module.canvas instanceof OffscreenCanvas;
+  var requestFrame = (typeof requestAnimationFrame !== 'undefined') ?
+      requestAnimationFrame :
+      function(f) { return setTimeout(function() { f(Date.now()) }, 16) };
+
+  // Set while the WebGL context is lost.  We don't render until the
+  // browser restores it, and then rebuild the GPU state from the CPU side
+  // data instead of reloading everything (see core_on_gl_context_restored).
+  var contextLost = false;
+  Module.canvas.addEventListener('webglcontextlost', function(e) {
+    // Needed so that the browser tries to restore the context.
+    e.preventDefault();
+    contextLost = true;
+  }, false);
+  Module.canvas.addEventListener('webglcontextrestored', function(e) {
+    contextLost = false;
+    Module._core_on_gl_context_restored();
+  }, false);
+
   // XXX: remove this I guess.
   var mouseDown = false;
   var mouseButtons = 0;
   var mousePos;
 
+  // Return the canvas size in CSS pixels and the device pixel ratio.
+  var getDisplaySize = function() {
+    if (offscreen) {
+      return Module.canvasSize ||
+             {width: Module.canvas.width, height: Module.canvas.height,
+              dpr: 1};
+    }
+    var rect = Module.canvas.getBoundingClientRect();
+    // Get the device pixel ratio, falling back to 1.
+    return {width: rect.width, height: rect.height,
+            dpr: window.devicePixelRatio || 1};
+  }
+
   // Function called at each frame
   var render = function(timestamp) {
 
@@ -23,17 +59,13 @@ Module.afterInit(function() {
 
     // Check for canvas resize
     var canvas = Module.canvas;
-
-    // Get the device pixel ratio, falling back to 1.
-    var dpr = window.devicePixelRatio || 1;
-
-    // Get the size of the canvas in CSS pixels.
-    var rect = canvas.getBoundingClientRect();
-
-    var displayWidth  = rect.width;
-    var displayHeight = rect.height;
-    var sizeChanged = (canvas.width  !== displayWidth) ||
-                      (canvas.height !== displayHeight);
+    var size = getDisplaySize();
+    var dpr = size.dpr;
+    var displayWidth  = size.width;
+    var displayHeight = size.height;
+    // Note: setting the canvas size clears it, so only do it if needed.
+    var sizeChanged = (canvas.width  !== Math.floor(displayWidth * dpr)) ||
+                      (canvas.height !== Math.floor(displayHeight * dpr));
 
     if (sizeChanged) {
       canvas.width = displayWidth * dpr;
@@ -43,9 +75,57 @@ Module.afterInit(function() {
     // TODO: manage paning and flicking here
 
     Module._core_update();
-    Module._core_render(displayWidth, displayHeight, dpr);
+    // Skip the rendering if the frame would be the same as the last one,
+    // unless the client asked for continuous rendering (e.g. to measure
+    // the rendering performances).
+    if (!contextLost && (sizeChanged || Module.continuousRendering ||
+                         Module._core_needs_render()))
+      Module._core_render(displayWidth, displayHeight, dpr);
+
+    if (Module.onFrameEnd) Module.onFrameEnd();
+    requestFrame(render)
+  }
 
-    window.requestAnimationFrame(render)
+  /*
+   * Function: canvasInput
+   * Process an input event, with positions in canvas CSS pixels.
+   *
+   * This is what the DOM events handlers below call, and what the worker
+   * mode uses to forward the page events.  The event is a plain object
+   * with a type attribute:
+   *   mousedown  - x, y, buttons
+   *   mousemove  - x, y
+   *   mouseup    - x, y
+   *   mouseleave
+   *   touch      - id, state (1: start, -1: move, 0: end), x, y
+   *   wheel      - delta, x, y
+   */
+  Module['canvasInput'] = function(e) {
+    switch (e.type) {
+    case 'mousedown':
+      mouseDown = true;
+      mousePos = {x: e.x, y: e.y};
+      mouseButtons = e.buttons;
+      break;
+    case 'mousemove':
+      mousePos = {x: e.x, y: e.y};
+      break;
+    case 'mouseup':
+      mouseDown = false;
+      mousePos = {x: e.x, y: e.y};
+      Module._core_on_mouse(0, 0, mousePos.x, mousePos.y, mouseButtons);
+      break;
+    case 'mouseleave':
+      mouseDown = false;
+      break;
+    case 'touch':
+      Module._core_on_mouse(e.id, e.state, e.x, e.y, 1);
+      break;
+    case 'wheel':
+      var zoom_factor = 1.05;
+      Module._core_on_zoom(Math.pow(zoom_factor, e.delta * 2), e.x, e.y);
+      break;
+    }
   }
 
   var fixPageXY = function(e) {
@@ -61,6 +141,7 @@ Module.afterInit(function() {
 
   var setupMouse = function() {
     var canvas = Module.canvas;
+    var input = Module.canvasInput;
     function getMousePos(evt) {
       var rect = canvas.getBoundingClientRect();
       return {
@@ -73,55 +154,45 @@ Module.afterInit(function() {
       var that = this;
       e = e || event;
       fixPageXY(e);
-      mouseDown = true;
-      mousePos = getMousePos(e);
-      mouseButtons = e.buttons;
+      var pos = getMousePos(e);
+      input({type: 'mousedown', x: pos.x, y: pos.y, buttons: e.buttons});
 
       document.onmouseup = function(e) {
         e = e || event;
         fixPageXY(e);
-        mouseDown = false;
-        mousePos = getMousePos(e);
-        Module._core_on_mouse(0, 0, mousePos.x, mousePos.y, mouseButtons);
+        var pos = getMousePos(e);
+        input({type: 'mouseup', x: pos.x, y: pos.y});
       };
       document.onmouseleave = function(e) {
-        mouseDown = false;
+        input({type: 'mouseleave'});
       };
 
       document.onmousemove = function(e) {
         e = e || event;
         fixPageXY(e);
-        mousePos = getMousePos(e);
+        var pos = getMousePos(e);
+        input({type: 'mousemove', x: pos.x, y: pos.y});
       }
     });
 
-    canvas.addEventListener('touchstart', function(e) {
+    var onTouch = function(e, state) {
       var rect = canvas.getBoundingClientRect();
       for (var i = 0; i < e.changedTouches.length; i++) {
-        var id = e.changedTouches[i].identifier;
-        var relX = e.changedTouches[i].pageX - rect.left;
-        var relY = e.changedTouches[i].pageY - rect.top;
-        Module._core_on_mouse(id, 1, relX, relY, 1);
+        input({type: 'touch', id: e.changedTouches[i].identifier,
+               state: state,
+               x: e.changedTouches[i].pageX - rect.left,
+               y: e.changedTouches[i].pageY - rect.top});
       }
+    }
+    canvas.addEventListener('touchstart', function(e) {
+      onTouch(e, 1);
     }, {passive: true});
     canvas.addEventListener('touchmove', function(e) {
       e.preventDefault();
-      var rect = canvas.getBoundingClientRect();
-      for (var i = 0; i < e.changedTouches.length; i++) {
-        var id = e.changedTouches[i].identifier;
-        var relX = e.changedTouches[i].pageX - rect.left;
-        var relY = e.changedTouches[i].pageY - rect.top;
-        Module._core_on_mouse(id, -1, relX, relY, 1);
-      }
+      onTouch(e, -1);
     }, {passive: false});
     canvas.addEventListener('touchend', function(e) {
-      var rect = canvas.getBoundingClientRect();
-      for (var i = 0; i < e.changedTouches.length; i++) {
-        var id = e.changedTouches[i].identifier;
-        var relX = e.changedTouches[i].pageX - rect.left;
-        var relY = e.changedTouches[i].pageY - rect.top;
-        Module._core_on_mouse(id, 0, relX, relY, 1);
-      }
+      onTouch(e, 0);
     });
 
     function getMouseWheelDelta(event) {
@@ -143,9 +214,8 @@ Module.afterInit(function() {
       e.preventDefault();
       fixPageXY(e);
       var pos = getMousePos(e);
-      var zoom_factor = 1.05;
-      var delta = getMouseWheelDelta(e) * 2;
-      Module._core_on_zoom(Math.pow(zoom_factor, delta), pos.x, pos.y);
+      input({type: 'wheel', delta: getMouseWheelDelta(e),
+             x: pos.x, y: pos.y});
       return false;
     };
     canvas.addEventListener('mousewheel', onWheelEvent, {passive: false});
@@ -158,8 +228,8 @@ Module.afterInit(function() {
 
   };
 
-  setupMouse();
+  if (!offscreen) setupMouse();
 
   // Kickoff rendering at max FPS, normally 60 FPS on a browser.
-  window.requestAnimationFrame(render)
+  requestFrame(render)
 })
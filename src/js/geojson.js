@@ -10,6 +10,7 @@
 
 // Some special methods for geojson objects.
 //  setData   - fast way to set the geojson data.
+//  setBinaryData - set pre-triangulated data from an eph file.
 //  filterAll - filter and change the properties of the geojson features.
 
 function fillColorPtr(color, ptr) {
@@ -57,6 +58,29 @@ function setData(obj, data) {
   }
 }
 
+/*
+ * Method: setBinaryData
+ * Set the features of a geojson object from an eph file.
+ *
+ * The file contains the already triangulated features, as generated by
+ * tools/make-geojson-eph.py, so that we don't have to parse any json.
+ * The features are indexed in the file order for the filter function.
+ *
+ * Parameters:
+ *   data - ArrayBuffer or Uint8Array with the file content.
+ *
+ * Return:
+ *   The number of features loaded, or -1 in case of error.
+ */
+function setBinaryData(obj, data) {
+  data = new Uint8Array(data);
+  const ptr = Module._malloc(data.length);
+  Module.writeArrayToMemory(data, ptr);
+  const ret = Module._geojson_load_eph(obj.v, ptr, data.length);
+  Module._free(ptr);
+  return ret;
+}
+
 /*
  * Method: filterAll
  * Deprecated.
@@ -142,6 +166,7 @@ Module['onGeojsonObj'] = function(obj) {
   });
 
   obj.setData = function(data) { setData(obj, data); }
+  obj.setBinaryData = function(data) { return setBinaryData(obj, data); }
   obj.filterAll = function(callback) { filterAll(obj, callback); }
   obj.queryRenderedFeatureIds = function(point) {
     return queryRenderedFeatureIds(obj, point);
@@ -0,0 +1,81 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Memory pressure handling.
+ *
+ * Some browsers (iOS Safari) kill the page once the wasm heap gets too
+ * large.  The heap never shrinks, so the best we can do is to release the
+ * data we can reload later, so that the engine reuses that memory instead
+ * of growing the heap.  See core_release_memory for the released tiers.
+ *
+ * Set Module.memoryBudget to a size in bytes to enable a watchdog that
+ * releases the tiers one by one each time the heap grows over the budget.
+ * When the page gets hidden we also release the off-screen textures.
+ */
+
+Module['MEMORY_TIER_TEXTURES'] = 1;
+Module['MEMORY_TIER_TILES'] = 2;
+Module['MEMORY_TIER_CATALOGS'] = 3;
+Module['MEMORY_TIER_TEXT'] = 4;
+
+/*
+ * Function: releaseMemory
+ * Release the data of all the memory tiers up to a given one.
+ *
+ * Parameters:
+ *   tier - One of the MEMORY_TIER_ values, default to MEMORY_TIER_TEXT
+ *          (release everything).
+ *
+ * Return:
+ *   The size in bytes of the released data.
+ */
+Module['releaseMemory'] = function(tier) {
+  if (tier === undefined) tier = Module.MEMORY_TIER_TEXT;
+  return Module._core_release_memory(tier);
+}
+
+/*
+ * Function: getMemoryUsage
+ * Return the usage in bytes of each memory tier, the CPU and GPU memory of
+ * each module, and the wasm heap size:
+ * {textures, tiles, catalogs, text, modules: {id: {cpu, gpu}}, heap}.
+ */
+Module['getMemoryUsage'] = function() {
+  let ret = Module.core.memory;
+  ret.heap = Module.HEAPU8.length;
+  return ret;
+}
+
+Module.afterInit(function() {
+  let lastHeap = 0;
+  let tier = 0;
+
+  // Each time the heap grows over the budget, go one tier further.
+  const watchdog = function() {
+    const budget = Module.memoryBudget;
+    const heap = Module.HEAPU8.length;
+    if (!budget || heap <= budget) {
+      tier = 0;
+      return;
+    }
+    if (heap <= lastHeap) return;
+    lastHeap = heap;
+    tier = Math.min(tier + 1, Module.MEMORY_TIER_TEXT);
+    Module.releaseMemory(tier);
+  };
+  setInterval(watchdog, 1000);
+
+  if (typeof(document) !== 'undefined') {
+    document.addEventListener('visibilitychange', function() {
+      if (document.visibilityState === 'hidden')
+        Module.releaseMemory(Module.MEMORY_TIER_TEXTURES);
+    });
+  }
+});
@@ -11,12 +11,18 @@ Module.afterInit(function() {
   // Init C function wrappers.
   var obj_call_json_str = Module.cwrap('obj_call_json_str',
     'number', ['number', 'string', 'string']);
+  var obj_call_attr_json_str = Module.cwrap('obj_call_attr_json_str',
+    'number', ['number', 'number', 'string']);
   var core_search = Module.cwrap('core_search', 'number', ['string']);
+  var core_search_prefix = Module.cwrap('core_search_prefix', 'number',
+    ['string', 'number', 'number', 'number']);
   var obj_get_id = Module.cwrap('obj_get_id', 'string', ['number']);
   var module_add = Module.cwrap('module_add', null, ['number', 'number']);
   var module_remove = Module.cwrap('module_remove', null, ['number', 'number']);
   var module_get_tree = Module.cwrap('module_get_tree', 'number',
     ['number', 'number']);
+  var module_get_tree_changes = Module.cwrap('module_get_tree_changes',
+    'number', ['number', 'number', 'number']);
   var module_get_path = Module.cwrap('module_get_path', 'number',
     ['number', 'number']);
   var obj_create_str = Module.cwrap('obj_create_str', 'number',
@@ -29,8 +35,26 @@ Module.afterInit(function() {
   var obj_get_json_data_str = Module.cwrap('obj_get_json_data_str', 'number',
     ['number']);
 
-  // List of {obj, attr, callback}
-  var g_listeners = [];
+  // Map of obj pointer (0 for all objects) -> attr name ('' for all
+  // attributes) -> list of {ctx, callback}.
+  var g_listeners = new Map();
+
+  // Cache of the C attribute names, that are always static strings.
+  var g_attr_names = new Map();
+
+  function addListener(objPtr, attr, callback, ctx) {
+    let byObj = g_listeners.get(objPtr);
+    if (!byObj) {
+      byObj = new Map();
+      g_listeners.set(objPtr, byObj);
+    }
+    let list = byObj.get(attr);
+    if (!list) {
+      list = [];
+      byObj.set(attr, list);
+    }
+    list.push({'ctx': ctx, 'callback': callback});
+  }
 
   let g_ret; // Global var used to pass back C callback values.
 
@@ -65,16 +89,19 @@ Module.afterInit(function() {
       let attr = g_ret[i][0];
       let isProp = g_ret[i][1];
       let name = Module.UTF8ToString(attr);
+      // Resolve the attribute once, so that the accessors don't need to
+      // pass its name.
+      let handle = Module._obj_get_attr_(this.v, attr);
       if (!isProp) {
         that[name] = function(args) {
-          return that._call(name, args);
+          return that._callAttr(handle, args);
         };
       } else {
         Object.defineProperty(that, name, {
           configurable: true,
           enumerable: true,
-          get: function() {return that._call(name)},
-          set: function(v) {return that._call(name, v)},
+          get: function() {return that._callAttr(handle)},
+          set: function(v) {return that._callAttr(handle, v)},
         })
       }
     }
@@ -132,12 +159,7 @@ Module.afterInit(function() {
   }
 
   SweObj.prototype.change = function(attr, callback, context) {
-    g_listeners.push({
-      'obj': this.v,
-      'ctx': context ? context : this,
-      'attr': attr,
-      'callback': callback
-    });
+    addListener(this.v, attr || '', callback, context ? context : this);
   };
 
   // Add an object as a child to an object.
@@ -224,6 +246,106 @@ Module.afterInit(function() {
     return ret;
   };
 
+  /*
+   * Function: listObjsInfo
+   * Return the positions and magnitudes of the objects of a module.
+   *
+   * Much faster than calling getInfo on the objects returned by listObjs,
+   * since all the values are computed in a single call, without any json.
+   *
+   * Arguments:
+   *   obs      - An observer.  If not set use the core observer.
+   *   options  - Dict of optional values:
+   *     maxMag       - Skip the objects fainter than this magnitude.
+   *     aboveHorizon - Only list the objects above the horizon.
+   *     inView       - Only list the objects in the current view.
+   *     cone         - Only list the objects in a cone {pos, radius}, with
+   *                    pos an ICRF direction and radius in radians.
+   *     polygon      - Only list the objects in a convex polygon, given as
+   *                    an array of ICRF directions.
+   *     rect         - Only list the objects in a rectangle of the view
+   *                    [x1, y1, x2, y2], as given by the 'rectSelection'
+   *                    event.
+   *     size         - Max number of objects (default to 10000).
+   *
+   * With a region (cone, polygon or rect), the stars and dsos modules only
+   * load the tiles that intersect it.
+   *
+   * Return:
+   *   A dict with:
+   *     length - Number of objects.
+   *     ra, dec, az, alt, vmag - Float64Array of the values (radians).
+   *     objs   - Int32Array of the objects pointers.  Use getId, getObj
+   *              to get their ids or SweObj only when needed.  Call
+   *              release once done, to release all the objects.
+   */
+  SweObj.prototype.listObjsInfo = function(obs, options) {
+    obs = obs || Module.core.observer;
+    options = options || {};
+    const size = options.size || 10000;
+    const maxMag = options.maxMag === undefined ? NaN : options.maxMag;
+    const flags = (options.aboveHorizon ? 1 : 0) | (options.inView ? 2 : 0);
+    let verts = options.polygon || [];
+    let radius = 0;
+    if (options.cone) {
+      verts = [options.cone.pos];
+      radius = options.cone.radius;
+    }
+    const vertsPtr = Module._malloc(8 * 3 * Math.max(verts.length, 4));
+    if (options.rect) {
+      const r = options.rect;
+      Module._core_get_rect_corners(r[0], r[1], r[2], r[3], vertsPtr);
+      verts = [null, null, null, null];
+    } else {
+      for (let i = 0; i < verts.length; i++)
+        Module.HEAPF64.set(verts[i].slice(0, 3), vertsPtr / 8 + i * 3);
+    }
+    const objsPtr = Module._malloc(4 * size);
+    const valuesPtr = Module._malloc(8 * 5 * size);
+    const n = Module._module_list_objs_info2(this.v, obs.v, verts.length,
+                                             vertsPtr, radius, maxMag,
+                                             flags, size, objsPtr,
+                                             valuesPtr);
+    Module._free(vertsPtr);
+    let ret = {
+      length: n,
+      objs: Module.HEAP32.slice(objsPtr / 4, objsPtr / 4 + n),
+      ra: new Float64Array(n),
+      dec: new Float64Array(n),
+      az: new Float64Array(n),
+      alt: new Float64Array(n),
+      vmag: new Float64Array(n),
+    };
+    const values = Module.HEAPF64.subarray(valuesPtr / 8,
+                                           valuesPtr / 8 + 5 * n);
+    for (let i = 0; i < n; i++) {
+      ret.ra[i] = values[i * 5 + 0];
+      ret.dec[i] = values[i * 5 + 1];
+      ret.az[i] = values[i * 5 + 2];
+      ret.alt[i] = values[i * 5 + 3];
+      ret.vmag[i] = values[i * 5 + 4];
+    }
+    Module._free(objsPtr);
+    Module._free(valuesPtr);
+
+    ret.getId = function(i) {
+      const id = obj_get_id(ret.objs[i]);
+      if (id) return id;
+      g_ret = [];
+      Module._obj_get_designations(ret.objs[i], 0,
+                                   g_obj_get_designations_callback);
+      return g_ret.length ? Module.UTF8ToString(g_ret[0]) : undefined;
+    };
+    ret.getObj = function(i) {
+      return new SweObj(Module._obj_retain(ret.objs[i]));
+    };
+    ret.release = function() {
+      for (let i = 0; i < ret.length; i++) Module._obj_release(ret.objs[i]);
+      ret.length = 0;
+    };
+    return ret;
+  };
+
   // XXX: deprecated.
   SweObj.prototype.getTree = function(detailed) {
     detailed = (detailed !== undefined) ? detailed : false
@@ -234,6 +356,28 @@ Module.afterInit(function() {
     return ret
   };
 
+  /*
+   * Function: getTreeChanges
+   * Get the changes of the tree since a given revision.
+   *
+   * Arguments:
+   *   since    - Revision returned by the previous call, or undefined for
+   *              the first call.
+   *   detailed - Set to add the attributes hints to the values.
+   *
+   * Return:
+   *   Either {revision, tree} with the full tree, or {revision, changes}
+   *   with changes an array of {path, attr, value} or {path, tree}.  See
+   *   module_get_tree_changes.
+   */
+  SweObj.prototype.getTreeChanges = function(since, detailed) {
+    var cret = module_get_tree_changes(this.v,
+        since === undefined ? -1 : since, !!detailed);
+    var ret = Module.UTF8ToString(cret);
+    Module._free(cret);
+    return JSON.parse(ret);
+  };
+
   /*
    * Function: computeVisibility
    *
@@ -268,6 +412,66 @@ Module.afterInit(function() {
     return [{'rise': rise, 'set': set}];
   };
 
+  const EVENT_TYPES = {
+    conjunction: 1 << 3,
+    opposition: 1 << 4,
+    occultation: 1 << 5,
+    solarEclipse: 1 << 6,
+    lunarEclipse: 1 << 7,
+  };
+
+  /*
+   * Function: searchEvents
+   * Search all the events between this object and other objects.
+   *
+   * Arguments:
+   *   type      - 'conjunction', 'opposition' (this object must be the
+   *               Sun), 'occultation', 'solarEclipse' or 'lunarEclipse'
+   *               (for the eclipses this object must be the Moon and objs
+   *               the Sun).
+   *   objs      - Array of objects.
+   *   obs       - An observer.  If not set use current core observer.
+   *   startTime - TT MJD start time.  Default to the observer time.
+   *   endTime   - TT MJD end time.  Default to one year after startTime.
+   *   step      - Min search step (days), smaller than the events
+   *               duration.  Default to one hour.
+   *   maxSep    - Max separation of the conjunctions (rad).
+   *   maxEvents - Max number of returned events.  Default to 1024.
+   *
+   * Return:
+   *   An array of dicts sorted by time, of the form:
+   *   [{time: <TT MJD>, obj: <SweObj>, value: <value>}], where the value
+   *   is the separation for conjunctions and occultations, the elongation
+   *   for oppositions, the obscuration for solar eclipses and the umbral
+   *   magnitude for lunar eclipses.
+   */
+  SweObj.prototype.searchEvents = function(args) {
+    const obs = args.obs || Module.core.observer;
+    const startTime = args.startTime || obs.tt;
+    const endTime = args.endTime || startTime + 365.25;
+    const step = args.step || 1 / 24;
+    const maxEvents = args.maxEvents || 1024;
+    const precision = 1 / 24 / 60 / 2;
+    const objs = args.objs;
+    const objsPtr = Module._malloc(4 * objs.length);
+    const outPtr = Module._malloc(8 * 3 * maxEvents);
+    for (let i = 0; i < objs.length; i++)
+      Module.HEAP32[objsPtr / 4 + i] = objs[i].v;
+    const n = Module._search_events(obs.v, EVENT_TYPES[args.type], this.v,
+                                    objs.length, objsPtr, startTime,
+                                    endTime, step, precision,
+                                    args.maxSep || 0, maxEvents, outPtr);
+    const out = Module.HEAPF64.subarray(outPtr / 8, outPtr / 8 + 3 * n);
+    let ret = [];
+    for (let i = 0; i < n; i++) {
+      ret.push({time: out[i * 3 + 0], obj: objs[out[i * 3 + 1]],
+                value: out[i * 3 + 2]});
+    }
+    Module._free(objsPtr);
+    Module._free(outPtr);
+    return ret;
+  };
+
   // Add id property
   Object.defineProperty(SweObj.prototype, 'id', {
     get: function() {
@@ -309,7 +513,19 @@ Module.afterInit(function() {
       arg = 0
     else
       arg = JSON.stringify(arg)
-    var cret = obj_call_json_str(this.v, attr, arg)
+    return parseCallRet(obj_call_json_str(this.v, attr, arg));
+  }
+
+  // Same as _call, but with an attribute pointer returned by obj_get_attr_.
+  SweObj.prototype._callAttr = function(handle, arg) {
+    if (arg === undefined || arg === null)
+      arg = 0
+    else
+      arg = JSON.stringify(arg)
+    return parseCallRet(obj_call_attr_json_str(this.v, handle, arg));
+  }
+
+  function parseCallRet(cret) {
     var ret = Module.UTF8ToString(cret)
     Module._free(cret)
     if (!ret) return null;
@@ -344,13 +560,22 @@ Module.afterInit(function() {
     return obj ? new SweObj(obj) : null;
   };
 
+  // Return up to max designations starting with a given prefix, for
+  // autocompletion.
+  //
+  // Inputs:
+  //  prefix    String
+  //  max       Maximum number of results (default to 10)
+  Module['searchComplete'] = function(prefix, max) {
+    assert(typeof(prefix) == 'string')
+    g_ret = [];
+    core_search_prefix(prefix, max || 10, 0,
+                       g_obj_get_designations_callback);
+    return g_ret.map(function(v) {return Module.UTF8ToString(v)});
+  };
+
   Module['change'] = function(callback, context) {
-    g_listeners.push({
-      'obj': null,
-      'ctx': context ? context : null,
-      'attr': null,
-      'callback': callback
-    });
+    addListener(0, '', callback, context ? context : null);
   };
 
   Module['getTree'] = function(detailed) {
@@ -387,17 +612,39 @@ Module.afterInit(function() {
     return ret;
   }
 
-  var onObjChanged = Module.addFunction(function(objPtr, attr) {
-    attr = Module.UTF8ToString(attr);
-    for (var i = 0; i < g_listeners.length; i++) {
-      var listener = g_listeners[i];
-      if (    (listener.obj === null || listener.obj === objPtr) &&
-        (listener.attr === null || listener.attr === attr)) {
-        var obj = new SweObj(objPtr);
+  // Call all the listeners of a given attribute in a map of attr ->
+  // listeners.  Return the SweObj, only created if needed.
+  function callListeners(byObj, objPtr, attr, obj) {
+    for (const key of [attr, '']) {
+      const list = byObj.get(key);
+      if (!list) continue;
+      for (const listener of list) {
+        obj = obj || new SweObj(objPtr);
         listener.callback.apply(listener.ctx, [obj, attr]);
       }
     }
-  }, 'vii');
+    return obj;
+  }
+
+  // Called once per frame with all the (obj, attr) pairs that changed.
+  var onObjChanged = Module.addFunction(function(nb, objs, attrs) {
+    const all = g_listeners.get(0);
+    // Copy the values first, in case the callbacks grow the heap.
+    const objPtrs = Module.HEAP32.slice(objs >> 2, (objs >> 2) + nb);
+    const attrPtrs = Module.HEAP32.slice(attrs >> 2, (attrs >> 2) + nb);
+    for (let i = 0; i < nb; i++) {
+      const objPtr = objPtrs[i];
+      let attr = g_attr_names.get(attrPtrs[i]);
+      if (attr === undefined) {
+        attr = Module.UTF8ToString(attrPtrs[i]);
+        g_attr_names.set(attrPtrs[i], attr);
+      }
+      const byObj = g_listeners.get(objPtr);
+      let obj = null;
+      if (byObj) obj = callListeners(byObj, objPtr, attr, obj);
+      if (all) callListeners(all, objPtr, attr, obj);
+    }
+  }, 'viii');
   Module._module_add_global_listener(onObjChanged);
 
 
@@ -9,7 +9,8 @@
 
 // Allow to set the memory file path in 'memFile' argument.
 Module['locateFile'] = function(path) {
-  if (path === "stellarium-web-engine.wasm") return Module.wasmFile;
+  if (path === "stellarium-web-engine.wasm" ||
+      path === "stellarium-web-engine-simd.wasm") return Module.wasmFile;
   return path;
 }
 
@@ -97,6 +98,34 @@ Module['date2MJD'] = function(date) {
   return date / 86400000 - 2400000.5 + 2440587.5;
 }
 
+/*
+ * Function: traceDump
+ * Return the recorded trace events as a chrome trace JSON string.
+ *
+ * The result can be saved to a file and opened with chrome://tracing or
+ * https://ui.perfetto.dev.  The trace is empty unless the engine was
+ * compiled with trace support (the default in debug mode).
+ */
+Module['traceDump'] = function() {
+  var cret = Module._trace_dump_json();
+  var ret = Module.UTF8ToString(cret);
+  Module._free(cret);
+  return ret;
+}
+
+/*
+ * Function: requestRedraw
+ * Force the rendering of the next frames.
+ *
+ * The engine only renders a frame when something changed since the last
+ * one.  Call this if the canvas content needs to be drawn again for some
+ * other reason.  Set Module.continuousRendering to true to render all the
+ * frames instead.
+ */
+Module['requestRedraw'] = function() {
+  Module._core_request_redraw();
+}
+
 /*
  * Function: a2tf
  * Decompose radians into hours, minutes, seconds, fraction.
@@ -414,11 +443,19 @@ let onClickCallback;
 let onClickFn;
 let onRectCallback;
 let onRectFn;
+let onLateInputCallback;
+let onLateInputFn;
 /*
  * Function: on
  * Allow to listen to events on the sky map
  *
- * For the moment we only support the 'click' and 'rect' event.
+ * For the moment we only support the 'click', 'rectSelection' and
+ * 'lateInput' events.
+ * The rectangle of the 'rectSelection' event can be passed to the
+ * listObjsInfo 'rect' option to get the objects inside of it.
+ * The 'lateInput' callback is called just before the render flush: if it
+ * changes the observer yaw or pitch, the new orientation is applied to
+ * the frame being rendered.
  */
 Module['on'] = function(eventName, callback) {
   if (eventName === 'click') {
@@ -437,6 +474,15 @@ Module['on'] = function(eventName, callback) {
     onRectCallback = callback;
     Module.core.on_rect = onRectFn;
   }
+  if (eventName === 'lateInput') {
+    if (!onLateInputFn) {
+      onLateInputFn = Module.addFunction(function() {
+        onLateInputCallback();
+      }, 'v');
+    }
+    onLateInputCallback = callback;
+    Module.core.on_late_input = onLateInputFn;
+  }
 }
 
 
@@ -0,0 +1,86 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Network backend of src/utils/request_js.c, using fetch.
+ *
+ * The responses are streamed directly into a buffer allocated in the wasm
+ * heap (sized from the Content-Length header when we have it), so that we
+ * don't need the extra copies of XMLHttpRequest.  The requests can be
+ * aborted, and get the fetch priority hint set by the request code.
+ *
+ * We always add a zero padding after the data, so that the C code can use
+ * it as a string.
+ */
+
+Module.afterInit(function() {
+  let pending = new Map(); // Fetch id -> AbortController.
+  const PRIORITIES = {'-1': 'low', '1': 'high'};
+
+  // Read the whole body into a malloc'ed buffer.  Return [ptr, size].
+  const readBody = async function(resp, id) {
+    const reader = resp.body.getReader();
+    let capacity = parseInt(resp.headers.get('Content-Length')) || 65536;
+    let ptr = Module._malloc(capacity + 1);
+    let size = 0;
+    try {
+      for (;;) {
+        const {done, value} = await reader.read();
+        if (done) break;
+        if (!pending.has(id)) throw new Error('aborted');
+        if (size + value.length > capacity) {
+          while (size + value.length > capacity) capacity *= 2;
+          const tmp = Module._malloc(capacity + 1);
+          // Note: the heap can be reallocated, so always get HEAPU8 again.
+          Module.HEAPU8.copyWithin(tmp, ptr, ptr + size);
+          Module._free(ptr);
+          ptr = tmp;
+        }
+        Module.HEAPU8.set(value, ptr + size);
+        size += value.length;
+      }
+    } catch (err) {
+      Module._free(ptr);
+      throw err;
+    }
+    Module.HEAPU8[ptr + size] = 0;
+    return [ptr, size];
+  };
+
+  const start = Module.addFunction(function(url, id, req, priority) {
+    url = Module.UTF8ToString(url);
+    const controller = new AbortController();
+    let options = {signal: controller.signal};
+    if (PRIORITIES[priority]) options.priority = PRIORITIES[priority];
+    pending.set(id, controller);
+    fetch(url, options).then(async function(resp) {
+      if (!resp.ok) return [0, 0, resp.status];
+      const [ptr, size] = await readBody(resp, id);
+      return [ptr, size, resp.status];
+    }).catch(function(err) {
+      return [0, 0, 0];
+    }).then(function([ptr, size, code]) {
+      if (!pending.has(id)) { // Aborted.
+        if (ptr) Module._free(ptr);
+        return;
+      }
+      pending.delete(id);
+      Module._request_on_fetch_done(req, ptr, size, code);
+    });
+  }, 'viiii');
+
+  const abort = Module.addFunction(function(id) {
+    const controller = pending.get(id);
+    if (!controller) return;
+    pending.delete(id);
+    controller.abort();
+  }, 'vi');
+
+  Module._request_set_fetch_functions(start, abort);
+});
@@ -0,0 +1,50 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Snapshot of the parsed modules data, for a fast restart of the engine.
+ * See src/snapshot.h.
+ *
+ * The client stores the bytes returned by saveSnapshot once the data is
+ * loaded (for example in IndexedDB), and passes them to loadSnapshot on
+ * the next start, after adding the data sources.
+ */
+
+/*
+ * Function: saveSnapshot
+ * Return a Uint8Array with the snapshot of the modules data, or null if
+ * there is nothing to save.
+ */
+Module['saveSnapshot'] = function() {
+  const sizePtr = Module._malloc(4);
+  const ptr = Module._core_save_snapshot(sizePtr);
+  const size = Module.getValue(sizePtr, 'i32');
+  Module._free(sizePtr);
+  if (!ptr) return null;
+  const ret = Module.HEAPU8.slice(ptr, ptr + size);
+  Module._free(ptr);
+  return ret;
+}
+
+/*
+ * Function: loadSnapshot
+ * Restore the modules data from a snapshot returned by saveSnapshot.
+ *
+ * Return:
+ *   The number of restored chunks, or -1 if the snapshot is not valid.
+ */
+Module['loadSnapshot'] = function(data) {
+  if (!data) return -1;
+  data = new Uint8Array(data);
+  const ptr = Module._malloc(data.length);
+  Module.HEAPU8.set(data, ptr);
+  const ret = Module._core_load_snapshot(ptr, data.length);
+  Module._free(ptr);
+  return ret;
+}
@@ -0,0 +1,143 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Persistent cache of the versioned tiles and eph files, in an IndexedDB
+ * database, so that returning visitors don't download them again and can
+ * even use the engine offline.
+ *
+ * The request code only gives us the urls that contain a HiPS release
+ * date (the '?v=' argument added by hips.c), so a new release of a survey
+ * automatically stops using the old entries, that end up evicted.  The
+ * only exception are the surveys properties files, that get replaced
+ * when they change.
+ *
+ * Set Module.tilesCacheSize to the max size in bytes (default to 512MB), or
+ * to 0 to disable the cache.
+ *
+ * The database has two stores: 'data' with the files content, and 'meta'
+ * with only the size and last access time of each entry, that we load in
+ * memory at startup to know the cached urls and for the LRU eviction.
+ */
+
+Module.afterInit(function() {
+  const DB_NAME = 'stellarium-web-engine-tiles';
+  const DB_VERSION = 1;
+  const budget = (Module.tilesCacheSize !== undefined) ?
+                 Module.tilesCacheSize : 512 * 1024 * 1024;
+  if (!budget || typeof(indexedDB) === 'undefined') return;
+
+  let index = new Map(); // url -> {size, lastUsed}
+  let total = 0;
+  let pending = new Map(); // Lookup id -> request pointer.
+
+  const openDb = function() {
+    return new Promise(function(resolve, reject) {
+      const req = indexedDB.open(DB_NAME, DB_VERSION);
+      req.onupgradeneeded = function() {
+        const db = req.result;
+        for (const name of db.objectStoreNames) db.deleteObjectStore(name);
+        db.createObjectStore('data');
+        db.createObjectStore('meta');
+      };
+      req.onsuccess = function() { resolve(req.result); };
+      req.onerror = function() { reject(req.error); };
+    }).then(function(db) {
+      return new Promise(function(resolve, reject) {
+        const tx = db.transaction('meta', 'readonly');
+        const cursor = tx.objectStore('meta').openCursor();
+        cursor.onsuccess = function() {
+          const c = cursor.result;
+          if (!c) return;
+          index.set(c.key, c.value);
+          total += c.value.size;
+          c.continue();
+        };
+        tx.oncomplete = function() { resolve(db); };
+        tx.onerror = function() { reject(tx.error); };
+      });
+    }).catch(function(err) {
+      console.warn('Cannot open tiles cache', err);
+      return null;
+    });
+  };
+  const dbPromise = openDb();
+
+  // Delete the least recently used entries until we are below the budget.
+  const evict = function(db) {
+    if (total <= budget) return;
+    const entries = Array.from(index.entries());
+    entries.sort(function(a, b) { return a[1].lastUsed - b[1].lastUsed; });
+    const tx = db.transaction(['data', 'meta'], 'readwrite');
+    for (const [url, meta] of entries) {
+      if (total <= budget * 0.9) break;
+      tx.objectStore('data').delete(url);
+      tx.objectStore('meta').delete(url);
+      index.delete(url);
+      total -= meta.size;
+    }
+  };
+
+  const onResult = function(id, data) {
+    const req = pending.get(id);
+    if (req === undefined) return; // Cancelled.
+    pending.delete(id);
+    if (!data) {
+      Module._request_on_cache_result(req, 0, 0);
+      return;
+    }
+    // Add a zero padding, as done for the downloaded data.
+    const ptr = Module._malloc(data.byteLength + 1);
+    Module.HEAPU8.set(new Uint8Array(data), ptr);
+    Module.HEAPU8[ptr + data.byteLength] = 0;
+    Module._request_on_cache_result(req, ptr, data.byteLength);
+  };
+
+  const get = Module.addFunction(function(url, id, req) {
+    url = Module.UTF8ToString(url);
+    pending.set(id, req);
+    dbPromise.then(function(db) {
+      const meta = index.get(url);
+      if (!db || !meta) return null;
+      return new Promise(function(resolve) {
+        const tx = db.transaction(['data', 'meta'], 'readwrite');
+        const r = tx.objectStore('data').get(url);
+        r.onsuccess = function() { resolve(r.result || null); };
+        r.onerror = function() { resolve(null); };
+        meta.lastUsed = Date.now();
+        tx.objectStore('meta').put(meta, url);
+      });
+    }).then(function(data) {
+      onResult(id, data);
+    });
+  }, 'viii');
+
+  const put = Module.addFunction(function(url, ptr, size) {
+    url = Module.UTF8ToString(url);
+    const data = Module.HEAPU8.slice(ptr, ptr + size).buffer;
+    dbPromise.then(function(db) {
+      if (!db || size > budget / 16) return;
+      const old = index.get(url);
+      if (old) total -= old.size;
+      const meta = {size: size, lastUsed: Date.now()};
+      const tx = db.transaction(['data', 'meta'], 'readwrite');
+      tx.objectStore('data').put(data, url);
+      tx.objectStore('meta').put(meta, url);
+      index.set(url, meta);
+      total += size;
+      tx.oncomplete = function() { evict(db); };
+    });
+  }, 'viii');
+
+  const cancel = Module.addFunction(function(id) {
+    pending.delete(id);
+  }, 'vi');
+
+  Module._request_set_persistent_cache(get, put, cancel);
+});
@@ -0,0 +1,123 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Worker side of the worker mode, where the engine runs in a dedicated
+ * worker and renders into an OffscreenCanvas transferred by the page.
+ *
+ * The page talks to the engine with messages (see
+ * src/js/worker/stellarium-web-engine-client.js for the page side):
+ *
+ *   resize - {width, height, dpr}: new canvas size in CSS pixels.
+ *   input  - {events}: list of input events, as passed to canvasInput.
+ *   calls  - {calls}: list of API calls {id, path, op, attr, args}, where
+ *            op is 'get', 'set' or 'call', and path the object path
+ *            ('core.stars', or an object id).  A null path calls a Module
+ *            function.
+ *   listen - {}: start to forward all the attributes changes.
+ *
+ * The engine answers with a single 'frame' message at the end of each
+ * frame, containing the results of the calls {id, ret, error}, and the
+ * attributes changes {path, value} since the last frame.
+ */
+
+// Convert a returned value so that it can be posted back to the page.
+// The objects are replaced by a {swe_, path, id} reference.
+function workerExportValue(v) {
+  if (v instanceof Module.SweObj) {
+    let path = v.path;
+    return {swe_: 1, path: path === 'core.' ? undefined : path, id: v.id};
+  }
+  if (Array.isArray(v)) return v.map(workerExportValue);
+  if (v && typeof(v) === 'object' && !ArrayBuffer.isView(v)) {
+    let ret = {};
+    for (const key in v) ret[key] = workerExportValue(v[key]);
+    return ret;
+  }
+  return v;
+}
+
+function workerGetObj(path) {
+  if (path === 'core') return Module.core;
+  return Module.getModule(path) || Module.getObj(path);
+}
+
+function workerCall(call) {
+  if (call.path === null || call.path === undefined)
+    return Module[call.attr].apply(Module, call.args || []);
+  let obj = workerGetObj(call.path);
+  if (!obj) throw new Error('No object ' + call.path);
+  switch (call.op) {
+  case 'get':
+    return obj[call.attr];
+  case 'set':
+    obj[call.attr] = call.args[0];
+    return null;
+  case 'call':
+    return obj[call.attr].apply(obj, call.args || []);
+  }
+  throw new Error('Unknown operation ' + call.op);
+}
+
+/*
+ * Function: serveWorker
+ * Start to process the messages of the page in worker mode.
+ *
+ * Parameters:
+ *   scope  - The worker global scope.
+ */
+Module['serveWorker'] = function(scope) {
+  let results = [];
+  let changes = new Map();
+  let listening = false;
+
+  scope.onmessage = function(e) {
+    let msg = e.data;
+    switch (msg.type) {
+    case 'resize':
+      Module.canvasSize = {width: msg.width, height: msg.height,
+                           dpr: msg.dpr};
+      break;
+    case 'input':
+      for (const ev of msg.events) Module.canvasInput(ev);
+      break;
+    case 'calls':
+      for (const call of msg.calls) {
+        try {
+          results.push({id: call.id,
+                        ret: workerExportValue(workerCall(call))});
+        } catch (err) {
+          results.push({id: call.id, error: String(err)});
+        }
+      }
+      break;
+    case 'listen':
+      if (listening) break;
+      listening = true;
+      Module.onValueChanged(function(path, value) {
+        changes.set(path, value);
+      });
+      break;
+    }
+  };
+
+  // Post everything once per frame, so that we don't flood the page with
+  // messages.
+  Module.onFrameEnd = function() {
+    if (!results.length && !changes.size) return;
+    let msg = {type: 'frame', results: results, changes: []};
+    for (const [path, value] of changes)
+      msg.changes.push({path: path, value: workerExportValue(value)});
+    results = [];
+    changes.clear();
+    scope.postMessage(msg);
+  };
+
+  scope.postMessage({type: 'ready'});
+}
@@ -0,0 +1,205 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Page side of the worker mode.
+ *
+ * Function: StelWebEngineWorker
+ * Start the engine in a dedicated worker, rendering into an OffscreenCanvas
+ * transferred from a page canvas.
+ *
+ * The page forwards the canvas size and the inputs, and the engine API is
+ * proxied with asynchronous calls.  All the messages of a frame are sent
+ * together at the next animation frame.
+ *
+ * Parameters:
+ *   args - Plain object with attributes:
+ *     canvas     - The page canvas element.
+ *     workerFile - Url of stellarium-web-engine-worker.js.
+ *     jsFile     - Url of stellarium-web-engine.js.
+ *     wasmFile   - Url of stellarium-web-engine.wasm.
+ *     onReady    - Called with the engine proxy once the engine is ready.
+ *
+ * The proxy has the methods:
+ *   getValue(path)           - Promise of an attribute value, as
+ *                              'core.fov' or 'core.stars.visible'.
+ *   setValue(path, value)    - Set an attribute value.
+ *   call(path, method, args) - Promise of the return value of an object
+ *                              method.  A null path calls a function of
+ *                              the engine module, like 'searchComplete'.
+ *   onValueChanged(callback) - Get notified of all the attributes changes
+ *                              with callback(path, value).
+ *   worker                   - The worker object.
+ *
+ * The objects returned by the calls are references {swe_, path, id} that
+ * can be used as path in the following calls.
+ */
+function StelWebEngineWorker(args) {
+  var canvas = args.canvas;
+  var worker = new Worker(args.workerFile);
+  var calls = [];
+  var events = [];
+  var pending = new Map();
+  var nextId = 1;
+  var listeners = [];
+  var size = null;
+  var scheduled = false;
+  var ready = false;
+
+  var getSize = function() {
+    var rect = canvas.getBoundingClientRect();
+    return {width: rect.width, height: rect.height,
+            dpr: window.devicePixelRatio || 1};
+  }
+
+  // Send all the queued messages, and check for canvas resize.
+  var flush = function() {
+    scheduled = false;
+    var s = getSize();
+    if (!size || s.width !== size.width || s.height !== size.height ||
+        s.dpr !== size.dpr) {
+      size = s;
+      worker.postMessage({type: 'resize', width: s.width, height: s.height,
+                          dpr: s.dpr});
+    }
+    if (events.length) worker.postMessage({type: 'input', events: events});
+    if (calls.length) worker.postMessage({type: 'calls', calls: calls});
+    events = [];
+    calls = [];
+  }
+
+  var schedule = function() {
+    if (scheduled || !ready) return;
+    scheduled = true;
+    window.requestAnimationFrame(flush);
+  }
+
+  var input = function(ev) {
+    events.push(ev);
+    schedule();
+  }
+
+  var call = function(path, op, attr, callArgs) {
+    var id = nextId++;
+    calls.push({id: id, path: path, op: op, attr: attr, args: callArgs});
+    schedule();
+    return new Promise(function(resolve, reject) {
+      pending.set(id, {resolve: resolve, reject: reject});
+    });
+  }
+
+  // Split a value path into the object path and the attribute.
+  var splitPath = function(path) {
+    var elems = path.split('.');
+    var attr = elems.pop();
+    return [elems.join('.'), attr];
+  }
+
+  var engine = {
+    worker: worker,
+    getValue: function(path) {
+      var p = splitPath(path);
+      return call(p[0], 'get', p[1]);
+    },
+    setValue: function(path, value) {
+      var p = splitPath(path);
+      return call(p[0], 'set', p[1], [value]);
+    },
+    call: function(path, method, callArgs) {
+      if (path && typeof(path) === 'object') path = path.path || path.id;
+      return call(path, 'call', method, callArgs);
+    },
+    onValueChanged: function(callback) {
+      if (!listeners.length) worker.postMessage({type: 'listen'});
+      listeners.push(callback);
+    },
+  };
+
+  worker.onmessage = function(e) {
+    var msg = e.data;
+    if (msg.type === 'ready') {
+      ready = true;
+      schedule();
+      if (args.onReady) args.onReady(engine);
+      return;
+    }
+    if (msg.type !== 'frame') return;
+    msg.results.forEach(function(r) {
+      var p = pending.get(r.id);
+      pending.delete(r.id);
+      if (!p) return;
+      if (r.error !== undefined) p.reject(new Error(r.error));
+      else p.resolve(r.ret);
+    });
+    msg.changes.forEach(function(c) {
+      listeners.forEach(function(callback) {
+        callback(c.path, c.value);
+      });
+    });
+  }
+
+  // Forward the inputs, with the same events as src/js/canvas.js.
+  var getMousePos = function(e) {
+    var rect = canvas.getBoundingClientRect();
+    return {x: e.clientX - rect.left, y: e.clientY - rect.top};
+  }
+  canvas.addEventListener('mousedown', function(e) {
+    var pos = getMousePos(e);
+    input({type: 'mousedown', x: pos.x, y: pos.y, buttons: e.buttons});
+    document.onmouseup = function(e) {
+      var pos = getMousePos(e);
+      input({type: 'mouseup', x: pos.x, y: pos.y});
+    };
+    document.onmouseleave = function(e) {
+      input({type: 'mouseleave'});
+    };
+    document.onmousemove = function(e) {
+      var pos = getMousePos(e);
+      input({type: 'mousemove', x: pos.x, y: pos.y});
+    };
+  });
+  var onTouch = function(e, state) {
+    var rect = canvas.getBoundingClientRect();
+    for (var i = 0; i < e.changedTouches.length; i++) {
+      input({type: 'touch', id: e.changedTouches[i].identifier,
+             state: state,
+             x: e.changedTouches[i].pageX - rect.left,
+             y: e.changedTouches[i].pageY - rect.top});
+    }
+  }
+  canvas.addEventListener('touchstart', function(e) {
+    onTouch(e, 1);
+  }, {passive: true});
+  canvas.addEventListener('touchmove', function(e) {
+    e.preventDefault();
+    onTouch(e, -1);
+  }, {passive: false});
+  canvas.addEventListener('touchend', function(e) {
+    onTouch(e, 0);
+  });
+  canvas.addEventListener('wheel', function(e) {
+    e.preventDefault();
+    var pos = getMousePos(e);
+    // Same scale as the old mousewheel event wheelDelta / 120.
+    var delta = -e.deltaY / (e.deltaMode === 0 ? 100 : 3);
+    input({type: 'wheel', delta: delta, x: pos.x, y: pos.y});
+  }, {passive: false});
+  canvas.oncontextmenu = function(e) {
+    e.preventDefault();
+    e.stopPropagation();
+  }
+
+  size = getSize();
+  var offscreen = canvas.transferControlToOffscreen();
+  worker.postMessage({type: 'init', canvas: offscreen,
+                      jsFile: args.jsFile, wasmFile: args.wasmFile,
+                      width: size.width, height: size.height,
+                      dpr: size.dpr}, [offscreen]);
+  return engine;
+}
@@ -0,0 +1,31 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Entry point of the engine worker in worker mode.
+ *
+ * The page creates this worker with StelWebEngineWorker (see
+ * stellarium-web-engine-client.js), and sends an 'init' message with the
+ * OffscreenCanvas and the engine files urls.  Once the engine is ready we
+ * let it process the other messages (see src/js/worker.js).
+ */
+
+onmessage = function(e) {
+  var msg = e.data;
+  if (msg.type !== 'init') return;
+  importScripts(msg.jsFile);
+  StelWebEngine({
+    wasmFile: msg.wasmFile,
+    canvas: msg.canvas,
+    canvasSize: {width: msg.width, height: msg.height, dpr: msg.dpr},
+    onReady: function(stel) {
+      stel.serveWorker(self);
+    }
+  });
+};
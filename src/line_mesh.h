@@ -17,50 +17,10 @@
 /*
  * File: line.h
  *
- * Some util functions to convert a line into a quad, for better opengl
- * rendering.
+ * Some util functions to cut a line into points for rendering.  The
+ * renderer then extrudes the points into a thick line on the GPU.
  */
 
-/*
- * Struct: line_mesh_t
- * Contains the vertices and indices of a line mesh.
- */
-typedef struct line_mesh
-{
-    struct {
-        float pos[3];
-        float win[2];
-        float uv[2];
-    } *verts;
-    uint16_t *indices;
-    int indices_count;
-    int verts_count;
-} line_mesh_t;
-
-/*
- * Function: line_to_mesh
- * Convert a line with a width into a quad mesh.
- *
- * Parameters:
- *   line   - Array of 3d coordinates.
- *   win    - Pre projected window coordinates.
- *   size   - Number of points in the line array.
- *   width  - width of the line.
- *
- * Return:
- *   A new <line_mesh_t> instance, that should be released with
- *   <line_mesh_delete>.
- */
-line_mesh_t *line_to_mesh(const double (*line)[3],
-                          const double (*win)[3],
-                          int size, double width);
-
-/*
- * Function: line_mesh_delete
- * Delete a line mesh.
- */
-void line_mesh_delete(line_mesh_t *mesh);
-
 /*
  * Function: line_tesselate
  * Cut a parametric line into a list of points.
@@ -73,8 +33,10 @@ void line_mesh_delete(line_mesh_t *mesh);
  *   split  - Number of segments requested in the output.  If < 0 use
  *            an adaptive algorithm, where -split is the minimum level
  *            of split.
- *   out_pos - Allocated out line points in view coordinates.
- *   out_win - Allocated out line points in windows coordinates.
+ *   out_pos - Out line points in view coordinates, allocated in the
+ *             frame arena.
+ *   out_win - Out line points in windows coordinates, allocated in the
+ *             frame arena.
  *
  * Return:
  *   The number of points in the line, or -1 in case or error (and out is not
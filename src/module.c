@@ -9,7 +9,49 @@
 
 #include "swe.h"
 
-static void (*g_listener)(obj_t *module, const char *attr) = NULL;
+static void (*g_listener)(int nb, obj_t **modules, const char **attrs) = NULL;
+
+// Changes not yet sent to the listener.  The modules are retained until we
+// flush the changes.
+static struct {
+    int nb;
+    int capacity;
+    obj_t **modules;
+    const char **attrs;
+} g_changes = {};
+
+// Incremented each time a child is added or removed from a module.
+static int g_children_version = 0;
+
+// Max number of entries of the changes journal before we drop the oldest.
+#define JOURNAL_MAX 4096
+
+/*
+ * Type: journal_entry_t
+ * Last change of an attribute (or of the children list if attr is NULL)
+ * recorded for <module_get_tree_changes>.  The objects are retained until
+ * the entry gets dropped.
+ */
+typedef struct journal_entry journal_entry_t;
+struct journal_entry {
+    UT_hash_handle  hh;
+    struct {
+        obj_t       *obj;
+        const char  *attr;
+    } key;
+    int             revision;
+    journal_entry_t *prev, *next;
+};
+
+// Journal of the changes, only recorded once a client asked for them.
+static struct {
+    bool            enabled;
+    int             revision;
+    int             min_revision; // The changes up to it were dropped.
+    int             nb;
+    journal_entry_t *map;
+    journal_entry_t *list; // Sorted by revision.
+} g_journal = {};
 
 EMSCRIPTEN_KEEPALIVE
 int module_update(obj_t *module, double dt)
@@ -57,6 +99,117 @@ int module_list_objs(const obj_t *obj,
     return 0;
 }
 
+void sky_region_init_cone(sky_region_t *region, const double dir[3],
+                          double radius)
+{
+    vec3_normalize(dir, region->cap);
+    region->cap[3] = cos(radius);
+    region->nb = 0;
+}
+
+int sky_region_init_polygon(sky_region_t *region, int nb,
+                            const double (*verts)[3])
+{
+    double v[SKY_REGION_MAX_VERTICES][3], center[3] = {0, 0, 0};
+    int i, j;
+
+    if (nb < 3 || nb > SKY_REGION_MAX_VERTICES) return -1;
+    for (i = 0; i < nb; i++) {
+        vec3_normalize(verts[i], v[i]);
+        vec3_add(center, v[i], center);
+    }
+    if (vec3_norm2(center) == 0.0) return -1;
+    vec3_normalize(center, region->cap);
+    region->cap[3] = 1.0;
+    region->nb = nb;
+    for (i = 0; i < nb; i++) {
+        region->cap[3] = fmin(region->cap[3], vec3_dot(region->cap, v[i]));
+        vec3_cross(v[i], v[(i + 1) % nb], region->planes[i]);
+        if (vec3_norm2(region->planes[i]) == 0.0) return -1;
+        vec3_normalize(region->planes[i], region->planes[i]);
+    }
+    // The edges only stay inside the bounding cap if it is smaller than
+    // an hemisphere.
+    if (region->cap[3] <= 0.0) return -1;
+    // Make the planes point inside for clockwise polygons.
+    if (vec3_dot(region->planes[0], region->cap) < 0.0) {
+        for (i = 0; i < nb; i++)
+            vec3_mul(-1, region->planes[i], region->planes[i]);
+    }
+    for (i = 0; i < nb; i++) {
+        for (j = 0; j < nb; j++) {
+            if (vec3_dot(region->planes[i], v[j]) < -1e-12) return -1;
+        }
+    }
+    return 0;
+}
+
+bool sky_region_contains(const sky_region_t *region, const double v[3])
+{
+    int i;
+    if (!cap_contains_vec3(region->cap, v)) return false;
+    for (i = 0; i < region->nb; i++) {
+        if (vec3_dot(region->planes[i], v) < 0.0) return false;
+    }
+    return true;
+}
+
+bool sky_region_intersects_cap(const sky_region_t *region,
+                               const double cap[4])
+{
+    int i;
+    double sin_r;
+    if (!cap_intersects_cap(region->cap, cap)) return false;
+    // Caps larger than an hemisphere always cross the edges planes.
+    if (cap[3] < 0.0) return true;
+    sin_r = sqrt(1.0 - cap[3] * cap[3]);
+    for (i = 0; i < region->nb; i++) {
+        if (vec3_dot(region->planes[i], cap) < -sin_r) return false;
+    }
+    return true;
+}
+
+typedef struct {
+    observer_t          *obs;
+    const sky_region_t  *region;
+    double              max_mag;
+    void                *user;
+    int                 (*f)(void *user, obj_t *obj);
+} region_filter_t;
+
+static int list_in_region_callback(void *user, obj_t *obj)
+{
+    const region_filter_t *filter = user;
+    double pvo[2][4], dir[3], vmag = NAN;
+
+    if (obj_get_pvo(obj, filter->obs, pvo)) return 0;
+    if (vec3_norm2(pvo[0]) == 0.0) return 0;
+    vec3_normalize(pvo[0], dir);
+    if (!sky_region_contains(filter->region, dir)) return 0;
+    if (!isnan(filter->max_mag)) {
+        obj_get_info(obj, filter->obs, INFO_VMAG, &vmag);
+        if (vmag > filter->max_mag) return 0;
+    }
+    return filter->f(filter->user, obj);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int module_list_objs_in_region(const obj_t *obj, observer_t *obs,
+                               const sky_region_t *region, double max_mag,
+                               const char *source, void *user,
+                               int (*f)(void *user, obj_t *obj))
+{
+    region_filter_t filter = {obs, region, max_mag, user, f};
+
+    observer_update(obs, true);
+    if (obj->klass->list_in_region) {
+        return obj->klass->list_in_region(obj, obs, region, max_mag, source,
+                                          &filter, list_in_region_callback);
+    }
+    return module_list_objs(obj, max_mag, 0, source, &filter,
+                            list_in_region_callback);
+}
+
 // Only there because we can't easily call module_list_objs from js.
 EMSCRIPTEN_KEEPALIVE
 int module_list_objs2(const obj_t *obj, observer_t *obs,
@@ -66,6 +219,121 @@ int module_list_objs2(const obj_t *obj, observer_t *obs,
     return module_list_objs(obj, max_mag, 0, NULL, user, f);
 }
 
+static int list_objs_info_callback(void *user, obj_t *obj)
+{
+    observer_t *obs = USER_GET(user, 0);
+    const projection_t *proj = USER_GET(user, 1);
+    int flags = *(int*)USER_GET(user, 2);
+    int size = *(int*)USER_GET(user, 3);
+    int *nb = USER_GET(user, 4);
+    obj_t **objs = USER_GET(user, 5);
+    double (*values)[5] = USER_GET(user, 6);
+    double max_mag = *(double*)USER_GET(user, 7);
+    double pvo[2][4], p[4], view[4], win[3], vmag = NAN, ra, dec, az, alt;
+
+    if (*nb >= size) return 1;
+    obj_get_info(obj, obs, INFO_VMAG, &vmag);
+    if (!isnan(max_mag) && !(vmag <= max_mag)) return 0;
+    obj_get_pvo(obj, obs, pvo);
+    convert_framev4(obs, FRAME_ICRF, FRAME_OBSERVED, pvo[0], p);
+    if ((flags & MODULE_LIST_ABOVE_HORIZON) && p[2] < 0) return 0;
+    if (flags & MODULE_LIST_IN_VIEW) {
+        convert_framev4(obs, FRAME_ICRF, FRAME_VIEW, pvo[0], view);
+        if (!project_to_win(proj, view, win)) return 0;
+        if (win[0] < 0 || win[0] > proj->window_size[0] ||
+            win[1] < 0 || win[1] > proj->window_size[1] ||
+            win[2] < 0 || win[2] > 1) return 0;
+    }
+    vec3_to_sphe(p, &az, &alt);
+    convert_framev4(obs, FRAME_ICRF, FRAME_JNOW, pvo[0], p);
+    vec3_to_sphe(p, &ra, &dec);
+
+    if (objs) objs[*nb] = obj_retain(obj);
+    values[*nb][0] = eraAnp(ra);
+    values[*nb][1] = dec;
+    values[*nb][2] = eraAnp(az);
+    values[*nb][3] = alt;
+    values[*nb][4] = vmag;
+    (*nb)++;
+    return 0;
+}
+
+/*
+ * Function: module_list_objs_info
+ * List the objects of a module, with their positions and magnitudes.
+ *
+ * This is the same as calling <obj_get_info> for all the listed objects,
+ * but gets all the values at once in flat arrays, so that we can quickly
+ * build large tables of objects from js.
+ *
+ * Parameters:
+ *   obj      - The module.
+ *   obs      - The observer.
+ *   region   - If set, only list the objects in this region of the sky
+ *              (see <module_list_objs_in_region>).
+ *   max_mag  - If not NAN, skip the objects fainter than this value, and
+ *              the objects without any magnitude.
+ *   flags    - Union of <MODULE_LIST_FLAGS> to only get the visible
+ *              objects.
+ *   size     - Max number of objects to return.
+ *   objs     - Output objects, or NULL.  The objects are retained, and the
+ *              caller should release them.
+ *   values   - Output values: five doubles per object, with the apparent
+ *              ra and dec (JNOW), the azimuth and altitude (OBSERVED) and
+ *              the visual magnitude (NAN if unknown).  Same angles as
+ *              given by vec3_to_sphe, with ra and az in [0, 2pi).
+ *
+ * Return:
+ *   The number of objects listed.
+ */
+int module_list_objs_info(const obj_t *obj, observer_t *obs,
+                          const sky_region_t *region,
+                          double max_mag, int flags, int size,
+                          obj_t **objs, double (*values)[5])
+{
+    int nb = 0;
+    projection_t proj;
+    void *user;
+
+    observer_update(obs, true);
+    if (flags & MODULE_LIST_IN_VIEW) core_get_proj(&proj);
+    user = USER_PASS(obs, &proj, &flags, &size, &nb, objs, values, &max_mag);
+    if (region) {
+        module_list_objs_in_region(obj, obs, region, max_mag, NULL,
+                                   user, list_objs_info_callback);
+    } else {
+        module_list_objs(obj, max_mag, 0, NULL, user,
+                         list_objs_info_callback);
+    }
+    return nb;
+}
+
+/*
+ * Same as module_list_objs_info, with the region given as an array of
+ * vertices, since we can't easily create a sky_region_t from js.
+ *
+ * region_nb - Zero for no region, one for a cone centered on the first
+ *             vertex, or the number of vertices of a convex polygon.
+ */
+EMSCRIPTEN_KEEPALIVE
+int module_list_objs_info2(const obj_t *obj, observer_t *obs,
+                           int region_nb, const double (*region_verts)[3],
+                           double region_radius,
+                           double max_mag, int flags, int size,
+                           obj_t **objs, double (*values)[5])
+{
+    sky_region_t region;
+    if (region_nb == 1)
+        sky_region_init_cone(&region, region_verts[0], region_radius);
+    if (region_nb > 1 &&
+            sky_region_init_polygon(&region, region_nb, region_verts)) {
+        LOG_W("Invalid sky region polygon");
+        return 0;
+    }
+    return module_list_objs_info(obj, obs, region_nb ? &region : NULL,
+                                 max_mag, flags, size, objs, values);
+}
+
 static int module_add_data_source_task(task_t *task, double dt)
 {
     struct {
@@ -117,6 +385,17 @@ int module_add_data_source(obj_t *module, const char *url, const char *key)
     return r;
 }
 
+void module_get_memory(const obj_t *module, int64_t *cpu, int64_t *gpu)
+{
+    const obj_t *child;
+    if (module->klass->get_memory) {
+        module->klass->get_memory(module, cpu, gpu);
+        return;
+    }
+    DL_FOREACH(module->children, child)
+        module_get_memory(child, cpu, gpu);
+}
+
 // For modules: return the order in which the modules should be rendered.
 // NOTE: if we used deferred rendering this wouldn't be needed at all!
 double module_get_render_order(const obj_t *module)
@@ -128,15 +407,89 @@ double module_get_render_order(const obj_t *module)
 }
 
 EMSCRIPTEN_KEEPALIVE
-void module_add_global_listener(void (*f)(obj_t *module, const char *attr))
+void module_add_global_listener(
+        void (*f)(int nb, obj_t **modules, const char **attrs))
 {
     g_listener = f;
 }
 
+static void journal_record(obj_t *obj, const char *attr)
+{
+    journal_entry_t *entry;
+    typeof(entry->key) key = {obj, attr};
+
+    // Objects in the middle of their destruction cannot be retained.
+    if (!g_journal.enabled || !obj->ref) return;
+    HASH_FIND(hh, g_journal.map, &key, sizeof(key), entry);
+    if (entry) {
+        DL_DELETE(g_journal.list, entry);
+    } else {
+        entry = calloc(1, sizeof(*entry));
+        entry->key = key;
+        obj_retain(obj);
+        HASH_ADD(hh, g_journal.map, key, sizeof(entry->key), entry);
+        g_journal.nb++;
+    }
+    entry->revision = ++g_journal.revision;
+    DL_APPEND(g_journal.list, entry);
+
+    // Drop the oldest changes, the clients that didn't get them will get
+    // the full tree instead.
+    if (g_journal.nb <= JOURNAL_MAX) return;
+    while (g_journal.nb > JOURNAL_MAX * 3 / 4) {
+        entry = g_journal.list;
+        g_journal.min_revision = entry->revision;
+        DL_DELETE(g_journal.list, entry);
+        HASH_DEL(g_journal.map, entry);
+        obj_release(entry->key.obj);
+        free(entry);
+        g_journal.nb--;
+    }
+}
+
 void module_changed(obj_t *module, const char *attr)
 {
-    if (g_listener)
-        g_listener(module, attr);
+    int i;
+
+    journal_record(module, attr);
+    // Objects in the middle of their destruction cannot be retained.
+    if (!g_listener || !module->ref) return;
+    for (i = 0; i < g_changes.nb; i++) {
+        if (g_changes.modules[i] == module &&
+            strcmp(g_changes.attrs[i], attr) == 0) return;
+    }
+    if (g_changes.nb >= g_changes.capacity) {
+        g_changes.capacity = g_changes.capacity ? g_changes.capacity * 2 : 16;
+        g_changes.modules = realloc(g_changes.modules,
+                g_changes.capacity * sizeof(*g_changes.modules));
+        g_changes.attrs = realloc(g_changes.attrs,
+                g_changes.capacity * sizeof(*g_changes.attrs));
+    }
+    g_changes.modules[g_changes.nb] = obj_retain(module);
+    g_changes.attrs[g_changes.nb] = attr;
+    g_changes.nb++;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void module_flush_changes(void)
+{
+    int i;
+    typeof(g_changes) changes = g_changes;
+
+    if (!changes.nb) return;
+    // The listener can change more attributes, so we first detach the list,
+    // and those new changes will be sent at the next flush.
+    memset(&g_changes, 0, sizeof(g_changes));
+    g_listener(changes.nb, changes.modules, changes.attrs);
+    for (i = 0; i < changes.nb; i++) obj_release(changes.modules[i]);
+    // Reuse the buffers if we can.
+    if (!g_changes.capacity) {
+        g_changes = changes;
+        g_changes.nb = 0;
+    } else {
+        free(changes.modules);
+        free(changes.attrs);
+    }
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -147,6 +500,9 @@ void module_add(obj_t *parent, obj_t *child)
     child->parent = parent;
     DL_APPEND(parent->children, child);
     obj_retain(child);
+    g_children_version++;
+    if (child->id && (child->klass->flags & OBJ_IN_JSON_TREE))
+        journal_record(parent, NULL);
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -167,7 +523,15 @@ void module_remove(obj_t *parent, obj_t *child)
     assert(child->ref > 0);
     child->parent = NULL;
     DL_DELETE(parent->children, child);
+    if (child->id && (child->klass->flags & OBJ_IN_JSON_TREE))
+        journal_record(parent, NULL);
     obj_release(child);
+    g_children_version++;
+}
+
+int module_get_children_version(void)
+{
+    return g_children_version;
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -178,8 +542,7 @@ obj_t *module_get_child(const obj_t *module, const char *id)
     DL_FOREACH(module->children, ret) {
         assert(ret->ref > 0);
         if (ret->id && strcmp(ret->id, id) == 0) {
-            ret->ref++;
-            return ret;
+            return obj_retain(ret);
         }
     }
     return NULL;
@@ -198,11 +561,25 @@ static json_value *json_extract_attr(json_value *val, const char *attr)
     return ret;
 }
 
+static json_value *get_attr_json(const obj_t *obj, const char *attr,
+                                 bool detailed)
+{
+    json_value *val, *tmp;
+    val = obj_call_json((obj_t*)obj, attr, NULL);
+    // Remove the attributes informations if we want a simple tree.
+    if (!detailed && json_get_attr(val, "swe_", 0)) {
+        tmp = json_extract_attr(val, "v");
+        json_builder_free(val);
+        val = tmp;
+    }
+    return val;
+}
+
 static json_value *module_get_tree_json(const obj_t *obj, bool detailed)
 {
     int i;
     attribute_t *attr;
-    json_value *ret, *val, *tmp;
+    json_value *ret, *val;
     obj_t *child;
     obj_klass_t *klass;
 
@@ -222,13 +599,7 @@ static json_value *module_get_tree_json(const obj_t *obj, bool detailed)
         if (obj == &core->obj && strcmp(attr->name, "observer") == 0) {
             val = module_get_tree_json(&core->observer->obj, detailed);
         } else {
-            val = obj_call_json((obj_t*)obj, attr->name, NULL);
-            // Remove the attributes informations if we want a simple tree.
-            if (!detailed && json_get_attr(val, "swe_", 0)) {
-                tmp = json_extract_attr(val, "v");
-                json_builder_free(val);
-                val = tmp;
-            }
+            val = get_attr_json(obj, attr->name, detailed);
         }
         json_object_push(ret, attr->name, val);
     }
@@ -268,6 +639,83 @@ char *module_get_tree(const obj_t *obj, bool detailed)
     return ret;
 }
 
+// Return the path of an object in the json tree of a root object, or NULL
+// if it is not part of it.
+static char *get_tree_path(const obj_t *obj, const obj_t *root)
+{
+    const obj_t *o;
+    if (obj == root) return strdup("");
+    if (root == &core->obj && obj == &core->observer->obj)
+        return strdup("observer");
+    for (o = obj; o != root; o = o->parent) {
+        if (!o || !o->id || !(o->klass->flags & OBJ_IN_JSON_TREE))
+            return NULL;
+    }
+    return module_get_path(obj, root);
+}
+
+EMSCRIPTEN_KEEPALIVE
+char *module_get_tree_changes(const obj_t *obj, int since, bool detailed)
+{
+    char *ret, *path;
+    int size;
+    json_value *jret, *changes, *change;
+    journal_entry_t *entry, *first = NULL;
+    const attribute_t *attr;
+    json_serialize_opts opts = {
+        .mode = json_serialize_mode_packed,
+    };
+
+    obj = obj ?: &core->obj;
+    jret = json_object_new(0);
+    if (!g_journal.enabled || since < g_journal.min_revision ||
+            since > g_journal.revision) {
+        g_journal.enabled = true;
+        json_object_push(jret, "tree", module_get_tree_json(obj, detailed));
+        goto end;
+    }
+
+    changes = json_array_new(0);
+    // Walk back from the last change to the first one after the revision.
+    entry = g_journal.list ? g_journal.list->prev : NULL;
+    for (; entry && entry->revision > since; entry = entry->prev) {
+        first = entry;
+        if (entry == g_journal.list) break;
+    }
+    for (entry = first; entry; entry = entry->next) {
+        path = get_tree_path(entry->key.obj, obj);
+        if (!path) continue;
+        change = json_object_new(0);
+        json_object_push(change, "path", json_string_new(path));
+        free(path);
+        if (!entry->key.attr) {
+            json_object_push(change, "tree",
+                             module_get_tree_json(entry->key.obj, detailed));
+        } else {
+            attr = obj_get_attr_(entry->key.obj, entry->key.attr);
+            if (!attr || !attr->is_prop) {
+                json_builder_free(change);
+                continue;
+            }
+            json_object_push(change, "attr",
+                             json_string_new(entry->key.attr));
+            json_object_push(change, "value",
+                             get_attr_json(entry->key.obj, entry->key.attr,
+                                           detailed));
+        }
+        json_array_push(changes, change);
+    }
+    json_object_push(jret, "changes", changes);
+
+end:
+    json_object_push(jret, "revision", json_integer_new(g_journal.revision));
+    size = json_measure_ex(jret, opts);
+    ret = calloc(1, size);
+    json_serialize_ex(ret, jret, opts);
+    json_builder_free(jret);
+    return ret;
+}
+
 // Return the path of the object relative to a root object.
 // Inputs:
 //  obj         The object.
@@ -291,3 +739,85 @@ char *module_get_path(const obj_t *obj, const obj_t *root)
     free(base);
     return ret;
 }
+
+#if COMPILE_TESTS
+
+static void test_sky_region(void)
+{
+    const double square[4][3] = {{1, -0.1, -0.1}, {1, 0.1, -0.1},
+                                 {1, 0.1, 0.1}, {1, -0.1, 0.1}};
+    const double concave[4][3] = {{1, -0.1, -0.1}, {1, 0, 0},
+                                  {1, 0.1, -0.1}, {1, 0, 0.1}};
+    double verts[4][3], p[3], cap[4];
+    sky_region_t region, reversed, cone;
+    bool r;
+    int i, j, k;
+
+    assert(sky_region_init_polygon(&region, 4, square) == 0);
+    // Same polygon with the opposite winding order.
+    for (i = 0; i < 4; i++) vec3_copy(square[3 - i], verts[i]);
+    assert(sky_region_init_polygon(&reversed, 4, verts) == 0);
+    assert(sky_region_init_polygon(&cone, 4, concave) == -1);
+    sky_region_init_cone(&cone, VEC(1, 0, 0), 0.05);
+
+    srand(1);
+    for (j = 0; j < 10000; j++) {
+        for (k = 0; k < 3; k++) p[k] = (double)rand() / RAND_MAX - 0.5;
+        p[0] = 4;
+        vec3_normalize(p, p);
+        r = fabs(p[1] / p[0]) <= 0.1 && fabs(p[2] / p[0]) <= 0.1;
+        assert(sky_region_contains(&region, p) == r);
+        assert(sky_region_contains(&reversed, p) == r);
+        assert(sky_region_contains(&cone, p) ==
+               (vec3_dot(p, VEC(1, 0, 0)) >= cos(0.05)));
+        // Any cap that contains a point of the region intersects it.
+        vec3_copy(p, cap);
+        cap[3] = cos(0.01);
+        if (r) assert(sky_region_intersects_cap(&region, cap));
+        if (vec3_dot(p, VEC(1, 0, 0)) < cos(0.2))
+            assert(!sky_region_intersects_cap(&region, cap));
+    }
+}
+
+TEST_REGISTER(NULL, test_sky_region, TEST_AUTO);
+
+static void test_tree_changes(void)
+{
+    char *str;
+    json_value *ret, *changes, *change;
+    int revision;
+
+    str = module_get_tree_changes(NULL, -1, false);
+    ret = json_parse(str, strlen(str));
+    assert(json_get_attr(ret, "tree", json_object));
+    revision = json_get_attr_i(ret, "revision", -1);
+    json_value_free(ret);
+    free(str);
+
+    obj_set_attr(&core->obj, "fov", core->fov / 2);
+    obj_set_attr(&core->obj, "fov", core->fov * 2);
+    str = module_get_tree_changes(NULL, revision, false);
+    ret = json_parse(str, strlen(str));
+    changes = json_get_attr(ret, "changes", json_array);
+    assert(changes && changes->u.array.length == 1);
+    change = changes->u.array.values[0];
+    assert(strcmp(json_get_attr_s(change, "path"), "") == 0);
+    assert(strcmp(json_get_attr_s(change, "attr"), "fov") == 0);
+    assert(fabs(json_get_attr_f(change, "value", 0) - core->fov) < 1e-6);
+    assert(json_get_attr_i(ret, "revision", -1) > revision);
+    revision = json_get_attr_i(ret, "revision", -1);
+    json_value_free(ret);
+    free(str);
+
+    // No changes since the last call.
+    str = module_get_tree_changes(NULL, revision, false);
+    ret = json_parse(str, strlen(str));
+    changes = json_get_attr(ret, "changes", json_array);
+    assert(changes && changes->u.array.length == 0);
+    json_value_free(ret);
+    free(str);
+}
+
+TEST_REGISTER(NULL, test_tree_changes, TEST_AUTO);
+
+#endif
@@ -50,6 +50,112 @@ int module_list_objs(const obj_t *module,
                      void *user, int (*f)(void *user, obj_t *obj))
 __attribute__((nonnull(1, 6)));
 
+// Max number of vertices of the polygon sky regions.
+#define SKY_REGION_MAX_VERTICES 16
+
+/*
+ * Type: sky_region_t
+ * A cone or convex polygon region of the sky, in ICRF.
+ *
+ * Use <sky_region_init_cone> or <sky_region_init_polygon> to set it up.
+ *
+ * Attributes:
+ *   cap    - Bounding cap of the region.
+ *   nb     - Number of polygon edges, or zero for a cone.
+ *   planes - Normals of the polygon edges planes, pointing inside.
+ */
+struct sky_region {
+    double  cap[4];
+    int     nb;
+    double  planes[SKY_REGION_MAX_VERTICES][3];
+};
+
+/*
+ * Function: sky_region_init_cone
+ * Initialize a cone region from its center direction and radius.
+ */
+void sky_region_init_cone(sky_region_t *region, const double dir[3],
+                          double radius);
+
+/*
+ * Function: sky_region_init_polygon
+ * Initialize a convex polygon region.
+ *
+ * The vertices can be in any winding order, and don't need to be
+ * normalized.
+ *
+ * Return:
+ *   0 on success, or -1 if the polygon is not convex, too large, or has
+ *   more than SKY_REGION_MAX_VERTICES vertices.
+ */
+int sky_region_init_polygon(sky_region_t *region, int nb,
+                            const double (*verts)[3]);
+
+/*
+ * Function: sky_region_contains
+ * Test if a direction is inside a region.
+ */
+bool sky_region_contains(const sky_region_t *region, const double v[3]);
+
+/*
+ * Function: sky_region_intersects_cap
+ * Test if a cap might intersect a region.
+ *
+ * This can return true for some caps that only touch the region bounding
+ * cap, but never false for a cap that intersects the region.
+ */
+bool sky_region_intersects_cap(const sky_region_t *region,
+                               const double cap[4]);
+
+/*
+ * Function: module_list_objs_in_region
+ * List the astro objects of a module that are in a region of the sky.
+ *
+ * The modules that support it only walk the parts of their data that
+ * intersect the region (the HiPS tiles for the stars and dsos), the others
+ * list all their objects.  In both cases we only pass to the callback the
+ * objects actually in the region.
+ *
+ * Parameters:
+ *   module   - The module.
+ *   obs      - The observer used to compute the objects positions.
+ *   region   - The region, in ICRF.
+ *   max_mag  - If not NAN, skip the objects fainter than this value.  The
+ *              objects without any magnitude are kept.
+ *   source   - Only consider objects from the given data source.  Can be
+ *              set to NULL to ignore.
+ *   user     - Data passed to the callback.
+ *   f        - Callback function called once per object, that can return
+ *              a non zero value to stop the listing.
+ *
+ * Return:
+ *   Same as <module_list_objs>.
+ */
+int module_list_objs_in_region(const obj_t *module, observer_t *obs,
+                               const sky_region_t *region, double max_mag,
+                               const char *source, void *user,
+                               int (*f)(void *user, obj_t *obj))
+__attribute__((nonnull(1, 2, 3, 7)));
+
+/*
+ * Enum: MODULE_LIST_FLAGS
+ * Flags to filter the objects listed by <module_list_objs_info>.
+ *
+ * Values:
+ *   MODULE_LIST_ABOVE_HORIZON  - Only list the objects above the horizon.
+ *   MODULE_LIST_IN_VIEW        - Only list the objects in the current core
+ *                                view.
+ */
+enum {
+    MODULE_LIST_ABOVE_HORIZON   = 1 << 0,
+    MODULE_LIST_IN_VIEW         = 1 << 1,
+};
+
+int module_list_objs_info(const obj_t *obj, observer_t *obs,
+                          const sky_region_t *region,
+                          double max_mag, int flags, int size,
+                          obj_t **objs, double (*values)[5]);
+
 /*
  * Function: module_add_data_source
  * Add a data source url to a module
@@ -84,6 +190,21 @@ int module_add_data_source(obj_t *module, const char *url, const char *key);
  */
 obj_t *obj_get_by_hip(int hip, int *code);
 
+/*
+ * Function: module_get_memory
+ * Add the resident memory of a module data, in bytes.
+ *
+ * This uses the get_memory klass method if the module has one, otherwise
+ * the memory of all its children.  The shared caches (assets, renderer)
+ * are not included.
+ *
+ * Parameters:
+ *   module - A module.
+ *   cpu    - Incremented with the CPU memory.
+ *   gpu    - Incremented with the GPU memory.
+ */
+void module_get_memory(const obj_t *module, int64_t *cpu, int64_t *gpu);
+
 /*
  * Function: module_get_render_order
  *
@@ -94,20 +215,41 @@ double module_get_render_order(const obj_t *module);
 
 /*
  * Function: module_add_global_listener
- * Register a callback to be called anytime an attribute of a module changes.
+ * Register a callback to be called when attributes of modules have changed.
+ *
+ * The changes are not sent immediately, but coalesced and sent all at once
+ * by <module_flush_changes>, so that we only get a single call per frame
+ * even if the same attributes changed several times.
  *
  * For the moment we can only have one listener for all the modules.  This
  * is enough for the javascript binding.
+ *
+ * Parameters:
+ *   f  - Callback that gets the number of changes and arrays of the
+ *        changed modules and attributes names.  The arrays are only valid
+ *        during the call.
  */
-void module_add_global_listener(void (*f)(obj_t *module, const char *attr));
+void module_add_global_listener(
+        void (*f)(int nb, obj_t **modules, const char **attrs));
 
 /*
  * Function: module_changed
  * Should be called by modules after they manually change one of their
  * attributes.
+ *
+ * The attribute name should be a static string, since it is only used
+ * at the next call to <module_flush_changes>.
  */
 void module_changed(obj_t *module, const char *attr);
 
+/*
+ * Function: module_flush_changes
+ * Send all the changes since the last call to the global listener.
+ *
+ * This is called once per frame at the end of <core_update>.
+ */
+void module_flush_changes(void);
+
 /*
  * Macro: MODULE_ITER
  * Iter all the children of a given module of a given type.
@@ -146,6 +288,16 @@ obj_t *module_add_new(obj_t *module, const char *type, json_value *args);
  */
 void module_remove(obj_t *module, obj_t *child);
 
+/*
+ * Function: module_get_children_version
+ * Return a counter incremented each time a child is added or removed from
+ * any module.
+ *
+ * This can be used to invalidate caches that keep pointers to module
+ * children.
+ */
+int module_get_children_version(void);
+
 /*
  * Function: module_get_child
  * Return a module child by id.
@@ -167,6 +319,30 @@ obj_t *module_get_child(const obj_t *module, const char *id);
  */
 char *module_get_tree(const obj_t *obj, bool detailed);
 
+/*
+ * Function: module_get_tree_changes
+ * Return the changes of the json tree since a given revision.
+ *
+ * Each attribute change and each child added or removed bumps the tree
+ * revision.  The changes are only recorded after the first call, that
+ * returns the full tree.  We also return the full tree if the changes got
+ * dropped because the journal was full.
+ *
+ * Parameters:
+ *   obj        - The root object or NULL for global tree (starts at 'core')
+ *   since      - Revision returned by the previous call, or -1 to get
+ *                the full tree.
+ *   detailed   - Whether to add hints to the values or not.
+ *
+ * Return:
+ *   A newly allocated json string.  Caller should delete it.  Either
+ *   {revision, tree} with the same tree as <module_get_tree>, or
+ *   {revision, changes} with changes an array of {path, attr, value} for
+ *   the changed attributes, and {path, tree} for the objects whose
+ *   children changed.  The paths are relative to the root object.
+ */
+char *module_get_tree_changes(const obj_t *obj, int since, bool detailed);
+
 /*
  * Function: obj_get_path
  * Return the path of the module relative to a root module.
@@ -16,6 +16,20 @@
  *
  */
 
+/*
+ * The luminance is computed per pixel in the shader from the prepared
+ * skybrightness terms.  The chromaticity only depends on the sun position,
+ * so we bake it into an alt-az equirectangular map of the upper hemisphere,
+ * that we only rebuild when the sun moves.  Each texel contains the xy
+ * chromaticity in the luminance and alpha channels.
+ *
+ * The last column is a copy of the first one, so that we can use clamp to
+ * edge wrapping and still get a seamless interpolation at azimuth 0.
+ * The values must match the ones in atmosphere.glsl.
+ */
+#define LUT_W 128
+#define LUT_H 32
+
 /*
  * Type: atmosphere_t
  * Atmosphere module struct.
@@ -24,6 +38,14 @@ typedef struct atmosphere {
     obj_t           obj;
     fader_t         visible;
     double          turbidity;
+
+    // Sky chromaticity LUT, only rebuilt when the input values change.
+    struct {
+        texture_t   *tex;
+        // Values used to build the LUT.
+        double      sun_pos[3];
+        double      turbidity;
+    } lut;
 } atmosphere_t;
 
 // All the precomputed data
@@ -47,13 +69,14 @@ typedef struct {
     double sum_lum;
     double max_lum;
     int    nb_lum;
-
-    // Cos Maximum distance between 2 points of the grid on which the atmosphere
-    // is rendered. It is used to avoid aliasing in fast varying regions of the
-    // atmosphere, like near moon border.
-    float cos_grid_angular_step;
 } render_data_t;
 
+// Cos of the minimum distance to the sun and moon used in the skybrightness
+// model.  The look of the sky has been tuned with it, initially to avoid
+// aliasing near the moon border when the luminance was computed per vertex.
+// The value must match the one in atmosphere.glsl.
+static const double COS_MIN_DIST = 0.96592582628906831; // cos(15°)
+
 static double F2(const double *lam, double cos_theta,
                  double gamma, double cos_gamma)
 {
@@ -149,11 +172,10 @@ static void mjd2gcal(double mjd, int *year, int *month)
 }
 
 static void prepare_skybrightness(
-        skybrightness_t *sb, const painter_t *painter,
+        skybrightness_t *sb, const observer_t *obs,
         const double sun_pos[3], const double moon_pos[3], double moon_vmag)
 {
     int year, month;
-    const observer_t *obs = painter->obs;
     const double zenith[3] = {0, 0, 1};
     mjd2gcal(obs->utc, &year, &month);
     skybrightness_prepare(sb, year, month,
@@ -164,6 +186,8 @@ static void prepare_skybrightness(
                           vec3_sep(sun_pos, zenith));
 }
 
+// Luminance of the sky in a given direction.  Same as the shader code, that
+// we only use for the eye adaptation.
 static float compute_lum(void *user, const float pos[3])
 {
     render_data_t *d = user;
@@ -173,8 +197,8 @@ static float compute_lum(void *user, const float pos[3])
     // Our formula does not work below the horizon.
     p[2] = fabs(p[2]);
     lum = skybrightness_get_luminance(&d->skybrightness,
-                fmin(vec3_dot(p, d->moon_pos), d->cos_grid_angular_step),
-                fmin(vec3_dot(p, d->sun_pos), d->cos_grid_angular_step),
+                fmin(vec3_dot(p, d->moon_pos), COS_MIN_DIST),
+                fmin(vec3_dot(p, d->sun_pos), COS_MIN_DIST),
                 vec3_dot(p, zenith));
     lum *= d->eclipse_factor;
 
@@ -193,6 +217,45 @@ static float compute_lum(void *user, const float pos[3])
     return lum;
 }
 
+// Rebuild the chromaticity LUT if the sun moved enough to make a visible
+// difference.
+static void lut_update(atmosphere_t *atm, const render_data_t *data)
+{
+    int i, j;
+    double az, alt, p[3], cos_gamma, gamma, cos_theta;
+    uint8_t (*img)[LUT_W][2];
+    size_t mark;
+
+    // The texture id is zero if it was lost with the GL context.
+    if (    atm->lut.tex && atm->lut.tex->id &&
+            vec3_sep(data->sun_pos, atm->lut.sun_pos) < 0.1 * DD2R &&
+            atm->lut.turbidity == atm->turbidity)
+        return;
+
+    mark = frame_alloc_mark();
+    img = frame_alloc(LUT_H * sizeof(*img));
+    for (i = 0; i < LUT_H; i++)
+    for (j = 0; j < LUT_W; j++) {
+        alt = (double)i / (LUT_H - 1) * M_PI / 2;
+        az = (double)j / (LUT_W - 1) * 2 * M_PI;
+        vec3_set(p, cos(alt) * cos(az), cos(alt) * sin(az), sin(alt));
+        // At the horizon the model tends toward a finite value, so we just
+        // avoid the division by zero.
+        cos_gamma = clamp(vec3_dot(p, data->sun_pos), -1, 1);
+        gamma = acos(cos_gamma);
+        cos_theta = fmax(p[2], 0.001);
+        img[i][j][0] = round(clamp(F2(data->Px, cos_theta, gamma, cos_gamma) *
+                                   data->kx, 0, 1) * 255);
+        img[i][j][1] = round(clamp(F2(data->Py, cos_theta, gamma, cos_gamma) *
+                                   data->ky, 0, 1) * 255);
+    }
+    if (!atm->lut.tex) atm->lut.tex = texture_create(LUT_W, LUT_H, 2);
+    texture_set_data(atm->lut.tex, img, LUT_W, LUT_H, 2);
+    frame_alloc_rewind(mark);
+    vec3_copy(data->sun_pos, atm->lut.sun_pos);
+    atm->lut.turbidity = atm->turbidity;
+}
+
 static int atmosphere_update(obj_t *obj, double dt)
 {
     atmosphere_t *atm = (atmosphere_t*)obj;
@@ -200,30 +263,30 @@ static int atmosphere_update(obj_t *obj, double dt)
 }
 
 static void render_tile(const atmosphere_t *atm, const painter_t *painter,
-                        int order, int pix)
+                        int order, int pix, int split)
 {
-    int split, i;
+    int i;
     uv_map_t map;
 
     if (painter_is_healpix_clipped(painter, FRAME_OBSERVED, order, pix))
         return;
     if (order < 1) {
         for (i = 0; i < 4; i++)
-            render_tile(atm, painter, order + 1, pix * 4 + i);
+            render_tile(atm, painter, order + 1, pix * 4 + i, split);
         return;
     }
-    split = 4; // Adhoc split value to look good while not being too slow.
     uv_map_init_healpix(&map, order, pix, true, true);
     paint_quad(painter, FRAME_OBSERVED, &map, split);
 }
 
 static int atmosphere_render(obj_t *obj, const painter_t *painter_)
 {
-    const atmosphere_t *atm = (const atmosphere_t*)obj;
+    atmosphere_t *atm = (atmosphere_t*)obj;
     obj_t *sun, *moon;
     double sun_pos[4], moon_pos[4], sun_vmag, moon_vmag;
     render_data_t data;
-    int i;
+    const skybrightness_t *sb;
+    int i, split;
     painter_t painter = *painter_;
     core->lwsky_average = 0.0001;
     const observer_t *obs = painter.obs;
@@ -240,30 +303,30 @@ static int atmosphere_render(obj_t *obj, const painter_t *painter_)
     obj_get_info(sun, obs, INFO_VMAG, &sun_vmag);
     obj_get_info(moon, obs, INFO_VMAG, &moon_vmag);
 
-    // XXX: this could be cached!
     data = prepare_render_data(sun_pos, sun_vmag, moon_pos, moon_vmag,
                                atm->turbidity, core->bortle_index);
-    // This is quite ad-hoc as in reality we are using a HIPS grid
-    data.cos_grid_angular_step = cos(15. * DD2R);
     prepare_skybrightness(&data.skybrightness,
-            &painter, sun_pos, moon_pos, moon_vmag);
-
-    // Set the shader attributes.
-    painter.atm.p[0]  = data.Px[0];
-    painter.atm.p[1]  = data.Px[1];
-    painter.atm.p[2]  = data.Px[2];
-    painter.atm.p[3]  = data.Px[3];
-    painter.atm.p[4]  = data.Px[4];
-    painter.atm.p[5]  = data.kx;
-
-    painter.atm.p[6]  = data.Py[0];
-    painter.atm.p[7]  = data.Py[1];
-    painter.atm.p[8]  = data.Py[2];
-    painter.atm.p[9]  = data.Py[3];
-    painter.atm.p[10] = data.Py[4];
-    painter.atm.p[11] = data.ky;
-
+            obs, sun_pos, moon_pos, moon_vmag);
+    lut_update(atm, &data);
+    // Since the color is computed per pixel, the grid only has to follow
+    // the projection, and give enough samples for the eye adaptation.
+    // Adhoc split value that we halve if we need to render faster.
+    split = quality_get(&core->quality, QUALITY_ATMOSPHERE) < 0.5 ? 1 : 2;
+
+    // Set the shader attributes.  The skybrightness terms are in the same
+    // order as the u_sb uniform of atmosphere.glsl.
+    sb = &data.skybrightness;
+    painter.textures[PAINTER_TEX_COLOR].tex = atm->lut.tex;
     vec3_to_float(sun_pos, painter.atm.sun);
+    vec3_to_float(moon_pos, painter.atm.moon);
+    painter.atm.sb[0] = sb->b_night_term;
+    painter.atm.sb[1] = sb->K;
+    painter.atm.sb[2] = sb->b_moon_term;
+    painter.atm.sb[3] = sb->C3;
+    painter.atm.sb[4] = sb->b_twilight_term;
+    painter.atm.sb[5] = sb->C4;
+    painter.atm.sb[6] = data.eclipse_factor;
+    painter.atm.sb[7] = data.light_pollution_lum;
     painter.atm.compute_lum = compute_lum;
     painter.atm.user = &data;
     painter.flags |= PAINTER_ADD | PAINTER_ATMOSPHERE_SHADER;
@@ -271,7 +334,7 @@ static int atmosphere_render(obj_t *obj, const painter_t *painter_)
 
     data.max_lum = 0;
     for (i = 0; i < 12; i++) {
-        render_tile(atm, &painter, 0, i);
+        render_tile(atm, &painter, 0, i, split);
     }
 
     core_report_luminance_in_fov(data.max_lum, true);
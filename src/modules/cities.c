@@ -0,0 +1,411 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "swe.h"
+
+/*
+ * Module that indexes a list of cities, for the location pickers.
+ *
+ * The data source (key 'cities') is a geonames cities file (like
+ * cities15000.txt), with one tab separated entry per line.  Once parsed we
+ * build two indexes:
+ *
+ * - The cities sorted by ascii name, for the prefix search.
+ * - A latitude/longitude grid of GRID_STEP cells, for the nearest city
+ *   search.
+ *
+ * The cities are not sky objects, so they are plain structures instead of
+ * module children.
+ */
+
+// Size of the nearest search grid cells.
+#define GRID_STEP (2 * DD2R)
+#define GRID_W 180
+#define GRID_H 90
+
+/*
+ * Type: city_t
+ * A single city entry.
+ */
+typedef struct {
+    char        *name;
+    char        *ascii_name;
+    char        *timezone;
+    char        country_code[4];
+    double      latitude;   // rad.
+    double      longitude;  // rad.
+    double      elevation;  // m.
+    int         population;
+} city_t;
+
+/*
+ * Type: cities_t
+ * The module object.
+ */
+typedef struct {
+    obj_t       obj;
+    char        *source_url;
+    bool        parsed;
+    city_t      *cities;
+    int         nb;
+    int         *sorted;        // Cities indices sorted by ascii name.
+    // The cities of the grid cell i are the indices from cells_cities
+    // at offsets cells[i] to cells[i + 1].
+    int         *cells;
+    int         *cells_cities;
+} cities_t;
+
+// Split a line in tab separated fields.  Return the number of fields.
+static int split_fields(char *line, char **fields, int max)
+{
+    int nb = 0;
+    char *tab;
+    while (nb < max) {
+        fields[nb++] = line;
+        tab = strchr(line, '\t');
+        if (!tab) break;
+        *tab = '\0';
+        line = tab + 1;
+    }
+    return nb;
+}
+
+static int get_cell(double lat, double lon)
+{
+    int row, col;
+    row = clamp(floor((lat + M_PI / 2) / GRID_STEP), 0, GRID_H - 1);
+    col = (int)floor(eraAnp(lon) / GRID_STEP) % GRID_W;
+    return row * GRID_W + col;
+}
+
+static const cities_t *g_sort_cities = NULL; // For qsort.
+
+static int name_cmp(const void *a, const void *b)
+{
+    const city_t *ca = &g_sort_cities->cities[*(const int*)a];
+    const city_t *cb = &g_sort_cities->cities[*(const int*)b];
+    return strcasecmp(ca->ascii_name, cb->ascii_name);
+}
+
+// Build the name and grid indexes.
+static void cities_build_index(cities_t *cities)
+{
+    int i, cell, *count;
+
+    cities->sorted = calloc(cities->nb, sizeof(*cities->sorted));
+    for (i = 0; i < cities->nb; i++) cities->sorted[i] = i;
+    g_sort_cities = cities;
+    qsort(cities->sorted, cities->nb, sizeof(*cities->sorted), name_cmp);
+    g_sort_cities = NULL;
+
+    // Counting sort of the cities by cell.
+    cities->cells = calloc(GRID_W * GRID_H + 1, sizeof(*cities->cells));
+    cities->cells_cities = calloc(cities->nb, sizeof(*cities->cells_cities));
+    count = calloc(GRID_W * GRID_H, sizeof(*count));
+    for (i = 0; i < cities->nb; i++) {
+        cell = get_cell(cities->cities[i].latitude,
+                        cities->cities[i].longitude);
+        cities->cells[cell + 1]++;
+    }
+    for (i = 0; i < GRID_W * GRID_H; i++)
+        cities->cells[i + 1] += cities->cells[i];
+    for (i = 0; i < cities->nb; i++) {
+        cell = get_cell(cities->cities[i].latitude,
+                        cities->cities[i].longitude);
+        cities->cells_cities[cities->cells[cell] + count[cell]++] = i;
+    }
+    free(count);
+}
+
+// Parse the geonames data and build the indexes.
+static int cities_parse(cities_t *cities, const char *data, int size)
+{
+    char *buf, *line, *end, *fields[19];
+    int capacity = 0, nb_err = 0;
+    city_t *city;
+
+    buf = strndup(data, size);
+    for (line = buf; line && *line; line = end) {
+        end = strchr(line, '\n');
+        if (end) *end++ = '\0';
+        if (!*line || *line == '#') continue;
+        if (split_fields(line, fields, 19) < 18) {
+            nb_err++;
+            continue;
+        }
+        if (cities->nb >= capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            cities->cities = realloc(cities->cities,
+                                     capacity * sizeof(*cities->cities));
+        }
+        city = &cities->cities[cities->nb++];
+        memset(city, 0, sizeof(*city));
+        city->name = strdup(fields[1]);
+        city->ascii_name = strdup(*fields[2] ? fields[2] : fields[1]);
+        city->latitude = atof(fields[4]) * DD2R;
+        city->longitude = atof(fields[5]) * DD2R;
+        snprintf(city->country_code, sizeof(city->country_code), "%s",
+                 fields[8]);
+        city->population = atoi(fields[14]);
+        // Use the elevation if set, otherwise the digital model one.
+        city->elevation = atof(*fields[15] ? fields[15] : fields[16]);
+        city->timezone = strdup(fields[17]);
+    }
+    free(buf);
+    if (nb_err) LOG_W("Cities data got %d error lines.", nb_err);
+    cities_build_index(cities);
+    return 0;
+}
+
+/*
+ * Check the cities of all the cells that can contain a city closer than a
+ * given distance from a point.
+ */
+static void search_cells(const cities_t *cities, double lat, double lon,
+                         double radius, int *best, double *best_dist)
+{
+    int row, row0, row1, col, col0, col1, c, i, idx;
+    const city_t *city;
+    double dist, dlon;
+
+    row0 = clamp(floor((lat - radius + M_PI / 2) / GRID_STEP), 0, GRID_H - 1);
+    row1 = clamp(floor((lat + radius + M_PI / 2) / GRID_STEP), 0, GRID_H - 1);
+    // Longitude extent of the cap, all around if it contains a pole.
+    col0 = 0;
+    col1 = GRID_W - 1;
+    if (radius < M_PI / 2 - fabs(lat)) {
+        dlon = asin(sin(radius) / cos(lat));
+        col0 = floor((eraAnp(lon) - dlon) / GRID_STEP);
+        col1 = floor((eraAnp(lon) + dlon) / GRID_STEP);
+        if (col1 - col0 >= GRID_W) col1 = col0 + GRID_W - 1;
+    }
+
+    for (row = row0; row <= row1; row++)
+    for (col = col0; col <= col1; col++) {
+        c = row * GRID_W + (col + GRID_W) % GRID_W;
+        for (i = cities->cells[c]; i < cities->cells[c + 1]; i++) {
+            idx = cities->cells_cities[i];
+            city = &cities->cities[idx];
+            dist = eraSeps(lon, lat, city->longitude, city->latitude);
+            if (dist >= *best_dist) continue;
+            *best_dist = dist;
+            *best = idx;
+        }
+    }
+}
+
+/*
+ * Return the index of the nearest city from a location, or -1 if there are
+ * no cities.
+ */
+static int cities_get_nearest(const cities_t *cities, double lat, double lon)
+{
+    int best = -1;
+    double radius, best_dist = INFINITY;
+
+    if (!cities->nb) return -1;
+    // Grow the search area until we find a city, then check all the cells
+    // that could contain a closer one.
+    for (radius = GRID_STEP; best == -1; radius *= 2)
+        search_cells(cities, lat, lon, radius, &best, &best_dist);
+    search_cells(cities, lat, lon, best_dist, &best, &best_dist);
+    return best;
+}
+
+/*
+ * Get the cities whose ascii name starts with a given prefix (case
+ * insensitive), in alphabetical order.
+ *
+ * Return the number of cities put in the out array.
+ */
+static int cities_search(const cities_t *cities, const char *prefix,
+                         int max, int *out)
+{
+    int lo = 0, hi = cities->nb, mid, nb = 0, len = strlen(prefix);
+    const city_t *city;
+
+    // Lower bound of the prefix in the sorted names.
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        city = &cities->cities[cities->sorted[mid]];
+        if (strncasecmp(city->ascii_name, prefix, len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    for (; lo < cities->nb && nb < max; lo++) {
+        city = &cities->cities[cities->sorted[lo]];
+        if (strncasecmp(city->ascii_name, prefix, len) != 0) break;
+        out[nb++] = cities->sorted[lo];
+    }
+    return nb;
+}
+
+static json_value *city_to_json(const city_t *city)
+{
+    json_value *ret = json_object_new(0);
+    json_object_push(ret, "name", json_string_new(city->name));
+    json_object_push(ret, "country_code",
+                     json_string_new(city->country_code));
+    json_object_push(ret, "timezone", json_string_new(city->timezone));
+    json_object_push(ret, "latitude", json_double_new(city->latitude));
+    json_object_push(ret, "longitude", json_double_new(city->longitude));
+    json_object_push(ret, "elevation", json_double_new(city->elevation));
+    json_object_push(ret, "population",
+                     json_integer_new(city->population));
+    return ret;
+}
+
+static int cities_add_data_source(
+        obj_t *obj, const char *url, const char *key)
+{
+    cities_t *cities = (void*)obj;
+    if (strcmp(key, "cities") != 0) return -1;
+    free(cities->source_url);
+    cities->source_url = strdup(url);
+    return 0;
+}
+
+static int cities_update(obj_t *obj, double dt)
+{
+    cities_t *cities = (void*)obj;
+    const char *data;
+    int size, code;
+
+    if (cities->parsed || !cities->source_url) return 0;
+    data = asset_get_data2(cities->source_url, ASSET_USED_ONCE, &size, &code);
+    if (!code) return 0; // Still loading.
+    cities->parsed = true;
+    if (!data) {
+        LOG_E("Cannot load cities data: %s (%d)", cities->source_url, code);
+        return 0;
+    }
+    cities_parse(cities, data, size);
+    asset_release(cities->source_url);
+    LOG_I("Parsed %d cities", cities->nb);
+    return 0;
+}
+
+/*
+ * Function: search
+ * Search the cities by name prefix.
+ *
+ * Arguments:
+ *   prefix - Start of the city ascii name, case insensitive.
+ *   max    - Max number of results, default to 10.
+ *
+ * Return:
+ *   An array of {name, country_code, timezone, latitude, longitude,
+ *   elevation, population}, with the angles in radian.
+ */
+static json_value *cities_fn_search(
+        obj_t *obj, const attribute_t *attr, const json_value *args)
+{
+    const cities_t *cities = (void*)obj;
+    const char *prefix = json_get_attr_s(args, "prefix");
+    int i, nb, max = json_get_attr_i(args, "max", 10);
+    int *idx;
+    json_value *ret = json_array_new(0);
+
+    if (!prefix || max <= 0) return ret;
+    idx = calloc(max, sizeof(*idx));
+    nb = cities_search(cities, prefix, max, idx);
+    for (i = 0; i < nb; i++)
+        json_array_push(ret, city_to_json(&cities->cities[idx[i]]));
+    free(idx);
+    return ret;
+}
+
+/*
+ * Function: nearest
+ * Get the nearest city from a location.
+ *
+ * Arguments:
+ *   latitude, longitude - Location in radian, default to the observer's.
+ *
+ * Return:
+ *   The city, in the same format as the search function, or null.
+ */
+static json_value *cities_fn_nearest(
+        obj_t *obj, const attribute_t *attr, const json_value *args)
+{
+    const cities_t *cities = (void*)obj;
+    double lat = json_get_attr_f(args, "latitude", core->observer->phi);
+    double lon = json_get_attr_f(args, "longitude", core->observer->elong);
+    int idx = cities_get_nearest(cities, lat, lon);
+    if (idx == -1) return json_null_new();
+    return city_to_json(&cities->cities[idx]);
+}
+
+/*
+ * Meta class declarations.
+ */
+
+static obj_klass_t cities_klass = {
+    .id             = "cities",
+    .size           = sizeof(cities_t),
+    .flags          = OBJ_IN_JSON_TREE | OBJ_MODULE,
+    .add_data_source = cities_add_data_source,
+    .update         = cities_update,
+    .attributes     = (attribute_t[]) {
+        FUNCTION(search, .fn = cities_fn_search),
+        FUNCTION(nearest, .fn = cities_fn_nearest),
+        {}
+    },
+};
+OBJ_REGISTER(cities_klass)
+
+#if COMPILE_TESTS
+
+static void test_cities(void)
+{
+    cities_t cities = {};
+    int idx[4], nb, i;
+    const char *data =
+        "1\tParis\tParis\t\t48.85341\t2.3488\tP\tPPLC\tFR\t\t11\t75\t\t\t"
+            "2138551\t\t42\tEurope/Paris\t2020-01-01\n"
+        "2\tParamaribo\tParamaribo\t\t5.86638\t-55.16682\tP\tPPLC\tSR\t\t"
+            "16\t\t\t\t223757\t\t3\tAmerica/Paramaribo\t2020-01-01\n"
+        "3\tTaipei\tTaipei\t\t25.04776\t121.53185\tP\tPPLC\tTW\t\t03\t\t"
+            "\t\t7871900\t\t10\tAsia/Taipei\t2020-01-01\n"
+        "4\tSuva\tSuva\t\t-18.14161\t178.44149\tP\tPPLC\tFJ\t\t01\t\t\t\t"
+            "77366\t\t5\tPacific/Fiji\t2020-01-01\n";
+
+    cities_parse(&cities, data, strlen(data));
+    assert(cities.nb == 4);
+
+    nb = cities_search(&cities, "pa", 4, idx);
+    assert(nb == 2);
+    assert(strcmp(cities.cities[idx[0]].name, "Paramaribo") == 0);
+    assert(strcmp(cities.cities[idx[1]].name, "Paris") == 0);
+    assert(cities_search(&cities, "x", 4, idx) == 0);
+
+    // Versailles.
+    i = cities_get_nearest(&cities, 48.8 * DD2R, 2.13 * DD2R);
+    assert(strcmp(cities.cities[i].name, "Paris") == 0);
+    assert(cities.cities[i].elevation == 42);
+    // Across the antimeridian.
+    i = cities_get_nearest(&cities, -17 * DD2R, -179 * DD2R);
+    assert(strcmp(cities.cities[i].name, "Suva") == 0);
+    // Far from any city.
+    i = cities_get_nearest(&cities, -89 * DD2R, 0);
+    assert(strcmp(cities.cities[i].name, "Suva") == 0);
+
+    for (i = 0; i < cities.nb; i++) {
+        free(cities.cities[i].name);
+        free(cities.cities[i].ascii_name);
+        free(cities.cities[i].timezone);
+    }
+    free(cities.cities);
+    free(cities.sorted);
+    free(cities.cells);
+    free(cities.cells_cities);
+}
+
+TEST_REGISTER(NULL, test_cities, TEST_AUTO);
+
+#endif
@@ -74,6 +74,19 @@ typedef struct {
     char    *source_url;
     bool    parsed; // Set to true once the data has been parsed.
     regex_t search_reg;
+
+    // State of the data parsing, done over several frames.
+    struct {
+        char        *data;
+        int         size;
+        bool        is_mpc;
+        const char  *line;
+        int         len;
+        int         line_idx;
+        int         nb;
+        int         nb_err;
+        double      last_epoch;
+    } parser;
     bool    visible;
     // Hints/labels magnitude offset
     double hints_mag_offset;
@@ -160,107 +173,98 @@ static int comet_init(obj_t *obj, json_value *args)
     return 0;
 }
 
-static int load_data_mpc(comets_t *comets, const char *data, int size,
-                         double *last_epoch)
+// Set the history values for the historical comets, where we change the h
+// and g values around a peak date.  Only support Neowise for the moment.
+static void comet_set_history(comet_t *comet)
+{
+    if (strcmp(comet->name, "C/2020 F3 (NEOWISE)") == 0) {
+        comet->history = (typeof(comet->history)) {
+            .time = date2mjd(2020, 7, 3),
+            .duration = 30,
+            .peak_vmag = 1,
+            .h = 7.5,
+            .g = 5.2,
+        };
+    }
+}
+
+static comet_t *load_mpc_line(comets_t *comets, const char *line, int len,
+                              double *epoch)
 {
     comet_t *comet;
-    int num, nb_err = 0, len, line_idx = 0, r, nb;
-    double peri_time, peri_dist, e, peri, node, i, epoch, h, g;
-    const char *line = NULL;
+    int num, r;
+    double peri_time, peri_dist, e, peri, node, i, h, g;
     char orbit_type;
     char desgn[64];
-    obj_t *tmp;
-
-    while (iter_lines(data, size, &line, &len)) {
-        line_idx++;
-        r = mpc_parse_comet_line(
-                line, len, &num, &orbit_type, &peri_time, &peri_dist, &e,
-                &peri, &node, &i, &epoch, &h, &g, desgn);
-        if (r) {
-            nb_err++;
-            continue;
-        }
-
-        comet = (void*)module_add_new(&comets->obj, "mpc_comet", NULL);
-        comet->num = num;
-        comet->h = h;
-        comet->g = g;
-        comet->orbit.d = peri_time;
-        comet->orbit.i = i * DD2R;
-        comet->orbit.o = node * DD2R;
-        comet->orbit.w = peri * DD2R;
-        comet->orbit.q = peri_dist;
-        comet->orbit.e = e;
-        strncpy(comet->obj.type, orbit_type_to_otype(orbit_type), 4);
-        snprintf(comet->name, sizeof(comet->name), "%s", desgn);
-        comet->pvo[0][0] = NAN;
-        *last_epoch = fmax(epoch, *last_epoch);
-
-        // Check for historical comets, where we change the h and g values
-        // around a peak date.  Only support Neowise for the moment.
-        if (strcmp(desgn, "C/2020 F3 (NEOWISE)") == 0) {
-            comet->history = (typeof(comet->history)) {
-                .time = date2mjd(2020, 7, 3),
-                .duration = 30,
-                .peak_vmag = 1,
-                .h = 7.5,
-                .g = 5.2,
-            };
-        }
-    }
 
-    if (nb_err) {
-        LOG_W("Comet data got %d error lines.", nb_err);
-    }
-    DL_COUNT(comets->obj.children, tmp, nb);
-    return nb;
+    r = mpc_parse_comet_line(
+            line, len, &num, &orbit_type, &peri_time, &peri_dist, &e,
+            &peri, &node, &i, epoch, &h, &g, desgn);
+    if (r) return NULL;
+
+    comet = (void*)module_add_new(&comets->obj, "mpc_comet", NULL);
+    comet->num = num;
+    comet->h = h;
+    comet->g = g;
+    comet->orbit.d = peri_time;
+    comet->orbit.i = i * DD2R;
+    comet->orbit.o = node * DD2R;
+    comet->orbit.w = peri * DD2R;
+    comet->orbit.q = peri_dist;
+    comet->orbit.e = e;
+    strncpy(comet->obj.type, orbit_type_to_otype(orbit_type), 4);
+    snprintf(comet->name, sizeof(comet->name), "%s", desgn);
+    comet->pvo[0][0] = NAN;
+    return comet;
 }
 
-static int load_data_stel_jsonl(
-        const char *url, comets_t *comets, const char *data, int size,
-        double *last_epoch)
+static comet_t *load_stel_jsonl_line(comets_t *comets, const char *line,
+                                     int len, double *epoch)
 {
-    const char *line = NULL;
-    char *uncompressed_data;
     comet_t *comet;
-    int len, line_idx = 0, nb = 0;
     json_value *json;
 
-    uncompressed_data = z_uncompress_gz(data, size, &size);
-    if (!uncompressed_data) {
-        LOG_E("Cannot uncompress gz file: %s", url);
-        return -1;
-    }
-    data = uncompressed_data;
-    *last_epoch = 0;
-    while (iter_lines(data, size, &line, &len)) {
-        line_idx++;
-        json = json_parse(line, len);
-        if (!json) goto error;
-        comet = (void*)module_add_new(&comets->obj, "mpc_comet", json);
-        json_value_free(json);
-        if (!comet) goto error;
-        *last_epoch = fmax(*last_epoch, comet->epoch);
-        nb++;
-
-        // Check for historical comets, where we change the h and g values
-        // around a peak date.  Only support Neowise for the moment.
-        if (strcmp(comet->name, "C/2020 F3 (NEOWISE)") == 0) {
-            comet->history = (typeof(comet->history)) {
-                .time = date2mjd(2020, 7, 3),
-                .duration = 30,
-                .peak_vmag = 1,
-                .h = 7.5,
-                .g = 5.2,
-            };
-        }
+    json = json_parse(line, len);
+    if (!json) return NULL;
+    comet = (void*)module_add_new(&comets->obj, "mpc_comet", json);
+    json_value_free(json);
+    if (!comet) return NULL;
+    *epoch = comet->epoch;
+    return comet;
+}
 
-        continue;
-error:
-        LOG_E("Cannot create comet from %s:%d", url, line_idx);
+/*
+ * Parse at most nb_max lines of the comets data.
+ *
+ * Return true once all the data has been parsed.
+ */
+static bool load_data(comets_t *comets, int nb_max)
+{
+    typeof(comets->parser) *p = &comets->parser;
+    comet_t *comet;
+    double epoch;
+    int i;
+
+    for (i = 0; i < nb_max; i++) {
+        if (!iter_lines(p->data, p->size, &p->line, &p->len)) return true;
+        p->line_idx++;
+        epoch = 0;
+        if (p->is_mpc)
+            comet = load_mpc_line(comets, p->line, p->len, &epoch);
+        else
+            comet = load_stel_jsonl_line(comets, p->line, p->len, &epoch);
+        if (!comet) {
+            if (!p->is_mpc)
+                LOG_E("Cannot create comet from %s:%d", comets->source_url,
+                      p->line_idx);
+            p->nb_err++;
+            continue;
+        }
+        comet_set_history(comet);
+        p->last_epoch = fmax(p->last_epoch, epoch);
+        p->nb++;
     }
-    free(uncompressed_data);
-    return nb;
+    return false;
 }
 
 static void comet_get_h_g(const comet_t *comet, double tt, double *h, double *g)
@@ -277,7 +281,14 @@ static void comet_get_h_g(const comet_t *comet, double tt, double *h, double *g)
     *g = mix(comet->g, comet->history.g, k);
 }
 
-static int comet_update(comet_t *comet, const observer_t *obs)
+/*
+ * Compute the comet apparent position and magnitude for a given observer.
+ *
+ * This only reads the comet data, so that the info queries can be run
+ * without modifying the object.
+ */
+static void comet_compute(const comet_t *comet, const observer_t *obs,
+                          double pvo[2][4], double *vmag)
 {
     double a, p, n, ph[2][3], pv[2][3], or, sr, b, v, w, r, o, u, i, h, g;
     const double K = 0.01720209895; // AU, day
@@ -318,19 +329,24 @@ static int comet_update(comet_t *comet, const observer_t *obs)
 
     vec3_set(ph[1], 0, 0, 0);
     position_to_apparent(obs, ORIGIN_HELIOCENTRIC, false, ph, pv);
-    vec3_copy(pv[0], comet->pvo[0]);
-    comet->pvo[0][3] = 1;
-    vec3_copy(pv[1], comet->pvo[1]);
-    comet->pvo[1][3] = 0;
+    vec3_copy(pv[0], pvo[0]);
+    pvo[0][3] = 1;
+    vec3_copy(pv[1], pvo[1]);
+    pvo[1][3] = 0;
 
     // Compute vmag.
     // We use the g,k model: m = g + 5*log10(D) + 2.5*k*log10(r)
     // (http://www.clearskyinstitute.com/xephem/help/xephem.html)
     // XXX: probably better to switch to the same model as for asteroids.
     sr = vec3_norm(ph[0]);
-    or = vec3_norm(comet->pvo[0]);
+    or = vec3_norm(pvo[0]);
     comet_get_h_g(comet, obs->tt, &h, &g);
-    comet->vmag = h + 5 * log10(or) + 2.5 * g * log10(sr);
+    *vmag = h + 5 * log10(or) + 2.5 * g * log10(sr);
+}
+
+static int comet_update(comet_t *comet, const observer_t *obs)
+{
+    comet_compute(comet, obs, comet->pvo, &comet->vmag);
     return 0;
 }
 
@@ -338,16 +354,18 @@ static int comet_get_info(const obj_t *obj, const observer_t *obs, int info,
                           void *out)
 {
     const comet_t *comet = (const comet_t*)obj;
-    comet_update((comet_t*)comet, obs);
+    double pvo[2][4], vmag;
+
+    comet_compute(comet, obs, pvo, &vmag);
     switch (info) {
     case INFO_PVO:
-        memcpy(out, comet->pvo, sizeof(comet->pvo));
+        memcpy(out, pvo, sizeof(pvo));
         return 0;
     case INFO_VMAG:
-        *(double*)out = comet->vmag;
+        *(double*)out = vmag;
         return 0;
     case INFO_SEARCH_VMAG:
-        *(double*)out = fmin(comet->vmag, comet->history.peak_vmag ?: DBL_MAX);
+        *(double*)out = fmin(vmag, comet->history.peak_vmag ?: DBL_MAX);
         return 0;
     }
     return 1;
@@ -377,7 +395,7 @@ static void compute_tail_size(double H, double K, double r,
 }
 
 // Rotate a matrix to make the Y axis point toward a given position.
-static void mat_rotate_y_toward(double mat[4][4], double dir[3])
+static void mat_rotate_y_toward(double mat[4][4], const double dir[3])
 {
     double rot[4][4] = MAT4_IDENTITY;
     vec3_set(rot[0], 1, 0, 0);
@@ -388,25 +406,17 @@ static void mat_rotate_y_toward(double mat[4][4], double dir[3])
     mat4_mul(mat, rot, mat);
 }
 
-static void render_tail(comet_t *comet, const painter_t *painter, int tail)
+static void render_tail(const comet_t *comet, const painter_t *painter,
+                        int tail, const double ph[3], double l, double d)
 {
     double model_mat[4][4] = MAT4_IDENTITY;
-    double ph[3], rh, l, d, angle, point, dir[3], curvature = 0, h, g;
+    double angle, point, dir[3], curvature = 0;
     double color[4], lum_apparent, ld;
     json_value *args, *uniforms;
 
-    vec3_sub(comet->pvo[0], painter->obs->sun_pvo[0], ph);
-    rh = vec3_norm(ph);
-    comet_get_h_g(comet, painter->obs->tt, &h, &g);
-    compute_tail_size(h, g, rh, &l, &d);
-    mat4_itranslate(model_mat, VEC3_SPLIT(comet->pvo[0]));
-
     switch (tail) {
     case TAIL_GAS:
         vec4_set(color, 0.15, 0.35, 0.6, 0.25);
-        mat_rotate_y_toward(model_mat, ph);
-        // Rotate along axis so that both tails don't look exactly the same.
-        mat4_ry(M_PI / 2, model_mat, model_mat);
         break;
     case TAIL_DUST:
         // Empirical size adjustement to the dust tail size.
@@ -414,8 +424,6 @@ static void render_tail(comet_t *comet, const painter_t *painter, int tail)
         l *= 0.6;
         curvature = -M_PI;
         vec4_set(color, 0.7, 0.7, 0.4, 1.0);
-        vec3_addk(ph, comet->pvo[1], -5, dir);
-        mat_rotate_y_toward(model_mat, dir);
         break;
     }
 
@@ -433,6 +441,20 @@ static void render_tail(comet_t *comet, const painter_t *painter, int tail)
     color[3] *= smoothstep(1000, 100, point);
     if (color[3] <= 0.0) return;
 
+    // Only compute the model matrix if the tail is visible.
+    mat4_itranslate(model_mat, VEC3_SPLIT(comet->pvo[0]));
+    switch (tail) {
+    case TAIL_GAS:
+        mat_rotate_y_toward(model_mat, ph);
+        // Rotate along axis so that both tails don't look exactly the same.
+        mat4_ry(M_PI / 2, model_mat, model_mat);
+        break;
+    case TAIL_DUST:
+        vec3_addk(ph, comet->pvo[1], -5, dir);
+        mat_rotate_y_toward(model_mat, dir);
+        break;
+    }
+
     // Translate to put the orgin in the middle of the coma.
     mat4_itranslate(model_mat, 0, -0.0001, 0);
     mat4_iscale(model_mat, d / 2, l, d / 2);
@@ -449,6 +471,19 @@ static void render_tail(comet_t *comet, const painter_t *painter, int tail)
     json_builder_free(args);
 }
 
+// Render both tails of a comet, sharing the tail size computation.
+static void render_tails(const comet_t *comet, const painter_t *painter)
+{
+    double ph[3], rh, l, d, h, g;
+
+    vec3_sub(comet->pvo[0], painter->obs->sun_pvo[0], ph);
+    rh = vec3_norm(ph);
+    comet_get_h_g(comet, painter->obs->tt, &h, &g);
+    compute_tail_size(h, g, rh, &l, &d);
+    render_tail(comet, painter, TAIL_GAS, ph, l, d);
+    render_tail(comet, painter, TAIL_DUST, ph, l, d);
+}
+
 
 // Note: return 1 if the comet is actually visible on screen.
 static int comet_render(obj_t *obj, const painter_t *painter)
@@ -498,8 +533,7 @@ static int comet_render(obj_t *obj, const painter_t *painter)
     }
 
     if (size > 1) {
-        render_tail(comet, painter, TAIL_GAS);
-        render_tail(comet, painter, TAIL_DUST);
+        render_tails(comet, painter);
     }
     return 1;
 }
@@ -526,41 +560,74 @@ static int comets_add_data_source(
     return 0;
 }
 
+/*
+ * Function: comets_parse_task
+ * Cooperative task that creates the comets from the source data.
+ *
+ * We parse the lines by small groups, until the frame tasks budget is
+ * used, so that we don't block the rendering while we create all the
+ * comets.
+ */
+static int comets_parse_task(task_t *task, double dt)
+{
+    comets_t *comets = task->user;
+    typeof(comets->parser) *p = &comets->parser;
+    char buf[128];
+    // Number of lines we parse between two yield checks.
+    const int parse_nb = 16;
+
+    while (!load_data(comets, parse_nb)) {
+        if (core_task_should_yield(task)) return 0;
+    }
+    comets->parsed = true;
+    free(p->data);
+    p->data = NULL;
+
+    if (p->is_mpc && p->nb_err)
+        LOG_W("Comet data got %d error lines.", p->nb_err);
+    LOG_I("Parsed %d comets (latest epoch: %s)", p->nb,
+          format_time(buf, p->last_epoch, 0, "YYYY-MM-DD"));
+    if (p->last_epoch < unix_to_mjd(sys_get_unix_time()) - 4)
+        LOG_W("Warning: comets data seems outdated.");
+
+#if DEBUG
+    // Make sure the search work.
+    obj_t *obj = core_search("NAME C/1995 O1 (Hale-Bopp)");
+    assert(obj && strcmp(obj->klass->id, "mpc_comet") == 0);
+    obj = core_search("NAME 1P/Halley");
+    assert(obj && strcmp(obj->klass->id, "mpc_comet") == 0);
+#endif
+    return 1;
+}
+
 static int comets_update(obj_t *obj, double dt)
 {
-    int size, code, nb;
+    int size, code, flags;
     const char *data;
     comets_t *comets = (void*)obj;
-    double last_epoch = 0;
-    char buf[128];
+    typeof(comets->parser) *p = &comets->parser;
 
-    if (comets->parsed || !comets->source_url)
+    // Nothing to do once the parsing task has started.
+    if (comets->parsed || !comets->source_url || p->data)
         return 0;
 
-    data = asset_get_data2(comets->source_url, ASSET_USED_ONCE, &size, &code);
+    // The jsonl data is gz compressed, let the assets manager uncompress
+    // it in a worker.
+    p->is_mpc = strstr(comets->source_url, ".txt");
+    flags = ASSET_USED_ONCE | (p->is_mpc ? 0 : ASSET_GZ | ASSET_ASYNC);
+    data = asset_get_data2(comets->source_url, flags, &size, &code);
     if (!code) return 0; // Still loading.
-    comets->parsed = true;
     if (!data) {
         LOG_E("Cannot load comets data: %s (%d)", comets->source_url, code);
+        comets->parsed = true;
         return 0;
     }
-
-    if (strstr(comets->source_url, ".txt"))
-        nb = load_data_mpc(comets, data, size, &last_epoch);
-    else
-        nb = load_data_stel_jsonl(comets->source_url, comets, data, size,
-                                  &last_epoch);
-
-    LOG_I("Parsed %d comets (latest epoch: %s)", nb,
-          format_time(buf, last_epoch, 0, "YYYY-MM-DD"));
-    if (last_epoch < unix_to_mjd(sys_get_unix_time()) - 4)
-        LOG_W("Warning: comets data seems outdated.");
-
-    // Make sure the search work.
-    obj = core_search("NAME C/1995 O1 (Hale-Bopp)");
-    assert(obj && strcmp(obj->klass->id, "mpc_comet") == 0);
-    obj = core_search("NAME 1P/Halley");
-    assert(obj && strcmp(obj->klass->id, "mpc_comet") == 0);
+    // Keep a copy of the data, since we parse it over several frames.
+    p->data = calloc(1, size + 1);
+    memcpy(p->data, data, size);
+    p->size = size;
+    asset_release(comets->source_url);
+    core_add_task2(comets_parse_task, comets, TASK_PRIORITY_NORMAL);
     return 0;
 }
 
@@ -10,6 +10,13 @@
 #include "swe.h"
 #include <zlib.h> // For crc32.
 
+// Max angular length of the segments of the tessellated boundaries.
+#define BOUNDS_STEP (0.5 * DD2R)
+
+// Size of the illustrations atlas pages, and padding around each image.
+#define ATLAS_SIZE 2048
+#define ATLAS_PADDING 2
+
 /*
  * Enum of the label display styles.
  */
@@ -41,12 +48,26 @@ typedef struct constellation {
         int         nb_stars;
         obj_t       **stars;
         double      (*stars_pos)[3]; // ICRF/observer pos for all stars.
+        double      *stars_mag; // Vmag of all the stars.
         double      cap[4];  // Bounding cap of the lines (ICRF).
     } lines;
 
+    // Boundaries tessellated in ICRF, created at the first render.
+    struct {
+        double      (*points)[3];
+        struct {
+            int     start;
+            int     size;
+            double  cap[4]; // Bounding cap of the edge (ICRF).
+        } *edges;
+    } bounds;
+
     // Texture and associated transformation matrix.
     struct {
-        texture_t   *tex;
+        char        *url;   // Url of the image, NULL if there is none.
+        texture_t   *tex;   // Atlas page, set once the image is packed.
+        double      uv[3][3]; // Image uv to atlas page uv.
+        bool        failed; // Set if we couldn't load the image.
         anchor_t    anchors[3];
         obj_t       *anchors_stars[3];
         double      mat[3][3];
@@ -80,6 +101,8 @@ typedef struct constellations {
     bool        lines_animation;
     bool        show_only_pointed;
     double      illustrations_bscale;
+    // Set to load the images even when they are hidden (during the tours).
+    bool        prefetch_images;
 } constellations_t;
 
 static int constellation_update(constellation_t *con, const observer_t *obs);
@@ -131,7 +154,7 @@ static void constellation_set_image(obj_t *obj)
     char path[1024];
     const constellation_infos_t *a = &cons->info;
 
-    if (cons->img.tex) return; // Already set.
+    if (cons->img.url) return; // Already set.
     if (!*a->img) return;
 
     vec2_copy(a->anchors[0].uv, cons->img.anchors[0].uv);
@@ -142,8 +165,7 @@ static void constellation_set_image(obj_t *obj)
     cons->img.anchors[2].hip = a->anchors[2].hip;
 
     join_path(cons->info.base_path, cons->info.img, path, sizeof(path));
-    cons->img.tex = texture_from_url(path, TF_LAZY_LOAD);
-    assert(cons->img.tex);
+    cons->img.url = strdup(path);
 
     cons->image_loaded_fader.target = false;
     cons->image_loaded_fader.value = 0;
@@ -210,9 +232,11 @@ static int constellation_create_stars(constellation_t *cons)
     }
     cons->lines.stars_pos = calloc(cons->lines.nb_stars,
                                    sizeof(*cons->lines.stars_pos));
+    cons->lines.stars_mag = calloc(cons->lines.nb_stars,
+                                   sizeof(*cons->lines.stars_mag));
 
     // Also fetch the 3 stars for the image anchors if there is an illustration
-    if (!cons->img.tex) return 0;
+    if (!cons->img.url) return 0;
 
     for (i = 0; i < 3; i++) {
         hip = cons->img.anchors[i].hip;
@@ -237,7 +261,11 @@ still_loading:
     for (i = 0; i < cons->info.nb_lines * 2; i++)
         obj_release(cons->lines.stars[i]);
     free(cons->lines.stars);
+    free(cons->lines.stars_pos);
+    free(cons->lines.stars_mag);
     cons->lines.stars = NULL;
+    cons->lines.stars_pos = NULL;
+    cons->lines.stars_mag = NULL;
     cons->lines.nb_stars = 0;
     for (i = 0; i < 3; i++) {
         obj_release(cons->img.anchors_stars[i]);
@@ -283,7 +311,7 @@ static void update_image_mat(constellation_t *cons, const observer_t *obs)
     double pvo[2][4];
     obj_t *star;
 
-    if (!cons->img.tex) return;
+    if (!cons->img.url) return;
     for (i = 0; i < 3; i++) {
         vec2_copy(cons->img.anchors[i].uv, uvs[i]);
         uvs[i][2] = 1.0;
@@ -306,6 +334,8 @@ error:
     LOG_W("Cannot compute image for constellation %s", cons->info.id);
     texture_release(cons->img.tex);
     cons->img.tex = NULL;
+    free(cons->img.url);
+    cons->img.url = NULL;
 }
 
 // Make a line shorter so that we don't hide the star.
@@ -418,6 +448,8 @@ static int constellation_update(constellation_t *con, const observer_t *obs)
             if (!con->lines.stars[i]) continue;
             obj_get_pvo(con->lines.stars[i], obs, pvo);
             vec3_normalize(pvo[0], con->lines.stars_pos[i]);
+            obj_get_info(con->lines.stars[i], obs, INFO_VMAG,
+                         &con->lines.stars_mag[i]);
             vec3_add(pos, con->lines.stars_pos[i], pos);
         }
         if (!vec3_norm2(pos)) {
@@ -441,7 +473,7 @@ static int constellation_update(constellation_t *con, const observer_t *obs)
     }
 
     // If the constellation has no lines, it must have an illustration
-    if (con->lines.nb_stars == 0 && !con->img.tex) {
+    if (con->lines.nb_stars == 0 && !con->img.url) {
         con->error = true;
         LOG_E("Invalid constellation %s has no lines and no illustration",
               con->info.id);
@@ -491,7 +523,52 @@ static void spherical_project(
     mat3_mul_vec3(rnpb, out, out);
 }
 
-static int render_bounds(const constellation_t *con,
+/*
+ * Tessellate the boundaries into ICRF polylines once, so that we only have
+ * to rotate them to render.  The edges follow the B1875 meridians and
+ * parallels, so we cut them in segments of at most BOUNDS_STEP.
+ */
+static void constellation_create_bounds(constellation_t *con)
+{
+    const constellation_infos_t *info = &con->info;
+    int i, j, n, size = 0;
+    double line[2][2], lonlat[2], pos[4];
+
+    con->bounds.edges = calloc(info->nb_edges, sizeof(*con->bounds.edges));
+    for (i = 0; i < info->nb_edges; i++) {
+        memcpy(line, info->edges[i], sizeof(line));
+        if (line[1][0] < line[0][0]) line[1][0] += 2 * M_PI;
+        n = ceil(fmax(fabs(line[1][0] - line[0][0]) *
+                      cos((line[0][1] + line[1][1]) / 2),
+                      fabs(line[1][1] - line[0][1])) / BOUNDS_STEP);
+        con->bounds.edges[i].start = size;
+        con->bounds.edges[i].size = fmax(n, 1) + 1;
+        size += con->bounds.edges[i].size;
+    }
+    con->bounds.points = calloc(size, sizeof(*con->bounds.points));
+
+    for (i = 0; i < info->nb_edges; i++) {
+        memcpy(line, info->edges[i], sizeof(line));
+        if (line[1][0] < line[0][0]) line[1][0] += 2 * M_PI;
+        n = con->bounds.edges[i].size;
+        for (j = 0; j < n; j++) {
+            vec2_mix(line[0], line[1], (double)j / (n - 1), lonlat);
+            spherical_project(NULL, lonlat, pos);
+            vec3_copy(pos, con->bounds.points[con->bounds.edges[i].start + j]);
+        }
+        // Bounding cap of the edge, centered on its middle point.
+        vec2_mix(line[0], line[1], 0.5, lonlat);
+        spherical_project(NULL, lonlat, pos);
+        vec3_copy(pos, con->bounds.edges[i].cap);
+        con->bounds.edges[i].cap[3] = 1.0;
+        for (j = 0; j < n; j++) {
+            cap_extends(con->bounds.edges[i].cap,
+                        con->bounds.points[con->bounds.edges[i].start + j]);
+        }
+    }
+}
+
+static int render_bounds(constellation_t *con,
                          const painter_t *painter_,
                          bool selected)
 {
@@ -522,12 +599,27 @@ static int render_bounds(const constellation_t *con,
     painter.lines.dash_length = 8;
     info = &con->info;
     if (!info) return 0;
+
+    // The cached polylines are not cut at the projection discontinuities,
+    // so in that case we still tessellate the edges every frame.
+    if (painter.proj->flags & PROJ_HAS_DISCONTINUITY) {
+        for (i = 0; i < info->nb_edges; i++) {
+            memcpy(line[0], info->edges[i][0], 2 * sizeof(double));
+            memcpy(line[1], info->edges[i][1], 2 * sizeof(double));
+            if (line[1][0] < line[0][0]) line[1][0] += 2 * M_PI;
+            paint_line(&painter, FRAME_ICRF, line, &map, 0,
+                       PAINTER_SKIP_DISCONTINUOUS);
+        }
+        return 0;
+    }
+
+    if (!con->bounds.edges) constellation_create_bounds(con);
     for (i = 0; i < info->nb_edges; i++) {
-        memcpy(line[0], info->edges[i][0], 2 * sizeof(double));
-        memcpy(line[1], info->edges[i][1], 2 * sizeof(double));
-        if (line[1][0] < line[0][0]) line[1][0] += 2 * M_PI;
-        paint_line(&painter, FRAME_ICRF, line, &map, 0,
-                   PAINTER_SKIP_DISCONTINUOUS);
+        if (painter_is_cap_clipped(&painter, FRAME_ICRF,
+                                   con->bounds.edges[i].cap))
+            continue;
+        paint_linestring(&painter, FRAME_ICRF, con->bounds.edges[i].size,
+                con->bounds.points + con->bounds.edges[i].start);
     }
     return 0;
 }
@@ -548,6 +640,7 @@ static bool constellation_lines_in_view(const constellation_t *con,
     int i, nb = 0;
     double (*pos)[4], mx, my;
     bool ret;
+    size_t mark;
     const double m = 100; // Border margins (windows unit).
 
     assert(con->first_update_complete);
@@ -559,7 +652,9 @@ static bool constellation_lines_in_view(const constellation_t *con,
         return false;
 
     // Clipping test.
-    pos = calloc(con->lines.nb_stars, sizeof(*pos));
+    mark = frame_alloc_mark();
+    pos = frame_alloc(con->lines.nb_stars * sizeof(*pos));
+    memset(pos, 0, con->lines.nb_stars * sizeof(*pos));
     for (i = 0; i < con->lines.nb_stars; i++) {
         if (!con->lines.stars[i]) continue;
         convert_frame(painter->obs, FRAME_ICRF, FRAME_VIEW, true,
@@ -568,7 +663,7 @@ static bool constellation_lines_in_view(const constellation_t *con,
         nb++;
     }
     if (nb == 0) {
-        free(pos);
+        frame_alloc_rewind(mark);
         return true;
     }
     // Compute margins in NDC.
@@ -578,7 +673,7 @@ static bool constellation_lines_in_view(const constellation_t *con,
     my = fmin(my, 0.5);
 
     ret = !is_clipped(con->lines.nb_stars, pos, mx, my);
-    free(pos);
+    frame_alloc_rewind(mark);
     return ret;
 }
 
@@ -601,7 +696,7 @@ static bool constellation_image_in_view(const constellation_t *con,
     assert(con->first_update_complete);
 
     // Check that the texture matrix is computed.
-    if (!con->img.tex) return false;
+    if (!con->img.url) return false;
 
     // First fast tests for the case when the constellation is not in the
     // screen at all.
@@ -632,10 +727,10 @@ static int render_lines(constellation_t *con, const painter_t *_painter,
 {
     painter_t painter = *_painter;
     int i;
+    size_t mark;
     double (*lines)[4];
     double lines_color[4];
-    double mag[2], radius[2], visible, opacity;
-    const observer_t *obs = painter.obs;
+    double radius[2], visible, opacity;
     const constellations_t *cons = (const constellations_t*)con->obj.parent;
 
     assert(con->first_update_complete);
@@ -653,7 +748,9 @@ static int render_lines(constellation_t *con, const painter_t *_painter,
     vec4_set(lines_color, 0.65, 1.0, 1.0, 0.4);
     vec4_emul(lines_color, painter.color, painter.color);
 
-    lines = calloc(con->lines.nb_stars, sizeof(*lines));
+    mark = frame_alloc_mark();
+    lines = frame_alloc(con->lines.nb_stars * sizeof(*lines));
+    memset(lines, 0, con->lines.nb_stars * sizeof(*lines));
     for (i = 0; i < con->lines.nb_stars; i++) {
         if (!con->lines.stars[i]) continue;
         vec3_copy(con->lines.stars_pos[i], lines[i]);
@@ -662,10 +759,8 @@ static int render_lines(constellation_t *con, const painter_t *_painter,
 
     for (i = 0; i < con->lines.nb_stars; i += 2) {
         if (!con->lines.stars[i + 0] || !con->lines.stars[i + 1]) continue;
-        obj_get_info(con->lines.stars[i + 0], obs, INFO_VMAG, &mag[0]);
-        obj_get_info(con->lines.stars[i + 1], obs, INFO_VMAG, &mag[1]);
-        core_get_point_for_mag(mag[0], &radius[0], NULL);
-        core_get_point_for_mag(mag[1], &radius[1], NULL);
+        core_get_point_for_mag(con->lines.stars_mag[i + 0], &radius[0], NULL);
+        core_get_point_for_mag(con->lines.stars_mag[i + 1], &radius[1], NULL);
         radius[0] = core_get_apparent_angle_for_point(painter.proj, radius[0]);
         radius[1] = core_get_apparent_angle_for_point(painter.proj, radius[1]);
         // Add some space, using ad-hoc formula.
@@ -687,7 +782,7 @@ static int render_lines(constellation_t *con, const painter_t *_painter,
                    PAINTER_SKIP_DISCONTINUOUS);
     }
 
-    free(lines);
+    frame_alloc_rewind(mark);
 
     return 0;
 }
@@ -720,19 +815,22 @@ static int render_img(constellation_t *con, const painter_t *painter_,
     painter.color[3] *= cons->illustrations_bscale;
     if (!painter.color[3]) return 0;
     // Skip if not ready yet.
-    if (!con->img.tex || !texture_load(con->img.tex, NULL)) return 0;
+    if (!con->img.tex) return 0;
 
     if (painter_is_cap_clipped(&painter, FRAME_ICRF, con->img.cap))
         return 0;
 
     con->image_loaded_fader.target = true;
 
-    painter.flags |= PAINTER_ADD;
+    // All the illustrations are rendered in a row, so the renderer can
+    // batch the ones that share an atlas page.
+    painter.flags |= PAINTER_ADD | PAINTER_ALLOW_REORDER;
     vec3_set(painter.color, 1, 1, 1);
     painter.color[3] *= (selected ? 0.6 : 0.3) * con->image_loaded_fader.value;
     mat3_copy(con->img.mat, map.mat);
     map.map = img_map;
-    painter_set_texture(&painter, PAINTER_TEX_COLOR, con->img.tex, NULL);
+    painter_set_texture(&painter, PAINTER_TEX_COLOR, con->img.tex,
+                        con->img.uv);
     paint_quad(&painter, FRAME_ICRF, &map, 4);
     return 0;
 }
@@ -915,8 +1013,8 @@ static int constellation_render(obj_t *obj, const painter_t *_painter)
 
     render_lines(con, &painter, selected);
     render_label(con, &painter, selected);
-    render_img(con, &painter, selected);
     render_bounds(con, &painter, selected);
+    // Note: the images are rendered by the module, after all the lines.
 
     return 0;
 }
@@ -934,11 +1032,15 @@ static void constellation_del(obj_t *obj)
     int i;
     constellation_t *con = (constellation_t*)obj;
     texture_release(con->img.tex);
+    free(con->img.url);
     for (i = 0; i < con->lines.nb_stars; i++) {
         obj_release(con->lines.stars[i]);
     }
     free(con->lines.stars);
     free(con->lines.stars_pos);
+    free(con->lines.stars_mag);
+    free(con->bounds.points);
+    free(con->bounds.edges);
 }
 
 static void constellation_get_2d_ellipse(const obj_t *obj,
@@ -984,6 +1086,8 @@ static int constellations_init(obj_t *obj, json_value *args)
     return 0;
 }
 
+static void atlas_update(constellations_t *cons);
+
 static int constellations_update(obj_t *obj, double dt)
 {
     constellation_t *con;
@@ -994,6 +1098,8 @@ static int constellations_update(obj_t *obj, double dt)
     fader_update(&cons->labels_visible, dt);
     fader_update(&cons->bounds_visible, dt);
 
+    if (cons->prefetch_images) atlas_update(cons);
+
     // Skip update if not visible.
     if (cons->lines_visible.value == 0.0 &&
         cons->images_visible.value == 0.0 &&
@@ -1008,6 +1114,150 @@ static int constellations_update(obj_t *obj, double dt)
     return 0;
 }
 
+// Copy an image into an RGBA atlas page.
+static void atlas_blit(uint8_t *page, const uint8_t *img, int w, int h,
+                       int bpp, int x, int y)
+{
+    int i, j, k;
+    uint8_t *dst;
+    const uint8_t *src;
+
+    for (i = 0; i < h; i++)
+    for (j = 0; j < w; j++) {
+        src = img + (i * w + j) * bpp;
+        dst = page + ((y + i) * ATLAS_SIZE + x + j) * 4;
+        for (k = 0; k < 3; k++) dst[k] = src[bpp < 3 ? 0 : k];
+        dst[3] = (bpp == 2 || bpp == 4) ? src[bpp - 1] : 255;
+    }
+}
+
+typedef struct {
+    constellation_t *con;
+    uint8_t         *img;
+    int             w, h, bpp;
+} atlas_image_t;
+
+static int atlas_image_cmp(const void *a, const void *b)
+{
+    return cmp(((const atlas_image_t*)b)->h, ((const atlas_image_t*)a)->h);
+}
+
+// Upload an atlas page and give it to all its images.
+static void atlas_add_page(uint8_t *page, int page_h,
+                           atlas_image_t *images, int n)
+{
+    int i, w, h;
+    texture_t *tex;
+
+    // Only keep the used part of the page.
+    for (h = 1; h < page_h; h *= 2) {}
+    tex = texture_from_data(page, ATLAS_SIZE, ATLAS_SIZE, 4,
+                            0, 0, ATLAS_SIZE, h, TF_KEEP_DATA);
+    for (i = 0; i < n; i++) {
+        // Skip the images too large for the atlas.
+        if (images[i].con->img.tex) continue;
+        images[i].con->img.tex = tex;
+        texture_retain(tex);
+        w = images[i].w;
+        // The uv matrix is set to the image position in the page by the
+        // packing, we only need to normalize it by the page height.
+        images[i].con->img.uv[1][1] = (double)images[i].h / h;
+        images[i].con->img.uv[2][1] /= h;
+        images[i].con->img.uv[0][0] = (double)w / ATLAS_SIZE;
+        images[i].con->img.uv[2][0] /= ATLAS_SIZE;
+    }
+    texture_release(tex);
+}
+
+/*
+ * Pack all the loaded illustrations into a few atlas textures, so that the
+ * renderer can draw them with a handful of draw calls.
+ *
+ * We wait for all the images of the constellations to be loaded, then do
+ * a simple shelf packing, with the images sorted by height.  The images
+ * too large for an atlas page get their own texture.
+ */
+static void atlas_update(constellations_t *cons)
+{
+    constellation_t *con;
+    const void *data;
+    int size, code, n = 0, nb_pending = 0, i, start;
+    int x = 0, y = 0, shelf_h = 0;
+    atlas_image_t *images;
+    uint8_t *page = NULL;
+
+    MODULE_ITER(cons, con, "constellation") {
+        if (!con->img.url || con->img.tex || con->img.failed) continue;
+        data = asset_get_data(con->img.url, &size, &code);
+        if (!data && !code) nb_pending++;
+        if (!data && code) {
+            LOG_W("Cannot load constellation image %s", con->img.url);
+            con->img.failed = true;
+        }
+        if (data) n++;
+    }
+    if (nb_pending || !n) return;
+
+    images = calloc(n, sizeof(*images));
+    n = 0;
+    MODULE_ITER(cons, con, "constellation") {
+        if (!con->img.url || con->img.tex || con->img.failed) continue;
+        data = asset_get_data(con->img.url, &size, &code);
+        images[n].img = img_read_from_mem(data, size, &images[n].w,
+                                          &images[n].h, &images[n].bpp);
+        asset_release(con->img.url);
+        if (!images[n].img) {
+            LOG_W("Cannot read constellation image %s", con->img.url);
+            con->img.failed = true;
+            continue;
+        }
+        images[n++].con = con;
+    }
+    qsort(images, n, sizeof(*images), atlas_image_cmp);
+
+    for (i = 0, start = 0; i < n; i++) {
+        con = images[i].con;
+        if (images[i].w + 2 * ATLAS_PADDING > ATLAS_SIZE ||
+            images[i].h + 2 * ATLAS_PADDING > ATLAS_SIZE) {
+            con->img.tex = texture_from_data(images[i].img,
+                    images[i].w, images[i].h, images[i].bpp,
+                    0, 0, images[i].w, images[i].h, TF_KEEP_DATA);
+            mat3_set_identity(con->img.uv);
+            free(images[i].img);
+            images[i].img = NULL;
+            continue;
+        }
+        // New shelf, and new page if needed.
+        if (x + images[i].w + 2 * ATLAS_PADDING > ATLAS_SIZE) {
+            x = 0;
+            y += shelf_h;
+            shelf_h = 0;
+        }
+        if (page && y + images[i].h + 2 * ATLAS_PADDING > ATLAS_SIZE) {
+            atlas_add_page(page, y + shelf_h, images + start, i - start);
+            free(page);
+            page = NULL;
+        }
+        if (!page) {
+            page = calloc(ATLAS_SIZE * ATLAS_SIZE, 4);
+            x = y = shelf_h = 0;
+            start = i;
+        }
+        atlas_blit(page, images[i].img, images[i].w, images[i].h,
+                   images[i].bpp, x + ATLAS_PADDING, y + ATLAS_PADDING);
+        mat3_set_identity(con->img.uv);
+        con->img.uv[2][0] = x + ATLAS_PADDING;
+        con->img.uv[2][1] = y + ATLAS_PADDING;
+        x += images[i].w + 2 * ATLAS_PADDING;
+        shelf_h = fmax(shelf_h, images[i].h + 2 * ATLAS_PADDING);
+        free(images[i].img);
+        images[i].img = NULL;
+    }
+    if (page) atlas_add_page(page, y + shelf_h, images + start, n - start);
+    free(page);
+    free(images);
+}
+
 static int constellations_render(obj_t *obj, const painter_t *painter)
 {
     constellations_t *cons = (constellations_t*)obj;
@@ -1021,6 +1271,15 @@ static int constellations_render(obj_t *obj, const painter_t *painter)
     MODULE_ITER(obj, con, "constellation") {
         obj_render((obj_t*)con, painter);
     }
+
+    if (cons->images_visible.value == 0.0 &&
+        (!core->selection || core->selection->parent != obj)) return 0;
+    atlas_update(cons);
+    MODULE_ITER(obj, con, "constellation") {
+        if (con->error || !con->first_update_complete) continue;
+        if (con->visible.value == 0.0) continue;
+        render_img(con, painter, core->selection == &con->obj);
+    }
     return 0;
 }
 
@@ -1058,6 +1317,35 @@ static obj_klass_t constellation_klass = {
 };
 OBJ_REGISTER(constellation_klass)
 
+// Test if an earlier constellation uses the same atlas page.
+static bool atlas_page_counted(const obj_t *module, const constellation_t *con)
+{
+    const obj_t *child;
+    DL_FOREACH(module->children, child) {
+        if (child == &con->obj) return false;
+        if (((const constellation_t*)child)->img.tex == con->img.tex)
+            return true;
+    }
+    return false;
+}
+
+static void constellations_get_memory(const obj_t *obj, int64_t *cpu,
+                                      int64_t *gpu)
+{
+    const obj_t *child;
+    const constellation_t *con;
+
+    DL_FOREACH(obj->children, child) {
+        if (child->klass != &constellation_klass) continue;
+        con = (const constellation_t*)child;
+        *cpu += sizeof(*con) + con->lines.nb_stars *
+                (sizeof(*con->lines.stars) + sizeof(*con->lines.stars_pos) +
+                 sizeof(*con->lines.stars_mag));
+        if (con->img.tex && !atlas_page_counted(obj, con))
+            *gpu += con->img.tex->size;
+    }
+}
+
 static obj_klass_t constellations_klass = {
     .id = "constellations",
     .size = sizeof(constellations_t),
@@ -1065,6 +1353,7 @@ static obj_klass_t constellations_klass = {
     .init = constellations_init,
     .update = constellations_update,
     .render = constellations_render,
+    .get_memory = constellations_get_memory,
     .render_order = 25,
     .attributes = (attribute_t[]) {
         PROPERTY(lines_visible, TYPE_BOOL,
@@ -1081,6 +1370,8 @@ static obj_klass_t constellations_klass = {
                  MEMBER(constellations_t, show_only_pointed)),
         PROPERTY(illustrations_bscale, TYPE_FLOAT,
                  MEMBER(constellations_t, illustrations_bscale)),
+        PROPERTY(prefetch_images, TYPE_BOOL,
+                 MEMBER(constellations_t, prefetch_images)),
         {}
     },
 };
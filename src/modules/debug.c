@@ -9,7 +9,8 @@
 
 /*
  * Debug module.  This just adds a menu in the GUI to do run some testing
- * scripts.  Not compiled in release.
+ * scripts, and shows the frame profiler timers and the modules memory.
+ * Not compiled in release.
  */
 
 #include "swe.h"
@@ -91,8 +92,28 @@ static void show_target(const target_t *t)
     obj_set_attr((obj_t*)core->observer, "latitude", lat);
 }
 
+static void show_timer(void *user, const char *id,
+                       double last, double avg, double max)
+{
+    if (!DEFINED(SWE_GUI)) return;
+    gui_text("%-24s %6.2f %6.2f %6.2f", id, last * 1000, avg * 1000,
+             max * 1000);
+}
+
+static void show_memory(void *user, const char *id,
+                        int64_t cpu, int64_t gpu)
+{
+    int64_t *total = user;
+    if (!DEFINED(SWE_GUI)) return;
+    gui_text("%-24s %9.2f %9.2f", id, cpu / (double)(1 << 20),
+             gpu / (double)(1 << 20));
+    total[0] += cpu;
+    total[1] += gpu;
+}
+
 static void debug_gui(obj_t *obj, int location)
 {
+    int64_t total[2] = {0, 0};
     int i;
     if (!DEFINED(SWE_GUI)) return;
     if (location == 0 && gui_tab("Tests")) {
@@ -100,6 +121,21 @@ static void debug_gui(obj_t *obj, int location)
             show_target(&TARGETS[i]);
         gui_tab_end();
     }
+    // Frame profiler timers, in ms.
+    if (location == 0 && gui_tab("Profile")) {
+        gui_text("SIMD kernels: %s", simd_get_name());
+        gui_text("%-24s %6s %6s %6s", "timer", "last", "avg", "max");
+        profiler_list(NULL, show_timer);
+        gui_tab_end();
+    }
+    // Modules resident memory, in MB.
+    if (location == 0 && gui_tab("Memory")) {
+        gui_text("%-24s %9s %9s", "module", "cpu", "gpu");
+        core_list_memory(total, show_memory);
+        gui_text("%-24s %9.2f %9.2f", "total", total[0] / (double)(1 << 20),
+                 total[1] / (double)(1 << 20));
+        gui_tab_end();
+    }
 }
 
 #endif
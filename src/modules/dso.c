@@ -18,6 +18,12 @@
 
 #define DSO_DEFAULT_VMAG 16.0
 
+// Version of the layout of the tiles in the decoded tiles cache.  Should be
+// increased each time we change the format, or the way we decode the rows.
+#define DECODED_TILE_VERSION 1
+
+#define ALIGN8(n) (((n) + 7) / 8 * 8)
+
 static obj_klass_t dso_klass;
 
 /*
@@ -60,6 +66,9 @@ typedef struct {
 /*
  * Type: tile_t
  * Custom tile structure for the dso HiPS survey.
+ *
+ * The data used in the render loop is duplicated in packed arrays, so that
+ * we only touch the dso_t structs of the visible sources.
  */
 typedef struct tile {
     int         flags;
@@ -68,8 +77,51 @@ typedef struct tile {
     int         nb;
     dso_t       *sources;
     dso_clip_data_t *sources_quick;
+    double      (*ellipses_pts)[3][3]; // Precomputed ellipses points.
+    int         *ellipses_flags;
+
+    // Set if the tile was loaded from the decoded tiles cache.  In that case
+    // the packed arrays and the sources strings point into the mapped file.
+    struct {
+        void    *data;
+        int     size;
+    } map;
 } tile_t;
 
+/*
+ * Type: decoded_tile_t
+ * Header of a tile in the decoded tiles cache.
+ *
+ * It is followed by the blocks, each one padded to 8 bytes:
+ *   - The nb dso_record_t of the sources.
+ *   - The sources_quick, ellipses_pts and ellipses_flags arrays.
+ *   - The strings, referenced by offset from the records.
+ */
+typedef struct {
+    int32_t     nb;
+    int32_t     transparency;
+    int32_t     strings_size;
+    int32_t     pad;
+    double      mag_min;
+    double      mag_max;
+} decoded_tile_t;
+
+/*
+ * Type: dso_record_t
+ * A dso_t as stored in the decoded tiles cache.
+ */
+typedef struct {
+    char        type[4] NONSTRING;
+    float       ra;
+    float       de;
+    float       smin;
+    float       smax;
+    float       angle;
+    float       vmag;
+    int32_t     morpho; // Offset in the strings, or -1.
+    int32_t     names;  // Offset in the strings, or -1.
+} dso_record_t;
+
 typedef struct survey survey_t;
 struct survey {
     char key[128];
@@ -95,11 +147,6 @@ typedef struct {
 // Static instance.
 static dsos_t *g_dsos = NULL;
 
-static uint64_t pix_to_nuniq(int order, int pix)
-{
-    return pix + 4 * (1L << (2 * order));
-}
-
 static void nuniq_to_pix(uint64_t nuniq, int *order, int *pix)
 {
     *order = log2(nuniq / 4) / 2;
@@ -212,12 +259,19 @@ static int del_tile(void *data)
         if (tile->sources[i].obj.ref > 1) return CACHE_KEEP;
     }
 
+    free(tile->sources);
+    if (tile->map.data) {
+        hips_unmap_decoded_tile(tile->map.data, tile->map.size);
+        free(tile);
+        return 0;
+    }
     for (i = 0; i < tile->nb; i++) {
         free(tile->sources[i].names);
         free(tile->sources[i].morpho);
     }
-    free(tile->sources);
     free(tile->sources_quick);
+    free(tile->ellipses_pts);
+    free(tile->ellipses_flags);
     free(tile);
     return 0;
 }
@@ -256,9 +310,12 @@ static int on_file_tile_loaded(const char type[4],
     dso_t *s;
     int nb, i, j, version, data_ofs = 0, flags, row_size, order, pix;
     int children_mask;
-    char morpho[32], ids[256] = {};
-    double bmag, temp_mag, tmp_ra, tmp_de, tmp_smax, tmp_smin, tmp_angle;
     void *tile_data;
+    // Values decoded from the table, one column at a time.
+    struct {
+        double vmag, bmag, ra, de, smax, smin, angle;
+        char morpho[33], ids[257]; // Extra byte for the null terminator.
+    } *rows, *row;
     tile_t **out = USER_GET(user, 1); // Receive the tile.
     int *transparency = USER_GET(user, 2);
 
@@ -286,12 +343,13 @@ static int on_file_tile_loaded(const char type[4],
         LOG_E("Cannot parse file");
         return -1;
     }
+    // Make sure the strings fit into our buffers.
+    if (columns[0].size > 4 || columns[8].size > 32 || columns[9].size > 256) {
+        LOG_E("Wrong string size");
+        return -1;
+    }
     tile_data = eph_read_compressed_block(data, size, &data_ofs, &size);
     if (!tile_data) return -1;
-    data_ofs = 0;
-    if (flags & 1) {
-        eph_shuffle_bytes(tile_data + data_ofs, row_size, nb);
-    }
 
     tile = calloc(1, sizeof(*tile));
     tile->mag_min = DBL_MAX;
@@ -300,43 +358,54 @@ static int on_file_tile_loaded(const char type[4],
 
     tile->sources = calloc(tile->nb, sizeof(dso_t));
 
+    // Decode the table column by column, directly from the shuffled data.
+    rows = calloc(nb, sizeof(*rows));
+    {
+        void *dst[] = {tile->sources[0].obj.type, &rows[0].vmag,
+                       &rows[0].bmag, &rows[0].ra, &rows[0].de,
+                       &rows[0].smax, &rows[0].smin, &rows[0].angle,
+                       rows[0].morpho, rows[0].ids};
+        _Static_assert(ARRAY_SIZE(dst) == ARRAY_SIZE(columns), "");
+        for (i = 0; i < ARRAY_SIZE(columns); i++) {
+            eph_read_table_column(tile_data, size, nb, flags & 1,
+                                  &columns[i], dst[i],
+                                  i == 0 ? sizeof(dso_t) : sizeof(*rows));
+        }
+    }
+    free(tile_data);
+
     for (i = 0; i < tile->nb; i++) {
         s = &tile->sources[i];
+        row = &rows[i];
         s->obj.ref = 1;
         s->obj.klass = &dso_klass;
-        eph_read_table_row(tile_data, size, &data_ofs,
-                           ARRAY_SIZE(columns), columns,
-                           s->obj.type,
-                           &temp_mag, &bmag, &tmp_ra, &tmp_de,
-                           &tmp_smax, &tmp_smin, &tmp_angle,
-                           morpho, ids);
-        s->ra = tmp_ra;
-        s->de = tmp_de;
-
-        s->smax = tmp_smax;
-        s->smin = tmp_smin;
-        s->angle = tmp_angle;
+        s->ra = row->ra;
+        s->de = row->de;
+
+        s->smax = row->smax;
+        s->smin = row->smin;
+        s->angle = row->angle;
         if (!s->smin && s->smax) {
             s->smin = s->smax;
             s->angle = NAN;
         }
 
-        s->vmag = temp_mag;
+        s->vmag = row->vmag;
         // For the moment use bmag as fallback vmag value
-        if (isnan(s->vmag)) s->vmag = bmag;
+        if (isnan(s->vmag)) s->vmag = row->bmag;
         if (memchr(s->obj.type, ' ', 4)) LOG_W_ONCE("Malformated otype");
         s->display_vmag = isnan(s->vmag) ? DSO_DEFAULT_VMAG : s->vmag;
         tile->mag_min = fmin(tile->mag_min, s->display_vmag);
         tile->mag_max = fmax(tile->mag_max, s->display_vmag);
 
-        if (*morpho) s->morpho = strdup(morpho);
+        if (*row->morpho) s->morpho = strdup(row->morpho);
         s->symbol = symbols_get_for_otype(s->obj.type);
 
         // Turn '|' separated ids into '\0' separated values.
-        if (*ids) {
-            s->names = calloc(1, 2 + strlen(ids));
-            for (j = 0; ids[j]; j++)
-                s->names[j] = ids[j] != '|' ? ids[j] : '\0';
+        if (*row->ids) {
+            s->names = calloc(1, 2 + strlen(row->ids));
+            for (j = 0; row->ids[j]; j++)
+                s->names[j] = row->ids[j] != '|' ? row->ids[j] : '\0';
         }
 
         apply_errata(s);
@@ -344,14 +413,22 @@ static int on_file_tile_loaded(const char type[4],
         s->bounding_cap[3] = cosf(fmaxf(s->smin, s->smax));
         vec3_from_sphe(s->ra, s->de, s->bounding_cap);
     }
-    free(tile_data);
+    free(rows);
 
     // Sort DSO in tile by display magnitude
     qsort(tile->sources, tile->nb, sizeof(dso_t), dso_cmp);
     // Create a small table with all data used for fast tile iteration
     tile->sources_quick = calloc(tile->nb, sizeof(dso_clip_data_t));
-    for (i = 0; i < tile->nb; ++i)
-        tile->sources_quick[i] = tile->sources[i].clip_data;
+    tile->ellipses_pts = calloc(tile->nb, sizeof(*tile->ellipses_pts));
+    tile->ellipses_flags = calloc(tile->nb, sizeof(*tile->ellipses_flags));
+    for (i = 0; i < tile->nb; ++i) {
+        s = &tile->sources[i];
+        tile->sources_quick[i] = s->clip_data;
+        // Sources without a valid size are rendered as points.
+        tile->ellipses_flags[i] = painter_get_ellipse_points(
+                s->ra, s->de, s->angle, isnan(s->smax) ? 0 : s->smax,
+                s->smin, tile->ellipses_pts[i]);
+    }
 
     // If we have a json header, check for a children mask value.
     if (json) {
@@ -365,6 +442,84 @@ static int on_file_tile_loaded(const char type[4],
     return 0;
 }
 
+// Add a string to the strings of a decoded tile, and return its offset.
+static int32_t add_string(char **strings, int *size, const char *str,
+                          int len)
+{
+    int32_t ret = *size;
+    if (!str) return -1;
+    *strings = realloc(*strings, *size + len);
+    memcpy(*strings + *size, str, len);
+    *size += len;
+    return ret;
+}
+
+// Check that a string offset of a decoded tile is -1, or points to a string
+// that ends before the end of the strings.  If list is set, the string is
+// a list of null terminated values ending with an empty one.
+static bool check_string(const char *strings, int size, int32_t ofs,
+                         bool list)
+{
+    const char *end;
+    if (ofs == -1) return true;
+    if (ofs < 0) return false;
+    while (true) {
+        if (ofs >= size) return false;
+        end = memchr(strings + ofs, '\0', size - ofs);
+        if (!end) return false;
+        if (!list || end == strings + ofs) return true;
+        ofs = end - strings + 1;
+    }
+}
+
+// Save a newly created tile into the decoded tiles cache.
+static void tile_save_decoded(const survey_t *survey, int order, int pix,
+                              const tile_t *tile, int transparency)
+{
+    char path[1024];
+    const dso_t *s;
+    const char *end;
+    dso_record_t *records;
+    char *strings = NULL;
+    int i;
+    decoded_tile_t header = {
+        .nb = tile->nb,
+        .transparency = transparency,
+        .mag_min = tile->mag_min,
+        .mag_max = tile->mag_max,
+    };
+
+    if (!hips_get_decoded_path(survey->hips, order, pix, path, sizeof(path)))
+        return;
+    records = calloc(tile->nb, sizeof(*records));
+    for (i = 0; i < tile->nb; i++) {
+        s = &tile->sources[i];
+        memcpy(records[i].type, s->obj.type, 4);
+        records[i].ra = s->ra;
+        records[i].de = s->de;
+        records[i].smin = s->smin;
+        records[i].smax = s->smax;
+        records[i].angle = s->angle;
+        records[i].vmag = s->vmag;
+        records[i].morpho = add_string(
+                &strings, &header.strings_size, s->morpho,
+                s->morpho ? strlen(s->morpho) + 1 : 0);
+        for (end = s->names; end && *end; end += strlen(end) + 1) {}
+        records[i].names = add_string(&strings, &header.strings_size,
+                                      s->names, end - s->names + 1);
+    }
+    hips_save_decoded_tile(path, DECODED_TILE_VERSION, 6,
+        (const void*[]){&header, records, tile->sources_quick,
+                        tile->ellipses_pts, tile->ellipses_flags, strings},
+        (const int[]){sizeof(header), tile->nb * sizeof(*records),
+                      tile->nb * sizeof(*tile->sources_quick),
+                      tile->nb * sizeof(*tile->ellipses_pts),
+                      tile->nb * sizeof(*tile->ellipses_flags),
+                      header.strings_size});
+    free(records);
+    free(strings);
+}
+
 static void *dsos_create_tile(void *user, int order, int pix,
                               const void *data,
                               int size, int *cost, int *transparency)
@@ -374,7 +529,92 @@ static void *dsos_create_tile(void *user, int order, int pix,
     eph_load(data, size, USER_PASS(survey, &tile, transparency),
              on_file_tile_loaded);
     if (tile) *cost = tile->nb * sizeof(*tile->sources);
+    if (tile) tile_save_decoded(survey, order, pix, tile, *transparency);
+    return tile;
+}
+
+/*
+ * Function: dsos_load_decoded_tile
+ * Create a tile from a file of the decoded tiles cache.
+ *
+ * The packed arrays and the strings stay in the mapped file, we only need
+ * to rebuild the dso_t structures of the sources.
+ */
+static void *dsos_load_decoded_tile(void *user, int order, int pix,
+                                    const char *path, int *cost,
+                                    int *transparency)
+{
+    tile_t *tile;
+    uint8_t *data;
+    const decoded_tile_t *header;
+    const dso_record_t *records, *r;
+    char *strings;
+    dso_t *s;
+    int i, size, ofs, nb;
+
+    data = hips_map_decoded_tile(path, DECODED_TILE_VERSION, &size);
+    if (!data) return NULL;
+    header = (void*)data;
+    nb = header->nb;
+    ofs = ALIGN8(sizeof(*header));
+    if (    size < ofs || nb < 0 || header->strings_size < 0 ||
+            size != ofs + ALIGN8(nb * sizeof(*records)) +
+                    ALIGN8(nb * sizeof(*tile->sources_quick)) +
+                    ALIGN8(nb * sizeof(*tile->ellipses_pts)) +
+                    ALIGN8(nb * sizeof(*tile->ellipses_flags)) +
+                    ALIGN8(header->strings_size))
+        goto error;
+    records = (void*)(data + ofs);
+    strings = (void*)(data + size - ALIGN8(header->strings_size));
+    // Make sure a corrupted file cannot make us read out of the mapping.
+    for (i = 0; i < nb; i++) {
+        r = &records[i];
+        if (    !check_string(strings, header->strings_size, r->morpho,
+                              false) ||
+                !check_string(strings, header->strings_size, r->names, true))
+            goto error;
+    }
+
+    tile = calloc(1, sizeof(*tile));
+    tile->nb = nb;
+    tile->mag_min = header->mag_min;
+    tile->mag_max = header->mag_max;
+    tile->map.data = data;
+    tile->map.size = size;
+    ofs += ALIGN8(nb * sizeof(*records));
+    tile->sources_quick = (void*)(data + ofs);
+    ofs += ALIGN8(nb * sizeof(*tile->sources_quick));
+    tile->ellipses_pts = (void*)(data + ofs);
+    ofs += ALIGN8(nb * sizeof(*tile->ellipses_pts));
+    tile->ellipses_flags = (void*)(data + ofs);
+
+    tile->sources = calloc(nb, sizeof(*tile->sources));
+    for (i = 0; i < nb; i++) {
+        s = &tile->sources[i];
+        r = &records[i];
+        s->obj.ref = 1;
+        s->obj.klass = &dso_klass;
+        memcpy(s->obj.type, r->type, 4);
+        s->clip_data = tile->sources_quick[i];
+        s->ra = r->ra;
+        s->de = r->de;
+        s->smin = r->smin;
+        s->smax = r->smax;
+        s->angle = r->angle;
+        s->vmag = r->vmag;
+        s->symbol = symbols_get_for_otype(s->obj.type);
+        if (r->morpho >= 0) s->morpho = strings + r->morpho;
+        if (r->names >= 0) s->names = strings + r->names;
+    }
+
+    *transparency = header->transparency;
+    *cost = nb * sizeof(*tile->sources);
     return tile;
+
+error:
+    LOG_W("Invalid decoded tile %s", path);
+    hips_unmap_decoded_tile(data, size);
+    return NULL;
 }
 
 static int dsos_init(obj_t *obj, json_value *args)
@@ -405,6 +645,13 @@ static tile_t *get_tile(survey_t *survey, int order, int pix,
     return tile;
 }
 
+// Minimum size of the hints symbols.
+static void apply_hint_min_size(int symbol, double win_size[2])
+{
+    win_size[0] = fmax(win_size[0], symbol == SYMBOL_GALAXY ? 6 : 12);
+    win_size[1] = fmax(win_size[1], 12);
+}
+
 static void compute_hint_transformation(
         const painter_t *painter,
         float ra, float de, float angle,
@@ -413,9 +660,7 @@ static void compute_hint_transformation(
 {
     painter_project_ellipse(painter, FRAME_ASTROM, ra, de, angle,
                             size_x, size_y, win_pos, win_size, win_angle);
-
-    win_size[0] = fmax(win_size[0], symbol == SYMBOL_GALAXY ? 6 : 12);
-    win_size[1] = fmax(win_size[1], 12);
+    apply_hint_min_size(symbol, win_size);
 }
 
 
@@ -508,52 +753,52 @@ static void dso_render_label(const dso_t *s,
 }
 
 
-// Render a DSO from its data.
-static int dso_render_from_data(const dso_t *s,
-                                const painter_t *painter, uint64_t hint)
+// Compute the magnitude limit for the hints of a DSO.
+static double dso_get_hints_limit_mag(const dso_t *s,
+                                      const painter_t *painter)
 {
-    double color[4];
-    double win_pos[2], win_size[2], win_angle, hints_limit_mag;
-    const bool selected = (&s->obj == core->selection);
-    double opacity;
-    painter_t tmp_painter;
-    const float vmag = s->display_vmag;
     const double hints_mag_offset = g_dsos->hints_mag_offset - 0.8;
 
-    hints_limit_mag = painter->hints_limit_mag - 0.5 + hints_mag_offset;
+    if (&s->obj == core->selection)
+        return 99;
 
-    // Allow to select DSO a bit fainter than the faintest star
-    // as they tend to be more visible as they are extended objects.
-    if (vmag > painter->stars_limit_mag + 1.5 || vmag > painter->hard_limit_mag)
-        return 1;
-
-    // Check that it's intersecting with current viewport
-    if (painter_is_cap_clipped(painter, FRAME_ASTROM, s->bounding_cap))
-        return 0;
+    if (s->smax == 0) {
+        // DSO without shape don't need to have labels displayed unless they are
+        // much zoomed or selected
+        return painter->stars_limit_mag - 10 + hints_mag_offset;
+    }
 
     // Special case for Open Clusters, for which the limiting magnitude
     // is more like the one for a star.
     if (s->symbol == SYMBOL_OPEN_GALACTIC_CLUSTER ||
         s->symbol == SYMBOL_CLUSTER_OF_STARS ||
         s->symbol == SYMBOL_MULTIPLE_DEFAULT) {
-        hints_limit_mag = painter->hints_limit_mag - 2. + hints_mag_offset;
-    }
-
-    if (s->smax == 0) {
-        // DSO without shape don't need to have labels displayed unless they are
-        // much zoomed or selected
-        hints_limit_mag = painter->stars_limit_mag - 10 + hints_mag_offset;
+        return painter->hints_limit_mag - 2. + hints_mag_offset;
     }
 
-    if (selected)
-        hints_limit_mag = 99;
+    return painter->hints_limit_mag - 0.5 + hints_mag_offset;
+}
 
-    if (vmag > hints_limit_mag + 2)
-        return 0;
+// Check if a DSO is too faint to be rendered at all.
+static bool dso_is_too_faint(float vmag, const painter_t *painter)
+{
+    // Allow to select DSO a bit fainter than the faintest star
+    // as they tend to be more visible as they are extended objects.
+    return vmag > painter->stars_limit_mag + 1.5 ||
+           vmag > painter->hard_limit_mag;
+}
 
-    compute_hint_transformation(painter, s->ra, s->de, s->angle,
-            s->smax, s->smin, s->symbol, win_pos, win_size,
-            &win_angle);
+// Render a DSO once its ellipse has been projected on screen.
+static int dso_render_projected(const dso_t *s, const painter_t *painter,
+                                double hints_limit_mag,
+                                const double win_pos[2],
+                                const double win_size[2], double win_angle)
+{
+    double color[4];
+    const bool selected = (&s->obj == core->selection);
+    double opacity;
+    painter_t tmp_painter;
+    const float vmag = s->display_vmag;
 
     // Skip if 2D circle is outside screen (TODO intersect 2D ellipse instead)
     if (painter_is_2d_circle_clipped(painter, win_pos,
@@ -603,6 +848,31 @@ static int dso_render_from_data(const dso_t *s,
     return 0;
 }
 
+// Render a DSO from its data.
+static int dso_render_from_data(const dso_t *s,
+                                const painter_t *painter, uint64_t hint)
+{
+    double win_pos[2], win_size[2], win_angle, hints_limit_mag;
+    const float vmag = s->display_vmag;
+
+    if (dso_is_too_faint(vmag, painter))
+        return 1;
+
+    // Check that it's intersecting with current viewport
+    if (painter_is_cap_clipped(painter, FRAME_ASTROM, s->bounding_cap))
+        return 0;
+
+    hints_limit_mag = dso_get_hints_limit_mag(s, painter);
+    if (vmag > hints_limit_mag + 2)
+        return 0;
+
+    compute_hint_transformation(painter, s->ra, s->de, s->angle,
+            s->smax, s->smin, s->symbol, win_pos, win_size,
+            &win_angle);
+    return dso_render_projected(s, painter, hints_limit_mag,
+                                win_pos, win_size, win_angle);
+}
+
 static int dso_render(obj_t *obj, const painter_t *painter)
 {
     const dso_t *dso = (const dso_t*)obj;
@@ -628,26 +898,73 @@ static int render_visitor(int order, int pix, void *user)
     int *nb_loaded = USER_GET(user, 2);
     survey_t *survey = USER_GET(user, 3);
     tile_t *tile;
-    int i, ret, code;
-    uint64_t hint;
+    int i, n = 0, code;
+    int *idx, *flags;
+    double *limits, (*pts)[3][3], (*win_pos)[2], (*win_size)[2], *win_angle;
+    size_t mark;
+    const dso_clip_data_t *quick;
+    const dso_t *s;
+    hips_stats_t *stats = hips_frame_stats(survey->hips);
 
     // Early exit if the tile is clipped.
-    if (painter_is_healpix_clipped(&painter, FRAME_ICRF, order, pix))
+    stats->visited++;
+    if (painter_is_healpix_clipped(&painter, FRAME_ICRF, order, pix)) {
+        stats->clipped++;
         return 0;
+    }
 
     (*nb_tot)++;
     tile = get_tile(survey, order, pix, false, &code);
     if (code) (*nb_loaded)++;
+    else stats->missing++;
 
     if (!tile) return 0;
     if (tile->mag_min > painter.stars_limit_mag + 1.5) return 0;
+    stats->rendered++;
 
-    hint = pix_to_nuniq(order, pix);
+    mark = frame_alloc_mark();
+    idx = frame_alloc(tile->nb * sizeof(*idx));
+    limits = frame_alloc(tile->nb * sizeof(*limits));
+
+    // First pass using only the packed clipping data, the sources are
+    // sorted by magnitude so we can stop at the first one too faint.
     for (i = 0; i < tile->nb; i++) {
-        ret = dso_render_from_data(&tile->sources[i], &painter, hint);
-        if (ret)
+        quick = &tile->sources_quick[i];
+        if (dso_is_too_faint(quick->display_vmag, &painter))
             break;
+        if (painter_is_cap_clipped(&painter, FRAME_ASTROM,
+                                   quick->bounding_cap))
+            continue;
+        s = &tile->sources[i];
+        limits[n] = dso_get_hints_limit_mag(s, &painter);
+        if (quick->display_vmag > limits[n] + 2)
+            continue;
+        idx[n++] = i;
+    }
+
+    // Project all the remaining ellipses at once.
+    if (n) {
+        pts = frame_alloc(n * sizeof(*pts));
+        flags = frame_alloc(n * sizeof(*flags));
+        win_pos = frame_alloc(n * sizeof(*win_pos));
+        win_size = frame_alloc(n * sizeof(*win_size));
+        win_angle = frame_alloc(n * sizeof(*win_angle));
+        for (i = 0; i < n; i++) {
+            memcpy(pts[i], tile->ellipses_pts[idx[i]], sizeof(*pts));
+            flags[i] = tile->ellipses_flags[idx[i]];
+        }
+        painter_project_ellipses(&painter, FRAME_ASTROM, n,
+                                 (const double (*)[3][3])pts, flags,
+                                 win_pos, win_size, win_angle);
+        for (i = 0; i < n; i++) {
+            s = &tile->sources[idx[i]];
+            apply_hint_min_size(s->symbol, win_size[i]);
+            dso_render_projected(s, &painter, limits[i], win_pos[i],
+                                 win_size[i], win_angle[i]);
+        }
     }
+    frame_alloc_rewind(mark);
+
     if (tile->mag_max > painter.stars_limit_mag + 1.5) return 0;
     return 1;
 }
@@ -730,6 +1047,48 @@ static int dsos_list(const obj_t *obj,
     return 0;
 }
 
+/*
+ * Same as dsos_list, but only walk the tiles that intersect a region.
+ */
+static int dsos_list_in_region(const obj_t *obj, const observer_t *obs,
+                            const sky_region_t *region, double max_mag,
+                            const char *source, void *user,
+                            int (*f)(void *user, obj_t *obj))
+{
+    int order, pix, i, code, ret = 0;
+    const dsos_t *dsos = (const dsos_t*)obj;
+    tile_t *tile;
+    hips_iterator_t iter;
+    survey_t *survey = NULL;
+    double cap[4], vmag;
+
+    if (isnan(max_mag)) max_mag = DBL_MAX;
+    if (source) {
+        DL_FOREACH(dsos->surveys, survey) {
+            if (strcmp(survey->key, source) == 0)
+                break;
+        }
+    }
+    if (!survey) survey = dsos->surveys;
+    if (!survey) return 0;
+
+    hips_iter_init(&iter);
+    while (hips_iter_next(&iter, &order, &pix)) {
+        healpix_get_bounding_cap(1 << order, pix, cap);
+        if (!sky_region_intersects_cap(region, cap)) continue;
+        tile = get_tile(survey, order, pix, false, &code);
+        if (!tile && !code) ret = MODULE_AGAIN;
+        if (!tile || tile->mag_min >= max_mag) continue;
+        for (i = 0; i < tile->nb; i++) {
+            vmag = tile->sources[i].vmag;
+            if (!isnan(vmag) && vmag > max_mag) continue;
+            if (f(user, &tile->sources[i].obj)) return 0;
+        }
+        hips_iter_push_children(&iter, order, pix);
+    }
+    return ret;
+}
+
 static int dsos_add_data_source(obj_t *obj, const char *url, const char *key)
 {
     dsos_t *dsos = (void*)obj;
@@ -738,11 +1097,14 @@ static int dsos_add_data_source(obj_t *obj, const char *url, const char *key)
     hips_settings_t survey_settings = {
         .create_tile = dsos_create_tile,
         .delete_tile = del_tile,
+        .cache = "dsos",
+        .load_decoded_tile = dsos_load_decoded_tile,
     };
     DL_COUNT(dsos->surveys, survey, idx);
     survey = calloc(1, sizeof(*survey));
     survey_settings.user = survey;
     survey->hips = hips_create(url, 0, &survey_settings);
+    hips_prefetch(survey->hips);
     survey->idx = idx;
     if (key)
         snprintf(survey->key, sizeof(survey->key), "%s", key);
@@ -766,6 +1128,34 @@ static obj_klass_t dso_klass = {
 };
 OBJ_REGISTER(dso_klass)
 
+/*
+ * Get the tiles visit stats of the last frame, as an object of survey key
+ * to the <hips_stats_t> values.
+ */
+static json_value *dsos_fn_tiles_stats(obj_t *obj, const attribute_t *attr,
+                                       const json_value *args)
+{
+    dsos_t *dsos = (void*)obj;
+    survey_t *survey;
+    json_value *ret;
+
+    ret = json_object_new(0);
+    DL_FOREACH(dsos->surveys, survey) {
+        if (!survey->hips) continue;
+        json_object_push(ret, survey->key, hips_get_stats_json(survey->hips));
+    }
+    return ret;
+}
+
+static void dsos_get_memory(const obj_t *obj, int64_t *cpu, int64_t *gpu)
+{
+    const dsos_t *dsos = (const dsos_t*)obj;
+    const survey_t *survey;
+    DL_FOREACH(dsos->surveys, survey) {
+        if (survey->hips) hips_get_memory(survey->hips, cpu, gpu);
+    }
+}
+
 static obj_klass_t dsos_klass = {
     .id     = "dsos",
     .size   = sizeof(dsos_t),
@@ -774,13 +1164,16 @@ static obj_klass_t dsos_klass = {
     .update = dsos_update,
     .render = dsos_render,
     .list   = dsos_list,
+    .list_in_region = dsos_list_in_region,
     .add_data_source = dsos_add_data_source,
+    .get_memory = dsos_get_memory,
     .render_order = 25,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(dsos_t, visible.target)),
         PROPERTY(hints_mag_offset, TYPE_FLOAT,
                  MEMBER(dsos_t, hints_mag_offset)),
         PROPERTY(hints_visible, TYPE_BOOL, MEMBER(dsos_t, hints_visible)),
+        PROPERTY(tiles_stats, TYPE_JSON, .fn = dsos_fn_tiles_stats),
         {}
     },
 };
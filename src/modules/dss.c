@@ -15,6 +15,7 @@ typedef struct dss {
     obj_t       obj;
     fader_t     visible;
     hips_t      *hips;
+    bool        composited; // Already rendered by the milkyway this frame.
 } dss_t;
 
 static int dss_init(obj_t *obj, json_value *args)
@@ -24,16 +25,21 @@ static int dss_init(obj_t *obj, json_value *args)
     return 0;
 }
 
-static int dss_render(obj_t *obj, const painter_t *painter)
+/*
+ * Compute the painter and split order used to render the survey.
+ * Return false if the survey is not visible.
+ */
+static bool dss_get_layer_(const dss_t *dss, const painter_t *painter,
+                           hips_layer_t *layer)
 {
     double visibility;
-    const dss_t *dss = (const dss_t*)obj;
     painter_t painter2 = *painter;
     double lum, c, sep, ratio;
+    const double *cap;
     int render_order, split_order;
 
-    if (dss->visible.value == 0.0) return 0;
-    if (!dss->hips) return 0;
+    if (dss->visible.value == 0.0) return false;
+    if (!dss->hips) return false;
 
     // For large FOV we use the milky way texture
     visibility = smoothstep(20 * DD2R, 10 * DD2R, core->fov);
@@ -63,7 +69,7 @@ static int dss_render(obj_t *obj, const painter_t *painter)
     vec4_mul(c, painter2.color, painter2.color);
 
     // Don't even try to display if the brightness is too low
-    if (painter2.color[3] < 3.0 / 255) return 0;
+    if (painter2.color[3] < 3.0 / 255) return false;
 
     /*
      * Compute split order.
@@ -76,22 +82,51 @@ static int dss_render(obj_t *obj, const painter_t *painter)
      * Note 2: instead of this heuristic we should compute the exact healpix
      * distortion at a given position.
      */
-    sep = fmin(vec3_sep(painter->clip_info[FRAME_ICRF].bounding_cap,
-                      VEC(0, 0, +1)),
-               vec3_sep(painter->clip_info[FRAME_ICRF].bounding_cap,
-                      VEC(0, 0, -1)));
+    assert(painter->clip);
+    cap = painter->clip->frames[FRAME_ICRF].bounding_cap;
+    sep = fmin(vec3_sep(cap, VEC(0, 0, +1)), vec3_sep(cap, VEC(0, 0, -1)));
     split_order = mix(12, 4, clamp(sep / (40 * DD2R), 0, 1));
 
     render_order = hips_get_render_order(dss->hips, painter);
     split_order = fmin(split_order, render_order + 3);
 
-    hips_render(dss->hips, &painter2, NULL, split_order);
+    layer->hips = dss->hips;
+    layer->painter = painter2;
+    layer->split_order = split_order;
+    return true;
+}
+
+/*
+ * Function: dss_get_layer
+ * Let the milkyway module render the survey composited over it.
+ *
+ * Return false if the survey is not visible, otherwise set the layer to
+ * render and skip the survey rendering for this frame.
+ */
+bool dss_get_layer(obj_t *obj, const painter_t *painter,
+                   hips_layer_t *layer)
+{
+    dss_t *dss = (dss_t*)obj;
+    if (!dss_get_layer_(dss, painter, layer)) return false;
+    dss->composited = true;
+    return true;
+}
+
+static int dss_render(obj_t *obj, const painter_t *painter)
+{
+    const dss_t *dss = (const dss_t*)obj;
+    hips_layer_t layer;
+
+    if (dss->composited) return 0;
+    if (!dss_get_layer_(dss, painter, &layer)) return 0;
+    hips_render(layer.hips, &layer.painter, NULL, layer.split_order);
     return 0;
 }
 
 static int dss_update(obj_t *obj, double dt)
 {
     dss_t *dss = (dss_t*)obj;
+    dss->composited = false;
     return fader_update(&dss->visible, dt);
 }
 
@@ -100,6 +135,7 @@ static int dss_add_data_source(obj_t *obj, const char *url, const char *key)
     dss_t *dss = (dss_t*)obj;
     hips_delete(dss->hips);
     dss->hips = hips_create(url, 0, NULL);
+    hips_prefetch(dss->hips);
     return 0;
 }
 
@@ -107,6 +143,23 @@ static int dss_add_data_source(obj_t *obj, const char *url, const char *key)
  * Meta class declarations.
  */
 
+/*
+ * Get the tiles visit stats of the last frame (see <hips_stats_t>).
+ */
+static json_value *dss_fn_tiles_stats(obj_t *obj, const attribute_t *attr,
+                                      const json_value *args)
+{
+    dss_t *dss = (void*)obj;
+    if (!dss->hips) return json_object_new(0);
+    return hips_get_stats_json(dss->hips);
+}
+
+static void dss_get_memory(const obj_t *obj, int64_t *cpu, int64_t *gpu)
+{
+    const dss_t *dss = (const dss_t*)obj;
+    if (dss->hips) hips_get_memory(dss->hips, cpu, gpu);
+}
+
 static obj_klass_t dss_klass = {
     .id = "dss",
     .size = sizeof(dss_t),
@@ -116,8 +169,10 @@ static obj_klass_t dss_klass = {
     .render = dss_render,
     .render_order = 6,
     .add_data_source = dss_add_data_source,
+    .get_memory = dss_get_memory,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(dss_t, visible.target)),
+        PROPERTY(tiles_stats, TYPE_JSON, .fn = dss_fn_tiles_stats),
         {}
     },
 };
@@ -10,12 +10,30 @@
 #include "swe.h"
 
 #include "geojson_parser.h"
+#include "static_mesh.h"
 
 #include "utils/mesh.h"
 
 typedef struct feature feature_t;
 typedef struct image image_t;
 
+// Healpix order of the features spatial index cells.
+#define INDEX_ORDER 3
+// Features with a bounding cap larger than this (cosine of the radius)
+// are not put in the cells, but in a list that we always visit.
+#define INDEX_LARGE_CAP_COS 0.866
+// We only build the spatial index for images with this many features.
+#define INDEX_MIN_FEATURES 64
+
+// Number of subdivision levels of the static meshes.  Each level has
+// edges twice shorter than the previous one, the first level being the
+// features meshes as is.
+#define SMESH_LEVELS 4
+// Max projection error of the static meshes edges (in pixels).
+#define SMESH_MAX_ERROR 2.0
+// Max error of the simplified polygons of each level (in pixels).
+#define SIMPLIFY_MAX_ERROR 1.0
+
 typedef struct {
     int size;
     double (*points)[3];
@@ -25,6 +43,10 @@ struct feature {
     obj_t       obj;
     feature_t   *next, *prev;
     mesh_t      *meshes;
+    // Simplified polygon meshes for each static mesh level except the
+    // last one, or NULL to use the full meshes.  We still use the full
+    // meshes for the picking.
+    mesh_t      *lods[SMESH_LEVELS - 1];
     linestring_t linestring; // Only support a single linestring for the moment.
     int         frame;
     float       fill_color[4];
@@ -38,8 +60,25 @@ struct feature {
     float       text_offset[2];
     bool        hidden;
     bool        blink;
+    int         smesh_idx; // Index in the image static mesh, or -1.
+    int         idx;       // Index of the feature in the image.
 };
 
+// A cell of the features spatial index.
+typedef struct {
+    int         nb;
+    int         capacity;
+    feature_t   **features;
+} index_cell_t;
+
+// Loader to parse and triangulate the geojson data in a worker thread.
+typedef struct {
+    worker_t    worker;
+    json_value  *data;
+    int         frame;
+    feature_t   *features; // Result, once the worker is done.
+} loader_t;
+
 typedef void (*filter_fn_t)(const image_t *img, int idx,
                             float fill_color[4], float stroke_color[4],
                             bool *blink, bool *hidden);
@@ -51,6 +90,19 @@ typedef void (*filter_fn_t)(const image_t *img, int idx,
  * Attributes:
  *   filter - Function called for each feature.  Can set the fill and stroke
  *            color.  If it returns zero, then the feature is hidden.
+ *   smesh  - All the features geometry, kept on the GPU, for each
+ *            subdivision level.  Created at the first render using them,
+ *            and deleted when the features change.
+ *   smesh_stroke_width - Stroke width of all the features in smesh.
+ *   cells  - Spatial index of the features: the features whose bounding
+ *            caps intersect each healpix pixel at INDEX_ORDER.  NULL
+ *            for the images with few features.
+ *   large  - The features too large to be put in the cells.
+ *   async  - If set, the data attribute parses and triangulates the
+ *            features in a worker thread, and the new features only
+ *            replace the current ones once they are ready.  Must be set
+ *            before the data.
+ *   loader - Current asynchronous loading, if any.
  */
 struct image {
     obj_t       obj;
@@ -59,6 +111,13 @@ struct image {
     filter_fn_t filter;
     int         filter_idx;
     double      z;      // For sorting inside a layer.
+    static_mesh_t *smesh[SMESH_LEVELS];
+    float       smesh_stroke_width;
+    int         nb_features;
+    index_cell_t *cells;
+    index_cell_t large;
+    bool        async;
+    loader_t    *loader;
 };
 
 
@@ -103,13 +162,99 @@ static void linestring2c(const geojson_linestring_t *ls, feature_t *feature)
         lonlat2c(ls->coordinates[i], feature->linestring.points[i]);
 }
 
-static void feature_add_geo(feature_t *feature, const geojson_geometry_t *geo,
-                            bool save_linestring)
+/*
+ * Angular tolerance of the polygons simplification for a static mesh
+ * level.  The level is used down to a pixel size of about
+ * (pi / 8)^2 / (8 * SMESH_MAX_ERROR * 4^level) (see get_smesh_level).
+ */
+static double get_simplify_tolerance(int level)
+{
+    return SIMPLIFY_MAX_ERROR * (M_PI / 8) * (M_PI / 8) /
+           (8 * SMESH_MAX_ERROR) / (1 << (2 * level));
+}
+
+/*
+ * Add the simplified meshes of a polygon to the feature lods.
+ * Return a bit mask of the levels where at least one vertex got removed.
+ */
+static int feature_add_poly_lods(feature_t *feature,
+                                 const geojson_polygon_t *polygon,
+                                 const mesh_t *full)
+{
+    int level, r, i, n, size, ret = 0;
+    int *rings_size;
+    double (**rings_verts)[2];
+    bool *keep;
+    mesh_t *mesh;
+    const geojson_linestring_t *ring;
+
+    rings_size = calloc(polygon->size, sizeof(*rings_size));
+    rings_verts = calloc(polygon->size, sizeof(*rings_verts));
+    for (r = 0; r < polygon->size; r++) {
+        rings_verts[r] = calloc(polygon->rings[r].size,
+                                sizeof(*rings_verts[r]));
+    }
+    for (level = 0; level < SMESH_LEVELS - 1; level++) {
+        for (r = 0; r < polygon->size; r++) {
+            ring = &polygon->rings[r];
+            size = ring->size - 1;
+            keep = calloc(ring->size, sizeof(*keep));
+            n = mesh_simplify_lonlat(size, ring->coordinates, true,
+                                     get_simplify_tolerance(level), keep);
+            // Keep the original ring if it would collapse.
+            if (n < 3) {
+                n = size;
+                for (i = 0; i < size; i++) keep[i] = true;
+            }
+            if (n < size) ret |= 1 << level;
+            rings_size[r] = 0;
+            for (i = 0; i < size; i++) {
+                if (!keep[i]) continue;
+                memcpy(rings_verts[r][rings_size[r]++], ring->coordinates[i],
+                       sizeof(*rings_verts[r]));
+            }
+            free(keep);
+        }
+        // Since the tolerance decreases with the level, nothing gets
+        // simplified at the next levels either.
+        if (!(ret & (1 << level))) {
+            for (; level < SMESH_LEVELS - 1; level++)
+                DL_APPEND(feature->lods[level], mesh_copy(full));
+            break;
+        }
+        mesh = calloc(1, sizeof(*mesh));
+        mesh_add_poly_lonlat(mesh, polygon->size, rings_size,
+                             (void*)rings_verts);
+        mesh_update_bounding_cap(mesh);
+        DL_APPEND(feature->lods[level], mesh);
+    }
+    for (r = 0; r < polygon->size; r++) free(rings_verts[r]);
+    free(rings_size);
+    free(rings_verts);
+    return ret;
+}
+
+static void feature_del_lod(feature_t *feature, int level)
+{
+    mesh_t *mesh;
+    while (feature->lods[level]) {
+        mesh = feature->lods[level];
+        DL_DELETE(feature->lods[level], mesh);
+        mesh_delete(mesh);
+    }
+}
+
+/*
+ * Add a geojson geometry to the feature meshes.
+ * Return a bit mask of the lods levels that contain simplified polygons.
+ */
+static int feature_add_geo(feature_t *feature, const geojson_geometry_t *geo,
+                           bool save_linestring)
 {
     const double (*coordinates)[2];
     int *rings_size;
     const double (**rings_verts)[2];
-    int i, size;
+    int i, size, ret = 0;
     mesh_t *mesh = NULL;
     geojson_geometry_t poly;
 
@@ -138,6 +283,8 @@ static void feature_add_geo(feature_t *feature, const geojson_geometry_t *geo,
         free(rings_verts);
 
         DL_APPEND(feature->meshes, mesh);
+        mesh_update_bounding_cap(mesh);
+        ret = feature_add_poly_lods(feature, &geo->polygon, mesh);
         break;
 
     case GEOJSON_POINT:
@@ -151,24 +298,184 @@ static void feature_add_geo(feature_t *feature, const geojson_geometry_t *geo,
         for (i = 0; i < geo->multipolygon.size; i++) {
             poly.type = GEOJSON_POLYGON;
             poly.polygon = geo->multipolygon.polygons[i];
-            feature_add_geo(feature, &poly, false);
+            ret |= feature_add_geo(feature, &poly, false);
         }
         break;
 
     default:
         assert(false);
-        return;
+        return 0;
     }
     if (mesh) mesh_update_bounding_cap(mesh);
+    return ret;
 }
 
-static void add_geojson_feature(image_t *image,
-                                const geojson_feature_t *geo_feature)
+// Return the feature meshes to render at a given static mesh level.
+static const mesh_t *feature_get_meshes(const feature_t *feature, int level)
+{
+    if (level < SMESH_LEVELS - 1 && feature->lods[level])
+        return feature->lods[level];
+    return feature->meshes;
+}
+
+static void index_cell_add(index_cell_t *cell, feature_t *feature)
+{
+    if (cell->nb >= cell->capacity) {
+        cell->capacity = cell->capacity ? cell->capacity * 2 : 8;
+        cell->features = realloc(cell->features,
+                                 cell->capacity * sizeof(*cell->features));
+    }
+    cell->features[cell->nb++] = feature;
+}
+
+static bool feature_intersects_cap(const feature_t *feature,
+                                   const double cap[4])
+{
+    const mesh_t *mesh;
+    for (mesh = feature->meshes; mesh; mesh = mesh->next) {
+        if (cap_intersects_cap(mesh->bounding_cap, cap)) return true;
+    }
+    return false;
+}
+
+static void index_add_rec(image_t *image, feature_t *feature,
+                          int order, int pix)
+{
+    double cap[4];
+    int i;
+
+    healpix_get_bounding_cap(1 << order, pix, cap);
+    if (!feature_intersects_cap(feature, cap)) return;
+    if (order < INDEX_ORDER) {
+        for (i = 0; i < 4; i++)
+            index_add_rec(image, feature, order + 1, pix * 4 + i);
+        return;
+    }
+    index_cell_add(&image->cells[pix], feature);
+}
+
+static void index_add_feature(image_t *image, feature_t *feature)
+{
+    const mesh_t *mesh;
+    int pix;
+
+    for (mesh = feature->meshes; mesh; mesh = mesh->next) {
+        if (mesh->bounding_cap[3] < INDEX_LARGE_CAP_COS) {
+            index_cell_add(&image->large, feature);
+            return;
+        }
+    }
+    for (pix = 0; pix < 12; pix++)
+        index_add_rec(image, feature, 0, pix);
+}
+
+static void index_clear(image_t *image)
+{
+    int i;
+    if (image->cells) {
+        for (i = 0; i < 12 << (2 * INDEX_ORDER); i++)
+            free(image->cells[i].features);
+        free(image->cells);
+        image->cells = NULL;
+    }
+    free(image->large.features);
+    memset(&image->large, 0, sizeof(image->large));
+}
+
+typedef struct {
+    const image_t   *image;
+    const painter_t *painter;
+    const feature_t **list;
+    bool            *visited;
+    int             nb;
+} index_query_t;
+
+static void index_query_cell(index_query_t *q, const index_cell_t *cell)
+{
+    int i;
+    for (i = 0; i < cell->nb; i++) {
+        if (q->visited[cell->features[i]->idx]) continue;
+        q->visited[cell->features[i]->idx] = true;
+        q->list[q->nb++] = cell->features[i];
+    }
+}
+
+static void index_query_rec(index_query_t *q, int order, int pix)
+{
+    int i;
+    if (painter_is_healpix_clipped(q->painter, q->image->frame, order, pix))
+        return;
+    if (order < INDEX_ORDER) {
+        for (i = 0; i < 4; i++)
+            index_query_rec(q, order + 1, pix * 4 + i);
+        return;
+    }
+    index_query_cell(q, &q->image->cells[pix]);
+}
+
+static int feature_cmp(const void *a, const void *b)
+{
+    return cmp((*(const feature_t**)a)->idx, (*(const feature_t**)b)->idx);
+}
+
+/*
+ * Function: index_query
+ * Get the features that can be visible, or that can contain a position.
+ *
+ * Parameters:
+ *   image  - A geojson image.
+ *   painter - Used to return the features that can be visible, if pos is
+ *             not set.
+ *   pos    - If set, return the features that can contain this position,
+ *            in the image frame.
+ *   out    - Output list of features, in the image order, allocated in
+ *            the frame arena.
+ *
+ * Return:
+ *   The number of features returned.
+ */
+static int index_query(const image_t *image, const painter_t *painter,
+                       const double pos[3], const feature_t ***out)
+{
+    const feature_t *feature;
+    index_query_t q = {
+        .image = image,
+        .painter = painter,
+        .list = frame_alloc(image->nb_features * sizeof(*q.list)),
+    };
+    int pix;
+
+    if (!image->cells) {
+        for (feature = image->features; feature; feature = feature->next)
+            q.list[q.nb++] = feature;
+        *out = q.list;
+        return q.nb;
+    }
+    q.visited = frame_alloc(image->nb_features * sizeof(*q.visited));
+    memset(q.visited, 0, image->nb_features * sizeof(*q.visited));
+    index_query_cell(&q, &image->large);
+    if (pos) {
+        pix = healpix_vec2pix(1 << INDEX_ORDER, pos);
+        index_query_cell(&q, &image->cells[pix]);
+    } else {
+        for (pix = 0; pix < 12; pix++)
+            index_query_rec(&q, 0, pix);
+    }
+    qsort(q.list, q.nb, sizeof(*q.list), feature_cmp);
+    *out = q.list;
+    return q.nb;
+}
+
+// Create a new feature from its geojson description.  This doesn't touch
+// any image, so that the loader can call it from a worker thread.
+static feature_t *feature_create(int frame,
+                                 const geojson_feature_t *geo_feature)
 {
     feature_t *feature;
+    int i, lods;
 
     feature = (void*)obj_create("geojson-feature", NULL);
-    feature->frame = image->frame;
+    feature->frame = frame;
 
     vec3_copy(geo_feature->properties.fill, feature->fill_color);
     vec3_copy(geo_feature->properties.stroke, feature->stroke_color);
@@ -183,20 +490,57 @@ static void add_geojson_feature(image_t *image,
     feature->text_rotate = geo_feature->properties.text_rotate;
     vec2_copy(geo_feature->properties.text_offset, feature->text_offset);
 
-    feature_add_geo(feature, &geo_feature->geometry, feature->stroke_glow);
+    lods = feature_add_geo(feature, &geo_feature->geometry,
+                           feature->stroke_glow);
+    // No need to keep the levels where nothing got simplified.
+    for (i = 0; i < SMESH_LEVELS - 1; i++) {
+        if (!(lods & (1 << i))) feature_del_lod(feature, i);
+    }
+    return feature;
+}
+
+static void static_meshes_release(image_t *image)
+{
+    int i;
+    for (i = 0; i < SMESH_LEVELS; i++) {
+        static_mesh_release(image->smesh[i]);
+        image->smesh[i] = NULL;
+    }
+}
+
+static void image_add_feature(image_t *image, feature_t *feature)
+{
     DL_APPEND(image->features, feature);
+    feature->idx = image->nb_features++;
+
+    if (image->cells) {
+        index_add_feature(image, feature);
+    } else if (image->nb_features >= INDEX_MIN_FEATURES) {
+        image->cells = calloc(12 << (2 * INDEX_ORDER), sizeof(*image->cells));
+        for (feature = image->features; feature; feature = feature->next)
+            index_add_feature(image, feature);
+    }
+    static_meshes_release(image);
+}
+
+static void add_geojson_feature(image_t *image,
+                                const geojson_feature_t *geo_feature)
+{
+    image_add_feature(image, feature_create(image->frame, geo_feature));
 }
 
 static void feature_del(obj_t *obj)
 {
     feature_t *feature = (void*)obj;
     mesh_t *mesh;
+    int i;
 
     while (feature->meshes) {
         mesh = feature->meshes;
         DL_DELETE(feature->meshes, mesh);
         mesh_delete(mesh);
     }
+    for (i = 0; i < SMESH_LEVELS - 1; i++) feature_del_lod(feature, i);
     free(feature->linestring.points);
     free(feature->title);
 }
@@ -234,16 +578,159 @@ void geojson_set_color_ptr_(float *ptr, float r, float g, float b, float a)
 }
 
 
+static int loader_worker(worker_t *worker)
+{
+    loader_t *loader = (void*)worker;
+    geojson_t *geojson;
+    feature_t *feature;
+    int i;
+
+    geojson = geojson_parse(loader->data);
+    json_builder_free(loader->data);
+    loader->data = NULL;
+    if (!geojson) {
+        LOG_E("Cannot parse geojson");
+        return 0;
+    }
+    for (i = 0; i < geojson->nb_features; i++) {
+        feature = feature_create(loader->frame, &geojson->features[i]);
+        DL_APPEND(loader->features, feature);
+    }
+    geojson_delete(geojson);
+    return 0;
+}
+
+// Wait for the current loader to finish, and drop its result.
+static void loader_cancel(image_t *image)
+{
+    loader_t *loader = image->loader;
+    feature_t *feature;
+
+    if (!loader) return;
+    worker_wait(&loader->worker);
+    while (loader->features) {
+        feature = loader->features;
+        DL_DELETE(loader->features, feature);
+        obj_release(&feature->obj);
+    }
+    free(loader);
+    image->loader = NULL;
+}
+
+static void apply_filter(image_t *image);
+void geojson_remove_all_features(image_t *image);
+
+// Replace the features with the loader result once it is ready.
+static void loader_update(image_t *image)
+{
+    loader_t *loader = image->loader;
+    feature_t *feature;
+
+    if (!loader || !worker_iter(&loader->worker)) return;
+    image->loader = NULL;
+    geojson_remove_all_features(image);
+    while (loader->features) {
+        feature = loader->features;
+        DL_DELETE(loader->features, feature);
+        image_add_feature(image, feature);
+    }
+    free(loader);
+    apply_filter(image);
+}
+
 EMSCRIPTEN_KEEPALIVE
 void geojson_remove_all_features(image_t *image)
 {
     feature_t *feature;
 
+    loader_cancel(image);
+
     while (image->features) {
         feature = image->features;
         DL_DELETE(image->features, feature);
         obj_release(&feature->obj);
     }
+    image->nb_features = 0;
+    index_clear(image);
+    static_meshes_release(image);
+}
+
+// Update the static mesh features texture after a change of the features
+// colors or flags.
+static void static_mesh_sync(image_t *image, static_mesh_t *smesh)
+{
+    const feature_t *feature;
+    if (!smesh) return;
+    for (feature = image->features; feature; feature = feature->next) {
+        if (feature->smesh_idx < 0) continue;
+        static_mesh_set_feature(smesh, feature->smesh_idx,
+                                feature->fill_color, feature->stroke_color,
+                                feature->blink, feature->hidden);
+    }
+}
+
+static void static_meshes_sync(image_t *image)
+{
+    int i;
+    for (i = 0; i < SMESH_LEVELS; i++)
+        static_mesh_sync(image, image->smesh[i]);
+}
+
+/*
+ * Put all the features geometry into a static mesh, subdivided so that
+ * the edges are at most 2^level times shorter than in the features
+ * meshes.  The polygons are simplified for the level (see the features
+ * lods).  The features with a glowing linestring or a different stroke
+ * width than the first feature are left out, and still rendered one by
+ * one.
+ */
+static static_mesh_t *static_mesh_build(image_t *image, int level)
+{
+    feature_t *feature;
+    const mesh_t *mesh;
+    mesh_t *copy;
+    static_mesh_t *smesh;
+
+    smesh = static_mesh_create();
+    if (image->features)
+        image->smesh_stroke_width = image->features->stroke_width;
+    for (feature = image->features; feature; feature = feature->next) {
+        feature->smesh_idx = -1;
+        if (feature->linestring.size) continue;
+        if (feature->stroke_width != image->smesh_stroke_width) continue;
+        feature->smesh_idx = static_mesh_add_feature(smesh);
+        for (mesh = feature_get_meshes(feature, level); mesh;
+             mesh = mesh->next) {
+            if (level == 0) {
+                static_mesh_add_mesh(smesh, feature->smesh_idx, mesh);
+                continue;
+            }
+            copy = mesh_copy(mesh);
+            if (mesh_subdivide(copy, M_PI / 8 / (1 << level)) &&
+                    copy->triangles_count)
+                copy->subdivided = true;
+            static_mesh_add_mesh(smesh, feature->smesh_idx, copy);
+            mesh_delete(copy);
+        }
+    }
+    static_mesh_sync(image, smesh);
+    return smesh;
+}
+
+/*
+ * Get the static mesh subdivision level to use for the current view.
+ *
+ * The screen error of an edge of angular length l, compared to the
+ * projected great circle, is about l^2 * h / (8 * fov) pixels (with h the
+ * window height), so the narrow fields need shorter edges.  We use the
+ * first level whose edges are short enough.
+ */
+static int get_smesh_level(const painter_t *painter)
+{
+    double h = painter->proj->window_size[1];
+    double max_length = sqrt(8 * SMESH_MAX_ERROR * core->fov / h);
+    int level = ceil(log2(M_PI / 8 / max_length));
+    return clamp(level, 0, SMESH_LEVELS - 1);
 }
 
 static void apply_filter(image_t *image)
@@ -255,6 +742,7 @@ static void apply_filter(image_t *image)
         image->filter(image, i, feature->fill_color, feature->stroke_color,
                       &feature->blink, &feature->hidden);
     }
+    static_meshes_sync(image);
 }
 
 static json_value *data_fn(obj_t *obj, const attribute_t *attr,
@@ -265,6 +753,15 @@ static json_value *data_fn(obj_t *obj, const attribute_t *attr,
     int i;
 
     if (!args) return NULL;
+    if (image->async) {
+        loader_cancel(image);
+        image->loader = calloc(1, sizeof(*image->loader));
+        worker_init(&image->loader->worker, loader_worker);
+        image->loader->data = json_copy(args);
+        image->loader->frame = image->frame;
+        worker_iter(&image->loader->worker);
+        return NULL;
+    }
     geojson_remove_all_features(image);
     geojson = geojson_parse(args);
     if (!geojson) {
@@ -304,6 +801,7 @@ void geojson_filter_all(image_t *image,
         feature->hidden = (r == 0);
         feature->blink = r & 0x2;
     }
+    static_meshes_sync(image);
 }
 
 // Compute the blink alpha coef.  Probably need to be changed.
@@ -317,13 +815,20 @@ static float blink(void)
 
 static int image_render(obj_t *obj, const painter_t *painter_)
 {
-    const image_t *image = (const image_t*)obj;
+    image_t *image = (image_t*)obj;
     painter_t painter = *painter_;
-    const feature_t *feature;
+    const feature_t *feature, **features;
     double pos[2], ofs[2];
-    int frame = image->frame, mode;
+    int frame = image->frame, mode, i, nb;
     const mesh_t *mesh;
     double c[4];
+    size_t mark = frame_alloc_mark();
+    // The static mesh is not cut at the projection discontinuities.
+    bool use_smesh = !(painter.proj->flags & PROJ_HAS_DISCONTINUITY);
+    int level = get_smesh_level(&painter);
+    static_mesh_t *smesh = NULL;
+
+    loader_update(image);
 
     /*
      * For the moment, we render all the filled shapes first, then
@@ -331,23 +836,49 @@ static int image_render(obj_t *obj, const painter_t *painter_)
      * to merge the rendering calls together.
      * We should probably instead allow the renderer to reorder the calls.
      */
-    for (feature = image->features; feature; feature = feature->next) {
+    if (use_smesh) {
+        if (!image->smesh[level])
+            image->smesh[level] = static_mesh_build(image, level);
+        smesh = image->smesh[level];
+        smesh->blink = blink();
+        use_smesh = paint_static_mesh(&painter, frame, MODE_TRIANGLES,
+                                      smesh) == 0;
+    }
+    if (use_smesh)
+        paint_static_mesh(&painter, frame, MODE_POINTS, smesh);
+
+    // Only visit the features that can be visible.
+    nb = index_query(image, painter_, NULL, &features);
+
+    for (i = 0; i < nb; i++) {
+        feature = features[i];
+        if (use_smesh && feature->smesh_idx >= 0) continue;
         if (feature->hidden || feature->fill_color[3] == 0) continue;
         vec4_copy(feature->fill_color, c);
         vec4_emul(c, painter_->color, painter.color);
         if (feature->blink)
             painter.color[3] *= blink();
-        for (mesh = feature->meshes; mesh; mesh = mesh->next) {
+        for (mesh = feature_get_meshes(feature, level); mesh;
+             mesh = mesh->next) {
             mode = mesh->points_count ? MODE_POINTS : MODE_TRIANGLES;
             paint_mesh(&painter, frame, mode, mesh);
         }
     }
 
-    for (feature = image->features; feature; feature = feature->next) {
+    if (use_smesh) {
+        painter = *painter_;
+        painter.lines.width = image->smesh_stroke_width;
+        paint_static_mesh(&painter, frame, MODE_LINES, smesh);
+    }
+
+    for (i = 0; i < nb; i++) {
+        feature = features[i];
+        if (use_smesh && feature->smesh_idx >= 0) continue;
         if (feature->hidden || feature->stroke_color[3] == 0) continue;
         vec4_copy(feature->stroke_color, c);
         vec4_emul(c, painter_->color, painter.color);
-        for (mesh = feature->meshes; mesh; mesh = mesh->next) {
+        for (mesh = feature_get_meshes(feature, level); mesh;
+             mesh = mesh->next) {
             if (mesh->points_count) continue;
             painter.lines.width = feature->stroke_width;
             if (feature->linestring.size) {
@@ -359,7 +890,8 @@ static int image_render(obj_t *obj, const painter_t *painter_)
         }
     }
 
-    for (feature = image->features; feature; feature = feature->next) {
+    for (i = 0; i < nb; i++) {
+        feature = features[i];
         if (feature->hidden) continue;
         for (mesh = feature->meshes; mesh; mesh = mesh->next) {
             if (feature->title) {
@@ -378,6 +910,7 @@ static int image_render(obj_t *obj, const painter_t *painter_)
             }
         }
     }
+    frame_alloc_rewind(mark);
     return 0;
 }
 
@@ -414,26 +947,187 @@ void geojson_add_poly_feature(image_t *image, int size, const double *data)
     add_geojson_feature(image, &feature);
 }
 
+static void unpack_color(uint32_t v, float out[4])
+{
+    out[0] = ((v >> 24) & 0xff) / 255.0;
+    out[1] = ((v >> 16) & 0xff) / 255.0;
+    out[2] = ((v >>  8) & 0xff) / 255.0;
+    out[3] = ((v >>  0) & 0xff) / 255.0;
+}
+
+// Create a feature mesh from the GEOM chunk data, or return NULL if the
+// data is not valid.
+static mesh_t *geom_create_mesh(int nb_verts, const float (*verts)[3],
+                                const int counts[3], const uint16_t *indices,
+                                bool subdivided)
+{
+    int i;
+    mesh_t *mesh;
+
+    if (nb_verts <= 0 || nb_verts > 65536) return NULL;
+    for (i = 0; i < counts[0] + counts[1] + counts[2]; i++) {
+        if (indices[i] >= nb_verts) return NULL;
+    }
+    mesh = mesh_create();
+    mesh->vertices_count = nb_verts;
+    mesh->vertices = malloc(nb_verts * sizeof(*mesh->vertices));
+    for (i = 0; i < nb_verts; i++) {
+        mesh->vertices[i][0] = verts[i][0];
+        mesh->vertices[i][1] = verts[i][1];
+        mesh->vertices[i][2] = verts[i][2];
+    }
+    mesh->triangles_count = counts[0];
+    mesh->triangles = malloc(counts[0] * sizeof(*indices));
+    memcpy(mesh->triangles, indices, counts[0] * sizeof(*indices));
+    indices += counts[0];
+    mesh->lines_count = counts[1];
+    mesh->lines = malloc(counts[1] * sizeof(*indices));
+    memcpy(mesh->lines, indices, counts[1] * sizeof(*indices));
+    indices += counts[1];
+    mesh->points_count = counts[2];
+    mesh->points = malloc(counts[2] * sizeof(*indices));
+    memcpy(mesh->points, indices, counts[2] * sizeof(*indices));
+    mesh->subdivided = subdivided;
+    mesh_update_bounding_cap(mesh);
+    return mesh;
+}
+
+static int on_geom_chunk(const char type[4], const void *data, int size,
+                         const json_value *json, void *user)
+{
+    image_t *image = USER_GET(user, 0);
+    int *nb = USER_GET(user, 1);
+    int version, data_ofs = 0, row_size, flags, n, i, table_size;
+    int verts_size, indices_size, strs_size, verts_ofs = 0, indices_ofs = 0;
+    int fill, stroke, nb_verts, counts[3], feature_flags, title_ofs;
+    double stroke_width;
+    void *table = NULL;
+    float (*verts)[3] = NULL;
+    uint16_t *indices = NULL;
+    char *strs = NULL;
+    feature_t *feature;
+    mesh_t *mesh;
+    eph_table_column_t columns[] = {
+        {"fill", 'i'},
+        {"strk", 'i'},
+        {"strw", 'f'},
+        {"nvrt", 'i'},
+        {"ntri", 'i'},
+        {"nlin", 'i'},
+        {"npnt", 'i'},
+        {"flag", 'i'},
+        {"titl", 'i'},
+    };
+
+    if (strncmp(type, "GEOM", 4) != 0) return 0;
+    memcpy(&version, data, 4);
+    data_ofs += 4;
+    n = eph_read_table_header(version, data, size, &data_ofs, &row_size,
+                              &flags, ARRAY_SIZE(columns), columns);
+    if (n < 0) goto error;
+    table = eph_read_compressed_block(data, size, &data_ofs, &table_size);
+    verts = eph_read_compressed_block(data, size, &data_ofs, &verts_size);
+    indices = eph_read_compressed_block(data, size, &data_ofs, &indices_size);
+    strs = eph_read_compressed_block(data, size, &data_ofs, &strs_size);
+    if (!table || !verts || !indices || !strs) goto error;
+    if (!strs_size || strs[strs_size - 1]) goto error;
+    if (flags & 1) eph_shuffle_bytes(table, row_size, n);
+
+    data_ofs = 0;
+    for (i = 0; i < n; i++) {
+        eph_read_table_row(table, table_size, &data_ofs,
+                           ARRAY_SIZE(columns), columns,
+                           &fill, &stroke, &stroke_width, &nb_verts,
+                           &counts[0], &counts[1], &counts[2],
+                           &feature_flags, &title_ofs);
+        if (title_ofs < 0 || title_ofs >= strs_size) goto error;
+        if (counts[0] < 0 || counts[1] < 0 || counts[2] < 0) goto error;
+        if (nb_verts < 0 ||
+            (verts_ofs + nb_verts) * sizeof(*verts) > verts_size ||
+            (indices_ofs + counts[0] + counts[1] + counts[2]) *
+                sizeof(*indices) > indices_size) goto error;
+        mesh = geom_create_mesh(nb_verts, verts + verts_ofs, counts,
+                                indices + indices_ofs, feature_flags & 1);
+        if (!mesh) goto error;
+        verts_ofs += nb_verts;
+        indices_ofs += counts[0] + counts[1] + counts[2];
+
+        feature = (void*)obj_create("geojson-feature", NULL);
+        feature->frame = image->frame;
+        DL_APPEND(feature->meshes, mesh);
+        unpack_color(fill, feature->fill_color);
+        unpack_color(stroke, feature->stroke_color);
+        feature->stroke_width = stroke_width;
+        if (strs[title_ofs]) feature->title = strdup(strs + title_ofs);
+        feature->text_anchor = GEOJSON_ANCHOR_CENTER | GEOJSON_ANCHOR_MIDDLE;
+        feature->text_size = -1;
+        image_add_feature(image, feature);
+        (*nb)++;
+    }
+    free(table);
+    free(verts);
+    free(indices);
+    free(strs);
+    return 0;
+
+error:
+    LOG_E("Cannot parse geojson eph data");
+    free(table);
+    free(verts);
+    free(indices);
+    free(strs);
+    return -1;
+}
+
+/*
+ * Function: geojson_load_eph
+ * Replace the features of an image with pre-triangulated features.
+ *
+ * The data is an eph file with a GEOM chunk, as generated by
+ * tools/make-geojson-eph.py.  Compared to the data attribute, this
+ * skips the json parsing and the triangulation, and never needs to
+ * keep the full json document in memory.
+ *
+ * Return:
+ *   The number of features loaded, or -1 in case of error.
+ */
+EMSCRIPTEN_KEEPALIVE
+int geojson_load_eph(image_t *image, const void *data, int size)
+{
+    int nb = 0, r;
+
+    geojson_remove_all_features(image);
+    r = eph_load(data, size, USER_PASS(image, &nb), on_geom_chunk);
+    apply_filter(image);
+    return r ? -1 : nb;
+}
+
 static int query_rendered_features_(
-        const image_t *image, const double pos[3], int max_ret,
+        const image_t *image, const double pos_[3], int max_ret,
         void **tiles, int *index)
 {
-    int i = 0, nb = 0;
-    const feature_t *feature;
+    int i, n, nb = 0;
+    const feature_t *feature, **features;
     const mesh_t *mesh;
+    double pos[3];
+    size_t mark = frame_alloc_mark();
 
-    for (feature = image->features; feature; feature = feature->next, i++) {
+    vec3_normalize(pos_, pos);
+    n = index_query(image, NULL, pos, &features);
+    for (i = 0; i < n; i++) {
+        feature = features[i];
         if (nb >= max_ret) break;
         if (feature->hidden) continue;
         for (mesh = feature->meshes; mesh; mesh = mesh->next) {
             if (mesh_contains_vec3(mesh, pos)) {
-                index[nb] = i;
+                index[nb] = feature->idx;
                 if (tiles) tiles[nb] = (void*)image;
                 nb++;
                 break;
             }
         }
     }
+    frame_alloc_rewind(mark);
     return nb;
 }
 
@@ -447,10 +1141,12 @@ static bool mesh_intersects_box(const mesh_t *mesh_, const painter_t *painter,
 
     // Project the mesh vertices into screen coordinates.
     mesh = mesh_copy(mesh_);
+    for (i = 0; i < mesh->vertices_count; i++)
+        vec3_normalize(mesh->vertices[i], mesh->vertices[i]);
+    convert_frame_batch(painter->obs, FRAME_ICRF, FRAME_VIEW, true,
+                        mesh->vertices_count, mesh->vertices, mesh->vertices);
     for (i = 0; i < mesh->vertices_count; i++) {
-        vec3_normalize(mesh->vertices[i], p);
-        convert_frame(painter->obs, FRAME_ICRF, FRAME_VIEW, true, p, p);
-        project_to_win(painter->proj, p, p);
+        project_to_win(painter->proj, mesh->vertices[i], p);
         vec2_copy(p, mesh->vertices[i]);
     }
     ret = mesh_intersects_2d_box(mesh, box);
@@ -463,22 +1159,26 @@ static int query_rendered_features_box_(
         const double box[2][2], int max_ret,
         void **tiles, int *index)
 {
-    int i = 0, nb = 0;
-    const feature_t *feature;
+    int i, n, nb = 0;
+    const feature_t *feature, **features;
     const mesh_t *mesh;
+    size_t mark = frame_alloc_mark();
 
-    for (feature = image->features; feature; feature = feature->next, i++) {
+    n = index_query(image, painter, NULL, &features);
+    for (i = 0; i < n; i++) {
+        feature = features[i];
         if (nb >= max_ret) break;
         if (feature->hidden) continue;
         for (mesh = feature->meshes; mesh; mesh = mesh->next) {
             if (mesh_intersects_box(mesh, painter, box)) {
-                index[nb] = i;
+                index[nb] = feature->idx;
                 if (tiles) tiles[nb] = (void*)image;
                 nb++;
                 break;
             }
         }
     }
+    frame_alloc_rewind(mark);
     return nb;
 }
 
@@ -494,6 +1194,7 @@ int geojson_query_rendered_features(
 {
     const image_t *image = (const image_t*)obj;
     painter_t painter;
+    painter_clip_t clip;
     int frame = image->frame;
     projection_t proj;
     double pos[3];
@@ -503,7 +1204,7 @@ int geojson_query_rendered_features(
         .obs = core->observer,
         .proj = &proj,
     };
-    painter_update_clip_info(&painter);
+    painter_update_clip_info(&painter, &clip);
     painter_unproject(&painter, frame, win_pos, pos);
 
     return query_rendered_features_(image, pos, max_ret, NULL, index);
@@ -578,6 +1279,7 @@ int geojson_survey_query_rendered_features(
     int i, nb = 0;
     int order, pix, code;
     painter_t painter;
+    painter_clip_t clip;
     projection_t proj;
     double pos[3];
     hips_t *hips = survey->hips;
@@ -593,7 +1295,7 @@ int geojson_survey_query_rendered_features(
         .fb_size = {core->win_size[0] * core->win_pixels_scale,
                     core->win_size[1] * core->win_pixels_scale},
     };
-    painter_update_clip_info(&painter);
+    painter_update_clip_info(&painter, &clip);
 
     // Case where we query a single point.
     if (box[0][0] == box[1][0] && box[0][1] == box[1][1]) {
@@ -679,6 +1381,7 @@ static int survey_init(obj_t *obj, json_value *args)
         .create_tile = survey_create_tile,
         .delete_tile = survey_delete_tile,
         .ext = "geojson",
+        .cache = "geojson",
     };
 
     if (!args) return -1;
@@ -794,27 +1497,62 @@ static obj_klass_t geojson_feature_klass = {
 };
 OBJ_REGISTER(geojson_feature_klass)
 
+static void image_get_memory(const obj_t *obj, int64_t *cpu, int64_t *gpu)
+{
+    const image_t *image = (const image_t*)obj;
+    const feature_t *feature;
+    const mesh_t *mesh;
+    int i;
+
+    DL_FOREACH(image->features, feature) {
+        *cpu += sizeof(*feature) +
+                feature->linestring.size * sizeof(*feature->linestring.points);
+        DL_FOREACH(feature->meshes, mesh) *cpu += mesh_get_size(mesh);
+        for (i = 0; i < SMESH_LEVELS - 1; i++) {
+            DL_FOREACH(feature->lods[i], mesh) *cpu += mesh_get_size(mesh);
+        }
+    }
+    for (i = 0; i < SMESH_LEVELS; i++) {
+        if (image->smesh[i]) static_mesh_get_memory(image->smesh[i], cpu, gpu);
+    }
+    if (image->cells) {
+        for (i = 0; i < 12 << (2 * INDEX_ORDER); i++)
+            *cpu += image->cells[i].capacity * sizeof(feature_t*);
+    }
+    *cpu += image->large.capacity * sizeof(feature_t*);
+}
+
 static obj_klass_t image_klass = {
     .id = "geojson",
     .size = sizeof(image_t),
     .init = image_init,
     .render = image_render,
     .del = image_del,
+    .get_memory = image_get_memory,
     .attributes = (attribute_t[]) {
         PROPERTY(data, TYPE_JSON, .fn = data_fn),
         PROPERTY(frame, TYPE_ENUM, MEMBER(image_t, frame)),
         PROPERTY(filter, TYPE_FUNC, .fn = filter_fn),
         PROPERTY(z, TYPE_FLOAT, MEMBER(image_t, z)),
+        PROPERTY(async, TYPE_BOOL, MEMBER(image_t, async)),
         {}
     },
 };
 OBJ_REGISTER(image_klass)
 
+static void survey_get_memory(const obj_t *obj, int64_t *cpu, int64_t *gpu)
+{
+    const survey_t *survey = (const survey_t*)obj;
+    if (survey->hips) hips_get_memory(survey->hips, cpu, gpu);
+    if (survey->allsky) image_get_memory(&survey->allsky->obj, cpu, gpu);
+}
+
 static obj_klass_t survey_klass = {
     .id             = "geojson-survey",
     .size           = sizeof(survey_t),
     .init           = survey_init,
     .render         = survey_render,
+    .get_memory     = survey_get_memory,
     .attributes = (attribute_t[]) {
         PROPERTY(filter, TYPE_FUNC, .fn = survey_filter_fn),
         PROPERTY(z, TYPE_FLOAT, MEMBER(survey_t, z)),
@@ -9,6 +9,10 @@
 
 #include "swe.h"
 
+// Size in pixel of the cells of the grid used to test label overlaps.
+#define GRID_CELL_SIZE 64
+// Size in pixel of the screen regions of the labels budget.
+#define REGION_SIZE 256
 
 typedef struct label label_t;
 struct label
@@ -34,14 +38,118 @@ struct label
     double  bounds[4];
 };
 
+// Screen space grid of the labels bounds, rebuilt at each frame so that we
+// only test overlaps against the labels close to each other.
+typedef struct grid {
+    int     size[2];    // Number of cells in x and y.
+    int     *cells;     // Index of the first entry of each cell, or -1.
+    struct {
+        label_t *label;
+        int     next;   // Index of the next entry in the cell, or -1.
+    } *entries;
+    int     nb;
+    int     capacity;
+} grid_t;
+
+/*
+ * Screen regions of the floating labels added during the current frame,
+ * with for each one a min heap of the 'max' highest priority labels, so
+ * that we can reject the low priority labels of the crowded parts of the
+ * screen as soon as they are added.
+ */
+typedef struct budget {
+    int     max;        // Max number of labels per region.
+    int     size[2];    // Number of regions in x and y.
+    int     *nb;        // Number of labels in each region.
+    struct {
+        double  priority;
+        label_t *label;
+    } *heaps;           // size[0] * size[1] heaps of max entries.
+    projection_t proj;  // Projection of the current frame.
+} budget_t;
+
 typedef struct labels {
     obj_t obj;
     label_t *labels;
     obj_t *hidden_obj;
+    grid_t grid;
+    budget_t budget;
 } labels_t;
 
 static labels_t *g_labels = NULL;
 
+static void budget_reset(budget_t *budget)
+{
+    int n;
+    core_get_proj(&budget->proj);
+    budget->size[0] = fmax(1, ceil(core->win_size[0] / REGION_SIZE));
+    budget->size[1] = fmax(1, ceil(core->win_size[1] / REGION_SIZE));
+    n = budget->size[0] * budget->size[1];
+    budget->nb = realloc(budget->nb, n * sizeof(*budget->nb));
+    memset(budget->nb, 0, n * sizeof(*budget->nb));
+    budget->heaps = realloc(budget->heaps,
+                            n * fmax(budget->max, 1) * sizeof(*budget->heaps));
+}
+
+// Return the region of a label position, or -1 if it's not on screen.
+static int budget_get_region(const budget_t *budget, int frame,
+                             const double pos[3], bool at_inf)
+{
+    double p[3], win[2];
+    int x, y;
+
+    if (frame == -1) {
+        vec2_copy(pos, win);
+    } else {
+        convert_frame(core->observer, frame, FRAME_VIEW, at_inf, pos, p);
+        if (!project_to_win_xy(&budget->proj, p, win)) return -1;
+    }
+    x = floor(win[0] / REGION_SIZE);
+    y = floor(win[1] / REGION_SIZE);
+    if (x < 0 || x >= budget->size[0] || y < 0 || y >= budget->size[1])
+        return -1;
+    return y * budget->size[0] + x;
+}
+
+/*
+ * Test whether a floating label would be in the budget of its region,
+ * before we create it.
+ */
+static bool budget_test(const budget_t *budget, int region, double priority)
+{
+    if (region < 0) return false;
+    return budget->nb[region] < budget->max ||
+           priority > budget->heaps[region * budget->max].priority;
+}
+
+// Add a label to the heap of its region, replacing the lowest priority
+// one if the region is full.
+static void budget_add(budget_t *budget, int region, label_t *label)
+{
+    typeof(*budget->heaps) *heap = &budget->heaps[region * budget->max], tmp;
+    int i, c, n = budget->nb[region];
+
+    if (n == budget->max) {
+        heap[0].label->active = false;
+        heap[0].label->fader.target = false;
+        heap[0] = heap[--n];
+        // Sift down.
+        for (i = 0; (c = 2 * i + 1) < n; i = c) {
+            if (c + 1 < n && heap[c + 1].priority < heap[c].priority) c++;
+            if (heap[i].priority <= heap[c].priority) break;
+            tmp = heap[i]; heap[i] = heap[c]; heap[c] = tmp;
+        }
+    }
+    // Sift up.
+    heap[n].priority = label->priority;
+    heap[n].label = label;
+    for (i = n; i > 0 && heap[(i - 1) / 2].priority > heap[i].priority;
+         i = (i - 1) / 2) {
+        tmp = heap[i]; heap[i] = heap[(i - 1) / 2]; heap[(i - 1) / 2] = tmp;
+    }
+    budget->nb[region] = n + 1;
+}
+
 void labels_reset(void)
 {
     label_t *label, *tmp;
@@ -57,6 +165,7 @@ void labels_reset(void)
             label->fader.target = false;
         }
     }
+    budget_reset(&g_labels->budget);
 }
 
 static label_t *label_get(label_t *list, const char *txt, double size,
@@ -120,6 +229,48 @@ static double bounds_dist_point(const double rect[4], const double p[2])
     return sqrt(dx * dx + dy * dy);
 }
 
+// Compute the range of grid cells covered by a bounding box.
+static void grid_get_range(const grid_t *grid, const double bounds[4],
+                           int range[4])
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+        range[i] = clamp(floor(bounds[i] / GRID_CELL_SIZE),
+                         0, grid->size[i % 2] - 1);
+    }
+}
+
+static void grid_reset(grid_t *grid, const double win_size[2])
+{
+    int i;
+    grid->size[0] = fmax(1, ceil(win_size[0] / GRID_CELL_SIZE));
+    grid->size[1] = fmax(1, ceil(win_size[1] / GRID_CELL_SIZE));
+    grid->cells = realloc(grid->cells,
+            grid->size[0] * grid->size[1] * sizeof(*grid->cells));
+    for (i = 0; i < grid->size[0] * grid->size[1]; i++)
+        grid->cells[i] = -1;
+    grid->nb = 0;
+}
+
+static void grid_add(grid_t *grid, label_t *label)
+{
+    int range[4], x, y, *cell;
+
+    grid_get_range(grid, label->bounds, range);
+    for (y = range[1]; y <= range[3]; y++)
+    for (x = range[0]; x <= range[2]; x++) {
+        if (grid->nb >= grid->capacity) {
+            grid->capacity = grid->capacity ? grid->capacity * 2 : 256;
+            grid->entries = realloc(grid->entries,
+                    grid->capacity * sizeof(*grid->entries));
+        }
+        cell = &grid->cells[y * grid->size[0] + x];
+        grid->entries[grid->nb].label = label;
+        grid->entries[grid->nb].next = *cell;
+        *cell = grid->nb++;
+    }
+}
+
 /*
  * Compute the overlap between a label and any other label on screen.
  * We define the overlap as the minimum length in X or Y of the
@@ -127,20 +278,28 @@ static double bounds_dist_point(const double rect[4], const double p[2])
  */
 static double test_label_overlaps(const label_t *label)
 {
+    const grid_t *grid = &g_labels->grid;
     label_t *other;
     double ret = 0, overlap;
     double inter[4];
+    int range[4], x, y, i;
 
     if (!(label->effects & TEXT_FLOAT)) return 0.0;
-    DL_FOREACH(g_labels->labels, other) {
-        if (other->priority < label->priority) continue;
-        if (other == label) continue;
-        if (other->fader.target == false) continue;
-        if (!bounds_intersection(label->bounds, other->bounds, inter))
-            continue;
-        overlap = fmin(inter[2] - inter[0], inter[3] - inter[1]);
-        if (overlap > ret)
-            ret = overlap;
+    grid_get_range(grid, label->bounds, range);
+    for (y = range[1]; y <= range[3]; y++)
+    for (x = range[0]; x <= range[2]; x++) {
+        for (i = grid->cells[y * grid->size[0] + x]; i != -1;
+             i = grid->entries[i].next) {
+            other = grid->entries[i].label;
+            if (other->priority < label->priority) continue;
+            if (other == label) continue;
+            if (other->fader.target == false) continue;
+            if (!bounds_intersection(label->bounds, other->bounds, inter))
+                continue;
+            overlap = fmin(inter[2] - inter[0], inter[3] - inter[1]);
+            if (overlap > ret)
+                ret = overlap;
+        }
     }
     return ret;
 }
@@ -156,9 +315,22 @@ static int label_cmp(void *a_, void *b_)
 static int labels_init(obj_t *obj, json_value *args)
 {
     g_labels = (void*)obj;
+    g_labels->budget.max = 16;
     return 0;
 }
 
+// Check if the labels are already sorted, since in most cases the order
+// doesn't change from one frame to the next.
+static bool labels_are_sorted(label_t *list)
+{
+    label_t *label;
+    DL_FOREACH(list, label) {
+        if (label->next && label_cmp(label, label->next) > 0)
+            return false;
+    }
+    return true;
+}
+
 static int labels_render(obj_t *obj, const painter_t *painter_)
 {
     label_t *label;
@@ -167,7 +339,26 @@ static int labels_render(obj_t *obj, const painter_t *painter_)
     painter_t painter = *painter_;
 
     // Order labels to render them from far to near.
-    DL_SORT(g_labels->labels, label_cmp);
+    if (!labels_are_sorted(g_labels->labels))
+        DL_SORT(g_labels->labels, label_cmp);
+
+    // First pass: compute all the labels bounds and put them in the grid.
+    painter.flags &= ~PAINTER_ENABLE_DEPTH;
+    grid_reset(&g_labels->grid, core->win_size);
+    DL_FOREACH(g_labels->labels, label) {
+        // Re-project label on screen
+        if (label->obj != g_labels->hidden_obj || !label->obj) {
+            if (label->frame != -1) {
+                painter_project(&painter, label->frame, label->pos,
+                                label->at_inf, false, label->win_pos);
+            }
+            label_apply_radius_offset(label, pos);
+            paint_text_bounds(&painter, label->render_text, pos, label->align,
+                              label->effects, label->size, label->bounds);
+        }
+        grid_add(&g_labels->grid, label);
+    }
+
     DL_FOREACH(g_labels->labels, label) {
 
         if (g_labels->hidden_obj && label->obj == g_labels->hidden_obj)
@@ -175,15 +366,7 @@ static int labels_render(obj_t *obj, const painter_t *painter_)
 
         vec4_copy(label->color, painter.color);
         painter.color[3] *= label->fader.value;
-        // Re-project label on screen
-        if (label->frame != -1) {
-            painter_project(&painter, label->frame, label->pos, label->at_inf,
-                            false, label->win_pos);
-        }
-        painter.flags &= ~PAINTER_ENABLE_DEPTH;
         label_apply_radius_offset(label, pos);
-        paint_text_bounds(&painter, label->render_text, pos, label->align,
-                          label->effects, label->size, label->bounds);
         label->fader.target = label->active &&
                                 (test_label_overlaps(label) <= max_overlap);
 
@@ -231,9 +414,18 @@ void labels_add_3d(const char *text, int frame, const double pos[3],
     assert(!angle); // Not supported at the moment.
     assert(!obj || (obj->klass && obj->klass->get_info));
     label_t *label;
+    budget_t *budget = &g_labels->budget;
+    int region = -1;
 
     if (!text || !*text) return;
 
+    // Reject the floating labels that wouldn't fit in the budget of their
+    // screen region, before we do anything else with them.
+    if ((effects & TEXT_FLOAT) && budget->max > 0 && budget->nb) {
+        region = budget_get_region(budget, frame, pos, at_inf);
+        if (!budget_test(budget, region, priority)) return;
+    }
+
     label = label_get(g_labels->labels, text, size, obj);
     if (!label) {
         label = calloc(1, sizeof(*label));
@@ -258,6 +450,8 @@ void labels_add_3d(const char *text, int frame, const double pos[3],
     label->effects = effects;
     label->priority = priority;
     label->fader.target = true;
+    // Only count the labels added several times once.
+    if (region >= 0 && !label->active) budget_add(budget, region, label);
     label->active = true;
 }
 
@@ -314,6 +508,9 @@ static obj_klass_t labels_klass = {
     .update = labels_update,
     .render_order = 100,
     .attributes = (attribute_t[]) {
+        // Max number of floating labels per screen region, zero for no
+        // limit.
+        PROPERTY(region_budget, TYPE_INT, MEMBER(labels_t, budget.max)),
         {},
     },
 };
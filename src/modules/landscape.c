@@ -16,6 +16,15 @@ enum {
     LS_DESCRIPTION    = 1 << 1,
 };
 
+// Number of azimuth bins of the horizon profile (0.1° resolution).
+#define HORIZON_NB 3600
+
+// Min alpha value of the landscape pixels we consider opaque.
+#define HORIZON_MIN_ALPHA 250
+
+// Max number of pixels we sample along each side of a tile.
+#define HORIZON_TILE_SAMPLES 64
+
 /*
  * Type: landscape_t
  * Represent an individual landscape.
@@ -34,6 +43,9 @@ typedef struct landscape {
     } info;
     int             parsed; // union of LS_ enum for each parsed file.
     char            *description;  // html description if any.
+    // Max altitude of the opaque part of the landscape for each azimuth,
+    // computed from the tiles as they get loaded.  NULL if not known.
+    float           *horizon;
 } landscape_t;
 
 /*
@@ -88,6 +100,12 @@ static double get_global_brightness(void)
     double sin_angle;
     double brightness = 0.0;
     double moon_phase;
+    // Only depends on the observer, so we compute it once per update even
+    // if several landscapes are rendered.
+    static uint64_t obs_hash = 0;
+    static double ret;
+
+    if (obs_hash && obs_hash == core->observer->hash_sky) return ret;
     sun = core_get_planet(PLANET_SUN);
     obj_get_pos(sun, core->observer, FRAME_OBSERVED, pos);
     vec3_normalize(pos, pos);
@@ -103,7 +121,9 @@ static double get_global_brightness(void)
     if (sin_angle > -0.1 / 1.5 )
         brightness += moon_phase * 0.2 * (sin_angle + 0.1 / 1.5);
 
-    return fmin(brightness * 1.2, 1.0);
+    ret = fmin(brightness * 1.2, 1.0);
+    obs_hash = core->observer->hash_sky;
+    return ret;
 }
 
 /*
@@ -199,19 +219,68 @@ static void landscape_on_active_changed(obj_t *obj, const attribute_t *attr)
     }
 }
 
+static int horizon_get_bin(double az)
+{
+    int i;
+    i = (int)floor(az / (2 * M_PI) * HORIZON_NB) % HORIZON_NB;
+    return i < 0 ? i + HORIZON_NB : i;
+}
+
+/*
+ * Update the horizon profile with the opaque pixels of a landscape tile.
+ */
+static void landscape_on_tile_image(void *user, int order, int pix,
+                                    const uint8_t *img, int w, int h, int bpp)
+{
+    landscape_t *ls = user;
+    double mat[3][3], p[3], alt, az, da;
+    int i, x, y, step, end;
+
+    if (bpp != 4) return; // No alpha.
+    if (!ls->horizon) {
+        ls->horizon = malloc(HORIZON_NB * sizeof(*ls->horizon));
+        for (i = 0; i < HORIZON_NB; i++) ls->horizon[i] = -M_PI / 2;
+    }
+    healpix_get_mat3(1 << order, pix, mat);
+    step = w > HORIZON_TILE_SAMPLES ? w / HORIZON_TILE_SAMPLES : 1;
+    // Approximate azimuth range covered by each sample.
+    da = sqrt(4 * M_PI / (12 << (2 * order))) * step / w;
+    for (y = step / 2; y < h; y += step) {
+        for (x = step / 2; x < w; x += step) {
+            if (img[(y * w + x) * 4 + 3] < HORIZON_MIN_ALPHA) continue;
+            // The tiles uv are swapped, and the landscapes are flipped
+            // along y (see landscape_render).
+            vec3_set(p, (y + 0.5) / h, (x + 0.5) / w, 1);
+            mat3_mul_vec3(mat, p, p);
+            healpix_xy2vec(p, p);
+            p[1] = -p[1];
+            vec3_to_sphe(p, &az, &alt);
+            end = horizon_get_bin(az + da / 2);
+            for (i = horizon_get_bin(az - da / 2); ; i = (i + 1) % HORIZON_NB) {
+                ls->horizon[i] = fmax(ls->horizon[i], alt);
+                if (i == end) break;
+            }
+        }
+    }
+}
+
 static landscape_t *add_from_uri(landscapes_t *lss, const char *uri,
                                  const char *key)
 {
     landscape_t *ls;
+    hips_settings_t settings = {};
 
     ls = (void*)module_add_new(&lss->obj, "landscape", NULL);
     ls->key = strdup(key);
     ls->obj.id = ls->key;
     ls->uri = strdup(uri);
     if (strcmp(key, "zero") != 0) {
-        ls->hips = hips_create(uri, 0, NULL);
+        settings.on_image = landscape_on_tile_image;
+        settings.user = ls;
+        ls->hips = hips_create(uri, 0, &settings);
         hips_set_label(ls->hips, "Landscape");
         hips_set_frame(ls->hips, FRAME_OBSERVED);
+        hips_prefetch(ls->hips);
         ls->info.name = strdup(key);
     } else {
         // Zero horizon shape.
@@ -255,6 +324,27 @@ static int landscapes_render(obj_t *obj, const painter_t *painter)
     return 0;
 }
 
+/*
+ * Test if a point in ICRF coordinates is hidden by the current landscape.
+ * This is used by the labels module to hide labels behind the terrain.
+ */
+static bool landscapes_is_point_occulted(
+        const obj_t *obj, const double pos[3], bool at_inf,
+        const observer_t *obs, const obj_t *ignore)
+{
+    const landscapes_t *lss = (const landscapes_t*)obj;
+    const landscape_t *ls = lss->current;
+    double p[3], az, alt;
+
+    if (!ls || !ls->horizon) return false;
+    if (lss->visible.value < 0.5 || ls->visible.value < 0.5) return false;
+    vec3_copy(pos, p);
+    if (at_inf) vec3_normalize(p, p);
+    convert_frame(obs, FRAME_ICRF, FRAME_OBSERVED, at_inf, p, p);
+    vec3_to_sphe(p, &az, &alt);
+    return alt < ls->horizon[horizon_get_bin(az)];
+}
+
 static void landscapes_gui(obj_t *obj, int location)
 {
     landscape_t *ls;
@@ -315,6 +405,14 @@ static json_value *landscapes_current_id_fn(
  * Meta class declarations.
  */
 
+static void landscape_get_memory(const obj_t *obj, int64_t *cpu,
+                                 int64_t *gpu)
+{
+    const landscape_t *ls = (const landscape_t*)obj;
+    if (ls->hips) hips_get_memory(ls->hips, cpu, gpu);
+    if (ls->horizon) *cpu += HORIZON_NB * sizeof(*ls->horizon);
+}
+
 static obj_klass_t landscape_klass = {
     .id = "landscape",
     .size = sizeof(landscape_t),
@@ -322,6 +420,7 @@ static obj_klass_t landscape_klass = {
     .init = landscape_init,
     .update = landscape_update,
     .render = landscape_render,
+    .get_memory = landscape_get_memory,
     .render_order = 40,
     .attributes = (attribute_t[]) {
         PROPERTY(name, TYPE_STRING_PTR, MEMBER(landscape_t, info.name)),
@@ -346,6 +445,7 @@ static obj_klass_t landscapes_klass = {
     .render         = landscapes_render,
     .gui            = landscapes_gui,
     .add_data_source    = landscapes_add_data_source,
+    .is_point_occulted  = landscapes_is_point_occulted,
     .render_order   = 40,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(landscapes_t, visible.target)),
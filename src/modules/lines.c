@@ -7,6 +7,7 @@
  * repository.
  */
 
+#include "render.h"
 #include "swe.h"
 #include <zlib.h> // For crc32.
 
@@ -155,6 +156,56 @@ struct lines {
     bool        visible;
 };
 
+/*
+ * Type: line_cache_t
+ * The lines and labels rendered by a grid, so that we can render them
+ * again without any computation as long as the view doesn't change.
+ *
+ * We get them by rendering the grid with a capture renderer (see
+ * capture_backend), so they are already tessellated in window coordinates.
+ */
+typedef struct {
+    bool            valid;
+
+    // Values of the view when we built the cache.
+    struct {
+        double      rot[2][3][3]; // Line frame and observed to view.
+        double      proj_mat[4][4];
+        double      window_size[2];
+        const void  *proj_klass;
+        int         proj_flags;
+        double      refa, refb;
+        double      color[4];
+        double      quality;
+    } key;
+
+    double          (*pos)[3];
+    double          (*win)[3];
+    int             nb_points;
+    int             points_capacity;
+
+    struct {
+        int         start;
+        int         size;
+        int         flags;
+    } *lines;
+    int             nb_lines;
+    int             lines_capacity;
+
+    struct {
+        char        text[32];
+        double      pos[2];
+        int         align;
+        int         effects;
+        int         flags;
+        double      size;
+        double      color[4];
+        double      angle;
+    } *labels;
+    int             nb_labels;
+    int             labels_capacity;
+} line_cache_t;
+
 typedef struct line line_t;
 struct line {
     obj_t           obj;
@@ -164,6 +215,7 @@ struct line {
     const char      *name;
     bool            grid;       // If true render the whole grid.
     double          color[4];
+    line_cache_t    cache;
 };
 
 static void hex_to_rgba(uint32_t v, double rgba[4])
@@ -336,6 +388,107 @@ static void spherical_project(
     mat3_mul_vec3(*rot, out, out);
 }
 
+// Format a label according to the 'format' attribute.
+static void format_label(const line_t *line, int dir, int step, double a,
+                         char *buf, int len)
+{
+    char s;
+    int h[4];
+
+    if (line->format == 'd' || (line->format == 'h' && dir == 0)) {
+        if (step <= 360) {
+            eraA2af(-4, a, &s, h);
+            if (dir == 1 && s == '+') s = ' ';
+            if (h[0] == 0) s = ' ';
+            snprintf(buf, len, "%c%d°", s, h[0]);
+        } else if (step <= 21600) {
+            eraA2af(-2, a, &s, h);
+            if (dir == 1 && s == '+') s = ' ';
+            if (h[0] == 0 && h[1] == 0) s = ' ';
+            snprintf(buf, len, "%c%d°%02d'", s, h[0], h[1]);
+        } else {
+            eraA2af(0, a, &s, h);
+            if (dir == 1 && s == '+') s = ' ';
+            if (h[0] == 0 && h[1] == 0 && h[2] == 0) s = ' ';
+            snprintf(buf, len, "%c%d°%02d'%02d\"", s, h[0], h[1], h[2]);
+        }
+    } else if (line->format == 'h') {
+        if (step <= 24) {
+            eraA2tf(-4, a, &s, h);
+            snprintf(buf, len, "%dh", h[0]);
+        } else if (step <= 1440) {
+            eraA2tf(-2, a, &s, h);
+            snprintf(buf, len, "%dh%02d", h[0], h[1]);
+        } else {
+            eraA2tf(0, a, &s, h);
+            snprintf(buf, len, "%dh%02dm%02ds", h[0], h[1], h[2]);
+        }
+    } else if (line->format == 'n') {
+        snprintf(buf, len, "%s", sys_translate("gui", line->name));
+    } else {
+        assert(false);
+    }
+}
+
+/*
+ * Type: label_text_t
+ * Memoized text of a grid label.
+ *
+ * The labels values are always a multiple of the grid step, so we only
+ * render a small set of them and we don't need to format them again at
+ * each frame.  The text metrics are already cached by the renderer.
+ */
+typedef struct {
+    UT_hash_handle  hh;
+    struct {
+        int         format;
+        int         dir;
+        int         step;
+        int         index;  // Label value as a number of steps.
+    } key;
+    char            text[32];
+} label_text_t;
+
+// Max number of memoized labels before we flush them all.
+#define LABELS_CACHE_MAX 1024
+
+static label_text_t *g_labels_cache = NULL;
+
+static void get_label_text(const line_t *line, int dir, int step,
+                           const double uv[2], char buf[32])
+{
+    label_text_t *entry, *tmp, key = {};
+    double a;
+
+    if (dir == 0) a = mix(-90, +90 , uv[1]) * DD2R;
+    else          a = mix(  0, +360, uv[0]) * DD2R;
+
+    // The names depend on the language, there are only a few anyway.
+    if (line->format == 'n') {
+        format_label(line, dir, step, a, buf, 32);
+        return;
+    }
+
+    key.key.format = line->format;
+    key.key.dir = dir;
+    key.key.step = step;
+    key.key.index = round(dir == 0 ? uv[1] * step / 2 : uv[0] * step);
+    HASH_FIND(hh, g_labels_cache, &key.key, sizeof(key.key), entry);
+    if (!entry) {
+        if (HASH_COUNT(g_labels_cache) >= LABELS_CACHE_MAX) {
+            HASH_ITER(hh, g_labels_cache, entry, tmp) {
+                HASH_DEL(g_labels_cache, entry);
+                free(entry);
+            }
+        }
+        entry = calloc(1, sizeof(*entry));
+        entry->key = key.key;
+        format_label(line, dir, step, a, entry->text, sizeof(entry->text));
+        HASH_ADD(hh, g_labels_cache, key, sizeof(entry->key), entry);
+    }
+    memcpy(buf, entry->text, sizeof(entry->text));
+}
+
 /*
  * Function: render_label
  * Render the border label
@@ -354,9 +507,7 @@ static void render_label(const double p[2], const double u[2],
     char buf[32];
     double pos[2];
     double n[2];
-    double a, label_angle;
-    char s;
-    int h[4];
+    double label_angle;
     double bounds[4], size[2];
     const double text_size = 12;
     painter_t painter = *painter_;
@@ -377,43 +528,7 @@ static void render_label(const double p[2], const double u[2],
     label_angle = atan2(n[1], n[0]);
     if (fabs(label_angle) > M_PI / 2) label_angle -= M_PI;
 
-    if (dir == 0) a = mix(-90, +90 , uv[1]) * DD2R;
-    else          a = mix(  0, +360, uv[0]) * DD2R;
-
-    // Compute label according to the 'format' attribute.
-    if (line->format == 'd' || (line->format == 'h' && dir == 0)) {
-        if (step <= 360) {
-            eraA2af(-4, a, &s, h);
-            if (dir == 1 && s == '+') s = ' ';
-            if (h[0] == 0) s = ' ';
-            snprintf(buf, sizeof(buf), "%c%d°", s, h[0]);
-        } else if (step <= 21600) {
-            eraA2af(-2, a, &s, h);
-            if (dir == 1 && s == '+') s = ' ';
-            if (h[0] == 0 && h[1] == 0) s = ' ';
-            snprintf(buf, sizeof(buf), "%c%d°%02d'", s, h[0], h[1]);
-        } else {
-            eraA2af(0, a, &s, h);
-            if (dir == 1 && s == '+') s = ' ';
-            if (h[0] == 0 && h[1] == 0 && h[2] == 0) s = ' ';
-            snprintf(buf, sizeof(buf), "%c%d°%02d'%02d\"", s, h[0], h[1], h[2]);
-        }
-    } else if (line->format == 'h') {
-        if (step <= 24) {
-            eraA2tf(-4, a, &s, h);
-            snprintf(buf, sizeof(buf), "%dh", h[0]);
-        } else if (step <= 1440) {
-            eraA2tf(-2, a, &s, h);
-            snprintf(buf, sizeof(buf), "%dh%02d", h[0], h[1]);
-        } else {
-            eraA2tf(0, a, &s, h);
-            snprintf(buf, sizeof(buf), "%dh%02dm%02ds", h[0], h[1], h[2]);
-        }
-    } else if (line->format == 'n') {
-        snprintf(buf, sizeof(buf), "%s", sys_translate("gui", line->name));
-    } else {
-        assert(false);
-    }
+    get_label_text(line, dir, step, uv, buf);
 
     paint_text_bounds(&painter, buf, p, ALIGN_CENTER | ALIGN_MIDDLE, 0,
                       text_size, bounds);
@@ -456,7 +571,7 @@ static void render_recursion(
         const step_t *steps[2],
         bool skip_half)
 {
-    int i, j, dir;
+    int i, j, dir, split;
     int split_az, split_al, new_splits[2], new_pos[2];
     double p[4], lines[4][4] = {}, u[2], v[2];
     double pos_view[4][3], cap[4];
@@ -475,9 +590,10 @@ static void render_recursion(
     for (i = 0; i < 4; i++) {
         mat3_mul_vec2(mat, uv[i], p);
         spherical_project(&map, p, p);
-        convert_frame(painter->obs, line->frame, FRAME_VIEW, true, p, p);
         vec3_copy(p, pos_view[i]);
     }
+    convert_frame_batch(painter->obs, line->frame, FRAME_VIEW, true, 4,
+                        pos_view, pos_view);
     // If the quad is clipped we stop the recursion.
     // We only start to test after a certain level to prevent distortion
     // error with big quads at low levels.
@@ -494,6 +610,9 @@ static void render_recursion(
     // before level 2.
     if (level < 2) goto keep_going;
 
+    // Use less segments per line if we need to render faster.
+    split = 2 + round(6 * quality_get(&core->quality, QUALITY_LINES));
+
     for (i = 0; i < 4; i++) mat3_mul_vec2(mat, uv[i], uv[i]);
     vec2_copy(uv[0], lines[0]);
     vec2_copy(uv[2], lines[1]);
@@ -516,7 +635,7 @@ static void render_recursion(
                 (uv_i[1] == 0 || uv_i[1] == splits[1] - 1))
             continue;
 
-        paint_line(painter, line->frame, lines + dir * 2, &map, 8, 0);
+        paint_line(painter, line->frame, lines + dir * 2, &map, split, 0);
         if (!line->format) continue;
         if (get_line_screen_intersection(
                     painter, line->frame, lines + dir * 2, &map, p, u, v)) {
@@ -678,15 +797,172 @@ static int render_boundary(const painter_t *painter)
 }
 
 
+/*
+ * Renderer backend that saves the lines and labels into a line cache
+ * instead of rendering them.  The grid rendering only uses the line and
+ * text functions.
+ */
+typedef struct {
+    renderer_t      base;
+    renderer_t      *next;  // Used for the text size computations.
+    line_cache_t    *cache;
+} capture_t;
+
+static void capture_line(renderer_t *rend, const painter_t *painter,
+                         const double (*pos)[3], const double (*win)[3],
+                         int size)
+{
+    line_cache_t *cache = ((capture_t*)rend)->cache;
+    int n = cache->nb_points + size;
+
+    if (n > cache->points_capacity) {
+        cache->points_capacity = fmax(n, cache->points_capacity * 2);
+        cache->pos = realloc(cache->pos,
+                             cache->points_capacity * sizeof(*cache->pos));
+        cache->win = realloc(cache->win,
+                             cache->points_capacity * sizeof(*cache->win));
+    }
+    if (cache->nb_lines >= cache->lines_capacity) {
+        cache->lines_capacity = cache->lines_capacity * 2 ?: 64;
+        cache->lines = realloc(cache->lines,
+                               cache->lines_capacity * sizeof(*cache->lines));
+    }
+    memcpy(cache->pos + cache->nb_points, pos, size * sizeof(*pos));
+    memcpy(cache->win + cache->nb_points, win, size * sizeof(*win));
+    cache->lines[cache->nb_lines].start = cache->nb_points;
+    cache->lines[cache->nb_lines].size = size;
+    cache->lines[cache->nb_lines].flags = painter->flags;
+    cache->nb_lines++;
+    cache->nb_points = n;
+}
+
+static void capture_text(renderer_t *rend, const painter_t *painter,
+                         const char *text, const double win_pos[2],
+                         const double view_pos[3],
+                         int align, int effects, double size,
+                         const double color[4], double angle,
+                         double bounds[4])
+{
+    capture_t *capture = (void*)rend;
+    line_cache_t *cache = capture->cache;
+
+    if (bounds) {
+        render_text(capture->next, painter, text, win_pos, view_pos, align,
+                    effects, size, color, angle, bounds);
+        return;
+    }
+    assert(!view_pos);
+    if (cache->nb_labels >= cache->labels_capacity) {
+        cache->labels_capacity = cache->labels_capacity * 2 ?: 16;
+        cache->labels = realloc(cache->labels,
+                cache->labels_capacity * sizeof(*cache->labels));
+    }
+    snprintf(cache->labels[cache->nb_labels].text,
+             sizeof(cache->labels[cache->nb_labels].text), "%s", text);
+    vec2_copy(win_pos, cache->labels[cache->nb_labels].pos);
+    cache->labels[cache->nb_labels].align = align;
+    cache->labels[cache->nb_labels].effects = effects;
+    cache->labels[cache->nb_labels].flags = painter->flags;
+    cache->labels[cache->nb_labels].size = size;
+    vec4_copy(color, cache->labels[cache->nb_labels].color);
+    cache->labels[cache->nb_labels].angle = angle;
+    cache->nb_labels++;
+}
+
+static const render_backend_t capture_backend = {
+    .line = capture_line,
+    .text = capture_text,
+};
+
+/*
+ * Check if the cache of a line can be used for the current view, and if not
+ * update the cache key.
+ *
+ * We accept small changes of the view as long as the lines don't move by
+ * more than a fraction of a pixel, so that a slow rotation of the sky
+ * doesn't force the tessellation at every frame.
+ */
+static bool cache_check(line_cache_t *cache, const line_t *line,
+                        const painter_t *painter)
+{
+    int i, j, k;
+    double rot[2][3][3], eps;
+    bool ret = cache->valid;
+    const projection_t *proj = painter->proj;
+    const int frames[2] = {line->frame, FRAME_OBSERVED};
+
+    for (k = 0; k < 2; k++)
+    for (i = 0; i < 3; i++) {
+        vec3_set(rot[k][i], i == 0, i == 1, i == 2);
+        convert_frame(painter->obs, frames[k], FRAME_VIEW, true,
+                      rot[k][i], rot[k][i]);
+    }
+    // A quarter of a pixel in radian.
+    eps = 0.25 * proj->fovy / proj->window_size[1];
+    for (k = 0; k < 2; k++)
+    for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++) {
+        if (fabs(rot[k][i][j] - cache->key.rot[k][i][j]) > eps)
+            ret = false;
+    }
+    ret = ret &&
+        memcmp(proj->mat, cache->key.proj_mat, sizeof(proj->mat)) == 0 &&
+        memcmp(proj->window_size, cache->key.window_size,
+               sizeof(proj->window_size)) == 0 &&
+        proj->klass == cache->key.proj_klass &&
+        proj->flags == cache->key.proj_flags &&
+        painter->obs->refa == cache->key.refa &&
+        painter->obs->refb == cache->key.refb &&
+        vec4_equal(painter->color, cache->key.color) &&
+        quality_get(&core->quality, QUALITY_LINES) == cache->key.quality;
+    if (ret) return true;
+
+    memcpy(cache->key.rot, rot, sizeof(rot));
+    memcpy(cache->key.proj_mat, proj->mat, sizeof(proj->mat));
+    vec2_copy(proj->window_size, cache->key.window_size);
+    cache->key.proj_klass = proj->klass;
+    cache->key.proj_flags = proj->flags;
+    cache->key.refa = painter->obs->refa;
+    cache->key.refb = painter->obs->refb;
+    vec4_copy(painter->color, cache->key.color);
+    cache->key.quality = quality_get(&core->quality, QUALITY_LINES);
+    return false;
+}
+
+static void cache_render(const line_cache_t *cache, const painter_t *painter_)
+{
+    int i;
+    painter_t painter = *painter_;
+
+    for (i = 0; i < cache->nb_lines; i++) {
+        painter.flags = cache->lines[i].flags;
+        render_line(painter.rend, &painter,
+                    cache->pos + cache->lines[i].start,
+                    cache->win + cache->lines[i].start,
+                    cache->lines[i].size);
+    }
+    for (i = 0; i < cache->nb_labels; i++) {
+        painter.flags = cache->labels[i].flags;
+        render_text(painter.rend, &painter, cache->labels[i].text,
+                    cache->labels[i].pos, NULL, cache->labels[i].align,
+                    cache->labels[i].effects, cache->labels[i].size,
+                    cache->labels[i].color, cache->labels[i].angle, NULL);
+    }
+}
+
 static int line_render(obj_t *obj, const painter_t *painter_)
 {
-    const line_t *line = (const line_t*)obj;
+    line_t *line = (line_t*)obj;
     double rot[3][3] = MAT3_IDENTITY;
     const step_t *steps[2];
     int splits[2] = {1, 1};
     int pos[2] = {0, 0};
     bool skip_half = false;
     painter_t painter = *painter_;
+    capture_t capture = {
+        .base.backend = &capture_backend,
+        .cache = &line->cache,
+    };
 
     // XXX: probably need to use enum id for the different lines/grids.
     if (strcmp(line->obj.id, "meridian") == 0) {
@@ -703,6 +979,11 @@ static int line_render(obj_t *obj, const painter_t *painter_)
         return render_boundary(&painter);
     }
 
+    if (cache_check(&line->cache, line, &painter)) {
+        cache_render(&line->cache, &painter);
+        return 0;
+    }
+
     // Compute the number of divisions of the grid.
     get_steps(line->format, line->frame, &painter, steps);
 
@@ -713,7 +994,16 @@ static int line_render(obj_t *obj, const painter_t *painter_)
         skip_half = true;
     }
 
+    // Render into the cache, then from the cache.
+    capture.next = painter.rend;
+    line->cache.nb_points = 0;
+    line->cache.nb_lines = 0;
+    line->cache.nb_labels = 0;
+    painter.rend = &capture.base;
     render_recursion(line, &painter, rot, 0, splits, pos, steps, skip_half);
+    painter.rend = capture.next;
+    line->cache.valid = true;
+    cache_render(&line->cache, &painter);
     return 0;
 }
 
@@ -12,16 +12,19 @@
 #define EARTH_RADIUS 6378.0         // Earth_radius in km
 #define MAX_ALTITUDE 120.0          // Max meteor altitude in km
 #define MIN_ALTITUDE 80.0           // Min meteor altitude in km
+#define MAX_METEORS 100             // Max number of meteors at once
 
 typedef struct meteor meteor_t;
 
 /*
  * Type: meteor_t
  * Represents a single meteor
+ *
+ * The position is not integrated: we compute it from the initial position,
+ * the speed and the time since the meteor was created.
  */
 struct meteor {
-    meteor_t    *next, *prev;   // List within the meteors module.
-    double      pvo[2][4];
+    double      pvo[2][4]; // Initial position and speed.
     double      duration; // Duration (sec).
     double      time; // From 0 to duration.
 };
@@ -48,7 +51,8 @@ typedef struct shower {
 typedef struct {
     obj_t   obj;
     double  zhr;
-    meteor_t *meteors;
+    meteor_t meteors[MAX_METEORS]; // Pool of the active meteors.
+    int     nb;
     char *showers_url;
     bool showers_loaded;
     bool visible;
@@ -59,10 +63,9 @@ static double frand(double from, double to)
     return from + (rand() / (double)RAND_MAX) * (to - from);
 }
 
-static meteor_t *meteor_create(void)
+static void meteor_init(meteor_t *m)
 {
     double z, mat[3][3];
-    meteor_t *m = calloc(1, sizeof(*m));
 
     // Give the meteor a random position and speed.
     z = (EARTH_RADIUS + MAX_ALTITUDE) * 1000 * DM2AU;
@@ -77,14 +80,7 @@ static meteor_t *meteor_create(void)
     vec3_mul(0.00001, m->pvo[1], m->pvo[1]);
 
     m->duration = 4.0;
-    return m;
-}
-
-static int meteor_update(meteor_t *m, double dt)
-{
-    vec3_addk(m->pvo[0], m->pvo[1], dt, m->pvo[0]);
-    m->time += dt;
-    return 0;
+    m->time = 0;
 }
 
 /*
@@ -144,6 +140,7 @@ static int meteor_render(const meteor_t *m, const painter_t *painter_)
     painter.color[3] *= fmax(0.0, 1.0 - m->time / m->duration);
 
     vec4_copy(m->pvo[0], p1);
+    vec3_addk(p1, m->pvo[1], m->time, p1);
     vec3_addk(p1, m->pvo[1], -2, p2);
 
     render_tail(&painter, p1, p2);
@@ -323,27 +320,27 @@ static json_value *shower_get_json_data(const obj_t *obj)
 static int meteors_update(obj_t *obj, double dt)
 {
     meteors_t *ms = (meteors_t*)obj;
-    meteor_t *m, *tmp;
-    int nb, max_nb = 100;
+    int i;
     double proba;
 
     load_showers(ms);
 
-    DL_COUNT(ms->meteors, m, nb);
+    // Remove the finished meteors by moving the last ones in their place.
+    for (i = 0; i < ms->nb; ) {
+        ms->meteors[i].time += dt;
+        if (ms->meteors[i].time > ms->meteors[i].duration) {
+            ms->nb--;
+            ms->meteors[i] = ms->meteors[ms->nb];
+            continue;
+        }
+        i++;
+    }
+
     // Probabiliy of having a new shooting star at this frame.
     proba = ms->zhr * dt / 3600;
 
-    if (nb < max_nb && frand(0, 1) < proba) {
-        m = meteor_create();
-        DL_APPEND(ms->meteors, m);
-    }
-
-    DL_FOREACH_SAFE(ms->meteors, m, tmp) {
-        meteor_update(m, dt);
-        if (m->time > m->duration) {
-            DL_DELETE(ms->meteors, m);
-            free(m);
-        }
+    if (ms->nb < MAX_METEORS && frand(0, 1) < proba) {
+        meteor_init(&ms->meteors[ms->nb++]);
     }
 
     return 0;
@@ -353,12 +350,12 @@ static int meteors_render(obj_t *obj, const painter_t *painter)
 {
     const meteors_t *meteors = (const meteors_t*)obj;
     obj_t *child;
-    meteor_t *m;
+    int i;
 
     if (!meteors->visible) return 0;
 
-    DL_FOREACH(meteors->meteors, m) {
-        meteor_render(m, painter);
+    for (i = 0; i < meteors->nb; i++) {
+        meteor_render(&meteors->meteors[i], painter);
     }
 
     DL_FOREACH(meteors->obj.children, child) {
@@ -15,6 +15,9 @@ typedef struct milkyway {
     hips_t          *hips;
 } milkyway_t;
 
+// Defined in dss.c
+bool dss_get_layer(obj_t *obj, const painter_t *painter,
+                   hips_layer_t *layer);
 
 static int milkyway_init(obj_t *obj, json_value *args)
 {
@@ -37,6 +40,8 @@ static int milkyway_render(obj_t *obj, const painter_t *painter_)
     const milkyway_t *mw = (const milkyway_t*)obj;
     painter_t painter = *painter_;
     double visibility;
+    obj_t *dss;
+    hips_layer_t base, top;
 
     if (!mw->hips) return 0;
     if (mw->visible.value == 0.0) return 0;
@@ -58,6 +63,17 @@ static int milkyway_render(obj_t *obj, const painter_t *painter_)
     if (painter.color[3] < 1./255)
         return 0;
 
+    // During the transition with the DSS survey, render both surveys in
+    // a single pass.
+    dss = core_get_module("dss");
+    if (dss && dss_get_layer(dss, painter_, &top)) {
+        base.hips = mw->hips;
+        base.painter = painter;
+        base.split_order = split_order;
+        hips_render_composite(&base, &top);
+        return 0;
+    }
+
     hips_render(mw->hips, &painter, NULL, split_order);
     return 0;
 }
@@ -68,6 +84,7 @@ static int milkyway_add_data_source(
     milkyway_t *mw = (milkyway_t*)obj;
     if (mw->hips) return -1;
     mw->hips = hips_create(url, 0, NULL);
+    hips_prefetch(mw->hips);
     return 0;
 }
 
@@ -75,6 +92,24 @@ static int milkyway_add_data_source(
  * Meta class declarations.
  */
 
+/*
+ * Get the tiles visit stats of the last frame (see <hips_stats_t>).
+ */
+static json_value *milkyway_fn_tiles_stats(obj_t *obj, const attribute_t *attr,
+                                           const json_value *args)
+{
+    milkyway_t *mw = (void*)obj;
+    if (!mw->hips) return json_object_new(0);
+    return hips_get_stats_json(mw->hips);
+}
+
+static void milkyway_get_memory(const obj_t *obj, int64_t *cpu,
+                                int64_t *gpu)
+{
+    const milkyway_t *mw = (const milkyway_t*)obj;
+    if (mw->hips) hips_get_memory(mw->hips, cpu, gpu);
+}
+
 static obj_klass_t milkyway_klass = {
     .id = "milkyway",
     .size = sizeof(milkyway_t),
@@ -83,9 +118,11 @@ static obj_klass_t milkyway_klass = {
     .update = milkyway_update,
     .render = milkyway_render,
     .add_data_source = milkyway_add_data_source,
+    .get_memory = milkyway_get_memory,
     .render_order = 5,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(milkyway_t, visible.target)),
+        PROPERTY(tiles_stats, TYPE_JSON, .fn = milkyway_fn_tiles_stats),
         {}
     },
 };
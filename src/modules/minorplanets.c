@@ -22,6 +22,23 @@ static const double ECLIPTIC_ROT[3][3] = {
 
 // Minor planets module
 
+// Number of workers used for the batch computation of all the positions.
+#define BATCH_NB_WORKERS 4
+// Max age (days) of the batch positions, after which we don't use them to
+// find the minor planets visible on screen.
+#define BATCH_MAX_AGE 1.0
+// Extra magnitude computed by the batch over the last render limit, so that
+// we don't have to restart it each time we zoom in a bit.
+#define BATCH_MAG_MARGIN 1.0
+
+// The catalog minor planets are bucketed by the brightest magnitude they
+// can reach, with 1 mag wide buckets.  The first bucket also gets all the
+// bodies brighter than MAG_BUCKETS_MIN, and the last one all the fainter.
+#define MAG_BUCKETS_NB 32
+#define MAG_BUCKETS_MIN -2.0
+// Brightest magnitude value used for the bodies without a lower bound.
+#define MIN_VMAG_NONE -100.0
+
 typedef struct orbit_t {
     float d;    // date (julian day).
     float i;    // inclination (rad).
@@ -48,6 +65,7 @@ struct mplanet {
     int         mpl_number; // Minor planet number if one has been assigned.
     char        model[64];  // Model name. e.g: '1_Ceres'
     bool        no_model;
+    int         catalog_idx; // Index in the module catalog, or -1.
 
     // Cached values.
     float       vmag;
@@ -57,6 +75,25 @@ struct mplanet {
     mplanet_t   *visible_next, *visible_prev;
 };
 
+/*
+ * Type: mplanet_entry_t
+ * Packed data of a minor planet in the module catalog.  The mplanet_t
+ * objects are only created for the bodies we actually need (see
+ * mplanets_get_obj), and released once they are no longer visible or
+ * referenced (see catalog_drop_obj).
+ */
+typedef struct mplanet_entry {
+    double      elements[8]; // d, i, o, w, a, n, e, m (see orbit_t).
+    float       h;
+    float       g;
+    int         number;
+    int         orbit_type;
+    int         name;   // Offset of the name in the strings table.
+    int         desig;  // Offset of the designation in the strings table.
+    float       min_vmag; // Brightest possible magnitude.
+    mplanet_t   *obj;   // Weak pointer to the created object or NULL.
+} mplanet_entry_t;
+
 /*
  * Type: mplanets_t
  * Minor planets module object
@@ -64,13 +101,67 @@ struct mplanet {
 typedef struct mplanets {
     obj_t   obj;
     char    *source_url;
+    bool    source_is_eph;
     bool    parsed; // Set to true once the data has been parsed.
+    bool    released; // Data released, only parse it again once visible.
     bool    visible;
     double hints_mag_offset; // Hints/labels magnitude offset
     bool   hints_visible;
 
     mplanet_t *render_current;
     mplanet_t *visibles; // Linked list of currently visible minor planets.
+
+    // Visible minor planets indexed for the occultation tests, and the
+    // observer hash they were computed for (reset every frame).
+    occluders_t *occluders;
+    uint64_t    occluders_hash;
+
+    // All the minor planets loaded from the data sources.
+    struct {
+        int             nb;
+        int             allocated;
+        mplanet_entry_t *entries;
+        char            *strs;  // Null terminated names and designations.
+        int             strs_size;
+        int             strs_allocated;
+        struct {
+            int         nb;
+            int         allocated;
+            int         *idx;
+        } buckets[MAG_BUCKETS_NB];
+    } catalog;
+    double  render_limit_mag; // Magnitude limit used in the last render.
+
+    // Batch computation of the positions of all the catalog minor planets
+    // in the workers pool.  'running' is the batch being computed, 'done'
+    // the last finished one.  Only the bodies of the magnitude buckets
+    // under limit_mag are computed, sorted by bucket.
+    struct mplanets_batch {
+        int         nb;
+        int         catalog_nb; // Size of the catalog at the batch start.
+        double      tt;
+        double      limit_mag;
+        double      earth_pvh[2][3];
+        int         bucket_ofs[MAG_BUCKETS_NB + 1];
+        int         *idx;           // Catalog indices.
+        double      (*elements)[8];
+        float       (*hg)[2];
+        double      (*pvh)[2][3];   // Heliocentric ICRF (AU, AU/day).
+        float       *vmag;          // Magnitude ignoring light time.
+    } running, done;
+    worker_t    workers[BATCH_NB_WORKERS];
+    bool        batch_running;
+    double      batch_start_time;   // Unix time of the running batch start.
+    double      batch_duration;     // Duration of the last batch (s).
+
+    // Buffers used at render time.
+    struct {
+        int         size;
+        int         *candidates;    // Catalog indices.
+        double      (*pos)[3];
+        double      (*win)[2];
+        bool        *visible;
+    } buf;
 } mplanets_t;
 
 // Static instance.
@@ -118,14 +209,105 @@ static const char *ORBIT_TYPES[] = {
 };
 
 
+/*
+ * Compute the brightest magnitude a minor planet can reach: at perihelion,
+ * at opposition, with the earth at its aphelion distance.  Return
+ * MIN_VMAG_NONE for the bodies that can get close to the earth.
+ */
+static double compute_min_vmag(double h, double a, double e)
+{
+    const double earth_r = 1.017;
+    double q = a * (1 - e); // Perihelion distance.
+    if (q < earth_r + 0.1) return MIN_VMAG_NONE;
+    return h + 5 * log10(q * (q - earth_r));
+}
+
+static int mag_bucket(double vmag)
+{
+    if (vmag < MAG_BUCKETS_MIN + 1) return 0;
+    return fmin(floor(vmag - MAG_BUCKETS_MIN), MAG_BUCKETS_NB - 1);
+}
+
+// Return the brightest magnitude of the bodies in a bucket.
+static double mag_bucket_min(int bucket)
+{
+    return bucket ? MAG_BUCKETS_MIN + bucket : MIN_VMAG_NONE;
+}
+
+// Add a string to the catalog strings table and return its offset.
+static int catalog_add_str(mplanets_t *mps, const char *str)
+{
+    int ofs, len = strlen(str);
+    if (!len) return 0; // Offset 0 is always the empty string.
+    if (!mps->catalog.strs_size) mps->catalog.strs_size = 1;
+    if (mps->catalog.strs_size + len + 1 > mps->catalog.strs_allocated) {
+        mps->catalog.strs_allocated =
+            mps->catalog.strs_allocated * 2 + len + 1024;
+        mps->catalog.strs = realloc(mps->catalog.strs,
+                                    mps->catalog.strs_allocated);
+        mps->catalog.strs[0] = '\0';
+    }
+    ofs = mps->catalog.strs_size;
+    memcpy(mps->catalog.strs + ofs, str, len + 1);
+    mps->catalog.strs_size += len + 1;
+    return ofs;
+}
+
+/*
+ * Add a minor planet to the catalog.
+ *
+ * Parameters:
+ *   elements   - Orbit elements (d, i, o, w, a, n, e, m), with the angles
+ *                in radians.
+ *   h          - Absolute magnitude.
+ *   g          - Slope parameter.
+ *   number     - MPC number, or 0.
+ *   orbit_type - MPC orbit type (first 6 bits of the flags).
+ *   name       - Name, or empty string.
+ *   desig      - Principal designation, or empty string.
+ */
+static void catalog_add(mplanets_t *mps, const double elements[8],
+                        double h, double g, int number, int orbit_type,
+                        const char *name, const char *desig)
+{
+    mplanet_entry_t *entry;
+    int idx = mps->catalog.nb;
+    typeof(mps->catalog.buckets[0]) *bucket;
+
+    if (orbit_type < 0 || orbit_type >= ARRAY_SIZE(ORBIT_TYPES))
+        orbit_type = 0;
+    if (mps->catalog.nb >= mps->catalog.allocated) {
+        mps->catalog.allocated = mps->catalog.allocated * 2 ?: 1024;
+        mps->catalog.entries = realloc(
+                mps->catalog.entries,
+                mps->catalog.allocated * sizeof(*mps->catalog.entries));
+    }
+    entry = &mps->catalog.entries[mps->catalog.nb++];
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->elements, elements, sizeof(entry->elements));
+    entry->h = h;
+    entry->g = g;
+    entry->number = number;
+    entry->orbit_type = orbit_type;
+    entry->name = catalog_add_str(mps, name);
+    entry->desig = catalog_add_str(mps, desig);
+    entry->min_vmag = compute_min_vmag(h, elements[4], elements[6]);
+
+    bucket = &mps->catalog.buckets[mag_bucket(entry->min_vmag)];
+    if (bucket->nb >= bucket->allocated) {
+        bucket->allocated = bucket->allocated * 2 ?: 256;
+        bucket->idx = realloc(bucket->idx,
+                              bucket->allocated * sizeof(*bucket->idx));
+    }
+    bucket->idx[bucket->nb++] = idx;
+}
+
 static void load_data(mplanets_t *mplanets, const char *data, int size)
 {
     const char *line = NULL;
-    int r, len, line_idx = 0, flags, orbit_type, number, nb_err, nb;
+    int r, len, line_idx = 0, flags, number, nb_err, nb = 0;
     char desig[24], name[24];
     double h, g, m, w, o, i, e, n, a, epoch;
-    mplanet_t *mplanet;
-    obj_t *tmp;
 
     line_idx = 0;
     nb_err = 0;
@@ -139,46 +321,170 @@ static void load_data(mplanets_t *mplanets, const char *data, int size)
             nb_err++;
             continue;
         }
-        mplanet = (void*)module_add_new(&mplanets->obj, "asteroid", NULL);
-        mplanet->orbit.d = epoch;
-        mplanet->orbit.m = m * DD2R;
-        mplanet->orbit.w = w * DD2R;
-        mplanet->orbit.o = o * DD2R;
-        mplanet->orbit.i = i * DD2R;
-        mplanet->orbit.e = e;
-        mplanet->orbit.n = n * DD2R;
-        mplanet->orbit.a = a;
-        mplanet->h = h;
-        mplanet->g = g;
-
-        orbit_type = flags & 0x3f;
-        strncpy(mplanet->obj.type, ORBIT_TYPES[orbit_type], 4);
-        mplanet->mpl_number = number;
-        if (name[0]) {
-            _Static_assert(sizeof(name) == sizeof(mplanet->name), "");
-            memcpy(mplanet->name, name, sizeof(name));
-            snprintf(mplanet->model, sizeof(mplanet->model), "%d_%s",
-                     mplanet->mpl_number, mplanet->name);
-        }
-        if (desig[0]) {
-            _Static_assert(sizeof(desig) == sizeof(mplanet->desig), "");
-            memcpy(mplanet->desig, desig, sizeof(desig));
-        }
+        catalog_add(mplanets, (double[8]) {
+                        epoch, i * DD2R, o * DD2R, w * DD2R, a, n * DD2R, e,
+                        m * DD2R},
+                    h, g, number, flags & 0x3f, name, desig);
+        nb++;
     }
     if (nb_err) {
         LOG_W("Minor planet data got %d errors lines.", nb_err);
     }
-    DL_COUNT(mplanets->obj.children, tmp, nb);
     LOG_I("Parsed %d asteroids", nb);
 }
 
+static int on_mpco_chunk(const char type[4], const void *data, int size,
+                         const json_value *json, void *user)
+{
+    mplanets_t *mps = USER_GET(user, 0);
+    int *nb = USER_GET(user, 1);
+    int version, data_ofs = 0, row_size, flags, n, i, strs_size, table_size;
+    int number, orbit_type, name_ofs, desig_ofs;
+    double epoch, h, g, m, w, o, inc, e, mm, a;
+    void *table = NULL;
+    char *strs = NULL;
+    eph_table_column_t columns[] = {
+        {"numb", 'i'},
+        {"type", 'i'},
+        {"epoc", 'd'},
+        {"h",    'f', EPH_VMAG},
+        {"g",    'f'},
+        {"m",    'f', EPH_RAD},
+        {"w",    'f', EPH_RAD},
+        {"o",    'f', EPH_RAD},
+        {"i",    'f', EPH_RAD},
+        {"e",    'f'},
+        {"n",    'f', EPH_RAD},
+        {"a",    'f'},
+        {"name", 'i'},
+        {"desg", 'i'},
+    };
+
+    if (strncmp(type, "MPCO", 4) != 0) return 0;
+    if (size < 4) goto error;
+    memcpy(&version, data, 4);
+    data_ofs += 4;
+    n = eph_read_table_header(version, data, size, &data_ofs, &row_size,
+                              &flags, ARRAY_SIZE(columns), columns);
+    if (n < 0) goto error;
+    table = eph_read_compressed_block(data, size, &data_ofs, &table_size);
+    strs = eph_read_compressed_block(data, size, &data_ofs, &strs_size);
+    if (!table || !strs || !strs_size || strs[strs_size - 1]) goto error;
+    if (flags & 1) eph_shuffle_bytes(table, row_size, n);
+
+    data_ofs = 0;
+    for (i = 0; i < n; i++) {
+        eph_read_table_row(table, table_size, &data_ofs,
+                           ARRAY_SIZE(columns), columns,
+                           &number, &orbit_type, &epoch, &h, &g,
+                           &m, &w, &o, &inc, &e, &mm, &a,
+                           &name_ofs, &desig_ofs);
+        if (name_ofs < 0 || name_ofs >= strs_size ||
+            desig_ofs < 0 || desig_ofs >= strs_size) goto error;
+        catalog_add(mps, (double[8]) {epoch, inc, o, w, a, mm, e, m},
+                    h, g, number, orbit_type,
+                    strs + name_ofs, strs + desig_ofs);
+        (*nb)++;
+    }
+    free(table);
+    free(strs);
+    return 0;
+
+error:
+    LOG_E("Cannot parse minor planets eph data");
+    free(table);
+    free(strs);
+    return -1;
+}
+
+static void load_eph_data(mplanets_t *mps, const char *data, int size)
+{
+    int nb = 0;
+    eph_load(data, size, USER_PASS(mps, &nb), on_mpco_chunk);
+    LOG_I("Parsed %d asteroids", nb);
+}
+
+/*
+ * Create the object of a catalog minor planet.  The returned object is not
+ * added to the module yet.
+ */
+static mplanet_t *catalog_create_obj(mplanets_t *mps, int idx)
+{
+    const mplanet_entry_t *entry = &mps->catalog.entries[idx];
+    const char *name = mps->catalog.strs + entry->name;
+    mplanet_t *mp;
+
+    mp = (void*)obj_create("asteroid", NULL);
+    mp->orbit = (orbit_t) {
+        entry->elements[0], entry->elements[1], entry->elements[2],
+        entry->elements[3], entry->elements[4], entry->elements[5],
+        entry->elements[6], entry->elements[7]};
+    mp->h = entry->h;
+    mp->g = entry->g;
+    strncpy(mp->obj.type, ORBIT_TYPES[entry->orbit_type], 4);
+    mp->mpl_number = entry->number;
+    if (*name) {
+        snprintf(mp->name, sizeof(mp->name), "%s", name);
+        snprintf(mp->model, sizeof(mp->model), "%d_%s",
+                 mp->mpl_number, mp->name);
+    }
+    snprintf(mp->desig, sizeof(mp->desig), "%s",
+             mps->catalog.strs + entry->desig);
+    mp->catalog_idx = idx;
+    return mp;
+}
+
+// Add a created catalog object to the module.
+static void catalog_adopt_obj(mplanets_t *mps, mplanet_t *mp)
+{
+    module_add(&mps->obj, &mp->obj);
+    mps->catalog.entries[mp->catalog_idx].obj = mp;
+}
+
+/*
+ * Return the object of a catalog minor planet, creating it if needed.
+ * The returned reference is owned by the module.
+ */
+static mplanet_t *mplanets_get_obj(mplanets_t *mps, int idx)
+{
+    mplanet_t *mp = mps->catalog.entries[idx].obj;
+    if (mp) return mp;
+    mp = catalog_create_obj(mps, idx);
+    catalog_adopt_obj(mps, mp);
+    obj_release(&mp->obj);
+    return mp;
+}
+
+/*
+ * Remove the object of a catalog minor planet from the module if nothing
+ * else holds a reference to it, so that we only keep the objects of the
+ * visible bodies.  It is created again from the catalog when needed.
+ */
+static void catalog_drop_obj(mplanets_t *mps, mplanet_t *mp)
+{
+    if (mp->catalog_idx < 0 || mp->obj.ref > 1) return;
+    if (&mp->obj == core->selection) return;
+    assert(!mp->visible_prev);
+    if (mps->render_current == mp)
+        mps->render_current = (void*)mp->obj.next;
+    mps->occluders_hash = 0; // The occluders may point to the object.
+    module_remove(&mps->obj, &mp->obj);
+}
+
 static int mplanets_add_data_source(
         obj_t *obj, const char *url, const char *key)
 {
     mplanets_t *mplanets = (void*)obj;
-    if (strcmp(key, "mpc_asteroids") != 0) return 1;
-    mplanets->source_url = strdup(url);
-    return 0;
+    if (strcmp(key, "mpc_asteroids") == 0) {
+        mplanets->source_url = strdup(url);
+        return 0;
+    }
+    if (strcmp(key, "eph/mpc") == 0) {
+        mplanets->source_url = strdup(url);
+        mplanets->source_is_eph = true;
+        return 0;
+    }
+    return 1;
 }
 
 static int mplanet_init(obj_t *obj, json_value *args)
@@ -188,6 +494,7 @@ static int mplanet_init(obj_t *obj, json_value *args)
     orbit_t *orbit = &mp->orbit;
     json_value *model, *names;
     int num = -1;
+    mp->catalog_idx = -1;
     model = json_get_attr(args, "model_data", json_object);
     if (model) {
         mp->h = json_get_attr_f(model, "H", 0);
@@ -215,7 +522,23 @@ static int mplanet_init(obj_t *obj, json_value *args)
     return 0;
 }
 
-static int mplanet_update(mplanet_t *mp, const observer_t *obs)
+static void mplanet_del(obj_t *obj)
+{
+    mplanet_t *mp = (void*)obj;
+    if (mp->catalog_idx >= 0 && g_mplanets &&
+            g_mplanets->catalog.entries[mp->catalog_idx].obj == mp)
+        g_mplanets->catalog.entries[mp->catalog_idx].obj = NULL;
+}
+
+/*
+ * Compute the minor planet apparent position and magnitude for a given
+ * observer.
+ *
+ * This only reads the orbit data, so that the info queries can be run
+ * without modifying the object.
+ */
+static void mplanet_compute(const mplanet_t *mp, const observer_t *obs,
+                            double out_pvo[2][4], double *vmag)
 {
     double pvh[2][3], pvo[2][3];
 
@@ -226,14 +549,21 @@ static int mplanet_update(mplanet_t *mp, const observer_t *obs)
     mat3_mul_vec3(ECLIPTIC_ROT, pvh[0], pvh[0]);
     mat3_mul_vec3(ECLIPTIC_ROT, pvh[1], pvh[1]);
     position_to_apparent(obs, ORIGIN_HELIOCENTRIC, false, pvh, pvo);
-    vec3_copy(pvo[0], mp->pvo[0]);
-    vec3_copy(pvo[1], mp->pvo[1]);
-    mp->pvo[0][3] = 1.0; // AU unit.
-    mp->pvo[1][3] = 1.0;
+    vec3_copy(pvo[0], out_pvo[0]);
+    vec3_copy(pvo[1], out_pvo[1]);
+    out_pvo[0][3] = 1.0; // AU unit.
+    out_pvo[1][3] = 1.0;
 
     // Compute vmag using algo from
     // http://www.britastro.org/asteroids/dymock4.pdf
-    mp->vmag = compute_magnitude(mp->h, mp->g, pvh[0], pvo[0]);
+    *vmag = compute_magnitude(mp->h, mp->g, pvh[0], pvo[0]);
+}
+
+static int mplanet_update(mplanet_t *mp, const observer_t *obs)
+{
+    double vmag;
+    mplanet_compute(mp, obs, mp->pvo, &vmag);
+    mp->vmag = vmag;
     return 0;
 }
 
@@ -253,20 +583,20 @@ static int mplanet_get_info(const obj_t *obj, const observer_t *obs, int info,
                             void *out)
 {
     const mplanet_t *mp = (const mplanet_t*)obj;
-    double radius;
+    double radius, pvo[2][4], vmag;
 
-    mplanet_update((mplanet_t*)mp, obs);
+    mplanet_compute(mp, obs, pvo, &vmag);
     switch (info) {
     case INFO_PVO:
-        memcpy(out, mp->pvo, sizeof(mp->pvo));
+        memcpy(out, pvo, sizeof(pvo));
         return 0;
     case INFO_VMAG:
-        *(double*)out = mp->vmag;
+        *(double*)out = vmag;
         return 0;
     case INFO_RADIUS:
         radius = mplanet_get_radius(mp);
         if (radius == 0) return 1;
-        *(double*)out = radius / vec3_norm(mp->pvo[0]);
+        *(double*)out = radius / vec3_norm(pvo[0]);
         return 0;
     }
     return 1;
@@ -400,41 +730,232 @@ static int mplanets_init(obj_t *obj, json_value *args)
     g_mplanets = mps;
     mps->visible = true;
     mps->hints_visible = true;
+    mps->render_limit_mag = 10;
     return 0;
 }
 
+static void batch_release(struct mplanets_batch *batch)
+{
+    free(batch->idx);
+    free(batch->elements);
+    free(batch->hg);
+    free(batch->pvh);
+    free(batch->vmag);
+    memset(batch, 0, sizeof(*batch));
+}
+
+/*
+ * Worker function for the batch computation.  Each worker computes a
+ * slice of the bodies.
+ */
+static int batch_worker(worker_t *w)
+{
+    mplanets_t *mps = w->user;
+    struct mplanets_batch *batch = &mps->running;
+    int i, k = w - mps->workers;
+    int start = batch->nb * k / BATCH_NB_WORKERS;
+    int end = batch->nb * (k + 1) / BATCH_NB_WORKERS;
+    double po[3];
+
+    orbit_compute_pv_batch(end - start, batch->tt,
+                           (const double (*)[8])batch->elements + start,
+                           batch->pvh + start);
+    for (i = start; i < end; i++) {
+        mat3_mul_vec3(ECLIPTIC_ROT, batch->pvh[i][0], batch->pvh[i][0]);
+        mat3_mul_vec3(ECLIPTIC_ROT, batch->pvh[i][1], batch->pvh[i][1]);
+        vec3_sub(batch->pvh[i][0], batch->earth_pvh[0], po);
+        batch->vmag[i] = compute_magnitude(batch->hg[i][0], batch->hg[i][1],
+                                           batch->pvh[i][0], po);
+    }
+    return 0;
+}
+
+static void batch_start(mplanets_t *mps, const observer_t *obs)
+{
+    int i, b, n, nb = 0;
+    const mplanet_entry_t *entry;
+    struct mplanets_batch *batch = &mps->running;
+
+    batch->limit_mag = mps->render_limit_mag + BATCH_MAG_MARGIN;
+    for (b = 0; b < MAG_BUCKETS_NB; b++) {
+        if (mag_bucket_min(b) > batch->limit_mag) break;
+        nb += mps->catalog.buckets[b].nb;
+    }
+
+    // Copy the elements, since the catalog can grow while the workers run.
+    batch->idx = calloc(nb, sizeof(*batch->idx));
+    batch->elements = calloc(nb, sizeof(*batch->elements));
+    batch->hg = calloc(nb, sizeof(*batch->hg));
+    batch->pvh = calloc(nb, sizeof(*batch->pvh));
+    batch->vmag = calloc(nb, sizeof(*batch->vmag));
+    batch->catalog_nb = mps->catalog.nb;
+    batch->tt = obs->tt;
+    memcpy(batch->earth_pvh, obs->earth_pvh, sizeof(batch->earth_pvh));
+    for (b = 0; b < MAG_BUCKETS_NB; b++) {
+        batch->bucket_ofs[b] = batch->nb;
+        if (batch->nb == nb) continue;
+        for (i = 0; i < mps->catalog.buckets[b].nb; i++) {
+            n = batch->nb++;
+            batch->idx[n] = mps->catalog.buckets[b].idx[i];
+            entry = &mps->catalog.entries[batch->idx[n]];
+            memcpy(batch->elements[n], entry->elements,
+                   sizeof(*batch->elements));
+            batch->hg[n][0] = entry->h;
+            batch->hg[n][1] = entry->g;
+        }
+    }
+    batch->bucket_ofs[MAG_BUCKETS_NB] = batch->nb;
+    for (i = 0; i < BATCH_NB_WORKERS; i++) {
+        worker_init(&mps->workers[i], batch_worker);
+        mps->workers[i].user = mps;
+    }
+    mps->batch_start_time = sys_get_unix_time();
+    mps->batch_running = true;
+}
+
+static void batch_iter(mplanets_t *mps)
+{
+    int i;
+    bool done = true;
+
+    for (i = 0; i < BATCH_NB_WORKERS; i++)
+        done = worker_iter(&mps->workers[i]) && done;
+    if (!done) return;
+    batch_release(&mps->done);
+    mps->done = mps->running;
+    memset(&mps->running, 0, sizeof(mps->running));
+    mps->batch_duration = sys_get_unix_time() - mps->batch_start_time;
+    mps->batch_running = false;
+}
+
+// Test whether we should start a new batch for a given observer.
+static bool batch_needed(const mplanets_t *mps, const observer_t *obs)
+{
+    // Don't start batches that would be outdated once finished because
+    // of the time speed.
+    return !mps->batch_running && mps->visible && mps->catalog.nb &&
+           (fabs(obs->tt - mps->done.tt) > BATCH_MAX_AGE / 2 ||
+            mps->done.catalog_nb != mps->catalog.nb ||
+            mps->render_limit_mag > mps->done.limit_mag) &&
+           !core_is_outdated_at_time_speed(mps->batch_duration,
+                                           BATCH_MAX_AGE);
+}
+
 static int mplanets_update(obj_t *obj, double dt)
 {
     int size, code;
     const char *data;
     mplanets_t *mps = (void*)obj;
+    const observer_t *obs = core->observer;
 
-    if (!mps->parsed && mps->source_url) {
+    mps->occluders_hash = 0;
+    if (mps->batch_running) batch_iter(mps);
+    if (batch_needed(mps, obs)) batch_start(mps, obs);
+
+    if (!mps->parsed && mps->source_url &&
+            (mps->visible || !mps->released)) {
         data = asset_get_data(mps->source_url, &size, &code);
         if (!code) return 0; // Still loading.
         mps->parsed = true;
+        mps->released = false;
         if (!data) {
             LOG_W("Cannot read asteroids data: %s (%d)", mps->source_url, code);
             return 0;
         }
-        load_data(mps, data, size);
+        if (mps->source_is_eph)
+            load_eph_data(mps, data, size);
+        else
+            load_data(mps, data, size);
         asset_release(mps->source_url);
     }
     return 0;
 }
 
+// Start the next batch while the renderer flushes the frame.
+static int mplanets_update_ahead(obj_t *obj, const observer_t *next)
+{
+    mplanets_t *mps = (void*)obj;
+    if (mps->batch_running) batch_iter(mps);
+    if (batch_needed(mps, next)) batch_start(mps, next);
+    return 0;
+}
+
 static void add_to_visible(mplanets_t *mps, mplanet_t *mplanet)
 {
     if (mplanet->visible_prev) return;
     DL_APPEND2(mps->visibles, mplanet, visible_prev, visible_next);
 }
 
+/*
+ * Use the last batch positions to find all the catalog minor planets that
+ * could be visible on screen, and render them.  The positions are linearly
+ * extrapolated to the current time and only used to select the candidates,
+ * the rendering itself uses the exact positions.  The objects of the
+ * candidates are created as needed.
+ *
+ * Return false if we don't have recent enough batch positions.
+ */
+static bool mplanets_render_candidates(mplanets_t *mps,
+                                       const painter_t *painter)
+{
+    const observer_t *obs = painter->obs;
+    const struct mplanets_batch *batch = &mps->done;
+    // Same test as in mplanet_render, with some margin since we ignore
+    // the light time and the phase changes.
+    const double limit_mag = painter->stars_limit_mag + 1.4 +
+                             mps->hints_mag_offset + 0.5;
+    double dt = obs->tt - batch->tt;
+    int i, b, n = 0;
+    const mplanet_entry_t *entry;
+    mplanet_t *mp;
+
+    mps->render_limit_mag = limit_mag;
+    if (!batch->nb || fabs(dt) > BATCH_MAX_AGE) return false;
+
+    if (batch->nb > mps->buf.size) {
+        mps->buf.size = batch->nb;
+        mps->buf.candidates = realloc(
+                mps->buf.candidates, batch->nb * sizeof(*mps->buf.candidates));
+        mps->buf.pos = realloc(
+                mps->buf.pos, batch->nb * sizeof(*mps->buf.pos));
+        mps->buf.win = realloc(
+                mps->buf.win, batch->nb * sizeof(*mps->buf.win));
+        mps->buf.visible = realloc(
+                mps->buf.visible, batch->nb * sizeof(*mps->buf.visible));
+    }
+
+    // Skip all the buckets that are too faint.
+    for (b = 0; b < MAG_BUCKETS_NB && mag_bucket_min(b) <= limit_mag; b++) {
+        for (i = batch->bucket_ofs[b]; i < batch->bucket_ofs[b + 1]; i++) {
+            if (batch->vmag[i] > limit_mag) continue;
+            entry = &mps->catalog.entries[batch->idx[i]];
+            if (entry->obj && entry->obj->visible_prev) continue;
+            vec3_addk(batch->pvh[i][0], batch->pvh[i][1], dt,
+                      mps->buf.pos[n]);
+            vec3_sub(mps->buf.pos[n], obs->earth_pvh[0], mps->buf.pos[n]);
+            mps->buf.candidates[n++] = batch->idx[i];
+        }
+    }
+
+    painter_project_batch(painter, FRAME_ICRF, n,
+                          (const double (*)[3])mps->buf.pos, false, true,
+                          mps->buf.win, mps->buf.visible);
+    for (i = 0; i < n; i++) {
+        if (!mps->buf.visible[i]) continue;
+        mp = mplanets_get_obj(mps, mps->buf.candidates[i]);
+        if (mplanet_render(&mp->obj, painter) == 1) add_to_visible(mps, mp);
+        else catalog_drop_obj(mps, mp);
+    }
+    return true;
+}
+
 static int mplanets_render(obj_t *obj, const painter_t *painter)
 {
     mplanets_t *mps = (void*)obj;
     int i, r;
     const int update_nb = 32;
-    mplanet_t *child, *tmp;
+    bool batch_ok;
+    mplanet_t *child, *tmp, *next;
 
     if (!mps->visible) return 0;
 
@@ -445,20 +966,31 @@ static int mplanets_render(obj_t *obj, const painter_t *painter)
     }
 
     // Render all the flagged visible minor planets, remove those that are
-    // no longer visible.
+    // no longer visible, and release their objects.
     DL_FOREACH_SAFE2(mps->visibles, child, tmp, visible_next) {
         r = mplanet_render(&child->obj, painter);
         if (r == 0 && &child->obj != core->selection) {
             DL_DELETE2(mps->visibles, child, visible_prev, visible_next);
             child->visible_prev = NULL;
+            catalog_drop_obj(mps, child);
         }
     }
 
-    // Then iter part of the full list as well.
+    batch_ok = mplanets_render_candidates(mps, painter);
+
+    // Iter part of the full list for the bodies not covered by the batch.
+    // Note: without batch positions we only test the created objects.
     for (   i = 0, child = mps->render_current ?: (void*)mps->obj.children;
             child && i < update_nb;
-            i++, child = (void*)child->obj.next) {
+            i++, child = next) {
+        next = (void*)child->obj.next;
         if (child->visible_prev) continue; // Was already rendered.
+        // The batch already covers the catalog bodies, only release the
+        // objects that are no longer used, like the ones kept by a list.
+        if (batch_ok && child->catalog_idx >= 0) {
+            catalog_drop_obj(mps, child);
+            continue;
+        }
         r = mplanet_render(&child->obj, painter);
         if (r == 1) add_to_visible(mps, child);
     }
@@ -472,25 +1004,102 @@ static bool mplanets_is_point_occulted(
         const observer_t *obs, const obj_t *ignore)
 {
     mplanet_t *child;
-    const mplanets_t *mps = (const void*)module;
-    double p[3], d, r, dir[3], t, l2, d2;
-
-    d = vec3_norm(pos);
-    vec3_normalize(pos, dir);
-    DL_FOREACH2(mps->visibles, child, visible_next) {
-        if (&child->obj == ignore) continue;
-        mplanet_update(child, obs);
-        vec3_copy(child->pvo[0], p);
-        t = vec3_dot(dir, p);
-        if (t < 0) continue;
-        l2 = vec3_norm2(p);
-        if (!at_inf && d * d < l2) continue;
-        r = mplanet_get_radius(child);
-        if (r == 0) continue;
-        d2 = l2 - t * t;
-        if (d2 < r * r) return true;
-    }
-    return false;
+    mplanets_t *mps = (void*)module;
+
+    if (!mps->visibles) return false;
+    if (!mps->occluders) mps->occluders = occluders_create();
+    if (mps->occluders_hash != obs->hash) {
+        occluders_clear_all(mps->occluders);
+        DL_FOREACH2(mps->visibles, child, visible_next) {
+            mplanet_update(child, obs);
+            occluders_add(mps->occluders, child->pvo[0],
+                          mplanet_get_radius(child), &child->obj);
+        }
+        mps->occluders_hash = obs->hash;
+    }
+    return occluders_test(mps->occluders, pos, at_inf, ignore);
+}
+
+/*
+ * List all the minor planets.  For the catalog bodies without an object
+ * yet, we pass a temporary object to the callback, and only add it to the
+ * module if the callback kept a reference to it.
+ */
+/*
+ * List the minor planets, skipping the catalog entries flagged in the
+ * optional skip array.
+ */
+static int mplanets_list_(mplanets_t *mps, double max_mag, const bool *skip,
+                          void *user, int (*f)(void *user, obj_t *obj))
+{
+    bool test_vmag = !isnan(max_mag);
+    int i, r;
+    mplanet_t *mp;
+    obj_t *child;
+
+    for (i = 0; i < mps->catalog.nb; i++) {
+        if (skip && skip[i]) continue;
+        if (test_vmag && mps->catalog.entries[i].min_vmag > max_mag)
+            continue;
+        mp = mps->catalog.entries[i].obj;
+        if (mp) {
+            if (f(user, &mp->obj)) return 0;
+            continue;
+        }
+        mp = catalog_create_obj(mps, i);
+        r = f(user, &mp->obj);
+        if (mp->obj.ref > 1) catalog_adopt_obj(mps, mp);
+        obj_release(&mp->obj);
+        if (r) return 0;
+    }
+    DL_FOREACH(mps->obj.children, child) {
+        if (((mplanet_t*)child)->catalog_idx >= 0) continue;
+        if (f(user, child)) break;
+    }
+    return 0;
+}
+
+static int mplanets_list(const obj_t *obj,
+                         double max_mag, uint64_t hint,
+                         const char *sources, void *user,
+                         int (*f)(void *user, obj_t *obj))
+{
+    return mplanets_list_((mplanets_t*)obj, max_mag, NULL, user, f);
+}
+
+/*
+ * Same as mplanets_list, but use the last batch positions to skip the
+ * catalog minor planets far from the region, as we do for the rendering.
+ */
+static int mplanets_list_in_region(const obj_t *obj, const observer_t *obs,
+                                   const sky_region_t *region,
+                                   double max_mag, const char *sources,
+                                   void *user,
+                                   int (*f)(void *user, obj_t *obj))
+{
+    mplanets_t *mps = (void*)obj;
+    const struct mplanets_batch *batch = &mps->done;
+    // Margin for the linear extrapolation and the light time.
+    const double margin = 1.0 * DD2R;
+    double dt = obs->tt - batch->tt, pos[3], cap[4];
+    bool *skip;
+    int i, ret;
+
+    if (!batch->nb || fabs(dt) > BATCH_MAX_AGE)
+        return mplanets_list_(mps, max_mag, NULL, user, f);
+
+    skip = calloc(mps->catalog.nb, sizeof(*skip));
+    for (i = 0; i < batch->nb; i++) {
+        vec3_addk(batch->pvh[i][0], batch->pvh[i][1], dt, pos);
+        vec3_sub(pos, obs->earth_pvh[0], pos);
+        vec3_normalize(pos, cap);
+        cap[3] = cos(margin);
+        if (!sky_region_intersects_cap(region, cap))
+            skip[batch->idx[i]] = true;
+    }
+    ret = mplanets_list_(mps, max_mag, skip, user, f);
+    free(skip);
+    return ret;
 }
 
 /*
@@ -502,6 +1111,7 @@ static obj_klass_t mplanet_klass = {
     .model      = "mpc_asteroid",
     .size       = sizeof(mplanet_t),
     .init       = mplanet_init,
+    .del        = mplanet_del,
     .get_info   = mplanet_get_info,
     .render     = mplanet_render,
     .get_designations = mplanet_get_designations,
@@ -509,15 +1119,84 @@ static obj_klass_t mplanet_klass = {
 };
 OBJ_REGISTER(mplanet_klass)
 
+// Memory used by the catalog and the last batch, in bytes.
+static int catalog_get_size(const mplanets_t *mps)
+{
+    int i, size;
+    size = mps->catalog.allocated * sizeof(*mps->catalog.entries) +
+           mps->catalog.strs_allocated;
+    for (i = 0; i < MAG_BUCKETS_NB; i++)
+        size += mps->catalog.buckets[i].allocated * sizeof(int);
+    size += mps->done.nb * (sizeof(*mps->done.idx) +
+                            sizeof(*mps->done.elements) +
+                            sizeof(*mps->done.hg) + sizeof(*mps->done.pvh) +
+                            sizeof(*mps->done.vmag));
+    return size;
+}
+
+static void mplanets_get_memory(const obj_t *obj, int64_t *cpu, int64_t *gpu)
+{
+    const obj_t *child;
+    int nb;
+    DL_COUNT(obj->children, child, nb);
+    *cpu += catalog_get_size((const mplanets_t*)obj) + nb * sizeof(mplanet_t);
+}
+
+/*
+ * Release the catalog while the module is hidden.  The created objects
+ * are detached from the catalog, and removed from the module, and we parse
+ * the data source again once the module gets visible.
+ */
+static int mplanets_release_data(obj_t *obj, bool dry_run)
+{
+    mplanets_t *mps = (void*)obj;
+    mplanet_t *mp, *tmp;
+    int i, size;
+
+    if (mps->visible || !mps->parsed || !mps->source_url) return 0;
+    if (mps->batch_running) return 0;
+    size = catalog_get_size(mps);
+    if (dry_run) return size;
+
+    DL_FOREACH_SAFE2(mps->visibles, mp, tmp, visible_next) {
+        DL_DELETE2(mps->visibles, mp, visible_prev, visible_next);
+        mp->visible_prev = NULL;
+    }
+    if (mps->occluders) occluders_clear_all(mps->occluders);
+    mps->occluders_hash = 0;
+    mps->render_current = NULL;
+    for (i = 0; i < mps->catalog.nb; i++) {
+        mp = mps->catalog.entries[i].obj;
+        if (!mp) continue;
+        mp->catalog_idx = -1;
+        module_remove(&mps->obj, &mp->obj);
+    }
+    free(mps->catalog.entries);
+    free(mps->catalog.strs);
+    for (i = 0; i < MAG_BUCKETS_NB; i++)
+        free(mps->catalog.buckets[i].idx);
+    memset(&mps->catalog, 0, sizeof(mps->catalog));
+    batch_release(&mps->done);
+    mps->parsed = false;
+    mps->released = true;
+    LOG_I("Released the asteroids data (%d bytes)", size);
+    return size;
+}
+
 static obj_klass_t mplanets_klass = {
     .id             = "minor_planets",
     .size           = sizeof(mplanets_t),
     .flags          = OBJ_IN_JSON_TREE | OBJ_MODULE | OBJ_LISTABLE,
     .init           = mplanets_init,
     .add_data_source    = mplanets_add_data_source,
+    .release_data   = mplanets_release_data,
+    .get_memory     = mplanets_get_memory,
     .update         = mplanets_update,
+    .update_ahead   = mplanets_update_ahead,
     .render         = mplanets_render,
     .is_point_occulted = mplanets_is_point_occulted,
+    .list           = mplanets_list,
+    .list_in_region = mplanets_list_in_region,
     .render_order   = 20,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(mplanets_t, visible)),
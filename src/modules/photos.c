@@ -10,10 +10,17 @@
 #include "swe.h"
 
 // Support embedding online photos in the sky.
+//
+// Large photos can be given as a tiles pyramid instead (see
+// tools/make-photo-tiles.py), that we stream with the hips tiles code, so
+// that we only load the visible tiles at the needed resolution.
 
 typedef struct photo {
     obj_t       obj;
     texture_t   *img;
+    hips_t      *tiles; // Tiles pyramid, used instead of img if set.
+    int         tiles_w; // Full size of the pyramid image (px).
+    int         tiles_h;
     fader_t     visible;
     // Only render the shape if set.
     // Note: we could have more control, like rendering both the pic and
@@ -47,6 +54,22 @@ static json_value *photo_fn_url(obj_t *obj, const attribute_t *attr,
     return args_value_new(TYPE_STRING, photo->img->url);
 }
 
+static json_value *photo_fn_tiles_url(obj_t *obj, const attribute_t *attr,
+                                      const json_value *args)
+{
+    photo_t *photo = (void*)obj;
+    char url[1024];
+    if (args->u.array.length) {
+        hips_delete(photo->tiles);
+        args_get(args, TYPE_STRING, &url);
+        photo->tiles = hips_create(url, 0, NULL);
+        photo->tiles_w = photo->tiles_h = 0;
+        photo->mat[3][3] = 0; // Recompute with the new size.
+    }
+    if (!photo->tiles) return NULL;
+    return args_value_new(TYPE_STRING, photo->tiles->url);
+}
+
 static json_value *photo_fn_calibration(obj_t *obj, const attribute_t *attr,
                                         const json_value *args)
 {
@@ -85,19 +108,139 @@ static void photo_map(const uv_map_t *map, const double v[2], double out[4])
     vec4_copy(p, out);
 }
 
+// Project from a pyramid tile uv to the sphere: the map matrix transforms
+// the tile uv into the full image uv.
+static void photo_tile_map(const uv_map_t *map, const double v[2],
+                           double out[4])
+{
+    double p[3] = {v[0], v[1], 1.0};
+    mat3_mul_vec3(map->mat, p, p);
+    photo_map(map, p, out);
+}
+
+// Pixel index of a pyramid tile, with the bits of x and y interleaved, so
+// that the hips code can find the parent tiles.
+static int tile_pix(int order, int x, int y)
+{
+    int i, pix = 0;
+    for (i = 0; i < order; i++) {
+        pix |= ((x >> i) & 1) << (2 * i + 1);
+        pix |= ((y >> i) & 1) << (2 * i);
+    }
+    return pix;
+}
+
+/*
+ * Render the visible pyramid tiles under a given tile, at the render
+ * order.
+ *
+ * The tiles are aligned on the top left corner of the image, so the
+ * right and bottom tiles can be partially outside of it.  We only render
+ * their part inside the image.
+ */
+static void photo_render_tile(const photo_t *photo, const painter_t *painter,
+                              int order, int x, int y, int render_order)
+{
+    painter_t painter2 = *painter;
+    uv_map_t map = {.map = photo_tile_map, .transf = &photo->mat};
+    double size, w, h, uv[3][3];
+    texture_t *tex;
+    int i;
+
+    // Tile size in image uv, and part of the tile inside the image.
+    size = photo->tiles->tile_width * (1 << (photo->tiles->order - order));
+    w = fmin(1.0, photo->tiles_w / size - x);
+    h = fmin(1.0, photo->tiles_h / size - y);
+    if (w <= 0 || h <= 0) return;
+    mat3_set_identity(map.mat);
+    mat3_iscale(map.mat, size / photo->tiles_w, size / photo->tiles_h, 1);
+    mat3_itranslate(map.mat, x, y);
+    mat3_iscale(map.mat, w, h, 1);
+    if (painter_is_quad_clipped(painter, FRAME_ICRF, &map)) return;
+
+    if (order < render_order) {
+        for (i = 0; i < 4; i++) {
+            photo_render_tile(photo, painter, order + 1,
+                              x * 2 + i / 2, y * 2 + i % 2, render_order);
+        }
+        return;
+    }
+
+    mat3_set_identity(uv);
+    tex = hips_get_tile_texture(photo->tiles, order, tile_pix(order, x, y),
+                                HIPS_LOAD_IN_THREAD, uv, NULL, NULL);
+    if (!tex) return;
+    mat3_iscale(uv, w, h, 1);
+    painter_set_texture(&painter2, PAINTER_TEX_COLOR, tex, uv);
+    paint_quad(&painter2, FRAME_ICRF, &map, 4);
+}
+
+/*
+ * Get the full image size of a tiles pyramid photo from its properties.
+ * Return false if the properties are not loaded yet.
+ */
+static bool photo_load_tiles_size(photo_t *photo)
+{
+    hips_t *tiles = photo->tiles;
+    const char *str;
+
+    if (photo->tiles_w) return true;
+    if (!hips_is_ready(tiles)) return false;
+    str = json_get_attr_s(tiles->properties, "photo_width");
+    photo->tiles_w = str ? atoi(str) : 0;
+    str = json_get_attr_s(tiles->properties, "photo_height");
+    photo->tiles_h = str ? atoi(str) : 0;
+    if (!photo->tiles_w || !photo->tiles_h) {
+        LOG_W_ONCE("No photo size in the tiles properties (%s)", tiles->url);
+        photo->tiles_w = photo->tiles_h =
+            (tiles->tile_width ?: 256) * (1 << tiles->order);
+    }
+    return true;
+}
+
+/*
+ * Render a tiles pyramid photo, with the tiles pixels about the size of
+ * the screen pixels.
+ */
+static void photo_render_tiles(const photo_t *photo, const painter_t *painter)
+{
+    const hips_t *tiles = photo->tiles;
+    double win_h = painter->proj->window_size[1];
+    double f = fabs(painter->proj->mat[1][1]);
+    double lower = 1 - quality_get(&core->quality, QUALITY_HIPS);
+    int render_order;
+
+    // One screen pixel covers 2 / (f * win_h) rad, and one pixel of the
+    // order N tiles covers pixscale * 2^(order - N) rad.
+    render_order = ceil(tiles->order +
+            log2(photo->calibration.pixscale * f * win_h / 2) - lower);
+    render_order = clamp(render_order, 0, tiles->order);
+    photo_render_tile(photo, painter, 0, 0, 0, render_order);
+}
+
 static int photo_render(obj_t *obj, const painter_t *painter)
 {
      photo_t *photo = (photo_t*)obj;
     typeof(&photo->calibration) calibration = &photo->calibration;
     uv_map_t map = {};
     painter_t painter2 = *painter;
+    double w, h;
 
     fader_update(&photo->visible, 0.06);
     painter2.color[3] *= photo->visible.value;
     if (painter2.color[3] == 0.0) return 0;
 
-    // We can only compute the projection matrix once we get the texture?
-    if (!photo->img || !texture_load(photo->img, NULL)) return 0;
+    if (photo->tiles) {
+        if (!photo_load_tiles_size(photo)) return 0;
+        w = photo->tiles_w;
+        h = photo->tiles_h;
+    } else {
+        // We can only compute the projection matrix once we get the
+        // texture?
+        if (!photo->img || !texture_load(photo->img, NULL)) return 0;
+        w = photo->img->w;
+        h = photo->img->h;
+    }
 
     if (photo->mat[3][3] == 0) {
         mat4_set_identity(photo->mat);
@@ -105,15 +248,17 @@ static int photo_render(obj_t *obj, const painter_t *painter)
         mat4_ry(90 * DD2R - calibration->dec, photo->mat, photo->mat);
         mat4_rz(-90 * DD2R, photo->mat, photo->mat);
         mat4_rz(calibration->orientation, photo->mat, photo->mat);
-        mat4_iscale(photo->mat, calibration->pixscale * photo->img->w,
-                                calibration->pixscale * photo->img->h, 1.0);
+        mat4_iscale(photo->mat, calibration->pixscale * w,
+                                calibration->pixscale * h, 1.0);
         mat4_itranslate(photo->mat, -0.5, -0.5, 0.0);
     }
 
     map.transf = &photo->mat;
     map.map = photo_map;
 
-    if (!photo->render_shape) {
+    if (!photo->render_shape && photo->tiles) {
+        photo_render_tiles(photo, &painter2);
+    } else if (!photo->render_shape) {
         painter_set_texture(&painter2, PAINTER_TEX_COLOR, photo->img, NULL);
         paint_quad(&painter2, FRAME_ICRF, &map, 4);
     } else {
@@ -125,6 +270,13 @@ static int photo_render(obj_t *obj, const painter_t *painter)
     return 0;
 }
 
+static void photo_del(obj_t *obj)
+{
+    photo_t *photo = (photo_t*)obj;
+    texture_release(photo->img);
+    hips_delete(photo->tiles);
+}
+
 /*
  * Meta class declarations.
  */
@@ -133,9 +285,11 @@ static obj_klass_t photo_klass = {
     .id         = "photo",
     .size       = sizeof(photo_t),
     .render     = photo_render,
+    .del        = photo_del,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(photo_t, visible.target)),
         PROPERTY(url, TYPE_STRING_PTR, .fn = photo_fn_url),
+        PROPERTY(tiles_url, TYPE_STRING_PTR, .fn = photo_fn_tiles_url),
         PROPERTY(calibration, TYPE_JSON, .fn = photo_fn_calibration),
         PROPERTY(render_shape, TYPE_BOOL, MEMBER(photo_t, render_shape)),
         // Default properties.
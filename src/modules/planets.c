@@ -32,6 +32,24 @@ typedef struct elements
 
 typedef struct planet planet_t;
 
+// Flags of the values stored in the planets cache.
+enum {
+    CACHE_VMAG      = 1 << 0,
+    CACHE_PHASE     = 1 << 1,
+    CACHE_SHADOWS   = 1 << 2,
+};
+
+// Values computed for a given observer, so that we compute them at most
+// once per frame, even if they are used in several places.
+typedef struct planet_cache {
+    uint64_t    obs_hash;
+    int         flags;          // Union of CACHE_ values already computed.
+    double      vmag;
+    double      phase;
+    int         nb_shadows;
+    double      shadows[4][4];  // See get_shadow_candidates.
+} planet_cache_t;
+
 // The planet object klass.
 struct planet {
     obj_t       obj;
@@ -56,6 +74,18 @@ struct planet {
     uint64_t pvo_obs_hash;
     double pvo[2][3];
 
+    planet_cache_t cache;
+
+    // Optional precomputed Chebyshev ephemeris, relative to the parent
+    // body (ICRF, AU).  Loaded from the 'eph/cheb' data source.
+    struct {
+        double  start;      // Start of the first segment (MJD TT).
+        double  seg_len;    // Length of the segments (day).
+        int     nb_segs;
+        int     nb_coefs;   // Number of coefficients per axis.
+        double  *coefs;     // nb_segs * 3 * nb_coefs values.
+    } cheb;
+
     // Rotation elements
     struct {
         double obliquity;   // (rad)
@@ -117,6 +147,14 @@ typedef struct planets {
     // A multiplicator for srt_full_brightness.
     double srt_full_brightness_coef;
 
+    // Url of the Chebyshev ephemeris file, until it is loaded.
+    char *cheb_url;
+
+    // Planets indexed for the occultation tests, and the observer hash
+    // they were computed for (reset every frame).
+    occluders_t *occluders;
+    uint64_t    occluders_hash;
+
 } planets_t;
 
 // Static instance.
@@ -192,6 +230,10 @@ static const double VIS_ELEMENTS[][5] = {
             p; \
             p = (planet_t*)p->obj.next)
 
+// Size on screen (pixels) below which we render the planets hips with a
+// coarse sphere, using the allsky texture if available.
+#define PLANET_LOW_LOD_SIZE 32
+
 
 __attribute__((weak))
 void planetary_features_render(const painter_t *painter,
@@ -254,6 +296,29 @@ static int gust86_id(int id)
     }
 }
 
+/*
+ * Compute the position of a planet relative to its parent from the
+ * precomputed Chebyshev ephemeris.
+ *
+ * Return false if we don't have an ephemeris covering the time.
+ */
+static bool planet_get_cheb_pv(const planet_t *planet, double tt,
+                               double pv[2][3])
+{
+    double t;
+    int seg;
+
+    if (!planet->cheb.coefs) return false;
+    t = (tt - planet->cheb.start) / planet->cheb.seg_len;
+    if (t < 0 || t > planet->cheb.nb_segs) return false;
+    seg = (int)t;
+    if (seg == planet->cheb.nb_segs) seg--; // End of the last segment.
+    chebyshev_eval_pv(planet->cheb.nb_coefs,
+                      planet->cheb.coefs + seg * 3 * planet->cheb.nb_coefs,
+                      2 * (t - seg) - 1, 2 / planet->cheb.seg_len, pv);
+    return true;
+}
+
 /*
  * Function: planet_get_pvh
  * Get the heliocentric (ICRF) position of a planet at a given time.
@@ -264,6 +329,16 @@ static void planet_get_pvh(const planet_t *planet, const observer_t *obs,
     double dt, parent_pvh[2][3];
     int n;
 
+    // Use the precomputed ephemeris if possible.  This is faster than the
+    // cached value.
+    if (planet_get_cheb_pv(planet, obs->tt, pvh)) {
+        if (planet->parent->id != SUN) {
+            planet_get_pvh(planet->parent, obs, parent_pvh);
+            eraPvppv(pvh, parent_pvh, pvh);
+        }
+        return;
+    }
+
     // Use cached value if possible.
     if (planet->last_full_update) {
         dt = obs->tt - planet->last_full_update;
@@ -378,7 +453,7 @@ static void planet_get_pvo(const planet_t *planet, const observer_t *obs,
     double ldt;
 
     // Use cached value if possible.
-    if (obs->hash == planet->pvo_obs_hash) {
+    if (obs->hash_sky == planet->pvo_obs_hash) {
         eraCpv(planet->pvo, pvo);
         return;
     }
@@ -401,7 +476,7 @@ static void planet_get_pvo(const planet_t *planet, const observer_t *obs,
     astrometric_to_apparent(obs, pvo[0], false, pvo[0]);
 
     // Copy value into cache to speed up next access.
-    ((planet_t*)planet)->pvo_obs_hash = obs->hash;
+    ((planet_t*)planet)->pvo_obs_hash = obs->hash_sky;
     eraCpv(pvo, ((planet_t*)planet)->pvo);
 }
 
@@ -430,41 +505,49 @@ static double compute_sun_eclipse_factor(const planet_t *sun,
     double pvo[2][3];
     planet_t *p;
 
-    sun_r = 2.0 * sun->radius_m * DM2AU / vec3_norm(obs->sun_pvo[0]);
+    sun_r = sun->radius_m * DM2AU / vec3_norm(obs->sun_pvo[0]);
 
     PLANETS_ITER(sun->obj.parent, p) {
         if (p->id != MOON) continue; // Only consider the Moon.
         planet_get_pvo(p, obs, pvo);
-        sph_r = 2.0 * p->radius_m * DM2AU / vec3_norm(pvo[0]);
+        sph_r = p->radius_m * DM2AU / vec3_norm(pvo[0]);
         sep = vec3_sep(obs->sun_pvo[0], pvo[0]);
-        // Compute shadow factor.
-        // XXX: this should be in algos.
-        if (sep >= sun_r + sph_r) return 1.0; // Outside of shadow.
-        if (sep <= sph_r - sun_r) return 0.0; // Umbra.
-        if (sep <= sun_r - sph_r) // Penumbra completely inside.
-            return 1.0 - sph_r * sph_r / (sun_r * sun_r);
-        // Penumbra partially inside.
-        double x = (sun_r * sun_r + sep * sep - sph_r * sph_r) / (2.0 * sep);
-        double alpha = acos(x / sun_r);
-        double beta = acos((sep - x) / sph_r);
-        double AR = sun_r * sun_r * (alpha - 0.5 * sin(2.0 * alpha));
-        double Ar = sph_r * sph_r * (beta - 0.5 * sin(2.0 * beta));
-        double AS = sun_r * sun_r * 2.0 * 1.57079633;
-        return 1.0 - (AR + Ar) / AS;
+        return eclipse_factor(sun_r, sph_r, sep);
     }
     return 1.0;
 }
 
+/*
+ * Return the planet cache for a given observer.  If the cache was computed
+ * with an other observer it is reset first.
+ */
+static planet_cache_t *planet_get_cache(const planet_t *planet,
+                                        const observer_t *obs)
+{
+    planet_cache_t *cache = (planet_cache_t*)&planet->cache;
+    if (cache->obs_hash != obs->hash_sky) {
+        cache->obs_hash = obs->hash_sky;
+        cache->flags = 0;
+    }
+    return cache;
+}
+
 static double planet_get_phase(const planet_t *planet, const observer_t *obs)
 {
     double i;   // Phase angle.
     double pvh[2][3], pvo[2][3];
+    planet_cache_t *cache;
+
     if (planet->id == EARTH || planet->id == SUN)
         return NAN;
+    cache = planet_get_cache(planet, obs);
+    if (cache->flags & CACHE_PHASE) return cache->phase;
     planet_get_pvh(planet, obs, pvh);
     planet_get_pvo(planet, obs, pvo);
     i = vec3_sep(pvh[0], pvo[0]);
-    return 0.5 * cos(i) + 0.5;
+    cache->phase = 0.5 * cos(i) + 0.5;
+    cache->flags |= CACHE_PHASE;
+    return cache->phase;
 }
 
 static double sun_get_vmag(const planet_t *sun, const observer_t *obs)
@@ -518,7 +601,8 @@ static double rings_vmag(const planet_t *planet, const observer_t *obs)
     return (-2.60 + 1.25 * set) * set;
 }
 
-static double planet_get_vmag(const planet_t *planet, const observer_t *obs)
+static double planet_compute_vmag(const planet_t *planet,
+                                  const observer_t *obs)
 {
     const double *vis;  // Visual element of planet.
     double rho; // Distance to Earth (AU).
@@ -569,6 +653,16 @@ static double planet_get_vmag(const planet_t *planet, const observer_t *obs)
     }
 }
 
+static double planet_get_vmag(const planet_t *planet, const observer_t *obs)
+{
+    planet_cache_t *cache = planet_get_cache(planet, obs);
+    if (!(cache->flags & CACHE_VMAG)) {
+        cache->vmag = planet_compute_vmag(planet, obs);
+        cache->flags |= CACHE_VMAG;
+    }
+    return cache->vmag;
+}
+
 static void planet_get_mat(const planet_t *planet, const observer_t *obs,
                            double mat[4][4])
 {
@@ -694,32 +788,21 @@ static int on_render_tile(hips_t *hips, const painter_t *painter_,
     return 0;
 }
 
-static void ring_project(const uv_map_t *map, const double v[2], double out[4])
-{
-    const double *radii = map->user;
-    double theta, r, mat[3][3], p[4] = {1, 0, 0, 1};
-    theta = v[0] * 2 * M_PI;
-    r = mix(radii[0], radii[1], v[1]);
-    mat3_set_identity(mat);
-    mat3_rz(theta, mat, mat);
-    mat3_iscale(mat, r, r, 1.0);
-    mat3_mul_vec3(mat, p, p);
-    vec4_copy(p, out);
-}
-
+/*
+ * Render the rings of a planet.
+ *
+ * The ring grid only depends on the radii, so that the renderer can keep
+ * it cached, and we just need to change the split with the size of the
+ * planet on screen.
+ */
 static void render_rings(const planet_t *planet,
                          const painter_t *painter_,
-                         const double transf[4][4])
+                         const double transf[4][4],
+                         int split)
 {
     texture_t *tex = planet->rings.tex;
-    double inner_radius = planet->rings.inner_radius / planet->radius_m;
-    double outer_radius = planet->rings.outer_radius / planet->radius_m;
-    uv_map_t map = {
-        .map = ring_project,
-        .transf = (const void*)transf,
-    };
+    uv_map_t map;
     painter_t painter = *painter_;
-    const double radii[2] = {inner_radius, outer_radius};
     double pvo[2][3];
 
     // Add the planet in the painter shadow candidates.
@@ -733,12 +816,15 @@ static void render_rings(const planet_t *planet,
         painter.planet.shadow_spheres_nb++;
     }
 
-    map.user = radii;
+    uv_map_init_ring(&map, planet->rings.inner_radius / planet->radius_m,
+                     planet->rings.outer_radius / planet->radius_m);
+    map.transf = (const void*)transf;
     painter.planet.light_emit = NULL;
+    painter.planet.rings_tex = NULL; // No self shadow.
     painter.flags &= ~PAINTER_PLANET_SHADER;
     painter.flags |= PAINTER_RING_SHADER;
     painter_set_texture(&painter, PAINTER_TEX_COLOR, tex, NULL);
-    paint_quad(&painter, FRAME_ICRF, &map, 64);
+    paint_quad(&painter, FRAME_ICRF, &map, split);
 }
 
 /*
@@ -799,8 +885,15 @@ static int get_shadow_candidates(const planet_t *planet,
     planets_t *planets = (planets_t*)planet->obj.parent;
     planet_t *other;
     double pvo[2][3];
+    planet_cache_t *cache = planet_get_cache(planet, obs);
+    // Only cache the results when we ask the maximum number of spheres.
+    bool use_cache = nb_max == ARRAY_SIZE(cache->shadows);
 
     if (!could_cast_shadow(NULL, planet, obs)) return 0;
+    if (use_cache && (cache->flags & CACHE_SHADOWS)) {
+        memcpy(spheres, cache->shadows, cache->nb_shadows * sizeof(*spheres));
+        return cache->nb_shadows;
+    }
 
     PLANETS_ITER(planets, other) {
         if (could_cast_shadow(other, planet, obs)) {
@@ -818,6 +911,11 @@ static int get_shadow_candidates(const planet_t *planet,
             qsort(spheres, nb, 4 * sizeof(double), sort_shadow_cmp);
         }
     }
+    if (use_cache) {
+        memcpy(cache->shadows, spheres, nb * sizeof(*spheres));
+        cache->nb_shadows = nb;
+        cache->flags |= CACHE_SHADOWS;
+    }
     return nb;
 }
 
@@ -872,6 +970,11 @@ static void planet_render_hips(const planet_t *planet,
         painter.planet.light_emit = &full_emit;
     if (planet->id == MOON)
         painter.planet.shadow_color_tex = planets->earth_shadow_tex;
+    if (planet->rings.tex) {
+        painter.planet.rings_tex = planet->rings.tex;
+        painter.planet.rings_radii[0] = planet->rings.inner_radius * DM2AU;
+        painter.planet.rings_radii[1] = planet->rings.outer_radius * DM2AU;
+    }
     // Lower current moon texture contrast.
     if (planet->id == MOON) painter.contrast = 0.6;
 
@@ -886,6 +989,14 @@ static void planet_render_hips(const planet_t *planet,
     if (render_order < -4 && hips->allsky.data)
         flags |= HIPS_FORCE_USE_ALLSKY;
 
+    // Small planets on screen only need a coarse sphere: use the lowest
+    // order tiles without splitting them much.
+    if (pixel_size < PLANET_LOW_LOD_SIZE) {
+        render_order = hips->order_min;
+        split_order = 1;
+        if (hips->allsky.data) flags |= HIPS_FORCE_USE_ALLSKY;
+    }
+
     // Clamp the render order into physically possible range.
     // XXX: should be done in hips_get_render_order_planet I guess.
     render_order = clamp(render_order, hips->order_min, hips->order);
@@ -909,8 +1020,10 @@ static void planet_render_hips(const planet_t *planet,
                        planet, &nb_tot, &nb_loaded);
     }
 
-    if (planet->rings.tex)
-        render_rings(planet, &painter, mat);
+    if (planet->rings.tex) {
+        render_rings(planet, &painter, mat,
+                     pixel_size < PLANET_LOW_LOD_SIZE ? 16 : 64);
+    }
 
     if (planets->special_render_target == &planet->obj &&
             planets->srt_show_features) {
@@ -1152,23 +1265,22 @@ static bool planets_is_point_occulted(
         const obj_t *module, const double pos[3], bool at_inf,
         const observer_t *obs, const obj_t *ignore)
 {
+    planets_t *planets = (planets_t*)module;
     const planet_t *p;
-    double pvo[2][3], d, r, dir[3], t, l2, d2;
-    d = vec3_norm(pos);
-    vec3_normalize(pos, dir);
-    PLANETS_ITER(g_planets, p) {
-        if (!obs->space && p->id == EARTH) continue;
-        if (&p->obj == ignore) continue;
-        planet_get_pvo(p, obs, pvo);
-        t = vec3_dot(dir, pvo[0]);
-        if (t < 0) continue;
-        l2 = vec3_norm2(pvo[0]);
-        if (!at_inf && d * d < l2) continue;
-        d2 = l2 - t * t;
-        r = p->radius_m * DM2AU;
-        if (d2 < r * r) return true;
+    double pvo[2][3];
+
+    if (!planets->occluders) planets->occluders = occluders_create();
+    if (planets->occluders_hash != obs->hash) {
+        occluders_clear_all(planets->occluders);
+        PLANETS_ITER(planets, p) {
+            if (!obs->space && p->id == EARTH) continue;
+            planet_get_pvo(p, obs, pvo);
+            occluders_add(planets->occluders, pvo[0], p->radius_m * DM2AU,
+                          &p->obj);
+        }
+        planets->occluders_hash = obs->hash;
     }
-    return false;
+    return occluders_test(planets->occluders, pos, at_inf, ignore);
 }
 
 static void planet_render(const planet_t *planet, const painter_t *painter_)
@@ -1402,6 +1514,18 @@ static planet_t *planet_get_by_name(planets_t *planets, const char *name)
     return NULL;
 }
 
+/*
+ * Convenience function to look for a planet by id
+ */
+static planet_t *planet_get_by_id(planets_t *planets, int id)
+{
+    planet_t *p;
+    PLANETS_ITER(planets, p) {
+        if (p->id == id) return p;
+    }
+    return NULL;
+}
+
 // Parse the planet data.
 static int planets_ini_handler(void* user, const char* section,
                                const char* attr, const char* value)
@@ -1546,11 +1670,81 @@ static int planets_init(obj_t *obj, json_value *args)
     return 0;
 }
 
+/*
+ * Parse a PCHB chunk of the Chebyshev ephemeris file, with the series of a
+ * single body:
+ *
+ *   4 bytes: version (1)
+ *   4 bytes: body id
+ *   4 bytes: center body id (must be the parent of the body)
+ *   8 bytes: start time (MJD TT)
+ *   8 bytes: segments length (day)
+ *   4 bytes: number of segments
+ *   4 bytes: number of coefficients per axis
+ *   compressed block: the coefficients (double), per segment and axis.
+ */
+static int on_cheb_chunk(const char type[4], const void *data, int size,
+                         const json_value *json, void *user)
+{
+    planets_t *planets = user;
+    struct {
+        int32_t version, id, center;
+        double start, seg_len;
+        int32_t nb_segs, nb_coefs;
+    } __attribute__((packed)) header;
+    int data_ofs = sizeof(header), coefs_size;
+    double *coefs;
+    planet_t *p;
+
+    if (strncmp(type, "PCHB", 4) != 0) return 0;
+    if (size < sizeof(header)) goto error;
+    memcpy(&header, data, sizeof(header));
+    if (header.version != 1) goto error;
+    p = planet_get_by_id(planets, header.id);
+    if (!p || p->id == EARTH || !p->parent ||
+            p->parent->id != header.center) {
+        LOG_W("Ignore Chebyshev ephemeris of body %d", header.id);
+        return 0;
+    }
+    coefs = eph_read_compressed_block(data, size, &data_ofs, &coefs_size);
+    if (!coefs || !(header.seg_len > 0) ||
+            coefs_size != header.nb_segs * header.nb_coefs * 3 *
+                          (int)sizeof(double)) {
+        free(coefs);
+        goto error;
+    }
+    free(p->cheb.coefs);
+    p->cheb.start = header.start;
+    p->cheb.seg_len = header.seg_len;
+    p->cheb.nb_segs = header.nb_segs;
+    p->cheb.nb_coefs = header.nb_coefs;
+    p->cheb.coefs = coefs;
+    return 0;
+
+error:
+    LOG_E("Cannot parse Chebyshev ephemeris data");
+    return -1;
+}
+
 static int planets_update(obj_t *obj, double dt)
 {
     planets_t *planets = (void*)obj;
     planet_t *p;
+    const char *data;
+    int size, code;
+
+    if (planets->cheb_url) {
+        data = asset_get_data2(planets->cheb_url, ASSET_USED_ONCE,
+                               &size, &code);
+        if (code) {
+            if (data) eph_load(data, size, planets, on_cheb_chunk);
+            else LOG_W("Cannot load %s (%d)", planets->cheb_url, code);
+            free(planets->cheb_url);
+            planets->cheb_url = NULL;
+        }
+    }
 
+    planets->occluders_hash = 0;
     fader_update(&planets->visible, dt);
     fader_update(&planets->srt_full_brightness, dt);
     PLANETS_ITER(obj, p) {
@@ -1565,6 +1759,12 @@ static int planets_add_data_source(
     planets_t *planets = (void*)obj;
     planet_t *p;
 
+    if (strcmp(key, "eph/cheb") == 0) {
+        free(planets->cheb_url);
+        planets->cheb_url = strdup(url);
+        return 0;
+    }
+
     if (strcmp(key, "default") == 0) {
         hips_delete(planets->default_hips);
         planets->default_hips = hips_create(url, 0, NULL);
@@ -1599,6 +1799,12 @@ static json_value *planet_get_json_data(const obj_t *obj)
     return ret;
 }
 
+static void planet_del(obj_t *obj)
+{
+    planet_t *planet = (planet_t*)obj;
+    free(planet->cheb.coefs);
+}
+
 /*
  * Meta class declarations.
  */
@@ -1610,9 +1816,24 @@ static obj_klass_t planet_klass = {
     .get_info = planet_get_info,
     .get_designations = planet_get_designations,
     .get_json_data = planet_get_json_data,
+    .del = planet_del,
 };
 OBJ_REGISTER(planet_klass)
 
+static void planets_get_memory(const obj_t *obj, int64_t *cpu,
+                               int64_t *gpu)
+{
+    const planets_t *planets = (const planets_t*)obj;
+    const planet_t *p;
+    if (planets->default_hips)
+        hips_get_memory(planets->default_hips, cpu, gpu);
+    PLANETS_ITER(planets, p) {
+        if (p->hips && p->hips != planets->default_hips)
+            hips_get_memory(p->hips, cpu, gpu);
+        if (p->hips_normalmap) hips_get_memory(p->hips_normalmap, cpu, gpu);
+    }
+}
+
 static obj_klass_t planets_klass = {
     .id     = "planets",
     .size   = sizeof(planets_t),
@@ -1623,6 +1844,7 @@ static obj_klass_t planets_klass = {
     .list   = planets_list,
     .is_point_occulted = planets_is_point_occulted,
     .add_data_source = planets_add_data_source,
+    .get_memory = planets_get_memory,
     .render_order = 30,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(planets_t, visible.target)),
@@ -1644,3 +1866,68 @@ static obj_klass_t planets_klass = {
     },
 };
 OBJ_REGISTER(planets_klass)
+
+#if COMPILE_TESTS
+
+// Fit the Plan94 position of Mars with Chebyshev series, and check the
+// planet_get_pvh results in and out of the series range.
+static void test_cheb_ephemeris(void)
+{
+    const int nb_segs = 50, nb_coefs = 16;
+    const double start = 60000, seg_len = 32;
+    planet_t sun = {.id = SUN}, mars = {.id = MARS, .parent = &sun};
+    observer_t obs = {};
+    double *coefs, pv[2][3], ref[2][3], v[3], a, t;
+    int s, i, j, k;
+
+    // Coefficients from the values at the Chebyshev nodes.
+    coefs = calloc(nb_segs * 3 * nb_coefs, sizeof(*coefs));
+    for (s = 0; s < nb_segs; s++) {
+        for (j = 0; j < nb_coefs; j++) {
+            a = M_PI * (j + 0.5) / nb_coefs;
+            t = start + (s + (cos(a) + 1) / 2) * seg_len;
+            eraPlan94(DJM0, t, 4, ref);
+            for (i = 0; i < 3; i++) {
+                for (k = 0; k < nb_coefs; k++) {
+                    coefs[(s * 3 + i) * nb_coefs + k] +=
+                        (k ? 2.0 : 1.0) / nb_coefs * ref[0][i] * cos(k * a);
+                }
+            }
+        }
+    }
+    mars.cheb.start = start;
+    mars.cheb.seg_len = seg_len;
+    mars.cheb.nb_segs = nb_segs;
+    mars.cheb.nb_coefs = nb_coefs;
+    mars.cheb.coefs = coefs;
+
+    // Inside the range, including the segments limits.  The Plan94 speed
+    // is only approximated, so we compare ours with a numerical derivative
+    // of the position.
+    for (t = start; t <= start + nb_segs * seg_len; t += 0.25) {
+        obs.tt = t;
+        planet_get_pvh(&mars, &obs, pv);
+        eraPlan94(DJM0, t + 0.01, 4, ref);
+        vec3_copy(ref[0], v);
+        eraPlan94(DJM0, t - 0.01, 4, ref);
+        vec3_sub(v, ref[0], v);
+        vec3_mul(1 / 0.02, v, v);
+        eraPlan94(DJM0, t, 4, ref);
+        assert(vec3_dist(pv[0], ref[0]) < 1e-12);
+        assert(vec3_dist(pv[1], v) < 1e-9);
+    }
+
+    // Outside of the range we use Plan94 directly.
+    for (i = 0; i < 2; i++) {
+        obs.tt = i ? start + nb_segs * seg_len + 0.001 : start - 0.001;
+        assert(!planet_get_cheb_pv(&mars, obs.tt, pv));
+        planet_get_pvh(&mars, &obs, pv);
+        eraPlan94(DJM0, obs.tt, 4, ref);
+        assert(memcmp(pv, ref, sizeof(pv)) == 0);
+    }
+    free(coefs);
+}
+
+TEST_REGISTER(NULL, test_cheb_ephemeris, TEST_AUTO);
+
+#endif
@@ -12,6 +12,20 @@
 #include "designation.h"
 
 #define SATELLITE_DEFAULT_MAG 7.0
+
+// Number of workers used for the batch propagation of all the satellites.
+#define PROP_NB_WORKERS 4
+// Max age (days) of the batch positions, after which we don't use
+// them to find the satellites visible on screen.
+#define PROP_MAX_AGE (10.0 / 86400)
+// Healpix order of the buckets used to cull the batch positions.
+#define PROP_ORDER 3
+#define PROP_NPIX (12 * (1 << (2 * PROP_ORDER)))
+// Duration (days) of the interpolation window of the satellites positions.
+#define INTERP_WINDOW (60.0 / 86400)
+// Version of the satellites snapshot chunk layout.
+#define SNAPSHOT_VERSION 1
+
 /*
  * Artificial satellites module
  */
@@ -36,18 +50,41 @@ struct satellite {
     double decay_date;
 
     bool error; // Set if we got an error computing the position.
+    bool in_data; // Set if found in the data being reloaded.
     json_value *data; // Data passed in the constructor.
     double max_brightness; // Cached max_brightness value.
 
     // Linked list of currently visible on screen.
     satellite_t *visible_next, *visible_prev;
+
+    // Batch propagation values.  The elements are a copy of elsetrec only
+    // used by the workers.
+    sgp4_elsetrec_t *prop_elsetrec;
+    double prop_utc; // Time of prop_pvg, zero if not computed.
+    double prop_pvg[2][3]; // Geocentric ICRF pos/speed (AU, AU/day).
+
+    // SGP4 pos/speed (km, km/s) at the two ends of the interpolation
+    // window, so that we don't need to run sgp4 at each frame.
+    double interp_utc[2];
+    double interp_pv[2][2][3];
+    uint64_t obs_hash; // Hash of the observer used for pvg and pvo.
 };
 
 // Module class.
 typedef struct satellites {
     obj_t   obj;
     char    *jsonl_url;   // jsonl file in noctuasky server format.
+    char    *eph_url;     // Binary eph file (see tools/make-satellites.py).
     bool    loaded;
+    char    *etag;        // ETag of the loaded source, if known.
+    // Set when the data was restored from a snapshot, until we checked
+    // that the source didn't change.
+    bool    check_source;
+    // Existing satellites sorted by NORAD number while we reload the data.
+    struct {
+        satellite_t **sats;
+        int         nb;
+    } reload;
     int     update_pos; // Index of the position for iterative update.
     bool    visible;
     double  hints_mag_offset;
@@ -55,6 +92,39 @@ typedef struct satellites {
 
     satellite_t *render_current;
     satellite_t *visibles; // Linked list of currently visible satellites.
+
+    // Batch propagation of all the satellites in the workers pool.
+    struct {
+        worker_t    workers[PROP_NB_WORKERS];
+        bool        running;
+        double      utc;        // UTC of the running batch.
+        double      rnp[3][3];  // True equator to J2000 for the batch.
+        double      done_utc;   // UTC of the last finished batch.
+        double      start_time; // Unix time of the running batch start.
+        double      duration;   // Real time duration of the last batch (s).
+        double      obs_pvg[2][3]; // Observer position for the batch.
+        int         nb;
+        satellite_t **sats;     // Retained while the batch is running.
+        double      (*pvg)[2][3];
+        bool        *ok;
+
+        // Satellites of the last finished batch, sorted by the healpix
+        // pixel of their direction from the observer.  For each pixel we
+        // keep the max angular speed of its satellites (rad/day), so that
+        // we can bound their motion since the batch time.
+        satellite_t **sorted;   // Retained.
+        int         sorted_nb;
+        int         buckets[PROP_NPIX + 1]; // Start of each pixel in sorted.
+        double      buckets_speed[PROP_NPIX];
+        double      (*buckets_cap)[4]; // Bounding cap of each pixel.
+
+        // Buffers used at render time.
+        int         buf_size;
+        satellite_t **candidates;
+        double      (*pos)[3];
+        double      (*win)[2];
+        bool        *visible;
+    } prop;
 } satellites_t;
 
 // Static instance.
@@ -79,70 +149,555 @@ static int satellites_add_data_source(
         obj_t *obj, const char *url, const char *key)
 {
     satellites_t *sats = (void*)obj;
-    if (strcmp(key, "jsonl/sat") != 0)
+    char **dst;
+
+    if (strcmp(key, "jsonl/sat") == 0)
+        dst = &sats->jsonl_url;
+    else if (strcmp(key, "eph/sat") == 0)
+        dst = &sats->eph_url;
+    else
         return -1;
-    sats->jsonl_url = strdup(url);
+
+    // Adding a source once the data is loaded refreshes the satellites
+    // from the new source only.
+    if (sats->loaded) {
+        free(sats->jsonl_url);
+        free(sats->eph_url);
+        sats->jsonl_url = NULL;
+        sats->eph_url = NULL;
+        sats->loaded = false;
+        sats->check_source = false;
+    }
+    free(*dst);
+    *dst = strdup(url);
     return 0;
 }
 
-static int load_jsonl_data(satellites_t *sats, const char *data, int size,
-                           const char *url, double *last_epoch)
+static int sat_cmp_number(const void *a, const void *b)
 {
-    const char *line = NULL;
-    int len, line_idx = 0, nb = 0;
-    char *uncompressed_data;
-    json_value *json;
+    const satellite_t *s1 = *(const satellite_t**)a;
+    const satellite_t *s2 = *(const satellite_t**)b;
+    return cmp(s1->number, s2->number);
+}
+
+static void satellite_clear(satellite_t *sat);
+
+/*
+ * Return the satellite to initialize for a record of the loaded data.
+ *
+ * When we reload the data, this is the existing satellite with the same
+ * NORAD number if any, so that it keeps its selection or visibility
+ * state.  Return NULL if the existing satellite already has elements of
+ * the same epoch and doesn't need to be updated.
+ */
+static satellite_t *get_record_sat(satellites_t *sats, int number,
+                                   double epoch)
+{
+    satellite_t key = {.number = number}, *keyp = &key, **found = NULL, *sat;
+
+    if (sats->reload.nb) {
+        found = bsearch(&keyp, sats->reload.sats, sats->reload.nb,
+                        sizeof(*found), sat_cmp_number);
+    }
+    if (!found || (*found)->in_data)
+        return (void*)module_add_new(&sats->obj, "tle_satellite", NULL);
+    sat = *found;
+    sat->in_data = true;
+    // Allow for the rounding errors of the epoch stored by sgp4.
+    if (sat->elsetrec &&
+            fabs(sgp4_get_satepoch(sat->elsetrec) - epoch) < 1e-7)
+        return NULL;
+    satellite_clear(sat);
+    return sat;
+}
+
+static void satellite_init_from_elements(
+        satellite_t *sat, int number, double stdmag,
+        sgp4_elsetrec_t *elsetrec, double launch_date, double decay_date,
+        const char *names, const char *types);
+static int parse_date(const char *str, double *out);
+
+/*
+ * Read a json array of strings into a list of null terminated strings
+ * ending with an empty string.  The strings that don't fit in the buffer
+ * are dropped.
+ */
+static int read_str_list(json_reader_t *r, char *buf, int size)
+{
+    int n = 0, len;
+
+    if (json_reader_next(r) != JSON_TOK_ARRAY) return -1;
+    while (json_reader_next(r) == JSON_TOK_STRING) {
+        len = json_reader_get_str(r, buf + n, size - n - 1);
+        if (n + len + 2 <= size) n += len + 1;
+    }
+    buf[n] = '\0';
+    return r->type == JSON_TOK_ARRAY_END ? 0 : -1;
+}
+
+/*
+ * Create or update a satellite from a line of a jsonl file.
+ *
+ * We only need a few attributes of each line, so we extract them with the
+ * streaming json reader instead of parsing the whole line.  The satellite
+ * then gets the same json data as when created from an eph file.
+ */
+static int load_jsonl_sat(satellites_t *sats, const char *line, int len,
+                          double *epoch)
+{
+    json_reader_t r;
+    char names[1024] = "", types[256] = "", tle[256] = "", date[32];
+    const char *tle2;
+    int number = -1;
+    double mag = NAN, launch_date = 0, decay_date = 0;
+    double startmfe, stopmfe, deltamin;
+    sgp4_elsetrec_t *elsetrec;
     satellite_t *sat;
 
-    // XXX: should use a more robust gz uncompression function for external
-    // data.
-    uncompressed_data = z_uncompress_gz(data, size, &size);
-    if (!uncompressed_data) {
-        LOG_E("Cannot uncompress gz file: %s", url);
-        return -1;
+    json_reader_init(&r, line, len);
+    if (json_reader_next(&r) != JSON_TOK_OBJECT) return -1;
+    while (json_reader_next(&r) == JSON_TOK_KEY) {
+        if (json_reader_key_is(&r, "names")) {
+            if (read_str_list(&r, names, sizeof(names))) return -1;
+            continue;
+        }
+        if (json_reader_key_is(&r, "types")) {
+            if (read_str_list(&r, types, sizeof(types))) return -1;
+            continue;
+        }
+        if (!json_reader_key_is(&r, "model_data")) {
+            if (json_reader_skip(&r)) return -1;
+            continue;
+        }
+        if (json_reader_next(&r) != JSON_TOK_OBJECT) return -1;
+        while (json_reader_next(&r) == JSON_TOK_KEY) {
+            if (json_reader_key_is(&r, "tle")) {
+                if (read_str_list(&r, tle, sizeof(tle))) return -1;
+            } else if (json_reader_key_is(&r, "norad_number")) {
+                if (json_reader_next(&r) != JSON_TOK_NUMBER) return -1;
+                number = r.number;
+            } else if (json_reader_key_is(&r, "mag")) {
+                if (json_reader_next(&r) == JSON_TOK_NUMBER) mag = r.number;
+            } else if (json_reader_key_is(&r, "launch_date")) {
+                if (json_reader_next(&r) != JSON_TOK_STRING) return -1;
+                json_reader_get_str(&r, date, sizeof(date));
+                parse_date(date, &launch_date);
+            } else if (json_reader_key_is(&r, "decay_date")) {
+                if (json_reader_next(&r) != JSON_TOK_STRING) return -1;
+                json_reader_get_str(&r, date, sizeof(date));
+                parse_date(date, &decay_date);
+            } else if (json_reader_skip(&r)) {
+                return -1;
+            }
+        }
+        if (r.type != JSON_TOK_OBJECT_END) return -1;
     }
+    if (r.type != JSON_TOK_OBJECT_END) return -1;
+
+    tle2 = tle + strlen(tle) + 1;
+    if (number < 0 || !*tle || !*tle2) return -1;
+    elsetrec = sgp4_twoline2rv(tle, tle2, 'c', 'm', 'i',
+                               &startmfe, &stopmfe, &deltamin);
+    *epoch = sgp4_get_satepoch(elsetrec);
+    sat = get_record_sat(sats, number, *epoch);
+    if (!sat) {
+        free(elsetrec);
+        return 0;
+    }
+    satellite_init_from_elements(sat, number, mag, elsetrec,
+                                 launch_date, decay_date, names, types);
+    return 0;
+}
 
-    data = uncompressed_data;
+static int load_jsonl_data(satellites_t *sats, const char *data, int size,
+                           const char *url, double *last_epoch)
+{
+    const char *line = NULL;
+    int len, line_idx = 0, nb = 0;
+    double epoch;
 
     *last_epoch = 0;
     while (iter_lines(data, size, &line, &len)) {
         line_idx++;
-        json = json_parse(line, len);
-        if (!json) goto error;
-        sat = (void*)module_add_new(&sats->obj, "tle_satellite", json);
-        json_value_free(json);
-        if (!sat) goto error;
-        *last_epoch = fmax(*last_epoch, sgp4_get_satepoch(sat->elsetrec));
+        if (load_jsonl_sat(sats, line, len, &epoch)) {
+            LOG_E("Cannot create sat from %s:%d", url, line_idx);
+            continue;
+        }
+        *last_epoch = fmax(*last_epoch, epoch);
         nb++;
-        continue;
-error:
-        LOG_E("Cannot create sat from %s:%d", url, line_idx);
     }
+    return nb;
+}
 
-    free(uncompressed_data);
+/*
+ * Parse a SATS chunk of an eph file.
+ *
+ * The chunk contains a table of precomputed SGP4 mean elements, followed by
+ * a string table with the names and types of all the satellites, each
+ * stored as a list of null terminated strings ending with an empty string.
+ */
+static int on_sats_chunk(const char type[4], const void *data, int size,
+                         const json_value *json, void *user)
+{
+    satellites_t *sats = USER_GET(user, 0);
+    int *nb = USER_GET(user, 1);
+    double *last_epoch = USER_GET(user, 2);
+    int version, data_ofs = 0, row_size, flags, n, i, strs_size, table_size;
+    int number, name_ofs, types_ofs;
+    double epoch, bstar, ndot, nddot, ecco, argpo, inclo, mo, no, nodeo;
+    double mag, launch_date, decay_date;
+    void *table = NULL;
+    char *strs = NULL;
+    satellite_t *sat;
+    eph_table_column_t columns[] = {
+        {"nora", 'i'},
+        {"epoc", 'd'},
+        {"bstr", 'd'},
+        {"ndot", 'd'},
+        {"nddt", 'd'},
+        {"ecco", 'd'},
+        {"argp", 'd', EPH_RAD},
+        {"incl", 'd', EPH_RAD},
+        {"mo",   'd', EPH_RAD},
+        {"no",   'd'},
+        {"node", 'd', EPH_RAD},
+        {"vmag", 'f', EPH_VMAG},
+        {"laun", 'd'},
+        {"deca", 'd'},
+        {"name", 'i'},
+        {"type", 'i'},
+    };
+
+    if (strncmp(type, "SATS", 4) != 0) return 0;
+    memcpy(&version, data, 4);
+    data_ofs += 4;
+    n = eph_read_table_header(version, data, size, &data_ofs, &row_size,
+                              &flags, ARRAY_SIZE(columns), columns);
+    if (n < 0) goto error;
+    table = eph_read_compressed_block(data, size, &data_ofs, &table_size);
+    strs = eph_read_compressed_block(data, size, &data_ofs, &strs_size);
+    if (!table || !strs || !strs_size || strs[strs_size - 1]) goto error;
+    if (flags & 1) eph_shuffle_bytes(table, row_size, n);
+
+    data_ofs = 0;
+    for (i = 0; i < n; i++) {
+        eph_read_table_row(table, table_size, &data_ofs,
+                           ARRAY_SIZE(columns), columns,
+                           &number, &epoch, &bstar, &ndot, &nddot, &ecco,
+                           &argpo, &inclo, &mo, &no, &nodeo, &mag,
+                           &launch_date, &decay_date, &name_ofs, &types_ofs);
+        if (name_ofs < 0 || name_ofs >= strs_size ||
+            types_ofs < 0 || types_ofs >= strs_size) goto error;
+        *last_epoch = fmax(*last_epoch, epoch);
+        (*nb)++;
+        sat = get_record_sat(sats, number, epoch);
+        if (!sat) continue;
+        satellite_init_from_elements(
+                sat, number, mag,
+                sgp4_init(number, epoch, bstar, ndot, nddot, ecco, argpo,
+                          inclo, mo, no, nodeo),
+                launch_date, decay_date, strs + name_ofs, strs + types_ofs);
+    }
+    free(table);
+    free(strs);
+    return 0;
+
+error:
+    LOG_E("Cannot parse satellites eph data");
+    free(table);
+    free(strs);
+    return -1;
+}
+
+static int load_eph_data(satellites_t *sats, const char *data, int size,
+                         double *last_epoch)
+{
+    int nb = 0;
+    *last_epoch = 0;
+    eph_load(data, size, USER_PASS(sats, &nb, last_epoch), on_sats_chunk);
     return nb;
 }
 
-static int satellites_update(obj_t *obj, double dt)
+static bool satellite_is_operational(const satellite_t *sat, double utc);
+
+/*
+ * Worker function for the batch propagation.  Each worker computes a slice
+ * of the satellites, using the satellites own copy of the orbit elements
+ * so that the main thread can still call sgp4 at the same time.
+ */
+static int prop_worker(worker_t *w)
 {
-    satellites_t *sats = (satellites_t*)obj;
-    const char *data;
+    satellites_t *sats = w->user;
+    int i, r, k = w - sats->prop.workers;
+    int start = sats->prop.nb * k / PROP_NB_WORKERS;
+    int end = sats->prop.nb * (k + 1) / PROP_NB_WORKERS;
+    double pv[2][3];
+    const satellite_t *sat;
+
+    for (i = start; i < end; i++) {
+        sat = sats->prop.sats[i];
+        sats->prop.ok[i] = false;
+        if (!satellite_is_operational(sat, sats->prop.utc)) continue;
+        r = sgp4(sat->prop_elsetrec, sats->prop.utc, pv[0], pv[1]);
+        if (r) continue;
+        vec3_mul(1000.0 * DM2AU, pv[0], pv[0]);
+        vec3_mul(1000.0 * DM2AU * 60 * 60 * 24, pv[1], pv[1]);
+        mat3_mul_vec3(sats->prop.rnp, pv[0], sats->prop.pvg[i][0]);
+        mat3_mul_vec3(sats->prop.rnp, pv[1], sats->prop.pvg[i][1]);
+        sats->prop.ok[i] = true;
+    }
+    return 0;
+}
+
+static void prop_start(satellites_t *sats, const observer_t *obs)
+{
+    int i, nb = 0;
+    obj_t *child;
+    satellite_t *sat;
+
+    DL_COUNT(sats->obj.children, child, nb);
+    sats->prop.sats = calloc(nb, sizeof(*sats->prop.sats));
+    sats->prop.pvg = calloc(nb, sizeof(*sats->prop.pvg));
+    sats->prop.ok = calloc(nb, sizeof(*sats->prop.ok));
+    sats->prop.nb = 0;
+    DL_FOREACH(sats->obj.children, child) {
+        sat = (void*)child;
+        if (sat->error || !sat->elsetrec) continue;
+        if (!sat->prop_elsetrec)
+            sat->prop_elsetrec = sgp4_clone(sat->elsetrec);
+        sats->prop.sats[sats->prop.nb++] = (void*)obj_retain(child);
+    }
+    sats->prop.utc = obs->utc;
+    mat3_copy(obs->rnp, sats->prop.rnp);
+    memcpy(sats->prop.obs_pvg, obs->obs_pvg, sizeof(sats->prop.obs_pvg));
+    for (i = 0; i < PROP_NB_WORKERS; i++) {
+        worker_init(&sats->prop.workers[i], prop_worker);
+        sats->prop.workers[i].user = sats;
+    }
+    sats->prop.start_time = sys_get_unix_time();
+    sats->prop.running = true;
+}
+
+/*
+ * Sort the satellites of the finished batch into the healpix buckets.
+ * The references to the satellites taken by the batch are moved into the
+ * sorted list, and kept until the next batch.
+ */
+static void prop_sort(satellites_t *sats)
+{
+    int i, pix;
+    int *pixs = calloc(sats->prop.nb, sizeof(*pixs));
+    int *fill = calloc(PROP_NPIX, sizeof(*fill));
+    double pos[3], speed[3], d;
+    double cap[4];
+    const int nside = 1 << PROP_ORDER;
+
+    if (!sats->prop.buckets_cap) {
+        sats->prop.buckets_cap = calloc(PROP_NPIX,
+                                        sizeof(*sats->prop.buckets_cap));
+        for (i = 0; i < PROP_NPIX; i++) {
+            healpix_get_bounding_cap(nside, i, cap);
+            vec4_copy(cap, sats->prop.buckets_cap[i]);
+        }
+    }
+
+    for (i = 0; i < sats->prop.sorted_nb; i++)
+        obj_release(&sats->prop.sorted[i]->obj);
+    free(sats->prop.sorted);
+    sats->prop.sorted = calloc(sats->prop.nb, sizeof(*sats->prop.sorted));
+    memset(sats->prop.buckets_speed, 0, sizeof(sats->prop.buckets_speed));
+
+    for (i = 0; i < sats->prop.nb; i++) {
+        pixs[i] = -1;
+        if (!sats->prop.ok[i]) continue;
+        vec3_sub(sats->prop.pvg[i][0], sats->prop.obs_pvg[0], pos);
+        vec3_sub(sats->prop.pvg[i][1], sats->prop.obs_pvg[1], speed);
+        d = vec3_norm(pos);
+        if (d == 0) continue;
+        pix = healpix_vec2pix(nside, pos);
+        pixs[i] = pix;
+        fill[pix]++;
+        sats->prop.buckets_speed[pix] = fmax(sats->prop.buckets_speed[pix],
+                                             vec3_norm(speed) / d);
+    }
+    sats->prop.buckets[0] = 0;
+    for (pix = 0; pix < PROP_NPIX; pix++) {
+        sats->prop.buckets[pix + 1] = sats->prop.buckets[pix] + fill[pix];
+        fill[pix] = sats->prop.buckets[pix];
+    }
+    for (i = 0; i < sats->prop.nb; i++) {
+        if (pixs[i] < 0) {
+            obj_release(&sats->prop.sats[i]->obj);
+            continue;
+        }
+        sats->prop.sorted[fill[pixs[i]]++] = sats->prop.sats[i];
+    }
+    sats->prop.sorted_nb = sats->prop.buckets[PROP_NPIX];
+    free(pixs);
+    free(fill);
+}
+
+// Return true once the running batch is finished, and copy its results
+// into the satellites.
+static bool prop_iter(satellites_t *sats)
+{
+    int i;
+    bool done = true;
+    satellite_t *sat;
+
+    for (i = 0; i < PROP_NB_WORKERS; i++)
+        done = worker_iter(&sats->prop.workers[i]) && done;
+    if (!done) return false;
+
+    for (i = 0; i < sats->prop.nb; i++) {
+        sat = sats->prop.sats[i];
+        sat->prop_utc = sats->prop.ok[i] ? sats->prop.utc : 0;
+        memcpy(sat->prop_pvg, sats->prop.pvg[i], sizeof(sat->prop_pvg));
+    }
+    prop_sort(sats);
+    free(sats->prop.sats);
+    free(sats->prop.pvg);
+    free(sats->prop.ok);
+    sats->prop.sats = NULL;
+    sats->prop.pvg = NULL;
+    sats->prop.ok = NULL;
+    sats->prop.done_utc = sats->prop.utc;
+    sats->prop.duration = sys_get_unix_time() - sats->prop.start_time;
+    sats->prop.running = false;
+    return true;
+}
+
+/*
+ * Before loading new data while we already have some satellites, index
+ * them by NORAD number so that the loaders can update them in place.
+ */
+static void reload_begin(satellites_t *sats)
+{
+    obj_t *child;
+    int nb;
+
+    DL_COUNT(sats->obj.children, child, nb);
+    if (!nb) return;
+    sats->reload.sats = calloc(nb, sizeof(*sats->reload.sats));
+    DL_FOREACH(sats->obj.children, child) {
+        ((satellite_t*)child)->in_data = false;
+        sats->reload.sats[sats->reload.nb++] = (void*)child;
+    }
+    qsort(sats->reload.sats, nb, sizeof(*sats->reload.sats), sat_cmp_number);
+}
+
+/*
+ * After a reload, remove the satellites that were not in the new data.
+ */
+static void reload_end(satellites_t *sats)
+{
+    int i, nb = 0;
+    satellite_t *sat;
+
+    if (!sats->reload.nb) return;
+    for (i = 0; i < sats->reload.nb; i++) {
+        sat = sats->reload.sats[i];
+        if (sat->in_data) continue;
+        if (sat->visible_prev) {
+            DL_DELETE2(sats->visibles, sat, visible_prev, visible_next);
+            sat->visible_prev = NULL;
+        }
+        module_remove(&sats->obj, &sat->obj);
+        nb++;
+    }
+    free(sats->reload.sats);
+    sats->reload.sats = NULL;
+    sats->reload.nb = 0;
+    sats->render_current = NULL;
+    // Don't use the previous batch positions anymore.
+    sats->prop.done_utc = 0;
+    LOG_I("Removed %d satellites", nb);
+}
+
+/*
+ * Load the data from the source url.
+ *
+ * After a restore from a snapshot, we only parse it again if its ETag
+ * changed.
+ */
+static void load_source(satellites_t *sats, const char *url)
+{
+    const char *data, *etag;
     double last_epoch = 0;
-    int size, code, nb;
+    int size, code, nb, flags;
     char buf[128];
 
-    if (sats->loaded) return 0;
-    if (!sats->jsonl_url) return 0;
-
-    data = asset_get_data2(sats->jsonl_url, ASSET_USED_ONCE, &size, &code);
-    if (!code) return 0; // Sill loading.
-    if (!data) return 0; // Got error;
-    nb = load_jsonl_data(sats, data, size, sats->jsonl_url, &last_epoch);
+    // The jsonl data is gz compressed, let the assets manager uncompress it
+    // in a worker.
+    flags = ASSET_USED_ONCE | (sats->eph_url ? 0 : ASSET_GZ | ASSET_ASYNC);
+    data = asset_get_data2(url, flags, &size, &code);
+    if (!code) return; // Sill loading.
+    etag = asset_get_etag(url);
+    if (sats->check_source) {
+        sats->check_source = false;
+        // On error we keep the restored data.
+        if (!data) return;
+        if (etag && sats->etag && strcmp(etag, sats->etag) == 0) return;
+        LOG_I("Satellites source changed since the snapshot");
+    }
+    if (!data) return; // Got error;
+    free(sats->etag);
+    sats->etag = etag ? strdup(etag) : NULL;
+    reload_begin(sats);
+    if (sats->eph_url)
+        nb = load_eph_data(sats, data, size, &last_epoch);
+    else
+        nb = load_jsonl_data(sats, data, size, url, &last_epoch);
+    reload_end(sats);
     LOG_I("Parsed %d satellites (latest epoch: %s)", nb,
           format_time(buf, last_epoch, 0, "YYYY-MM-DD"));
     if (last_epoch < unix_to_mjd(sys_get_unix_time()) - 2)
         LOG_W("Warning: satellites data seems outdated.");
     sats->loaded = true;
+}
+
+// Test whether we should start a new batch for a given observer.
+static bool prop_needed(const satellites_t *sats, const observer_t *obs)
+{
+    // In time lapse, the batch positions would be too old once computed,
+    // so we only use the iterative update.
+    return sats->loaded && !sats->prop.running && sats->visible &&
+           sats->obj.children &&
+           fabs(obs->utc - sats->prop.done_utc) > PROP_MAX_AGE / 2 &&
+           !core_is_outdated_at_time_speed(sats->prop.duration,
+                                           PROP_MAX_AGE);
+}
+
+static int satellites_update(obj_t *obj, double dt)
+{
+    satellites_t *sats = (satellites_t*)obj;
+    const char *url;
+    const observer_t *obs = core->observer;
+
+    url = sats->eph_url ?: sats->jsonl_url;
+    if (sats->loaded) {
+        if (sats->prop.running) prop_iter(sats);
+        if (prop_needed(sats, obs)) prop_start(sats, obs);
+        if (sats->check_source && !sats->prop.running)
+            load_source(sats, url);
+        return 0;
+    }
+    if (!url) return 0;
+    // The batch propagation uses the satellites elements.
+    if (sats->prop.running) {
+        prop_iter(sats);
+        return 0;
+    }
+    load_source(sats, url);
+    return 0;
+}
+
+// Start the next batch while the renderer flushes the frame.
+static int satellites_update_ahead(obj_t *obj, const observer_t *next)
+{
+    satellites_t *sats = (satellites_t*)obj;
+    if (sats->prop.running) prop_iter(sats);
+    if (prop_needed(sats, next)) prop_start(sats, next);
     return 0;
 }
 
@@ -154,6 +709,84 @@ static void add_to_visible(satellites_t *sats, satellite_t *sat)
 
 static int satellite_render(obj_t *obj, const painter_t *painter);
 
+/*
+ * Use the last batch propagation to find all the satellites that could be
+ * visible on screen, and render them.  The healpix buckets not intersecting
+ * the viewport are skipped, then the batch positions are linearly
+ * extrapolated to the current time.  This is only used to select the
+ * candidates, the rendering itself uses the exact positions.
+ *
+ * Return false if we don't have recent enough batch positions.
+ */
+static bool satellites_render_candidates(satellites_t *sats,
+                                         const painter_t *painter)
+{
+    const observer_t *obs = painter->obs;
+    const double hints_limit_mag = painter->hints_limit_mag +
+                                   sats->hints_mag_offset - 2.5;
+    const double limit_mag = fmax(painter->stars_limit_mag, hints_limit_mag);
+    const double margin = 0.1 * DD2R;
+    double dt = obs->utc - sats->prop.done_utc;
+    double range, *pos, cap[4], x, angle;
+    int i, pix, n = 0, nb = sats->prop.sorted_nb;
+    satellite_t *sat;
+
+    if (!sats->prop.done_utc || fabs(dt) > PROP_MAX_AGE) return false;
+
+    if (nb > sats->prop.buf_size) {
+        sats->prop.buf_size = nb;
+        sats->prop.candidates = realloc(sats->prop.candidates,
+                                        nb * sizeof(*sats->prop.candidates));
+        sats->prop.pos = realloc(sats->prop.pos, nb * sizeof(*sats->prop.pos));
+        sats->prop.win = realloc(sats->prop.win, nb * sizeof(*sats->prop.win));
+        sats->prop.visible = realloc(sats->prop.visible,
+                                     nb * sizeof(*sats->prop.visible));
+    }
+
+    for (pix = 0; pix < PROP_NPIX; pix++) {
+        if (sats->prop.buckets[pix] == sats->prop.buckets[pix + 1]) continue;
+        // Grow the pixel cap by the max motion of its satellites since
+        // the batch time.
+        x = sats->prop.buckets_speed[pix] * fabs(dt);
+        if (x < 1) {
+            vec4_copy(sats->prop.buckets_cap[pix], cap);
+            angle = acos(cap[3]) + asin(x) + margin;
+            cap[3] = angle < M_PI ? cos(angle) : -1;
+            if (painter_is_cap_clipped(painter, FRAME_ICRF, cap)) continue;
+        }
+        for (i = sats->prop.buckets[pix]; i < sats->prop.buckets[pix + 1];
+             i++) {
+            sat = sats->prop.sorted[i];
+            if (sat->visible_prev) continue; // Was already rendered.
+            if (sat->error || sat->prop_utc != sats->prop.done_utc) continue;
+            if (!sat->model && sat->max_brightness > limit_mag) continue;
+            pos = sats->prop.pos[n];
+            vec3_addk(sat->prop_pvg[0], sat->prop_pvg[1], dt, pos);
+            vec3_sub(pos, obs->obs_pvg[0], pos);
+            // Skip the satellites below the horizon.
+            if (vec3_dot(pos, obs->obs_pvg[0]) < 0) continue;
+            // Skip the satellites too faint even if fully illuminated (see
+            // satellite_compute_vmag).
+            range = vec3_norm(pos) * DAU2M / 1000;
+            if (!sat->model && !isnan(sat->stdmag) &&
+                sat->stdmag - 15.75 + 2.5 * log10(range * range) > limit_mag)
+                continue;
+            sats->prop.candidates[n++] = sat;
+        }
+    }
+
+    painter_project_batch(painter, FRAME_ICRF, n,
+                          (const double (*)[3])sats->prop.pos, false, true,
+                          sats->prop.win, sats->prop.visible);
+    for (i = 0; i < n; i++) {
+        if (!sats->prop.visible[i]) continue;
+        sat = sats->prop.candidates[i];
+        if (satellite_render(&sat->obj, painter) == 1)
+            add_to_visible(sats, sat);
+    }
+    return true;
+}
+
 static int satellites_render(obj_t *obj, const painter_t *painter)
 {
     satellites_t *sats = (void*)obj;
@@ -179,7 +812,9 @@ static int satellites_render(obj_t *obj, const painter_t *painter)
         }
     }
 
-    // Then iter part of the full list as well.
+    if (satellites_render_candidates(sats, painter)) return 0;
+
+    // Without batch positions, iter part of the full list.
     for (   i = 0, child = sats->render_current ?: (void*)sats->obj.children;
             child && i < update_nb;
             i++, child = (void*)child->obj.next) {
@@ -192,12 +827,16 @@ static int satellites_render(obj_t *obj, const painter_t *painter)
 }
 
 /*
- * Compute the amount of light the satellite receives from the Sun, taking
+ * Compute the amount of light a satellite receives from the Sun, taking
  * into account the Earth shadow.  Return a value from 0 (totally eclipsed)
  * to 1 (totally illuminated).
+ *
+ * Parameters:
+ *   sat_pos    - Geocentric position of the satellite (AU).
+ *   earth_pos  - Heliocentric position of the Earth (AU), in the same frame.
  */
-static double satellite_compute_earth_shadow(const satellite_t *sat,
-                                             const observer_t *obs)
+static double compute_earth_shadow(const double sat_pos[3],
+                                   const double earth_pos[3])
 {
     double e_pos[3]; // Earth position from sat.
     double s_pos[3]; // Sun position from sat.
@@ -207,8 +846,8 @@ static double satellite_compute_earth_shadow(const satellite_t *sat,
     const double EARTH_RADIUS = 6371000; // (m).
 
 
-    vec3_mul(-DAU2M, sat->pvg[0], e_pos);
-    vec3_add(obs->earth_pvh[0], sat->pvg[0], s_pos);
+    vec3_mul(-DAU2M, sat_pos, e_pos);
+    vec3_add(earth_pos, sat_pos, s_pos);
     vec3_mul(-DAU2M, s_pos, s_pos);
     elong = vec3_sep(e_pos, s_pos);
     e_r = asin(EARTH_RADIUS / vec3_norm(e_pos));
@@ -220,6 +859,12 @@ static double satellite_compute_earth_shadow(const satellite_t *sat,
     return 0.0;
 }
 
+static double satellite_compute_earth_shadow(const satellite_t *sat,
+                                             const observer_t *obs)
+{
+    return compute_earth_shadow(sat->pvg[0], obs->earth_pvh[0]);
+}
+
 static double compute_max_brightness(
         const sgp4_elsetrec_t *elsetrec, double stdmag)
 {
@@ -308,6 +953,18 @@ error:
     return -1;
 }
 
+// Part of the initialization shared by the json and eph data.
+static void satellite_init_common(satellite_t *sat, const char *name)
+{
+    sat->max_brightness = compute_max_brightness(sat->elsetrec, sat->stdmag);
+
+    // Determin what 3d model to use.
+    if (name && strncmp(name, "NAME STARLINK", 13) == 0)
+        sat->model = "Starlink";
+    if (sat->number == 25544) sat->model = "ISS";
+    if (sat->number == 20580) sat->model = "HST";
+}
+
 static int satellite_init(obj_t *obj, json_value *args)
 {
     // Support creating a satellite using noctuasky model data json values.
@@ -343,26 +1000,85 @@ static int satellite_init(obj_t *obj, json_value *args)
         strncpy(sat->obj.type, otype_from_json(types, "Asa"), 4);
 
         sat->data = json_copy(args);
-        sat->max_brightness = compute_max_brightness(
-                sat->elsetrec, sat->stdmag);
-
         if (launch_date) parse_date(launch_date, &sat->launch_date);
         if (decay_date) parse_date(decay_date, &sat->decay_date);
-
-        // Determin what 3d model to use.
-        if (name && strncmp(name, "NAME STARLINK", 13) == 0)
-            sat->model = "Starlink";
-        if (sat->number == 25544) sat->model = "ISS";
-        if (sat->number == 20580) sat->model = "HST";
+        satellite_init_common(sat, name);
     }
 
     return 0;
 }
 
+/*
+ * Initialize a satellite created without json args, using the values
+ * read from an eph file.
+ *
+ * Parameters:
+ *   names  - List of null terminated names, ending with an empty string.
+ *   types  - List of null terminated otypes, ending with an empty string.
+ */
+static void satellite_init_from_elements(
+        satellite_t *sat, int number, double stdmag,
+        sgp4_elsetrec_t *elsetrec, double launch_date, double decay_date,
+        const char *names, const char *types)
+{
+    json_value *jnames, *jtypes, *model_data;
+    const char *str;
+    char buf[32];
+
+    sat->number = number;
+    sat->stdmag = isnan(stdmag) ? SATELLITE_DEFAULT_MAG : stdmag;
+    sat->elsetrec = elsetrec;
+    sat->launch_date = launch_date;
+    sat->decay_date = decay_date;
+
+    // Recreate the same json data as we get in the jsonl files.
+    sat->data = json_object_new(0);
+    jtypes = json_object_push(sat->data, "types", json_array_new(0));
+    for (str = types; *str; str += strlen(str) + 1)
+        json_array_push(jtypes, json_string_new(str));
+    jnames = json_object_push(sat->data, "names", json_array_new(0));
+    for (str = names; *str; str += strlen(str) + 1)
+        json_array_push(jnames, json_string_new(str));
+    model_data = json_object_push(sat->data, "model_data",
+                                  json_object_new(0));
+    json_object_push(model_data, "norad_number", json_integer_new(number));
+    if (!isnan(stdmag))
+        json_object_push(model_data, "mag", json_double_new(stdmag));
+    if (launch_date)
+        json_object_push(model_data, "launch_date", json_string_new(
+                format_time(buf, launch_date, 0, "YYYY-MM-DD")));
+    if (decay_date)
+        json_object_push(model_data, "decay_date", json_string_new(
+                format_time(buf, decay_date, 0, "YYYY-MM-DD")));
+
+    strncpy(sat->obj.type, otype_from_json(jtypes, "Asa"), 4);
+    satellite_init_common(sat, *names ? names : NULL);
+}
+
+/*
+ * Reset the orbit elements and all the computed values of a satellite, so
+ * that it can be initialized again with new elements.
+ */
+static void satellite_clear(satellite_t *sat)
+{
+    free(sat->elsetrec);
+    free(sat->prop_elsetrec);
+    json_builder_free(sat->data);
+    sat->elsetrec = NULL;
+    sat->prop_elsetrec = NULL;
+    sat->data = NULL;
+    sat->error = false;
+    sat->model = NULL;
+    sat->prop_utc = 0;
+    sat->interp_utc[0] = sat->interp_utc[1] = 0;
+    sat->obs_hash = 0;
+}
+
 static void satellite_del(obj_t *obj)
 {
     satellite_t *sat = (satellite_t*)obj;
     free(sat->elsetrec);
+    free(sat->prop_elsetrec);
     json_builder_free(sat->data);
 }
 
@@ -378,18 +1094,79 @@ static void true_equator_to_j2000(const observer_t *obs,
     mat3_mul_vec3(obs->rnp, out[0], out[0]);
 }
 
-// Check if the satellite is currently in orbit.
-static bool satellite_is_operational(const satellite_t *sat, double utc)
+// Get the UTC range when the satellite is in orbit.
+static void satellite_get_operational_range(const satellite_t *sat,
+                                            double *start, double *end)
 {
     // For the moment, if we don't know the launch or decay date, we 10
     // years before/after the satellite epoch.
-    double start, end, epoch;
+    double epoch;
     epoch = sgp4_get_satepoch(sat->elsetrec);
-    start = sat->launch_date ? sat->launch_date - 1 : epoch - 3600;
-    end = sat->decay_date ? sat->decay_date + 1 : epoch + 3600;
+    *start = sat->launch_date ? sat->launch_date - 1 : epoch - 3600;
+    *end = sat->decay_date ? sat->decay_date + 1 : epoch + 3600;
+}
+
+// Check if the satellite is currently in orbit.
+static bool satellite_is_operational(const satellite_t *sat, double utc)
+{
+    double start, end;
+    satellite_get_operational_range(sat, &start, &end);
     return utc > start && utc < end;
 }
 
+/*
+ * Compute the SGP4 pos/speed (km, km/s) of a satellite at a given time.
+ *
+ * We keep the exact values at the two ends of a small time window around
+ * the requested time, and use a cubic Hermite interpolation inside it.
+ * This is accurate to a fraction of meter for low circular orbits, and to a
+ * few meters for very eccentric ones.
+ */
+static int satellite_get_teme_pv(satellite_t *sat, double utc,
+                                 double pv[2][3])
+{
+    int i, r;
+    double h, t, t2, t3, h00, h10, h01, h11, d00, d10, d01, d11;
+    const double (*p)[2][3] = sat->interp_pv;
+
+    if (!(utc >= sat->interp_utc[0] && utc <= sat->interp_utc[1])) {
+        sat->interp_utc[0] = utc - INTERP_WINDOW / 2;
+        sat->interp_utc[1] = utc + INTERP_WINDOW / 2;
+        for (i = 0; i < 2; i++) {
+            r = sgp4(sat->elsetrec, sat->interp_utc[i],
+                     sat->interp_pv[i][0], sat->interp_pv[i][1]);
+            if (r) break;
+        }
+        if (r) {
+            // The satellite probably decays in the window, don't
+            // interpolate.
+            sat->interp_utc[0] = sat->interp_utc[1] = NAN;
+            return sgp4(sat->elsetrec, utc, pv[0], pv[1]);
+        }
+    }
+
+    h = (sat->interp_utc[1] - sat->interp_utc[0]) * 86400; // (s).
+    t = (utc - sat->interp_utc[0]) / (sat->interp_utc[1] -
+                                      sat->interp_utc[0]);
+    t2 = t * t;
+    t3 = t2 * t;
+    h00 = 2 * t3 - 3 * t2 + 1;
+    h10 = t3 - 2 * t2 + t;
+    h01 = -2 * t3 + 3 * t2;
+    h11 = t3 - t2;
+    d00 = 6 * t2 - 6 * t;
+    d10 = 3 * t2 - 4 * t + 1;
+    d01 = -6 * t2 + 6 * t;
+    d11 = 3 * t2 - 2 * t;
+    for (i = 0; i < 3; i++) {
+        pv[0][i] = h00 * p[0][0][i] + h10 * h * p[0][1][i] +
+                   h01 * p[1][0][i] + h11 * h * p[1][1][i];
+        pv[1][i] = (d00 * p[0][0][i] + d01 * p[1][0][i]) / h +
+                   d10 * p[0][1][i] + d11 * p[1][1][i];
+    }
+    return 0;
+}
+
 /*
  * Update an individual satellite.
  */
@@ -402,9 +1179,10 @@ static int satellite_update(satellite_t *sat, const observer_t *obs)
     if (sat->error) return 0;
     assert(sat->elsetrec);
     if (!satellite_is_operational(sat, obs->utc)) return 0;
+    if (sat->obs_hash == obs->hash_sky) return 0;
 
     // Orbit computation.
-    r = sgp4(sat->elsetrec, obs->utc, pv[0],  pv[1]);
+    r = satellite_get_teme_pv(sat, obs->utc, pv);
     if (r && r != 6) { // 6 = satellite decayed, don't log this case.
         obj_get_name((obj_t*)sat, buf, sizeof(buf));
         LOG_W("Satellite position error for %s (%d), err=%d",
@@ -428,6 +1206,7 @@ static int satellite_update(satellite_t *sat, const observer_t *obs)
     vec3_copy(pv[1], sat->pvo[1]);
 
     sat->vmag = satellite_compute_vmag(sat, obs);
+    sat->obs_hash = obs->hash_sky;
     return 0;
 }
 
@@ -565,7 +1344,10 @@ static void satellite_render_model(const satellite_t *sat,
     double p_win[4], model_mat[4][4] = MAT4_IDENTITY;
     double lvlh_rot[3][3];
     painter_t painter = *painter_;
-    json_value *args, *uniforms;
+    json_value *uniforms;
+    // The model args are the same for all the satellites, so we only build
+    // them once.
+    static json_value *args = NULL;
 
     if (!sat->model) return;
     if (!painter_project(&painter, FRAME_ICRF, sat->pvo[0], false, true, p_win))
@@ -576,12 +1358,13 @@ static void satellite_render_model(const satellite_t *sat,
     get_lvlh_rot(painter.obs, sat->pvo, lvlh_rot);
     mat4_mul_mat3(model_mat, lvlh_rot, model_mat);
 
-    args = json_object_new(0);
-    uniforms = json_object_push(args, "uniforms", json_object_new(0));
-    json_object_push(uniforms, "u_light.ambient", json_double_new(0.05));
-    json_object_push(args, "use_ibl", json_boolean_new(true));
+    if (!args) {
+        args = json_object_new(0);
+        uniforms = json_object_push(args, "uniforms", json_object_new(0));
+        json_object_push(uniforms, "u_light.ambient", json_double_new(0.05));
+        json_object_push(args, "use_ibl", json_boolean_new(true));
+    }
     paint_3d_model(&painter, sat->model, model_mat, args);
-    json_builder_free(args);
 }
 
 static double get_model_alpha(const satellite_t *sat, const painter_t *painter,
@@ -767,6 +1550,386 @@ int satellite_get_altitude(const obj_t *obj, const observer_t *obs,
     return 0;
 }
 
+/*
+ * Batch prediction of the passes of all the satellites over an observer.
+ *
+ * For each satellite we first step through the time window as fast as the
+ * orbit geometry allows: from the satellite max angular speed and the
+ * radius of its apogee, we know how long it takes at least to get close
+ * enough to the observer to be above the min altitude.  Only once we get
+ * there we sample the pass and refine its rise, set and culmination times,
+ * and its sunlit intervals, by bisection.
+ *
+ * The positions are computed directly in the TEME frame of sgp4, with the
+ * observer rotated by the Greenwich mean sidereal time (TEME is based on
+ * the equinox, not on the CIO).
+ */
+
+// Max number of sunlit intervals we report per pass.
+#define PASS_MAX_SUNLIT 4
+// Duration (days) of the steps of the Earth positions table.
+#define PASS_EARTH_STEP (1.0 / 24)
+// Earth rotation rate (rad/s).
+#define EARTH_ROT_RATE 7.2921159e-5
+// Earth gravitational parameter (km³/s²).
+#define EARTH_MU 398600.4418
+
+typedef struct {
+    int     number;
+    double  aos;        // Rise time (UTC MJD).
+    double  los;        // Set time (UTC MJD).
+    double  max_utc;    // Culmination time (UTC MJD).
+    double  max_alt;    // Culmination altitude (rad).
+    int     nb_sunlit;
+    double  sunlit[PASS_MAX_SUNLIT][2];
+} sat_pass_t;
+
+typedef struct passes passes_t;
+
+// Each worker computes a slice of the satellites.
+typedef struct {
+    worker_t    worker;
+    int         k;
+    int         nb;
+    int         allocated;
+    sat_pass_t  *passes;
+} pass_worker_t;
+
+struct passes {
+    double      start;
+    double      end;
+    double      min_alt;
+    double      dut1;           // UT1 - UTC (days).
+    double      obs_pos[3];     // Observer ITRS position (km).
+    double      obs_up[3];      // Observer ITRS geodetic zenith.
+    int         earth_nb;
+    double      (*earth_pos)[3]; // Heliocentric Earth positions (AU) in
+                                 // the true equator of date.
+    int         nb;
+    satellite_t **sats;
+    pass_worker_t workers[PROP_NB_WORKERS];
+};
+
+// Compute the satellite TEME position (km), altitude, and sunlit state.
+static int pass_get_state(const passes_t *p, sgp4_elsetrec_t *elsetrec,
+                          double utc, double pos[3], double *alt,
+                          bool *sunlit)
+{
+    double speed[3], obs[3], up[3], rel[3], earth[3], sat[3], t, theta;
+    int i;
+
+    if (sgp4(elsetrec, utc, pos, speed)) return -1;
+    theta = eraGmst82(DJM0, utc + p->dut1);
+    vec3_copy(p->obs_pos, obs);
+    vec3_copy(p->obs_up, up);
+    vec2_rotate(theta, obs, obs);
+    vec2_rotate(theta, up, up);
+    vec3_sub(pos, obs, rel);
+    *alt = M_PI / 2 - vec3_sep(rel, up);
+
+    t = (utc - p->start) / PASS_EARTH_STEP;
+    i = clamp(floor(t), 0, p->earth_nb - 2);
+    vec3_mix(p->earth_pos[i], p->earth_pos[i + 1], t - i, earth);
+    vec3_mul(1000.0 * DM2AU, pos, sat);
+    *sunlit = compute_earth_shadow(sat, earth) > 0.0;
+    return 0;
+}
+
+/*
+ * Find the time of change of the visibility (or sunlit state if sun is
+ * set) between two times, to about one second.
+ */
+static double pass_bisect(const passes_t *p, sgp4_elsetrec_t *elsetrec,
+                          double t0, double t1, bool v0, bool sun)
+{
+    double t, pos[3], alt;
+    bool sunlit;
+
+    while ((t1 - t0) * 86400 > 1) {
+        t = (t0 + t1) / 2;
+        if (pass_get_state(p, elsetrec, t, pos, &alt, &sunlit)) break;
+        if ((sun ? sunlit : alt >= p->min_alt) == v0) t0 = t;
+        else t1 = t;
+    }
+    return (t0 + t1) / 2;
+}
+
+static void pass_add_sunlit(sat_pass_t *pass, double start, double end)
+{
+    if (pass->nb_sunlit >= PASS_MAX_SUNLIT) return;
+    pass->sunlit[pass->nb_sunlit][0] = start;
+    pass->sunlit[pass->nb_sunlit][1] = end;
+    pass->nb_sunlit++;
+}
+
+/*
+ * Sample a pass from its rise, and refine its set time, culmination and
+ * sunlit intervals.  Return the set time.
+ */
+static double pass_refine(const passes_t *p, pass_worker_t *pw,
+                          const satellite_t *sat, double aos, double end,
+                          double step)
+{
+    sgp4_elsetrec_t *elsetrec = sat->elsetrec;
+    sat_pass_t pass = {.number = sat->number, .aos = aos, .max_alt = -1};
+    double t, prev, a, b, m1, m2, pos[3], alt, alt1, alt2, sunlit_start;
+    bool sunlit, prev_sunlit, set, dummy;
+
+    if (pass_get_state(p, elsetrec, aos, pos, &alt, &prev_sunlit))
+        return end;
+    sunlit_start = aos;
+    pass.max_utc = aos;
+    pass.max_alt = alt;
+    for (prev = aos; ; prev = t) {
+        t = fmin(prev + step, end);
+        if (pass_get_state(p, elsetrec, t, pos, &alt, &sunlit)) {
+            t = prev;
+            break;
+        }
+        set = alt < p->min_alt;
+        if (set) {
+            t = pass_bisect(p, elsetrec, prev, t, true, false);
+            if (pass_get_state(p, elsetrec, t, pos, &alt, &sunlit)) break;
+        }
+        if (sunlit != prev_sunlit) {
+            a = pass_bisect(p, elsetrec, prev, t, prev_sunlit, true);
+            if (prev_sunlit) pass_add_sunlit(&pass, sunlit_start, a);
+            sunlit_start = a;
+            prev_sunlit = sunlit;
+        }
+        if (alt > pass.max_alt) {
+            pass.max_alt = alt;
+            pass.max_utc = t;
+        }
+        if (set || t >= end) break;
+    }
+    pass.los = t;
+    if (prev_sunlit) pass_add_sunlit(&pass, sunlit_start, t);
+
+    // Ternary search of the culmination around the highest sample.
+    a = fmax(pass.max_utc - step, pass.aos);
+    b = fmin(pass.max_utc + step, pass.los);
+    while ((b - a) * 86400 > 1) {
+        m1 = a + (b - a) / 3;
+        m2 = b - (b - a) / 3;
+        if (pass_get_state(p, elsetrec, m1, pos, &alt1, &dummy) ||
+            pass_get_state(p, elsetrec, m2, pos, &alt2, &dummy)) break;
+        if (alt1 < alt2) a = m1;
+        else b = m2;
+    }
+    if (!pass_get_state(p, elsetrec, (a + b) / 2, pos, &alt, &dummy) &&
+            alt > pass.max_alt) {
+        pass.max_alt = alt;
+        pass.max_utc = (a + b) / 2;
+    }
+
+    if (pw->nb >= pw->allocated) {
+        pw->allocated = pw->allocated ? pw->allocated * 2 : 16;
+        pw->passes = realloc(pw->passes,
+                             pw->allocated * sizeof(*pw->passes));
+    }
+    pw->passes[pw->nb++] = pass;
+    return pass.los;
+}
+
+/*
+ * Get an upper bound of the angular speed around the Earth center of
+ * the satellite relative to the Earth surface (rad/s) and the max radius
+ * of its orbit (km), from its osculating elements.
+ */
+static void pass_get_orbit_bounds(const double pv[2][3], double *rate,
+                                  double *rmax)
+{
+    double r, v, h, a, e, c[3];
+
+    r = vec3_norm(pv[0]);
+    v = vec3_norm(pv[1]);
+    vec3_cross(pv[0], pv[1], c);
+    h = vec3_norm(c);
+    a = 1.0 / (2.0 / r - v * v / EARTH_MU);
+    if (a <= 0) { // Escape orbit, shouldn't happen with TLEs.
+        *rate = 2 * v / r + EARTH_ROT_RATE;
+        *rmax = INFINITY;
+        return;
+    }
+    e = sqrt(fmax(0, 1 - h * h / (EARTH_MU * a)));
+    // Add a margin for the drag that lowers the orbit over the window.
+    *rate = 1.2 * h / pow(a * (1 - e), 2) + EARTH_ROT_RATE;
+    *rmax = a * (1 + e);
+}
+
+static void pass_compute_sat(const passes_t *p, pass_worker_t *pw,
+                             const satellite_t *sat)
+{
+    sgp4_elsetrec_t *elsetrec = sat->elsetrec;
+    double t0, t1, t, prev, dt, step, rate, rmax, lambda, robs, alt, sep = 0;
+    double pv[2][3], obs[3], alt_margin;
+    bool sunlit, above;
+
+    satellite_get_operational_range(sat, &t0, &t1);
+    t0 = fmax(t0, p->start);
+    t1 = fmin(t1, p->end);
+    if (t0 >= t1) return;
+    if (sgp4(elsetrec, t0, pv[0], pv[1])) return;
+    pass_get_orbit_bounds(pv, &rate, &rmax);
+
+    // Max angle from the Earth center between the observer and the
+    // satellite for it to be above the min altitude, with a margin for
+    // the difference between the geodetic and geocentric zenith.
+    robs = vec3_norm(p->obs_pos);
+    alt_margin = p->min_alt - 0.01;
+    if (robs * cos(alt_margin) >= rmax) return;
+    lambda = acos(robs * cos(alt_margin) / rmax) - alt_margin + 0.01;
+    // Sampling step during the passes (s).
+    step = clamp(0.02 / rate, 5, 600);
+
+    for (prev = t = t0; ; ) {
+        if (pass_get_state(p, elsetrec, t, pv[0], &alt, &sunlit)) return;
+        above = alt >= p->min_alt;
+        if (above) {
+            if (t > t0) t = pass_bisect(p, elsetrec, prev, t, false, false);
+            t = pass_refine(p, pw, sat, t, t1, step / 86400);
+        } else {
+            vec3_copy(p->obs_pos, obs);
+            vec2_rotate(eraGmst82(DJM0, t + p->dut1), obs, obs);
+            sep = vec3_sep(pv[0], obs);
+        }
+        if (t >= t1) return;
+        dt = above ? step : fmax((sep - lambda) / rate, step);
+        prev = t;
+        t = fmin(t + dt / 86400, t1);
+    }
+}
+
+static int pass_worker(worker_t *w)
+{
+    pass_worker_t *pw = (void*)w;
+    const passes_t *p = w->user;
+    int i;
+    int start = p->nb * pw->k / PROP_NB_WORKERS;
+    int end = p->nb * (pw->k + 1) / PROP_NB_WORKERS;
+
+    for (i = start; i < end; i++)
+        pass_compute_sat(p, pw, p->sats[i]);
+    return 0;
+}
+
+static int pass_cmp(const void *a, const void *b)
+{
+    return cmp(((const sat_pass_t*)a)->aos, ((const sat_pass_t*)b)->aos);
+}
+
+/*
+ * Function: compute_passes
+ * Compute the passes of all the satellites over the observer location.
+ *
+ * The computation is done by the workers pool, and the call blocks until
+ * all the passes have been found.
+ *
+ * Arguments, as a json object:
+ *   start      - Start of the window (UTC MJD), default to the observer
+ *                time.
+ *   end        - End of the window (UTC MJD), default to one day after
+ *                start.
+ *   min_alt    - Min altitude of the passes (rad), default to 10°.
+ *
+ * Return:
+ *   A json array of the passes sorted by rise time, as objects with the
+ *   attributes: norad, aos, los, max_utc, max_alt, and sunlit, an array
+ *   of [start, end] intervals when the satellite is not in the Earth
+ *   shadow.
+ */
+static json_value *satellites_fn_compute_passes(
+        obj_t *obj, const attribute_t *attr, const json_value *args)
+{
+    satellites_t *sats = (satellites_t*)obj;
+    const observer_t *obs = core->observer;
+    passes_t p = {};
+    obj_t *child;
+    satellite_t *sat;
+    sat_pass_t *passes, *pass;
+    double rnp_t[3][3], pvh[2][3], pvb[2][3], utc;
+    int i, j, nb, nb_passes = 0;
+    json_value *ret, *jpass, *sunlit, *interval;
+
+    p.start = json_get_attr_f(args, "start", obs->utc);
+    p.end = json_get_attr_f(args, "end", p.start + 1);
+    p.min_alt = json_get_attr_f(args, "min_alt", 10 * DD2R);
+    if (!(p.end > p.start)) return json_array_new(0);
+    p.dut1 = obs->ut1 - obs->utc;
+    eraGd2gc(1, obs->elong, obs->phi, obs->hm, p.obs_pos);
+    vec3_mul(0.001, p.obs_pos, p.obs_pos);
+    p.obs_up[0] = cos(obs->phi) * cos(obs->elong);
+    p.obs_up[1] = cos(obs->phi) * sin(obs->elong);
+    p.obs_up[2] = sin(obs->phi);
+
+    // The precession doesn't change much over the window, so we use the
+    // observer matrix for all the Earth positions.
+    mat3_transpose(obs->rnp, rnp_t);
+    p.earth_nb = ceil((p.end - p.start) / PASS_EARTH_STEP) + 2;
+    p.earth_pos = calloc(p.earth_nb, sizeof(*p.earth_pos));
+    for (i = 0; i < p.earth_nb; i++) {
+        utc = p.start + i * PASS_EARTH_STEP;
+        eraEpv00(DJM0, utc + obs->tt - obs->utc, pvh, pvb);
+        mat3_mul_vec3(rnp_t, pvh[0], p.earth_pos[i]);
+    }
+
+    // The workers use the satellites main elements, since the main thread
+    // is blocked until they are done.  The batch propagation only uses
+    // its own copy.
+    DL_COUNT(sats->obj.children, child, nb);
+    p.sats = calloc(nb, sizeof(*p.sats));
+    DL_FOREACH(sats->obj.children, child) {
+        sat = (void*)child;
+        if (sat->error || !sat->elsetrec) continue;
+        p.sats[p.nb++] = sat;
+    }
+    for (i = 0; i < PROP_NB_WORKERS; i++) {
+        worker_init(&p.workers[i].worker, pass_worker);
+        p.workers[i].worker.user = &p;
+        p.workers[i].k = i;
+        worker_iter(&p.workers[i].worker);
+    }
+    for (i = 0; i < PROP_NB_WORKERS; i++) {
+        worker_wait(&p.workers[i].worker);
+        nb_passes += p.workers[i].nb;
+    }
+
+    passes = calloc(nb_passes ?: 1, sizeof(*passes));
+    for (i = 0, nb = 0; i < PROP_NB_WORKERS; i++) {
+        if (p.workers[i].nb)
+            memcpy(passes + nb, p.workers[i].passes,
+                   p.workers[i].nb * sizeof(*passes));
+        nb += p.workers[i].nb;
+        free(p.workers[i].passes);
+    }
+    qsort(passes, nb_passes, sizeof(*passes), pass_cmp);
+
+    ret = json_array_new(nb_passes);
+    for (i = 0; i < nb_passes; i++) {
+        pass = &passes[i];
+        jpass = json_object_new(0);
+        json_object_push(jpass, "norad", json_integer_new(pass->number));
+        json_object_push(jpass, "aos", json_double_new(pass->aos));
+        json_object_push(jpass, "los", json_double_new(pass->los));
+        json_object_push(jpass, "max_utc", json_double_new(pass->max_utc));
+        json_object_push(jpass, "max_alt", json_double_new(pass->max_alt));
+        sunlit = json_array_new(pass->nb_sunlit);
+        for (j = 0; j < pass->nb_sunlit; j++) {
+            interval = json_array_new(2);
+            json_array_push(interval, json_double_new(pass->sunlit[j][0]));
+            json_array_push(interval, json_double_new(pass->sunlit[j][1]));
+            json_array_push(sunlit, interval);
+        }
+        json_object_push(jpass, "sunlit", sunlit);
+        json_array_push(ret, jpass);
+    }
+    free(passes);
+    free(p.sats);
+    free(p.earth_pos);
+    return ret;
+}
+
 /*
  * Meta class declarations.
  */
@@ -785,6 +1948,168 @@ static obj_klass_t satellite_klass = {
 };
 OBJ_REGISTER(satellite_klass)
 
+static void satellites_get_memory(const obj_t *obj, int64_t *cpu,
+                                  int64_t *gpu)
+{
+    const obj_t *child;
+    const satellite_t *sat;
+    const satellites_t *sats = (const satellites_t*)obj;
+    DL_FOREACH(obj->children, child) {
+        sat = (const satellite_t*)child;
+        *cpu += sizeof(*sat);
+        if (sat->elsetrec) *cpu += sgp4_get_size();
+        if (sat->prop_elsetrec) *cpu += sgp4_get_size();
+    }
+    *cpu += sats->prop.nb * (sizeof(*sats->prop.sats) +
+                             sizeof(*sats->prop.pvg) + sizeof(*sats->prop.ok));
+    *cpu += sats->prop.sorted_nb * sizeof(*sats->prop.sorted);
+}
+
+/*
+ * Layout of the snapshot chunk: a sats_snapshot_header_t, then for each
+ * satellite a sat_snapshot_t followed by its SGP4 elements padded to 8
+ * bytes, and finally a table of the names and types strings lists.
+ */
+typedef struct {
+    uint32_t    nb;
+    uint32_t    elsetrec_size;
+    uint32_t    strs_size;
+    uint32_t    padding_;
+} sats_snapshot_header_t;
+
+typedef struct {
+    int32_t     number;
+    int32_t     strs_ofs;   // Names list, followed by the types list.
+    double      stdmag;     // NAN if not known.
+    double      launch_date;
+    double      decay_date;
+} sat_snapshot_t;
+
+// Add a json list of strings to a strings table, as for read_str_list.
+static void add_str_list(UT_string *strs, const json_value *list)
+{
+    int i;
+    const json_value *v;
+    for (i = 0; list && list->type == json_array &&
+                i < list->u.array.length; i++) {
+        v = list->u.array.values[i];
+        if (v->type != json_string || !v->u.string.length) continue;
+        utstring_bincpy(strs, v->u.string.ptr, v->u.string.length + 1);
+    }
+    utstring_bincpy(strs, "", 1);
+}
+
+static int satellites_save_snapshot(const obj_t *obj, snapshot_t *snap)
+{
+    const satellites_t *sats = (const satellites_t*)obj;
+    const satellite_t *sat;
+    const obj_t *child;
+    const json_value *model_data, *mag;
+    sats_snapshot_header_t header = {.elsetrec_size = sgp4_get_size()};
+    sat_snapshot_t rec;
+    int stride, nb = 0;
+    uint8_t *data;
+    UT_string strs;
+
+    if (!sats->loaded) return 0;
+    stride = sizeof(rec) + (header.elsetrec_size + 7) / 8 * 8;
+    DL_COUNT(obj->children, child, nb);
+    data = calloc(1, sizeof(header) + nb * stride);
+    utstring_init(&strs);
+    DL_FOREACH(obj->children, child) {
+        sat = (const satellite_t*)child;
+        if (!sat->elsetrec || !sat->data) continue;
+        model_data = json_get_attr(sat->data, "model_data", json_object);
+        mag = json_get_attr(model_data, "mag", 0);
+        rec = (sat_snapshot_t) {
+            .number = sat->number,
+            .strs_ofs = utstring_len(&strs),
+            .stdmag = !mag ? NAN :
+                      mag->type == json_double ? mag->u.dbl :
+                      mag->type == json_integer ? mag->u.integer : NAN,
+            .launch_date = sat->launch_date,
+            .decay_date = sat->decay_date,
+        };
+        add_str_list(&strs, json_get_attr(sat->data, "names", json_array));
+        add_str_list(&strs, json_get_attr(sat->data, "types", json_array));
+        memcpy(data + sizeof(header) + header.nb * stride, &rec, sizeof(rec));
+        memcpy(data + sizeof(header) + header.nb * stride + sizeof(rec),
+               sat->elsetrec, header.elsetrec_size);
+        header.nb++;
+    }
+    header.strs_size = utstring_len(&strs);
+    memcpy(data, &header, sizeof(header));
+    data = realloc(data, sizeof(header) + header.nb * stride +
+                         header.strs_size);
+    memcpy(data + sizeof(header) + header.nb * stride, utstring_body(&strs),
+           header.strs_size);
+    snapshot_add(snap, sats->eph_url ?: sats->jsonl_url, sats->etag,
+                 SNAPSHOT_VERSION, data,
+                 sizeof(header) + header.nb * stride + header.strs_size);
+    utstring_done(&strs);
+    free(data);
+    return 0;
+}
+
+static int satellites_load_snapshot(obj_t *obj, const char *url,
+                                    const char *etag, int version,
+                                    const void *data, int size)
+{
+    satellites_t *sats = (satellites_t*)obj;
+    const uint8_t *ptr = data;
+    const char *strs, *names, *types;
+    sats_snapshot_header_t header;
+    sat_snapshot_t rec;
+    satellite_t *sat;
+    sgp4_elsetrec_t *elsetrec;
+    int i, stride;
+
+    if (version != SNAPSHOT_VERSION || size < sizeof(header)) return -1;
+    // Only restore the data of the current source.
+    if (sats->loaded || !url ||
+            strcmp(url, sats->eph_url ?: sats->jsonl_url ?: "") != 0)
+        return -1;
+    memcpy(&header, ptr, sizeof(header));
+    if (header.elsetrec_size != sgp4_get_size()) return -1;
+    stride = sizeof(rec) + (header.elsetrec_size + 7) / 8 * 8;
+    if (header.nb > (size - sizeof(header)) / stride ||
+            header.strs_size != size - sizeof(header) - header.nb * stride ||
+            (header.nb && (header.strs_size < 2 || ptr[size - 1] ||
+                           ptr[size - 2])))
+        return -1;
+    strs = (const char*)ptr + sizeof(header) + header.nb * stride;
+
+    reload_begin(sats);
+    for (i = 0; i < header.nb; i++) {
+        memcpy(&rec, ptr + sizeof(header) + i * stride, sizeof(rec));
+        // The names and types lists are next to each other.
+        if (rec.strs_ofs < 0 || rec.strs_ofs + 1 >= header.strs_size)
+            continue;
+        names = strs + rec.strs_ofs;
+        for (types = names; *types; types += strlen(types) + 1) {}
+        types++;
+        if (types >= strs + header.strs_size) continue;
+        elsetrec = sgp4_clone((const void*)(ptr + sizeof(header) +
+                                            i * stride + sizeof(rec)));
+        sat = get_record_sat(sats, rec.number,
+                             sgp4_get_satepoch(elsetrec));
+        if (!sat) {
+            free(elsetrec);
+            continue;
+        }
+        satellite_init_from_elements(sat, rec.number, rec.stdmag, elsetrec,
+                                     rec.launch_date, rec.decay_date,
+                                     names, types);
+    }
+    reload_end(sats);
+    LOG_I("Restored %d satellites from snapshot", header.nb);
+    free(sats->etag);
+    sats->etag = etag ? strdup(etag) : NULL;
+    sats->loaded = true;
+    sats->check_source = true;
+    return 0;
+}
+
 static obj_klass_t satellites_klass = {
     .id             = "satellites",
     .size           = sizeof(satellites_t),
@@ -793,13 +2118,18 @@ static obj_klass_t satellites_klass = {
     .add_data_source = satellites_add_data_source,
     .render_order   = 31, // After planets.
     .update         = satellites_update,
+    .update_ahead   = satellites_update_ahead,
     .render         = satellites_render,
     .list           = satellites_list,
+    .get_memory     = satellites_get_memory,
+    .save_snapshot  = satellites_save_snapshot,
+    .load_snapshot  = satellites_load_snapshot,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(satellites_t, visible)),
         PROPERTY(hints_mag_offset, TYPE_FLOAT,
                  MEMBER(satellites_t, hints_mag_offset)),
         PROPERTY(hints_visible, TYPE_BOOL, MEMBER(satellites_t, hints_visible)),
+        FUNCTION(compute_passes, .fn = satellites_fn_compute_passes),
         {}
     }
 };
@@ -816,7 +2146,8 @@ static void check_sat(
     observer_t obs;
     char json[1204];
     obj_t *obj;
-    double d1, d2, vmag, dist, pos[4], alt, az;
+    double d1, d2, vmag, dist, pos[4], alt, az, utc, pv[2][3], pv2[2][3];
+    int i;
 
     snprintf(json, sizeof(json),
              "{\"model_data\":{\"mag\": %f,"
@@ -846,9 +2177,62 @@ static void check_sat(
     satellite_get_altitude(obj, &obs, &alt);
     assert(fabs(ha_alt - alt * DR2D) < 1);
 
+    // Check the interpolated positions against sgp4.
+    for (i = 1; i < 10; i++) {
+        utc = obs.utc + i * 2.9 / 86400;
+        satellite_get_teme_pv((satellite_t*)obj, utc, pv);
+        sgp4(((satellite_t*)obj)->elsetrec, utc, pv2[0], pv2[1]);
+        assert(vec3_dist(pv[0], pv2[0]) < 0.01); // 10 m.
+        assert(vec3_dist(pv[1], pv2[1]) < 0.01); // 10 m/s.
+    }
+
     obj_release(obj);
 }
 
+// Check the ISS pass found by compute_passes against heavens above.
+static void check_passes(void)
+{
+    obj_t *sats, *obj;
+    observer_t *obs = core->observer;
+    double elong = obs->elong, phi = obs->phi, d1, d2, utc;
+    char args[128], *str;
+    json_value *ret, *pass;
+
+    sats = core_get_module("satellites");
+    obj = obj_create_str("tle_satellite",
+        "{\"model_data\":{\"norad_number\": 25544, \"tle\": ["
+        "\"1 25544U 98067A   20115.55025390  .00016717  00000-0  "
+        "10270-3 0  9027\","
+        "\"2 25544  51.6412 253.9367 0001868 190.8144 169.2966 "
+        "15.49324997 23698\"]}}");
+    module_add(sats, obj);
+    obs->elong = 121.5654 * DD2R;
+    obs->phi = 25.0330 * DD2R;
+    observer_update(obs, false);
+
+    eraDtf2d("UTC", 2020, 4, 24, 4, 18, 58, &d1, &d2);
+    utc = d1 - DJM0 + d2 - 8. / 24;
+    snprintf(args, sizeof(args), "{\"start\": %.8f, \"end\": %.8f}",
+             utc - 0.5 / 24, utc + 0.5 / 24);
+    str = obj_call_json_str(sats, "compute_passes", args);
+    ret = json_parse(str, strlen(str));
+    free(str);
+    assert(ret && ret->u.array.length == 1);
+    pass = ret->u.array.values[0];
+    assert(json_get_attr_i(pass, "norad", 0) == 25544);
+    assert(fabs(json_get_attr_f(pass, "max_alt", 0) * DR2D - 86) < 1);
+    assert(fabs(json_get_attr_f(pass, "max_utc", 0) - utc) * 86400 < 60);
+    assert(json_get_attr_f(pass, "aos", 0) < utc - 2. / 1440);
+    assert(json_get_attr_f(pass, "los", 0) > utc + 2. / 1440);
+    json_value_free(ret);
+
+    module_remove(sats, obj);
+    obj_release(obj);
+    obs->elong = elong;
+    obs->phi = phi;
+    observer_update(obs, false);
+}
+
 static void test_satellites(void)
 {
     // Compare some position/vmag with values from heavens above.
@@ -910,6 +2294,8 @@ static void test_satellites(void)
         2020, 4, 24, 18, 48, 8,
         10, 219, 1810, 5.5,
         1, 1, 3, 1);
+
+    check_passes();
 }
 
 TEST_REGISTER(NULL, test_satellites, TEST_AUTO);
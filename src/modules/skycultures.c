@@ -23,8 +23,30 @@
 enum {
     SK_JSON                         = 1 << 0,
     SK_MD                           = 1 << 1,
+    // Names and constellations data, only parsed once activated.
+    SK_DATA                         = 1 << 2,
 };
 
+// Number of upcoming tour steps whose data we prefetch.
+#define TOUR_PREFETCH_STEPS 2
+
+/*
+ * Type: tour_step_t
+ * Target of a tour step, parsed ahead of time to prefetch its data.
+ *
+ * The tour steps are objects with the optional attributes:
+ *   target   - Designation of the target object, e.g. a constellation id.
+ *   ra, dec  - View direction (deg), if there is no target.
+ *   fov      - View fov (deg), default to fit the target.
+ */
+typedef struct {
+    char        *target;
+    obj_t       *obj;       // Target object, once found.
+    bool        not_found;
+    double      dir[3];     // ICRF direction from ra/dec, or zero.
+    double      fov;        // In radian, zero if not given.
+} tour_step_t;
+
 /*
  * Type: skyculture_t
  * Represent an individual skyculture.
@@ -39,6 +61,14 @@ typedef struct skyculture {
     json_value      *imgs;
     int             parsed; // union of SK_ enum for each parsed file.
     json_value      *tour;
+    tour_step_t     *tour_steps;
+    int             nb_tour_steps;
+    int             tour_step; // Current step of the tour, -1 if not playing.
+
+    // Kept until we parse the culture data, so that we only need to parse
+    // the names and constellations of the cultures we actually use.
+    json_value      *doc; // index.json.
+    char            *constellations_md; // 'Constellations' md section.
 
     // True if the common names for this sky culture should fallback to the
     // international names. Useful for cultures based on the western family.
@@ -104,14 +134,20 @@ typedef struct skycultures_t {
     skyculture_t *current; // The current skyculture.
     int     name_format_style;
     regex_t chinese_re;
+    // Incremented each time the cached labels need to be recomputed.
+    int     labels_version;
+    char    lang[16]; // Language used for the cached labels.
 } skycultures_t;
 
 // Static instance.
 static skycultures_t *g_skycultures = NULL;
 
+static void skyculture_release_tour(skyculture_t *cult);
+
 static void skyculture_deactivate(skyculture_t *cult)
 {
     obj_t *constellations, *cst, *tmp;
+    skyculture_release_tour(cult);
     // Remove all the constellation objects.
     constellations = core_get_module("constellations");
     assert(constellations);
@@ -120,6 +156,55 @@ static void skyculture_deactivate(skyculture_t *cult)
     }
 }
 
+static void load_constellation_md_data(const char *md, skyculture_t *cult);
+
+// Parse the names and constellations of a culture, the first time we
+// activate it.  The parsed data is then kept for the next activations.
+static void skyculture_load_data(skyculture_t *cult)
+{
+    unsigned int i;
+    int r;
+    const json_value *names, *features, *edges;
+    constellation_infos_t *cst_info;
+
+    if (!(cult->parsed & SK_MD) || (cult->parsed & SK_DATA)) return;
+    cult->parsed |= SK_DATA;
+    if (!cult->doc) return;
+
+    names = json_get_attr(cult->doc, "common_names", json_object);
+    features = json_get_attr(cult->doc, "constellations", json_array);
+    edges = json_get_attr(cult->doc, "edges", json_array);
+    if (names) cult->names = skyculture_parse_names_json(names);
+
+    if (features) {
+        cult->constellations = calloc(features->u.array.length,
+                                      sizeof(*cult->constellations));
+        for (i = 0; i < features->u.array.length; i++) {
+            cst_info = &cult->constellations[cult->nb_constellations];
+            r = skyculture_parse_feature_json(
+                    &cult->names,
+                    features->u.array.values[i],
+                    cst_info);
+            cst_info->base_path = cult->uri;
+            if (r) continue;
+            cult->nb_constellations++;
+        }
+    }
+
+    if (features && edges) {
+        skyculture_parse_edges(edges, cult->constellations,
+                               cult->nb_constellations);
+    }
+
+    if (cult->constellations_md)
+        load_constellation_md_data(cult->constellations_md, cult);
+
+    json_value_free(cult->doc);
+    free(cult->constellations_md);
+    cult->doc = NULL;
+    cult->constellations_md = NULL;
+}
+
 static void skyculture_activate(skyculture_t *cult)
 {
     int i;
@@ -127,6 +212,7 @@ static void skyculture_activate(skyculture_t *cult)
     constellation_infos_t *cst;
     obj_t *constellations;
 
+    skyculture_load_data(cult);
     // Create all the constellations object.
     constellations = core_get_module("constellations");
     assert(constellations);
@@ -159,6 +245,7 @@ static skyculture_t *add_from_uri(skycultures_t *cults, const char *uri,
     cult->key = strdup(key);
     cult->uri = strdup(uri);
     cult->obj.id = cult->key;
+    cult->tour_step = -1;
     skyculture_update((obj_t*)cult, 0);
     return cult;
 }
@@ -318,7 +405,6 @@ static void load_constellation_md_data(const char *md, skyculture_t *cult)
 static void add_section(const char *section_name, const char *content,
                         int size, skyculture_t *cult)
 {
-    char *cst_md_data;
     while (*(content + size - 1) == '\n' && size)
         size--;
     if (strcmp(section_name, "Introduction") == 0) {
@@ -332,9 +418,9 @@ static void add_section(const char *section_name, const char *content,
     } else if (strcmp(section_name, "License") == 0) {
         cult->licence = to_buf(content, size);
     } else if (strcmp(section_name, "Constellations") == 0) {
-        cst_md_data = to_buf(content, size);
-        load_constellation_md_data(cst_md_data, cult);
-        free(cst_md_data);
+        // Parsed with the constellations, when we activate the culture.
+        free(cult->constellations_md);
+        cult->constellations_md = to_buf(content, size);
     } else if (strcmp(section_name, "Extras") == 0) {
         // Currently ignores this section
     } else {
@@ -406,6 +492,36 @@ static int skyculture_load_md(skyculture_t *cult) {
     return 0;
 }
 
+// Parse the tour steps targets, the tour can either be an array of steps,
+// or an object with a 'steps' array.
+static void skyculture_parse_tour(skyculture_t *cult)
+{
+    const json_value *steps = cult->tour, *step;
+    const char *target;
+    tour_step_t *ts;
+    double ra, dec;
+    unsigned int i;
+
+    if (steps->type == json_object)
+        steps = json_get_attr(steps, "steps", json_array);
+    if (!steps || steps->type != json_array) return;
+    cult->tour_steps = calloc(steps->u.array.length,
+                              sizeof(*cult->tour_steps));
+    cult->nb_tour_steps = steps->u.array.length;
+    for (i = 0; i < steps->u.array.length; i++) {
+        step = steps->u.array.values[i];
+        ts = &cult->tour_steps[i];
+        if (step->type != json_object) continue;
+        target = json_get_attr_s(step, "target");
+        if (target) ts->target = strdup(target);
+        ra = json_get_attr_f(step, "ra", NAN);
+        dec = json_get_attr_f(step, "dec", NAN);
+        if (!isnan(ra) && !isnan(dec))
+            eraS2c(ra * DD2R, dec * DD2R, ts->dir);
+        ts->fov = json_get_attr_f(step, "fov", 0) * DD2R;
+    }
+}
+
 static int skyculture_update(obj_t *obj, double dt)
 {
     const char *json;
@@ -414,8 +530,7 @@ static int skyculture_update(obj_t *obj, double dt)
     int code, r;
     unsigned int i;
     json_value *doc;
-    const json_value *names = NULL, *features = NULL,
-                     *tour = NULL, *edges = NULL,
+    const json_value *tour = NULL,
                      *langs_use_native_names = NULL,
                      *thumbnail_bscale = NULL, *illustrations_bscale = NULL;
     const char *description = NULL, *introduction = NULL,
@@ -423,8 +538,6 @@ static int skyculture_update(obj_t *obj, double dt)
                *thumbnail = NULL, *highlight = NULL;
     const char* langname;
 
-    constellation_infos_t *cst_info;
-
     if (cult->parsed & SK_MD)
         return 0;
 
@@ -455,14 +568,11 @@ static int skyculture_update(obj_t *obj, double dt)
         "?fallback_to_international_names",
                    JCON_BOOL(cult->fallback_to_international_names, 0),
         "?langs_use_native_names", JCON_VAL(langs_use_native_names),
-        "?common_names", JCON_VAL(names),
-        "?constellations", JCON_VAL(features),
         "?introduction", JCON_STR(introduction),
         "?description", JCON_STR(description),
         "?references", JCON_STR(references),
         "?authors", JCON_STR(authors),
         "?licence", JCON_STR(licence),
-        "?edges", JCON_VAL(edges),
         "?tour", JCON_VAL(tour),
         "?thumbnail", JCON_STR(thumbnail),
         "?thumbnail_bscale", JCON_VAL(thumbnail_bscale),
@@ -494,8 +604,10 @@ static int skyculture_update(obj_t *obj, double dt)
         cult->thumbnail = strdup(thumbnail);
     if (highlight)
         cult->highlight = strdup(highlight);
-    if (names) cult->names = skyculture_parse_names_json(names);
-    if (tour) cult->tour = json_copy(tour);
+    if (tour) {
+        cult->tour = json_copy(tour);
+        skyculture_parse_tour(cult);
+    }
 
     if (langs_use_native_names) {
         for (i = 0; i < langs_use_native_names->u.array.length; i++) {
@@ -507,25 +619,9 @@ static int skyculture_update(obj_t *obj, double dt)
         }
     }
 
-    if (!features) goto end;
-    cult->constellations = calloc(features->u.array.length,
-                                  sizeof(*cult->constellations));
-    for (i = 0; i < features->u.array.length; i++) {
-        cst_info = &cult->constellations[cult->nb_constellations];
-        r = skyculture_parse_feature_json(
-                &cult->names,
-                features->u.array.values[i],
-                cst_info);
-        cst_info->base_path = cult->uri;
-        if (r) continue;
-        cult->nb_constellations++;
-    }
-
-    if (edges) {
-        cult->has_boundaries = true;
-        skyculture_parse_edges(edges, cult->constellations,
-                               cult->nb_constellations);
-    }
+    // Only known once we parse the data, but we need it in the UI.
+    cult->has_boundaries = json_get_attr(doc, "constellations", json_array) &&
+                           json_get_attr(doc, "edges", json_array);
 
     cult->thumbnail_bscale = 1;
     if (thumbnail_bscale) {
@@ -544,13 +640,74 @@ static int skyculture_update(obj_t *obj, double dt)
             illustrations_bscale->u.integer : illustrations_bscale->u.dbl;
     }
 
-end:
-    json_value_free(doc);
+    // The rest of the data is parsed when we activate the culture.
+    cult->doc = doc;
 
     // Immediately tries to load the md file if available
     return skyculture_load_md(cult);
 }
 
+// Release the tour targets objects, so that we look for them again the
+// next time the tour is played.
+static void skyculture_release_tour(skyculture_t *cult)
+{
+    int i;
+    for (i = 0; i < cult->nb_tour_steps; i++) {
+        obj_release(cult->tour_steps[i].obj);
+        cult->tour_steps[i].obj = NULL;
+        cult->tour_steps[i].not_found = false;
+    }
+}
+
+/*
+ * Prefetch the data of a tour step: the target object (for the
+ * constellations this loads the lines stars), its label, and the sky
+ * surveys tiles around it.
+ */
+static void skyculture_prefetch_tour_step(tour_step_t *step)
+{
+    double pos[4], dir[3], radius, fov = step->fov;
+    char label[256];
+
+    vec3_copy(step->dir, dir);
+    if (step->target && !step->obj && !step->not_found) {
+        step->obj = core_search(step->target);
+        step->not_found = !step->obj;
+        skycultures_get_label(step->target, label, sizeof(label));
+    }
+    if (step->obj) {
+        // Fails until the object data is loaded.
+        if (obj_get_pos(step->obj, core->observer, FRAME_ICRF, pos)) return;
+        vec3_copy(pos, dir);
+        if (!fov && obj_get_info(step->obj, core->observer, INFO_RADIUS,
+                                 &radius) == 0)
+            fov = radius * 4; // Leave some margin around the target.
+    }
+    if (!vec3_norm2(dir)) return;
+    hips_prefetch_view(dir, fov ?: core->fov);
+}
+
+static void skyculture_prefetch_tour(skyculture_t *cult)
+{
+    int i;
+    if (cult->tour_step < 0) return;
+    for (i = cult->tour_step; i < cult->nb_tour_steps; i++) {
+        if (i >= cult->tour_step + TOUR_PREFETCH_STEPS) break;
+        skyculture_prefetch_tour_step(&cult->tour_steps[i]);
+    }
+}
+
+static void skyculture_on_tour_step_changed(obj_t *obj,
+                                            const attribute_t *attr)
+{
+    skyculture_t *cult = (void*)obj;
+    obj_t *constellations = core_get_module("constellations");
+    // Also load the constellations images while the tour is playing, in
+    // case a step shows them.
+    obj_set_attr(constellations, "prefetch_images", cult->tour_step >= 0);
+    if (cult->tour_step < 0) skyculture_release_tour(cult);
+}
+
 static void skycultures_gui(obj_t *obj, int location)
 {
     skyculture_t *cult;
@@ -575,12 +732,27 @@ static void skycultures_gui(obj_t *obj, int location)
     }
 }
 
+static void skycultures_invalidate_labels(obj_t *obj,
+                                         const attribute_t *attr)
+{
+    skycultures_t *cults = (void*)obj;
+    cults->labels_version++;
+}
+
 static int skycultures_update(obj_t *obj, double dt)
 {
     obj_t *skyculture;
+    skycultures_t *cults = (void*)obj;
+    const char *lang = sys_get_lang();
+
+    if (strcmp(lang, cults->lang) != 0) {
+        snprintf(cults->lang, sizeof(cults->lang), "%s", lang);
+        cults->labels_version++;
+    }
     MODULE_ITER(obj, skyculture, "skyculture") {
         skyculture_update(skyculture, dt);
     }
+    if (cults->current) skyculture_prefetch_tour(cults->current);
     return 0;
 }
 
@@ -588,6 +760,8 @@ static int skycultures_init(obj_t *obj, json_value *args)
 {
     skycultures_t *scs = (skycultures_t*)obj;
     regcomp(&scs->chinese_re, " [MDCLXVI]+$", REG_EXTENDED);
+    scs->labels_version = 1;
+    snprintf(scs->lang, sizeof(scs->lang), "%s", sys_get_lang());
     assert(!g_skycultures);
     g_skycultures = scs;
     return 0;
@@ -761,30 +935,11 @@ static void skycultures_translate_english_name(const char* name, char *out,
     snprintf(out, out_size, "%s", tr_name);
 }
 
-/*
- * Function: skycultures_get_label
- * Get the label of a sky object in the current skyculture, translated
- * for the current language.
- *
- * Parameters:
- *   main_id        - the main ID of the sky object:
- *                     - for bright stars use "HIP XXXX"
- *                     - for constellations use "CON culture_name XXX"
- *                     - for planets use "NAME Planet"
- *                     - for DSO use the first identifier of the names list
- *   out            - A text buffer that get filled with the name.
- *   out_size       - size of the out buffer.
- *
- * Return:
- *   NULL if no name was found.  A pointer to the passed buffer otherwise.
- */
-const char *skycultures_get_label(const char* main_id, char *out, int out_size)
+// Compute the label of a sky culture name, without using the cache.
+static const char *format_label(const skyculture_t *cult,
+                                const skyculture_name_t *entry,
+                                char *out, int out_size)
 {
-    const skyculture_t *cult = g_skycultures->current;
-    const skyculture_name_t *entry = skycultures_get_name_info(main_id);
-
-    if (!cult || !entry) return NULL;
-
     switch (g_skycultures->name_format_style) {
     case NAME_AUTO:
         if (cult->prefer_native_names) {
@@ -832,6 +987,46 @@ const char *skycultures_get_label(const char* main_id, char *out, int out_size)
     return NULL;
 }
 
+/*
+ * Function: skycultures_get_label
+ * Get the label of a sky object in the current skyculture, translated
+ * for the current language.
+ *
+ * Parameters:
+ *   main_id        - the main ID of the sky object:
+ *                     - for bright stars use "HIP XXXX"
+ *                     - for constellations use "CON culture_name XXX"
+ *                     - for planets use "NAME Planet"
+ *                     - for DSO use the first identifier of the names list
+ *   out            - A text buffer that get filled with the name.
+ *   out_size       - size of the out buffer.
+ *
+ * Return:
+ *   NULL if no name was found.  A pointer to the passed buffer otherwise.
+ */
+const char *skycultures_get_label(const char* main_id, char *out, int out_size)
+{
+    const skyculture_t *cult = g_skycultures->current;
+    skyculture_name_t *entry;
+    char buf[256];
+
+    entry = (skyculture_name_t*)skycultures_get_name_info(main_id);
+    if (!cult || !entry) return NULL;
+
+    // The labels are requested at each frame, so we cache them until the
+    // language or the names format change.
+    if (entry->label_version != g_skycultures->labels_version) {
+        free(entry->label);
+        entry->label = NULL;
+        if (format_label(cult, entry, buf, sizeof(buf)))
+            entry->label = strdup(buf);
+        entry->label_version = g_skycultures->labels_version;
+    }
+    if (!entry->label) return NULL;
+    snprintf(out, out_size, "%s", entry->label);
+    return out;
+}
+
 static void add_one_sc_names_(const skyculture_name_t *entry, const obj_t *obj,
                              void *user, void (*f)(const obj_t *obj, void *user,
                                                    const char *dsgn))
@@ -1060,11 +1255,24 @@ static json_value *skycultures_current_id_fn(
 /*
  * Meta class declarations.
  */
+static void skyculture_get_memory(const obj_t *obj, int64_t *cpu,
+                                  int64_t *gpu)
+{
+    const skyculture_t *cult = (const skyculture_t*)obj;
+    *cpu += sizeof(*cult) +
+            HASH_COUNT(cult->names) * sizeof(*cult->names) +
+            cult->nb_constellations * sizeof(*cult->constellations);
+    if (cult->constellations_md) *cpu += strlen(cult->constellations_md);
+    if (cult->introduction) *cpu += strlen(cult->introduction);
+    if (cult->description) *cpu += strlen(cult->description);
+}
+
 static obj_klass_t skyculture_klass = {
     .id     = "skyculture",
     .size   = sizeof(skyculture_t),
     .flags  = 0,
     .update = skyculture_update,
+    .get_memory = skyculture_get_memory,
     .attributes = (attribute_t[]) {
         PROPERTY(name, TYPE_STRING_PTR, MEMBER(skyculture_t, name)),
         PROPERTY(region, TYPE_STRING_PTR, MEMBER(skyculture_t, region)),
@@ -1079,6 +1287,8 @@ static obj_klass_t skyculture_klass = {
         PROPERTY(licence, TYPE_STRING_PTR, MEMBER(skyculture_t, licence)),
         PROPERTY(url, TYPE_STRING_PTR, MEMBER(skyculture_t, uri)),
         PROPERTY(tour, TYPE_JSON, MEMBER(skyculture_t, tour)),
+        PROPERTY(tour_step, TYPE_INT, MEMBER(skyculture_t, tour_step),
+                 .on_changed = skyculture_on_tour_step_changed),
         PROPERTY(thumbnail, TYPE_STRING_PTR, MEMBER(skyculture_t, thumbnail)),
         PROPERTY(thumbnail_bscale, TYPE_FLOAT,
                  MEMBER(skyculture_t, thumbnail_bscale)),
@@ -1104,7 +1314,8 @@ static obj_klass_t skycultures_klass = {
         PROPERTY(current, TYPE_OBJ, MEMBER(skycultures_t, current)),
         PROPERTY(current_id, TYPE_STRING, .fn = skycultures_current_id_fn),
         PROPERTY(name_format_style, TYPE_INT,
-                 MEMBER(skycultures_t, name_format_style)),
+                 MEMBER(skycultures_t, name_format_style),
+                 .on_changed = skycultures_invalidate_labels),
         {}
     },
 };
@@ -23,8 +23,25 @@ static const double LABEL_SPACING = 4;
 static obj_klass_t star_klass;
 
 typedef struct stars stars_t;
+
+// Pre-parsed star designations used for the labels, so that we don't parse
+// the names again at each frame.
 typedef struct {
-    obj_t   obj;
+    designation_t first;    // First designation.
+    designation_t bayer;    // First bayer like designation.
+    const char    *bayer_name; // Pointer into the star names, or NULL.
+} star_dsgns_t;
+
+/*
+ * Type: star_data_t
+ * Catalog data of a star.
+ *
+ * The tiles store their stars as plain records, and we only create a
+ * <star_t> object for the ones we need to return from picking, search or
+ * listing.
+ */
+typedef struct {
+    char    type[4] NONSTRING;
     uint64_t gaia;  // Gaia source id (0 if none)
     int     hip;    // HIP number.
     float   vmag;
@@ -36,22 +53,67 @@ typedef struct {
     double  distance;    // Distance in AU
     // List of extra names, separated by '\0', terminated by two '\0'.
     char    *names;
+    star_dsgns_t *dsgns; // Only set if the star has names.
     char    *sp_type;
-} star_t;
+} star_data_t;
 
 typedef struct survey survey_t;
+
+/*
+ * Type: star_key_t
+ * Location of a star in the surveys tiles.
+ */
+typedef struct {
+    const survey_t  *survey;
+    int             order;
+    int             pix;
+    int             index; // Index of the star in the tile sources.
+} star_key_t;
+
+/*
+ * Type: star_t
+ * Object of a star.
+ *
+ * The objects of the tiles stars are created on demand with a copy of
+ * their data, and indexed by location as long as they are alive, so that
+ * we always return the same object for a given star.
+ */
+typedef struct {
+    obj_t           obj;
+    star_data_t     data;
+    star_key_t      key; // Only set for the stars of the tiles.
+    UT_hash_handle  hh;
+} star_t;
+
 struct survey {
     stars_t *stars;
     char    key[128];
     hips_t *hips;
     char    url[URL_MAX_SIZE - 256];
     int     min_order;
-    double  min_vmag; // Don't render survey below this mag.
+    // Magnitude range covered by the survey, max_vmag is NAN if unlimited.
+    double  min_vmag;
     double  max_vmag;
+    // Start of the magnitude band we actually use from the survey, after
+    // the brighter surveys, see surveys_update_bands.
+    double  band_min;
     bool    is_gaia;
     survey_t *next, *prev;
 };
 
+/*
+ * Type: hip_entry_t
+ * Location of a HIP star in the surveys, used by obj_get_by_hip.
+ */
+typedef struct hip_entry {
+    UT_hash_handle  hh;
+    int             hip;
+    survey_t        *survey;
+    int             order;
+    int             pix;
+    int             index; // Index of the star in the tile sources.
+} hip_entry_t;
+
 /*
  * Type: stars_t
  * The module object.
@@ -64,24 +126,220 @@ struct stars {
     // Hints/labels magnitude offset
     double          hints_mag_offset;
     bool            hints_visible;
+    // Render the unresolved faint stars of the tiles as impostors.
+    bool            impostors;
+    hip_entry_t     *hip_index; // Hash of all the HIP stars seen so far.
+    star_t          *objs; // Hash of the tiles stars objects alive.
 };
 
 // Static instance.
 static stars_t *g_stars = NULL;
 
+// Tile flags.
+enum {
+    TILE_HIP_INDEXED = 1 << 0, // The tile HIP stars are in the hip index.
+};
+
+// Number of rows converted when a tile is created, and then at each frame
+// for all the tiles still loading.  Only used without threads support,
+// otherwise the tiles are fully loaded in the worker pool.
+#define TILE_FIRST_ROWS         1024
+#define LOAD_ROWS_PER_FRAME     16384
+
+// Version of the layout of the tiles in the decoded tiles cache.  Should be
+// increased each time we change the format, or the way we decode the rows.
+#define DECODED_TILE_VERSION    2
+
+// Magnitude margin after the start of a survey band where we consider the
+// HIP stars to be already in the brighter surveys.  The magnitudes of the
+// same star can differ a bit from one catalog to the other.
+#define CROSS_MATCH_MAG         1.0
+
+// Max time difference (day) before we recompute the cached astrometric
+// positions of the tiles.  In one day the fastest star (Barnard's star)
+// moves by 0.03 arcsec, and the parallax of the closest one changes by
+// less than 0.02 arcsec.
+#define ASTROM_MAX_AGE          1.0
+
+// Tiles impostors, see tile_update_impostor.  The textures have
+// 2^IMPOSTOR_ORDER texels per side, and the IMPOSTOR_KEEP brightest stars
+// of a tile are always rendered as points.
+#define IMPOSTOR_ORDER          4
+#define IMPOSTOR_SIZE           (1 << IMPOSTOR_ORDER)
+#define IMPOSTOR_KEEP           32
+#define IMPOSTOR_MIN_STARS      256
+#define IMPOSTOR_BINS           16
+#define IMPOSTOR_BIN_MAG        0.5
+// Max luminance of the points replaced by the impostor.
+#define IMPOSTOR_MAX_LUM        0.2
+
+// All the columns we care about in the source file.
+static const eph_table_column_t COLUMNS[] = {
+    {"type", 's', .size=4},
+    {"gaia", 'Q'},
+    {"hip",  'i'},
+    {"vmag", 'f', EPH_VMAG},
+    {"gmag", 'f', EPH_VMAG},
+    {"ra",   'f', EPH_RAD},
+    {"de",   'f', EPH_RAD},
+    {"plx",  'f', EPH_ARCSEC},
+    {"pra",  'f', EPH_RAD_PER_YEAR},
+    {"pde",  'f', EPH_RAD_PER_YEAR},
+    {"epoc", 'f', EPH_YEAR},
+    {"bv",   'f'},
+    {"ids",  's', .size=256},
+    {"spec", 's', .size=32},
+};
+
+/*
+ * Type: tile_loader_t
+ * State of a tile whose rows are still being converted.
+ *
+ * The table data is uncompressed and unshuffled at once, but the rows are
+ * then converted in bounded chunks, so that big tiles don't stall the
+ * frame in which they arrive.
+ */
+typedef struct tile_loader {
+    void    *table_data;
+    int     table_size;
+    int     data_ofs;
+    int     nb_rows;
+    int     row;        // Next row to convert.
+    int     start;      // Index of the first source of the slice.
+    eph_table_column_t columns[ARRAY_SIZE(COLUMNS)];
+} tile_loader_t;
+
+/*
+ * Type: tile_slice_t
+ * Copy of a STAR chunk of a tile file, not decoded yet.
+ *
+ * A tile file can contain several STAR chunks, each one a magnitude slice
+ * fainter than the previous one.  Only the first slice is decoded when the
+ * tile is created, the others are kept compressed until the limiting
+ * magnitude goes past the decoded stars.
+ */
+typedef struct tile_slice {
+    void    *data;
+    int     size;
+} tile_slice_t;
+
 /*
  * Type: tile_t
  * Custom tile structure for the stars hips survey.
  */
 typedef struct tile {
+    // Used to reference the sources without creating their objects, see
+    // star_tile_get_source.
+    obj_t       obj;
+    survey_t    *survey;
+    int         order;
+    int         pix;
     int         flags;
     double      mag_min;
     double      mag_max;
     double      illuminance; // Totall illuminance (lux).
     int         nb;
-    star_t      *sources;
+    int         nb_max; // Number of allocated sources, for all the slices.
+    star_data_t *sources;
+    int         transparency; // Children mask of the tile file.
+
+    // Copy of the values used during rendering, stored as separate arrays
+    // in the same order as the sources, so that the render loop doesn't
+    // have to go through the full star_data_t structures.
+    struct {
+        double  (*pos)[3];      // Position at J2000 (AU).
+        double  (*speed)[3];    // Speed (AU/day).
+        double  (*astrom)[3];   // Cached astrometric positions.
+        float   *vmag;
+        float   *illuminance;
+        uint8_t (*color)[3];    // Precomputed B-V color.
+    } hot;
+
+    // Number of valid positions in hot.astrom, and the time and earth
+    // position they were computed for.
+    struct {
+        int     nb;
+        double  tt;
+        double  earth_pos[3];
+    } astrom;
+
+    // Set while the rows are still being converted.  In that case the
+    // sources of the slice are not sorted yet, and only rendered as
+    // anonymous points.
+    tile_loader_t *loader;
+
+    // Magnitude slices still compressed.  The sources are allocated for
+    // all the slices, so that decoding a slice never moves the others.
+    tile_slice_t *slices;
+    int         slices_nb;
+    int         slices_next; // Next slice to decode.
+
+    // Set if the tile was loaded from the decoded tiles cache.  In that case
+    // the hot arrays and the strings of the first nb sources point into
+    // the mapped file.
+    struct {
+        void    *data;
+        int     size;
+        int     nb;
+    } map;
+    int         saved_slices; // Value of slices_next when last saved.
+
+    // Integrated light of the faint stars, rendered instead of the points
+    // when they are not resolved anyway.
+    struct {
+        int         nb;         // Value of tile nb when built, 0 if none.
+        int         start;      // Index of the first source in it.
+        double      mag;        // Magnitude of the first source.
+        double      scale;      // Illuminance of the brightest texel (lux).
+        double      illuminance; // Total illuminance (lux).
+        float       bins[IMPOSTOR_BINS]; // Illuminance per magnitude bin.
+        texture_t   *tex;
+    } impostor;
 } tile_t;
 
+/*
+ * Type: decoded_tile_t
+ * Header of a tile in the decoded tiles cache.
+ *
+ * It is followed by the blocks, each one padded to 8 bytes:
+ *   - The nb star_record_t of the decoded sources.
+ *   - The hot arrays, as allocated by tile_alloc_hot for nb_max sources.
+ *   - The strings, referenced by offset from the records.
+ *   - The sizes of the slices not decoded yet (int32_t).
+ *   - The data of those slices.
+ */
+typedef struct {
+    int32_t     nb;
+    int32_t     nb_max;
+    int32_t     transparency;
+    int32_t     strings_size;
+    int32_t     slices_nb;
+    int32_t     slices_size;
+    double      mag_min;
+    double      mag_max;
+    double      illuminance;
+} decoded_tile_t;
+
+/*
+ * Type: star_record_t
+ * A star_data_t as stored in the decoded tiles cache.
+ */
+typedef struct {
+    char        type[4] NONSTRING;
+    int32_t     hip;
+    uint64_t    gaia;
+    float       vmag;
+    float       plx;
+    float       bv;
+    float       illuminance;
+    double      pvo[2][3];
+    double      distance;
+    int32_t     names;      // Offset in the strings, or -1.
+    int32_t     sp_type;    // Offset in the strings, or -1.
+} star_record_t;
+
+#define ALIGN8(n) (((n) + 7) / 8 * 8)
+
 static void nuniq_to_pix(uint64_t nuniq, int *order, int *pix)
 {
     *order = log2(nuniq / 4) / 2;
@@ -98,7 +356,7 @@ static void nuniq_to_pix(uint64_t nuniq, int *order, int *pix)
  *   plx    - Parallax (arcseconds).
  */
 static void compute_pv(double ra, double de, double pra, double pde,
-                       double plx, double epoch, star_t *s)
+                       double plx, double epoch, star_data_t *s)
 {
     int r;
     double djm0, djm = 0;
@@ -153,10 +411,30 @@ static char *parse_json_names(json_value *names)
     return utstring_body(&ret);
 }
 
+static bool name_is_bayer(const char* name) {
+    return strncmp(name, "* ", 2) == 0 || strncmp(name, "V* ", 3) == 0;
+}
+
+// Parse the designations we need for the labels, once the names are set.
+static void star_parse_names(star_data_t *s)
+{
+    const char *name;
+
+    if (!s->names || !*s->names) return;
+    s->dsgns = calloc(1, sizeof(*s->dsgns));
+    designation_parse(s->names, &s->dsgns->first);
+    for (name = s->names; *name; name += strlen(name) + 1) {
+        if (!name_is_bayer(name)) continue;
+        s->dsgns->bayer_name = name;
+        designation_parse(name, &s->dsgns->bayer);
+        break;
+    }
+}
+
 static int star_init(obj_t *obj, json_value *args)
 {
     // Support creating a star using noctuasky model data json values.
-    star_t *star = (star_t*)obj;
+    star_data_t *star = &((star_t*)obj)->data;
     json_value *model, *names;
     double epoch, ra, de, pra, pde;
 
@@ -178,12 +456,13 @@ static int star_init(obj_t *obj, json_value *args)
     names = json_get_attr(args, "names", json_array);
     if (names)
         star->names = parse_json_names(names);
+    star_parse_names(star);
     return 0;
 }
 
 // Return the star astrometric position, that is as seen from earth center
 // after applying proper motion and parallax.
-static void star_get_astrom(const star_t *s, const observer_t *obs,
+static void star_get_astrom(const star_data_t *s, const observer_t *obs,
                             double v[3])
 {
     // Apply proper motion
@@ -194,11 +473,93 @@ static void star_get_astrom(const star_t *s, const observer_t *obs,
     vec3_normalize(v, v);
 }
 
+/*
+ * Function: tile_compute_astrom
+ * Compute the astrometric positions of a range of stars of a tile.
+ *
+ * Same as star_get_astrom, but working directly on the tile hot arrays so
+ * that the compiler can vectorize the loop.
+ *
+ * Parameters:
+ *   tile       - A stars tile.
+ *   start      - Index of the first star.
+ *   end        - Index after the last star.
+ *   tt         - TT time (MJD).
+ *   earth_pos  - Earth barycentric position (AU).
+ */
+static void tile_compute_astrom(tile_t *tile, int start, int end, double tt,
+                                const double earth_pos[3])
+{
+    int i, j;
+    double norm;
+    const double dt = tt - ERFA_DJM00;
+    const double (*restrict pos)[3] = (const double (*)[3])tile->hot.pos;
+    const double (*restrict speed)[3] = (const double (*)[3])tile->hot.speed;
+    double (*restrict out)[3] = tile->hot.astrom;
+
+    for (i = start; i < end; i++) {
+        for (j = 0; j < 3; j++)
+            out[i][j] = pos[i][j] + dt * speed[i][j] - earth_pos[j];
+    }
+    for (i = start; i < end; i++) {
+        norm = sqrt(out[i][0] * out[i][0] + out[i][1] * out[i][1] +
+                    out[i][2] * out[i][2]);
+        for (j = 0; j < 3; j++)
+            out[i][j] *= 1.0 / norm;
+    }
+}
+
+/*
+ * Function: tile_update_astrom
+ * Make sure the first n stars of a tile have their astrometric positions
+ * in the hot.astrom array.
+ *
+ * The positions are cached in the tile and only recomputed once the time
+ * changes by more than ASTROM_MAX_AGE, since the proper motion and the
+ * parallax change very slowly.  While a slice is still loading its
+ * sources are not sorted yet, so we don't keep their positions.
+ */
+static void tile_update_astrom(tile_t *tile, int n, const observer_t *obs)
+{
+    int stable = tile->loader ? tile->loader->start : tile->nb;
+
+    if (fabs(obs->tt - tile->astrom.tt) > ASTROM_MAX_AGE)
+        tile->astrom.nb = 0;
+    if (tile->astrom.nb == 0) {
+        tile->astrom.tt = obs->tt;
+        vec3_copy(obs->earth_pvb[0], tile->astrom.earth_pos);
+    }
+    if (tile->astrom.nb < n) {
+        tile_compute_astrom(tile, tile->astrom.nb, n, tile->astrom.tt,
+                            tile->astrom.earth_pos);
+        tile->astrom.nb = n < stable ? n : stable;
+    }
+}
+
+/*
+ * Function: tile_count_brighter
+ * Return the number of sources of a sorted tile with a magnitude lower or
+ * equal to a given value.
+ *
+ * Since the sources are sorted by magnitude, this is the index of the
+ * first source fainter than vmag, found with a binary search.
+ */
+static int tile_count_brighter(const tile_t *tile, double vmag)
+{
+    int lo = 0, hi = tile->nb, mid;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (tile->hot.vmag[mid] > vmag) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
 // Return position and velocity in ICRF with origin on observer (AU).
 static int star_get_pvo(const obj_t *obj, const observer_t *obs,
                         double pvo[2][4])
 {
-    const star_t *s = (const star_t*)obj;
+    const star_data_t *s = &((const star_t*)obj)->data;
     star_get_astrom(s, obs, pvo[0]);
     convert_frame(obs, FRAME_ASTROM, FRAME_ICRF, true, pvo[0], pvo[0]);
     pvo[0][3] = 0.0;
@@ -209,7 +570,7 @@ static int star_get_pvo(const obj_t *obj, const observer_t *obs,
 static int star_get_info(const obj_t *obj, const observer_t *obs, int info,
                          void *out)
 {
-    const star_t *star = (const star_t*)obj;
+    const star_data_t *star = &((const star_t*)obj)->data;
     switch (info) {
     case INFO_PVO:
         star_get_pvo(obj, obs, out);
@@ -227,7 +588,7 @@ static int star_get_info(const obj_t *obj, const observer_t *obs, int info,
 
 static json_value *star_get_json_data(const obj_t *obj)
 {
-    const star_t *star = (const star_t*)obj;
+    const star_data_t *star = &((const star_t*)obj)->data;
     json_value* ret = json_object_new(0);
     json_value* md = json_object_new(0);
     if (!isnan(star->plx)) {
@@ -256,7 +617,8 @@ static json_value *star_get_json_data(const obj_t *obj)
  * Return:
  *   true if a label was found, false otherwise.
  */
-static bool star_get_skycultural_name(const star_t *s, char *out, int size)
+static bool star_get_skycultural_name(const star_data_t *s,
+                                      char *out, int size)
 {
     const char *name;
     char hip_buf[128];
@@ -269,11 +631,6 @@ static bool star_get_skycultural_name(const star_t *s, char *out, int size)
     return name != NULL;
 }
 
-
-static bool name_is_bayer(const char* name) {
-    return strncmp(name, "* ", 2) == 0 || strncmp(name, "V* ", 3) == 0;
-}
-
 /*
  * Function: star_get_bayer_name
  * Return the Bayer / Flamsteed name for a given star
@@ -287,36 +644,80 @@ static bool name_is_bayer(const char* name) {
  * Return:
  *   true if a label was found, false otherwise.
  */
-static bool star_get_bayer_name(const star_t *s, char *out, int size,
+static bool star_get_bayer_name(const star_data_t *s, char *out, int size,
                                 int flags)
 {
-    const char *names = s->names;
-    if (!names)
+    if (!s->dsgns || !s->dsgns->bayer_name)
         return false;
+    designation_format(s->dsgns->bayer_name, &s->dsgns->bayer,
+                       out, size, flags);
+    return true;
+}
 
-    while (*names) {
-        if (!name_is_bayer(names))
-            names += strlen(names) + 1;
-        else
-            break;
-    }
-    if (*names) {
-        designation_cleanup(names, out, size, flags);
-        return true;
-    }
-    return false;
+// Copy a list of '\0' separated names terminated by two '\0'.
+static char *names_dup(const char *names)
+{
+    const char *end;
+    char *ret;
+    if (!names) return NULL;
+    for (end = names; *end; end += strlen(end) + 1) {}
+    ret = malloc(end - names + 1);
+    memcpy(ret, names, end - names + 1);
+    return ret;
 }
 
+/*
+ * Function: tile_get_star
+ * Return the object of a star of a tile, creating it if needed.
+ *
+ * The caller should release the returned object.
+ */
+static star_t *tile_get_star(const tile_t *tile, int index)
+{
+    star_key_t key;
+    star_t *star;
+    const star_data_t *s = &tile->sources[index];
+
+    memset(&key, 0, sizeof(key)); // Make sure the padding is zero.
+    key.survey = tile->survey;
+    key.order = tile->order;
+    key.pix = tile->pix;
+    key.index = index;
+    HASH_FIND(hh, g_stars->objs, &key, sizeof(key), star);
+    if (star) return (star_t*)obj_retain(&star->obj);
+
+    star = calloc(1, sizeof(*star));
+    star->obj.klass = &star_klass;
+    star->obj.ref = 1;
+    memcpy(star->obj.type, s->type, sizeof(star->obj.type));
+    star->data = *s;
+    star->data.names = names_dup(s->names);
+    star->data.sp_type = s->sp_type ? strdup(s->sp_type) : NULL;
+    star->data.dsgns = NULL;
+    star_parse_names(&star->data);
+    star->key = key;
+    HASH_ADD(hh, g_stars->objs, key, sizeof(star->key), star);
+    return star;
+}
 
-static void star_render_name(const painter_t *painter, const star_t *s,
+/*
+ * Render the label of a star.
+ *
+ * The label needs the star object, so for the tiles stars we pass the
+ * tile and the index of the star, and only create the object if the label
+ * is actually rendered.
+ */
+static void star_render_name(const painter_t *painter, const star_data_t *s,
+                             bool selected, const obj_t *obj,
+                             const tile_t *tile, int index,
                              int frame, const double pos[3],
                              const double win_pos[2], double radius,
                              double color[3])
 {
     double label_color[4] = {color[0], color[1], color[2], 0.8};
     static const double white[4] = {1, 1, 1, 1};
-    const bool selected = (&s->obj == core->selection);
     int effects = TEXT_FLOAT;
+    star_t *star = NULL;
     char buf[128];
     const double hints_mag_offset = g_stars->hints_mag_offset +
                                     core_get_hints_mag_offset(win_pos);
@@ -350,7 +751,8 @@ static void star_render_name(const painter_t *painter, const star_t *s,
                 // Use long version of bayer name for very bright stars
                 flags |= BAYER_LATIN_LONG | BAYER_CONST_LONG;
             }
-            designation_cleanup(first_name, buf, sizeof(buf), flags);
+            designation_format(first_name, &s->dsgns->first,
+                               buf, sizeof(buf), flags);
         } else {
             // From here we know the star is not selected and not very bright
             // just display the small form of bayer name to save space.
@@ -367,9 +769,14 @@ static void star_render_name(const painter_t *painter, const star_t *s,
     radius += LABEL_SPACING;
 
     u8_split_line(buf, sizeof(buf), buf, 16);
+    if (!obj) {
+        star = tile_get_star(tile, index);
+        obj = &star->obj;
+    }
     labels_add_3d(buf, frame, pos, true,
                  radius, FONT_SIZE_BASE, label_color, 0, 0,
-                 effects | TEXT_MULTILINES, -s->vmag, &s->obj);
+                 effects | TEXT_MULTILINES, -s->vmag, obj);
+    if (star) obj_release(&star->obj);
 }
 
 // Render a single star.
@@ -377,7 +784,7 @@ static void star_render_name(const painter_t *painter, const star_t *s,
 static int star_render(obj_t *obj, const painter_t *painter_)
 {
     // XXX: the code is almost the same as the inner loop in stars_render.
-    const star_t *star = (const star_t*)obj;
+    const star_data_t *star = &((const star_t*)obj)->data;
     double pvo[2][4], p[2], size, luminance;
     double color[3];
     painter_t painter = *painter_;
@@ -396,20 +803,43 @@ static int star_render(obj_t *obj, const painter_t *painter_)
         .size = size,
         .color = {color[0] * 255, color[1] * 255, color[2] * 255,
                   luminance * 255},
-        .obj = &star->obj,
+        .obj = obj,
     };
     paint_2d_points(&painter, 1, &point);
 
-    star_render_name(&painter, star, FRAME_ICRF, pvo[0], p, size, color);
+    star_render_name(&painter, star, obj == core->selection, obj, NULL, 0,
+                     FRAME_ICRF, pvo[0], p, size, color);
     return 0;
 }
 
+static void star_del(obj_t *obj)
+{
+    star_t *star = (star_t*)obj;
+    if (star->key.survey) HASH_DEL(g_stars->objs, star);
+    free(star->data.names);
+    free(star->data.dsgns);
+    free(star->data.sp_type);
+}
+
+// Return the object of a tile star referenced by the render points.
+static obj_t *star_tile_get_source(const obj_t *obj, const void *source)
+{
+    const tile_t *tile = (const tile_t*)obj;
+    int index = (const star_data_t*)source - tile->sources;
+    return &tile_get_star(tile, index)->obj;
+}
+
+static obj_klass_t star_tile_klass = {
+    .id         = "star_tile",
+    .get_source = star_tile_get_source,
+};
+
 
 void star_get_designations(
     const obj_t *obj, void *user,
     int (*f)(const obj_t *obj, void *user, const char *cat, const char *str))
 {
-    const star_t *star = (const star_t*)obj;
+    const star_data_t *star = &((const star_t*)obj)->data;
     const char *names = star->names;
     char buf[128];
 
@@ -429,95 +859,227 @@ static int del_tile(void *data)
     int i;
     tile_t *tile = data;
 
-    // Don't delete the tile if any contained star is used somehwere else.
-    for (i = 0; i < tile->nb; i++) {
-        if (tile->sources[i].obj.ref > 1) return CACHE_KEEP;
-    }
+    // Don't delete the tile if its sources are still referenced somewhere
+    // else (see star_tile_get_source).
+    if (tile->obj.ref > 1) return CACHE_KEEP;
 
     for (i = 0; i < tile->nb; i++) {
+        free(tile->sources[i].dsgns);
+        if (i < tile->map.nb) continue; // Strings in the mapped file.
         free(tile->sources[i].names);
         free(tile->sources[i].sp_type);
     }
     free(tile->sources);
+    if (tile->map.data)
+        hips_unmap_decoded_tile(tile->map.data, tile->map.size);
+    else
+        free(tile->hot.pos);
+    if (tile->loader) {
+        free(tile->loader->table_data);
+        free(tile->loader);
+    }
+    for (i = tile->slices_next; i < tile->slices_nb; i++)
+        free(tile->slices[i].data);
+    free(tile->slices);
+    texture_release(tile->impostor.tex);
     free(tile);
     return 0;
 }
 
-static int star_data_cmp(const void *a, const void *b)
+// Size of the hot arrays per source.
+#define HOT_SIZE (3 * sizeof(double[3]) + 2 * sizeof(float) + \
+                  sizeof(uint8_t[3]))
+
+// Set the tile hot arrays for n sources, from a single buffer starting at
+// hot.pos.
+static void tile_set_hot_buffer(tile_t *tile, void *buf, int n)
 {
-    return cmp(((const star_t*)a)->vmag, ((const star_t*)b)->vmag);
+    tile->hot.pos = buf;
+    tile->hot.speed = (void*)(tile->hot.pos + n);
+    tile->hot.astrom = (void*)(tile->hot.speed + n);
+    tile->hot.vmag = (void*)(tile->hot.astrom + n);
+    tile->hot.illuminance = tile->hot.vmag + n;
+    tile->hot.color = (void*)(tile->hot.illuminance + n);
 }
 
-static int on_file_tile_loaded(const char type[4],
-                               const void *data, int size,
-                               const json_value *json,
-                               void *user)
+// Allocate the tile hot arrays for n sources.
+static void tile_alloc_hot(tile_t *tile, int n)
 {
-    int version, nb, data_ofs = 0, row_size, flags, i, j, order, pix;
-    int children_mask;
-    double vmag, gmag, ra, de, pra, pde, plx, bv, epoch;
-    char ids[256] = {};
-    char sp_type[32] = {};
-    survey_t *survey = USER_GET(user, 0);
-    tile_t **out = USER_GET(user, 1); // Receive the tile.
-    int *transparency = USER_GET(user, 2);
-    tile_t *tile;
-    void *table_data;
-    star_t *s;
-
-    // All the columns we care about in the source file.
-    eph_table_column_t columns[] = {
-        {"type", 's', .size=4},
-        {"gaia", 'Q'},
-        {"hip",  'i'},
-        {"vmag", 'f', EPH_VMAG},
-        {"gmag", 'f', EPH_VMAG},
-        {"ra",   'f', EPH_RAD},
-        {"de",   'f', EPH_RAD},
-        {"plx",  'f', EPH_ARCSEC},
-        {"pra",  'f', EPH_RAD_PER_YEAR},
-        {"pde",  'f', EPH_RAD_PER_YEAR},
-        {"epoc", 'f', EPH_YEAR},
-        {"bv",   'f'},
-        {"ids",  's', .size=256},
-        {"spec", 's', .size=32},
-    };
+    tile_set_hot_buffer(tile, malloc(n * HOT_SIZE), n);
+}
 
-    *out = NULL;
-    // Only support STAR and GAIA chunks.  Ignore anything else.
-    if (strncmp(type, "STAR", 4) != 0 &&
-        strncmp(type, "GAIA", 4) != 0) return 0;
+// Copy the values of a source into the tile hot arrays.
+static void tile_set_hot(tile_t *tile, int i)
+{
+    const star_data_t *s = &tile->sources[i];
+    double color[3];
 
-    eph_read_tile_header(data, size, &data_ofs, &version, &order, &pix);
-    assert(version >= 3); // No more support for old style format.
-    nb = eph_read_table_header(version, data, size,
-                               &data_ofs, &row_size, &flags,
-                               ARRAY_SIZE(columns), columns);
-    if (nb < 0) {
-        LOG_E("Cannot parse file");
-        return -1;
+    vec3_copy(s->pvo[0], tile->hot.pos[i]);
+    vec3_copy(s->pvo[1], tile->hot.speed[i]);
+    tile->hot.vmag[i] = s->vmag;
+    tile->hot.illuminance[i] = s->illuminance;
+    bv_to_rgb(isnan(s->bv) ? 0 : s->bv, color);
+    tile->hot.color[i][0] = color[0] * 255;
+    tile->hot.color[i][1] = color[1] * 255;
+    tile->hot.color[i][2] = color[2] * 255;
+}
+
+// Add a string to the strings of a decoded tile, and return its offset.
+static int32_t add_string(char **strings, int *size, const char *str,
+                          int len)
+{
+    int32_t ret = *size;
+    if (!str) return -1;
+    *strings = realloc(*strings, *size + len);
+    memcpy(*strings + *size, str, len);
+    *size += len;
+    return ret;
+}
+
+/*
+ * Function: check_string
+ * Check a string offset of a decoded tile file.
+ *
+ * Parameters:
+ *   strings    - The strings of the tile.
+ *   size       - Size of the strings.
+ *   ofs        - Offset of the string, or -1 for no string.
+ *   list       - If set, the string is a list of null terminated values
+ *                that ends with an empty value, like star_data_t names.
+ *
+ * Return:
+ *   true if the string ends before the end of the strings.
+ */
+static bool check_string(const char *strings, int size, int32_t ofs,
+                         bool list)
+{
+    const char *end;
+    if (ofs == -1) return true;
+    if (ofs < 0) return false;
+    while (true) {
+        if (ofs >= size) return false;
+        end = memchr(strings + ofs, '\0', size - ofs);
+        if (!end) return false;
+        if (!list || end == strings + ofs) return true;
+        ofs = end - strings + 1;
     }
+}
 
-    table_data = eph_read_compressed_block(data, size, &data_ofs, &size);
-    if (!table_data) {
-        LOG_E("Cannot get table data");
-        return -1;
+/*
+ * Function: tile_save_decoded
+ * Save a tile into the decoded tiles cache.
+ *
+ * Only done once all the rows of the last started slice are converted, and
+ * if the tile changed since the last time we saved it.  The slices not
+ * decoded yet are saved as they are.
+ */
+static void tile_save_decoded(const survey_t *survey, tile_t *tile)
+{
+    char path[1024];
+    const star_data_t *s;
+    const char *end;
+    star_record_t *records;
+    char *strings = NULL;
+    int32_t *slices_sizes;
+    uint8_t *slices_data;
+    int i, ofs = 0;
+    decoded_tile_t header = {
+        .nb = tile->nb,
+        .nb_max = tile->nb_max,
+        .transparency = tile->transparency,
+        .slices_nb = tile->slices_nb - tile->slices_next,
+        .mag_min = tile->mag_min,
+        .mag_max = tile->mag_max,
+        .illuminance = tile->illuminance,
+    };
+
+    if (tile->loader || tile->saved_slices == tile->slices_next) return;
+    tile->saved_slices = tile->slices_next;
+    if (!survey->hips || !hips_get_decoded_path(
+                survey->hips, tile->order, tile->pix, path, sizeof(path)))
+        return;
+
+    records = calloc(tile->nb, sizeof(*records));
+    for (i = 0; i < tile->nb; i++) {
+        s = &tile->sources[i];
+        memcpy(records[i].type, s->type, 4);
+        records[i].hip = s->hip;
+        records[i].gaia = s->gaia;
+        records[i].vmag = s->vmag;
+        records[i].plx = s->plx;
+        records[i].bv = s->bv;
+        records[i].illuminance = s->illuminance;
+        memcpy(records[i].pvo, s->pvo, sizeof(s->pvo));
+        records[i].distance = s->distance;
+        for (end = s->names; end && *end; end += strlen(end) + 1) {}
+        records[i].names = add_string(&strings, &header.strings_size,
+                                      s->names, end - s->names + 1);
+        records[i].sp_type = add_string(
+                &strings, &header.strings_size, s->sp_type,
+                s->sp_type ? strlen(s->sp_type) + 1 : 0);
+    }
+    slices_sizes = calloc(header.slices_nb, sizeof(*slices_sizes));
+    for (i = 0; i < header.slices_nb; i++) {
+        slices_sizes[i] = tile->slices[tile->slices_next + i].size;
+        header.slices_size += slices_sizes[i];
+    }
+    slices_data = malloc(header.slices_size);
+    for (i = 0; i < header.slices_nb; i++) {
+        memcpy(slices_data + ofs, tile->slices[tile->slices_next + i].data,
+               slices_sizes[i]);
+        ofs += slices_sizes[i];
     }
-    data_ofs = 0;
-    if (flags & 1) eph_shuffle_bytes(table_data, row_size, nb);
 
-    tile = calloc(1, sizeof(*tile));
-    tile->sources = calloc(nb, sizeof(*tile->sources));
-    tile->mag_min = DBL_MAX;
-    tile->mag_max = -DBL_MAX;
+    hips_save_decoded_tile(path, DECODED_TILE_VERSION, 6,
+        (const void*[]){&header, records, tile->hot.pos, strings,
+                        slices_sizes, slices_data},
+        (const int[]){sizeof(header), tile->nb * sizeof(*records),
+                      tile->nb_max * HOT_SIZE, header.strings_size,
+                      header.slices_nb * sizeof(*slices_sizes),
+                      header.slices_size});
+    free(records);
+    free(strings);
+    free(slices_sizes);
+    free(slices_data);
+}
 
-    for (i = 0; i < nb; i++) {
+static int star_data_cmp(const void *a, const void *b)
+{
+    return cmp(((const star_data_t*)a)->vmag, ((const star_data_t*)b)->vmag);
+}
+
+/*
+ * Function: tile_load_rows
+ * Convert some more rows of a tile still loading.
+ *
+ * Once all the rows have been converted, the sources are sorted by vmag and
+ * the loader released.
+ *
+ * Parameters:
+ *   survey     - The tile survey.
+ *   tile       - A tile, does nothing if it is already fully loaded.
+ *   max_rows   - Maximum number of rows to convert, or -1 for all.
+ *
+ * Return:
+ *   The number of rows converted.
+ */
+static int tile_load_rows(const survey_t *survey, tile_t *tile, int max_rows)
+{
+    int i, j, nb = 0;
+    double vmag, gmag, ra, de, pra, pde, plx, bv, epoch;
+    char ids[256] = {};
+    char sp_type[32] = {};
+    tile_loader_t *loader = tile->loader;
+    star_data_t *s;
+
+    if (!loader) return 0;
+    for (; loader->row < loader->nb_rows && nb != max_rows;
+         loader->row++, nb++) {
         s = &tile->sources[tile->nb];
-        s->obj.ref = 1;
-        s->obj.klass = &star_klass;
         eph_read_table_row(
-                table_data, size, &data_ofs, ARRAY_SIZE(columns), columns,
-                s->obj.type, &s->gaia, &s->hip, &vmag, &gmag,
+                loader->table_data, loader->table_size, &loader->data_ofs,
+                ARRAY_SIZE(loader->columns), loader->columns,
+                s->type, &s->gaia, &s->hip, &vmag, &gmag,
                 &ra, &de, &plx, &pra, &pde, &epoch, &bv, ids, sp_type);
         assert(!isnan(ra));
         assert(!isnan(de));
@@ -528,10 +1090,13 @@ static int on_file_tile_loaded(const char type[4],
         // current data has some wrong values.
         if (!isnan(plx) && (plx < 2.0 / 1000)) plx = 0.0;
 
-        // Avoid overlapping stars from Gaia survey.
-        if (survey->is_gaia && vmag < survey->min_vmag) continue;
+        // Skip the stars already provided by the brighter surveys.
+        if (vmag < survey->band_min) continue;
+        if (s->hip && survey->band_min > survey->min_vmag &&
+                vmag < survey->band_min + CROSS_MATCH_MAG)
+            continue;
 
-        if (!*s->obj.type) strncpy(s->obj.type, "*", 4); // Default type.
+        if (!*s->type) strncpy(s->type, "*", 4); // Default type.
         epoch = epoch ?: 2000; // Default epoch.
         s->vmag = vmag;
         s->plx = plx;
@@ -554,6 +1119,7 @@ static int on_file_tile_loaded(const char type[4],
             s->names = calloc(1, 16);
             snprintf(s->names, 15, "HIP %d", s->hip);
         }
+        star_parse_names(s);
 
         compute_pv(ra, de, pra, pde, plx, epoch, s);
         s->illuminance = core_mag_to_illuminance(vmag);
@@ -561,12 +1127,116 @@ static int on_file_tile_loaded(const char type[4],
         tile->illuminance += s->illuminance;
         tile->mag_min = fmin(tile->mag_min, vmag);
         tile->mag_max = fmax(tile->mag_max, vmag);
+        tile_set_hot(tile, tile->nb);
         tile->nb++;
     }
+    if (loader->row < loader->nb_rows) return nb;
 
     // Sort the data by vmag, so that we can early exit during render.
-    qsort(tile->sources, tile->nb, sizeof(*tile->sources), star_data_cmp);
-    free(table_data);
+    // Since the slices are fainter than the previous ones, we only need to
+    // sort the new sources.
+    qsort(tile->sources + loader->start, tile->nb - loader->start,
+          sizeof(*tile->sources), star_data_cmp);
+    for (i = loader->start; i < tile->nb; i++) tile_set_hot(tile, i);
+    free(loader->table_data);
+    free(loader);
+    tile->loader = NULL;
+    tile_save_decoded(survey, tile);
+    return nb;
+}
+
+/*
+ * Function: tile_start_slice
+ * Start to convert the next magnitude slice of a tile
+ *
+ * Return:
+ *   0 on success, -1 if the slice data could not be parsed.
+ */
+static int tile_start_slice(tile_t *tile)
+{
+    int version, nb, data_ofs = 0, row_size, flags, order, pix;
+    tile_slice_t *slice;
+    tile_loader_t *loader;
+
+    assert(!tile->loader);
+    assert(tile->slices_next < tile->slices_nb);
+    slice = &tile->slices[tile->slices_next++];
+    loader = calloc(1, sizeof(*loader));
+    memcpy(loader->columns, COLUMNS, sizeof(COLUMNS));
+    eph_read_tile_header(slice->data, slice->size, &data_ofs, &version,
+                         &order, &pix);
+    assert(version >= 3); // No more support for old style format.
+    nb = eph_read_table_header(version, slice->data, slice->size,
+                               &data_ofs, &row_size, &flags,
+                               ARRAY_SIZE(loader->columns), loader->columns);
+    if (nb < 0) {
+        LOG_E("Cannot parse file");
+        goto error;
+    }
+    loader->table_data = eph_read_compressed_block(
+            slice->data, slice->size, &data_ofs, &loader->table_size);
+    if (!loader->table_data) {
+        LOG_E("Cannot get table data");
+        goto error;
+    }
+    if (flags & 1) eph_shuffle_bytes(loader->table_data, row_size, nb);
+    loader->nb_rows = nb;
+    loader->start = tile->nb;
+    tile->loader = loader;
+    free(slice->data);
+    return 0;
+
+error:
+    free(loader);
+    free(slice->data);
+    return -1;
+}
+
+// Return the number of rows of a slice, or -1 in case of error.
+static int slice_get_nb_rows(const tile_slice_t *slice)
+{
+    int version, data_ofs = 0, row_size, flags, order, pix;
+    eph_table_column_t columns[ARRAY_SIZE(COLUMNS)];
+
+    memcpy(columns, COLUMNS, sizeof(COLUMNS));
+    eph_read_tile_header(slice->data, slice->size, &data_ofs, &version,
+                         &order, &pix);
+    if (version < 3) return -1;
+    return eph_read_table_header(version, slice->data, slice->size,
+                                 &data_ofs, &row_size, &flags,
+                                 ARRAY_SIZE(columns), columns);
+}
+
+// Convert all the remaining rows and slices of a tile.
+static void tile_load_all(const survey_t *survey, tile_t *tile)
+{
+    while (true) {
+        tile_load_rows(survey, tile, -1);
+        if (tile->slices_next == tile->slices_nb) break;
+        tile_start_slice(tile);
+    }
+}
+
+static int on_file_tile_loaded(const char type[4],
+                               const void *data, int size,
+                               const json_value *json,
+                               void *user)
+{
+    int children_mask;
+    tile_slice_t **slices = USER_GET(user, 0);
+    int *nb = USER_GET(user, 1);
+    int *transparency = USER_GET(user, 2);
+
+    // Only support STAR and GAIA chunks.  Ignore anything else.
+    if (strncmp(type, "STAR", 4) != 0 &&
+        strncmp(type, "GAIA", 4) != 0) return 0;
+
+    // Keep a copy of the chunk, the data is only decoded when needed.
+    *slices = realloc(*slices, (*nb + 1) * sizeof(**slices));
+    (*slices)[*nb].data = malloc(size);
+    (*slices)[*nb].size = size;
+    memcpy((*slices)[*nb].data, data, size);
+    (*nb)++;
 
     // If we have a json header, check for a children mask value.
     if (json) {
@@ -575,8 +1245,6 @@ static int on_file_tile_loaded(const char type[4],
             *transparency = (~children_mask) & 15;
         }
     }
-
-    *out = tile;
     return 0;
 }
 
@@ -584,12 +1252,176 @@ static void *stars_create_tile(
         void *user, int order, int pix, const void *data, int size,
         int *cost, int *transparency)
 {
-    tile_t *tile = NULL;
+    tile_t *tile;
     survey_t *survey = user;
-    eph_load(data, size, USER_PASS(survey, &tile, transparency),
+    tile_slice_t *slices = NULL;
+    int i, n, nb = 0, slices_nb = 0;
+
+    eph_load(data, size, USER_PASS(&slices, &slices_nb, transparency),
              on_file_tile_loaded);
-    if (tile) *cost = tile->nb * sizeof(*tile->sources);
+    if (!slices_nb) return NULL;
+    for (i = 0; i < slices_nb; i++) {
+        n = slice_get_nb_rows(&slices[i]);
+        if (n < 0) {
+            LOG_E("Cannot parse file");
+            goto error;
+        }
+        nb += n;
+    }
+
+    tile = calloc(1, sizeof(*tile));
+    tile->obj.klass = &star_tile_klass;
+    tile->obj.ref = 1;
+    tile->survey = survey;
+    tile->order = order;
+    tile->pix = pix;
+    tile->nb_max = nb;
+    tile->sources = calloc(nb, sizeof(*tile->sources));
+    tile->transparency = *transparency;
+    tile->mag_min = DBL_MAX;
+    tile->mag_max = -DBL_MAX;
+    tile->slices = slices;
+    tile->slices_nb = slices_nb;
+    tile_alloc_hot(tile, nb);
+    if (tile_start_slice(tile)) {
+        del_tile(tile);
+        return NULL;
+    }
+
+    // With threads we are already running in the worker pool, so we can
+    // convert all the rows now.  Otherwise we only convert the first ones
+    // (usually the brightest) and let the render loop do the rest.
+#ifdef HAVE_PTHREAD
+    tile_load_rows(survey, tile, -1);
+#else
+    tile_load_rows(survey, tile, TILE_FIRST_ROWS);
+#endif
+
+    // Count the rows of all the slices, since we allocate for all of them.
+    *cost = nb * (sizeof(*tile->sources) +
+                  3 * sizeof(double[3]) + 3 * sizeof(float));
+    return tile;
+
+error:
+    for (i = 0; i < slices_nb; i++) free(slices[i].data);
+    free(slices);
+    return NULL;
+}
+
+/*
+ * Function: stars_load_decoded_tile
+ * Create a tile from a file of the decoded tiles cache.
+ *
+ * The hot arrays and the strings stay in the mapped file, we only need to
+ * rebuild the star_data_t structures of the sources.
+ */
+static void *stars_load_decoded_tile(
+        void *user, int order, int pix, const char *path,
+        int *cost, int *transparency)
+{
+    tile_t *tile;
+    survey_t *survey = user;
+    uint8_t *data;
+    const decoded_tile_t *header;
+    const star_record_t *records, *r;
+    char *strings;
+    const int32_t *slices_sizes;
+    const uint8_t *slices_data;
+    star_data_t *s;
+    int i, size, ofs, slices_size = 0;
+    void *hot;
+
+    data = hips_map_decoded_tile(path, DECODED_TILE_VERSION, &size);
+    if (!data) return NULL;
+    header = (void*)data;
+    ofs = ALIGN8(sizeof(*header));
+    if (    size < ofs || header->nb < 0 || header->nb > header->nb_max ||
+            header->strings_size < 0 || header->slices_nb < 0 ||
+            header->slices_size < 0 ||
+            size != ofs + ALIGN8(header->nb * sizeof(*records)) +
+                    ALIGN8(header->nb_max * HOT_SIZE) +
+                    ALIGN8(header->strings_size) +
+                    ALIGN8(header->slices_nb * sizeof(*slices_sizes)) +
+                    ALIGN8(header->slices_size))
+        goto error;
+    records = (void*)(data + ofs);
+    ofs += ALIGN8(header->nb * sizeof(*records));
+    hot = data + ofs;
+    ofs += ALIGN8(header->nb_max * HOT_SIZE);
+    strings = (void*)(data + ofs);
+    ofs += ALIGN8(header->strings_size);
+    slices_sizes = (void*)(data + ofs);
+    ofs += ALIGN8(header->slices_nb * sizeof(*slices_sizes));
+    slices_data = data + ofs;
+
+    // Make sure a corrupted file cannot make us read out of the mapping.
+    for (i = 0; i < header->nb; i++) {
+        r = &records[i];
+        if (    !check_string(strings, header->strings_size, r->names, true) ||
+                !check_string(strings, header->strings_size, r->sp_type,
+                              false))
+            goto error;
+    }
+    for (i = 0; i < header->slices_nb; i++) {
+        if (slices_sizes[i] < 0) goto error;
+        slices_size += slices_sizes[i];
+    }
+    if (slices_size != header->slices_size) goto error;
+
+    tile = calloc(1, sizeof(*tile));
+    tile->obj.klass = &star_tile_klass;
+    tile->obj.ref = 1;
+    tile->survey = survey;
+    tile->order = order;
+    tile->pix = pix;
+    tile->nb = header->nb;
+    tile->nb_max = header->nb_max;
+    tile->transparency = header->transparency;
+    tile->mag_min = header->mag_min;
+    tile->mag_max = header->mag_max;
+    tile->illuminance = header->illuminance;
+    tile->map.data = data;
+    tile->map.size = size;
+    tile->map.nb = header->nb;
+    tile_set_hot_buffer(tile, hot, header->nb_max);
+
+    tile->sources = calloc(tile->nb_max, sizeof(*tile->sources));
+    for (i = 0; i < tile->nb; i++) {
+        s = &tile->sources[i];
+        r = &records[i];
+        memcpy(s->type, r->type, 4);
+        s->hip = r->hip;
+        s->gaia = r->gaia;
+        s->vmag = r->vmag;
+        s->plx = r->plx;
+        s->bv = r->bv;
+        s->illuminance = r->illuminance;
+        memcpy(s->pvo, r->pvo, sizeof(s->pvo));
+        s->distance = r->distance;
+        if (r->names >= 0) s->names = strings + r->names;
+        if (r->sp_type >= 0) s->sp_type = strings + r->sp_type;
+        star_parse_names(s);
+    }
+
+    // The slices data is released once decoded, so we need a copy.
+    tile->slices_nb = header->slices_nb;
+    tile->slices = calloc(tile->slices_nb, sizeof(*tile->slices));
+    for (i = 0, ofs = 0; i < tile->slices_nb; i++) {
+        tile->slices[i].size = slices_sizes[i];
+        tile->slices[i].data = malloc(slices_sizes[i]);
+        memcpy(tile->slices[i].data, slices_data + ofs, slices_sizes[i]);
+        ofs += slices_sizes[i];
+    }
+
+    *transparency = tile->transparency;
+    *cost = tile->nb_max * (sizeof(*tile->sources) +
+                            3 * sizeof(double[3]) + 3 * sizeof(float));
     return tile;
+
+error:
+    LOG_W("Invalid decoded tile %s", path);
+    hips_unmap_decoded_tile(data, size);
+    return NULL;
 }
 
 static int stars_init(obj_t *obj, json_value *args)
@@ -614,10 +1446,33 @@ static survey_t *get_survey(const stars_t *stars, const char *key)
     return NULL;
 }
 
+/*
+ * Function: get_tile_
+ * Load and return a tile, that might still be converting its rows.
+ *
+ * Only the render loop should use this, see <get_tile>.
+ */
+static tile_t *get_tile_(survey_t *survey, int order, int pix,
+                         bool sync, int *code)
+{
+    int flags = 0;
+    assert(code);
+    assert(survey);
+    if (!sync) flags |= HIPS_LOAD_IN_THREAD;
+    if (!survey->hips) {
+        *code = 0;
+        return NULL;
+    }
+    return hips_get_tile(survey->hips, order, pix, flags, code);
+}
+
 /*
  * Function: get_tile
  * Load and return a tile.
  *
+ * If the tile rows or magnitude slices are still being converted, finish
+ * the conversion right away.
+ *
  * Parameters:
  *   survey - The survey.
  *   order  - Healpix order.
@@ -629,89 +1484,270 @@ static survey_t *get_survey(const stars_t *stars, const char *key)
 static tile_t *get_tile(survey_t *survey, int order, int pix,
                         bool sync, int *code)
 {
-    int flags = 0;
     tile_t *tile;
-    assert(code);
-    assert(survey);
-    if (!sync) flags |= HIPS_LOAD_IN_THREAD;
-    if (!survey->hips) {
-        *code = 0;
-        return NULL;
-    }
-    tile = hips_get_tile(survey->hips, order, pix, flags, code);
+    tile = get_tile_(survey, order, pix, sync, code);
+    if (tile) tile_load_all(survey, tile);
     return tile;
 }
 
+/*
+ * Build the impostor of a tile: a low resolution texture of the integrated
+ * light of all its faint stars, with the healpix sub pixels of the tile as
+ * texels, along with the distribution of their illuminance per magnitude.
+ *
+ * Only done for the fully loaded tiles with enough stars, and built again
+ * when more magnitude slices get decoded.
+ */
+static void tile_update_impostor(tile_t *tile)
+{
+    const int n = IMPOSTOR_SIZE;
+    const int nside = (1 << tile->order) * n;
+    int i, b, ix, iy, face, x0, y0, face0;
+    float (*acc)[4]; // Illuminance weighted rgb, and illuminance.
+    uint8_t (*data)[3];
+    double lux, max = 0;
+    const uint8_t *rgb;
+
+    if (tile->loader || tile->impostor.nb == tile->nb) return;
+    texture_release(tile->impostor.tex);
+    memset(&tile->impostor, 0, sizeof(tile->impostor));
+    tile->impostor.nb = tile->nb;
+    if (tile->nb < IMPOSTOR_KEEP + IMPOSTOR_MIN_STARS) return;
+
+    tile->impostor.start = IMPOSTOR_KEEP;
+    tile->impostor.mag = tile->hot.vmag[IMPOSTOR_KEEP];
+    healpix_nest2xyf(1 << tile->order, tile->pix, &x0, &y0, &face0);
+    acc = calloc(n * n, sizeof(*acc));
+    for (i = IMPOSTOR_KEEP; i < tile->nb; i++) {
+        lux = tile->hot.illuminance[i];
+        b = (tile->hot.vmag[i] - tile->impostor.mag) / IMPOSTOR_BIN_MAG;
+        tile->impostor.bins[(int)fmin(b, IMPOSTOR_BINS - 1)] += lux;
+        tile->impostor.illuminance += lux;
+        healpix_nest2xyf(nside, healpix_vec2pix(nside, tile->hot.pos[i]),
+                         &ix, &iy, &face);
+        // The proper motions can move a few stars out of the tile.
+        if (face != face0) continue;
+        ix = clamp(ix - x0 * n, 0, n - 1);
+        iy = clamp(iy - y0 * n, 0, n - 1);
+        rgb = tile->hot.color[i];
+        acc[iy * n + ix][0] += lux * rgb[0] / 255.0;
+        acc[iy * n + ix][1] += lux * rgb[1] / 255.0;
+        acc[iy * n + ix][2] += lux * rgb[2] / 255.0;
+        acc[iy * n + ix][3] += lux;
+    }
+    for (i = 0; i < n * n; i++) max = fmax(max, acc[i][3]);
+    if (max > 0) {
+        data = calloc(n * n, sizeof(*data));
+        for (i = 0; i < n * n; i++) {
+            data[i][0] = round(acc[i][0] / max * 255);
+            data[i][1] = round(acc[i][1] / max * 255);
+            data[i][2] = round(acc[i][2] / max * 255);
+        }
+        tile->impostor.tex = texture_from_data(data, n, n, 3, 0, 0, n, n, 0);
+        tile->impostor.scale = max;
+        free(data);
+    }
+    free(acc);
+}
+
+/*
+ * Render the impostor of a tile instead of its faint stars, if those are
+ * not resolved anyway: the brightest of them would only be faint sub pixel
+ * points.  The texture is scaled so that each texel gets the same amount
+ * of light the points it replaces would have, using the magnitude
+ * distribution of the stars, and ignoring the ones fainter than the
+ * limiting magnitude.
+ *
+ * Return the number of stars still to render as points, or -1 if we
+ * didn't render the impostor.
+ */
+static int tile_render_impostor(tile_t *tile, const painter_t *painter_,
+                                double limit_mag, int selected_index,
+                                double *illuminance)
+{
+    painter_t painter = *painter_;
+    uv_map_t map;
+    double r, lum, mag, light = 0, lux = 0, k, area;
+    int b;
+
+    tile_update_impostor(tile);
+    if (!tile->impostor.tex || limit_mag < tile->impostor.mag) return -1;
+    if (selected_index >= tile->impostor.start) return -1;
+    core_get_point_for_mag(tile->impostor.mag, &r, &lum);
+    if (lum > IMPOSTOR_MAX_LUM) return -1;
+
+    // Light of the points we replace, as their luminance times their area
+    // on screen, per lux of the tile.
+    for (b = 0; b < IMPOSTOR_BINS; b++) {
+        mag = tile->impostor.mag + (b + 0.5) * IMPOSTOR_BIN_MAG;
+        if (mag > limit_mag) break;
+        if (!core_get_point_for_mag(mag, &r, &lum)) continue;
+        light += tile->impostor.bins[b] * lum * M_PI * r * r /
+                 core_mag_to_illuminance(mag);
+        lux += tile->impostor.bins[b];
+    }
+    if (light == 0) return tile->impostor.start;
+    (*illuminance) += lux;
+
+    // Area of a texel on screen, in window pixels.
+    k = core_get_point_for_apparent_angle(painter.proj, 1.0);
+    area = 4 * M_PI / (12 << (2 * tile->order)) /
+           (IMPOSTOR_SIZE * IMPOSTOR_SIZE) * k * k;
+    k = light / tile->impostor.illuminance * tile->impostor.scale / area;
+    vec3_mul(k, painter.color, painter.color);
+    painter.flags |= PAINTER_ADD | PAINTER_ALLOW_REORDER;
+    painter_set_texture(&painter, PAINTER_TEX_COLOR, tile->impostor.tex,
+                        NULL);
+    uv_map_init_healpix(&map, tile->order, tile->pix, false, true);
+    paint_quad(&painter, FRAME_ICRF, &map,
+               IMPOSTOR_SIZE >> (int)fmin(tile->order, IMPOSTOR_ORDER));
+    return tile->impostor.start;
+}
+
 static int render_visitor(stars_t *stars, survey_t *survey,
                           int order, int pix,
                           const painter_t *painter_,
                           int *nb_tot, int *nb_loaded,
-                          double *illuminance)
+                          double *illuminance, int *load_budget)
 {
     painter_t painter = *painter_;
     tile_t *tile;
-    int i, n = 0, code;
-    star_t *s;
-    double p_win[4], size = 0, luminance = 0, vmag = -DBL_MAX;
+    int i, n = 0, n3d = 0, nb, code, selected_index = -1, nb_points;
+    size_t mark;
+    const star_data_t *s;
+    const star_t *sel;
+    double p_win[2], size = 0, luminance = 0, vmag = -DBL_MAX;
     double color[3];
-    double v[3];
+    const uint8_t *rgb;
+    const double (*astrom)[3];
+    double (*view)[3];
+    bool *visible;
+    point_t *points;
+    point_3d_t *points_3d;
     double limit_mag = fmin(painter.stars_limit_mag, painter.hard_limit_mag);
-    bool selected;
+    bool selected, selectable, show_name;
+    hips_stats_t *stats = hips_frame_stats(survey->hips);
 
-    // Early exit if the tile is clipped.
-    if (painter_is_healpix_clipped(&painter, FRAME_ASTROM, order, pix))
-        return 0;
     if (order < survey->min_order) return 1;
 
     (*nb_tot)++;
-    tile = get_tile(survey, order, pix, false, &code);
+    tile = get_tile_(survey, order, pix, false, &code);
     if (code) (*nb_loaded)++;
+    else stats->missing++;
 
     if (!tile) goto end;
+    if (tile->loader && *load_budget > 0)
+        *load_budget -= tile_load_rows(survey, tile, *load_budget);
+    // Decode the next magnitude slice once all the decoded stars are
+    // bright enough to be rendered.
+    if (!tile->loader && tile->slices_next < tile->slices_nb &&
+            tile->mag_max <= limit_mag && *load_budget > 0) {
+        if (tile_start_slice(tile) == 0)
+            *load_budget -= tile_load_rows(survey, tile, *load_budget);
+    }
     if (tile->mag_min > limit_mag) goto end;
+    stats->rendered++;
 
-    point_t *points = malloc(tile->nb * sizeof(*points));
-    for (i = 0; i < tile->nb; i++) {
-        s = &tile->sources[i];
-        if (s->vmag > limit_mag) break;
+    // Number of stars bright enough to be rendered.  If the tile is still
+    // loading the sources are not sorted, so we filter them in the loop.
+    nb = tile->loader ? tile->nb : tile_count_brighter(tile, limit_mag);
 
-        star_get_astrom(s, painter.obs, v);
-        if (!painter_project(&painter, FRAME_ASTROM, v, true, true, p_win))
-            continue;
+    if (core->selection && core->selection->klass == &star_klass) {
+        sel = (const star_t*)core->selection;
+        if (sel->key.survey == survey && sel->key.order == order &&
+                sel->key.pix == pix)
+            selected_index = sel->key.index;
+    }
+
+    // Only the brightest stars if we rendered the others as an impostor.
+    if (stars->impostors && !tile->loader) {
+        nb_points = tile_render_impostor(tile, &painter, limit_mag,
+                                         selected_index, illuminance);
+        if (nb_points >= 0) nb = fmin(nb, nb_points);
+    }
 
-        (*illuminance) += s->illuminance;
+    mark = frame_alloc_mark();
+    points = frame_alloc(nb * sizeof(*points));
+    points_3d = frame_alloc(nb * sizeof(*points_3d));
+    view = frame_alloc(nb * sizeof(*view));
+    visible = frame_alloc(nb * sizeof(*visible));
+    tile_update_astrom(tile, nb, painter.obs);
+    astrom = (const double (*)[3])tile->hot.astrom;
+    painter_to_view_batch(&painter, FRAME_ASTROM, nb, astrom, true, true,
+                          view, visible);
+
+    // Points are additive, so we can let the renderer batch all the tiles
+    // together.
+    painter.flags |= PAINTER_ALLOW_REORDER;
+
+    for (i = 0; i < nb; i++) {
+        if (!visible[i]) continue;
+        if (tile->loader && tile->hot.vmag[i] > limit_mag) continue;
+        // Tiles loaded before we added a brighter survey.
+        if (tile->hot.vmag[i] < survey->band_min) continue;
 
         // No need to recompute the point size and luminance if the last
         // star had the same vmag (often the case since we sort by vmag).
-        if (s->vmag != vmag) {
-            vmag = s->vmag;
+        if (tile->hot.vmag[i] != vmag) {
+            vmag = tile->hot.vmag[i];
             core_get_point_for_mag(vmag, &size, &luminance);
         }
+
+        // Only the stars that can be selected or get a label need their
+        // screen position, for all the others we let the GPU do the
+        // projection.
+        s = &tile->sources[i];
+        selected = (i == selected_index);
+        // This makes very faint stars not selectable
+        selectable = luminance > 0.5 && size > 1;
+        show_name = selected || (stars->hints_visible && !survey->is_gaia);
+        // The sources of a loading tile will move when we sort them.
+        if (tile->loader && i >= tile->loader->start)
+            selectable = show_name = false;
+        if ((selectable || show_name) &&
+            !painter_project(&painter, FRAME_VIEW, view[i], true, false,
+                             p_win))
+            continue;
+
+        (*illuminance) += tile->hot.illuminance[i];
         if (size == 0.0 || luminance == 0.0)
             continue;
 
-        bv_to_rgb(isnan(s->bv) ? 0 : s->bv, color);
+        rgb = tile->hot.color[i];
+        if (!selectable && !show_name) {
+            points_3d[n3d++] = (point_3d_t) {
+                .pos = {view[i][0], view[i][1], view[i][2]},
+                .size = size,
+                .color = {rgb[0], rgb[1], rgb[2], luminance * 255},
+            };
+            continue;
+        }
         points[n] = (point_t) {
             .pos = {p_win[0], p_win[1]},
             .size = size,
-            .color = {color[0] * 255, color[1] * 255, color[2] * 255,
-                      luminance * 255},
-            // This makes very faint stars not selectable
-            .obj = (luminance > 0.5 && size > 1) ? &s->obj : NULL,
+            .color = {rgb[0], rgb[1], rgb[2], luminance * 255},
+            .obj = selectable ? &tile->obj : NULL,
+            .source = selectable ? s : NULL,
         };
         n++;
-        selected = (&s->obj == core->selection);
-        if (selected || (stars->hints_visible && !survey->is_gaia))
-            star_render_name(&painter, s, FRAME_ASTROM, v, p_win, size, color);
+        if (show_name) {
+            vec3_set(color, rgb[0] / 255.0, rgb[1] / 255.0, rgb[2] / 255.0);
+            star_render_name(&painter, s, selected, NULL, tile, i,
+                             FRAME_ASTROM, astrom[i], p_win, size, color);
+        }
     }
     if (n > 0) {
         paint_2d_points(&painter, n, points);
     }
-    free(points);
+    if (n3d > 0) {
+        paint_3d_points(&painter, n3d, points_3d);
+    }
+    frame_alloc_rewind(mark);
 
 end:
     // Test if we should go into higher order tiles.
-    if (!tile || (tile->mag_max > limit_mag))
+    if (!tile || tile->loader || tile->slices_next < tile->slices_nb ||
+        (tile->mag_max > limit_mag))
         return 0;
     return 1;
 }
@@ -720,25 +1756,50 @@ end:
 static int stars_render(obj_t *obj, const painter_t *painter_)
 {
     stars_t *stars = (stars_t*)obj;
-    int nb_tot = 0, nb_loaded = 0, order, pix, r;
+    int nb_tot = 0, nb_loaded = 0, order, pix, i;
+    int load_budget = LOAD_ROWS_PER_FRAME;
     double illuminance = 0; // Totall illuminance
     painter_t painter = *painter_;
     survey_t *survey;
     hips_iterator_t iter;
+    uint32_t skip, children_skip, all = 0, bit;
+    bool clipped;
 
     if (!stars->visible) return 0;
 
+    // Don't even traverse the surveys whose band starts after the max
+    // visible vmag.
+    i = 0;
     DL_FOREACH(stars->surveys, survey) {
-        // Don't even traverse if the min vmag of the survey is higher than
-        // the max visible vmag.
-        if (survey->min_vmag > painter.stars_limit_mag)
-            continue;
-        hips_iter_init(&iter);
-        while (hips_iter_next(&iter, &order, &pix)) {
-            r = render_visitor(stars, survey, order, pix, &painter,
-                               &nb_tot, &nb_loaded, &illuminance);
-            if (r == 1) hips_iter_push_children(&iter, order, pix);
+        if (i == 32) break;
+        if (survey->band_min <= painter.stars_limit_mag) all |= 1U << i;
+        i++;
+    }
+
+    // Single traversal for all the surveys, with for each tile the mask
+    // of the surveys we don't need to go into anymore.
+    hips_iter_init(&iter);
+    while (all && hips_iter_next2(&iter, &order, &pix, &skip)) {
+        children_skip = skip | ~all;
+        clipped = painter_is_healpix_clipped(&painter, FRAME_ASTROM,
+                                             order, pix);
+        i = 0;
+        DL_FOREACH(stars->surveys, survey) {
+            if (i == 32) break;
+            bit = 1U << i++;
+            if ((skip & bit) || !(all & bit)) continue;
+            hips_frame_stats(survey->hips)->visited++;
+            if (clipped) {
+                hips_frame_stats(survey->hips)->clipped++;
+                continue;
+            }
+            if (render_visitor(stars, survey, order, pix, &painter,
+                               &nb_tot, &nb_loaded, &illuminance,
+                               &load_budget) != 1)
+                children_skip |= bit;
         }
+        if (!clipped && (~children_skip & all))
+            hips_iter_push_children2(&iter, order, pix, children_skip);
     }
 
     /* Get the global stars luminance */
@@ -754,6 +1815,16 @@ static int stars_render(obj_t *obj, const painter_t *painter_)
     return 0;
 }
 
+// Pass the object of a tile star to a listing callback.
+static int list_star(const tile_t *tile, int index, void *user,
+                     int (*f)(void *user, obj_t *obj))
+{
+    star_t *star = tile_get_star(tile, index);
+    int r = f(user, &star->obj);
+    obj_release(&star->obj);
+    return r;
+}
+
 static int stars_list(const obj_t *obj,
                       double max_mag, uint64_t hint, const char *source,
                       void *user, int (*f)(void *user, obj_t *obj))
@@ -784,7 +1855,7 @@ static int stars_list(const obj_t *obj,
             if (!tile || tile->mag_min >= max_mag) continue;
             for (i = 0; i < tile->nb; i++) {
                 if (tile->sources[i].vmag > max_mag) continue;
-                r = f(user, &tile->sources[i].obj);
+                r = list_star(tile, i, user, f);
                 if (r) break;
             }
             if (i < tile->nb) break;
@@ -801,12 +1872,48 @@ static int stars_list(const obj_t *obj,
         return -1;
     }
     for (i = 0; i < tile->nb; i++) {
-        r = f(user, &tile->sources[i].obj);
+        r = list_star(tile, i, user, f);
         if (r) break;
     }
     return 0;
 }
 
+/*
+ * Same as stars_list, but only walk the tiles that intersect a region.
+ */
+static int stars_list_in_region(const obj_t *obj, const observer_t *obs,
+                             const sky_region_t *region, double max_mag,
+                             const char *source, void *user,
+                             int (*f)(void *user, obj_t *obj))
+{
+    int order, pix, i, code, ret = 0;
+    const stars_t *stars = (const stars_t*)obj;
+    tile_t *tile;
+    hips_iterator_t iter;
+    survey_t *survey = NULL;
+    double cap[4];
+
+    if (isnan(max_mag)) max_mag = DBL_MAX;
+    if (source) survey = get_survey(stars, source);
+    if (!survey) survey = stars->surveys;
+    if (!survey) return 0;
+
+    hips_iter_init(&iter);
+    while (hips_iter_next(&iter, &order, &pix)) {
+        healpix_get_bounding_cap(1 << order, pix, cap);
+        if (!sky_region_intersects_cap(region, cap)) continue;
+        tile = get_tile(survey, order, pix, false, &code);
+        if (!tile && !code) ret = MODULE_AGAIN;
+        if (!tile || tile->mag_min >= max_mag) continue;
+        for (i = 0; i < tile->nb; i++) {
+            if (tile->sources[i].vmag > max_mag) continue;
+            if (list_star(tile, i, user, f)) return 0;
+        }
+        hips_iter_push_children(&iter, order, pix);
+    }
+    return ret;
+}
+
 static int hips_property_handler(void* user, const char* section,
                                  const char* name, const char* value)
 {
@@ -820,7 +1927,10 @@ static json_value *hips_load_properties(const char *url, int *code)
     char path[1024];
     const char *data;
     json_value *ret;
-    snprintf(path, sizeof(path), "%s/properties", url);
+    int len = strlen(url);
+    // Same url as the one the hips requests, so that we share the data.
+    while (len > 1 && url[len - 1] == '/') len--;
+    snprintf(path, sizeof(path), "%.*s/properties", len, url);
     data = asset_get_data(path, NULL, code);
     if (!data) return NULL;
     ret = json_object_new(0);
@@ -853,18 +1963,38 @@ static double properties_get_f(const json_value *props, const char *key,
     return atof(str);
 }
 
+/*
+ * Split the magnitude range between the surveys, so that each star only
+ * comes from one of them: the surveys are sorted by max_vmag, and each one
+ * only provides the stars fainter than the coverage of all the brighter
+ * ones.  The stars of a tile outside of its survey band are skipped when
+ * we decode it, and the traversal never goes into the tiles of a survey
+ * whose band starts after the limiting magnitude.
+ */
+static void surveys_update_bands(stars_t *stars)
+{
+    survey_t *survey;
+    double max = -DBL_MAX;
+
+    DL_FOREACH(stars->surveys, survey) {
+        survey->band_min = fmax(survey->min_vmag, max);
+        if (!isnan(survey->max_vmag)) max = fmax(max, survey->max_vmag);
+    }
+}
+
 static int stars_add_data_source(obj_t *obj, const char *url, const char *key)
 {
     stars_t *stars = (stars_t*)obj;
     json_value *args;
-    const char *args_type, *release_date_str;
+    const char *args_type;
     hips_settings_t survey_settings = {
         .create_tile = stars_create_tile,
         .delete_tile = del_tile,
+        .cache = "stars",
+        .load_decoded_tile = stars_load_decoded_tile,
     };
     int i, code;
-    double release_date = 0;
-    survey_t *survey, *gaia;
+    survey_t *survey;
 
     // We can't add the source until the properties file has been parsed.
     args = hips_load_properties(url, &code);
@@ -884,16 +2014,16 @@ static int stars_add_data_source(obj_t *obj, const char *url, const char *key)
         survey->is_gaia = true;
     }
 
-    release_date_str = json_get_attr_s(args, "hips_release_date");
-    if (release_date_str)
-        release_date = hips_parse_date(release_date_str);
-
     survey_settings.user = survey;
     snprintf(survey->url, sizeof(survey->url), "%s", url);
-    survey->hips = hips_create(survey->url, release_date, &survey_settings);
+    // Don't pass the release date: the hips gets it from the same already
+    // loaded properties file, instead of requesting it again with a
+    // version argument.
+    survey->hips = hips_create(survey->url, 0, &survey_settings);
     survey->min_order = properties_get_f(args, "hips_order_min", 0);
     survey->max_vmag = properties_get_f(args, "max_vmag", NAN);
     survey->min_vmag = properties_get_f(args, "min_vmag", -2.0);
+    survey->band_min = survey->min_vmag;
 
     // Preload the first level of the survey (only for bright stars).
     if (survey->min_order == 0 && survey->min_vmag <= 0.0) {
@@ -905,28 +2035,53 @@ static int stars_add_data_source(obj_t *obj, const char *url, const char *key)
     DL_APPEND(stars->surveys, survey);
     DL_SORT(stars->surveys, survey_cmp);
     if (survey->is_gaia) assert(survey == stars->surveys->prev);
-
-    // Tell online gaia survey to only start after the vmag for this survey.
-    // XXX: We should remove that.
-    gaia = get_survey(stars, "gaia");
-    if (gaia) {
-        DL_FOREACH(stars->surveys, survey) {
-            if (!survey->is_gaia && !isnan(survey->max_vmag)) {
-                gaia->min_vmag = fmax(gaia->min_vmag, survey->max_vmag);
-            }
-        }
-    }
+    surveys_update_bands(stars);
 
     json_builder_free(args);
     return 0;
 }
 
+// Add all the HIP stars of a tile into the hip index.
+static void tile_index_hip(stars_t *stars, survey_t *survey,
+                           int order, int pix, tile_t *tile)
+{
+    int i;
+    hip_entry_t *entry;
+
+    if (tile->flags & TILE_HIP_INDEXED) return;
+    tile->flags |= TILE_HIP_INDEXED;
+    for (i = 0; i < tile->nb; i++) {
+        if (!tile->sources[i].hip) continue;
+        HASH_FIND_INT(stars->hip_index, &tile->sources[i].hip, entry);
+        if (entry) continue;
+        entry = calloc(1, sizeof(*entry));
+        entry->hip = tile->sources[i].hip;
+        entry->survey = survey;
+        entry->order = order;
+        entry->pix = pix;
+        entry->index = i;
+        HASH_ADD_INT(stars->hip_index, hip, entry);
+    }
+}
+
 obj_t *obj_get_by_hip(int hip, int *code)
 {
     int order, pix, i;
     stars_t *stars = g_stars;
     survey_t *survey;
     tile_t *tile;
+    hip_entry_t *entry;
+
+    // First check if we already know where the star is.
+    HASH_FIND_INT(stars->hip_index, &hip, entry);
+    if (entry) {
+        tile = get_tile(entry->survey, entry->order, entry->pix, true, code);
+        if (*code == 0) return NULL; // Still loading.
+        if (tile && entry->index < tile->nb &&
+                tile->sources[entry->index].hip == hip) {
+            return &tile_get_star(tile, entry->index)->obj;
+        }
+    }
 
     for (order = 0; order < 2; order++) {
         pix = hip_get_pix(hip, order);
@@ -939,10 +2094,14 @@ obj_t *obj_get_by_hip(int hip, int *code)
             tile = get_tile(survey, order, pix, true, code);
             if (*code == 0) return NULL; // Still loading.
             if (!tile) continue;
-            for (i = 0; i < tile->nb; i++) {
-                if (tile->sources[i].hip == hip) {
-                    return obj_retain(&tile->sources[i].obj);
-                }
+            // If the tile was already indexed we know the star is not in it.
+            if (tile->flags & TILE_HIP_INDEXED) continue;
+            tile_index_hip(stars, survey, order, pix, tile);
+            HASH_FIND_INT(stars->hip_index, &hip, entry);
+            if (entry && entry->survey == survey && entry->order == order &&
+                    entry->pix == pix) {
+                i = entry->index;
+                return &tile_get_star(tile, i)->obj;
             }
         }
     }
@@ -957,6 +2116,7 @@ obj_t *obj_get_by_hip(int hip, int *code)
 static obj_klass_t star_klass = {
     .id         = "star",
     .init       = star_init,
+    .del        = star_del,
     .size       = sizeof(star_t),
     .get_info   = star_get_info,
     .get_json_data = star_get_json_data,
@@ -965,6 +2125,36 @@ static obj_klass_t star_klass = {
 };
 OBJ_REGISTER(star_klass)
 
+/*
+ * Get the tiles visit stats of the last frame, as an object of survey key
+ * to the <hips_stats_t> values.
+ */
+static json_value *stars_fn_tiles_stats(obj_t *obj, const attribute_t *attr,
+                                        const json_value *args)
+{
+    stars_t *stars = (void*)obj;
+    survey_t *survey;
+    json_value *ret;
+
+    ret = json_object_new(0);
+    DL_FOREACH(stars->surveys, survey) {
+        if (!survey->hips) continue;
+        json_object_push(ret, survey->key, hips_get_stats_json(survey->hips));
+    }
+    return ret;
+}
+
+static void stars_get_memory(const obj_t *obj, int64_t *cpu, int64_t *gpu)
+{
+    const stars_t *stars = (const stars_t*)obj;
+    const survey_t *survey;
+    DL_FOREACH(stars->surveys, survey) {
+        if (survey->hips) hips_get_memory(survey->hips, cpu, gpu);
+    }
+    *cpu += HASH_COUNT(stars->objs) * sizeof(star_t) +
+            HASH_COUNT(stars->hip_index) * sizeof(hip_entry_t);
+}
+
 static obj_klass_t stars_klass = {
     .id             = "stars",
     .size           = sizeof(stars_t),
@@ -972,13 +2162,17 @@ static obj_klass_t stars_klass = {
     .init           = stars_init,
     .render         = stars_render,
     .list           = stars_list,
+    .list_in_region = stars_list_in_region,
     .add_data_source = stars_add_data_source,
+    .get_memory     = stars_get_memory,
     .render_order   = 20,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(stars_t, visible)),
         PROPERTY(hints_mag_offset, TYPE_FLOAT,
                  MEMBER(stars_t, hints_mag_offset)),
         PROPERTY(hints_visible, TYPE_BOOL, MEMBER(stars_t, hints_visible)),
+        PROPERTY(impostors, TYPE_BOOL, MEMBER(stars_t, impostors)),
+        PROPERTY(tiles_stats, TYPE_JSON, .fn = stars_fn_tiles_stats),
         {},
     },
 };
@@ -1011,4 +2205,56 @@ static void test_create_from_json(void)
 }
 TEST_REGISTER(NULL, test_create_from_json, TEST_AUTO);
 
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+
+// Write a decoded tile file with a single star, and try to load it.
+static tile_t *test_decoded_tile(const char *strings, int strings_size,
+                                 int32_t names)
+{
+    const char *path = "/tmp/swe_test_decoded.bin";
+    const uint8_t hot[HOT_SIZE] = {};
+    int cost, transparency;
+    tile_t *tile;
+    decoded_tile_t header = {
+        .nb = 1,
+        .nb_max = 1,
+        .strings_size = strings_size,
+    };
+    star_record_t record = {
+        .type = "*",
+        .hip = 1,
+        .vmag = 3,
+        .names = names,
+        .sp_type = -1,
+    };
+
+    hips_save_decoded_tile(path, DECODED_TILE_VERSION, 6,
+        (const void*[]){&header, &record, hot, strings, NULL, NULL},
+        (const int[]){sizeof(header), sizeof(record), sizeof(hot),
+                      strings_size, 0, 0});
+    hips_update_decoded_saves(true);
+    tile = stars_load_decoded_tile(NULL, 0, 0, path, &cost, &transparency);
+    remove(path);
+    return tile;
+}
+
+static void test_decoded_tiles(void)
+{
+    tile_t *tile;
+
+    tile = test_decoded_tile("HIP 1\0", 7, 0);
+    assert(tile && tile->nb == 1);
+    assert(strcmp(tile->sources[0].names, "HIP 1") == 0);
+    del_tile(tile);
+
+    // Corrupted files.
+    assert(!test_decoded_tile("HIP 1\0", 7, 7));
+    assert(!test_decoded_tile("HIP 1\0", 7, -2));
+    assert(!test_decoded_tile("HIP 1", 6, 0)); // Missing names end.
+    assert(!test_decoded_tile("HIP 1", 5, 0)); // Missing string end.
+}
+TEST_REGISTER(NULL, test_decoded_tiles, TEST_AUTO);
+
+#endif
+
 #endif
@@ -13,6 +13,12 @@
 // Global list of all the registered klasses.
 static obj_klass_t *g_klasses = NULL;
 
+// Entry of the klasses attributes hash tables.
+struct attribute_entry {
+    UT_hash_handle hh;
+    const attribute_t *attr;
+};
+
 static obj_t *obj_create_(obj_klass_t *klass, json_value *args)
 {
     const char *attr;
@@ -72,21 +78,33 @@ obj_t *obj_create_str(const char *type, const char *args)
     return ret;
 }
 
+static void obj_delete(void *user)
+{
+    obj_t *obj = user;
+    if (obj->parent) {
+        LOG_E("Trying to delete an object still owned by a parent!");
+        LOG_E("id: %s, klass: %s", obj->id, obj->klass->id);
+    }
+    assert(!obj->parent);
+    if (obj->klass->del) obj->klass->del(obj);
+    free(obj);
+}
+
 EMSCRIPTEN_KEEPALIVE
 void obj_release(obj_t *obj)
 {
+    int ref;
     if (!obj) return;
-    assert(obj->ref);
-    obj->ref--;
-    if (obj->ref == 0) {
-        if (obj->parent) {
-            LOG_E("Trying to delete an object still owned by a parent!");
-            LOG_E("id: %s, klass: %s", obj->id, obj->klass->id);
-        }
-        assert(!obj->parent);
-        if (obj->klass->del) obj->klass->del(obj);
-        free(obj);
+    ref = __atomic_sub_fetch(&obj->ref, 1, __ATOMIC_ACQ_REL);
+    assert(ref >= 0);
+    if (ref) return;
+    // The klasses destructors are not thread safe, so if a worker released
+    // the last reference we delete the object on the main thread.
+    if (!worker_is_main_thread()) {
+        worker_defer_to_main(obj_delete, obj);
+        return;
     }
+    obj_delete(obj);
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -94,7 +112,7 @@ obj_t *obj_retain(const obj_t *obj)
 {
     if (!obj) return NULL;
     assert(obj->ref);
-    ((obj_t*)obj)->ref++;
+    __atomic_add_fetch(&((obj_t*)obj)->ref, 1, __ATOMIC_RELAXED);
     return (obj_t*)obj;
 }
 
@@ -198,6 +216,29 @@ int obj_get_pos(const obj_t *obj, const observer_t *obs, int frame,
     return 0;
 }
 
+EMSCRIPTEN_KEEPALIVE
+int obj_get_pos_batch(int nb_objs, obj_t *const *objs,
+                      const observer_t *obs, int nb_times,
+                      const double *times, int frame,
+                      double (*pos)[4], double *vmag)
+{
+    int t, i, k, nb_err = 0;
+    observer_t tmp = *obs;
+
+    for (t = 0; t < nb_times; t++) {
+        tmp.tt = times[t];
+        observer_update(&tmp, false);
+        for (i = 0; i < nb_objs; i++) {
+            k = t * nb_objs + i;
+            if (obj_get_pos(objs[i], &tmp, frame, pos[k])) nb_err++;
+            if (!vmag) continue;
+            if (obj_get_info(objs[i], &tmp, INFO_VMAG, &vmag[k]))
+                vmag[k] = NAN;
+        }
+    }
+    return nb_err;
+}
+
 int obj_get_info(const obj_t *obj, const observer_t *obs, int info,
                  void *out)
 {
@@ -452,29 +493,46 @@ static json_value *obj_fn_default(obj_t *obj, const attribute_t *attr,
                 o = *(obj_t**)p;
                 obj_release(o);
                 memcpy(&o, buf, sizeof(o));
-                if (o) o->ref++;
+                obj_retain(o);
             }
             memcpy(p, buf, attr->member.size);
             if (attr->on_changed) attr->on_changed(obj, attr);
             module_changed(obj, attr->name);
+            core_request_redraw();
         }
         return NULL;
     }
 }
 
+// Build the hash table of the attributes of a klass.  The entries are
+// never freed, since the klasses are static.
+static void klass_index_attributes(obj_klass_t *klass)
+{
+    int i, nb;
+    struct attribute_entry *entries;
+    const attribute_t *attr;
+
+    if (klass->attributes_index || !klass->attributes) return;
+    for (nb = 0; klass->attributes[nb].name; nb++) {}
+    if (!nb) return;
+    entries = calloc(nb, sizeof(*entries));
+    for (i = 0; i < nb; i++) {
+        attr = &klass->attributes[i];
+        entries[i].attr = attr;
+        HASH_ADD_KEYPTR(hh, klass->attributes_index, attr->name,
+                        strlen(attr->name), &entries[i]);
+    }
+}
+
 EMSCRIPTEN_KEEPALIVE
 const attribute_t *obj_get_attr_(const obj_t *obj, const char *attr_name)
 {
-    attribute_t *attr;
-    int i;
+    struct attribute_entry *entry;
     assert(obj);
-    if (!obj->klass->attributes) return NULL;
-    for (i = 0; ; i++) {
-        attr = &obj->klass->attributes[i];
-        if (!attr->name) return NULL;
-        if (strcmp(attr->name, attr_name) == 0) break;
-    }
-    return attr;
+    // Klasses that are not registered are only indexed on first use.
+    klass_index_attributes(obj->klass);
+    HASH_FIND_STR(obj->klass->attributes_index, attr_name, entry);
+    return entry ? entry->attr : NULL;
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -528,15 +586,31 @@ json_value *obj_call_json(obj_t *obj, const char *name,
 }
 
 EMSCRIPTEN_KEEPALIVE
-char *obj_call_json_str(obj_t *obj, const char *attr, const char *args)
+char *obj_call_json_str(obj_t *obj, const char *name, const char *args)
+{
+    const attribute_t *attr;
+    attr = obj_get_attr_(obj, name);
+    if (!attr) {
+        LOG_E("Cannot find attribute %s of object %s", name, obj->id);
+        return NULL;
+    }
+    return obj_call_attr_json_str(obj, attr, args);
+}
+
+EMSCRIPTEN_KEEPALIVE
+char *obj_call_attr_json_str(obj_t *obj, const attribute_t *attr,
+                             const char *args)
 {
     json_value *jargs, *jret;
     char *ret;
     int size;
 
     jargs = args ? json_parse(args, strlen(args)) : NULL;
-    jret = obj_call_json(obj, attr, jargs);
-    if (!jret) return NULL;
+    jret = (attr->fn ?: obj_fn_default)(obj, attr, jargs);
+    if (!jret) {
+        json_value_free(jargs);
+        return NULL;
+    }
     size = json_measure(jret);
     ret = calloc(1, size);
     json_serialize(ret, jret);
@@ -552,8 +626,9 @@ int obj_get_attr(const obj_t *obj, const char *name, ...)
     va_list ap;
 
     attr = obj_get_attr_(obj, name);
+    assert(attr);
     va_start(ap, name);
-    ret = obj_call_json((obj_t*)obj, name, NULL);
+    ret = (attr->fn ?: obj_fn_default)((obj_t*)obj, attr, NULL);
     assert(ret);
     args_vget(ret, attr->type, &ap);
     json_builder_free(ret);
@@ -571,7 +646,7 @@ int obj_get_attr2(const obj_t *obj, const char *name, int type, ...)
     attr = obj_get_attr_(obj, name);
     if (attr->type != type) return -1;
     va_start(ap, type);
-    ret = obj_call_json((obj_t*)obj, name, NULL);
+    ret = (attr->fn ?: obj_fn_default)((obj_t*)obj, attr, NULL);
     assert(ret);
     args_vget(ret, attr->type, &ap);
     json_builder_free(ret);
@@ -592,7 +667,7 @@ int obj_set_attr(obj_t *obj, const char *name, ...)
     }
     va_start(ap, name);
     arg = args_vvalue_new(attr->type, &ap);
-    ret = obj_call_json(obj, name, arg);
+    ret = (attr->fn ?: obj_fn_default)(obj, attr, arg);
     json_builder_free(arg);
     json_builder_free(ret);
     va_end(ap);
@@ -602,6 +677,7 @@ int obj_set_attr(obj_t *obj, const char *name, ...)
 void obj_register_(obj_klass_t *klass)
 {
     assert(klass->size);
+    klass_index_attributes(klass);
     LL_PREPEND(g_klasses, klass);
 }
 
@@ -814,6 +890,9 @@ static void test_simple(void)
     assert(test.nb_changes == 1);
     obj_set_attr(&test.obj, "my_attr", 30.0);
     assert(test.nb_changes == 2);
+
+    assert(obj_get_attr_(&test.obj, "lookat") == &test_klass.attributes[3]);
+    assert(!obj_get_attr_(&test.obj, "look"));
 }
 
 TEST_REGISTER(NULL, test_simple, TEST_AUTO);
@@ -66,6 +66,8 @@ typedef struct observer observer_t;
 typedef struct projection projection_t;
 typedef struct painter painter_t;
 typedef struct obj_klass obj_klass_t;
+typedef struct sky_region sky_region_t;
+typedef struct snapshot snapshot_t;
 
 /*
  * Type: obj_klass
@@ -100,6 +102,8 @@ typedef struct obj_klass obj_klass_t;
  *
  * Module Methods:
  *   update  - Update the module.
+ *   update_ahead - Start the view independent background work of the
+ *                  next update, in pipelined mode.
  *   list    - List all the sky objects children from this module.
  *   get_render_order - Return the render order.
  *   on_mouse   - Called when there is a mouse event.
@@ -131,6 +135,10 @@ struct obj_klass
                     int points_count);
 
     int (*update)(obj_t *module, double dt);
+    // Called in pipelined mode, after the render and before the flush,
+    // with an observer at the predicted time of the next update.  The
+    // observer stays untouched until the next call.
+    int (*update_ahead)(obj_t *module, const observer_t *next);
 
     // List all the names associated with an object.
     void (*get_designations)(const obj_t *obj, void *user,
@@ -149,14 +157,43 @@ struct obj_klass
     void (*gui)(obj_t *obj, int location);
 
     obj_t* (*clone)(const obj_t *obj);
+
+    // For the objects that store their children as plain catalog records,
+    // like the stars tiles: return a new reference to the object of a
+    // record, created on demand.
+    obj_t *(*get_source)(const obj_t *obj, const void *source);
     // List all the sky objects children from this module.
     int (*list)(const obj_t *obj, double max_mag,
                 uint64_t hint, const char *source, void *user,
                 int (*f)(void *user, obj_t *obj));
+    // Same as list, but only for the objects in a region of the sky.  Like
+    // max_mag, the region is only a hint to skip the parts of the data
+    // we know are outside of it.
+    int (*list_in_region)(const obj_t *obj, const observer_t *obs,
+                          const sky_region_t *region, double max_mag,
+                          const char *source, void *user,
+                          int (*f)(void *user, obj_t *obj));
 
     // Add a source of data.
     int (*add_data_source)(obj_t *obj, const char *url, const char *key);
 
+    // Release the parsed data of a hidden module, that it can load again
+    // later, when the engine is short of memory (see core_release_memory).
+    // Return the size in bytes of the released data.  With dry_run set
+    // nothing is released, and we only return the size.
+    int (*release_data)(obj_t *obj, bool dry_run);
+
+    // Add the resident memory of the object data in bytes, on the CPU and
+    // on the GPU (see module_get_memory).
+    void (*get_memory)(const obj_t *obj, int64_t *cpu, int64_t *gpu);
+
+    // Save the parsed data of a module with snapshot_add, and restore it
+    // from one of the saved chunks on the next start (see snapshot.h).
+    // load_snapshot returns -1 if it can't use the chunk.
+    int (*save_snapshot)(const obj_t *obj, snapshot_t *snap);
+    int (*load_snapshot)(obj_t *obj, const char *url, const char *etag,
+                         int version, const void *data, int size);
+
     // Return the render order.
     // By default this return the class attribute `render_order`.
     double (*get_render_order)(const obj_t *obj);
@@ -168,6 +205,8 @@ struct obj_klass
     // List of object attributes that can be read, set or called with the
     // obj_call and obj_toogle_attr functions.
     attribute_t *attributes;
+    // Hash table of the attributes by name, built at registration.
+    struct attribute_entry *attributes_index;
 
     // All the registered klass are put in a list, sorted by create_order.
     obj_klass_t *next;
@@ -285,6 +324,10 @@ obj_t *obj_create_str(const char *type, const char *args);
 /*
  * Function: obj_release
  * Decrement object ref count and delete it if needed.
+ *
+ * The ref count is atomic, so the objects can be shared with the workers.
+ * If a worker releases the last reference, the object is deleted later on
+ * the main thread.
  */
 void obj_release(obj_t *obj);
 
@@ -344,6 +387,36 @@ int obj_get_pvo(const obj_t *obj, const observer_t *obs, double pvo[S 2][4]);
 int obj_get_pos(const obj_t *obj, const observer_t *obs, int frame,
                 double pos[S 4]);
 
+/*
+ * Function: obj_get_pos_batch
+ * Compute the positions and magnitudes of several objects at several times.
+ *
+ * This is meant for the ephemeris computations that don't render anything:
+ * the observer is only updated once per time step, and the objects reuse
+ * their cached values between the calls with the same observer state.
+ * The given observer is not modified, we use a copy for the time steps.
+ *
+ * Parameters:
+ *   nb_objs    - Number of objects.
+ *   objs       - The sky objects.
+ *   obs        - The observer, used for the location.
+ *   nb_times   - Number of time steps.
+ *   times      - The time steps (TT MJD).
+ *   frame      - One of the <FRAME> enum values.
+ *   pos        - Output positions of size nb_times * nb_objs, time after
+ *                time, in homogenous coordinates.  Zero for the objects
+ *                we couldn't compute.
+ *   vmag       - Optional output magnitudes of size nb_times * nb_objs.
+ *                NAN if unknown.
+ *
+ * Return:
+ *   The number of positions we couldn't compute.
+ */
+int obj_get_pos_batch(int nb_objs, obj_t *const *objs,
+                      const observer_t *obs, int nb_times,
+                      const double *times, int frame,
+                      double (*pos)[4], double *vmag);
+
 /*
  * Function: obj_get_info
  * Compute an information value from a sky object.
@@ -357,6 +430,11 @@ int obj_get_pos(const obj_t *obj, const observer_t *obs, int frame,
  *
  * Each object class define what info they support with the get_info method.
  *
+ * The stars, DSOs, comets and minor planets compute the values from their
+ * catalog data only, without modifying the object, so they can be queried
+ * for several observers at once.  The planets and satellites keep a cache
+ * of the last observer values (see observer_t.hash_sky) inside the object.
+ *
  * Parameters:
  *   obj    - A sky object.
  *   obs    - An observer.  Must be up to date.
@@ -475,10 +553,21 @@ json_value *obj_call_json(obj_t *obj, const char *attr,
  */
 char *obj_call_json_str(obj_t *obj, const char *attr, const char *args);
 
+/*
+ * Function: obj_call_attr_json_str
+ * Same as obj_call_json_str, but using an attribute returned by
+ * <obj_get_attr_>, to skip the lookup of the attribute name.
+ */
+char *obj_call_attr_json_str(obj_t *obj, const attribute_t *attr,
+                             const char *args);
+
 /*
  * Function: obj_get_attr_
  * Return the actual <attribute_t> pointer for a given attr name
  *
+ * The attributes are static, so the returned pointer can be kept and used
+ * for all the objects of the same klass.
+ *
  * XXX: need to use a proper name!
  */
 const attribute_t *obj_get_attr_(const obj_t *obj, const char *attr);
@@ -26,18 +26,48 @@ static uint32_t hash_xor(uint32_t v, const char *data, int len)
     return v;
 }
 
-static void update_matrices(observer_t *obs)
+// Max time difference (day) after which we recompute the slowly varying
+// terms (precession, nutation and ecliptic matrices).  This gives errors
+// lower than 0.002 arcsec.
+#define SLOW_TERMS_MAX_DT 0.01
+
+// Max time difference (day) from the last full update after which the fast
+// updates are not allowed anymore.  In between the earth position is
+// extrapolated (see extrapolate_earth).
+#define FULL_UPDATE_MAX_DT 1.001
+
+// Gaussian gravitational constant squared (AU^3 / day^2).
+#define GM_SUN (0.01720209895 * 0.01720209895)
+
+/*
+ * Update the nutation/precession and ecliptic matrices if they were
+ * computed for a too different time.
+ */
+static void update_slow_terms(observer_t *obs)
+{
+    double dpsi, deps, epsa, rb[3][3], rp[3][3], rbp[3][3], rn[3][3],
+           rbpn[3][3];
+
+    if (obs->slow_terms.valid &&
+            fabs(obs->tt - obs->slow_terms.tt) < SLOW_TERMS_MAX_DT)
+        return;
+    eraPn00a(DJM0, obs->tt, &dpsi, &deps, &epsa, rb, rp, rbp, rn, rbpn);
+    mat3_mul(rn, rp, obs->rnp);
+    // Equatorial to ecliptic
+    eraEcm06(DJM0, obs->tt, obs->re2i);
+    mat3_invert(obs->re2i, obs->ri2e);
+    obs->slow_terms.tt = obs->tt;
+    obs->slow_terms.valid = true;
+}
+
+/*
+ * Update the matrices that depend on the view direction.  This is all we
+ * need to do when only the view changed.
+ */
+static void update_view_matrices(observer_t *obs)
 {
-    eraASTROM *astrom = &obs->astrom;
-    // We work with 3x3 matrices, so that we can use the erfa functions.
     double rdir[3][3];
     double ro2v[3][3];  // Rotate from observed to view.
-    double ri2h[3][3];  // Equatorial J2000 (ICRF) to horizontal.
-    double rh2i[3][3];  // Horizontal to Equatorial J2000 (ICRF).
-    double ri2v[3][3];  // Equatorial J2000 (ICRF) to view.
-    double ri2e[3][3];  // Equatorial J2000 (ICRF) to ecliptic.
-    double re2i[3][3];  // Eclipic to Equatorial J2000 (ICRF).
-    double rc2v[3][3];
     double view_rot[3][3];
     // r2gl changes the coordinate from z up to y up orthonomal.
     const double r2gl[3][3] = {{ 0, 0, -1},
@@ -64,6 +94,21 @@ static void update_matrices(observer_t *obs)
     mat3_rx(obs->view_offset_alt, view_rot, view_rot);
     mat3_mul(view_rot, ro2v, ro2v);
 
+    mat3_copy(ro2v, obs->ro2v);
+    mat3_invert(obs->ro2v, obs->rv2o);
+    mat3_mul(ro2v, obs->ri2h, obs->ri2v);
+    // ICRF to view (ignoring refraction).
+    mat3_transpose(obs->astrom.bpn, obs->rc2v);
+    mat3_mul(obs->ri2h, obs->rc2v, obs->rc2v);
+    mat3_mul(ro2v, obs->rc2v, obs->rc2v);
+}
+
+static void update_matrices(observer_t *obs)
+{
+    eraASTROM *astrom = &obs->astrom;
+    // We work with 3x3 matrices, so that we can use the erfa functions.
+    double ri2h[3][3];  // Equatorial J2000 (ICRF) to horizontal.
+
     // Compute rotation matrix from CIRS to horizontal.
     mat3_set_identity(ri2h);
     // Earth rotation.
@@ -80,31 +125,22 @@ static void update_matrices(observer_t *obs)
     mat3_transpose(ri2h, ri2h);
 
     // Also store its inverse.
-    mat3_invert(ri2h, rh2i);
-    mat3_mul(ro2v, ri2h, ri2v);
-
-    // Equatorial to ecliptic
-    eraEcm06(DJM0, obs->tt, re2i);
-    mat3_invert(re2i, ri2e);
-
-    // ICRF to view (ignoring refraction).
-    mat3_transpose(astrom->bpn, rc2v);
-    mat3_mul(ri2h, rc2v, rc2v);
-    mat3_mul(ro2v, rc2v, rc2v);
-
-    // Copy all
-    mat3_copy(ro2v, obs->ro2v);
-    mat3_invert(obs->ro2v, obs->rv2o);
     mat3_copy(ri2h, obs->ri2h);
-    mat3_copy(rh2i, obs->rh2i);
-    mat3_copy(ri2v, obs->ri2v);
-    mat3_copy(ri2e, obs->ri2e);
-    mat3_copy(re2i, obs->re2i);
-    mat3_copy(rc2v, obs->rc2v);
+    mat3_invert(ri2h, obs->rh2i);
+
+    update_slow_terms(obs);
+    update_view_matrices(obs);
 }
 
+/*
+ * Compute the observer hashes:
+ *   hash_partial   - Location and refraction.
+ *   hash_state     - Partial hash plus the time, i.e. everything except the
+ *                    view direction.
+ *   hash           - The full state.
+ */
 static void observer_compute_hash(const observer_t *obs, uint64_t* hash_partial,
-                                  uint64_t* hash)
+                                  uint64_t *hash_state, uint64_t* hash)
 {
     uint32_t v = 1;
     #define H(a) v = hash_xor(v, (const char*)&obs->a, sizeof(obs->a))
@@ -115,13 +151,14 @@ static void observer_compute_hash(const observer_t *obs, uint64_t* hash_partial,
     H(pressure);
     H(space);
     *hash_partial = v;
+    H(tt);
+    if (obs->space) H(obs_pvg);
+    *hash_state = v;
     H(ro2m);
     H(pitch);
     H(yaw);
     H(roll);
     H(view_offset_alt);
-    H(tt);
-    if (obs->space) H(obs_pvg);
     #undef H
     *hash = v;
 }
@@ -132,14 +169,58 @@ static void correct_speed_of_light(double pv[2][3]) {
 }
 
 
-static void update_nutation_precession_mat(observer_t *obs)
+// Sun gravity acceleration at a heliocentric position (AU / day^2).
+static void sun_acceleration(const double p[3], double a[3])
 {
-    // XXX: we can maybe optimize this, since eraPn00a is very slow!
-    double dpsi, deps, epsa, rb[3][3], rp[3][3], rbp[3][3], rn[3][3],
-           rbpn[3][3];
-    eraPn00a(DJM0, obs->tt, &dpsi, &deps, &epsa, rb, rp, rbp, rn, rbpn);
-    mat3_mul(rn, rp, obs->rnp);
+    double r = vec3_norm(p);
+    vec3_mul(-GM_SUN / (r * r * r), p, a);
+}
+
+/*
+ * Extrapolate the earth position and velocity from the last update.
+ *
+ * We use a velocity Verlet step with the sun gravity only, that is enough
+ * for the FULL_UPDATE_MAX_DT range (the moon perturbation gives errors of
+ * about a hundred kilometers after a day), and much better than a linear
+ * extrapolation.  The barycentric state gets the same acceleration as the
+ * heliocentric one, since the sun barycentric acceleration is negligible.
+ */
+static void extrapolate_earth(observer_t *obs, double dt)
+{
+    double a0[3], a1[3], dv[3];
+
+    if (dt == 0) return;
+    sun_acceleration(obs->earth_pvh[0], a0);
+    vec3_addk(obs->earth_pvh[0], obs->earth_pvh[1], dt, obs->earth_pvh[0]);
+    vec3_addk(obs->earth_pvh[0], a0, 0.5 * dt * dt, obs->earth_pvh[0]);
+    vec3_addk(obs->earth_pvb[0], obs->earth_pvb[1], dt, obs->earth_pvb[0]);
+    vec3_addk(obs->earth_pvb[0], a0, 0.5 * dt * dt, obs->earth_pvb[0]);
+    sun_acceleration(obs->earth_pvh[0], a1);
+    vec3_add(a0, a1, dv);
+    vec3_mul(0.5 * dt, dv, dv);
+    vec3_add(obs->earth_pvh[1], dv, obs->earth_pvh[1]);
+    vec3_add(obs->earth_pvb[1], dv, obs->earth_pvb[1]);
+}
 
+/*
+ * Update the astrom observer position and velocity terms (used for the
+ * light deflection and the aberration) without touching the rotation
+ * terms, that are updated separately in the fast updates.
+ */
+static void update_astrom_pv(observer_t *obs)
+{
+    double pvg[2][3];
+    eraASTROM astrom;
+
+    vec3_mul(DAU2M, obs->obs_pvg[0], pvg[0]);
+    vec3_mul(DAU2M / ERFA_DAYSEC, obs->obs_pvg[1], pvg[1]);
+    eraApcs(DJM0, obs->tt, pvg, obs->earth_pvb, obs->earth_pvh[0], &astrom);
+    obs->astrom.pmt = astrom.pmt;
+    vec3_copy(astrom.eb, obs->astrom.eb);
+    vec3_copy(astrom.eh, obs->astrom.eh);
+    obs->astrom.em = astrom.em;
+    vec3_copy(astrom.v, obs->astrom.v);
+    obs->astrom.bm1 = astrom.bm1;
 }
 
 static void observer_update_fast(observer_t *obs)
@@ -154,8 +235,7 @@ static void observer_update_fast(observer_t *obs)
 
     if (!obs->space)
         eraAper13(DJM0, obs->ut1, &obs->astrom);
-    eraPvu(obs->tt - obs->last_update, obs->earth_pvh, obs->earth_pvh);
-    eraPvu(obs->tt - obs->last_update, obs->earth_pvb, obs->earth_pvb);
+    extrapolate_earth(obs, obs->tt - obs->last_update);
 
     if (!obs->space) {
         // Update observer geocentric position obs_pvg. We can't use eraPvu
@@ -170,6 +250,7 @@ static void observer_update_fast(observer_t *obs)
         eraSxp(DM2AU, obs->obs_pvg[0], obs->obs_pvg[0]);
         // Set speed back in AU / day
         eraSxp(ERFA_DAYSEC * DM2AU, obs->obs_pvg[1], obs->obs_pvg[1]);
+        update_astrom_pv(obs);
     } else {
         vec3_mul(DAU2M, obs->obs_pvg[0], pvg[0]);
         vec3_mul(DAU2M / ERFA_DAYSEC, obs->obs_pvg[1], pvg[1]);
@@ -229,8 +310,15 @@ static void observer_update_full(observer_t *obs)
     if (!obs->space)
         eraPvmpv(obs->obs_pvb, obs->earth_pvb, obs->obs_pvg);
     // Update refraction constants.
-    refraction_prepare(obs->pressure, 15, 0.5, &obs->refa, &obs->refb);
-    update_nutation_precession_mat(obs);
+    if (!obs->refraction_ok || obs->refraction_pressure != obs->pressure) {
+        refraction_prepare(obs->pressure, 15, 0.5, &obs->refa, &obs->refb);
+        if (obs->pressure)
+            refraction_lut_init(obs->refa, obs->refb,
+                                OBSERVER_REFRACTION_LUT_SIZE,
+                                obs->refraction_lut);
+        obs->refraction_pressure = obs->pressure;
+        obs->refraction_ok = true;
+    }
 
     update_matrices(obs);
     eraPvmpv(obs->earth_pvb, obs->earth_pvh, obs->sun_pvb);
@@ -243,21 +331,30 @@ static void observer_update_full(observer_t *obs)
 EMSCRIPTEN_KEEPALIVE
 void observer_update(observer_t *obs, bool fast)
 {
-    uint64_t hash, hash_partial;
+    uint64_t hash, hash_partial, hash_state;
 
-    observer_compute_hash(obs, &hash_partial, &hash);
+    observer_compute_hash(obs, &hash_partial, &hash_state, &hash);
     // Check if we have computed accurate positions already
     if (hash == obs->hash)
         return;
-
     // Check if we have computed 'fast' positions already
+    if (fast && hash + 1 == obs->hash)
+        return;
+
+    // If only the view changed, we only need to update the view matrices.
+    if (hash_state == obs->hash_state && (fast || !obs->last_update_fast)) {
+        update_view_matrices(obs);
+        // Keep using the fast update hash value if needed.
+        obs->hash = hash + (obs->last_update_fast ? 1 : 0);
+        return;
+    }
+
     if (fast) {
         // Add one to the hash for the fast update hash value.
         hash++;
-        if (hash == obs->hash)
-            return;
         if (    hash_partial != obs->hash_partial ||
-                fabs(obs->last_accurate_update - obs->tt) >= 1.001)
+                fabs(obs->last_accurate_update - obs->tt) >=
+                    FULL_UPDATE_MAX_DT)
             fast = false;
     }
 
@@ -267,7 +364,10 @@ void observer_update(observer_t *obs, bool fast)
         observer_update_full(obs);
 
     obs->last_update = obs->tt;
+    obs->last_update_fast = fast;
     obs->hash_partial = hash_partial;
+    obs->hash_state = hash_state;
+    obs->hash_sky = hash_state + (fast ? 1 : 0);
     obs->hash = hash;
     if (!fast)
         obs->last_accurate_update = obs->tt;
@@ -276,8 +376,11 @@ void observer_update(observer_t *obs, bool fast)
 static int observer_init(obj_t *obj, json_value *args)
 {
     observer_t*  obs = (observer_t*)obj;
+    uint64_t hash_state;
     mat3_set_identity(obs->ro2m);
-    observer_compute_hash(obs, &obs->hash_partial, &obs->hash);
+    // Note: we don't set hash_state, to force a full update the first time.
+    observer_compute_hash(obs, &obs->hash_partial, &hash_state, &obs->hash);
+    obs->hash_sky = obs->hash;
     return 0;
 }
 
@@ -311,8 +414,8 @@ static void on_tt_changed(obj_t *obj, const attribute_t *attr)
 
 bool observer_is_uptodate(const observer_t *obs, bool fast)
 {
-    uint64_t hash, hash_partial;
-    observer_compute_hash(obs, &hash_partial, &hash);
+    uint64_t hash, hash_partial, hash_state;
+    observer_compute_hash(obs, &hash_partial, &hash_state, &hash);
     if (hash == obs->hash) return true;
     if (fast && (hash + 1 == obs->hash)) return true;
     return false;
@@ -355,3 +458,35 @@ static obj_klass_t observer_klass = {
 };
 OBJ_REGISTER(observer_klass)
 
+
+#if COMPILE_TESTS
+
+// Check that the fast updates stay close to the full computation.
+static void test_fast_update(void)
+{
+    observer_t *obs;
+    double pvh[2][3], eb[3], v[3];
+
+    core_init(100, 100, 1.0);
+    obs = core->observer;
+    obj_set_attr((obj_t*)obs, "utc", 58450.0);
+    obj_set_attr((obj_t*)obs, "latitude", 33.7490 * DD2R);
+    observer_update(obs, false);
+    obj_set_attr((obj_t*)obs, "tt", obs->tt + 0.5);
+    observer_update(obs, true);
+    assert(obs->last_update_fast);
+    memcpy(pvh, obs->earth_pvh, sizeof(pvh));
+    vec3_copy(obs->astrom.eb, eb);
+    vec3_copy(obs->astrom.v, v);
+    observer_update(obs, false);
+    assert(!obs->last_update_fast);
+    assert(vec3_dist(pvh[0], obs->earth_pvh[0]) < 1e-6);
+    assert(vec3_dist(pvh[1], obs->earth_pvh[1]) < 1e-6);
+    assert(vec3_dist(eb, obs->astrom.eb) < 1e-6);
+    // Aberration error lower than 0.01 arcsec.
+    assert(vec3_dist(v, obs->astrom.v) < 0.01 * ERFA_DAS2R);
+}
+
+TEST_REGISTER(NULL, test_fast_update, TEST_AUTO)
+
+#endif
@@ -13,6 +13,9 @@
 #include "obj.h"
 #include "erfa_wrap.h"
 
+// Size of the observer refraction table.
+#define OBSERVER_REFRACTION_LUT_SIZE 1024
+
 /*
  * Type: observer_t
  * Store informations about the observer current position.
@@ -61,6 +64,28 @@ struct observer
     // not safe to perform a fast update.
     uint64_t hash_partial;
 
+    // Hash of the observer state without the view direction.  If only the
+    // view changed we just need to update the view matrices.
+    uint64_t hash_state;
+    bool last_update_fast;
+
+    // Hash of the last computed state without the view direction, including
+    // the fast update flag.  Used to cache the values that don't depend on
+    // the view (positions, magnitudes...), so that they are shared between
+    // several views of the same instant.
+    uint64_t hash_sky;
+
+    // Time of the last computation of the slowly varying terms (rnp,
+    // ri2e, re2i), that we only update after a small time tolerance.
+    struct {
+        bool    valid;
+        double  tt;
+    } slow_terms;
+
+    // Pressure used for the refraction constants computation.
+    bool refraction_ok;
+    double refraction_pressure;
+
     // Different times, all in MJD.
     double ut1;
     double utc;
@@ -71,6 +96,8 @@ struct observer
     // Refraction precomputed value, for fast refraction computation.
     double refa;
     double refb;
+    // Refraction as a function of the altitude, see refraction_lut_init.
+    double refraction_lut[OBSERVER_REFRACTION_LUT_SIZE][2];
 
     // Heliocentric position/speed of the earth in ICRF reference frame and in
     // BCRS reference system. AU, AU/day.
@@ -0,0 +1,194 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "occluders.h"
+
+#include "algos/algos.h"
+#include "constants.h"
+#include "erfa_wrap.h"
+#include "utarray.h"
+#include "utils/vec.h"
+#include "utils/utils.h"
+
+#include <math.h>
+
+/*
+ * The bodies are indexed in the healpix pixels of order NSIDE of their
+ * center direction, and also in all the neighbour pixels, so that a test
+ * only has to check the bodies of the point pixel.  This only works for
+ * bodies smaller than MAX_ANGLE, which is much less than the pixels size:
+ * the larger ones (the moon for an observer in orbit, or a planet seen
+ * from a spacecraft) are kept in a separate list always tested.
+ */
+#define NSIDE 4
+#define NB_PIX (12 * NSIDE * NSIDE)
+#define MAX_ANGLE (2 * DD2R)
+
+typedef struct item {
+    double pos[3];
+    double radius;
+    const obj_t *obj;
+} item_t;
+
+typedef struct entry {
+    int item;   // Index of the item in the items array.
+    int next;   // Index of the next entry in the bucket, or -1.
+} entry_t;
+
+struct occluders
+{
+    UT_array *items;
+    UT_array *entries;
+    int buckets[NB_PIX];    // First entry of each pixel, or -1.
+    int large;              // First entry of large items, or -1.
+};
+
+static void add_entry(occluders_t *occluders, int *head, int item)
+{
+    entry_t entry = {item, *head};
+    *head = utarray_len(occluders->entries);
+    utarray_push_back(occluders->entries, &entry);
+}
+
+occluders_t *occluders_create(void)
+{
+    static UT_icd item_icd = {sizeof(item_t), NULL, NULL, NULL};
+    static UT_icd entry_icd = {sizeof(entry_t), NULL, NULL, NULL};
+    occluders_t *occluders;
+    occluders = calloc(1, sizeof(*occluders));
+    utarray_new(occluders->items, &item_icd);
+    utarray_new(occluders->entries, &entry_icd);
+    memset(occluders->buckets, -1, sizeof(occluders->buckets));
+    occluders->large = -1;
+    return occluders;
+}
+
+void occluders_delete(occluders_t *occluders)
+{
+    if (!occluders) return;
+    utarray_free(occluders->items);
+    utarray_free(occluders->entries);
+    free(occluders);
+}
+
+void occluders_add(occluders_t *occluders, const double pos[3],
+                   double radius, const obj_t *obj)
+{
+    item_t item = {};
+    int idx, pix, neighbours[8], i;
+    double dist;
+
+    if (radius <= 0) return;
+    vec3_copy(pos, item.pos);
+    item.radius = radius;
+    item.obj = obj;
+    utarray_push_back(occluders->items, &item);
+    idx = utarray_len(occluders->items) - 1;
+
+    dist = vec3_norm(pos);
+    if (radius >= dist * sin(MAX_ANGLE)) {
+        add_entry(occluders, &occluders->large, idx);
+        return;
+    }
+    pix = healpix_vec2pix(NSIDE, pos);
+    add_entry(occluders, &occluders->buckets[pix], idx);
+    healpix_get_neighbours(NSIDE, pix, neighbours);
+    for (i = 0; i < 8; i++) {
+        if (neighbours[i] == -1) continue;
+        add_entry(occluders, &occluders->buckets[neighbours[i]], idx);
+    }
+}
+
+void occluders_clear_all(occluders_t *occluders)
+{
+    utarray_clear(occluders->items);
+    utarray_clear(occluders->entries);
+    memset(occluders->buckets, -1, sizeof(occluders->buckets));
+    occluders->large = -1;
+}
+
+static bool test_list(const occluders_t *occluders, int i,
+                      const double dir[3], double dist, bool at_inf,
+                      const obj_t *ignore)
+{
+    const entry_t *entry;
+    const item_t *item;
+    double t, l2, d2;
+
+    for (; i != -1; i = entry->next) {
+        entry = (entry_t*)utarray_eltptr(occluders->entries, i);
+        item = (item_t*)utarray_eltptr(occluders->items, entry->item);
+        if (item->obj && item->obj == ignore) continue;
+        t = vec3_dot(dir, item->pos);
+        if (t < 0) continue;
+        l2 = vec3_norm2(item->pos);
+        if (!at_inf && dist * dist < l2) continue;
+        d2 = l2 - t * t;
+        if (d2 < item->radius * item->radius) return true;
+    }
+    return false;
+}
+
+bool occluders_test(const occluders_t *occluders, const double pos[3],
+                    bool at_inf, const obj_t *ignore)
+{
+    double dir[3], dist;
+    int pix;
+
+    if (utarray_len(occluders->items) == 0) return false;
+    dist = vec3_norm(pos);
+    vec3_normalize(pos, dir);
+    if (test_list(occluders, occluders->large, dir, dist, at_inf, ignore))
+        return true;
+    pix = healpix_vec2pix(NSIDE, dir);
+    return test_list(occluders, occluders->buckets[pix], dir, dist, at_inf,
+                     ignore);
+}
+
+#if COMPILE_TESTS
+
+#include "tests.h"
+#include <assert.h>
+
+// Compare the index against a brute force test of all the bodies.
+static void test_occluders(void)
+{
+    occluders_t *occluders;
+    double pos[64][4], p[3], t, d2;
+    int i, j, k;
+    bool r, expected, hit = false;
+
+    srand(1);
+    occluders = occluders_create();
+    for (i = 0; i < 64; i++) {
+        for (k = 0; k < 3; k++) pos[i][k] = (double)rand() / RAND_MAX - 0.5;
+        // Some bodies large enough to go into the large list.
+        pos[i][3] = (double)rand() / RAND_MAX * (i % 8 ? 0.01 : 0.2);
+        occluders_add(occluders, pos[i], pos[i][3], NULL);
+    }
+    for (j = 0; j < 10000; j++) {
+        for (k = 0; k < 3; k++) p[k] = (double)rand() / RAND_MAX - 0.5;
+        vec3_normalize(p, p);
+        expected = false;
+        for (i = 0; i < 64; i++) {
+            t = vec3_dot(p, pos[i]);
+            d2 = vec3_norm2(pos[i]) - t * t;
+            if (t >= 0 && d2 < pos[i][3] * pos[i][3]) expected = true;
+        }
+        r = occluders_test(occluders, p, true, NULL);
+        assert(r == expected);
+        hit = hit || r;
+    }
+    assert(hit);
+    occluders_delete(occluders);
+}
+
+TEST_REGISTER(NULL, test_occluders, TEST_AUTO);
+
+#endif
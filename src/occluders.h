@@ -0,0 +1,73 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef OCCLUDERS_H
+#define OCCLUDERS_H
+
+#include <stdbool.h>
+
+/*
+ * File: occluders.h
+ * An occluders instance maintains a list of spherical bodies, indexed by
+ * direction in the sky, for fast occultation tests.
+ *
+ * The modules with bodies that can hide other objects fill it once per
+ * frame, so that testing a point only costs a lookup in a healpix pixel
+ * bucket instead of a scan of all the bodies.
+ */
+
+typedef struct occluders occluders_t;
+typedef struct obj obj_t;
+
+/*
+ * Function: occluders_create
+ * Return a new occluders.
+ */
+occluders_t *occluders_create(void);
+
+/*
+ * Function: occluders_delete
+ * Delete an occluders instance.
+ */
+void occluders_delete(occluders_t *occluders);
+
+/*
+ * Function: occluders_add
+ * Add a spherical body to the occluders.
+ *
+ * Parameters:
+ *   occluders  - an occluders instance.
+ *   pos        - observed position of the body center (AU).
+ *   radius     - radius of the body (AU).
+ *   obj        - object associated with the body.  Only used to skip it
+ *                during the tests.
+ */
+void occluders_add(occluders_t *occluders, const double pos[3],
+                   double radius, const obj_t *obj);
+
+/*
+ * Function: occluders_clear_all
+ * Remove all the bodies in an occluders instance.
+ */
+void occluders_clear_all(occluders_t *occluders);
+
+/*
+ * Function: occluders_test
+ * Test if a point is hidden by any body of an occluders instance.
+ *
+ * Parameters:
+ *   occluders  - an occluders instance.
+ *   pos        - observed position of the point (AU).
+ *   at_inf     - true if the point is at infinity.
+ *   ignore     - object to skip, or NULL.
+ */
+bool occluders_test(const occluders_t *occluders, const double pos[3],
+                    bool at_inf, const obj_t *ignore);
+
+#endif // OCCLUDERS_H
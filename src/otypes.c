@@ -29,14 +29,34 @@ typedef struct entry
     uint8_t n[4];   // 4 digits number.
     char    id[5];  // 4 bytes id (use 5 to ensure null termination).
     char    *str;   // Long name.
+    // Packed digits, and mask of the leading non zero digits, so that we
+    // can test the hierarchy with a single AND.
+    uint32_t code;
+    uint32_t mask;
 } entry_t;
 
+// Packed digits and ancestors mask, computed at compile time by the T macro.
+#define CODE(n0, n1, n2, n3) \
+    ((uint32_t)(n0) << 24 | (uint32_t)(n1) << 16 | (n2) << 8 | (n3))
+#define MASK(n0, n1, n2, n3) \
+    (!(n0) ? 0 : !(n1) ? 0xff000000 : !(n2) ? 0xffff0000 : \
+     !(n3) ? 0xffffff00 : 0xffffffff)
+
 static const entry_t ENTRIES[];
 
+// Index of the parent of each entry, lazily computed.
+static int16_t g_parents[TOTAL_KEYWORDS];
+static bool g_parents_ready = false;
+
+int otype_index(const char *id)
+{
+    return otypes_hash_search(id, strnlen(id, 4));
+}
+
 static const entry_t *otype_get(const char *id)
 {
     int idx;
-    idx = otypes_hash_search(id, strnlen(id, 4));
+    idx = otype_index(id);
     return idx != -1 ? &ENTRIES[idx] : NULL;
 }
 
@@ -48,36 +68,51 @@ const char *otype_get_str(const char *id)
     return e ? e->str : NULL;
 }
 
-// Return the parent condensed id of an otype.
-const char *otype_get_parent(const char *id)
+static void compute_parents(void)
 {
-    int i;
-    uint8_t n[4];
-    const entry_t *e;
+    int i, j;
+    uint32_t code;
 
-    e = otype_get(id);
-    if (!e) return NULL;
-    // We get the parent number by setting the last non zero digit to zero.
-    memcpy(n, e->n, 4);
-    for (i = 0; i < 4; i++) {
-        if (n[i] == 0) break;
-    }
-    if (i == 0) return NULL;
-    n[i - 1] = 0;
-    for (e = &ENTRIES[0]; e->id[0]; e++) {
-        if (memcmp(e->n, n, 4) == 0)
-            return e->id;
+    for (i = 0; ENTRIES[i].id[0]; i++) {
+        g_parents[i] = -1;
+        // We get the parent number by setting the last non zero digit to
+        // zero.
+        if (!ENTRIES[i].mask) continue;
+        code = ENTRIES[i].code & (ENTRIES[i].mask << 8);
+        code |= ENTRIES[i].code & ~ENTRIES[i].mask;
+        // The parents always come before their children in the list.
+        for (j = i - 1; j >= 0; j--) {
+            if (ENTRIES[j].code == code) {
+                g_parents[i] = j;
+                break;
+            }
+        }
     }
-    return NULL;
+    g_parents_ready = true;
 }
 
-static bool otype_get_digits(const char *id, uint8_t out[4])
+int otype_index_get_parent(int idx)
 {
-    const entry_t *e;
-    e = otype_get(id);
-    if (!e) return false;
-    memcpy(out, e->n, 4);
-    return true;
+    if (idx < 0) return -1;
+    if (!g_parents_ready) compute_parents();
+    return g_parents[idx];
+}
+
+// Return the parent condensed id of an otype.
+const char *otype_get_parent(const char *id)
+{
+    int idx;
+    idx = otype_index_get_parent(otype_index(id));
+    return idx != -1 ? ENTRIES[idx].id : NULL;
+}
+
+bool otype_index_match(int otype, int match)
+{
+    const entry_t *o, *m;
+    if (otype < 0 || match < 0) return false;
+    o = &ENTRIES[otype];
+    m = &ENTRIES[match];
+    return (o->code & m->mask) == (m->code & m->mask);
 }
 
 /*
@@ -88,22 +123,15 @@ static bool otype_get_digits(const char *id, uint8_t out[4])
  */
 bool otype_match(const char *otype, const char *match)
 {
-    uint8_t o[4], m[4];
-    int i;
     if (strncmp(otype, match, 4) == 0) return true;
-    if (!otype_get_digits(otype, o)) return false;
-    if (!otype_get_digits(match, m)) return false;
-    for (i = 0; i < 4; i++) {
-        if (m[i] == 0) return true;
-        if (o[i] != m[i]) return false;
-    }
-    return true;
+    return otype_index_match(otype_index(otype), otype_index(match));
 }
 
 // STYLE-CHECK OFF
 
 static const entry_t ENTRIES[] = {
-#define T(n0, n1, n2, n3, id, str) {{n0, n1, n2, n3}, id, str},
+#define T(n0, n1, n2, n3, id, str) \
+    {{n0, n1, n2, n3}, id, str, CODE(n0, n1, n2, n3), MASK(n0, n1, n2, n3)},
 T( 0, 0, 0, 0, "?"  , N_("Object of unknown nature"))
 T( 0, 2, 0, 0, "ev" ,   N_("transient event"))
 T( 1, 0, 0, 0, "Rad", N_("Radio-source"))
@@ -421,6 +449,10 @@ static void test_otypes_hash(void)
     for (i = 0, e = &ENTRIES[0]; e->id[0]; e++, i++) {
         assert(otypes_hash_search(e->id, strnlen(e->id, 4)) == i);
     }
+    assert(strcmp(otype_get_parent("No?"), "CV?") == 0);
+    assert(otype_get_parent("?") == NULL);
+    assert(otype_match("No?", "**?"));
+    assert(!otype_match("**?", "No?"));
 }
 
 TEST_REGISTER(NULL, test_otypes_hash, TEST_AUTO);
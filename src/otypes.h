@@ -48,3 +48,36 @@ const char *otype_get_parent(const char *otype);
  * Return true if the type is equal to or is a subclass of the other.
  */
 bool otype_match(const char *otype, const char *match);
+
+/*
+ * Function: otype_index
+ * Return the index of an otype in the otypes table.
+ *
+ * The index can be stored instead of the condensed id and used with the
+ * otype_index_xxx functions to avoid the hash lookups.
+ *
+ * Parameters:
+ *   otype  - An otype condensed id string (e.g '**').  Can be shorter than
+ *            4 bytes.  Doesn't have to be NULL terminated if exactly 4 bytes.
+ *
+ * Return:
+ *   The index of the otype, or -1 if the otype doesn't exists.
+ */
+int otype_index(const char *otype);
+
+/*
+ * Function: otype_index_get_parent
+ * Same as <otype_get_parent>, but using otype indices.
+ *
+ * Return:
+ *   The index of the parent otype, or -1 if no parent was found.
+ */
+int otype_index_get_parent(int otype);
+
+/*
+ * Function: otype_index_match
+ * Same as <otype_match>, but using otype indices.
+ *
+ * This is a single mask test on the precomputed otypes digits.
+ */
+bool otype_index_match(int otype, int match);
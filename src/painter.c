@@ -13,8 +13,58 @@
 
 #include <float.h>
 
+// Max number of entries in the healpix clipping tests cache.
+#define CLIPPED_TILES_MAX_ENTRIES 16384
+
 static bool g_debug = false;
 
+/*
+ * Type: clipped_tile_t
+ * Cached result of painter_is_healpix_clipped.
+ */
+typedef struct clipped_tile clipped_tile_t;
+struct clipped_tile {
+    UT_hash_handle  hh;
+    struct {
+        int         frame;
+        int         order;
+        int         pix;
+        int         flags;
+    } key;
+    bool            clipped;
+};
+
+// Cache of the healpix tiles clipping tests, so that the different layers
+// rendering healpix tiles in the same frame (stars, dso, surveys...) don't
+// test the same tiles again.  The cache is flushed every time the clip info
+// of a painter is updated.
+static struct {
+    clipped_tile_t      *map;
+    int                 count;
+    int                 id;
+    const projection_t  *proj;
+    const observer_t    *obs;
+} g_clipped = {};
+
+static void clipped_tiles_flush(void)
+{
+    clipped_tile_t *e, *tmp;
+    HASH_ITER(hh, g_clipped.map, e, tmp) {
+        HASH_DEL(g_clipped.map, e);
+        free(e);
+    }
+    g_clipped.count = 0;
+}
+
+// Clip info of a frame, or zero caps, that never clip, if the painter
+// doesn't have any.
+static const painter_clip_info_t *get_clip_info(const painter_t *painter,
+                                                int frame)
+{
+    static const painter_clip_t no_clip = {};
+    return &(painter->clip ?: &no_clip)->frames[frame];
+}
+
 // Test if a shape in clipping coordinates is clipped or not.
 static bool is_clipped(int n, double (*pos)[4])
 {
@@ -66,7 +116,8 @@ static bool intersect_circle_rect(
  * Function: compute_viewport_cap
  * Compute the viewport cap (in given frame).
  */
-static void compute_viewport_cap(painter_t *painter, int frame)
+static void compute_viewport_cap(const painter_t *painter,
+                                 painter_clip_t *clip, int frame)
 {
     int i;
     double p[4][3];
@@ -74,7 +125,7 @@ static void compute_viewport_cap(painter_t *painter, int frame)
     const double w = painter->proj->window_size[0];
     const double h = painter->proj->window_size[1];
     double max_sep = 0;
-    double* cap = painter->clip_info[frame].bounding_cap;
+    double* cap = clip->frames[frame].bounding_cap;
     bool r;
 
     painter_unproject(painter, frame, VEC(w / 2, h / 2), cap);
@@ -98,14 +149,14 @@ static void compute_viewport_cap(painter_t *painter, int frame)
     if (max_sep > M_PI_2)
         return;
 
-    painter->clip_info[frame].nb_viewport_caps = 4;
+    clip->frames[frame].nb_viewport_caps = 4;
     for (i = 0; i < 4; i++) {
         vec3_cross(p[i], p[(i + 1) % 4], c);
         vec3_normalize(c, c);
-        vec3_copy(c, painter->clip_info[frame].viewport_caps[i]);
-        if (!cap_contains_vec3(painter->clip_info[frame].viewport_caps[i], cap))
-            vec3_mul(-1, painter->clip_info[frame].viewport_caps[i],
-                         painter->clip_info[frame].viewport_caps[i]);
+        vec3_copy(c, clip->frames[frame].viewport_caps[i]);
+        if (!cap_contains_vec3(clip->frames[frame].viewport_caps[i], cap))
+            vec3_mul(-1, clip->frames[frame].viewport_caps[i],
+                         clip->frames[frame].viewport_caps[i]);
     }
 }
 
@@ -116,13 +167,19 @@ static void compute_sky_cap(const observer_t *obs, int frame, double cap[4])
     cap[3] = cos(91.0 * M_PI / 180);
 }
 
-void painter_update_clip_info(painter_t *painter)
+void painter_update_clip_info(painter_t *painter, painter_clip_t *clip)
 {
     int i;
+    memset(clip, 0, sizeof(*clip));
     for (i = 0; i < FRAMES_NB ; ++i) {
-        compute_viewport_cap(painter, i);
-        compute_sky_cap(painter->obs, i, painter->clip_info[i].sky_cap);
+        compute_viewport_cap(painter, clip, i);
+        compute_sky_cap(painter->obs, i, clip->frames[i].sky_cap);
     }
+    clipped_tiles_flush();
+    clip->id = ++g_clipped.id;
+    painter->clip = clip;
+    g_clipped.proj = painter->proj;
+    g_clipped.obs = painter->obs;
 }
 
 int paint_prepare(painter_t *painter, double win_w, double win_h,
@@ -145,6 +202,10 @@ int paint_prepare(painter_t *painter, double win_w, double win_h,
 int paint_finish(const painter_t *painter)
 {
     render_finish(painter->rend);
+    texture_upload_new_frame();
+    // All the transient data of the frame has been consumed by the
+    // renderer.
+    frame_alloc_reset();
     return 0;
 }
 
@@ -154,7 +215,8 @@ int paint_finish(const painter_t *painter)
  * Parameters:
  *   painter    - A painter struct.
  *   slot       - The texture slot we want to set.  Can be one of:
- *                PAINTER_TEX_COLOR or PAINTER_TEX_NORMAL.
+ *                PAINTER_TEX_COLOR, PAINTER_TEX_NORMAL or
+ *                PAINTER_TEX_LAYER.
  *   uv_mat     - The transformation to the uv coordinates to get the part
  *                of the texture we want to use.  NULL default to the
  *                identity matrix, that is the full texture.
@@ -186,11 +248,21 @@ int paint_quad(const painter_t *painter,
                const uv_map_t *map,
                int grid_size)
 {
+    painter_t painter2;
+    texture_t *layer = painter->textures[PAINTER_TEX_LAYER].tex;
+
     if (painter->textures[PAINTER_TEX_COLOR].tex) {
         if (!texture_load(painter->textures[PAINTER_TEX_COLOR].tex, NULL))
             return 0;
     }
     if (painter->color[3] == 0.0) return 0;
+    // Just skip the layer if its texture is not ready yet.
+    if (layer && (!texture_load(layer, NULL) ||
+                  painter->layer_color[3] == 0.0)) {
+        painter2 = *painter;
+        painter2.textures[PAINTER_TEX_LAYER].tex = NULL;
+        painter = &painter2;
+    }
 
     // XXX: need to check if we intersect discontinuity, and if so split
     // the painter projection.
@@ -297,6 +369,7 @@ int paint_line(const painter_t *painter,
                int split, int flags)
 {
     int i, size;
+    size_t mark;
     double view_pos[2][4];
     double (*win_line)[3] = NULL;
     double (*pos_line)[3] = NULL;
@@ -322,13 +395,13 @@ int paint_line(const painter_t *painter,
     if (discontinuous)
         goto split;
 
+    mark = frame_alloc_mark();
     size = line_tesselate(line_func, painter->proj,
                           USER_PASS(painter, &frame, line, map),
                           split, &pos_line, &win_line);
     if (size < 0) goto split;
     render_line(painter->rend, painter, pos_line, win_line, size);
-    free(win_line);
-    free(pos_line);
+    frame_alloc_rewind(mark);
     return 0;
 
 split:
@@ -350,16 +423,16 @@ int paint_linestring(const painter_t *painter, int frame,
     double (*win_line)[3];
     double (*pos_line)[3];
     int i;
-    win_line = calloc(size, sizeof(*win_line));
-    pos_line = calloc(size, sizeof(*pos_line));
+    size_t mark = frame_alloc_mark();
+    win_line = frame_alloc(size * sizeof(*win_line));
+    pos_line = frame_alloc(size * sizeof(*pos_line));
     for (i = 0; i < size; i++) {
         convert_frame(painter->obs, frame, FRAME_VIEW, true,
                       points[i], pos_line[i]);
         project_to_win(painter->proj, pos_line[i], win_line[i]);
     }
     render_line(painter->rend, painter, pos_line, win_line, size);
-    free(win_line);
-    free(pos_line);
+    frame_alloc_rewind(mark);
     return 0;
 }
 
@@ -444,6 +517,12 @@ subdivide:
     return 0;
 }
 
+int paint_static_mesh(const painter_t *painter, int frame, int mode,
+                      static_mesh_t *mesh)
+{
+    return render_static_mesh(painter->rend, painter, frame, mode, mesh);
+}
+
 void paint_debug(bool value)
 {
     g_debug = value;
@@ -453,17 +532,16 @@ bool painter_is_cap_clipped(const painter_t *painter, int frame,
                             const double cap[4])
 {
     int i;
+    const painter_clip_info_t *clipinfo = get_clip_info(painter, frame);
 
-    if (!cap_intersects_cap(painter->clip_info[frame].bounding_cap, cap))
+    if (!cap_intersects_cap(clipinfo->bounding_cap, cap))
         return true;
 
     // Skip if below horizon.
     if (painter->flags & PAINTER_HIDE_BELOW_HORIZON &&
-            !cap_intersects_cap(painter->clip_info[frame].sky_cap, cap))
+            !cap_intersects_cap(clipinfo->sky_cap, cap))
         return true;
 
-    const typeof (painter->clip_info[frame]) *clipinfo =
-            &painter->clip_info[frame];
     if (clipinfo->nb_viewport_caps > 0) {
         for (i = 0; i < clipinfo->nb_viewport_caps; ++i) {
             if (!cap_intersects_cap(clipinfo->viewport_caps[i], cap)) {
@@ -480,16 +558,15 @@ bool painter_is_point_clipped_fast(const painter_t *painter, int frame,
 {
     double v[3];
     int i;
+    const painter_clip_info_t *clipinfo = get_clip_info(painter, frame);
     vec3_copy(pos, v);
     if (!is_normalized)
         vec3_normalize(v, v);
-    if (!cap_contains_vec3(painter->clip_info[frame].bounding_cap, v))
+    if (!cap_contains_vec3(clipinfo->bounding_cap, v))
         return true;
     if ((painter->flags & PAINTER_HIDE_BELOW_HORIZON) &&
-         !cap_contains_vec3(painter->clip_info[frame].sky_cap, v))
+         !cap_contains_vec3(clipinfo->sky_cap, v))
         return true;
-    const typeof (painter->clip_info[frame]) *clipinfo =
-            &painter->clip_info[frame];
     if (clipinfo->nb_viewport_caps > 0) {
         for (i = 0; i < clipinfo->nb_viewport_caps; ++i) {
             if (!cap_contains_vec3(clipinfo->viewport_caps[i], v)) {
@@ -601,12 +678,65 @@ static bool painter_is_planet_quad_clipped(const painter_t *painter, int frame,
     return false;
 }
 
-bool painter_is_healpix_clipped(const painter_t *painter, int frame,
-                                int order, int pix)
+/*
+ * Test if a quad is entirely below the horizon (with the sky cap 1° margin
+ * for the refraction).  The bounding caps of the order 0 and 1 healpix
+ * tiles are so large that they almost always intersect the sky cap, so in
+ * that case we check the children instead.
+ */
+static bool is_quad_below_horizon(const painter_t *painter, int frame,
+                                  const uv_map_t *map)
+{
+    double cap[4];
+    uv_map_t children[4];
+    int i;
+
+    uv_map_get_bounding_cap(map, cap);
+    if (!cap_intersects_cap(get_clip_info(painter, frame)->sky_cap, cap))
+        return true;
+    if (map->order >= 2) return false;
+    uv_map_subdivide(map, children);
+    for (i = 0; i < 4; i++) {
+        if (!is_quad_below_horizon(painter, frame, &children[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool is_healpix_clipped(const painter_t *painter, int frame,
+                               int order, int pix)
 {
     uv_map_t map;
     uv_map_init_healpix(&map, order, pix, false, false);
-    return painter_is_quad_clipped(painter, frame, &map);
+    if (painter_is_quad_clipped(painter, frame, &map)) return true;
+    return (painter->flags & PAINTER_HIDE_BELOW_HORIZON) && order < 2 &&
+           is_quad_below_horizon(painter, frame, &map);
+}
+
+bool painter_is_healpix_clipped(const painter_t *painter, int frame,
+                                int order, int pix)
+{
+    clipped_tile_t *e, key = {};
+
+    // Only use the cache if the painter clip info are the current ones.
+    if (    !painter->clip || painter->clip->id != g_clipped.id ||
+            painter->proj != g_clipped.proj ||
+            painter->obs != g_clipped.obs ||
+            g_clipped.count >= CLIPPED_TILES_MAX_ENTRIES)
+        return is_healpix_clipped(painter, frame, order, pix);
+
+    key.key.frame = frame;
+    key.key.order = order;
+    key.key.pix = pix;
+    key.key.flags = painter->flags & PAINTER_HIDE_BELOW_HORIZON;
+    HASH_FIND(hh, g_clipped.map, &key.key, sizeof(key.key), e);
+    if (e) return e->clipped;
+    e = calloc(1, sizeof(*e));
+    e->key = key.key;
+    e->clipped = is_healpix_clipped(painter, frame, order, pix);
+    HASH_ADD(hh, g_clipped.map, key, sizeof(e->key), e);
+    g_clipped.count++;
+    return e->clipped;
 }
 
 bool painter_is_planet_healpix_clipped(const painter_t *painter,
@@ -676,10 +806,44 @@ static void orbit_map(const uv_map_t *map, const double v[2], double out[4])
     out[3] = 1.0; // AU.
 }
 
+/*
+ * Compute the focus position and the semi-major and semi-minor axes vectors
+ * of an elliptic orbit in the view frame.
+ */
+static void orbit_get_view_axes(const painter_t *painter,
+                                const double transf[4][4],
+                                const double o[8],
+                                double focus[3], double axes[2][3])
+{
+    const double i = o[1], om = o[2], w = o[3], a = o[4], e = o[6];
+    const double len[2] = {a, a * sqrt(1 - e * e)};
+    double u, p[3];
+    int k;
+
+    convert_frame(painter->obs, FRAME_ICRF, FRAME_VIEW, false, transf[3],
+                  focus);
+    for (k = 0; k < 2; k++) {
+        // Direction of the periapsis, and 90° after it, as computed in
+        // orbit_compute_pv.
+        u = w + k * M_PI / 2;
+        p[0] = cos(om) * cos(u) - sin(om) * sin(u) * cos(i);
+        p[1] = sin(om) * cos(u) + cos(om) * sin(u) * cos(i);
+        p[2] = sin(u) * sin(i);
+        vec3_mul(len[k], p, p);
+        mat4_mul_dir3(transf, p, p);
+        vec3_add(transf[3], p, p);
+        convert_frame(painter->obs, FRAME_ICRF, FRAME_VIEW, false, p, p);
+        vec3_sub(p, focus, axes[k]);
+    }
+}
+
 /*
  * Function: paint_orbit
  * Draw an orbit from it's elements.
  *
+ * If the renderer supports it, the elliptic orbits are evaluated on the
+ * GPU (see <render_orbit>), otherwise we tessellate the line here.
+ *
  * Parameters:
  *   painter    - The painter.
  *   frame      - Need to be FRAME_ICRF.
@@ -711,13 +875,21 @@ int paint_orbit(const painter_t *painter_, int frame,
         .user       = (const void*)orbit,
     };
     double line[2][4] = {{0}, {1}};
-    double center[3];
+    double center[3], axes[2][3];
     // We only support ICRF for the moment to make things simpler.
     assert(frame == FRAME_ICRF);
+    painter.flags |= PAINTER_ENABLE_DEPTH;
+
+    // The GPU lines don't handle the projections discontinuities.
+    if (k_ec < 1 && !(painter.proj->flags & PROJ_HAS_DISCONTINUITY)) {
+        orbit_get_view_axes(&painter, transf, orbit, center, axes);
+        if (render_orbit(painter.rend, &painter, center, axes, k_ec) == 0)
+            return 0;
+    }
+
     convert_frame(painter.obs, frame, FRAME_VIEW, false, transf[3], center);
     painter.lines.fade_dist_min = -center[2] - k_a;
     painter.lines.fade_dist_max = -center[2] + k_a * 2;
-    painter.flags |= PAINTER_ENABLE_DEPTH;
     paint_line(&painter, frame, line, &map, -5, 0);
     return 0;
 }
@@ -837,7 +1009,7 @@ void paint_cap(const painter_t *painter, int frame, double cap[4])
     double p[4];
 
     if (cap[3] >= 1.0) return;
-    if (!cap_intersects_cap(painter->clip_info[frame].bounding_cap, cap))
+    if (!cap_intersects_cap(get_clip_info(painter, frame)->bounding_cap, cap))
         return;
 
     vec3_copy(cap, p);
@@ -872,11 +1044,11 @@ void paint_3d_model(const painter_t *painter, const char *model,
 }
 
 
-void painter_project_ellipse(const painter_t *painter, int frame,
-        float ra, float de, float angle, float size_x, float size_y,
-        double win_pos[2], double win_size[2], double *win_angle)
+int painter_get_ellipse_points(float ra, float de, float angle,
+                               float size_x, float size_y, double pts[3][3])
 {
-    double p[4], c[4], a[4], b[4], mat[3][3];
+    double mat[3][3], axis[3][3];
+    int flags = 0;
 
     assert(!isnan(ra));
     assert(!isnan(de));
@@ -888,57 +1060,84 @@ void painter_project_ellipse(const painter_t *painter, int frame,
         if (isnan(angle))
             angle = 0;
     }
+    if (isnan(angle)) flags |= ELLIPSE_NO_ANGLE;
 
     // 1. Center.
-    vec4_set(p, 1, 0, 0, 0);
     mat3_set_identity(mat);
     mat3_rz(ra, mat, mat);
     mat3_ry(-de, mat, mat);
-    mat3_mul_vec3(mat, p, p);
-    convert_frame(painter->obs, frame, FRAME_VIEW, true, p, p);
-    project_to_win(painter->proj, p, c);
+    mat3_mul_vec3(mat, VEC(1, 0, 0), pts[0]);
 
     // Point ellipse.
     if (size_x == 0) {
-        vec2_copy(c, win_pos);
-        vec2_set(win_size, 0, 0);
-        *win_angle = 0;
-        return;
+        vec3_copy(pts[0], pts[1]);
+        vec3_copy(pts[0], pts[2]);
+        return flags | ELLIPSE_POINT;
     }
 
-    // 2. Semi major.
-    vec4_set(p, 1, 0, 0, 0);
-    mat3_set_identity(mat);
-    mat3_rz(ra, mat, mat);
-    mat3_ry(-de, mat, mat);
     if (!isnan(angle)) mat3_rx(-angle, mat, mat);
     mat3_iscale(mat, 1.0, size_y / size_x, 1.0);
-    mat3_rz(size_x / 2.0, mat, mat);
-    mat3_mul_vec3(mat, p, p);
-    vec3_normalize(p, p);
-    convert_frame(painter->obs, frame, FRAME_VIEW, true, p, p);
-    project_to_win(painter->proj, p, a);
+
+    // 2. Semi major.
+    mat3_rz(size_x / 2.0, mat, axis);
+    mat3_mul_vec3(axis, VEC(1, 0, 0), pts[1]);
+    vec3_normalize(pts[1], pts[1]);
 
     // 3. Semi minor.
-    vec4_set(p, 1, 0, 0, 0);
-    mat3_set_identity(mat);
-    mat3_rz(ra, mat, mat);
-    mat3_ry(-de, mat, mat);
-    if (!isnan(angle)) mat3_rx(-angle, mat, mat);
-    mat3_iscale(mat, 1.0, size_y / size_x, 1.0);
-    mat3_rx(-M_PI / 2, mat, mat);
-    mat3_rz(size_x / 2.0, mat, mat);
-    mat3_mul_vec3(mat, p, p);
-    vec3_normalize(p, p);
-    convert_frame(painter->obs, frame, FRAME_VIEW, true, p, p);
-    project_to_win(painter->proj, p, b);
+    mat3_rx(-M_PI / 2, mat, axis);
+    mat3_rz(size_x / 2.0, axis, axis);
+    mat3_mul_vec3(axis, VEC(1, 0, 0), pts[2]);
+    vec3_normalize(pts[2], pts[2]);
 
-    vec2_copy(c, win_pos);
-    vec2_sub(a, c, a);
-    vec2_sub(b, c, b);
-    *win_angle = isnan(angle) ? 0 : atan2(a[1], a[0]);
-    win_size[0] = 2 * vec2_norm(a);
-    win_size[1] = 2 * vec2_norm(b);
+    return flags;
+}
+
+void painter_project_ellipses(const painter_t *painter, int frame, int n,
+                              const double (*pts)[3][3], const int *flags,
+                              double (*win_pos)[2], double (*win_size)[2],
+                              double *win_angle)
+{
+    int i;
+    double (*view)[3][3], c[4], a[4], b[4];
+    bool *visible;
+    size_t mark = frame_alloc_mark();
+
+    view = frame_alloc(n * sizeof(*view));
+    visible = frame_alloc(n * 3 * sizeof(*visible));
+    painter_to_view_batch(painter, frame, n * 3, (const double (*)[3])pts,
+                          true, false, (double (*)[3])view, visible);
+    for (i = 0; i < n; i++) {
+        project_to_win(painter->proj, view[i][0], c);
+        vec2_copy(c, win_pos[i]);
+        // Point ellipse.
+        if (flags[i] & ELLIPSE_POINT) {
+            vec2_set(win_size[i], 0, 0);
+            win_angle[i] = 0;
+            continue;
+        }
+        project_to_win(painter->proj, view[i][1], a);
+        project_to_win(painter->proj, view[i][2], b);
+        vec2_sub(a, c, a);
+        vec2_sub(b, c, b);
+        win_angle[i] = (flags[i] & ELLIPSE_NO_ANGLE) ? 0 : atan2(a[1], a[0]);
+        win_size[i][0] = 2 * vec2_norm(a);
+        win_size[i][1] = 2 * vec2_norm(b);
+    }
+    frame_alloc_rewind(mark);
+}
+
+void painter_project_ellipse(const painter_t *painter, int frame,
+        float ra, float de, float angle, float size_x, float size_y,
+        double win_pos[2], double win_size[2], double *win_angle)
+{
+    double pts[3][3];
+    int flags;
+
+    flags = painter_get_ellipse_points(ra, de, angle, size_x, size_y, pts);
+    painter_project_ellipses(painter, frame, 1,
+                             (const double (*)[3][3])pts, &flags,
+                             (double (*)[2])win_pos, (double (*)[2])win_size,
+                             win_angle);
 }
 
 /*
@@ -966,6 +1165,76 @@ bool painter_project(const painter_t *painter, int frame,
     return is_visible_win(v, painter->proj->window_size);
 }
 
+int painter_to_view_batch(const painter_t *painter, int frame, int n,
+                          const double (*pos)[3], bool at_inf,
+                          bool clip_first, double (*view_pos)[3],
+                          bool *visible)
+{
+    int i, nb = 0, lin_frame;
+    double v[3], mat[3][3];
+    const observer_t *obs = painter->obs;
+    // Without refraction, all the conversions after the astrometric to
+    // apparent correction are rotations that we can combine into a single
+    // matrix.
+    bool linear = !obs->pressure ||
+                  (frame >= FRAME_OBSERVED && frame != FRAME_ECLIPTIC);
+
+    if (linear) {
+        lin_frame = (frame == FRAME_ASTROM) ? FRAME_ICRF : frame;
+        for (i = 0; i < 3; i++) {
+            vec3_set(v, i == 0, i == 1, i == 2);
+            convert_frame(obs, lin_frame, FRAME_VIEW, true, v, v);
+            mat[i][0] = v[0];
+            mat[i][1] = v[1];
+            mat[i][2] = v[2];
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        visible[i] = false;
+        if (clip_first &&
+                painter_is_point_clipped_fast(painter, frame, pos[i], at_inf))
+            continue;
+        if (linear) {
+            vec3_copy(pos[i], v);
+            if (frame == FRAME_ASTROM)
+                astrometric_to_apparent(obs, v, at_inf, v);
+            mat3_mul_vec3(mat, v, view_pos[i]);
+        } else {
+            convert_frame(obs, frame, FRAME_VIEW, at_inf, pos[i],
+                          view_pos[i]);
+        }
+        visible[i] = true;
+        nb++;
+    }
+    return nb;
+}
+
+int painter_project_batch(const painter_t *painter, int frame, int n,
+                          const double (*pos)[3], bool at_inf,
+                          bool clip_first, double (*win_pos)[2],
+                          bool *visible)
+{
+    int i, nb = 0;
+    double (*view)[3], v[3];
+    size_t mark = frame_alloc_mark();
+
+    view = frame_alloc(n * sizeof(*view));
+    painter_to_view_batch(painter, frame, n, pos, at_inf, clip_first,
+                          view, visible);
+    for (i = 0; i < n; i++) {
+        if (!visible[i]) continue;
+        visible[i] = false;
+        if (!project_to_win(painter->proj, view[i], v))
+            continue;
+        vec2_copy(v, win_pos[i]);
+        visible[i] = is_visible_win(v, painter->proj->window_size);
+        nb += visible[i];
+    }
+    frame_alloc_rewind(mark);
+    return nb;
+}
+
 bool painter_unproject(const painter_t *painter, int frame,
                      const double win_pos[2], double pos[3]) {
     double p[4] = {win_pos[0], win_pos[1], 0};
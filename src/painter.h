@@ -24,6 +24,7 @@ typedef struct point point_t;
 typedef struct point_3d point_3d_t;
 typedef struct texture texture_t;
 typedef struct renderer renderer_t;
+typedef struct static_mesh static_mesh_t;
 
 // Base font size in pixels
 #define FONT_SIZE_BASE 15
@@ -75,6 +76,7 @@ struct point
     double  size;       // Radius in window pixel (pixel with density scale).
     uint8_t color[4];
     const obj_t *obj;
+    const void *source; // Optional catalog record in obj (see areas.h).
 };
 
 struct point_3d
@@ -83,6 +85,7 @@ struct point_3d
     double  size;       // Radius in window pixel (pixel with density scale).
     uint8_t color[4];
     const obj_t *obj;
+    const void *source; // Optional catalog record in obj (see areas.h).
 };
 
 // Painter flags
@@ -105,8 +108,47 @@ enum {
 enum {
     PAINTER_TEX_COLOR = 0,
     PAINTER_TEX_NORMAL = 1,
+    // Texture composited over the color texture in the same pass, with
+    // its own color (painter.layer_color).  Only used by the quads.
+    PAINTER_TEX_LAYER = 2,
 };
 
+/*
+ * Type: painter_clip_t
+ * Clipping info of a frame rendering, shared by all the painters.
+ *
+ * The painters only keep a pointer to it, so that the copies of a painter
+ * don't need to duplicate the caps.  See <painter_update_clip_info>.
+ */
+typedef struct painter_clip_info {
+    // Viewport caps for fast clipping test.
+    double bounding_cap[4];
+
+    // 4 caps representing the 4 sides of the viewport
+    double viewport_caps[4][4];
+    int nb_viewport_caps;
+
+    // Sky above ground cap for fast clipping test.
+    // The cap is pointing up, and has an angle of 91 deg (1 deg margin to
+    // take refraction into account).
+    double sky_cap[4];
+} painter_clip_info_t;
+
+typedef struct painter_clip {
+    painter_clip_info_t frames[FRAMES_NB];
+    // Id of the clip info, used to share the healpix tiles clipping tests
+    // of a frame between all the layers.
+    int id;
+} painter_clip_t;
+
+/*
+ * Type: painter_t
+ * The state used by the paint functions.
+ *
+ * The modules often copy the painter to change the color or the flags, so
+ * we try to keep it small: everything that is constant during a frame is
+ * only referenced by pointer (observer, projection, clipping info).
+ */
 struct painter
 {
     renderer_t      *rend;          // The render used.
@@ -135,21 +177,13 @@ struct painter
         int type;
         texture_t *tex;
         double mat[3][3];
-    } textures[2];
-
-    struct {
-        // Viewport caps for fast clipping test.
-        double bounding_cap[4];
+    } textures[3];
 
-        // 4 caps representing the 4 sides of the viewport
-        double viewport_caps[4][4];
-        int nb_viewport_caps;
+    double          layer_color[4]; // Color of the PAINTER_TEX_LAYER tex.
 
-        // Sky above ground cap for fast clipping test.
-        // The cap is pointing up, and has an angle of 91 deg (1 deg margin to
-        // take refraction into account).
-        double sky_cap[4];
-    } clip_info[FRAMES_NB];
+    // Clipping info, NULL if not computed, in which case nothing is
+    // clipped.
+    const painter_clip_t *clip;
 
     union {
         // For planet rendering only.
@@ -160,17 +194,21 @@ struct painter
             int             shadow_spheres_nb;
             double          (*shadow_spheres)[4]; // pos + radius.
             texture_t       *shadow_color_tex; // Used for lunar eclipses.
+            // Rings casting shadow on the planet, in the xy plane of the
+            // model, with their opacity profile in the texture alpha.
+            texture_t       *rings_tex;
+            double          rings_radii[2]; // Inner and outer (AU).
             float           scale; // The fake scale we used.
             float           min_brightness;
         } planet;
 
         // For atmosphere rendering only.
+        // The sky chromaticity LUT is set as the color texture.
         struct {
-            // All the factors for A. J. Preetham model:
-            //   Ax, Bx, Cx, Dx, Ex, kx,
-            //   Ay, By, Cy, Dy, Ey, ky,
-            float p[12];
-            float sun[3]; // Sun position.
+            float sun[3];   // Sun position.
+            float moon[3];  // Moon position.
+            // Skybrightness model terms, see atmosphere.c.
+            float sb[8];
             // Callback to compute the luminosity at a given point.
             float (*compute_lum)(void *user, const float pos[3]);
             void *user;
@@ -306,6 +344,26 @@ int paint_linestring(const painter_t *painter, int frame,
 int paint_mesh(const painter_t *painter, int frame, int mode,
                const mesh_t *mesh);
 
+/*
+ * Function: paint_static_mesh
+ * Render all the features of a static mesh
+ *
+ * Contrary to <paint_mesh>, the meshes are not clipped nor cut at the
+ * projection discontinuities, so this should only be used with projections
+ * without discontinuity.
+ *
+ * Parameters:
+ *   painter        - A painter instance.
+ *   frame          - Frame of the vertex coordinates.
+ *   mode           - MODE_TRIANGLES, MODE_LINES or MODE_POINTS.
+ *   mesh           - A static mesh.
+ *
+ * Return:
+ *   0 on success, or -1 if the renderer doesn't support static meshes.
+ */
+int paint_static_mesh(const painter_t *painter, int frame, int mode,
+                      static_mesh_t *mesh);
+
 
 int paint_text_bounds(const painter_t *painter, const char *text,
                       const double win_pos[2],
@@ -386,6 +444,9 @@ bool painter_is_quad_clipped(const painter_t *painter, int frame,
 //  A clipped tile is guaranteed to be not visible, but it is not guaranteed
 //  that a non visible tile is clipped.  So this function can return false
 //  even though a tile is not actually visible.
+//
+//  If the painter has the PAINTER_HIDE_BELOW_HORIZON flag, the tiles
+//  entirely below the horizon are also clipped.
 bool painter_is_healpix_clipped(const painter_t *painter, int frame,
                                 int order, int pix);
 
@@ -474,14 +535,16 @@ bool painter_is_2d_circle_clipped(const painter_t *painter, const double p[2],
 bool painter_is_cap_clipped(const painter_t *painter, int frame,
                             const double cap[4]);
 
-// Function: painter_update_caps
+// Function: painter_update_clip_info
 //
 // Update the bounding caps for each reference frames.
 // Must be called after painter creation to allow for fast clipping tests.
 //
 // Parameters:
 //  painter       - The painter.
-void painter_update_clip_info(painter_t *painter);
+//  clip          - Where to store the clipping info.  Must stay valid
+//                  as long as the painter or any of its copies is used.
+void painter_update_clip_info(painter_t *painter, painter_clip_t *clip);
 
 /*
  * Function: paint_orbit
@@ -594,6 +657,55 @@ void painter_project_ellipse(const painter_t *painter, int frame,
         float ra, float de, float angle, float size_x, float size_y,
         double win_pos[2], double win_size[2], double *win_angle);
 
+// Flags returned by painter_get_ellipse_points.
+enum {
+    ELLIPSE_POINT       = 1 << 0, // Zero size ellipse.
+    ELLIPSE_NO_ANGLE    = 1 << 1, // No orientation, win_angle is zero.
+};
+
+/*
+ * Function: painter_get_ellipse_points
+ * Compute the center and axes points of an ellipse defined on the sphere.
+ *
+ * The points only depend on the ellipse, so they can be computed once
+ * and then projected many times with <painter_project_ellipses>.
+ *
+ * Parameters:
+ *   ra         - First spherical pos (rad).
+ *   de         - Second spherical pos (rad).
+ *   angle      - The ellipse angle w.r.t ra axis (rad).
+ *   size_x     - The ellipse large size (rad).
+ *   size_y     - The ellipse small size (rad).
+ *   pts        - Output center, semi major and semi minor points.
+ *
+ * Returns:
+ *   A combination of the ELLIPSE_ flags.
+ */
+int painter_get_ellipse_points(float ra, float de, float angle,
+                               float size_x, float size_y, double pts[3][3]);
+
+/*
+ * Function: painter_project_ellipses
+ * Project an array of ellipses to the screen.
+ *
+ * Same as calling <painter_project_ellipse> on each ellipse, but with the
+ * frame rotations combined once for all the points.
+ *
+ * Parameters:
+ *   painter    - The painter.
+ *   frame      - The frame in which the ellipses are defined
+ *   n          - Number of ellipses.
+ *   pts        - The ellipses points, from <painter_get_ellipse_points>.
+ *   flags      - The ellipses flags, from <painter_get_ellipse_points>.
+ *   win_pos    - The ellipses centers in screen coordinates (px).
+ *   win_size   - The ellipses sizes in screen coordinates (px).
+ *   win_angle  - The ellipses angles in screen coordinates (radian).
+ */
+void painter_project_ellipses(const painter_t *painter, int frame, int n,
+                              const double (*pts)[3][3], const int *flags,
+                              double (*win_pos)[2], double (*win_size)[2],
+                              double *win_angle);
+
 /*
  * Function: painter_project
  * Project a point defined on the sphere to the screen.
@@ -614,6 +726,57 @@ void painter_project_ellipse(const painter_t *painter, int frame,
 bool painter_project(const painter_t *painter, int frame, const double pos[3],
                      bool at_inf, bool clip_first, double win_pos[2]);
 
+/*
+ * Function: painter_to_view_batch
+ * Convert an array of points to the view frame, with optional clipping.
+ *
+ * The frame rotations are combined once for the whole batch when possible.
+ * This can be used to let the renderer do the projection on the GPU.
+ *
+ * Parameters:
+ *   painter    - The painter.
+ *   frame      - The frame in which the points are defined.
+ *   n          - Number of points.
+ *   pos        - The points 3D coordinates.
+ *   at_inf     - true for fixed objects (far away from the solar system).
+ *   clip_first - If a point is identified as clipped, skip its conversion.
+ *   view_pos   - The points positions in the view frame.
+ *   visible    - Set to true for each point that is not clipped.
+ *
+ * Returns:
+ *   The number of non clipped points.
+ */
+int painter_to_view_batch(const painter_t *painter, int frame, int n,
+                          const double (*pos)[3], bool at_inf,
+                          bool clip_first, double (*view_pos)[3],
+                          bool *visible);
+
+/*
+ * Function: painter_project_batch
+ * Project an array of points defined on the sphere to the screen.
+ *
+ * Same as calling <painter_project> on each point, but the frame rotations
+ * are combined once for the whole batch when possible (see
+ * <painter_to_view_batch>).
+ *
+ * Parameters:
+ *   painter    - The painter.
+ *   frame      - The frame in which the points are defined.
+ *   n          - Number of points.
+ *   pos        - The points 3D coordinates.
+ *   at_inf     - true for fixed objects (far away from the solar system).
+ *   clip_first - If a point is identified as clipped, skip its projection.
+ *   win_pos    - The points positions in screen coordinates (px).
+ *   visible    - Set to true for each point that is not clipped.
+ *
+ * Returns:
+ *   The number of non clipped points.
+ */
+int painter_project_batch(const painter_t *painter, int frame, int n,
+                          const double (*pos)[3], bool at_inf,
+                          bool clip_first, double (*win_pos)[2],
+                          bool *visible);
+
 
 /*
  * Function: painter_unproject
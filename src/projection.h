@@ -32,6 +32,7 @@ enum {
     PROJ_MERCATOR,
     PROJ_HAMMER,
     PROJ_MOLLWEIDE,
+    PROJ_FISHEYE,
     PROJ_COUNT,
 };
 
@@ -0,0 +1,93 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "swe.h"
+
+/*
+ * Fisheye (azimuthal equidistant) projection.
+ *
+ * The distance to the center of the projection is proportional to the
+ * angle θ from the view direction:
+ *
+ *     x' = θ * x / sqrt(x² + y²)
+ *     y' = θ * y / sqrt(x² + y²)
+ *
+ * This is the projection used by the planetarium dome masters: with a
+ * square window, a fov of 180° and the view pointing to the zenith, the
+ * disk inscribed in the window maps the full dome.
+ *
+ * The point opposite to the view direction (0, 0, 1) is a discontinuity.
+ */
+
+static bool proj_fisheye_project(const double v[3], double out[3])
+{
+    double d, r, theta;
+
+    d = vec3_norm(v);
+    vec3_mul(1. / d, v, out);
+    r = sqrt(out[0] * out[0] + out[1] * out[1]);
+    theta = atan2(r, -out[2]);
+    // Discontinuity case.
+    if (r == 0.0 && out[2] > 0) {
+        memset(out, 0, 3 * sizeof(double));
+        return false;
+    }
+    if (r != 0.0) {
+        out[0] *= theta / r;
+        out[1] *= theta / r;
+    }
+    out[2] = -1;
+    vec3_mul(d, out, out);
+    return true;
+}
+
+static bool proj_fisheye_backward(const double v[3], double out[3])
+{
+    double theta, s;
+
+    theta = sqrt(v[0] * v[0] + v[1] * v[1]);
+    s = theta ? sin(theta) / theta : 1.0;
+    out[0] = v[0] * s;
+    out[1] = v[1] * s;
+    out[2] = -cos(theta);
+    return theta <= M_PI;
+}
+
+static void proj_fisheye_compute_fov(int id, double fov, double aspect,
+                                     double *fovx, double *fovy)
+{
+    if (aspect < 1) {
+        *fovx = fov;
+        *fovy = fov / aspect;
+    } else {
+        *fovy = fov;
+        *fovx = fov * aspect;
+    }
+}
+
+static void proj_fisheye_init(projection_t *p, double fovy, double aspect)
+{
+    // The perspective matrix maps the projected y = fovy / 2 value to the
+    // top of the window.
+    double fovy2 = 2 * atan(fovy / 2);
+    const double clip_near = 5 * DM2AU;
+    mat4_inf_perspective(p->mat, fovy2 * DR2D, aspect, clip_near);
+}
+
+static const projection_klass_t proj_fisheye_klass = {
+    .name           = "fisheye",
+    .id             = PROJ_FISHEYE,
+    .max_fov        = 360. * DD2R,
+    .max_ui_fov     = 360. * DD2R,
+    .init           = proj_fisheye_init,
+    .project        = proj_fisheye_project,
+    .backward       = proj_fisheye_backward,
+    .compute_fovs   = proj_fisheye_compute_fov,
+};
+PROJECTION_REGISTER(proj_fisheye_klass);
@@ -0,0 +1,65 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "quality.h"
+#include "utils/profiler.h"
+#include "utils/utils.h"
+
+#include <math.h>
+
+// Speed of the level changes (per sec).  We go down faster than we go up,
+// to avoid oscillating around the budget.
+#define DOWN_SPEED  0.25
+#define UP_SPEED    0.05
+
+// We only raise the level when the frames are well below the budget.
+#define HEADROOM    0.75
+
+// Number of samples needed before we start to adjust the level.
+#define MIN_SAMPLES 16
+
+void quality_init(quality_t *q, double budget)
+{
+    q->enabled = true;
+    q->budget = budget;
+    q->level = 1.0;
+}
+
+bool quality_update(quality_t *q, double dt)
+{
+    double avg, level = q->level;
+
+    q->updates++;
+    if (!q->enabled) return false;
+    if (profiler_get("frame/interval", &avg, NULL) < MIN_SAMPLES)
+        return false;
+    if (avg > q->budget)
+        level -= DOWN_SPEED * dt;
+    else if (avg < q->budget * HEADROOM)
+        level += UP_SPEED * dt;
+    level = clamp(level, 0, 1);
+    if (level == q->level) return false;
+    q->level = level;
+    return true;
+}
+
+void quality_on_render(quality_t *q, double time)
+{
+    if (q->updates == 1 && q->last_frame)
+        profiler_add("frame/interval", time - q->last_frame);
+    q->last_frame = time;
+    q->updates = 0;
+}
+
+double quality_get(const quality_t *q, int feature)
+{
+    // Each feature is degraded in its own slice of the level range.
+    double start = 1.0 - (double)(feature + 1) / QUALITY_COUNT;
+    return clamp((q->level - start) * QUALITY_COUNT, 0, 1);
+}
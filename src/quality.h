@@ -0,0 +1,90 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <stdbool.h>
+
+/*
+ * File: quality.h
+ * Adaptive rendering quality.
+ *
+ * We keep a single quality level, from 0 (lowest) to 1 (full quality),
+ * that goes down when the frames take longer than a given budget, and
+ * slowly comes back up when we have some headroom.  Each feature that can
+ * be degraded gets its own factor from this level, so that we first
+ * reduce the cheap to lose features, one after the other, in the order of
+ * the QUALITY_ enum.
+ */
+
+enum {
+    QUALITY_STARS,      // Stars limiting magnitude.
+    QUALITY_HIPS,       // Survey tiles render order.
+    QUALITY_LINES,      // Grid lines subdivisions.
+    QUALITY_ATMOSPHERE, // Atmosphere grid resolution.
+    QUALITY_RESOLUTION, // Internal rendering resolution.
+    QUALITY_COUNT
+};
+
+typedef struct quality {
+    bool    enabled;    // Automatically adjust the level.
+    double  budget;     // Target frame duration (sec).
+    double  level;      // From 0 (lowest) to 1 (full quality).
+    double  last_frame; // Time of the last rendered frame.
+    int     updates;    // Number of updates since the last rendered frame.
+} quality_t;
+
+/*
+ * Function: quality_init
+ * Initialize a quality controller, with full quality.
+ *
+ * Parameters:
+ *   budget - Target frame duration (sec).
+ */
+void quality_init(quality_t *q, double budget);
+
+/*
+ * Function: quality_update
+ * Adjust the quality level from the frame durations.
+ *
+ * To be called once per update.  The frame durations come from the
+ * 'frame/interval' profiler timer, added by <quality_on_render>.
+ *
+ * Return:
+ *   True if the level changed.
+ */
+bool quality_update(quality_t *q, double dt);
+
+/*
+ * Function: quality_on_render
+ * Record a rendered frame.
+ *
+ * We only add a sample to the frame duration timer if the previous frame
+ * was also rendered, since the client can skip the rendering of frames
+ * where nothing changed.
+ *
+ * Parameters:
+ *   time - Current time (sec).
+ */
+void quality_on_render(quality_t *q, double time);
+
+/*
+ * Function: quality_get
+ * Get the quality factor for a given feature.
+ *
+ * Parameters:
+ *   feature - One of the QUALITY_ enum value.
+ *
+ * Return:
+ *   A value from 0 (lowest quality) to 1 (full quality).
+ */
+double quality_get(const quality_t *q, int feature);
+
+#endif // QUALITY_H
@@ -0,0 +1,182 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * The render functions just forward the calls to the renderer backend.
+ */
+
+#include "render.h"
+#include "swe.h"
+
+void render_release(renderer_t *rend)
+{
+    if (!rend) return;
+    if (!rend->backend->release) {
+        LOG_W("Renderer doesn't support release");
+        return;
+    }
+    rend->backend->release(rend);
+}
+
+void render_get_stats(const renderer_t *rend, render_stats_t *stats)
+{
+    rend->backend->get_stats(rend, stats);
+}
+
+void render_set_sky_scale(renderer_t *rend, double scale)
+{
+    if (rend->backend->set_sky_scale)
+        rend->backend->set_sky_scale(rend, scale);
+}
+
+int render_release_caches(renderer_t *rend, bool dry_run)
+{
+    if (!rend->backend->release_caches) return 0;
+    return rend->backend->release_caches(rend, dry_run);
+}
+
+void render_prepare(renderer_t *rend,
+                    const projection_t *proj,
+                    double win_w, double win_h, double scale,
+                    bool cull_flipped)
+{
+    rend->backend->prepare(rend, proj, win_w, win_h, scale, cull_flipped);
+}
+
+void render_finish(renderer_t *rend)
+{
+    rend->backend->finish(rend);
+}
+
+bool render_read_pixels(renderer_t *rend, int w, int h, uint8_t *out)
+{
+    if (!rend->backend->read_pixels) return false;
+    return rend->backend->read_pixels(rend, w, h, out);
+}
+
+bool render_measure_luminance(renderer_t *rend, double *value)
+{
+    if (!rend->backend->measure_luminance) return false;
+    return rend->backend->measure_luminance(rend, value);
+}
+
+bool render_pick(renderer_t *rend, const double pos[2], double max_dist,
+                 obj_t **obj)
+{
+    if (obj) *obj = NULL;
+    if (!rend->backend->pick) return false;
+    return rend->backend->pick(rend, pos, max_dist, obj);
+}
+
+void render_set_late_view(renderer_t *rend, const double rot[3][3],
+                          const double win[3][3])
+{
+    if (rend->backend->set_late_view)
+        rend->backend->set_late_view(rend, rot, win);
+}
+
+void render_context_restored(renderer_t *rend)
+{
+    if (rend->backend->context_restored)
+        rend->backend->context_restored(rend);
+}
+
+void render_points_2d(renderer_t *rend, const painter_t *painter,
+                      int n, const point_t *points)
+{
+    rend->backend->points_2d(rend, painter, n, points);
+}
+
+void render_points_3d(renderer_t *rend, const painter_t *painter,
+                      int n, const point_3d_t *points)
+{
+    rend->backend->points_3d(rend, painter, n, points);
+}
+
+void render_quad(renderer_t *rend, const painter_t *painter,
+                 int frame, int grid_size, const uv_map_t *map)
+{
+    rend->backend->quad(rend, painter, frame, grid_size, map);
+}
+
+void render_texture(renderer_t *rend, texture_t *tex,
+                    const double uv[4][2], const double pos[2], double size,
+                    const double color[4], double angle)
+{
+    rend->backend->texture(rend, tex, uv, pos, size, color, angle);
+}
+
+void render_text(renderer_t *rend, const painter_t *painter,
+                 const char *text, const double win_pos[2],
+                 const double view_pos[3],
+                 int align, int effects, double size,
+                 const double color[4], double angle,
+                 double bounds[4])
+{
+    rend->backend->text(rend, painter, text, win_pos, view_pos, align,
+                        effects, size, color, angle, bounds);
+}
+
+void render_line(renderer_t *rend, const painter_t *painter,
+                 const double (*pos)[3], const double (*win)[3], int size)
+{
+    rend->backend->line(rend, painter, pos, win, size);
+}
+
+void render_mesh(renderer_t *rend, const painter_t *painter,
+                 int frame, int mode, int verts_count,
+                 const double verts[][3], int indices_count,
+                 const uint16_t indices[], bool use_stencil)
+{
+    rend->backend->mesh(rend, painter, frame, mode, verts_count, verts,
+                        indices_count, indices, use_stencil);
+}
+
+int render_static_mesh(renderer_t *rend, const painter_t *painter,
+                       int frame, int mode, static_mesh_t *mesh)
+{
+    if (!rend->backend->static_mesh) return -1;
+    return rend->backend->static_mesh(rend, painter, frame, mode, mesh);
+}
+
+int render_orbit(renderer_t *rend, const painter_t *painter,
+                 const double focus[3], const double axes[2][3], double e)
+{
+    if (!rend->backend->orbit) return -1;
+    return rend->backend->orbit(rend, painter, focus, axes, e);
+}
+
+void render_ellipse_2d(renderer_t *rend, const painter_t *painter,
+                       const double pos[2], const double size[2],
+                       double angle, double dashes)
+{
+    rend->backend->ellipse_2d(rend, painter, pos, size, angle, dashes);
+}
+
+void render_rect_2d(renderer_t *rend, const painter_t *painter,
+                    const double pos[2], const double size[2],
+                    double angle)
+{
+    rend->backend->rect_2d(rend, painter, pos, size, angle);
+}
+
+void render_line_2d(renderer_t *rend, const painter_t *painter,
+                    const double p1[2], const double p2[2])
+{
+    rend->backend->line_2d(rend, painter, p1, p2);
+}
+
+void render_model_3d(renderer_t *rend, const painter_t *painter,
+                     const char *model, const double model_mat[4][4],
+                     const double view_mat[4][4], const double proj_mat[4][4],
+                     const double light_dir[3], const json_value *args)
+{
+    rend->backend->model_3d(rend, painter, model, model_mat, view_mat,
+                            proj_mat, light_dir, args);
+}
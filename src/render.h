@@ -23,10 +23,175 @@ typedef struct uv_map uv_map_t;
 typedef struct texture texture_t;
 typedef struct projection projection_t;
 typedef struct obj obj_t;
+typedef struct static_mesh static_mesh_t;
 
-// TODO: document those functions.
+/*
+ * Type: render_stats_t
+ * Statistics of the last rendered frame.
+ *
+ * Attributes:
+ *   items           - Number of render items flushed.
+ *   draw_calls      - Number of OpenGL draw calls (excluding nanovg).
+ *   program_changes - Number of times we switched the shader program.
+ *   vertices        - Number of vertices sent to the GPU.
+ *   bytes           - Size of the vertex and index data sent to the GPU.
+ */
+typedef struct render_stats {
+    int items;
+    int draw_calls;
+    int program_changes;
+    int vertices;
+    int bytes;
+} render_stats_t;
+
+/*
+ * Type: render_backend_t
+ * Table of functions implemented by a renderer backend.
+ *
+ * All the render_xxx functions just forward to the backend of the
+ * renderer, see the functions documentation below.  The release,
+ * set_sky_scale, release_caches, read_pixels, measure_luminance, pick,
+ * set_late_view, context_restored, static_mesh and orbit functions can be
+ * NULL if the backend doesn't support them.
+ */
+typedef struct render_backend {
+    void (*prepare)(renderer_t *rend, const projection_t *proj,
+                    double win_w, double win_h, double scale,
+                    bool cull_flipped);
+    void (*finish)(renderer_t *rend);
+    void (*get_stats)(const renderer_t *rend, render_stats_t *stats);
+    void (*release)(renderer_t *rend);
+    void (*set_sky_scale)(renderer_t *rend, double scale);
+    int (*release_caches)(renderer_t *rend, bool dry_run);
+    bool (*read_pixels)(renderer_t *rend, int w, int h, uint8_t *out);
+    bool (*measure_luminance)(renderer_t *rend, double *value);
+    bool (*pick)(renderer_t *rend, const double pos[2], double max_dist,
+                 obj_t **obj);
+    void (*set_late_view)(renderer_t *rend, const double rot[3][3],
+                          const double win[3][3]);
+    void (*context_restored)(renderer_t *rend);
+    void (*points_2d)(renderer_t *rend, const painter_t *painter,
+                      int n, const point_t *points);
+    void (*points_3d)(renderer_t *rend, const painter_t *painter,
+                      int n, const point_3d_t *points);
+    void (*quad)(renderer_t *rend, const painter_t *painter,
+                 int frame, int grid_size, const uv_map_t *map);
+    void (*texture)(renderer_t *rend, texture_t *tex,
+                    const double uv[4][2], const double pos[2], double size,
+                    const double color[4], double angle);
+    void (*text)(renderer_t *rend, const painter_t *painter,
+                 const char *text, const double win_pos[2],
+                 const double view_pos[3],
+                 int align, int effects, double size,
+                 const double color[4], double angle,
+                 double bounds[4]);
+    void (*line)(renderer_t *rend, const painter_t *painter,
+                 const double (*pos)[3], const double (*win)[3], int size);
+    void (*mesh)(renderer_t *rend, const painter_t *painter,
+                 int frame, int mode, int verts_count,
+                 const double verts[][3], int indices_count,
+                 const uint16_t indices[], bool use_stencil);
+    int (*static_mesh)(renderer_t *rend, const painter_t *painter,
+                       int frame, int mode, static_mesh_t *mesh);
+    int (*orbit)(renderer_t *rend, const painter_t *painter,
+                 const double focus[3], const double axes[2][3], double e);
+    void (*ellipse_2d)(renderer_t *rend, const painter_t *painter,
+                       const double pos[2], const double size[2],
+                       double angle, double dashes);
+    void (*rect_2d)(renderer_t *rend, const painter_t *painter,
+                    const double pos[2], const double size[2],
+                    double angle);
+    void (*line_2d)(renderer_t *rend, const painter_t *painter,
+                    const double p1[2], const double p2[2]);
+    void (*model_3d)(renderer_t *rend, const painter_t *painter,
+                     const char *model, const double model_mat[4][4],
+                     const double view_mat[4][4],
+                     const double proj_mat[4][4],
+                     const double light_dir[3], const json_value *args);
+} render_backend_t;
+
+/*
+ * Type: renderer_t
+ * Base structure of all the renderers.
+ *
+ * The backends put it as the first attribute of their own structure.
+ */
+struct renderer {
+    const render_backend_t *backend;
+};
+
+/*
+ * Function: render_create
+ * Create the default OpenGL renderer.
+ */
+renderer_t *render_create(void);
+
+/*
+ * Function: render_create_null
+ * Create a renderer that doesn't render anything.
+ *
+ * The renderer only counts the items, vertices and bytes it receives, so
+ * that we can profile the CPU side of the rendering without a GPU.  This
+ * also sets the textures in headless mode (see <texture_set_headless>).
+ *
+ * The items, vertices and bytes stats count the render calls before any
+ * batching, so they are not directly comparable with the GL renderer ones.
+ */
+renderer_t *render_create_null(void);
+
+/*
+ * Function: render_create_recorder
+ * Create a renderer that saves all the render calls into a file.
+ *
+ * Parameters:
+ *   path - Path of the output file.  See render_record.c for the format.
+ *   next - Optional renderer that also gets all the calls, so that we can
+ *          record while rendering normally.  Can be NULL.  It is released
+ *          with the recorder.
+ *
+ * Return:
+ *   The new renderer, or NULL if we couldn't open the file.
+ */
+renderer_t *render_create_recorder(const char *path, renderer_t *next);
 
-renderer_t* render_create(void);
+/*
+ * Function: render_release
+ * Release a renderer, if its backend supports it.
+ */
+void render_release(renderer_t *rend);
+
+void render_get_stats(const renderer_t *rend, render_stats_t *stats);
+
+/*
+ * Function: render_set_sky_scale
+ * Set the resolution factor of the sky rendering.
+ *
+ * With a value lower than one, the backend renders everything except the
+ * texts and the vector graphics into an offscreen buffer at this fraction
+ * of the framebuffer resolution.  It then upscales the buffer and renders
+ * the overlays at the native resolution.  This trades some sharpness for
+ * a lot less fill rate on high dpi screens.
+ *
+ * The value is used from the next call to <render_prepare>.  Backends
+ * that don't support it ignore it.
+ */
+void render_set_sky_scale(renderer_t *rend, double scale);
+
+/*
+ * Function: render_release_caches
+ * Release the cached text textures and metrics of the backend.
+ *
+ * They are recreated as needed for the next frames.  Should not be called
+ * between <render_prepare> and <render_finish>.
+ *
+ * Parameters:
+ *   rend     - A renderer.
+ *   dry_run  - If set, don't release anything, only return the size.
+ *
+ * Return:
+ *   The size in bytes of the released data.
+ */
+int render_release_caches(renderer_t *rend, bool dry_run);
 
 void render_prepare(renderer_t *rend,
                     const projection_t *proj,
@@ -35,6 +200,99 @@ void render_prepare(renderer_t *rend,
 
 void render_finish(renderer_t *rend);
 
+/*
+ * Function: render_read_pixels
+ * Read back the rendered image, after <render_finish>.
+ *
+ * Parameters:
+ *   rend   - A renderer.
+ *   w      - Width of the framebuffer.
+ *   h      - Height of the framebuffer.
+ *   out    - Output RGBA buffer of size w * h * 4, with the first row at
+ *            the top of the image.
+ *
+ * Return:
+ *   false if the backend doesn't support it.
+ */
+bool render_read_pixels(renderer_t *rend, int w, int h, uint8_t *out);
+
+/*
+ * Function: render_measure_luminance
+ * Get the average luminance of the sky as measured on the GPU.
+ *
+ * Calling this asks the backend to reduce the rendered sky (without the
+ * overlays) to its average display value during the next frame.  The
+ * results are read back a few frames later to avoid stalling the GPU, so
+ * the returned value is the one of an older frame.  The measure stops as
+ * soon as a frame is rendered without calling this function.
+ *
+ * Parameters:
+ *   rend   - A renderer.
+ *   value  - Output linear display value (after tonemapping, without the
+ *            gamma), from 0 to 1.
+ *
+ * Return:
+ *   false if there is no value available yet, or if the backend doesn't
+ *   support it.
+ */
+bool render_measure_luminance(renderer_t *rend, double *value);
+
+/*
+ * Function: render_pick
+ * Get the point rendered at a window position, using an object ids buffer
+ * rendered on the GPU.
+ *
+ * Calling this asks the backend to render the ids of the points with an
+ * attached object into a small buffer around the position during the next
+ * frame.  Those points are then not added to the core areas anymore.  As
+ * for <render_measure_luminance>, the buffer is read back a few frames
+ * later, and the ids stop being rendered as soon as a frame is rendered
+ * without calling this function.
+ *
+ * Parameters:
+ *   rend     - A renderer.
+ *   pos      - Position in window coordinates.
+ *   max_dist - Max distance between the position and the point.
+ *   obj      - Output object of the closest point, or NULL if there is
+ *              none.  Must be released with obj_release.  Can be NULL to
+ *              only request the ids buffer.
+ *
+ * Return:
+ *   false if no ids buffer around the position is available yet, or if the
+ *   backend doesn't support it.
+ */
+bool render_pick(renderer_t *rend, const double pos[2], double max_dist,
+                 obj_t **obj);
+
+/*
+ * Function: render_set_late_view
+ * Correct the view orientation of everything rendered since the last
+ * <render_prepare>.
+ *
+ * This is for the late latching of the inputs: the items are sent with the
+ * view of the start of the frame, and just before <render_finish> we can
+ * still apply the latest camera rotation.  The 3d items get the exact
+ * rotation, the 2d items (already in window coordinates) an affine
+ * approximation of it.  The correction is reset at each <render_prepare>.
+ *
+ * Parameters:
+ *   rend   - A renderer.
+ *   rot    - Rotation from the painter view frame to the new view frame.
+ *   win    - Affine transformation of the window coordinates.
+ */
+void render_set_late_view(renderer_t *rend, const double rot[3][3],
+                          const double win[3][3]);
+
+/*
+ * Function: render_context_restored
+ * Create the GPU state again after the GL context was lost and restored.
+ *
+ * The renderer forgets all its objects of the lost context, without trying
+ * to delete them, and recreates the ones it cannot create lazily (like the
+ * nanovg context with its fonts).
+ */
+void render_context_restored(renderer_t *rend);
+
 void render_points_2d(renderer_t *rend, const painter_t *painter,
                       int n, const point_t *points);
 
@@ -63,6 +321,45 @@ void render_mesh(renderer_t *rend, const painter_t *painter,
                  const double verts[][3], int indices_count,
                  const uint16_t indices[], bool use_stencil);
 
+/*
+ * Function: render_static_mesh
+ * Render all the features of a static mesh for a given mode.
+ *
+ * The triangles and points use the features fill color, and the lines the
+ * features stroke color, multiplied by the painter color.  The mesh must
+ * stay alive until the end of the frame.
+ *
+ * Return:
+ *   0 on success, or -1 if the renderer doesn't support static meshes, in
+ *   which case the caller should render the meshes with <render_mesh>.
+ */
+int render_static_mesh(renderer_t *rend, const painter_t *painter,
+                       int frame, int mode, static_mesh_t *mesh);
+
+/*
+ * Function: render_orbit
+ * Render an elliptic orbit line, computed by the renderer.
+ *
+ * The renderer batches all the orbits with the same painter lines
+ * attributes, so that we can render a lot of them at once.  The orbit
+ * far side is faded, as with the paint_orbit lines.
+ *
+ * Parameters:
+ *   rend       - A renderer.
+ *   painter    - The painter, for the color, lines width and flags.
+ *   focus      - Position of the orbit focus in the view frame.
+ *   axes       - Semi-major axis vector, toward the periapsis, and
+ *                semi-minor axis vector, toward the direction of the
+ *                motion, in the view frame.
+ *   e          - Eccentricity, smaller than one.
+ *
+ * Return:
+ *   0 on success, or -1 if the renderer doesn't support it, in which case
+ *   the caller should render the orbit with <render_line>.
+ */
+int render_orbit(renderer_t *rend, const painter_t *painter,
+                 const double focus[3], const double axes[2][3], double e);
+
 void render_ellipse_2d(renderer_t *rend, const painter_t *painter,
                        const double pos[2], const double size[2],
                        double angle, double dashes);
@@ -10,8 +10,8 @@
 #include "render.h"
 #include "swe.h"
 
-#include "line_mesh.h"
 #include "shader_cache.h"
+#include "static_mesh.h"
 #include "utils/gl.h"
 
 #ifdef GLES2
@@ -24,8 +24,50 @@
 
 #include <float.h>
 
+// GPU timer queries, only on the web, since the native GLES libraries
+// don't export the extension functions.
+#if defined(__EMSCRIPTEN__) && defined(GL_EXT_disjoint_timer_query)
+#   define HAS_GPU_TIMER 1
+#else
+#   define HAS_GPU_TIMER 0
+#endif
+
+// Instanced draws, part of WebGL2, GLES3 and OpenGL 3.3.  On the web we
+// use the GLES2 headers, where they are only declared by the ANGLE
+// extension, that emscripten maps to the WebGL2 functions.
+#if defined(__EMSCRIPTEN__) && defined(GL_ANGLE_instanced_arrays)
+#   define glDrawArraysInstanced glDrawArraysInstancedANGLE
+#   define glVertexAttribDivisor glVertexAttribDivisorANGLE
+#   define HAS_INSTANCING 1
+#elif !defined(GLES2) && !defined(__APPLE__)
+#   define HAS_INSTANCING 1
+#else
+#   define HAS_INSTANCING 0
+#endif
+
 #define GRID_CACHE_SIZE (2 * (1 << 20))
 
+// Number of segments of the orbits lines evaluated by the GPU.
+#define ORBIT_SEGMENTS 256
+
+// Luminance reduction: size of the first level (each level is four times
+// smaller), number of levels above 1x1, and number of 1x1 results.
+#define LUM_SIZE    64
+#define LUM_LEVELS  3
+#define LUM_RING    3
+
+// Object ids buffer: size in pixels of the area rendered around the picked
+// position, number of buffers in flight, and max number of ids per frame
+// (the ids are stored in the 24 bits of the RGB values).
+#define PICK_SIZE   128
+#define PICK_RING   2
+#define PICK_MAX_ID 0xffffff
+
+// Not defined in the GLES2 headers, but supported by WebGL2 and GLES3.
+#ifndef GL_DEPTH24_STENCIL8
+#   define GL_DEPTH24_STENCIL8 0x88F0
+#endif
+
 // Fix GL_PROGRAM_POINT_SIZE support on Mac.
 #ifdef __APPLE__
 #   define GL_PROGRAM_POINT_SIZE GL_PROGRAM_POINT_SIZE_EXT
@@ -45,9 +87,15 @@ enum {
     ATTR_TANGENT,
     ATTR_COLOR,
     ATTR_SKY_POS,
-    ATTR_LUMINANCE,
     ATTR_SIZE,
     ATTR_WPOS,
+    ATTR_PREV_POS,
+    ATTR_NEXT_POS,
+    ATTR_HALO,
+    ATTR_LAYER_TEX_POS,
+    ATTR_ID,
+    ATTR_AXIS_A,
+    ATTR_AXIS_B,
 };
 
 static const char *ATTR_NAMES[] = {
@@ -58,30 +106,58 @@ static const char *ATTR_NAMES[] = {
     [ATTR_TANGENT]      = "a_tangent",
     [ATTR_COLOR]        = "a_color",
     [ATTR_SKY_POS]      = "a_sky_pos",
-    [ATTR_LUMINANCE]    = "a_luminance",
     [ATTR_SIZE]         = "a_size",
     [ATTR_WPOS]         = "a_wpos",
+    [ATTR_PREV_POS]     = "a_prev_pos",
+    [ATTR_NEXT_POS]     = "a_next_pos",
+    [ATTR_HALO]         = "a_halo",
+    [ATTR_LAYER_TEX_POS] = "a_layer_tex_pos",
+    [ATTR_ID]           = "a_id",
+    [ATTR_AXIS_A]       = "a_axis_a",
+    [ATTR_AXIS_B]       = "a_axis_b",
     NULL,
 };
 
 // We keep all the text textures in a cache so that we don't have to recreate
-// them each time.
+// them each time.  The cache is hashed on a key built from the text and its
+// rendering attributes, and entries not used for TEX_CACHE_MAX_AGE frames
+// get released.
+#define TEX_CACHE_MAX_AGE 60
+
+// The flushed items are kept in a pool with their buffers, so that the next
+// frames can reuse them without any allocation.  Items not reused for
+// ITEMS_POOL_MAX_AGE frames get released.
+#define ITEMS_POOL_MAX_AGE 8
+
+// Number of vertices of the items used to batch the reorderable textured
+// quads.
+#define QUAD_BATCH_SIZE 4096
+
 typedef struct tex_cache tex_cache_t;
 struct tex_cache {
-    tex_cache_t *next, *prev;
-    double      size;
-    char        *text;
-    int         effects;
-    bool        in_use;
+    UT_hash_handle hh;
+    char        *key;
+    int         last_used; // Frame of last use.
     int         xoff;
     int         yoff;
-    double      color[3];
     texture_t   *tex;
 };
 
+// Same thing for the nanovg text metrics, that are needed both to get the
+// labels bounds and to render them.
+typedef struct text_metrics text_metrics_t;
+struct text_metrics {
+    UT_hash_handle hh;
+    char        *key;
+    int         last_used; // Frame of last use.
+    float       bounds[4]; // Unaligned bounds, relative to the text origin.
+    float       descender;
+};
+
 enum {
     ITEM_LINES = 1,
     ITEM_MESH,
+    ITEM_STATIC_MESH,
     ITEM_POINTS,
     ITEM_POINTS_3D,
     ITEM_TEXTURE,
@@ -94,6 +170,8 @@ enum {
     ITEM_VG_LINE,
     ITEM_TEXT,
     ITEM_GLTF,
+    ITEM_ORBITS,
+    ITEM_TYPES_COUNT
 };
 
 typedef struct item item_t;
@@ -106,6 +184,7 @@ struct item
     gl_buf_t    indices;
     texture_t   *tex;
     int         flags;
+    bool        overlay; // Rendered at native resolution, after the sky.
 
     union {
         struct {
@@ -125,6 +204,10 @@ struct item
             float contrast;
             texture_t *normalmap;
             texture_t *shadow_color_tex;
+            texture_t *rings_tex;
+            float rings_center[3];
+            float rings_normal[3];
+            float rings_radii[2];
             float mv[16];
             float sun[4]; // pos + radius.
             float light_emit[3];
@@ -146,8 +229,14 @@ struct item
         } vg;
 
         struct {
-            float p[12];    // Color computation coefs.
+            texture_t *tex; // Composited over the item texture.
+            float color[4];
+        } layer;
+
+        struct {
             float sun[3];   // Sun position.
+            float moon[3];  // Moon position.
+            float sb[8];    // Skybrightness model terms.
         } atm;
 
         struct {
@@ -168,6 +257,18 @@ struct item
             bool use_stencil;
         } mesh;
 
+        struct {
+            static_mesh_t *mesh; // Referenced until the item is released.
+            int mode;
+            float stroke_width;
+            bool use_stencil;
+            bool refraction;
+            double mat[3][3];   // To view, or to observed geom.
+            double ro2v[3][3];  // Observed to view, with refraction only.
+            float refa_refb[2];
+            float blink;
+        } static_mesh;
+
         struct {
             const char *model;
             double model_mat[4][4];
@@ -178,7 +279,8 @@ struct item
         } gltf;
     };
 
-    item_t *next, *prev;
+    int     last_used; // Frame of release, when in the pool.
+    item_t  *next, *prev;
 };
 
 static const gl_buf_info_t INDICES_BUF = {
@@ -196,30 +298,58 @@ static const gl_buf_info_t MESH_BUF = {
     },
 };
 
+// The lines are extruded in the shader: each point is added twice with the
+// previous and next points of the line, and the signed half width in the
+// second texture coordinate.
 static const gl_buf_info_t LINES_BUF = {
-    .size = 28,
+    .size = 44,
     .attrs = {
         [ATTR_POS]      = {GL_FLOAT, 3, false, 0},
-        [ATTR_WPOS]     = {GL_FLOAT, 2, false, 12},
-        [ATTR_TEX_POS]  = {GL_FLOAT, 2, false, 20},
+        [ATTR_PREV_POS] = {GL_FLOAT, 3, false, 12},
+        [ATTR_NEXT_POS] = {GL_FLOAT, 3, false, 24},
+        [ATTR_TEX_POS]  = {GL_FLOAT, 2, false, 36},
+    },
+};
+
+// The orbits instances, see orbits.glsl.  The vertices of the orbits
+// shared lines strip only have the eccentric anomaly and the side.
+static const gl_buf_info_t ORBIT_BUF = {
+    .size = 44,
+    .attrs = {
+        [ATTR_POS]      = {GL_FLOAT, 4, false, 0},
+        [ATTR_AXIS_A]   = {GL_FLOAT, 3, false, 16},
+        [ATTR_AXIS_B]   = {GL_FLOAT, 3, false, 28},
+        [ATTR_COLOR]    = {GL_UNSIGNED_BYTE, 4, true, 40},
+    },
+};
+
+static const gl_buf_info_t ORBIT_STRIP_BUF = {
+    .size = 8,
+    .attrs = {
+        [ATTR_TEX_POS]  = {GL_FLOAT, 2, false, 0},
     },
 };
 
+// The id is only used by the object ids buffer, see render_pick.
 static const gl_buf_info_t POINTS_BUF = {
-    .size = 16,
+    .size = 24,
     .attrs = {
         [ATTR_POS]      = {GL_FLOAT, 2, false, 0},
         [ATTR_SIZE]     = {GL_FLOAT, 1, false, 8},
         [ATTR_COLOR]    = {GL_UNSIGNED_BYTE, 4, true, 12},
+        [ATTR_HALO]     = {GL_FLOAT, 1, false, 16},
+        [ATTR_ID]       = {GL_UNSIGNED_BYTE, 4, true, 20},
     },
 };
 
 static const gl_buf_info_t POINTS_3D_BUF = {
-    .size = 20,
+    .size = 28,
     .attrs = {
         [ATTR_POS]      = {GL_FLOAT, 3, false, 0},
         [ATTR_SIZE]     = {GL_FLOAT, 1, false, 12},
         [ATTR_COLOR]    = {GL_UNSIGNED_BYTE, 4, true, 16},
+        [ATTR_HALO]     = {GL_FLOAT, 1, false, 20},
+        [ATTR_ID]       = {GL_UNSIGNED_BYTE, 4, true, 24},
     },
 };
 
@@ -231,6 +361,16 @@ static const gl_buf_info_t TEXTURE_BUF = {
     },
 };
 
+// Textured quads with a second texture composited over the first one.
+static const gl_buf_info_t TEXTURE_LAYER_BUF = {
+    .size = 28,
+    .attrs = {
+        [ATTR_POS]              = {GL_FLOAT, 3, false, 0},
+        [ATTR_TEX_POS]          = {GL_FLOAT, 2, false, 12},
+        [ATTR_LAYER_TEX_POS]    = {GL_FLOAT, 2, false, 20},
+    },
+};
+
 static const gl_buf_info_t TEXTURE_2D_BUF = {
     .size = 28,
     .attrs = {
@@ -253,11 +393,10 @@ static const gl_buf_info_t PLANET_BUF = {
 };
 
 static const gl_buf_info_t ATMOSPHERE_BUF = {
-    .size = 28,
+    .size = 24,
     .attrs = {
         [ATTR_POS]       = {GL_FLOAT, 3, false, 0},
         [ATTR_SKY_POS]   = {GL_FLOAT, 3, false, 12},
-        [ATTR_LUMINANCE] = {GL_FLOAT, 1, false, 24},
     },
 };
 
@@ -269,29 +408,178 @@ static const gl_buf_info_t FOG_BUF = {
     },
 };
 
-struct renderer {
+// Object referenced by an id of the object ids buffer.
+typedef struct pick_obj {
+    obj_t       *obj;
+    const void  *source; // Optional catalog record, as for the areas.
+} pick_obj_t;
+
+// Ids of a frame.
+typedef struct pick_ids {
+    pick_obj_t  *objs;  // Index of the id minus one.
+    int         nb;
+    int         size;   // Allocated size.
+} pick_ids_t;
+
+typedef struct renderer_gl renderer_gl_t;
+struct renderer_gl {
+    renderer_t base; // Must be first.
 
     projection_t proj;
     int     fb_size[2];
     double  scale;
     bool    cull_flipped;
 
+    // Native framebuffer size and scale, used for the overlays.  They are
+    // the same as fb_size and scale, unless we render the sky into the
+    // lower resolution sky_fb buffer.
+    int     ui_fb_size[2];
+    double  ui_scale;
+
     double  depth_min;
     double  depth_max;
 
+    // Late correction of the view, see render_set_late_view.
+    struct {
+        double  rot[3][3];  // Rotation of the view positions.
+        double  win[3][3];  // Affine transformation in window coordinates.
+        double  ndc[3][3];  // Same thing in NDC coordinates.
+    } late;
+
+    // Set if the vertex shaders can read textures, as needed by the
+    // static meshes.
+    bool    has_vertex_textures;
+    bool    has_instancing; // Needed by the orbits.
+
+    // Lines strip shared by all the orbits instances.
+    struct {
+        GLuint      vbo;
+        gl_buf_t    buf;
+    } orbit_strip;
+
     texture_t   *white_tex;
     tex_cache_t *tex_cache;
+    text_metrics_t *text_metrics;
     NVGcontext *vg;
 
-    // Nanovg fonts references for regular and bold.
+    // Nanovg fonts references for regular and bold.  Set to -1 until we
+    // use the font.
     struct {
         int   id;
         bool  is_default_font; // Set only for the original default fonts.
     } fonts[2];
+    bool    default_fonts_loaded;
+    // Fonts added with core_add_font, that we add again to the new nanovg
+    // context after a GL context loss.
+    struct {
+        int             font;
+        const uint8_t   *data;
+        int             size;
+    } *added_fonts;
+    int     added_fonts_nb;
 
     item_t  *items;
+    item_t  *items_pool[ITEM_TYPES_COUNT]; // Released items, per type.
     cache_t *grid_cache;
-
+    int     frame; // Incremented at each render_prepare.
+    // Projection for which all the warmup shaders are ready.
+    int     warmup_done_proj;
+
+    // Pools of GL buffer objects reused from frame to frame, one per
+    // target (WebGL doesn't allow to rebind a buffer to another target).
+    // Each flush takes the buffers in order, so that we only call
+    // glGenBuffers when a frame uses more buffers than the previous ones.
+    struct {
+        GLenum  target;
+        int     nb;
+        int     used;
+        struct {
+            GLuint  id;
+            int     size; // Allocated size in bytes.
+        } *bufs;
+    } vbos[2];
+
+    // Currently used program during a flush, or 0 if unknown.
+    GLint           prog;
+    render_stats_t  frame_stats; // Stats of the current flush.
+    render_stats_t  stats;       // Stats of the last flush.
+
+    // Offscreen buffer to render the sky at a lower resolution.  See
+    // render_set_sky_scale.
+    struct {
+        double      scale;  // Requested resolution factor.
+        GLuint      fbo;
+        GLuint      tex;
+        GLuint      depth;  // Depth and stencil renderbuffer.
+        int         size[2];
+        bool        failed; // Set if the driver doesn't support it.
+        bool        used;   // Set if the current frame renders into it.
+        gl_buf_t    buf;    // Fullscreen quad used for the upscale.
+        gl_buf_t    indices;
+    } sky_fb;
+
+    // Offscreen buffer to render the atmosphere and fog at a reduced
+    // resolution, see atm_fb_begin.
+    struct {
+        GLuint      fbo;
+        GLuint      tex;
+        int         size[2];
+        bool        failed; // Set if the driver doesn't support it.
+        bool        active; // Set while we render into it.
+        GLint       prev_fbo;
+        gl_buf_t    buf;    // Fullscreen quad used for the upsample.
+        gl_buf_t    indices;
+    } atm_fb;
+
+    // Reduction of the sky buffer to its average luminance, see
+    // render_measure_luminance.  The last level is a ring of 1x1 buffers,
+    // so that we only read back the results a few frames later, once the
+    // GPU is done with them.
+    struct {
+        int         frame;  // Last frame the measure was requested.
+        bool        active; // Set if we measure the current frame.
+        GLuint      tex[LUM_LEVELS + LUM_RING];
+        GLuint      fbo[LUM_LEVELS + LUM_RING];
+        int         pos;    // Ring index of the next measure.
+        int         nb;     // Number of measures in flight.
+        bool        failed;
+        bool        has_value;
+        double      value;
+    } lum;
+
+    // Object ids buffer, see render_pick.  The points ids are rendered
+    // into a ring of small buffers around the picked position, read back a
+    // few frames later.  Each buffer keeps the objects of its frame ids
+    // until then, so that we only resolve the picked one.
+    struct {
+        int         frame;  // Last frame the pick was requested.
+        bool        active; // Set if we render the ids of the current frame.
+        bool        failed;
+        double      pos[2]; // Last picked position, in window coordinates.
+        pick_ids_t  ids;    // Ids of the current frame.
+        struct {
+            GLuint      fbo;
+            GLuint      tex;
+            int         origin[2];  // Framebuffer pos of the first pixel.
+            int         fb_h;       // Framebuffer height.
+            double      scale;      // Framebuffer pixels per window unit.
+            pick_ids_t  ids;
+        } bufs[PICK_RING + 1];      // The last one is the read back result.
+        int         ring;   // Ring index of the next buffer.
+        int         nb;     // Number of buffers in flight.
+        uint8_t     *pixels; // Read back RGBA values, or NULL.
+    } pick;
+
+#if HAS_GPU_TIMER
+    // Ring of GPU timer queries.  The results are only available a few
+    // frames later, so we keep several in flight.
+    struct {
+        GLuint  ids[4];
+        int     pos;    // Index of the next query to use.
+        int     nb;     // Number of queries waiting for their result.
+        bool    active;
+    } gpu_timer;
+#endif
 };
 
 // Weak linking, so that we can put the implementation in a module.
@@ -306,13 +594,115 @@ int gltf_render(const char *url,
     return 0;
 }
 
+/*
+ * Bind a shader program, unless it's already the current one.
+ */
+static void use_program(renderer_gl_t *rend, const gl_shader_t *shader)
+{
+    if (rend->prog == shader->prog) return;
+    GL(glUseProgram(shader->prog));
+    rend->prog = shader->prog;
+    rend->frame_stats.program_changes++;
+}
+
+#if HAS_GPU_TIMER
+static bool has_timer_query(void)
+{
+    static int ret = -1;
+    const char *exts;
+    if (ret == -1) {
+        exts = (const char*)glGetString(GL_EXTENSIONS);
+        ret = exts && strstr(exts, "_disjoint_timer_query");
+    }
+    return ret;
+}
+#endif
+
+#if HAS_INSTANCING
+// Instancing is always there with WebGL2 and the GL versions that have
+// the functions, otherwise we need the extension.
+static bool has_instancing(void)
+{
+    const char *version, *exts;
+    int major = 0;
+
+    exts = (const char*)glGetString(GL_EXTENSIONS);
+    if (exts && strstr(exts, "_instanced_arrays")) return true;
+    version = (const char*)glGetString(GL_VERSION);
+    if (!version) return false;
+    if (sscanf(version, "OpenGL ES %d", &major) != 1)
+        sscanf(version, "%d", &major);
+    return major >= 3;
+}
+
+static void set_attribs_divisor(const gl_buf_info_t *info, int divisor)
+{
+    int i;
+    for (i = 0; i < ARRAY_SIZE(info->attrs); i++) {
+        if (info->attrs[i].size) GL(glVertexAttribDivisor(i, divisor));
+    }
+}
+#endif
+
+/*
+ * Start measuring the GPU time of the flush, and report the results of the
+ * previous frames to the profiler as the 'gpu/render' timer.
+ * Only supported with the EXT_disjoint_timer_query extension.
+ */
+static void gpu_timer_begin(renderer_gl_t *rend)
+{
+#if HAS_GPU_TIMER
+    const int n = ARRAY_SIZE(rend->gpu_timer.ids);
+    GLint disjoint = 0;
+    GLuint available;
+    GLuint64 ns;
+    int i;
+
+    if (!has_timer_query()) return;
+    if (!rend->gpu_timer.ids[0])
+        GL(glGenQueriesEXT(n, rend->gpu_timer.ids));
+    // If disjoint is set the results are unreliable (e.g. the GPU changed
+    // frequency), so we just drop them.
+    GL(glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint));
+    while (rend->gpu_timer.nb) {
+        i = (rend->gpu_timer.pos - rend->gpu_timer.nb + n) % n;
+        GL(glGetQueryObjectuivEXT(rend->gpu_timer.ids[i],
+                    GL_QUERY_RESULT_AVAILABLE_EXT, &available));
+        if (!available) break;
+        GL(glGetQueryObjectui64vEXT(rend->gpu_timer.ids[i],
+                    GL_QUERY_RESULT_EXT, &ns));
+        if (!disjoint) profiler_add("gpu/render", ns / 1e9);
+        rend->gpu_timer.nb--;
+    }
+    if (rend->gpu_timer.nb == n) return; // All the queries are in flight.
+    GL(glBeginQueryEXT(GL_TIME_ELAPSED_EXT,
+                       rend->gpu_timer.ids[rend->gpu_timer.pos]));
+    rend->gpu_timer.active = true;
+#endif
+}
+
+static void gpu_timer_end(renderer_gl_t *rend)
+{
+#if HAS_GPU_TIMER
+    const int n = ARRAY_SIZE(rend->gpu_timer.ids);
+    if (!rend->gpu_timer.active) return;
+    GL(glEndQueryEXT(GL_TIME_ELAPSED_EXT));
+    rend->gpu_timer.pos = (rend->gpu_timer.pos + 1) % n;
+    rend->gpu_timer.nb++;
+    rend->gpu_timer.active = false;
+#endif
+}
+
 static void init_shader(gl_shader_t *shader)
 {
-    // Set some common uniforms.
+    // Set some common uniforms.  Note: this changes the current program,
+    // but it's always called just before we use the shader.
     GL(glUseProgram(shader->prog));
     gl_update_uniform(shader, "u_tex", 0);
     gl_update_uniform(shader, "u_normal_tex", 1);
+    gl_update_uniform(shader, "u_layer_tex", 1);
     gl_update_uniform(shader, "u_shadow_color_tex", 2);
+    gl_update_uniform(shader, "u_ring_tex", 3);
 }
 
 static bool color_is_white(const float c[4])
@@ -341,7 +731,7 @@ static double proj_get_depth(const projection_t *proj,
  * Return the current flush projection, with depth range sets to infinity
  * if we did not enable the depth
  */
-static projection_t rend_get_proj(const renderer_t *rend, int flags)
+static projection_t rend_get_proj(const renderer_gl_t *rend, int flags)
 {
     const double eps = 0.000001;
     const double nearval = 5 * DM2AU;
@@ -355,30 +745,395 @@ static projection_t rend_get_proj(const renderer_t *rend, int flags)
     return proj;
 }
 
-static void window_to_ndc(renderer_t *rend,
+/*
+ * Set the projection uniforms of a shader that uses projections.glsl.
+ */
+static void set_proj_uniforms(const renderer_gl_t *rend, gl_shader_t *shader,
+                              int flags)
+{
+    projection_t proj = rend_get_proj(rend, flags);
+    gl_update_uniform_mat4(shader, "u_proj_mat", proj.mat);
+    gl_update_uniform_mat3(shader, "u_view_late", rend->late.rot);
+}
+
+static void window_to_ndc(renderer_gl_t *rend,
                           const double win[2], double ndc[2])
 {
     ndc[0] = (win[0] * rend->scale / rend->fb_size[0]) * 2 - 1;
     ndc[1] = 1 - (win[1] * rend->scale / rend->fb_size[1]) * 2;
 }
 
-void render_prepare(renderer_t *rend, const projection_t *proj,
-                    double win_w, double win_h,
-                    double scale, bool cull_flipped)
+/*
+ * Start to compile the shaders that we usually only need after a while
+ * (when we look at a planet, or enable the atmosphere), so that they are
+ * ready when we need them.
+ */
+static void warmup_shaders(renderer_gl_t *rend)
 {
-    tex_cache_t *ctex;
+    int proj = rend->proj.klass->id;
+    shader_define_t defines[] = {{"PROJ", proj}, {}};
+    shader_define_t shadow_defines[] = {{"HAS_SHADOW", 1}, {"PROJ", proj}, {}};
+    bool ready = true;
+
+    // Only until they are all ready, so that we don't keep the shaders of
+    // the previous projections in use in the shaders cache.
+    if (rend->warmup_done_proj == proj) return;
+    ready &= shader_warmup("atmosphere", defines, ATTR_NAMES, init_shader);
+    ready &= shader_warmup("fog", defines, ATTR_NAMES, init_shader);
+    ready &= shader_warmup("upsample", NULL, ATTR_NAMES, init_shader);
+    ready &= shader_warmup("planet", defines, ATTR_NAMES, init_shader);
+    ready &= shader_warmup("planet", shadow_defines, ATTR_NAMES,
+                           init_shader);
+    if (ready) rend->warmup_done_proj = proj;
+}
+
+static void sky_fb_release(renderer_gl_t *rend)
+{
+    if (rend->sky_fb.fbo) GL(glDeleteFramebuffers(1, &rend->sky_fb.fbo));
+    if (rend->sky_fb.tex) GL(glDeleteTextures(1, &rend->sky_fb.tex));
+    if (rend->sky_fb.depth) GL(glDeleteRenderbuffers(1, &rend->sky_fb.depth));
+    rend->sky_fb.fbo = rend->sky_fb.tex = rend->sky_fb.depth = 0;
+    rend->sky_fb.size[0] = rend->sky_fb.size[1] = 0;
+}
+
+// Fill a quad covering the whole viewport.
+static void fullscreen_quad_init(gl_buf_t *buf, gl_buf_t *indices)
+{
+    int i;
+    const int16_t INDICES[6] = {0, 1, 2, 3, 2, 1};
+
+    gl_buf_alloc(buf, &TEXTURE_BUF, 4);
+    gl_buf_alloc(indices, &INDICES_BUF, 6);
+    for (i = 0; i < 4; i++) {
+        gl_buf_3f(buf, -1, ATTR_POS, (i % 2) * 2 - 1, 1 - (i / 2) * 2, 0);
+        gl_buf_2f(buf, -1, ATTR_TEX_POS, i % 2, 1 - i / 2);
+        gl_buf_next(buf);
+    }
+    for (i = 0; i < 6; i++) {
+        gl_buf_1i(indices, -1, 0, INDICES[i]);
+        gl_buf_next(indices);
+    }
+}
+
+/*
+ * Make sure the sky buffer exists with the given size.
+ *
+ * Return false if we cannot create it, in which case we keep rendering
+ * the sky at the native resolution.
+ */
+static bool sky_fb_update(renderer_gl_t *rend, int w, int h)
+{
+    GLint prev_fbo;
+    GLenum status;
+
+    if (rend->sky_fb.failed) return false;
+    if (rend->sky_fb.size[0] == w && rend->sky_fb.size[1] == h) return true;
+    sky_fb_release(rend);
+
+    GL(glGenTextures(1, &rend->sky_fb.tex));
+    GL(glBindTexture(GL_TEXTURE_2D, rend->sky_fb.tex));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA,
+                    GL_UNSIGNED_BYTE, NULL));
+
+    GL(glGenRenderbuffers(1, &rend->sky_fb.depth));
+    GL(glBindRenderbuffer(GL_RENDERBUFFER, rend->sky_fb.depth));
+    // Note: no GL() check here, WebGL1 and some GLES2 drivers don't
+    // support packed depth stencil, in which case the framebuffer won't
+    // be complete.
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h);
+    while (glGetError() != GL_NO_ERROR) {}
+
+    GL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo));
+    GL(glGenFramebuffers(1, &rend->sky_fb.fbo));
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, rend->sky_fb.fbo));
+    GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_TEXTURE_2D, rend->sky_fb.tex, 0));
+    GL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                 GL_RENDERBUFFER, rend->sky_fb.depth));
+    GL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT,
+                                 GL_RENDERBUFFER, rend->sky_fb.depth));
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo));
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        LOG_W("Cannot create sky framebuffer (%s)", gl_enum_str(status));
+        sky_fb_release(rend);
+        rend->sky_fb.failed = true;
+        return false;
+    }
+    rend->sky_fb.size[0] = w;
+    rend->sky_fb.size[1] = h;
+
+    if (!rend->sky_fb.buf.capacity)
+        fullscreen_quad_init(&rend->sky_fb.buf, &rend->sky_fb.indices);
+    return true;
+}
+
+static void atm_fb_release(renderer_gl_t *rend)
+{
+    if (rend->atm_fb.fbo) GL(glDeleteFramebuffers(1, &rend->atm_fb.fbo));
+    if (rend->atm_fb.tex) GL(glDeleteTextures(1, &rend->atm_fb.tex));
+    rend->atm_fb.fbo = rend->atm_fb.tex = 0;
+    rend->atm_fb.size[0] = rend->atm_fb.size[1] = 0;
+}
+
+/*
+ * Make sure the atmosphere buffer exists with the given size.
+ *
+ * Return false if we cannot create it, in which case we render the
+ * atmosphere and fog directly.
+ */
+static bool atm_fb_update(renderer_gl_t *rend, int w, int h)
+{
+    GLint prev_fbo;
+    GLenum status;
+
+    if (rend->atm_fb.failed) return false;
+    if (rend->atm_fb.size[0] == w && rend->atm_fb.size[1] == h) return true;
+    atm_fb_release(rend);
+
+    // We only sample the texels centers in the upsample shader.
+    GL(glGenTextures(1, &rend->atm_fb.tex));
+    GL(glBindTexture(GL_TEXTURE_2D, rend->atm_fb.tex));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA,
+                    GL_UNSIGNED_BYTE, NULL));
+
+    GL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo));
+    GL(glGenFramebuffers(1, &rend->atm_fb.fbo));
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, rend->atm_fb.fbo));
+    GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_TEXTURE_2D, rend->atm_fb.tex, 0));
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo));
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        LOG_W("Cannot create atmosphere framebuffer (%s)",
+              gl_enum_str(status));
+        atm_fb_release(rend);
+        rend->atm_fb.failed = true;
+        return false;
+    }
+    rend->atm_fb.size[0] = w;
+    rend->atm_fb.size[1] = h;
+    if (!rend->atm_fb.buf.capacity)
+        fullscreen_quad_init(&rend->atm_fb.buf, &rend->atm_fb.indices);
+    return true;
+}
+
+static void gl_set_sky_scale(renderer_t *rend_, double scale)
+{
+    renderer_gl_t *rend = (void*)rend_;
+    rend->sky_fb.scale = clamp(scale, 0.25, 1.0);
+}
+
+static void gl_set_late_view(renderer_t *rend_, const double rot[3][3],
+                             const double win[3][3])
+{
+    renderer_gl_t *rend = (void*)rend_;
+    double w = rend->ui_fb_size[0] / rend->ui_scale;
+    double h = rend->ui_fb_size[1] / rend->ui_scale;
+    // Window to NDC coordinates, and back.
+    const double to_ndc[3][3] = {{2 / w, 0, 0}, {0, -2 / h, 0}, {-1, 1, 1}};
+    const double to_win[3][3] = {{w / 2, 0, 0}, {0, -h / 2, 0},
+                                 {w / 2, h / 2, 1}};
+
+    mat3_copy(rot, rend->late.rot);
+    mat3_copy(win, rend->late.win);
+    mat3_mul(win, to_win, rend->late.ndc);
+    mat3_mul(to_ndc, rend->late.ndc, rend->late.ndc);
+}
+
+static int gl_release_caches(renderer_t *rend_, bool dry_run)
+{
+    renderer_gl_t *rend = (void*)rend_;
+    tex_cache_t *ctex, *tmp;
+    text_metrics_t *metrics, *metrics_tmp;
+    int size = 0;
+
+    HASH_ITER(hh, rend->tex_cache, ctex, tmp) {
+        size += ctex->tex->size + sizeof(*ctex) + strlen(ctex->key) + 1;
+        if (dry_run) continue;
+        HASH_DEL(rend->tex_cache, ctex);
+        texture_release(ctex->tex);
+        free(ctex->key);
+        free(ctex);
+    }
+    HASH_ITER(hh, rend->text_metrics, metrics, metrics_tmp) {
+        size += sizeof(*metrics) + strlen(metrics->key) + 1;
+        if (dry_run) continue;
+        HASH_DEL(rend->text_metrics, metrics);
+        free(metrics->key);
+        free(metrics);
+    }
+    return size;
+}
+
+static void pick_ids_clear(pick_ids_t *ids)
+{
+    int i;
+    for (i = 0; i < ids->nb; i++) obj_release(ids->objs[i].obj);
+    ids->nb = 0;
+}
+
+// Drop all the ids buffers in flight and the last result.
+static void pick_reset(renderer_gl_t *rend)
+{
+    int i;
+    for (i = 0; i < ARRAY_SIZE(rend->pick.bufs); i++)
+        pick_ids_clear(&rend->pick.bufs[i].ids);
+    rend->pick.nb = 0;
+    free(rend->pick.pixels);
+    rend->pick.pixels = NULL;
+}
+
+static void gl_prepare(renderer_t *rend_, const projection_t *proj,
+                       double win_w, double win_h,
+                       double scale, bool cull_flipped)
+{
+    renderer_gl_t *rend = (void*)rend_;
+    tex_cache_t *ctex, *tmp;
+    text_metrics_t *metrics, *metrics_tmp;
+    item_t *item, *item_tmp;
+    int i;
 
-    rend->fb_size[0] = win_w * scale;
-    rend->fb_size[1] = win_h * scale;
+    rend->ui_fb_size[0] = win_w * scale;
+    rend->ui_fb_size[1] = win_h * scale;
+    rend->ui_scale = scale;
+    rend->fb_size[0] = rend->ui_fb_size[0];
+    rend->fb_size[1] = rend->ui_fb_size[1];
     rend->scale = scale;
+    // All the sky items use the scale of the sky buffer, so that the
+    // points sizes stay the same in window units.
+    // Only measure the luminance if it was requested since the last frame,
+    // otherwise drop the old results.
+    rend->lum.active = rend->lum.frame == rend->frame;
+    if (!rend->lum.active) {
+        rend->lum.nb = 0;
+        rend->lum.has_value = false;
+    }
+    // Same thing for the object ids buffer.
+    rend->pick.active = rend->pick.frame == rend->frame;
+    if (!rend->pick.active) pick_reset(rend);
+    pick_ids_clear(&rend->pick.ids);
+    // The luminance measure also needs the sky in its own buffer.
+    rend->sky_fb.used = false;
+    if (rend->sky_fb.scale < 1.0 || rend->lum.active) {
+        if (sky_fb_update(rend, win_w * scale * rend->sky_fb.scale,
+                                win_h * scale * rend->sky_fb.scale)) {
+            rend->fb_size[0] = rend->sky_fb.size[0];
+            rend->fb_size[1] = rend->sky_fb.size[1];
+            rend->scale = scale * rend->sky_fb.scale;
+            rend->sky_fb.used = true;
+        }
+    } else if (rend->sky_fb.fbo) {
+        sky_fb_release(rend);
+    }
     rend->cull_flipped = cull_flipped;
     rend->proj = *proj;
-
-    DL_FOREACH(rend->tex_cache, ctex)
-        ctex->in_use = false;
+    mat3_set_identity(rend->late.rot);
+    mat3_set_identity(rend->late.win);
+    mat3_set_identity(rend->late.ndc);
+
+    // Release the text textures we didn't use for a while.
+    rend->frame++;
+    HASH_ITER(hh, rend->tex_cache, ctex, tmp) {
+        if (rend->frame - ctex->last_used <= TEX_CACHE_MAX_AGE) continue;
+        HASH_DEL(rend->tex_cache, ctex);
+        texture_release(ctex->tex);
+        free(ctex->key);
+        free(ctex);
+    }
+    HASH_ITER(hh, rend->text_metrics, metrics, metrics_tmp) {
+        if (rend->frame - metrics->last_used <= TEX_CACHE_MAX_AGE) continue;
+        HASH_DEL(rend->text_metrics, metrics);
+        free(metrics->key);
+        free(metrics);
+    }
+
+    // Same thing for the pooled items.
+    for (i = 0; i < ITEM_TYPES_COUNT; i++) {
+        DL_FOREACH_SAFE(rend->items_pool[i], item, item_tmp) {
+            if (rend->frame - item->last_used <= ITEMS_POOL_MAX_AGE) continue;
+            DL_DELETE(rend->items_pool[i], item);
+            gl_buf_release(&item->buf);
+            gl_buf_release(&item->indices);
+            free(item);
+        }
+    }
 
     rend->depth_min = DBL_MAX;
     rend->depth_max = DBL_MIN;
+
+    warmup_shaders(rend);
+}
+
+/*
+ * Function: item_new
+ * Create a new render item, with its vertex and indice buffers.
+ *
+ * If a pooled item of the same type has buffers with the same layout and
+ * capacity, we reuse it, so that steady frames don't allocate anything.
+ *
+ * Parameters:
+ *   type           - The type of item.
+ *   buf_info       - The vertex buffer layout, or NULL for no buffer.
+ *   buf_size       - The vertex buffer capacity.
+ *   indices_size   - The indice buffer capacity, or 0 for no indices.
+ */
+static item_t *item_new(renderer_gl_t *rend, int type,
+                        const gl_buf_info_t *buf_info, int buf_size,
+                        int indices_size)
+{
+    item_t *item;
+    gl_buf_t buf = {}, indices = {};
+
+    DL_FOREACH(rend->items_pool[type], item) {
+        if (    item->buf.info == buf_info &&
+                item->buf.capacity == (buf_info ? buf_size : 0) &&
+                item->indices.capacity == indices_size)
+            break;
+    }
+    if (item) {
+        DL_DELETE(rend->items_pool[type], item);
+        buf = item->buf;
+        indices = item->indices;
+        buf.nb = indices.nb = 0;
+        memset(item, 0, sizeof(*item));
+    } else {
+        item = calloc(1, sizeof(*item));
+        if (buf_info) gl_buf_alloc(&buf, buf_info, buf_size);
+        if (indices_size) gl_buf_alloc(&indices, &INDICES_BUF, indices_size);
+    }
+    item->type = type;
+    item->buf = buf;
+    item->indices = indices;
+    // Texts and vector graphics are always rendered at native resolution.
+    item->overlay = type == ITEM_TEXT || type == ITEM_VG_ELLIPSE ||
+                    type == ITEM_VG_RECT || type == ITEM_VG_LINE;
+    return item;
+}
+
+// Put back a flushed item into the pool.
+static void item_release(renderer_gl_t *rend, item_t *item)
+{
+    texture_release(item->tex);
+    if (item->type == ITEM_PLANET)
+        texture_release(item->planet.normalmap);
+    if (item->type == ITEM_TEXTURE)
+        texture_release(item->layer.tex);
+    if (item->type == ITEM_STATIC_MESH)
+        static_mesh_release(item->static_mesh.mesh);
+    if (item->type == ITEM_GLTF)
+        json_builder_free(item->gltf.args);
+    item->tex = NULL;
+    item->last_used = rend->frame;
+    DL_PREPEND(rend->items_pool[item->type], item);
 }
 
 /*
@@ -390,7 +1145,7 @@ void render_prepare(renderer_t *rend, const projection_t *proj,
  *   buf_size       - The free vertex buffer size requiered.
  *   indices_size   - The free indice size required.
  */
-static item_t *get_item(renderer_t *rend, int type,
+static item_t *get_item(renderer_gl_t *rend, int type,
                         int buf_size,
                         int indices_size,
                         texture_t *tex)
@@ -414,13 +1169,78 @@ static item_t *get_item(renderer_t *rend, int type,
     return NULL;
 }
 
-void render_points_2d(renderer_t *rend, const painter_t *painter,
-                      int n, const point_t *points)
+/*
+ * Tell if a point is bright enough for its halo to be visible.
+ *
+ * The halos make the points sprites a lot larger than their core, so we
+ * only render them for the brightest points, the other ones get a sprite
+ * just large enough for the core.  This cuts most of the fill rate of the
+ * wide fields with many stars.
+ */
+static bool point_has_halo(const painter_t *painter, const uint8_t color[4])
+{
+    // Max intensity of the halo in the points shader.
+    const double HALO_INTENSITY = 0.08;
+    const double HALO_MIN = 0.02;
+    double v = fmax(fmax(color[0], color[1]), color[2]) / 255.0;
+    return HALO_INTENSITY * v * color[3] / 255.0 * painter->color[3] >=
+           HALO_MIN;
+}
+
+/*
+ * Add an object to the ids of the current frame.
+ *
+ * Return:
+ *   The new id, or zero if we don't render the ids buffer, in which case
+ *   the object should be added to the areas instead.
+ */
+static uint32_t pick_add(renderer_gl_t *rend, const obj_t *obj,
+                         const void *source)
+{
+    pick_ids_t *ids = &rend->pick.ids;
+    if (!rend->pick.active || ids->nb == PICK_MAX_ID) return 0;
+    if (ids->nb == ids->size) {
+        ids->size = ids->size * 2 ?: 1024;
+        ids->objs = realloc(ids->objs, ids->size * sizeof(*ids->objs));
+    }
+    ids->objs[ids->nb].obj = obj_retain(obj);
+    ids->objs[ids->nb].source = source;
+    return ++ids->nb;
+}
+
+/*
+ * Compute the buffer size of a new points item.
+ *
+ * The first item of the frame gets the size of a single render call, and
+ * each new one twice the size of the previous one, up to max_size.  This
+ * way the small points sets don't allocate large buffers, and the large
+ * ones still only need a few draw calls.  The sizes are the same from one
+ * frame to the other, so that the pooled items can be reused.
+ */
+static int points_item_size(const renderer_gl_t *rend, int type,
+                            int min_size, int max_size)
+{
+    const item_t *item;
+    int size = min_size;
+    DL_FOREACH(rend->items, item) {
+        if (item->type == type)
+            size = fmin(item->buf.capacity * 2, max_size);
+    }
+    return size;
+}
+
+static void gl_points_2d(renderer_t *rend_, const painter_t *painter,
+                         int n, const point_t *points)
 {
+    renderer_gl_t *rend = (void*)rend_;
     item_t *item;
     int i;
     const int MAX_POINTS = 4096;
+    // Points are rendered as single vertex sprites, so we can batch a lot
+    // of them in a single draw call (see points_item_size).
+    const int BATCH_SIZE = 16 * MAX_POINTS;
     point_t p;
+    uint32_t id;
 
     if (n > MAX_POINTS) {
         LOG_E("Try to render more than %d points: %d", MAX_POINTS, n);
@@ -434,10 +1254,10 @@ void render_points_2d(renderer_t *rend, const painter_t *painter,
         item = NULL;
 
     if (!item) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_POINTS;
+        item = item_new(rend, ITEM_POINTS, &POINTS_BUF,
+                        points_item_size(rend, ITEM_POINTS, MAX_POINTS,
+                                         BATCH_SIZE), 0);
         item->flags = painter->flags;
-        gl_buf_alloc(&item->buf, &POINTS_BUF, MAX_POINTS);
         vec4_to_float(painter->color, item->color);
         item->points.halo = painter->points_halo;
         DL_APPEND(rend->items, item);
@@ -450,26 +1270,36 @@ void render_points_2d(renderer_t *rend, const painter_t *painter,
         gl_buf_2f(&item->buf, -1, ATTR_POS, VEC2_SPLIT(p.pos));
         gl_buf_1f(&item->buf, -1, ATTR_SIZE, p.size * rend->scale);
         gl_buf_4i(&item->buf, -1, ATTR_COLOR, VEC4_SPLIT(p.color));
+        gl_buf_1f(&item->buf, -1, ATTR_HALO,
+                  point_has_halo(painter, p.color) ? 1 : 0);
+        id = p.obj ? pick_add(rend, p.obj, p.source) : 0;
+        gl_buf_4i(&item->buf, -1, ATTR_ID, id & 0xff, (id >> 8) & 0xff,
+                  id >> 16, id ? 255 : 0);
         gl_buf_next(&item->buf);
 
         // Add the point int the global list of rendered points.
         // XXX: could be done in the painter.
-        if (p.obj) {
+        if (p.obj && !id) {
             p.pos[0] = (+p.pos[0] + 1) / 2 * core->win_size[0];
             p.pos[1] = (-p.pos[1] + 1) / 2 * core->win_size[1];
-            areas_add_circle(core->areas, p.pos, p.size, p.obj);
+            areas_add_circle(core->areas, p.pos, p.size, p.obj, p.source);
         }
     }
 }
 
-void render_points_3d(renderer_t *rend, const painter_t *painter,
-                      int n, const point_3d_t *points)
+static void gl_points_3d(renderer_t *rend_, const painter_t *painter,
+                         int n, const point_3d_t *points)
 {
+    renderer_gl_t *rend = (void*)rend_;
     item_t *item;
     int i;
     const int MAX_POINTS = 4096;
+    // Points are rendered as single vertex sprites, so we can batch a lot
+    // of them in a single draw call (see points_item_size).
+    const int BATCH_SIZE = 16 * MAX_POINTS;
     double win_xy[2], depth;
     point_3d_t p;
+    uint32_t id;
 
     if (n > MAX_POINTS) {
         LOG_E("Try to render more than %d points: %d", MAX_POINTS, n);
@@ -483,10 +1313,10 @@ void render_points_3d(renderer_t *rend, const painter_t *painter,
         item = NULL;
 
     if (!item) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_POINTS_3D;
+        item = item_new(rend, ITEM_POINTS_3D, &POINTS_3D_BUF,
+                        points_item_size(rend, ITEM_POINTS_3D, MAX_POINTS,
+                                         BATCH_SIZE), 0);
         item->flags = painter->flags;
-        gl_buf_alloc(&item->buf, &POINTS_3D_BUF, MAX_POINTS);
         vec4_to_float(painter->color, item->color);
         item->points.halo = painter->points_halo;
         DL_APPEND(rend->items, item);
@@ -497,17 +1327,25 @@ void render_points_3d(renderer_t *rend, const painter_t *painter,
         gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(p.pos));
         gl_buf_1f(&item->buf, -1, ATTR_SIZE, p.size * rend->scale);
         gl_buf_4i(&item->buf, -1, ATTR_COLOR, VEC4_SPLIT(p.color));
+        gl_buf_1f(&item->buf, -1, ATTR_HALO,
+                  point_has_halo(painter, p.color) ? 1 : 0);
+        id = p.obj ? pick_add(rend, p.obj, p.source) : 0;
+        gl_buf_4i(&item->buf, -1, ATTR_ID, id & 0xff, (id >> 8) & 0xff,
+                  id >> 16, id ? 255 : 0);
         gl_buf_next(&item->buf);
 
-        depth = proj_get_depth(painter->proj, p.pos);
-        rend->depth_min = fmin(rend->depth_min, depth);
-        rend->depth_max = fmax(rend->depth_max, depth);
+        if (item->flags & PAINTER_ENABLE_DEPTH) {
+            depth = proj_get_depth(painter->proj, p.pos);
+            rend->depth_min = fmin(rend->depth_min, depth);
+            rend->depth_max = fmax(rend->depth_max, depth);
+        }
 
         // Add the point int the global list of rendered points.
         // XXX: could be done in the painter.
-        if (p.obj) {
+        if (p.obj && !id) {
             project_to_win_xy(painter->proj, p.pos, win_xy);
-            areas_add_circle(core->areas, win_xy, p.size, p.obj);
+            areas_add_circle(core->areas, win_xy, p.size, p.obj,
+                             p.source);
         }
     }
 }
@@ -515,44 +1353,54 @@ void render_points_3d(renderer_t *rend, const painter_t *painter,
 /*
  * Function: get_grid
  * Compute an uv_map grid, and cache it if possible.
+ *
+ * The healpix and ring grids are cached without the map transformation
+ * (used by the planets tiles and rings), that we apply after.
  */
-static const double (*get_grid(renderer_t *rend,
-                               const uv_map_t *map, int split,
-                               bool *should_delete))[4]
+static const double (*get_grid(renderer_gl_t *rend,
+                               const uv_map_t *map, int split))[4]
 {
     int n = split + 1;
-    double (*grid)[4];
+    double (*grid)[4], (*ret)[4];
+    uv_map_t base;
     struct {
         int order;
         int pix;
         int split;
-        int swapped;
-    } key = { map->order, map->pix, split, map->swapped };
-    _Static_assert(sizeof(key) == 16, "");
-    bool can_cache = map->type == UV_MAP_HEALPIX && map->at_infinity;
-
-    *should_delete = !can_cache;
-    if (can_cache) {
-        if (!rend->grid_cache)
-            rend->grid_cache = cache_create(GRID_CACHE_SIZE, 1);
-        grid = cache_get(rend->grid_cache, &key, sizeof(key));
-        if (grid)
-            return grid;
-    }
-
-    grid = malloc(n * n * sizeof(*grid));
-    uv_map_grid(map, split, grid, NULL);
-
-    if (can_cache) {
+        int16_t swapped;
+        int16_t at_infinity;
+        int type;
+        float radii[2];
+    } key = { map->order, map->pix, split, map->swapped, map->at_infinity,
+              map->type, {map->radii[0], map->radii[1]} };
+    _Static_assert(sizeof(key) == 28, "");
+
+    // The grids we cannot cache go into the frame arena.
+    if (map->type != UV_MAP_HEALPIX && map->type != UV_MAP_RING) {
+        grid = frame_alloc(n * n * sizeof(*grid));
+        uv_map_grid(map, split, grid, NULL);
+        return grid;
+    }
+
+    if (!rend->grid_cache)
+        rend->grid_cache = cache_create(GRID_CACHE_SIZE, 1);
+    grid = cache_get(rend->grid_cache, &key, sizeof(key));
+    if (!grid) {
+        base = *map;
+        base.transf = NULL;
+        grid = malloc(n * n * sizeof(*grid));
+        uv_map_grid(&base, split, grid, NULL);
         cache_add(rend->grid_cache, &key, sizeof(key),
                   grid, sizeof(*grid) * n * n, NULL);
     }
+    if (!map->transf) return grid;
 
-    return grid;
+    ret = frame_alloc(n * n * sizeof(*ret));
+    simd_mat4_mul_vec4_n(*map->transf, n * n, (const void*)grid, ret);
+    return ret;
 }
 
-static void compute_tangent(const double uv[2], const uv_map_t *map,
-                            double out[3])
+static void compute_tangent(const double normal[3], double out[3])
 {
     // XXX: this is what the algo should look like, except the normal map
     // texture we use (for the Moon) doesn't follow the healpix projection.
@@ -568,13 +1416,11 @@ static void compute_tangent(const double uv[2], const uv_map_t *map,
     vec3_normalize(tangent, out);
     */
 
-    double p[4] = {0}, n[3];
-    uv_map(map, uv, p, n);
-    vec3_cross(VEC(0, 0, 1), n, out);
+    vec3_cross(VEC(0, 0, 1), normal, out);
 }
 
 static void quad_planet(
-                 renderer_t          *rend,
+                 renderer_gl_t          *rend,
                  const painter_t     *painter,
                  int                 frame,
                  int                 grid_size,
@@ -583,6 +1429,10 @@ static void quad_planet(
     item_t *item;
     int n, i, j, k;
     double p[4], mpos[4], normal[4] = {0}, tangent[4] = {0}, mv[4][4], depth;
+    double ring_normal[3];
+    const double (*grid)[4];
+    uv_map_t base;
+    size_t mark;
 
     // Positions of the triangles in the quads.
     const int INDICES[6][2] = { {0, 0}, {0, 1}, {1, 0},
@@ -590,13 +1440,22 @@ static void quad_planet(
     n = grid_size + 1;
 
     assert(painter->flags & PAINTER_ENABLE_DEPTH);
-    item = calloc(1, sizeof(*item));
-    item->type = ITEM_PLANET;
-    gl_buf_alloc(&item->buf, &PLANET_BUF, n * n * 4);
-    gl_buf_alloc(&item->indices, &INDICES_BUF, n * n * 6);
+    item = item_new(rend, ITEM_PLANET, &PLANET_BUF, n * n * 4, n * n * 6);
     vec4_to_float(painter->color, item->color);
     item->flags = painter->flags;
     item->planet.shadow_color_tex = painter->planet.shadow_color_tex;
+
+    // The rings are in the xy plane of the planet model, the center
+    // doesn't change with the fake scale.
+    assert(map->transf);
+    vec3_normalize((*map->transf)[2], ring_normal);
+    if (painter->planet.rings_tex) {
+        item->planet.rings_tex = painter->planet.rings_tex;
+        vec3_to_float((*map->transf)[3], item->planet.rings_center);
+        vec3_to_float(ring_normal, item->planet.rings_normal);
+        item->planet.rings_radii[0] = painter->planet.rings_radii[0];
+        item->planet.rings_radii[1] = painter->planet.rings_radii[1];
+    }
     item->planet.contrast = painter->contrast;
     item->planet.min_brightness = painter->planet.min_brightness;
     item->planet.shadow_spheres_nb = painter->planet.shadow_spheres_nb;
@@ -628,34 +1487,46 @@ static void quad_planet(
     item->tex = painter->textures[PAINTER_TEX_COLOR].tex ?: rend->white_tex;
     mat3_to_float(painter->textures[PAINTER_TEX_COLOR].mat,
                   item->planet.tex_transf);
-    item->tex->ref++;
+    texture_retain(item->tex);
     item->planet.normalmap = painter->textures[PAINTER_TEX_NORMAL].tex;
     mat3_to_float(painter->textures[PAINTER_TEX_NORMAL].mat,
                   item->planet.normal_tex_transf);
-    if (item->planet.normalmap) item->planet.normalmap->ref++;
+    texture_retain(item->planet.normalmap);
 
     // Only support POT textures for planets.
     assert(item->tex->w == item->tex->tex_w &&
            item->tex->h == item->tex->tex_h);
 
+    // Use the cached grid without the planet transformation, so that we
+    // can compute the normals the same way uv_map does.  The rings all
+    // share the normal of their plane.
+    base = *map;
+    base.transf = NULL;
+    mark = frame_alloc_mark();
+    grid = get_grid(rend, &base, grid_size);
+
     for (i = 0; i < n; i++)
     for (j = 0; j < n; j++) {
-        vec3_set(p, (double)j / grid_size, (double)i / grid_size, 1.0);
-        gl_buf_2f(&item->buf, -1, ATTR_TEX_POS, p[0], p[1]);
+        gl_buf_2f(&item->buf, -1, ATTR_TEX_POS,
+                  (double)j / grid_size, (double)i / grid_size);
+        if (map->type == UV_MAP_RING) {
+            vec3_copy(ring_normal, normal);
+        } else {
+            mat4_mul_dir3(*map->transf, grid[i * n + j], normal);
+            vec3_normalize(normal, normal);
+        }
         if (item->planet.normalmap) {
-            compute_tangent(p, map, tangent);
+            compute_tangent(normal, tangent);
             gl_buf_3f(&item->buf, -1, ATTR_TANGENT, VEC3_SPLIT(tangent));
         }
 
-        vec3_set(p, (double)j / grid_size, (double)i / grid_size, 1.0);
-        uv_map(map, p, p, normal);
+        mat4_mul_vec4(*map->transf, grid[i * n + j], p);
         assert(p[3] == 1.0); // Planet can never be at infinity.
 
         gl_buf_3f(&item->buf, -1, ATTR_NORMAL, VEC3_SPLIT(normal));
 
         // Model position (without scaling applied).
         vec4_copy(p, mpos);
-        assert(map->transf);
         vec3_sub(mpos, (*map->transf)[3], mpos);
         vec3_mul(1.0 / painter->planet.scale, mpos, mpos);
         vec3_add(mpos, (*map->transf)[3], mpos);
@@ -672,6 +1543,7 @@ static void quad_planet(
         gl_buf_4i(&item->buf, -1, ATTR_COLOR, 255, 255, 255, 255);
         gl_buf_next(&item->buf);
     }
+    frame_alloc_rewind(mark);
 
     for (i = 0; i < grid_size; i++)
     for (j = 0; j < grid_size; j++) {
@@ -684,18 +1556,21 @@ static void quad_planet(
     DL_APPEND(rend->items, item);
 }
 
-void render_quad(renderer_t *rend, const painter_t *painter,
-                 int frame, int grid_size, const uv_map_t *map)
+static void gl_quad(renderer_t *rend_, const painter_t *painter,
+                    int frame, int grid_size, const uv_map_t *map)
 {
+    renderer_gl_t *rend = (void*)rend_;
     item_t *item;
     int n, i, j, k, ofs;
     const int INDICES[6][2] = {
         {0, 0}, {0, 1}, {1, 0}, {1, 1}, {1, 0}, {0, 1} };
     double p[4], tex_pos[2], ndc_p[4];
-    float lum;
+    float color[4];
     const double (*grid)[4] = NULL;
-    bool should_delete_grid;
+    size_t mark;
     texture_t *tex = painter->textures[PAINTER_TEX_COLOR].tex;
+    texture_t *layer = painter->textures[PAINTER_TEX_LAYER].tex;
+    painter_t painter2;
 
     // Special case for planet shader.
     if (painter->flags & (PAINTER_PLANET_SHADER | PAINTER_RING_SHADER))
@@ -704,44 +1579,83 @@ void render_quad(renderer_t *rend, const painter_t *painter,
     if (!tex) tex = rend->white_tex;
     n = grid_size + 1;
 
+    // The blit shader only composites the layer over plain color textures,
+    // in the other cases we render it as a second quad.
+    if (layer && ((painter->flags & (PAINTER_ADD | PAINTER_ALLOW_REORDER |
+                                     PAINTER_ATMOSPHERE_SHADER |
+                                     PAINTER_FOG_SHADER)) ||
+                  tex->format == GL_LUMINANCE ||
+                  layer->format == GL_LUMINANCE)) {
+        painter2 = *painter;
+        painter2.textures[PAINTER_TEX_LAYER].tex = NULL;
+        gl_quad(rend_, &painter2, frame, grid_size, map);
+        painter2.textures[PAINTER_TEX_COLOR] =
+            painter->textures[PAINTER_TEX_LAYER];
+        vec4_copy(painter->layer_color, painter2.color);
+        gl_quad(rend_, &painter2, frame, grid_size, map);
+        return;
+    }
+
     if (painter->flags & PAINTER_ATMOSPHERE_SHADER) {
         item = get_item(rend, ITEM_ATMOSPHERE,
                         n * n, grid_size * grid_size * 6, tex);
         if (item && (
-                memcmp(item->atm.p, painter->atm.p, sizeof(item->atm.p)) ||
-                memcmp(item->atm.sun, painter->atm.sun, sizeof(item->atm.sun))))
+                memcmp(item->atm.sun, painter->atm.sun,
+                       sizeof(item->atm.sun)) ||
+                memcmp(item->atm.moon, painter->atm.moon,
+                       sizeof(item->atm.moon)) ||
+                memcmp(item->atm.sb, painter->atm.sb, sizeof(item->atm.sb))))
             item = NULL;
         if (!item) {
-            item = calloc(1, sizeof(*item));
-            item->type = ITEM_ATMOSPHERE;
-            gl_buf_alloc(&item->buf, &ATMOSPHERE_BUF, 256);
-            gl_buf_alloc(&item->indices, &INDICES_BUF, 256 * 6);
-            memcpy(item->atm.p, painter->atm.p, sizeof(item->atm.p));
+            item = item_new(rend, ITEM_ATMOSPHERE, &ATMOSPHERE_BUF,
+                            256, 256 * 6);
             memcpy(item->atm.sun, painter->atm.sun, sizeof(item->atm.sun));
+            memcpy(item->atm.moon, painter->atm.moon, sizeof(item->atm.moon));
+            memcpy(item->atm.sb, painter->atm.sb, sizeof(item->atm.sb));
         }
     } else if (painter->flags & PAINTER_FOG_SHADER) {
         item = get_item(rend, ITEM_FOG, n * n, grid_size * grid_size * 6, tex);
         if (!item) {
-            item = calloc(1, sizeof(*item));
-            item->type = ITEM_FOG;
+            item = item_new(rend, ITEM_FOG, &FOG_BUF, 256, 256 * 6);
             vec4_copy(painter->color, item->color);
-            gl_buf_alloc(&item->buf, &FOG_BUF, 256);
-            gl_buf_alloc(&item->indices, &INDICES_BUF, 256 * 6);
         }
+    } else if (painter->flags & PAINTER_ALLOW_REORDER) {
+        // Reorderable quads sharing the same texture and color (like the
+        // constellations illustrations in their atlas) go in a single item.
+        vec4_to_float(painter->color, color);
+        item = get_item(rend, ITEM_TEXTURE, n * n, grid_size * grid_size * 6,
+                        tex);
+        if (item && (item->flags != painter->flags ||
+                     memcmp(item->color, color, sizeof(color))))
+            item = NULL;
+        if (!item) {
+            item = item_new(rend, ITEM_TEXTURE, &TEXTURE_BUF,
+                            fmax(n * n, QUAD_BATCH_SIZE),
+                            fmax(grid_size * grid_size * 6,
+                                 QUAD_BATCH_SIZE * 6));
+        }
+    } else if (layer) {
+        item = item_new(rend, ITEM_TEXTURE, &TEXTURE_LAYER_BUF, n * n,
+                        n * n * 6);
+        item->layer.tex = layer;
+        texture_retain(layer);
+        vec4_to_float(painter->layer_color, item->layer.color);
     } else {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_TEXTURE;
-        gl_buf_alloc(&item->buf, &TEXTURE_BUF, n * n);
-        gl_buf_alloc(&item->indices, &INDICES_BUF, n * n * 6);
+        item = item_new(rend, ITEM_TEXTURE, &TEXTURE_BUF, n * n,
+                        n * n * 6);
     }
 
     ofs = item->buf.nb;
-    item->tex = tex;
-    item->tex->ref++;
-    vec4_to_float(painter->color, item->color);
-    item->flags = painter->flags;
+    if (ofs == 0) {
+        item->tex = tex;
+        texture_retain(item->tex);
+        vec4_to_float(painter->color, item->color);
+        item->flags = painter->flags;
+        DL_APPEND(rend->items, item);
+    }
 
-    grid = get_grid(rend, map, grid_size, &should_delete_grid);
+    mark = frame_alloc_mark();
+    grid = get_grid(rend, map, grid_size);
     for (i = 0; i < n; i++)
     for (j = 0; j < n; j++) {
         vec3_set(p, (double)j / grid_size, (double)i / grid_size, 1.0);
@@ -749,24 +1663,30 @@ void render_quad(renderer_t *rend, const painter_t *painter,
         tex_pos[0] = p[0] * tex->w / tex->tex_w;
         tex_pos[1] = p[1] * tex->h / tex->tex_h;
         gl_buf_2f(&item->buf, -1, ATTR_TEX_POS, tex_pos[0], tex_pos[1]);
+        if (layer) {
+            vec3_set(p, (double)j / grid_size, (double)i / grid_size, 1.0);
+            mat3_mul_vec3(painter->textures[PAINTER_TEX_LAYER].mat, p, p);
+            gl_buf_2f(&item->buf, -1, ATTR_LAYER_TEX_POS,
+                      p[0] * layer->w / layer->tex_w,
+                      p[1] * layer->h / layer->tex_h);
+        }
 
         vec4_set(p, VEC4_SPLIT(grid[i * n + j]));
         convert_framev4(painter->obs, frame, FRAME_VIEW, p, ndc_p);
         gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(ndc_p));
-        // For atmosphere shader, in the first pass we do not compute the
-        // luminance yet, only if the point is visible.
+        // For atmosphere shader, the color is computed in the fragment
+        // shader, we only compute the luminance for the eye adaptation.
         if (painter->flags & PAINTER_ATMOSPHERE_SHADER) {
             gl_buf_3f(&item->buf, -1, ATTR_SKY_POS, VEC3_SPLIT(p));
-            lum = painter->atm.compute_lum(painter->atm.user,
+            painter->atm.compute_lum(painter->atm.user,
                     (float[3]){p[0], p[1], p[2]});
-            gl_buf_1f(&item->buf, -1, ATTR_LUMINANCE, lum);
         }
         if (painter->flags & PAINTER_FOG_SHADER) {
             gl_buf_3f(&item->buf, -1, ATTR_SKY_POS, VEC3_SPLIT(p));
         }
         gl_buf_next(&item->buf);
     }
-    if (should_delete_grid) free((void*)grid);
+    frame_alloc_rewind(mark);
 
     // Set the index buffer.
     for (i = 0; i < grid_size; i++)
@@ -777,13 +1697,12 @@ void render_quad(renderer_t *rend, const painter_t *painter,
             gl_buf_next(&item->indices);
         }
     }
-    DL_APPEND(rend->items, item);
 }
 
-static void texture_2d(renderer_t *rend, texture_t *tex,
+static void texture_2d(renderer_gl_t *rend, texture_t *tex,
                        const double uv[4][2], double win_pos[4][2],
                        const double view_pos[3],
-                       const double color_[4], int flags)
+                       const double color_[4], int flags, bool overlay)
 {
     int i, ofs;
     item_t *item;
@@ -795,15 +1714,15 @@ static void texture_2d(renderer_t *rend, texture_t *tex,
     vec4_to_float(color_, color);
     item = get_item(rend, ITEM_TEXTURE_2D, 4, 6, tex);
     if (item && memcmp(item->color, color, sizeof(color))) item = NULL;
+    if (item && item->overlay != overlay) item = NULL;
 
     if (!item) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_TEXTURE_2D;
+        item = item_new(rend, ITEM_TEXTURE_2D, &TEXTURE_2D_BUF,
+                        64 * 4, 64 * 6);
         item->flags = flags;
-        gl_buf_alloc(&item->buf, &TEXTURE_2D_BUF, 64 * 4);
-        gl_buf_alloc(&item->indices, &INDICES_BUF, 64 * 6);
+        item->overlay = overlay;
         item->tex = tex;
-        item->tex->ref++;
+        texture_retain(item->tex);
         memcpy(item->color, color, sizeof(color));
         DL_APPEND(rend->items, item);
     }
@@ -828,10 +1747,11 @@ static void texture_2d(renderer_t *rend, texture_t *tex,
     }
 }
 
-void render_texture(renderer_t *rend, texture_t  *tex,
-                    const double uv[4][2], const double pos[2], double size,
-                    const double color[4], double angle)
+static void gl_texture(renderer_t *rend_, texture_t  *tex,
+                       const double uv[4][2], const double pos[2],
+                       double size, const double color[4], double angle)
 {
+    renderer_gl_t *rend = (void*)rend_;
     int i;
     double verts[4][2], w, h;
     w = size;
@@ -843,7 +1763,7 @@ void render_texture(renderer_t *rend, texture_t  *tex,
         verts[i][0] = pos[0] + verts[i][0];
         verts[i][1] = pos[1] + verts[i][1];
     }
-    texture_2d(rend, tex, uv, verts, NULL, color, 0);
+    texture_2d(rend, tex, uv, verts, NULL, color, 0, false);
 }
 
 static uint8_t img_get(const uint8_t *img, int w, int h, int x, int y)
@@ -901,7 +1821,7 @@ static void text_shadow_effect(const uint8_t *src, uint8_t *dst,
 }
 
 // Render text using a system bakend generated texture.
-static void text_using_texture(renderer_t *rend,
+static void text_using_texture(renderer_gl_t *rend,
                                const painter_t *painter,
                                const char *text, const double win_pos[2],
                                const double view_pos[3],
@@ -911,18 +1831,25 @@ static void text_using_texture(renderer_t *rend,
 {
     double uv[4][2], verts[4][2];
     double s[2], ofs[2] = {0, 0}, bounds[4];
-    const double scale = rend->scale;
+    const double scale = rend->ui_scale;
     uint8_t *img, *img_rgba;
-    int i, w, h, xoff, yoff, flags;
+    int i, n, w, h, xoff, yoff, flags;
     tex_cache_t *ctex;
     texture_t *tex;
+    char *key;
+    size_t mark;
+    const char *KEY_FMT = "%a %d %a %a %a %s";
     assert(color);
 
-    DL_FOREACH(rend->tex_cache, ctex) {
-        if (ctex->size == size && ctex->effects == effects &&
-                strcmp(ctex->text, text) == 0 &&
-                memcmp(ctex->color, color, sizeof(ctex->color)) == 0) break;
-    }
+    // Build the cache key in the frame arena, since most of the time the
+    // texture is already in the cache.
+    mark = frame_alloc_mark();
+    n = snprintf(NULL, 0, KEY_FMT, size, effects,
+                 color[0], color[1], color[2], text) + 1;
+    key = frame_alloc(n);
+    snprintf(key, n, KEY_FMT, size, effects,
+             color[0], color[1], color[2], text);
+    HASH_FIND_STR(rend->tex_cache, key, ctex);
 
     if (!ctex) {
         img = (void*)sys_render_text(text, size * scale, effects, align, &w, &h,
@@ -930,22 +1857,20 @@ static void text_using_texture(renderer_t *rend,
         // Shadow effect, into a texture with one pixel extra border.
         w += 2;
         h += 2;
-        img_rgba = malloc(w * h * 4);
+        img_rgba = frame_alloc(w * h * 4);
         text_shadow_effect(img, img_rgba, w, h, color);
         free(img);
         ctex = calloc(1, sizeof(*ctex));
-        ctex->size = size;
-        ctex->effects = effects;
+        ctex->key = strdup(key);
         ctex->xoff = xoff;
         ctex->yoff = yoff;
-        ctex->text = strdup(text);
         ctex->tex = texture_from_data(img_rgba, w, h, 4, 0, 0, w, h, 0);
-        vec3_copy(color, ctex->color);
-        free(img_rgba);
-        DL_APPEND(rend->tex_cache, ctex);
+        HASH_ADD_KEYPTR(hh, rend->tex_cache, ctex->key, strlen(ctex->key),
+                        ctex);
     }
+    frame_alloc_rewind(mark);
 
-    ctex->in_use = true;
+    ctex->last_used = rend->frame;
 
     // Compute bounds taking alignment into account.
     s[0] = ctex->tex->w / scale;
@@ -996,12 +1921,17 @@ static void text_using_texture(renderer_t *rend,
     }
 
     flags = painter->flags;
-    texture_2d(rend, tex, uv, verts, view_pos, VEC(1, 1, 1, color[3]), flags);
+    texture_2d(rend, tex, uv, verts, view_pos, VEC(1, 1, 1, color[3]), flags,
+               true);
 }
 
+static void set_default_fonts(renderer_gl_t *rend);
+
 static void set_nvg_text_settings(
-        renderer_t *rend, int font, float size, int effects)
+        renderer_gl_t *rend, int font, float size, int effects)
 {
+    // The default fonts are only decoded the first time we render a text.
+    if (!rend->default_fonts_loaded) set_default_fonts(rend);
     nvgFontFaceId(rend->vg, rend->fonts[font].id);
     nvgFontSize(rend->vg, size);
     nvgTextLetterSpacing(rend->vg, size * 0.01);
@@ -1011,25 +1941,56 @@ static void set_nvg_text_settings(
         nvgTextLetterSpacing(rend->vg, size * 0.075);
 }
 
+/*
+ * Return the cached metrics of a text, computing them with nanovg if they
+ * are not in the cache yet.
+ */
+static const text_metrics_t *get_nvg_text_metrics(
+        renderer_gl_t *rend, const char *text, int font, float size,
+        int effects)
+{
+    text_metrics_t *metrics;
+    char *key;
+    size_t mark;
+    int n;
+    const char *KEY_FMT = "%a %d %d %s";
+
+    mark = frame_alloc_mark();
+    n = snprintf(NULL, 0, KEY_FMT, size, font, effects, text) + 1;
+    key = frame_alloc(n);
+    snprintf(key, n, KEY_FMT, size, font, effects, text);
+    HASH_FIND_STR(rend->text_metrics, key, metrics);
+    if (!metrics) {
+        metrics = calloc(1, sizeof(*metrics));
+        metrics->key = strdup(key);
+        nvgSave(rend->vg);
+        set_nvg_text_settings(rend, font, size, effects);
+        nvgTextAlign(rend->vg, NVG_ALIGN_TOP | NVG_ALIGN_LEFT);
+        nvgTextBoxBounds(rend->vg, 0, 0, 10000, text, NULL, metrics->bounds);
+        nvgTextMetrics(rend->vg, NULL, &metrics->descender, NULL);
+        nvgRestore(rend->vg);
+        HASH_ADD_KEYPTR(hh, rend->text_metrics, metrics->key,
+                        strlen(metrics->key), metrics);
+    }
+    frame_alloc_rewind(mark);
+    metrics->last_used = rend->frame;
+    return metrics;
+}
+
 static void get_nvg_text_bounds(
-        renderer_t *rend, const char* text, int align,
+        renderer_gl_t *rend, const text_metrics_t *metrics, int align,
         const double pos[2], double bounds[4])
 {
     float w, h, descender, fbounds[4];
 
-    nvgSave(rend->vg);
-    // First determine the actual text block width
-    nvgTextAlign(rend->vg, NVG_ALIGN_TOP | NVG_ALIGN_LEFT);
-    nvgTextBoxBounds(rend->vg, 0, 0, 10000, text, NULL, fbounds);
-
     // Compute bounds taking alignment into account.
-    nvgTextMetrics(rend->vg, NULL, &descender, NULL);
-    fbounds[0] = floorf(fbounds[0]);
+    descender = metrics->descender;
+    fbounds[0] = floorf(metrics->bounds[0]);
     // Artificially adds a margin equals to "descender" above the top of the
     // font to get something closer to the Qt renderer.
-    fbounds[1] = floorf(fbounds[1]);
-    fbounds[2] = ceilf(fbounds[2]);
-    fbounds[3] = ceilf(fbounds[3] -  descender);
+    fbounds[1] = floorf(metrics->bounds[1]);
+    fbounds[2] = ceilf(metrics->bounds[2]);
+    fbounds[3] = ceilf(metrics->bounds[3] -  descender);
     w = fbounds[2] - fbounds[0] + 1;
     h = fbounds[3] - fbounds[1];
     if (align & ALIGN_RIGHT)    fbounds[0] += -w;
@@ -1041,11 +2002,10 @@ static void get_nvg_text_bounds(
     bounds[1] = floor(fbounds[1] + pos[1]);
     bounds[2] = bounds[0] + w;
     bounds[3] = bounds[1] + h;
-    nvgRestore(rend->vg);
 }
 
 // Render text using nanovg.
-static void text_using_nanovg(renderer_t *rend,
+static void text_using_nanovg(renderer_gl_t *rend,
                               const painter_t *painter,
                               const char *text,
                               const double pos[2], int align, int effects,
@@ -1063,8 +2023,7 @@ static void text_using_nanovg(renderer_t *rend,
     }
 
     if (!bounds) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_TEXT;
+        item = item_new(rend, ITEM_TEXT, NULL, 0, 0);
         item->flags = painter->flags;
         vec4_to_float(color, item->color);
         item->color[0] = clamp(item->color[0], 0.0, 1.0);
@@ -1092,10 +2051,9 @@ static void text_using_nanovg(renderer_t *rend,
             snprintf(buf, sizeof(buf), "%s", text);
         }
 
-        nvgSave(rend->vg);
-        set_nvg_text_settings(rend, font, size, effects);
-        get_nvg_text_bounds(rend, buf, align, pos, bounds);
-        nvgRestore(rend->vg);
+        get_nvg_text_bounds(rend, get_nvg_text_metrics(rend, buf, font, size,
+                                                       effects),
+                            align, pos, bounds);
 
         // Uncomment to see labels bounding box
         if ((0)) {
@@ -1111,13 +2069,14 @@ static void text_using_nanovg(renderer_t *rend,
     }
 }
 
-void render_text(renderer_t *rend, const painter_t *painter,
-                 const char *text, const double win_pos[2],
-                 const double view_pos[3],
-                 int align, int effects, double size,
-                 const double color[4], double angle,
-                 double bounds[4])
+static void gl_text(renderer_t *rend_, const painter_t *painter,
+                    const char *text, const double win_pos[2],
+                    const double view_pos[3],
+                    int align, int effects, double size,
+                    const double color[4], double angle,
+                    double bounds[4])
 {
+    renderer_gl_t *rend = (void*)rend_;
     assert(win_pos);
     assert(size);
 
@@ -1142,19 +2101,58 @@ void render_text(renderer_t *rend, const painter_t *painter,
 
 }
 
-static void item_points_render(renderer_t *rend, const item_t *item)
+/*
+ * Function: vbo_upload
+ * Bind a pooled GL buffer and upload data into it.
+ *
+ * If the pooled buffer is large enough we orphan its storage and update it
+ * with glBufferSubData, so that the driver doesn't have to reallocate it nor
+ * wait for the previous draw calls using it.
+ *
+ * Parameters:
+ *   rend   - The renderer.
+ *   pool   - Index of the pool: 0 for vertices, 1 for indices.
+ *   data   - The data to upload.
+ *   size   - Size of the data in bytes.
+ */
+static void vbo_upload(renderer_gl_t *rend, int pool, const void *data,
+                       int size)
 {
-    gl_shader_t *shader;
-    GLuint  array_buffer;
-    double core_size;
-
+    typeof(rend->vbos[0]) *vbos = &rend->vbos[pool];
+    typeof(vbos->bufs[0]) *buf;
+
+    if (vbos->used == vbos->nb) {
+        vbos->nb++;
+        vbos->bufs = realloc(vbos->bufs, vbos->nb * sizeof(*vbos->bufs));
+        buf = &vbos->bufs[vbos->used];
+        GL(glGenBuffers(1, &buf->id));
+        buf->size = 0;
+    }
+    buf = &vbos->bufs[vbos->used++];
+    rend->frame_stats.bytes += size;
+    GL(glBindBuffer(vbos->target, buf->id));
+    if (size > buf->size) {
+        GL(glBufferData(vbos->target, size, data, GL_DYNAMIC_DRAW));
+        buf->size = size;
+    } else {
+        GL(glBufferData(vbos->target, buf->size, NULL, GL_DYNAMIC_DRAW));
+        GL(glBufferSubData(vbos->target, 0, size, data));
+    }
+}
+
+static void item_points_render(renderer_gl_t *rend, const item_t *item)
+{
+    gl_shader_t *shader;
+    double core_size;
+
     if (item->buf.nb <= 0) {
         LOG_W("Empty point buffer");
         return;
     }
 
     shader = shader_get("points", NULL, ATTR_NAMES, init_shader);
-    GL(glUseProgram(shader->prog));
+    if (!shader) return;
+    use_program(rend, shader);
 
     GL(glEnable(GL_BLEND));
     GL(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE));
@@ -1164,29 +2162,25 @@ static void item_points_render(renderer_t *rend, const item_t *item)
     else
         GL(glDisable(GL_DEPTH_TEST));
 
-    GL(glGenBuffers(1, &array_buffer));
-    GL(glBindBuffer(GL_ARRAY_BUFFER, array_buffer));
-    GL(glBufferData(GL_ARRAY_BUFFER, item->buf.nb * item->buf.info->size,
-                    item->buf.data, GL_DYNAMIC_DRAW));
+    vbo_upload(rend, 0, item->buf.data, item->buf.nb * item->buf.info->size);
 
     gl_update_uniform(shader, "u_color", item->color);
     core_size = 1.0 / item->points.halo;
     gl_update_uniform(shader, "u_core_size", core_size);
+    gl_update_uniform_mat3(shader, "u_ndc_late", rend->late.ndc);
 
     gl_buf_enable(&item->buf);
     GL(glDrawArrays(GL_POINTS, 0, item->buf.nb));
+    rend->frame_stats.draw_calls++;
     gl_buf_disable(&item->buf);
 
-    GL(glDeleteBuffers(1, &array_buffer));
     GL(glDisable(GL_DEPTH_TEST));
 }
 
-static void item_points_3d_render(renderer_t *rend, const item_t *item)
+static void item_points_3d_render(renderer_gl_t *rend, const item_t *item)
 {
     gl_shader_t *shader;
-    GLuint  array_buffer;
     double core_size;
-    projection_t proj;
 
     if (item->buf.nb <= 0)
         return;
@@ -1198,7 +2192,8 @@ static void item_points_3d_render(renderer_t *rend, const item_t *item)
     };
 
     shader = shader_get("points", defines, ATTR_NAMES, init_shader);
-    GL(glUseProgram(shader->prog));
+    if (!shader) return;
+    use_program(rend, shader);
 
     GL(glEnable(GL_BLEND));
     GL(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE));
@@ -1209,59 +2204,42 @@ static void item_points_3d_render(renderer_t *rend, const item_t *item)
         GL(glDisable(GL_DEPTH_TEST));
     GL(glDepthMask(GL_FALSE));
 
-    GL(glGenBuffers(1, &array_buffer));
-    GL(glBindBuffer(GL_ARRAY_BUFFER, array_buffer));
-    GL(glBufferData(GL_ARRAY_BUFFER, item->buf.nb * item->buf.info->size,
-                    item->buf.data, GL_DYNAMIC_DRAW));
+    vbo_upload(rend, 0, item->buf.data, item->buf.nb * item->buf.info->size);
 
     gl_update_uniform(shader, "u_color", item->color);
     core_size = 1.0 / item->points.halo;
     gl_update_uniform(shader, "u_core_size", core_size);
 
-    proj = rend_get_proj(rend, item->flags);
-    gl_update_uniform_mat4(shader, "u_proj_mat", proj.mat);
+    set_proj_uniforms(rend, shader, item->flags);
 
     gl_buf_enable(&item->buf);
     GL(glDrawArrays(GL_POINTS, 0, item->buf.nb));
+    rend->frame_stats.draw_calls++;
     gl_buf_disable(&item->buf);
 
-    GL(glDeleteBuffers(1, &array_buffer));
     GL(glDisable(GL_DEPTH_TEST));
 }
 
-static void draw_buffer(const gl_buf_t *buf, const gl_buf_t *indices,
+static void draw_buffer(renderer_gl_t *rend,
+                        const gl_buf_t *buf, const gl_buf_t *indices,
                         GLuint gl_mode)
 {
-    GLuint  array_buffer;
-    GLuint  index_buffer;
-
-    GL(glGenBuffers(1, &index_buffer));
-    GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer));
-    GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                    indices->nb * indices->info->size,
-                    indices->data, GL_DYNAMIC_DRAW));
-
-    GL(glGenBuffers(1, &array_buffer));
-    GL(glBindBuffer(GL_ARRAY_BUFFER, array_buffer));
-    GL(glBufferData(GL_ARRAY_BUFFER, buf->nb * buf->info->size,
-                    buf->data, GL_DYNAMIC_DRAW));
+    vbo_upload(rend, 1, indices->data, indices->nb * indices->info->size);
+    vbo_upload(rend, 0, buf->data, buf->nb * buf->info->size);
 
     gl_buf_enable(buf);
     GL(glDrawElements(gl_mode, indices->nb, GL_UNSIGNED_SHORT, 0));
+    rend->frame_stats.draw_calls++;
     gl_buf_disable(buf);
-
-    GL(glDeleteBuffers(1, &array_buffer));
-    GL(glDeleteBuffers(1, &index_buffer));
 }
 
-static void item_mesh_render(renderer_t *rend, const item_t *item)
+static void item_mesh_render(renderer_gl_t *rend, const item_t *item)
 {
     // XXX: almost the same as item_lines_render.
     gl_shader_t *shader;
     int gl_mode;
-    float fbo_size[2] = {rend->fb_size[0] / rend->scale,
-                         rend->fb_size[1] / rend->scale};
-    projection_t proj;
+    float fbo_size[2] = {rend->ui_fb_size[0] / rend->ui_scale,
+                         rend->ui_fb_size[1] / rend->ui_scale};
 
     gl_mode = item->mesh.mode == 0 ? GL_TRIANGLES :
               item->mesh.mode == 1 ? GL_LINES :
@@ -1272,7 +2250,8 @@ static void item_mesh_render(renderer_t *rend, const item_t *item)
         {}
     };
     shader = shader_get("mesh", defines, ATTR_NAMES, init_shader);
-    GL(glUseProgram(shader->prog));
+    if (!shader) return;
+    use_program(rend, shader);
 
     GL(glLineWidth(item->mesh.stroke_width));
 
@@ -1297,10 +2276,9 @@ static void item_mesh_render(renderer_t *rend, const item_t *item)
     gl_update_uniform(shader, "u_fbo_size", fbo_size);
     gl_update_uniform(shader, "u_proj_scaling", item->mesh.proj_scaling);
 
-    proj = rend_get_proj(rend, item->flags);
-    gl_update_uniform_mat4(shader, "u_proj_mat", proj.mat);
+    set_proj_uniforms(rend, shader, item->flags);
 
-    draw_buffer(&item->buf, &item->indices, gl_mode);
+    draw_buffer(rend, &item->buf, &item->indices, gl_mode);
 
     if (item->mesh.use_stencil) {
         GL(glDisable(GL_STENCIL_TEST));
@@ -1308,13 +2286,103 @@ static void item_mesh_render(renderer_t *rend, const item_t *item)
     }
 }
 
+static void item_static_mesh_render(renderer_gl_t *rend, const item_t *item)
+{
+    gl_shader_t *shader;
+    const static_mesh_t *smesh = item->static_mesh.mesh;
+    static_mesh_batch_t *batch;
+    int i, mode = item->static_mesh.mode, size;
+    GLuint gl_mode;
+    float tex_size[2] = {item->tex->tex_w, item->tex->tex_h};
+
+    gl_mode = mode == 0 ? GL_TRIANGLES :
+              mode == 1 ? GL_LINES :
+              mode == 2 ? GL_POINTS : 0;
+
+    shader_define_t defines[] = {
+        {"PROJ", rend->proj.klass->id},
+        {"STROKE", mode == 1},
+        {"REFRACTION", item->static_mesh.refraction},
+        {}
+    };
+    shader = shader_get("static_mesh", defines, ATTR_NAMES, init_shader);
+    if (!shader) return;
+    use_program(rend, shader);
+
+    GL(glLineWidth(item->static_mesh.stroke_width));
+    GL(glDisable(GL_CULL_FACE));
+    GL(glDisable(GL_DEPTH_TEST));
+    GL(glEnable(GL_BLEND));
+    GL(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+                           GL_ZERO, GL_ONE));
+
+    // Same stencil hack as for the meshes.
+    if (item->static_mesh.use_stencil) {
+        GL(glClear(GL_STENCIL_BUFFER_BIT));
+        GL(glEnable(GL_STENCIL_TEST));
+        GL(glStencilFunc(GL_NOTEQUAL, 1, 0xFF));
+        GL(glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE));
+    }
+
+    GL(glActiveTexture(GL_TEXTURE0));
+    GL(glBindTexture(GL_TEXTURE_2D, item->tex->id));
+
+    gl_update_uniform(shader, "u_color", item->color);
+    gl_update_uniform(shader, "u_blink", item->static_mesh.blink);
+    gl_update_uniform(shader, "u_tex_size", tex_size);
+    gl_update_uniform_mat3(shader, "u_mat", item->static_mesh.mat);
+    if (item->static_mesh.refraction) {
+        gl_update_uniform_mat3(shader, "u_ro2v", item->static_mesh.ro2v);
+        gl_update_uniform(shader, "u_refraction",
+                          item->static_mesh.refa_refb);
+    }
+    set_proj_uniforms(rend, shader, item->flags);
+
+    for (i = 0; i < smesh->batches_count; i++) {
+        batch = &smesh->batches[i];
+        if (!batch->indices_count[mode]) continue;
+        // Upload the geometry the first time we render it, after that
+        // the buffers stay on the GPU.
+        if (!batch->vbo) {
+            size = batch->verts_count * sizeof(*batch->verts);
+            GL(glGenBuffers(1, &batch->vbo));
+            GL(glBindBuffer(GL_ARRAY_BUFFER, batch->vbo));
+            GL(glBufferData(GL_ARRAY_BUFFER, size, batch->verts,
+                            GL_STATIC_DRAW));
+            rend->frame_stats.bytes += size;
+        }
+        if (!batch->ibos[mode]) {
+            size = batch->indices_count[mode] * sizeof(uint16_t);
+            GL(glGenBuffers(1, &batch->ibos[mode]));
+            GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibos[mode]));
+            GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, size,
+                            batch->indices[mode], GL_STATIC_DRAW));
+            rend->frame_stats.bytes += size;
+        }
+        GL(glBindBuffer(GL_ARRAY_BUFFER, batch->vbo));
+        GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibos[mode]));
+        GL(glEnableVertexAttribArray(ATTR_POS));
+        GL(glVertexAttribPointer(ATTR_POS, 4, GL_FLOAT, false,
+                                 sizeof(*batch->verts), 0));
+        GL(glDrawElements(gl_mode, batch->indices_count[mode],
+                          GL_UNSIGNED_SHORT, 0));
+        GL(glDisableVertexAttribArray(ATTR_POS));
+        rend->frame_stats.draw_calls++;
+        rend->frame_stats.vertices += batch->verts_count;
+    }
+
+    if (item->static_mesh.use_stencil) {
+        GL(glDisable(GL_STENCIL_TEST));
+        GL(glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP));
+    }
+}
+
 // XXX: almost the same as item_mesh_render!
-static void item_lines_render(renderer_t *rend, const item_t *item)
+static void item_lines_render(renderer_gl_t *rend, const item_t *item)
 {
     gl_shader_t *shader;
-    float win_size[2] = {rend->fb_size[0] / rend->scale,
-                         rend->fb_size[1] / rend->scale};
-    projection_t proj;
+    float win_size[2] = {rend->ui_fb_size[0] / rend->ui_scale,
+                         rend->ui_fb_size[1] / rend->ui_scale};
 
     shader_define_t defines[] = {
         {"DASH", item->lines.dash_length && (item->lines.dash_ratio < 1.0)},
@@ -1323,7 +2391,8 @@ static void item_lines_render(renderer_t *rend, const item_t *item)
         {}
     };
     shader = shader_get("lines", defines, ATTR_NAMES, init_shader);
-    GL(glUseProgram(shader->prog));
+    if (!shader) return;
+    use_program(rend, shader);
 
     GL(glEnable(GL_BLEND));
     GL(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
@@ -1344,19 +2413,103 @@ static void item_lines_render(renderer_t *rend, const item_t *item)
         gl_update_uniform(shader, "u_fade_dist_max", item->lines.fade_dist_max);
     }
 
-    proj = rend_get_proj(rend, item->flags);
-    gl_update_uniform_mat4(shader, "u_proj_mat", proj.mat);
+    set_proj_uniforms(rend, shader, item->flags);
+
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
+    GL(glDisable(GL_DEPTH_TEST));
+}
+
+// Create the lines strip shared by all the orbits.
+static void orbit_strip_init(renderer_gl_t *rend)
+{
+    int i, k;
+    gl_buf_t *buf = &rend->orbit_strip.buf;
+
+    if (rend->orbit_strip.vbo) return;
+    if (!buf->data) {
+        gl_buf_alloc(buf, &ORBIT_STRIP_BUF, (ORBIT_SEGMENTS + 1) * 2);
+        for (i = 0; i <= ORBIT_SEGMENTS; i++) {
+            for (k = 0; k < 2; k++) {
+                gl_buf_2f(buf, -1, ATTR_TEX_POS,
+                          (double)i / ORBIT_SEGMENTS, k ? 1 : -1);
+                gl_buf_next(buf);
+            }
+        }
+    }
+    GL(glGenBuffers(1, &rend->orbit_strip.vbo));
+    GL(glBindBuffer(GL_ARRAY_BUFFER, rend->orbit_strip.vbo));
+    GL(glBufferData(GL_ARRAY_BUFFER, buf->nb * buf->info->size, buf->data,
+                    GL_STATIC_DRAW));
+}
+
+// Only called if we have the instancing, see gl_orbit.
+static void item_orbits_render(renderer_gl_t *rend, const item_t *item)
+{
+    gl_shader_t *shader;
+    const gl_buf_t *strip = &rend->orbit_strip.buf;
+    float win_size[2] = {rend->ui_fb_size[0] / rend->ui_scale,
+                         rend->ui_fb_size[1] / rend->ui_scale};
+    shader_define_t defines[] = {
+        {"PROJ", rend->proj.klass->id},
+        {}
+    };
+
+    orbit_strip_init(rend);
+    shader = shader_get("orbits", defines, ATTR_NAMES, init_shader);
+    if (!shader) return;
+    use_program(rend, shader);
+
+    GL(glEnable(GL_BLEND));
+    GL(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+                           GL_ZERO, GL_ONE));
+    if (item->flags & PAINTER_ENABLE_DEPTH)
+        GL(glEnable(GL_DEPTH_TEST));
 
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    gl_update_uniform(shader, "u_line_width", item->lines.width);
+    gl_update_uniform(shader, "u_line_glow", item->lines.glow);
+    gl_update_uniform(shader, "u_win_size", win_size);
+    // Same extrusion width as for the lines.
+    gl_update_uniform(shader, "u_half_width",
+                      fmax(10, item->lines.width + 2) / 2);
+    gl_update_uniform(shader, "u_step", 1.0 / ORBIT_SEGMENTS);
+    set_proj_uniforms(rend, shader, item->flags);
+
+    GL(glBindBuffer(GL_ARRAY_BUFFER, rend->orbit_strip.vbo));
+    gl_buf_enable(strip);
+    vbo_upload(rend, 0, item->buf.data, item->buf.nb * item->buf.info->size);
+    gl_buf_enable(&item->buf);
+#if HAS_INSTANCING
+    set_attribs_divisor(item->buf.info, 1);
+    GL(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, strip->nb,
+                             item->buf.nb));
+    set_attribs_divisor(item->buf.info, 0);
+#endif
+    gl_buf_disable(&item->buf);
+    gl_buf_disable(strip);
+    rend->frame_stats.draw_calls++;
+    // item_render only counted the instances.
+    rend->frame_stats.vertices += (strip->nb - 1) * item->buf.nb;
     GL(glDisable(GL_DEPTH_TEST));
 }
 
-static void item_vg_render(renderer_t *rend, const item_t *item)
+/*
+ * Apply the late view correction to the nanovg transformation.
+ */
+static void vg_set_late_view(renderer_gl_t *rend)
+{
+    const double (*m)[3] = rend->late.win;
+    nvgTransform(rend->vg, m[0][0], m[0][1], m[1][0], m[1][1],
+                           m[2][0], m[2][1]);
+}
+
+static void item_vg_render(renderer_gl_t *rend, const item_t *item)
 {
     double a, da;
-    nvgBeginFrame(rend->vg, rend->fb_size[0] / rend->scale,
-                            rend->fb_size[1] / rend->scale, rend->scale);
+    nvgBeginFrame(rend->vg, rend->ui_fb_size[0] / rend->ui_scale,
+                            rend->ui_fb_size[1] / rend->ui_scale,
+                            rend->ui_scale);
     nvgSave(rend->vg);
+    vg_set_late_view(rend);
     nvgTranslate(rend->vg, item->vg.pos[0], item->vg.pos[1]);
     nvgRotate(rend->vg, item->vg.angle);
     nvgBeginPath(rend->vg);
@@ -1397,17 +2550,19 @@ static void item_vg_render(renderer_t *rend, const item_t *item)
     GL(glColorMask(true, true, true, false));
 }
 
-static void item_text_render(renderer_t *rend, const item_t *item)
+static void item_text_render(renderer_gl_t *rend, const item_t *item)
 {
     int font = (item->text.effects & TEXT_BOLD) ? FONT_BOLD : FONT_REGULAR;
     double pos[2] = {0, 0};
-    float descender;
     float w;
     double bounds[4];
+    const text_metrics_t *metrics;
 
-    nvgBeginFrame(rend->vg, rend->fb_size[0] / rend->scale,
-                            rend->fb_size[1] / rend->scale, rend->scale);
+    nvgBeginFrame(rend->vg, rend->ui_fb_size[0] / rend->ui_scale,
+                            rend->ui_fb_size[1] / rend->ui_scale,
+                            rend->ui_scale);
     nvgSave(rend->vg);
+    vg_set_late_view(rend);
     nvgTranslate(rend->vg, roundf(item->text.pos[0]),
                            roundf(item->text.pos[1]));
     nvgRotate(rend->vg, item->text.angle);
@@ -1417,7 +2572,9 @@ static void item_text_render(renderer_t *rend, const item_t *item)
                                    item->color[3] * 255));
 
     set_nvg_text_settings(rend, font, item->text.size, item->text.effects);
-    get_nvg_text_bounds(rend, item->text.text, item->text.align, pos, bounds);
+    metrics = get_nvg_text_metrics(rend, item->text.text, font,
+                                   item->text.size, item->text.effects);
+    get_nvg_text_bounds(rend, metrics, item->text.align, pos, bounds);
     w = bounds[2] - bounds[0];
 
     nvgTextAlign(rend->vg, NVG_ALIGN_TOP |
@@ -1425,11 +2582,10 @@ static void item_text_render(renderer_t *rend, const item_t *item)
                                       NVG_ALIGN_CENTER)));
 
     // Render in multi-line using the previously computed line width
-    nvgTextMetrics(rend->vg, NULL, &descender, NULL);
     // Re-add the "descender" extra offset that was applied on the bounding
     // box to simulate an extra space above the font, so that the font is
     // properly aligned.
-    nvgTextBox(rend->vg, bounds[0], roundf(bounds[1] - descender), w,
+    nvgTextBox(rend->vg, bounds[0], roundf(bounds[1] - metrics->descender), w,
             item->text.text, NULL);
 
     // Uncomment to see labels bounding box
@@ -1448,55 +2604,58 @@ static void item_text_render(renderer_t *rend, const item_t *item)
     nvgEndFrame(rend->vg);
 }
 
-static void item_fog_render(renderer_t *rend, const item_t *item)
+static void item_fog_render(renderer_gl_t *rend, const item_t *item)
 {
     gl_shader_t *shader;
-    projection_t proj;
 
     shader_define_t defines[] = {
         {"PROJ", rend->proj.klass->id},
         {}
     };
     shader = shader_get("fog", defines, ATTR_NAMES, init_shader);
-    GL(glUseProgram(shader->prog));
+    if (!shader) return;
+    use_program(rend, shader);
     GL(glEnable(GL_CULL_FACE));
     GL(glCullFace(rend->cull_flipped ? GL_FRONT : GL_BACK));
     GL(glEnable(GL_BLEND));
+    // The alpha is only written in the atmosphere buffer, where it is the
+    // fog coverage for the final composition.
     GL(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
-                           GL_ZERO, GL_ONE));
+                           GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
     GL(glDisable(GL_DEPTH_TEST));
 
-    proj = rend_get_proj(rend, item->flags);
-    gl_update_uniform_mat4(shader, "u_proj_mat", proj.mat);
+    set_proj_uniforms(rend, shader, item->flags);
     gl_update_uniform(shader, "u_color", item->color);
 
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
     GL(glCullFace(GL_BACK));
 }
 
-static void item_atmosphere_render(renderer_t *rend, const item_t *item)
+static void item_atmosphere_render(renderer_gl_t *rend, const item_t *item)
 {
     gl_shader_t *shader;
     float tm[3];
-    projection_t proj;
 
     shader_define_t defines[] = {
         {"PROJ", rend->proj.klass->id},
         {}
     };
     shader = shader_get("atmosphere", defines, ATTR_NAMES, init_shader);
-    GL(glUseProgram(shader->prog));
+    if (!shader) return;
+    use_program(rend, shader);
 
     GL(glActiveTexture(GL_TEXTURE0));
     GL(glBindTexture(GL_TEXTURE_2D, item->tex->id));
     GL(glEnable(GL_CULL_FACE));
     GL(glCullFace(rend->cull_flipped ? GL_FRONT : GL_BACK));
 
+    // Keep the alpha, so that in the atmosphere buffer the atmosphere is
+    // added to the screen.
     GL(glEnable(GL_BLEND));
     if (color_is_white(item->color)) {
-        GL(glBlendFunc(GL_ONE, GL_ONE));
+        GL(glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE));
     } else {
-        GL(glBlendFunc(GL_CONSTANT_COLOR, GL_ONE));
+        GL(glBlendFuncSeparate(GL_CONSTANT_COLOR, GL_ONE, GL_ZERO, GL_ONE));
         GL(glBlendColor(item->color[0] * item->color[3],
                         item->color[1] * item->color[3],
                         item->color[2] * item->color[3],
@@ -1504,38 +2663,45 @@ static void item_atmosphere_render(renderer_t *rend, const item_t *item)
     }
 
     gl_update_uniform(shader, "u_color", item->color);
-    gl_update_uniform(shader, "u_atm_p", item->atm.p);
     gl_update_uniform(shader, "u_sun", item->atm.sun);
+    gl_update_uniform(shader, "u_moon", item->atm.moon);
+    gl_update_uniform(shader, "u_sb", item->atm.sb);
     // XXX: the tonemapping args should be copied before rendering!
     tm[0] = core->tonemapper.p;
     tm[1] = core->tonemapper.lwmax;
     tm[2] = core->tonemapper.exposure;
     gl_update_uniform(shader, "u_tm", tm);
 
-    proj = rend_get_proj(rend, item->flags);
-    gl_update_uniform_mat4(shader, "u_proj_mat", proj.mat);
+    set_proj_uniforms(rend, shader, item->flags);
 
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
     GL(glCullFace(GL_BACK));
 }
 
-static void item_texture_render(renderer_t *rend, const item_t *item)
+static void item_texture_render(renderer_gl_t *rend, const item_t *item)
 {
     gl_shader_t *shader;
-    projection_t proj;
 
     shader_define_t defines[] = {
         {"TEXTURE_LUMINANCE", item->tex->format == GL_LUMINANCE &&
                               !(item->flags & PAINTER_ADD)},
         {"PROJ", item->type == ITEM_TEXTURE ? rend->proj.klass->id : 0},
+        {"HAS_LAYER", item->type == ITEM_TEXTURE && item->layer.tex},
         {}
     };
     shader = shader_get("blit", defines, ATTR_NAMES, init_shader);
+    if (!shader) return;
 
-    GL(glUseProgram(shader->prog));
+    use_program(rend, shader);
 
     GL(glActiveTexture(GL_TEXTURE0));
     GL(glBindTexture(GL_TEXTURE_2D, item->tex->id));
+    if (item->type == ITEM_TEXTURE && item->layer.tex) {
+        GL(glActiveTexture(GL_TEXTURE1));
+        GL(glBindTexture(GL_TEXTURE_2D, item->layer.tex->id));
+        GL(glActiveTexture(GL_TEXTURE0));
+        gl_update_uniform(shader, "u_layer_color", item->layer.color);
+    }
     GL(glEnable(GL_CULL_FACE));
     GL(glCullFace(rend->cull_flipped ? GL_FRONT : GL_BACK));
 
@@ -1562,19 +2728,17 @@ static void item_texture_render(renderer_t *rend, const item_t *item)
     }
 
     gl_update_uniform(shader, "u_color", item->color);
-    proj = rend_get_proj(rend, item->flags);
-    gl_update_uniform_mat4(shader, "u_proj_mat", proj.mat);
+    set_proj_uniforms(rend, shader, item->flags);
 
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
     GL(glCullFace(GL_BACK));
 }
 
-static void item_texture_2d_render(renderer_t *rend, const item_t *item)
+static void item_texture_2d_render(renderer_gl_t *rend, const item_t *item)
 {
     gl_shader_t *shader;
-    projection_t proj;
-    float win_size[2] = {rend->fb_size[0] / rend->scale,
-                         rend->fb_size[1] / rend->scale};
+    float win_size[2] = {rend->ui_fb_size[0] / rend->ui_scale,
+                         rend->ui_fb_size[1] / rend->ui_scale};
     shader_define_t defines[] = {
         {"TEXTURE_LUMINANCE", item->tex->format == GL_LUMINANCE &&
                               !(item->flags & PAINTER_ADD)},
@@ -1583,7 +2747,8 @@ static void item_texture_2d_render(renderer_t *rend, const item_t *item)
         {}
     };
     shader = shader_get("texture_2d", defines, ATTR_NAMES, init_shader);
-    GL(glUseProgram(shader->prog));
+    if (!shader) return;
+    use_program(rend, shader);
     GL(glActiveTexture(GL_TEXTURE0));
     GL(glBindTexture(GL_TEXTURE_2D, item->tex->id));
     if (item->tex->format == GL_RGB && item->color[3] == 1.0) {
@@ -1597,24 +2762,28 @@ static void item_texture_2d_render(renderer_t *rend, const item_t *item)
         GL(glEnable(GL_DEPTH_TEST));
     gl_update_uniform(shader, "u_color", item->color);
     gl_update_uniform(shader, "u_win_size", win_size);
-    proj = rend_get_proj(rend, item->flags);
-    gl_update_uniform_mat4(shader, "u_proj_mat", proj.mat);
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    set_proj_uniforms(rend, shader, item->flags);
+    gl_update_uniform_mat3(shader, "u_win_late", rend->late.win);
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
     GL(glDisable(GL_DEPTH_TEST));
 }
 
-static void item_planet_render(renderer_t *rend, const item_t *item)
+static void item_planet_render(renderer_gl_t *rend, const item_t *item)
 {
     gl_shader_t *shader;
     bool is_moon;
+    bool has_rings = item->planet.rings_tex &&
+                     texture_load(item->planet.rings_tex, NULL);
     shader_define_t defines[] = {
         {"HAS_SHADOW", item->planet.shadow_spheres_nb > 0},
+        {"HAS_RINGS", has_rings},
         {"PROJ", rend->proj.klass->id},
         {}
     };
     shader = shader_get("planet", defines, ATTR_NAMES, init_shader);
+    if (!shader) return;
 
-    GL(glUseProgram(shader->prog));
+    use_program(rend, shader);
 
     GL(glActiveTexture(GL_TEXTURE0));
     GL(glBindTexture(GL_TEXTURE_2D, item->tex->id));
@@ -1635,6 +2804,14 @@ static void item_planet_render(renderer_t *rend, const item_t *item)
     else
         GL(glBindTexture(GL_TEXTURE_2D, rend->white_tex->id));
 
+    if (has_rings) {
+        GL(glActiveTexture(GL_TEXTURE3));
+        GL(glBindTexture(GL_TEXTURE_2D, item->planet.rings_tex->id));
+        gl_update_uniform(shader, "u_ring_center", item->planet.rings_center);
+        gl_update_uniform(shader, "u_ring_normal", item->planet.rings_normal);
+        gl_update_uniform(shader, "u_ring_radii", item->planet.rings_radii);
+    }
+
     if (item->flags & PAINTER_RING_SHADER) {
         GL(glDisable(GL_CULL_FACE));
     } else {
@@ -1670,17 +2847,20 @@ static void item_planet_render(renderer_t *rend, const item_t *item)
                       item->planet.normal_tex_transf);
 
     gl_update_uniform_mat4(shader, "u_proj_mat", rend->proj.mat);
+    gl_update_uniform_mat3(shader, "u_view_late", rend->late.rot);
 
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
     GL(glCullFace(GL_BACK));
     GL(glDepthMask(GL_FALSE));
     GL(glDisable(GL_DEPTH_TEST));
 }
 
-static void item_gltf_render(renderer_t *rend, const item_t *item)
+static void item_gltf_render(renderer_gl_t *rend, const item_t *item)
 {
-    double proj[4][4], nearval, farval;
+    double proj[4][4], view[4][4], rot[4][4], nearval, farval;
     mat4_copy(item->gltf.proj_mat, proj);
+    mat3_to_mat4(rend->late.rot, rot);
+    mat4_mul(rot, item->gltf.view_mat, view);
 
     // Fix the depth range of the projection to the current frame values.
     if (item->flags & PAINTER_ENABLE_DEPTH) {
@@ -1690,13 +2870,501 @@ static void item_gltf_render(renderer_t *rend, const item_t *item)
         proj[3][2] = 2. * farval * nearval / (nearval - farval);
     }
 
-    gltf_render(item->gltf.model, item->gltf.model_mat, item->gltf.view_mat,
+    gltf_render(item->gltf.model, item->gltf.model_mat, view,
                 proj, item->gltf.light_dir, item->gltf.args);
 }
 
-static void rend_flush(renderer_t *rend)
+static int item_sort_cmp(const void *a, const void *b)
+{
+    const item_t *x = *(const item_t**)a;
+    const item_t *y = *(const item_t**)b;
+    if (x->type != y->type) return cmp(x->type, y->type);
+    if (x->tex != y->tex) return cmp((uintptr_t)x->tex, (uintptr_t)y->tex);
+    return cmp(x->flags, y->flags);
+}
+
+/*
+ * Sort the consecutive items that have the PAINTER_ALLOW_REORDER flag by
+ * type and texture, so that we change the GL state less often.
+ */
+static void sort_items(renderer_gl_t *rend)
+{
+    item_t *item, *end, **run = NULL;
+    int i, n, size = 0;
+
+    for (item = rend->items; item; item = end) {
+        // Find the run of reorderable items starting here.
+        n = 0;
+        for (end = item; end && (end->flags & PAINTER_ALLOW_REORDER);
+             end = end->next) n++;
+        if (n == 0) {
+            end = item->next;
+            continue;
+        }
+        if (n < 2) continue;
+        if (n > size) {
+            size = n;
+            run = realloc(run, size * sizeof(*run));
+        }
+        for (i = 0; i < n; i++, item = item->next) run[i] = item;
+        // Note: qsort is not stable, but the items in the run can be
+        // rendered in any order anyway.
+        qsort(run, n, sizeof(*run), item_sort_cmp);
+        for (i = 0; i < n; i++) {
+            DL_DELETE(rend->items, run[i]);
+            if (end) DL_PREPEND_ELEM(rend->items, end, run[i]);
+            else DL_APPEND(rend->items, run[i]);
+        }
+    }
+    free(run);
+}
+
+// Render an item, and put it back into the pool.
+static void item_render(renderer_gl_t *rend, item_t *item)
+{
+    rend->frame_stats.items++;
+    rend->frame_stats.vertices += item->buf.nb;
+    switch (item->type) {
+    case ITEM_LINES:
+        item_lines_render(rend, item);
+        break;
+    case ITEM_MESH:
+        item_mesh_render(rend, item);
+        break;
+    case ITEM_STATIC_MESH:
+        item_static_mesh_render(rend, item);
+        break;
+    case ITEM_POINTS:
+        item_points_render(rend, item);
+        break;
+    case ITEM_POINTS_3D:
+        item_points_3d_render(rend, item);
+        break;
+    case ITEM_TEXTURE:
+        item_texture_render(rend, item);
+        break;
+    case ITEM_TEXTURE_2D:
+        item_texture_2d_render(rend, item);
+        break;
+    case ITEM_ATMOSPHERE:
+        item_atmosphere_render(rend, item);
+        break;
+    case ITEM_FOG:
+        item_fog_render(rend, item);
+        break;
+    case ITEM_PLANET:
+        item_planet_render(rend, item);
+        break;
+    case ITEM_ORBITS:
+        item_orbits_render(rend, item);
+        break;
+    // nanovg and gltf use their own programs.
+    case ITEM_VG_ELLIPSE:
+    case ITEM_VG_RECT:
+    case ITEM_VG_LINE:
+        item_vg_render(rend, item);
+        rend->prog = 0;
+        break;
+    case ITEM_TEXT:
+        item_text_render(rend, item);
+        rend->prog = 0;
+        break;
+    case ITEM_GLTF:
+        item_gltf_render(rend, item);
+        rend->prog = 0;
+        break;
+    default:
+        assert(false);
+    }
+
+    DL_DELETE(rend->items, item);
+    item_release(rend, item);
+}
+
+/*
+ * Upscale the sky buffer into the current framebuffer.
+ */
+static void sky_fb_blit(renderer_gl_t *rend)
+{
+    gl_shader_t *shader;
+    const float white[4] = {1, 1, 1, 1};
+    shader_define_t defines[] = {
+        {"TEXTURE_LUMINANCE", 0},
+        {"PROJ", 0},
+        {}
+    };
+    shader = shader_get("blit", defines, ATTR_NAMES, init_shader);
+    if (!shader) return;
+    use_program(rend, shader);
+    GL(glActiveTexture(GL_TEXTURE0));
+    GL(glBindTexture(GL_TEXTURE_2D, rend->sky_fb.tex));
+    GL(glDisable(GL_BLEND));
+    GL(glDisable(GL_DEPTH_TEST));
+    GL(glDisable(GL_CULL_FACE));
+    gl_update_uniform(shader, "u_color", white);
+    draw_buffer(rend, &rend->sky_fb.buf, &rend->sky_fb.indices, GL_TRIANGLES);
+}
+
+static bool is_atm_item(const item_t *item)
+{
+    return item->type == ITEM_ATMOSPHERE || item->type == ITEM_FOG;
+}
+
+/*
+ * Start to render the atmosphere and fog items into the reduced resolution
+ * atmosphere buffer.
+ *
+ * The sky gradient is very smooth, so we can shade only one pixel out of 4
+ * (or 9 on high density screens) and upsample it in atm_fb_end, before we
+ * render the landscape.  The buffer starts transparent black: the
+ * atmosphere is added to the colors and the fog is blended over them while
+ * updating the alpha, so that the final composition gives the same result
+ * as rendering the items directly.
+ *
+ * Return false if the items should be rendered directly.
+ */
+static bool atm_fb_begin(renderer_gl_t *rend)
+{
+    int factor = rend->scale >= 2.5 ? 3 : rend->scale >= 1 ? 2 : 1;
+
+    if (factor == 1) return false;
+    GL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &rend->atm_fb.prev_fbo));
+    if (!atm_fb_update(rend, (rend->fb_size[0] + factor - 1) / factor,
+                             (rend->fb_size[1] + factor - 1) / factor))
+        return false;
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, rend->atm_fb.fbo));
+    GL(glViewport(0, 0, rend->atm_fb.size[0], rend->atm_fb.size[1]));
+    GL(glColorMask(true, true, true, true));
+    GL(glClearColor(0.0, 0.0, 0.0, 0.0));
+    GL(glClear(GL_COLOR_BUFFER_BIT));
+    GL(glClearColor(0.0, 0.0, 0.0, 1.0));
+    rend->atm_fb.active = true;
+    return true;
+}
+
+/*
+ * Upsample the atmosphere buffer into the previous framebuffer.
+ */
+static void atm_fb_end(renderer_gl_t *rend)
+{
+    gl_shader_t *shader;
+    float size[2] = {rend->atm_fb.size[0], rend->atm_fb.size[1]};
+
+    rend->atm_fb.active = false;
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, rend->atm_fb.prev_fbo));
+    GL(glViewport(0, 0, rend->fb_size[0], rend->fb_size[1]));
+    GL(glColorMask(true, true, true, false));
+    shader = shader_get("upsample", NULL, ATTR_NAMES, init_shader);
+    if (!shader) return;
+    use_program(rend, shader);
+    GL(glActiveTexture(GL_TEXTURE0));
+    GL(glBindTexture(GL_TEXTURE_2D, rend->atm_fb.tex));
+    GL(glEnable(GL_BLEND));
+    GL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+    GL(glDisable(GL_DEPTH_TEST));
+    GL(glDisable(GL_CULL_FACE));
+    gl_update_uniform(shader, "u_size", size);
+    draw_buffer(rend, &rend->atm_fb.buf, &rend->atm_fb.indices,
+                GL_TRIANGLES);
+}
+
+// Create the buffers of the luminance reduction.
+static bool lum_init(renderer_gl_t *rend)
+{
+    int i, size;
+    GLenum status = GL_FRAMEBUFFER_COMPLETE;
+
+    if (rend->lum.failed) return false;
+    if (rend->lum.fbo[0]) return true;
+    GL(glGenTextures(ARRAY_SIZE(rend->lum.tex), rend->lum.tex));
+    GL(glGenFramebuffers(ARRAY_SIZE(rend->lum.fbo), rend->lum.fbo));
+    for (i = 0; i < ARRAY_SIZE(rend->lum.tex); i++) {
+        size = i < LUM_LEVELS ? LUM_SIZE >> (2 * i) : 1;
+        GL(glBindTexture(GL_TEXTURE_2D, rend->lum.tex[i]));
+        GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+        GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                           GL_CLAMP_TO_EDGE));
+        GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                           GL_CLAMP_TO_EDGE));
+        GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_RGBA,
+                        GL_UNSIGNED_BYTE, NULL));
+        GL(glBindFramebuffer(GL_FRAMEBUFFER, rend->lum.fbo[i]));
+        GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_TEXTURE_2D, rend->lum.tex[i], 0));
+        status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE) break;
+    }
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        LOG_W("Cannot create luminance buffers (%s)", gl_enum_str(status));
+        GL(glDeleteFramebuffers(ARRAY_SIZE(rend->lum.fbo), rend->lum.fbo));
+        GL(glDeleteTextures(ARRAY_SIZE(rend->lum.tex), rend->lum.tex));
+        memset(rend->lum.fbo, 0, sizeof(rend->lum.fbo));
+        rend->lum.failed = true;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Reduce the sky buffer to its average luminance into the next 1x1 buffer
+ * of the ring, and read back the oldest one.
+ *
+ * Must be called with the sky buffer bound, after it has been rendered.
+ */
+static void lum_measure(renderer_gl_t *rend)
+{
+    gl_shader_t *shader;
+    GLuint src;
+    uint8_t rgba[4];
+    int i, level, size, src_size[2];
+    float step[2];
+    shader_define_t defines[] = {{"FIRST_PASS", 1}, {}};
+
+    if (!lum_init(rend)) return;
+
+    // Read the oldest result first, before we reuse its buffer.
+    if (rend->lum.nb == LUM_RING) {
+        i = LUM_LEVELS + rend->lum.pos;
+        GL(glBindFramebuffer(GL_FRAMEBUFFER, rend->lum.fbo[i]));
+        GL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+        GL(glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba));
+        rend->lum.value = pow(rgba[0] / 255.0, 2.2);
+        rend->lum.has_value = true;
+        rend->lum.nb--;
+    }
+
+    GL(glDisable(GL_BLEND));
+    GL(glDisable(GL_DEPTH_TEST));
+    GL(glDisable(GL_CULL_FACE));
+    GL(glColorMask(true, true, true, true));
+    GL(glActiveTexture(GL_TEXTURE0));
+    src = rend->sky_fb.tex;
+    src_size[0] = rend->sky_fb.size[0];
+    src_size[1] = rend->sky_fb.size[1];
+    for (level = 0; level <= LUM_LEVELS; level++) {
+        size = LUM_SIZE >> (2 * level);
+        // The first pass takes the samples over the whole sky buffer.
+        step[0] = level ? 1.0 / src_size[0] : 1.0 / (size * 4);
+        step[1] = level ? 1.0 / src_size[1] : 1.0 / (size * 4);
+        i = level < LUM_LEVELS ? level : LUM_LEVELS + rend->lum.pos;
+        defines[0].val = level == 0;
+        shader = shader_get("luminance", defines, ATTR_NAMES, init_shader);
+        if (!shader) {
+            rend->lum.failed = true;
+            break;
+        }
+        use_program(rend, shader);
+        GL(glBindFramebuffer(GL_FRAMEBUFFER, rend->lum.fbo[i]));
+        GL(glViewport(0, 0, size, size));
+        GL(glBindTexture(GL_TEXTURE_2D, src));
+        gl_update_uniform(shader, "u_step", step);
+        draw_buffer(rend, &rend->sky_fb.buf, &rend->sky_fb.indices,
+                    GL_TRIANGLES);
+        src = rend->lum.tex[i];
+        src_size[0] = src_size[1] = size;
+    }
+    rend->lum.pos = (rend->lum.pos + 1) % LUM_RING;
+    rend->lum.nb++;
+    GL(glColorMask(true, true, true, false));
+}
+
+static bool gl_measure_luminance(renderer_t *rend_, double *value)
+{
+    renderer_gl_t *rend = (void*)rend_;
+    rend->lum.frame = rend->frame;
+    if (rend->lum.failed || rend->sky_fb.failed) return false;
+    *value = rend->lum.value;
+    return rend->lum.has_value;
+}
+
+// Create the ring of object ids buffers.
+static bool pick_init(renderer_gl_t *rend)
+{
+    int i;
+    GLenum status = GL_FRAMEBUFFER_COMPLETE;
+    typeof(rend->pick.bufs[0]) *buf;
+
+    if (rend->pick.failed) return false;
+    if (rend->pick.bufs[0].fbo) return true;
+    for (i = 0; i < PICK_RING; i++) {
+        buf = &rend->pick.bufs[i];
+        GL(glGenTextures(1, &buf->tex));
+        GL(glBindTexture(GL_TEXTURE_2D, buf->tex));
+        GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+        GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PICK_SIZE, PICK_SIZE, 0,
+                        GL_RGBA, GL_UNSIGNED_BYTE, NULL));
+        GL(glGenFramebuffers(1, &buf->fbo));
+        GL(glBindFramebuffer(GL_FRAMEBUFFER, buf->fbo));
+        GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_TEXTURE_2D, buf->tex, 0));
+        status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE) break;
+    }
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        LOG_W("Cannot create object ids buffers (%s)", gl_enum_str(status));
+        for (i = 0; i < PICK_RING; i++) {
+            buf = &rend->pick.bufs[i];
+            if (buf->fbo) GL(glDeleteFramebuffers(1, &buf->fbo));
+            if (buf->tex) GL(glDeleteTextures(1, &buf->tex));
+            buf->fbo = buf->tex = 0;
+        }
+        rend->pick.failed = true;
+        return false;
+    }
+    return true;
+}
+
+static void item_points_pick(renderer_gl_t *rend, const item_t *item)
+{
+    gl_shader_t *shader;
+    bool is_3d = item->type == ITEM_POINTS_3D;
+    shader_define_t defines[] = {
+        {"PICK", true},
+        {"IS_3D", is_3d},
+        {"PROJ", rend->proj.klass->id},
+        {}
+    };
+
+    if (item->buf.nb <= 0) return;
+    shader = shader_get("points", defines, ATTR_NAMES, init_shader);
+    if (!shader) return;
+    use_program(rend, shader);
+    vbo_upload(rend, 0, item->buf.data, item->buf.nb * item->buf.info->size);
+    if (is_3d)
+        set_proj_uniforms(rend, shader, item->flags);
+    else
+        gl_update_uniform_mat3(shader, "u_ndc_late", rend->late.ndc);
+    gl_buf_enable(&item->buf);
+    GL(glDrawArrays(GL_POINTS, 0, item->buf.nb));
+    rend->frame_stats.draw_calls++;
+    gl_buf_disable(&item->buf);
+}
+
+/*
+ * Render the points ids around the picked position into the next buffer
+ * of the ring, and read back the oldest one.
+ *
+ * Must be called after all the sky items have been rendered, with the sky
+ * framebuffer still bound.
+ */
+static void pick_render(renderer_gl_t *rend)
+{
+    typeof(rend->pick.bufs[0]) *buf, *res = &rend->pick.bufs[PICK_RING];
+    pick_ids_t ids;
+    item_t *item;
+    GLint prev_fbo;
+
+    if (!pick_init(rend)) return;
+    GL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo));
+    buf = &rend->pick.bufs[rend->pick.ring];
+
+    // Read the oldest buffer first, before we reuse it.  Its ids become
+    // the ones of the result.
+    if (rend->pick.nb == PICK_RING) {
+        if (!rend->pick.pixels)
+            rend->pick.pixels = malloc(PICK_SIZE * PICK_SIZE * 4);
+        GL(glBindFramebuffer(GL_FRAMEBUFFER, buf->fbo));
+        GL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+        GL(glReadPixels(0, 0, PICK_SIZE, PICK_SIZE, GL_RGBA,
+                        GL_UNSIGNED_BYTE, rend->pick.pixels));
+        pick_ids_clear(&res->ids);
+        ids = res->ids;
+        res->ids = buf->ids;
+        buf->ids = ids;
+        memcpy(res->origin, buf->origin, sizeof(res->origin));
+        res->fb_h = buf->fb_h;
+        res->scale = buf->scale;
+        rend->pick.nb--;
+    }
+
+    ids = buf->ids;
+    buf->ids = rend->pick.ids;
+    rend->pick.ids = ids;
+    buf->scale = rend->scale;
+    buf->fb_h = rend->fb_size[1];
+    buf->origin[0] = round(rend->pick.pos[0] * rend->scale) - PICK_SIZE / 2;
+    buf->origin[1] = round(buf->fb_h - rend->pick.pos[1] * rend->scale) -
+                     PICK_SIZE / 2;
+
+    // The viewport offset puts the picked position at the buffer center.
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, buf->fbo));
+    GL(glViewport(-buf->origin[0], -buf->origin[1],
+                  rend->fb_size[0], rend->fb_size[1]));
+    GL(glDisable(GL_BLEND));
+    GL(glDisable(GL_DEPTH_TEST));
+    GL(glDisable(GL_CULL_FACE));
+    GL(glColorMask(true, true, true, true));
+    GL(glClearColor(0.0, 0.0, 0.0, 0.0));
+    GL(glClear(GL_COLOR_BUFFER_BIT));
+    DL_FOREACH(rend->items, item) {
+        if (rend->sky_fb.used && item->overlay) continue;
+        if (item->type == ITEM_POINTS || item->type == ITEM_POINTS_3D)
+            item_points_pick(rend, item);
+    }
+    rend->pick.ring = (rend->pick.ring + 1) % PICK_RING;
+    rend->pick.nb++;
+
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo));
+    GL(glViewport(0, 0, rend->fb_size[0], rend->fb_size[1]));
+    GL(glClearColor(0.0, 0.0, 0.0, 1.0));
+    GL(glColorMask(true, true, true, false));
+}
+
+static bool gl_pick(renderer_t *rend_, const double pos[2], double max_dist,
+                    obj_t **obj)
+{
+    renderer_gl_t *rend = (void*)rend_;
+    const typeof(rend->pick.bufs[0]) *res = &rend->pick.bufs[PICK_RING];
+    const pick_obj_t *pick;
+    const uint8_t *pix;
+    double c[2], r, d2, best_d2 = DBL_MAX;
+    int x, y, x0, y0, x1, y1;
+    uint32_t id, best = 0;
+
+    rend->pick.frame = rend->frame;
+    rend->pick.pos[0] = pos[0];
+    rend->pick.pos[1] = pos[1];
+    if (!rend->pick.pixels) return false;
+
+    // Search the closest id within max_dist, which must fit in the buffer.
+    c[0] = pos[0] * res->scale - res->origin[0];
+    c[1] = res->fb_h - pos[1] * res->scale - res->origin[1];
+    r = fmin(max_dist * res->scale, PICK_SIZE / 4);
+    if (c[0] - r < 0 || c[1] - r < 0 ||
+            c[0] + r > PICK_SIZE || c[1] + r > PICK_SIZE)
+        return false;
+    if (!obj) return true;
+    x0 = floor(c[0] - r);
+    y0 = floor(c[1] - r);
+    x1 = fmin(ceil(c[0] + r), PICK_SIZE - 1);
+    y1 = fmin(ceil(c[1] + r), PICK_SIZE - 1);
+    for (y = y0; y <= y1; y++)
+    for (x = x0; x <= x1; x++) {
+        pix = rend->pick.pixels + (y * PICK_SIZE + x) * 4;
+        if (!pix[3]) continue;
+        d2 = pow(x + 0.5 - c[0], 2) + pow(y + 0.5 - c[1], 2);
+        if (d2 > r * r || d2 >= best_d2) continue;
+        id = pix[0] | pix[1] << 8 | pix[2] << 16;
+        if (id == 0 || id > res->ids.nb) continue;
+        best_d2 = d2;
+        best = id;
+    }
+    if (!best) return true;
+    pick = &res->ids.objs[best - 1];
+    if (pick->source && pick->obj->klass->get_source)
+        *obj = pick->obj->klass->get_source(pick->obj, pick->source);
+    else
+        *obj = obj_retain(pick->obj);
+    return true;
+}
+
+static void rend_flush(renderer_gl_t *rend)
 {
     item_t *item, *tmp;
+    GLint prev_fbo = 0;
+    bool sky_fb = rend->sky_fb.used;
 
     // Compute depth range.
     if (rend->depth_min == DBL_MAX) {
@@ -1711,6 +3379,8 @@ static void rend_flush(renderer_t *rend)
     rend->depth_min *= 0.99;
     rend->depth_max *= 2.00;
     proj_set_depth_range(&rend->proj, rend->depth_min, rend->depth_max);
+    trace_begin("render", "flush");
+    gpu_timer_begin(rend);
 
     // Set default OpenGL state.
     // Make sure we clear everything.
@@ -1721,6 +3391,13 @@ static void rend_flush(renderer_t *rend)
     GL(glClear(GL_COLOR_BUFFER_BIT |
                GL_DEPTH_BUFFER_BIT |
                GL_STENCIL_BUFFER_BIT));
+    if (sky_fb) {
+        GL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo));
+        GL(glBindFramebuffer(GL_FRAMEBUFFER, rend->sky_fb.fbo));
+        GL(glClear(GL_COLOR_BUFFER_BIT |
+                   GL_DEPTH_BUFFER_BIT |
+                   GL_STENCIL_BUFFER_BIT));
+    }
 
     GL(glViewport(0, 0, rend->fb_size[0], rend->fb_size[1]));
     GL(glDepthMask(GL_FALSE));
@@ -1734,93 +3411,97 @@ static void rend_flush(renderer_t *rend)
     GL(glEnable(GL_POINT_SPRITE));
 #endif
 
-    DL_FOREACH_SAFE(rend->items, item, tmp) {
-        switch (item->type) {
-        case ITEM_LINES:
-            item_lines_render(rend, item);
-            break;
-        case ITEM_MESH:
-            item_mesh_render(rend, item);
-            break;
-        case ITEM_POINTS:
-            item_points_render(rend, item);
-            break;
-        case ITEM_POINTS_3D:
-            item_points_3d_render(rend, item);
-            break;
-        case ITEM_TEXTURE:
-            item_texture_render(rend, item);
-            break;
-        case ITEM_TEXTURE_2D:
-            item_texture_2d_render(rend, item);
-            break;
-        case ITEM_ATMOSPHERE:
-            item_atmosphere_render(rend, item);
-            break;
-        case ITEM_FOG:
-            item_fog_render(rend, item);
-            break;
-        case ITEM_PLANET:
-            item_planet_render(rend, item);
-            break;
-        case ITEM_VG_ELLIPSE:
-        case ITEM_VG_RECT:
-        case ITEM_VG_LINE:
-            item_vg_render(rend, item);
-            break;
-        case ITEM_TEXT:
-            item_text_render(rend, item);
-            break;
-        case ITEM_GLTF:
-            item_gltf_render(rend, item);
-            break;
-        default:
-            assert(false);
-        }
+    sort_items(rend);
+    memset(&rend->frame_stats, 0, sizeof(rend->frame_stats));
+    rend->prog = 0;
 
-        DL_DELETE(rend->items, item);
-        texture_release(item->tex);
-        if (item->type == ITEM_PLANET)
-            texture_release(item->planet.normalmap);
-        if (item->type == ITEM_GLTF)
-            json_builder_free(item->gltf.args);
-        gl_buf_release(&item->buf);
-        gl_buf_release(&item->indices);
-        free(item);
+    // If we render the sky at a lower resolution, first render all the
+    // items but the overlays into the sky buffer, then upscale it and
+    // render the overlays on top at native resolution.
+    DL_FOREACH_SAFE(rend->items, item, tmp) {
+        if (sky_fb && item->overlay) continue;
+        if (is_atm_item(item) && !rend->atm_fb.active) atm_fb_begin(rend);
+        item_render(rend, item);
+        if (rend->atm_fb.active && (!tmp || !is_atm_item(tmp)))
+            atm_fb_end(rend);
+    }
+    if (rend->pick.active) pick_render(rend);
+    if (sky_fb) {
+        if (rend->lum.active) lum_measure(rend);
+        GL(glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo));
+        GL(glViewport(0, 0, rend->ui_fb_size[0], rend->ui_fb_size[1]));
+        sky_fb_blit(rend);
+        DL_FOREACH_SAFE(rend->items, item, tmp)
+            item_render(rend, item);
     }
     // Reset to default OpenGL settings.
     GL(glDepthMask(GL_TRUE));
     GL(glColorMask(true, true, true, true));
+    GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+
+    // Give back all the pooled buffers for the next frame.
+    rend->vbos[0].used = 0;
+    rend->vbos[1].used = 0;
+    rend->stats = rend->frame_stats;
+    gpu_timer_end(rend);
+    trace_counter("render", "draw_calls", rend->stats.draw_calls);
+    trace_end("render", "flush");
 }
 
-void render_finish(renderer_t *rend)
+static void gl_finish(renderer_t *rend_)
 {
+    renderer_gl_t *rend = (void*)rend_;
     rend_flush(rend);
 }
 
-void render_line(renderer_t *rend, const painter_t *painter,
-                 const double (*line)[3], const double (*win)[3], int size)
+static bool gl_read_pixels(renderer_t *rend_, int w, int h, uint8_t *out)
 {
-    line_mesh_t *mesh;
-    int i, ofs;
+    int i;
+    uint8_t *row;
+
+    GL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    GL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+    GL(glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, out));
+    // OpenGL returns the rows bottom first.
+    row = malloc(w * 4);
+    for (i = 0; i < h / 2; i++) {
+        memcpy(row, out + i * w * 4, w * 4);
+        memcpy(out + i * w * 4, out + (h - 1 - i) * w * 4, w * 4);
+        memcpy(out + (h - 1 - i) * w * 4, row, w * 4);
+    }
+    free(row);
+    return true;
+}
+
+static void gl_get_stats(const renderer_t *rend_, render_stats_t *stats)
+{
+    const renderer_gl_t *rend = (const void*)rend_;
+    *stats = rend->stats;
+}
+
+static void gl_line(renderer_t *rend_, const painter_t *painter,
+                    const double (*line)[3], const double (*win)[3], int size)
+{
+    renderer_gl_t *rend = (void*)rend_;
+    int i, k, ofs;
     float color[4];
-    double depth;
+    double depth, length = 0, width;
     item_t *item;
     const int SIZE = 2048;
 
     if (size <= 1) return;
     assert(painter->lines.glow); // Only glowing lines supported for now.
     vec4_to_float(painter->color, color);
-    mesh = line_to_mesh(line, win, size, fmax(10, painter->lines.width + 2));
+    width = fmax(10, painter->lines.width + 2);
 
-    if (mesh->indices_count >= SIZE || mesh->verts_count >= SIZE) {
+    if ((size - 1) * 6 >= SIZE || size * 2 >= SIZE) {
         LOG_W("Too many points in lines! (size: %d)", size);
-        goto end;
+        return;
     }
 
     // Get the item.
-    item = get_item(rend, ITEM_LINES, mesh->verts_count,
-                    mesh->indices_count, NULL);
+    item = get_item(rend, ITEM_LINES, size * 2, (size - 1) * 6, NULL);
     if (item && memcmp(item->color, color, sizeof(color))) item = NULL;
     if (item && item->lines.dash_length != painter->lines.dash_length)
         item = NULL;
@@ -1836,11 +3517,8 @@ void render_line(renderer_t *rend, const painter_t *painter,
         item = NULL;
 
     if (!item) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_LINES;
+        item = item_new(rend, ITEM_LINES, &LINES_BUF, SIZE, SIZE);
         item->flags = painter->flags;
-        gl_buf_alloc(&item->buf, &LINES_BUF, SIZE);
-        gl_buf_alloc(&item->indices, &INDICES_BUF, SIZE);
         item->lines.width = painter->lines.width;
         item->lines.glow = painter->lines.glow;
         item->lines.dash_length = painter->lines.dash_length;
@@ -1860,30 +3538,81 @@ void render_line(renderer_t *rend, const painter_t *painter,
         }
     }
 
-    // Append the mesh to the buffer.
+    // Append the points to the buffer, the window coordinates are only
+    // used for the dashes length.
     ofs = item->buf.nb;
-    for (i = 0; i < mesh->verts_count; i++) {
-        gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(mesh->verts[i].pos));
-        gl_buf_2f(&item->buf, -1, ATTR_WPOS, VEC2_SPLIT(mesh->verts[i].win));
-        gl_buf_2f(&item->buf, -1, ATTR_TEX_POS, VEC2_SPLIT(mesh->verts[i].uv));
-        gl_buf_next(&item->buf);
+    for (i = 0; i < size; i++) {
+        if (i > 0) length += vec2_dist(win[i - 1], win[i]);
+        for (k = 0; k < 2; k++) {
+            gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(line[i]));
+            gl_buf_3f(&item->buf, -1, ATTR_PREV_POS,
+                      VEC3_SPLIT(line[i ? i - 1 : 0]));
+            gl_buf_3f(&item->buf, -1, ATTR_NEXT_POS,
+                      VEC3_SPLIT(line[i < size - 1 ? i + 1 : i]));
+            gl_buf_2f(&item->buf, -1, ATTR_TEX_POS,
+                      length, k ? width / 2 : -width / 2);
+            gl_buf_next(&item->buf);
+        }
     }
-    for (i = 0; i < mesh->indices_count; i++) {
-        gl_buf_1i(&item->indices, -1, 0, mesh->indices[i] + ofs);
-        gl_buf_next(&item->indices);
+    for (i = 0; i < size - 1; i++) {
+        for (k = 0; k < 6; k++) {
+            gl_buf_1i(&item->indices, -1, 0,
+                      ofs + i * 2 + (int[]){0, 1, 2, 3, 2, 1}[k]);
+            gl_buf_next(&item->indices);
+        }
     }
+}
 
-end:
-    line_mesh_delete(mesh);
+static int gl_orbit(renderer_t *rend_, const painter_t *painter,
+                    const double focus[3], const double axes[2][3], double e)
+{
+    renderer_gl_t *rend = (void*)rend_;
+    item_t *item;
+    double depth, r;
+    const int BATCH_SIZE = 4096;
+
+    if (!rend->has_instancing) return -1;
+    assert(painter->lines.glow); // Same as for the lines.
+
+    item = get_item(rend, ITEM_ORBITS, 1, 0, NULL);
+    if (item && item->lines.width != painter->lines.width) item = NULL;
+    if (item && item->lines.glow != painter->lines.glow) item = NULL;
+    if (item && item->flags != painter->flags) item = NULL;
+    if (!item) {
+        item = item_new(rend, ITEM_ORBITS, &ORBIT_BUF, BATCH_SIZE, 0);
+        item->flags = painter->flags;
+        item->lines.width = painter->lines.width;
+        item->lines.glow = painter->lines.glow;
+        DL_APPEND(rend->items, item);
+    }
+
+    if (item->flags & PAINTER_ENABLE_DEPTH) {
+        // All the orbit is within the apoapsis distance of the focus.
+        r = vec3_norm(axes[0]) * (1 + e);
+        depth = proj_get_depth(painter->proj, focus);
+        rend->depth_min = fmin(rend->depth_min, fmax(depth - r, 0));
+        rend->depth_max = fmax(rend->depth_max, depth + r);
+    }
+
+    gl_buf_4f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(focus), e);
+    gl_buf_3f(&item->buf, -1, ATTR_AXIS_A, VEC3_SPLIT(axes[0]));
+    gl_buf_3f(&item->buf, -1, ATTR_AXIS_B, VEC3_SPLIT(axes[1]));
+    gl_buf_4i(&item->buf, -1, ATTR_COLOR,
+              round(painter->color[0] * 255), round(painter->color[1] * 255),
+              round(painter->color[2] * 255), round(painter->color[3] * 255));
+    gl_buf_next(&item->buf);
+    return 0;
 }
 
-void render_mesh(renderer_t *rend, const painter_t *painter,
-                 int frame, int mode, int verts_count,
-                 const double verts[][3], int indices_count,
-                 const uint16_t indices[], bool use_stencil)
+static void gl_mesh(renderer_t *rend_, const painter_t *painter,
+                    int frame, int mode, int verts_count,
+                    const double verts[][3], int indices_count,
+                    const uint16_t indices[], bool use_stencil)
 {
+    renderer_gl_t *rend = (void*)rend_;
     int i, ofs;
-    double pos[4] = {};
+    size_t mark;
+    double (*view)[3];
     uint8_t color[4];
     item_t *item;
 
@@ -1899,27 +3628,28 @@ void render_mesh(renderer_t *rend, const painter_t *painter,
     if (item && item->mesh.stroke_width != painter->lines.width) item = NULL;
 
     if (!item) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_MESH;
+        item = item_new(rend, ITEM_MESH, &MESH_BUF, fmax(verts_count, 1024),
+                        fmax(indices_count, 1024));
         item->mesh.mode = mode;
         item->mesh.stroke_width = painter->lines.width;
         item->mesh.use_stencil = use_stencil;
-        gl_buf_alloc(&item->buf, &MESH_BUF, fmax(verts_count, 1024));
-        gl_buf_alloc(&item->indices, &INDICES_BUF, fmax(indices_count, 1024));
         DL_APPEND(rend->items, item);
     }
 
     ofs = item->buf.nb;
 
+    mark = frame_alloc_mark();
+    view = frame_alloc(verts_count * sizeof(*view));
+    for (i = 0; i < verts_count; i++)
+        vec3_normalize(verts[i], view[i]);
+    convert_frame_batch(painter->obs, frame, FRAME_VIEW, true, verts_count,
+                        view, view);
     for (i = 0; i < verts_count; i++) {
-        vec3_copy(verts[i], pos);
-        pos[3] = 0.0;
-        vec3_normalize(pos, pos);
-        convert_frame(painter->obs, frame, FRAME_VIEW, true, pos, pos);
-        gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(pos));
+        gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(view[i]));
         gl_buf_4i(&item->buf, -1, ATTR_COLOR, VEC4_SPLIT(color));
         gl_buf_next(&item->buf);
     }
+    frame_alloc_rewind(mark);
 
     // Fill the indice buffer.
     for (i = 0; i < indices_count; i++) {
@@ -1928,13 +3658,67 @@ void render_mesh(renderer_t *rend, const painter_t *painter,
     }
 }
 
-void render_ellipse_2d(renderer_t *rend, const painter_t *painter,
-                       const double pos[2], const double size[2],
-                       double angle, double dashes)
+/*
+ * Compute the matrix that transforms the static mesh vertices from their
+ * frame to the view frame.  With refraction, the matrix only goes up to
+ * the observed geometric frame, and the shader applies the refraction and
+ * the observed to view rotation.
+ */
+static void get_static_mesh_mat(const observer_t *obs, int frame,
+                                bool refraction, double mat[3][3])
+{
+    int i;
+    double v[3];
+    int dest = refraction ? FRAME_OBSERVED_GEOM : FRAME_VIEW;
+
+    if (frame == FRAME_ASTROM) frame = FRAME_ICRF;
+    for (i = 0; i < 3; i++) {
+        vec3_set(v, i == 0, i == 1, i == 2);
+        convert_frame(obs, frame, dest, true, v, v);
+        vec3_copy(v, mat[i]);
+    }
+}
+
+static int gl_static_mesh(renderer_t *rend_, const painter_t *painter,
+                          int frame, int mode, static_mesh_t *smesh)
 {
+    renderer_gl_t *rend = (void*)rend_;
+    const observer_t *obs = painter->obs;
     item_t *item;
-    item = calloc(1, sizeof(*item));
-    item->type = ITEM_VG_ELLIPSE;
+
+    if (!rend->has_vertex_textures) return -1;
+    if (!painter->color[3]) return 0;
+
+    item = item_new(rend, ITEM_STATIC_MESH, NULL, 0, 0);
+    item->static_mesh.mesh = smesh;
+    smesh->ref++;
+    item->static_mesh.mode = mode;
+    item->static_mesh.stroke_width = painter->lines.width;
+    item->static_mesh.use_stencil = mode == MODE_TRIANGLES &&
+                                    smesh->subdivided;
+    item->static_mesh.blink = smesh->blink;
+    // Same condition as in painter_to_view_batch.
+    item->static_mesh.refraction = obs->pressure &&
+            (frame < FRAME_OBSERVED || frame == FRAME_ECLIPTIC);
+    get_static_mesh_mat(obs, frame, item->static_mesh.refraction,
+                        item->static_mesh.mat);
+    mat3_copy(obs->ro2v, item->static_mesh.ro2v);
+    item->static_mesh.refa_refb[0] = obs->refa;
+    item->static_mesh.refa_refb[1] = obs->refb;
+    vec4_to_float(painter->color, item->color);
+    item->tex = static_mesh_get_texture(smesh);
+    texture_retain(item->tex);
+    DL_APPEND(rend->items, item);
+    return 0;
+}
+
+static void gl_ellipse_2d(renderer_t *rend_, const painter_t *painter,
+                          const double pos[2], const double size[2],
+                          double angle, double dashes)
+{
+    renderer_gl_t *rend = (void*)rend_;
+    item_t *item;
+    item = item_new(rend, ITEM_VG_ELLIPSE, NULL, 0, 0);
     vec2_to_float(pos, item->vg.pos);
     vec2_to_float(size, item->vg.size);
     vec4_to_float(painter->color, item->color);
@@ -1944,13 +3728,13 @@ void render_ellipse_2d(renderer_t *rend, const painter_t *painter,
     DL_APPEND(rend->items, item);
 }
 
-void render_rect_2d(renderer_t *rend, const painter_t *painter,
-                    const double pos[2], const double size[2],
-                    double angle)
+static void gl_rect_2d(renderer_t *rend_, const painter_t *painter,
+                       const double pos[2], const double size[2],
+                       double angle)
 {
+    renderer_gl_t *rend = (void*)rend_;
     item_t *item;
-    item = calloc(1, sizeof(*item));
-    item->type = ITEM_VG_RECT;
+    item = item_new(rend, ITEM_VG_RECT, NULL, 0, 0);
     vec2_to_float(pos, item->vg.pos);
     vec2_to_float(size, item->vg.size);
     vec4_to_float(painter->color, item->color);
@@ -1959,12 +3743,12 @@ void render_rect_2d(renderer_t *rend, const painter_t *painter,
     DL_APPEND(rend->items, item);
 }
 
-void render_line_2d(renderer_t *rend, const painter_t *painter,
-                    const double p1[2], const double p2[2])
+static void gl_line_2d(renderer_t *rend_, const painter_t *painter,
+                       const double p1[2], const double p2[2])
 {
+    renderer_gl_t *rend = (void*)rend_;
     item_t *item;
-    item = calloc(1, sizeof(*item));
-    item->type = ITEM_VG_LINE;
+    item = item_new(rend, ITEM_VG_LINE, NULL, 0, 0);
     vec2_to_float(p1, item->vg.pos);
     vec2_to_float(p2, item->vg.pos2);
     vec4_to_float(painter->color, item->color);
@@ -2017,16 +3801,17 @@ static void get_model_depth_range(
     if (size > dist) out_range[0] = 0;
 }
 
-void render_model_3d(renderer_t *rend, const painter_t *painter,
-                     const char *model, const double model_mat[4][4],
-                     const double view_mat[4][4], const double proj_mat[4][4],
-                     const double light_dir[3], const json_value *args)
+static void gl_model_3d(renderer_t *rend_, const painter_t *painter,
+                        const char *model, const double model_mat[4][4],
+                        const double view_mat[4][4],
+                        const double proj_mat[4][4],
+                        const double light_dir[3], const json_value *args)
 {
+    renderer_gl_t *rend = (void*)rend_;
     item_t *item;
     double depth_range[2];
 
-    item = calloc(1, sizeof(*item));
-    item->type = ITEM_GLTF;
+    item = item_new(rend, ITEM_GLTF, NULL, 0, 0);
     item->gltf.model = model;
     item->flags = painter->flags;
     mat4_copy(model_mat, item->gltf.model_mat);
@@ -2043,24 +3828,69 @@ void render_model_3d(renderer_t *rend, const painter_t *painter,
     DL_APPEND(rend->items, item);
 }
 
+// Create the nanovg context, without any font.
+static void vg_create(renderer_gl_t *rend)
+{
+#ifdef GLES2
+    rend->vg = nvgCreateGLES2(NVG_ANTIALIAS);
+#else
+    rend->vg = nvgCreateGL2(NVG_ANTIALIAS);
+#endif
+    rend->fonts[FONT_REGULAR].id = -1;
+    rend->fonts[FONT_BOLD].id = -1;
+    rend->default_fonts_loaded = false;
+}
+
+static void vg_delete(renderer_gl_t *rend)
+{
+#ifdef GLES2
+    nvgDeleteGLES2(rend->vg);
+#else
+    nvgDeleteGL2(rend->vg);
+#endif
+}
+
 static texture_t *create_white_texture(int w, int h)
 {
     uint8_t *data;
     texture_t *tex;
     data = malloc(w * h * 3);
     memset(data, 255, w * h * 3);
-    tex = texture_from_data(data, w, h, 3, 0, 0, w, h, 0);
+    tex = texture_from_data(data, w, h, 3, 0, 0, w, h, TF_KEEP_DATA);
     free(data);
     return tex;
 }
 
+static void add_font(renderer_gl_t *rend, int font, const uint8_t *data,
+                     int size)
+{
+    int id;
+    text_metrics_t *metrics, *tmp;
+    const char *names[] = {"regular", "bold"};
+
+    // The cached text metrics depend on the fonts.
+    HASH_ITER(hh, rend->text_metrics, metrics, tmp) {
+        HASH_DEL(rend->text_metrics, metrics);
+        free(metrics->key);
+        free(metrics);
+    }
+
+    id = nvgCreateFontMem(rend->vg, names[font], (unsigned char*)data, size,
+                          0);
+    if (rend->fonts[font].id == -1 || rend->fonts[font].is_default_font) {
+        rend->fonts[font].id = id;
+        rend->fonts[font].is_default_font = false;
+    } else {
+        nvgAddFallbackFontId(rend->vg, rend->fonts[font].id, id);
+    }
+}
+
 EMSCRIPTEN_KEEPALIVE
-void core_add_font(renderer_t *rend, const char *name,
+void core_add_font(renderer_gl_t *rend, const char *name,
                    const char *url, const uint8_t *data,
                    int size)
 {
-    int id;
-    int font;
+    int font, n;
     rend = rend ?: (void*)core->rend;
 
     if (!data) {
@@ -2077,23 +3907,85 @@ void core_add_font(renderer_t *rend, const char *name,
         return;
     }
 
-    id = nvgCreateFontMem(rend->vg, name, (unsigned char*)data, size, 0);
-    if (!rend->fonts[font].id || rend->fonts[font].is_default_font) {
-        rend->fonts[font].id = id;
-        rend->fonts[font].is_default_font = false;
-    } else {
-        nvgAddFallbackFontId(rend->vg, rend->fonts[font].id, id);
+    n = rend->added_fonts_nb++;
+    rend->added_fonts = realloc(rend->added_fonts,
+                                (n + 1) * sizeof(*rend->added_fonts));
+    rend->added_fonts[n].font = font;
+    rend->added_fonts[n].data = data;
+    rend->added_fonts[n].size = size;
+    add_font(rend, font, data, size);
+}
+
+/*
+ * Load the bundled fonts for the fonts that have not been set yet with
+ * core_add_font.
+ */
+static void set_default_fonts(renderer_gl_t *rend)
+{
+    const char *urls[] = {"asset://font/NotoSans-Regular.ttf",
+                          "asset://font/NotoSans-Bold.ttf"};
+    const uint8_t *data;
+    int font, size;
+
+    rend->default_fonts_loaded = true;
+    for (font = 0; font < ARRAY_SIZE(urls); font++) {
+        if (rend->fonts[font].id != -1) continue;
+        data = asset_get_data(urls[font], &size, NULL);
+        assert(data);
+        add_font(rend, font, data, size);
+        rend->fonts[font].is_default_font = true;
     }
 }
 
-static void set_default_fonts(renderer_t *rend)
+/*
+ * Forget all the GL objects after a context loss, and create the ones we
+ * need again.  The textures have already been reset by
+ * texture_on_context_lost.
+ */
+static void gl_context_restored(renderer_t *rend_)
 {
-    core_add_font(rend, "regular", "asset://font/NotoSans-Regular.ttf",
-                  NULL, 0);
-    core_add_font(rend, "bold", "asset://font/NotoSans-Bold.ttf",
-                  NULL, 0);
-    rend->fonts[FONT_REGULAR].is_default_font = true;
-    rend->fonts[FONT_BOLD].is_default_font = true;
+    renderer_gl_t *rend = (void*)rend_;
+    int i;
+
+    // The text textures are regenerated when needed.
+    gl_release_caches(rend_, false);
+    for (i = 0; i < ARRAY_SIZE(rend->vbos); i++) {
+        free(rend->vbos[i].bufs);
+        rend->vbos[i].bufs = NULL;
+        rend->vbos[i].nb = rend->vbos[i].used = 0;
+    }
+    rend->sky_fb.fbo = rend->sky_fb.tex = rend->sky_fb.depth = 0;
+    rend->sky_fb.size[0] = rend->sky_fb.size[1] = 0;
+    rend->sky_fb.failed = false;
+    rend->atm_fb.fbo = rend->atm_fb.tex = 0;
+    rend->atm_fb.size[0] = rend->atm_fb.size[1] = 0;
+    rend->atm_fb.failed = false;
+    memset(rend->lum.tex, 0, sizeof(rend->lum.tex));
+    memset(rend->lum.fbo, 0, sizeof(rend->lum.fbo));
+    rend->lum.nb = 0;
+    rend->lum.failed = false;
+    rend->lum.has_value = false;
+    for (i = 0; i < PICK_RING; i++)
+        rend->pick.bufs[i].fbo = rend->pick.bufs[i].tex = 0;
+    rend->pick.failed = false;
+    pick_reset(rend);
+    rend->orbit_strip.vbo = 0;
+#if HAS_GPU_TIMER
+    memset(&rend->gpu_timer, 0, sizeof(rend->gpu_timer));
+#endif
+    rend->prog = 0;
+    rend->warmup_done_proj = 0;
+    texture_load(rend->white_tex, NULL);
+
+    // The nanovg objects of the lost context are already invalid, so
+    // deleting them only sets some errors that we ignore.
+    vg_delete(rend);
+    while (glGetError() != GL_NO_ERROR) {}
+    vg_create(rend);
+    for (i = 0; i < rend->added_fonts_nb; i++) {
+        add_font(rend, rend->added_fonts[i].font, rend->added_fonts[i].data,
+                 rend->added_fonts[i].size);
+    }
 }
 
 #if DEBUG && defined(GL_DEBUG_OUTPUT)
@@ -2108,9 +4000,35 @@ static void debug_callback(GLenum source, GLenum type, GLuint id,
 }
 #endif
 
-renderer_t* render_create(void)
+static const render_backend_t GL_BACKEND = {
+    .prepare        = gl_prepare,
+    .finish         = gl_finish,
+    .get_stats      = gl_get_stats,
+    .set_sky_scale  = gl_set_sky_scale,
+    .release_caches = gl_release_caches,
+    .read_pixels    = gl_read_pixels,
+    .measure_luminance = gl_measure_luminance,
+    .pick           = gl_pick,
+    .set_late_view  = gl_set_late_view,
+    .context_restored = gl_context_restored,
+    .points_2d      = gl_points_2d,
+    .points_3d      = gl_points_3d,
+    .quad           = gl_quad,
+    .texture        = gl_texture,
+    .text           = gl_text,
+    .line           = gl_line,
+    .mesh           = gl_mesh,
+    .static_mesh    = gl_static_mesh,
+    .orbit          = gl_orbit,
+    .ellipse_2d     = gl_ellipse_2d,
+    .rect_2d        = gl_rect_2d,
+    .line_2d        = gl_line_2d,
+    .model_3d       = gl_model_3d,
+};
+
+renderer_t *render_create(void)
 {
-    renderer_t *rend;
+    renderer_gl_t *rend;
     GLint range[2];
 
 #ifdef WIN32
@@ -2118,21 +4036,25 @@ renderer_t* render_create(void)
 #endif
 
     rend = calloc(1, sizeof(*rend));
+    rend->base.backend = &GL_BACKEND;
+    rend->vbos[0].target = GL_ARRAY_BUFFER;
+    rend->vbos[1].target = GL_ELEMENT_ARRAY_BUFFER;
     rend->white_tex = create_white_texture(16, 16);
-#ifdef GLES2
-    rend->vg = nvgCreateGLES2(NVG_ANTIALIAS);
-#else
-    rend->vg = nvgCreateGL2(NVG_ANTIALIAS);
-#endif
-
-    if (!sys_callbacks.render_text)
-        set_default_fonts(rend);
+    rend->sky_fb.scale = 1.0;
+    vg_create(rend);
 
     // Query the point size range.
     GL(glGetIntegerv(GL_ALIASED_POINT_SIZE_RANGE, range));
     if (range[1] < 32)
         LOG_W("OpenGL Doesn't support large point size!");
 
+    GL(glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, range));
+    rend->has_vertex_textures = range[0] > 0;
+#if HAS_INSTANCING
+    rend->has_instancing = has_instancing();
+    while (glGetError() != GL_NO_ERROR) {}
+#endif
+
     // Enable GL debug messages.
     #if DEBUG && defined(GL_DEBUG_OUTPUT)
     {
@@ -2150,5 +4072,5 @@ renderer_t* render_create(void)
     }
     #endif
 
-    return rend;
+    return &rend->base;
 }
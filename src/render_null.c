@@ -0,0 +1,198 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Null renderer backend: doesn't render anything, but keep the stats of
+ * the number of calls, vertices and bytes it receives.  Each render call
+ * counts as one item.
+ */
+
+#include "render.h"
+#include "swe.h"
+
+typedef struct {
+    renderer_t      base;
+    render_stats_t  frame_stats; // Stats of the current frame.
+    render_stats_t  stats;       // Stats of the last finished frame.
+} renderer_null_t;
+
+static void add(renderer_t *rend_, int vertices, int bytes)
+{
+    renderer_null_t *rend = (void*)rend_;
+    rend->frame_stats.items++;
+    rend->frame_stats.vertices += vertices;
+    rend->frame_stats.bytes += bytes;
+}
+
+static void null_prepare(renderer_t *rend_, const projection_t *proj,
+                         double win_w, double win_h, double scale,
+                         bool cull_flipped)
+{
+    renderer_null_t *rend = (void*)rend_;
+    memset(&rend->frame_stats, 0, sizeof(rend->frame_stats));
+}
+
+static void null_finish(renderer_t *rend_)
+{
+    renderer_null_t *rend = (void*)rend_;
+    rend->stats = rend->frame_stats;
+}
+
+static void null_get_stats(const renderer_t *rend_, render_stats_t *stats)
+{
+    const renderer_null_t *rend = (const void*)rend_;
+    *stats = rend->stats;
+}
+
+static void null_release(renderer_t *rend)
+{
+    free(rend);
+}
+
+static void null_points_2d(renderer_t *rend, const painter_t *painter,
+                           int n, const point_t *points)
+{
+    add(rend, n, n * sizeof(*points));
+}
+
+static void null_points_3d(renderer_t *rend, const painter_t *painter,
+                           int n, const point_3d_t *points)
+{
+    add(rend, n, n * sizeof(*points));
+}
+
+static void null_quad(renderer_t *rend, const painter_t *painter,
+                      int frame, int grid_size, const uv_map_t *map)
+{
+    int n = (grid_size + 1) * (grid_size + 1);
+    add(rend, n, n * sizeof(double[3]));
+}
+
+static void null_texture(renderer_t *rend, texture_t *tex,
+                         const double uv[4][2], const double pos[2],
+                         double size, const double color[4], double angle)
+{
+    add(rend, 4, 4 * sizeof(double[4]));
+}
+
+static void null_text(renderer_t *rend, const painter_t *painter,
+                      const char *text, const double win_pos[2],
+                      const double view_pos[3],
+                      int align, int effects, double size,
+                      const double color[4], double angle,
+                      double bounds[4])
+{
+    // Still compute an approximate bounding box, since it's used for the
+    // labels overlap tests.
+    if (bounds) {
+        bounds[0] = win_pos[0];
+        bounds[1] = win_pos[1] - size;
+        bounds[2] = win_pos[0] + size * strlen(text) * 0.5;
+        bounds[3] = win_pos[1];
+    }
+    add(rend, 4, strlen(text));
+}
+
+static void null_line(renderer_t *rend, const painter_t *painter,
+                      const double (*pos)[3], const double (*win)[3],
+                      int size)
+{
+    add(rend, size, size * sizeof(double[3]));
+}
+
+static void null_mesh(renderer_t *rend, const painter_t *painter,
+                      int frame, int mode, int verts_count,
+                      const double verts[][3], int indices_count,
+                      const uint16_t indices[], bool use_stencil)
+{
+    add(rend, verts_count, verts_count * sizeof(*verts) +
+                           indices_count * sizeof(*indices));
+}
+
+static void null_ellipse_2d(renderer_t *rend, const painter_t *painter,
+                            const double pos[2], const double size[2],
+                            double angle, double dashes)
+{
+    add(rend, 0, 0);
+}
+
+static void null_rect_2d(renderer_t *rend, const painter_t *painter,
+                         const double pos[2], const double size[2],
+                         double angle)
+{
+    add(rend, 0, 0);
+}
+
+static void null_line_2d(renderer_t *rend, const painter_t *painter,
+                         const double p1[2], const double p2[2])
+{
+    add(rend, 2, 0);
+}
+
+static void null_model_3d(renderer_t *rend, const painter_t *painter,
+                          const char *model, const double model_mat[4][4],
+                          const double view_mat[4][4],
+                          const double proj_mat[4][4],
+                          const double light_dir[3], const json_value *args)
+{
+    add(rend, 0, 0);
+}
+
+static const render_backend_t NULL_BACKEND = {
+    .prepare        = null_prepare,
+    .finish         = null_finish,
+    .get_stats      = null_get_stats,
+    .release        = null_release,
+    .points_2d      = null_points_2d,
+    .points_3d      = null_points_3d,
+    .quad           = null_quad,
+    .texture        = null_texture,
+    .text           = null_text,
+    .line           = null_line,
+    .mesh           = null_mesh,
+    .ellipse_2d     = null_ellipse_2d,
+    .rect_2d        = null_rect_2d,
+    .line_2d        = null_line_2d,
+    .model_3d       = null_model_3d,
+};
+
+renderer_t *render_create_null(void)
+{
+    renderer_null_t *rend;
+    rend = calloc(1, sizeof(*rend));
+    rend->base.backend = &NULL_BACKEND;
+    texture_set_headless(true);
+    return &rend->base;
+}
+
+#if COMPILE_TESTS
+
+static void test_null_renderer(void)
+{
+    renderer_t *rend;
+    painter_t painter = {};
+    render_stats_t stats;
+    const point_t points[3] = {};
+
+    rend = render_create_null();
+    render_prepare(rend, NULL, 100, 100, 1, false);
+    render_points_2d(rend, &painter, 3, points);
+    render_line_2d(rend, &painter, VEC(0, 0), VEC(1, 1));
+    render_finish(rend);
+    render_get_stats(rend, &stats);
+    assert(stats.items == 2);
+    assert(stats.vertices == 5);
+    assert(stats.bytes == sizeof(points));
+    render_release(rend);
+    texture_set_headless(false);
+}
+
+TEST_REGISTER(NULL, test_null_renderer, TEST_AUTO);
+
+#endif
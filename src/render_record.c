@@ -0,0 +1,371 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Recording renderer backend: save all the render calls into a file, and
+ * optionally forward them to an other renderer.
+ *
+ * File format (native endianness):
+ *   4 bytes magic string:  "SWRR"
+ *   4 bytes version:       1
+ *   Then a list of records:
+ *     4 bytes:   type (REC_xxx enum value below)
+ *     4 bytes:   data size
+ *     n bytes:   data
+ *
+ * The record data is the raw values of the call arguments, in order, with
+ * the arrays inlined, and the strings null terminated.  The calls that
+ * take a painter start with a rec_painter_t with the painter state, and
+ * for the lines, meshes and 2d shapes we also add the painter lines
+ * attributes.  Textures, uv maps and json arguments are not saved.
+ * We don't support the static meshes, so that the callers fall back to
+ * regular meshes that get recorded.
+ *
+ * Each frame starts with a REC_PREPARE and ends with a REC_FINISH record.
+ */
+
+#include "render.h"
+#include "swe.h"
+
+#include <stdarg.h>
+
+enum {
+    REC_PREPARE = 1,
+    REC_FINISH,
+    REC_POINTS_2D,
+    REC_POINTS_3D,
+    REC_QUAD,
+    REC_TEXTURE,
+    REC_TEXT,
+    REC_LINE,
+    REC_MESH,
+    REC_ELLIPSE_2D,
+    REC_RECT_2D,
+    REC_LINE_2D,
+    REC_MODEL_3D,
+};
+
+typedef struct {
+    double  color[4];
+    int32_t flags;
+    float   points_halo;
+} rec_painter_t;
+
+typedef struct {
+    renderer_t  base;
+    FILE        *file;
+    renderer_t  *next;
+} renderer_rec_t;
+
+// Marks the end of the rec arguments, since the data pointers can be NULL
+// for empty arrays.
+static const char REC_END[1];
+
+/*
+ * Write a record.  The variadic arguments are pairs of data pointer and
+ * size, ending with REC_END.
+ */
+static void rec(renderer_t *rend_, int type, ...)
+{
+    renderer_rec_t *rend = (void*)rend_;
+    va_list args;
+    const void *data;
+    uint32_t header[2] = {type, 0};
+
+    va_start(args, type);
+    while ((data = va_arg(args, const void*)) != REC_END)
+        header[1] += va_arg(args, int);
+    va_end(args);
+
+    fwrite(header, sizeof(header), 1, rend->file);
+    va_start(args, type);
+    while ((data = va_arg(args, const void*)) != REC_END)
+        fwrite(data, va_arg(args, int), 1, rend->file);
+    va_end(args);
+}
+
+static rec_painter_t get_painter(const painter_t *painter)
+{
+    rec_painter_t ret = {
+        .color = {VEC4_SPLIT(painter->color)},
+        .flags = painter->flags,
+        .points_halo = painter->points_halo,
+    };
+    return ret;
+}
+
+#define P(v) &(v), (int)sizeof(v)
+
+static void rec_prepare(renderer_t *rend, const projection_t *proj,
+                        double win_w, double win_h, double scale,
+                        bool cull_flipped)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    int32_t proj_type = proj->klass ? proj->klass->id : 0;
+    int32_t cull = cull_flipped;
+    rec(rend, REC_PREPARE, P(proj_type), P(proj->fovy), P(proj->flags),
+        P(proj->mat), P(proj->window_size), P(win_w), P(win_h), P(scale),
+        P(cull), REC_END);
+    if (next) render_prepare(next, proj, win_w, win_h, scale, cull_flipped);
+}
+
+static void rec_finish(renderer_t *rend)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec(rend, REC_FINISH, REC_END);
+    fflush(((renderer_rec_t*)rend)->file);
+    if (next) render_finish(next);
+}
+
+static void rec_get_stats(const renderer_t *rend, render_stats_t *stats)
+{
+    const renderer_t *next = ((const renderer_rec_t*)rend)->next;
+    if (next)
+        render_get_stats(next, stats);
+    else
+        memset(stats, 0, sizeof(*stats));
+}
+
+// Only forwarded, since they don't change what we record.
+static void rec_set_sky_scale(renderer_t *rend, double scale)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    if (next) render_set_sky_scale(next, scale);
+}
+
+static int rec_release_caches(renderer_t *rend, bool dry_run)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    return next ? render_release_caches(next, dry_run) : 0;
+}
+
+static bool rec_measure_luminance(renderer_t *rend, double *value)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    return next && render_measure_luminance(next, value);
+}
+
+static bool rec_pick(renderer_t *rend, const double pos[2], double max_dist,
+                     obj_t **obj)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    return next && render_pick(next, pos, max_dist, obj);
+}
+
+static void rec_set_late_view(renderer_t *rend, const double rot[3][3],
+                              const double win[3][3])
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    if (next) render_set_late_view(next, rot, win);
+}
+
+static void rec_context_restored(renderer_t *rend)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    if (next) render_context_restored(next);
+}
+
+static void rec_release(renderer_t *rend)
+{
+    fclose(((renderer_rec_t*)rend)->file);
+    render_release(((renderer_rec_t*)rend)->next);
+    free(rend);
+}
+
+static void rec_points_2d(renderer_t *rend, const painter_t *painter,
+                          int n, const point_t *points)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec_painter_t p = get_painter(painter);
+    rec(rend, REC_POINTS_2D, P(p), P(n), points, n * (int)sizeof(*points),
+        REC_END);
+    if (next) render_points_2d(next, painter, n, points);
+}
+
+static void rec_points_3d(renderer_t *rend, const painter_t *painter,
+                          int n, const point_3d_t *points)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec_painter_t p = get_painter(painter);
+    rec(rend, REC_POINTS_3D, P(p), P(n), points, n * (int)sizeof(*points),
+        REC_END);
+    if (next) render_points_3d(next, painter, n, points);
+}
+
+static void rec_quad(renderer_t *rend, const painter_t *painter,
+                     int frame, int grid_size, const uv_map_t *map)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec_painter_t p = get_painter(painter);
+    rec(rend, REC_QUAD, P(p), P(frame), P(grid_size), REC_END);
+    if (next) render_quad(next, painter, frame, grid_size, map);
+}
+
+static void rec_texture(renderer_t *rend, texture_t *tex,
+                        const double uv[4][2], const double pos[2],
+                        double size, const double color[4], double angle)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec(rend, REC_TEXTURE, uv, (int)sizeof(double[4][2]),
+        pos, (int)sizeof(double[2]), P(size), color, (int)sizeof(double[4]),
+        P(angle), REC_END);
+    if (next) render_texture(next, tex, uv, pos, size, color, angle);
+}
+
+static void rec_text(renderer_t *rend, const painter_t *painter,
+                     const char *text, const double win_pos[2],
+                     const double view_pos[3],
+                     int align, int effects, double size,
+                     const double color[4], double angle,
+                     double bounds[4])
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec_painter_t p = get_painter(painter);
+    const double zero[3] = {};
+    rec(rend, REC_TEXT, P(p), text, (int)strlen(text) + 1,
+        win_pos ?: zero, (int)sizeof(double[2]),
+        view_pos ?: zero, (int)sizeof(double[3]),
+        P(align), P(effects), P(size), color, (int)sizeof(double[4]),
+        P(angle), REC_END);
+    if (next) {
+        render_text(next, painter, text, win_pos, view_pos, align, effects,
+                    size, color, angle, bounds);
+    } else if (bounds) {
+        memset(bounds, 0, sizeof(double[4]));
+    }
+}
+
+static void rec_line(renderer_t *rend, const painter_t *painter,
+                     const double (*pos)[3], const double (*win)[3],
+                     int size)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec_painter_t p = get_painter(painter);
+    rec(rend, REC_LINE, P(p), P(painter->lines), P(size),
+        pos, size * (int)sizeof(*pos), win, size * (int)sizeof(*win),
+        REC_END);
+    if (next) render_line(next, painter, pos, win, size);
+}
+
+static void rec_mesh(renderer_t *rend, const painter_t *painter,
+                     int frame, int mode, int verts_count,
+                     const double verts[][3], int indices_count,
+                     const uint16_t indices[], bool use_stencil)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec_painter_t p = get_painter(painter);
+    int32_t stencil = use_stencil;
+    rec(rend, REC_MESH, P(p), P(painter->lines), P(frame), P(mode),
+        P(verts_count), verts, verts_count * (int)sizeof(*verts),
+        P(indices_count), indices, indices_count * (int)sizeof(*indices),
+        P(stencil), REC_END);
+    if (next) {
+        render_mesh(next, painter, frame, mode, verts_count, verts,
+                    indices_count, indices, use_stencil);
+    }
+}
+
+static void rec_ellipse_2d(renderer_t *rend, const painter_t *painter,
+                           const double pos[2], const double size[2],
+                           double angle, double dashes)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec_painter_t p = get_painter(painter);
+    rec(rend, REC_ELLIPSE_2D, P(p), P(painter->lines),
+        pos, (int)sizeof(double[2]), size, (int)sizeof(double[2]),
+        P(angle), P(dashes), REC_END);
+    if (next) render_ellipse_2d(next, painter, pos, size, angle, dashes);
+}
+
+static void rec_rect_2d(renderer_t *rend, const painter_t *painter,
+                        const double pos[2], const double size[2],
+                        double angle)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec_painter_t p = get_painter(painter);
+    rec(rend, REC_RECT_2D, P(p), P(painter->lines),
+        pos, (int)sizeof(double[2]), size, (int)sizeof(double[2]),
+        P(angle), REC_END);
+    if (next) render_rect_2d(next, painter, pos, size, angle);
+}
+
+static void rec_line_2d(renderer_t *rend, const painter_t *painter,
+                        const double p1[2], const double p2[2])
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec_painter_t p = get_painter(painter);
+    rec(rend, REC_LINE_2D, P(p), P(painter->lines),
+        p1, (int)sizeof(double[2]), p2, (int)sizeof(double[2]), REC_END);
+    if (next) render_line_2d(next, painter, p1, p2);
+}
+
+static void rec_model_3d(renderer_t *rend, const painter_t *painter,
+                         const char *model, const double model_mat[4][4],
+                         const double view_mat[4][4],
+                         const double proj_mat[4][4],
+                         const double light_dir[3], const json_value *args)
+{
+    renderer_t *next = ((renderer_rec_t*)rend)->next;
+    rec_painter_t p = get_painter(painter);
+    rec(rend, REC_MODEL_3D, P(p), model, (int)strlen(model) + 1,
+        model_mat, (int)sizeof(double[4][4]),
+        view_mat, (int)sizeof(double[4][4]),
+        proj_mat, (int)sizeof(double[4][4]),
+        light_dir, (int)sizeof(double[3]), REC_END);
+    if (next) {
+        render_model_3d(next, painter, model, model_mat, view_mat, proj_mat,
+                        light_dir, args);
+    }
+}
+
+#undef P
+
+static const render_backend_t REC_BACKEND = {
+    .prepare        = rec_prepare,
+    .finish         = rec_finish,
+    .get_stats      = rec_get_stats,
+    .release        = rec_release,
+    .set_sky_scale  = rec_set_sky_scale,
+    .release_caches = rec_release_caches,
+    .measure_luminance = rec_measure_luminance,
+    .pick           = rec_pick,
+    .set_late_view  = rec_set_late_view,
+    .context_restored = rec_context_restored,
+    .points_2d      = rec_points_2d,
+    .points_3d      = rec_points_3d,
+    .quad           = rec_quad,
+    .texture        = rec_texture,
+    .text           = rec_text,
+    .line           = rec_line,
+    .mesh           = rec_mesh,
+    .ellipse_2d     = rec_ellipse_2d,
+    .rect_2d        = rec_rect_2d,
+    .line_2d        = rec_line_2d,
+    .model_3d       = rec_model_3d,
+};
+
+renderer_t *render_create_recorder(const char *path, renderer_t *next)
+{
+    renderer_rec_t *rend;
+    FILE *file;
+    const uint32_t version = 1;
+
+    file = fopen(path, "wb");
+    if (!file) {
+        LOG_E("Cannot open %s", path);
+        return NULL;
+    }
+    fwrite("SWRR", 4, 1, file);
+    fwrite(&version, sizeof(version), 1, file);
+    rend = calloc(1, sizeof(*rend));
+    rend->base.backend = &REC_BACKEND;
+    rend->file = file;
+    rend->next = next;
+    return &rend->base;
+}
@@ -53,6 +53,29 @@ sgp4_elsetrec_t *sgp4_twoline2rv(
     return (sgp4_elsetrec*)ret;
 }
 
+sgp4_elsetrec_t *sgp4_init(int satnum, double epoch, double bstar,
+                           double ndot, double nddot, double ecco,
+                           double argpo, double inclo, double mo,
+                           double no_kozai, double nodeo)
+{
+    elsetrec *ret = (elsetrec*)calloc(1, sizeof(*ret));
+    ret->jdsatepoch = floor(epoch) + 2400000.5;
+    ret->jdsatepochF = epoch - floor(epoch);
+    // Same values as used in twoline2rv with 'i' opsmode.
+    SGP4Funcs::sgp4init(wgs72, 'i', satnum,
+                        (ret->jdsatepoch + ret->jdsatepochF) - 2433281.5,
+                        bstar, ndot, nddot, ecco, argpo, inclo, mo,
+                        no_kozai, nodeo, *ret);
+    return (sgp4_elsetrec*)ret;
+}
+
+sgp4_elsetrec_t *sgp4_clone(const sgp4_elsetrec_t *satrec)
+{
+    elsetrec *ret = (elsetrec*)malloc(sizeof(*ret));
+    memcpy(ret, satrec, sizeof(*ret));
+    return (sgp4_elsetrec*)ret;
+}
+
 int sgp4(sgp4_elsetrec_t *satrec, double utc_mjd, double r[3], double v[3])
 {
     double tsince;
@@ -65,6 +88,11 @@ int sgp4(sgp4_elsetrec_t *satrec, double utc_mjd, double r[3], double v[3])
     return elrec->error;
 }
 
+int sgp4_get_size(void)
+{
+    return sizeof(elsetrec);
+}
+
 /*
  * Function: sgp4_get_satepoch
  * Return the reference epoch of a sat (UTC MJD)
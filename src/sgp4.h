@@ -21,6 +21,42 @@ sgp4_elsetrec_t *sgp4_twoline2rv(
         char typerun, char typeinput, char opsmode,
         double *startmfe, double *stopmfe, double *deltamin);
 
+/*
+ * Function: sgp4_init
+ * Create the orbit elements of a satellite directly from its mean elements
+ *
+ * This is the same as <sgp4_twoline2rv>, but skip the TLE parsing.  The
+ * values are in the units used internally by sgp4, so that they can be
+ * precomputed offline.
+ *
+ * Parameters:
+ *   satnum     - Norad number.
+ *   epoch      - Elements epoch (UTC MJD).
+ *   bstar      - Drag term (1/earth radii).
+ *   ndot       - First derivative of the mean motion (rad/min^2).
+ *   nddot      - Second derivative of the mean motion (rad/min^3).
+ *   ecco       - Eccentricity.
+ *   argpo      - Argument of perigee (rad).
+ *   inclo      - Inclination (rad).
+ *   mo         - Mean anomaly (rad).
+ *   no_kozai   - Mean motion (rad/min).
+ *   nodeo      - Right ascension of ascending node (rad).
+ */
+sgp4_elsetrec_t *sgp4_init(int satnum, double epoch, double bstar,
+                           double ndot, double nddot, double ecco,
+                           double argpo, double inclo, double mo,
+                           double no_kozai, double nodeo);
+
+/*
+ * Function: sgp4_clone
+ * Return a newly allocated copy of a sat orbit elements
+ *
+ * Since <sgp4> modifies the elements, this can be used to propagate the
+ * same satellite from several threads.  The copy should be released with
+ * free.
+ */
+sgp4_elsetrec_t *sgp4_clone(const sgp4_elsetrec_t *satrec);
+
 /*
  * Returns same error codes as defined in ext_src/sgp4/SGP4.cpp:
  *   0 - no error
@@ -33,6 +69,12 @@ sgp4_elsetrec_t *sgp4_twoline2rv(
  */
 int sgp4(sgp4_elsetrec_t *satrec, double utc_mjd, double r[3], double v[3]);
 
+/*
+ * Function: sgp4_get_size
+ * Return the size in bytes of the elements of a sat
+ */
+int sgp4_get_size(void);
+
 /*
  * Function: sgp4_get_satepoch
  * Return the reference epoch of a sat (UTC MJD)
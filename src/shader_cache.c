@@ -9,14 +9,17 @@
 
 #include "shader_cache.h"
 
-#define MAX_NB_SHADERS 32
+#define MAX_NB_SHADERS 64
 
 typedef struct {
     char key[256];
     gl_shader_t *shader;
+    void (*on_created)(gl_shader_t *s); // Called once the shader is ready.
+    int last_used; // Value of g_clock at the last use.
 } shader_t;
 
 static shader_t g_shaders[MAX_NB_SHADERS] = {};
+static int g_clock = 0;
 
 static char *process_includes(const char *code)
 {
@@ -41,9 +44,12 @@ static char *process_includes(const char *code)
     return utstring_body(&ret);
 }
 
-gl_shader_t *shader_get(const char *name, const shader_define_t *defines,
-                        const char **attr_names,
-                        void (*on_created)(gl_shader_t *s))
+/*
+ * Find a shader in the cache, or start to compile it.
+ */
+static shader_t *shader_find(const char *name, const shader_define_t *defines,
+                             const char **attr_names,
+                             void (*on_created)(gl_shader_t *s))
 {
     int i;
     shader_t *s = NULL;
@@ -67,21 +73,30 @@ gl_shader_t *shader_get(const char *name, const shader_define_t *defines,
         strcat(key, buf);
     }
 
+    g_clock++;
     for (i = 0; i < ARRAY_SIZE(g_shaders); i++) {
         s = &g_shaders[i];
         if (!*s->key) break;
-        if (strcmp(s->key, key) == 0)
-            return s->shader;
+        if (strcmp(s->key, key) == 0) {
+            s->last_used = g_clock;
+            return s;
+        }
     }
 
+    // If the cache is full, replace the least recently used shader.  This
+    // is never the current program, since we always use a shader just
+    // after getting it.
     if (i >= ARRAY_SIZE(g_shaders)) {
-        LOG_E("Too many shaders!");
-        for (i = 0; i < ARRAY_SIZE(g_shaders); i++) {
-            LOG_W("%s", g_shaders[i].key);
+        s = &g_shaders[0];
+        for (i = 1; i < ARRAY_SIZE(g_shaders); i++) {
+            if (g_shaders[i].last_used < s->last_used) s = &g_shaders[i];
         }
-        assert(false);
+        LOG_D("Too many shaders, remove %s", s->key);
+        gl_shader_delete(s->shader);
+        memset(s, 0, sizeof(*s));
     }
     strcpy(s->key, key);
+    s->last_used = g_clock;
 
     snprintf(path, sizeof(path), "asset://shaders/%s.glsl", name);
     code = asset_get_data2(path, ASSET_USED_ONCE, NULL, NULL);
@@ -93,9 +108,47 @@ gl_shader_t *shader_get(const char *name, const shader_define_t *defines,
         if (!define->val) continue;
         utstring_printf(&pre, "#define %s %d\n", define->name, define->val);
     }
-    s->shader = gl_shader_create(code2, code2, utstring_body(&pre), attr_names);
+    s->shader = gl_shader_create_async(code2, code2, utstring_body(&pre),
+                                       attr_names);
+    s->on_created = on_created;
     utstring_done(&pre);
     if (code2 != code) free(code2);
-    if (on_created) on_created(s->shader);
-    return s->shader;
+    return s;
+}
+
+static bool shader_is_ready(shader_t *s, bool wait)
+{
+    if (s->shader->ready) return true;
+    if (!gl_shader_is_ready(s->shader, wait)) return false;
+    if (s->on_created) s->on_created(s->shader);
+    return true;
+}
+
+gl_shader_t *shader_get(const char *name, const shader_define_t *defines,
+                        const char **attr_names,
+                        void (*on_created)(gl_shader_t *s))
+{
+    shader_t *s;
+    s = shader_find(name, defines, attr_names, on_created);
+    return shader_is_ready(s, true) ? s->shader : NULL;
+}
+
+bool shader_warmup(const char *name, const shader_define_t *defines,
+                   const char **attr_names,
+                   void (*on_created)(gl_shader_t *s))
+{
+    shader_t *s;
+    s = shader_find(name, defines, attr_names, on_created);
+    return shader_is_ready(s, false);
+}
+
+void shader_cache_on_context_lost(void)
+{
+    int i;
+    // The GL programs are already gone, so we only free the structures.
+    for (i = 0; i < ARRAY_SIZE(g_shaders); i++) {
+        if (!*g_shaders[i].key) break;
+        free(g_shaders[i].shader);
+    }
+    memset(g_shaders, 0, sizeof(g_shaders));
 }
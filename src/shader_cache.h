@@ -22,6 +22,9 @@ typedef struct {
  *
  * Probably need to change this api soon.
  *
+ * Return NULL if the shader failed to compile or link.  The cache keeps the
+ * failed shaders, so that we only log the errors once.
+ *
  * Properties:
  *   name       - Name of one of the shaders in the resources.
  *   defines    - Array of <shader_define_t>, terminated by an empty one.
@@ -31,3 +34,28 @@ typedef struct {
 gl_shader_t *shader_get(const char *name, const shader_define_t *defines,
                         const char **attr_names,
                         void (*on_created)(gl_shader_t *s));
+
+/*
+ * Function: shader_warmup
+ * Start to compile a shader in advance
+ *
+ * Same arguments as <shader_get>, but doesn't wait for the shader to be
+ * compiled if the driver supports KHR_parallel_shader_compile.  This can be
+ * called at each frame for the shaders we will probably need later, so that
+ * the compilation doesn't block the rendering when we first use them.
+ *
+ * Return:
+ *   true if the shader is ready.
+ */
+bool shader_warmup(const char *name, const shader_define_t *defines,
+                   const char **attr_names,
+                   void (*on_created)(gl_shader_t *s));
+
+/*
+ * Function: shader_cache_on_context_lost
+ * Forget all the cached shaders, after the GL context was lost.
+ *
+ * The shaders sources are in the assets, so they get compiled again the
+ * next time we use them.
+ */
+void shader_cache_on_context_lost(void);
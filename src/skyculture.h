@@ -82,6 +82,10 @@ typedef struct skyculture_name
     char           *name_description;
     // Pointer to a secondary name, or NULL
     struct skyculture_name* alternative;
+    // Cached label, as returned by skycultures_get_label.  Only valid
+    // if label_version matches the skycultures module labels version.
+    char           *label;
+    int            label_version;
 } skyculture_name_t;
 
 /*
@@ -0,0 +1,303 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "swe.h"
+#include <limits.h>
+#include <sys/stat.h>
+
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+#   define HAS_MMAP 1
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+/*
+ * The snapshot format:
+ *
+ *   header     - snapshot_header_t.
+ *   chunks     - For each chunk a chunk_header_t, followed by the source
+ *                url, then the data, each padded to 8 bytes.
+ *
+ * All the values are in the native byte order, that we check with the
+ * byte_order value of the header.
+ */
+
+// Version of the base format.  The chunks have their own versions.
+#define SNAPSHOT_VERSION 1
+#define BYTE_ORDER_MARK 0x01020304
+
+typedef struct {
+    char        magic[4];       // 'SWES'
+    uint32_t    version;
+    uint32_t    byte_order;
+    uint32_t    nb;             // Number of chunks.
+} snapshot_header_t;
+
+typedef struct {
+    char        module[32];     // Id of the module.
+    char        etag[64];       // Source ETag, empty if not known.
+    uint32_t    version;        // Version of the module data layout.
+    uint32_t    url_size;       // Including the zero, before padding.
+    uint32_t    size;           // Size of the data, before padding.
+    uint32_t    padding_;
+} chunk_header_t;
+
+struct snapshot {
+    const obj_t *module;        // Module being saved.
+    uint8_t     *data;
+    int         size;
+    int         capacity;
+    int         nb;
+};
+
+static int pad8(int size)
+{
+    return (size + 7) / 8 * 8;
+}
+
+static void snapshot_write(snapshot_t *snap, const void *data, int size)
+{
+    int padded = pad8(size);
+    if (snap->size + padded > snap->capacity) {
+        snap->capacity = snap->capacity * 2 ?: 4096;
+        if (snap->capacity < snap->size + padded)
+            snap->capacity = snap->size + padded;
+        snap->data = realloc(snap->data, snap->capacity);
+    }
+    memcpy(snap->data + snap->size, data, size);
+    memset(snap->data + snap->size + size, 0, padded - size);
+    snap->size += padded;
+}
+
+void snapshot_add(snapshot_t *snap, const char *url, const char *etag,
+                  int version, const void *data, int size)
+{
+    chunk_header_t header = {.version = version, .size = size};
+
+    assert(snap->module && snap->module->id);
+    if (strlen(snap->module->id) >= sizeof(header.module)) {
+        LOG_W("Module id too long for a snapshot: %s", snap->module->id);
+        return;
+    }
+    // An ETag that doesn't fit would never match, same as no ETag.
+    if (etag && strlen(etag) < sizeof(header.etag))
+        strcpy(header.etag, etag);
+    strcpy(header.module, snap->module->id);
+    header.url_size = strlen(url) + 1;
+    snapshot_write(snap, &header, sizeof(header));
+    snapshot_write(snap, url, header.url_size);
+    snapshot_write(snap, data, size);
+    snap->nb++;
+}
+
+void *snapshot_save(const obj_t *root, int *size)
+{
+    snapshot_t snap = {};
+    snapshot_header_t header = {{'S', 'W', 'E', 'S'}, SNAPSHOT_VERSION,
+                                BYTE_ORDER_MARK};
+    const obj_t *module;
+
+    snapshot_write(&snap, &header, sizeof(header));
+    DL_FOREACH(root->children, module) {
+        if (!module->klass->save_snapshot || !module->id) continue;
+        snap.module = module;
+        module->klass->save_snapshot(module, &snap);
+    }
+    if (!snap.nb) {
+        free(snap.data);
+        *size = 0;
+        return NULL;
+    }
+    ((snapshot_header_t*)snap.data)->nb = snap.nb;
+    *size = snap.size;
+    return snap.data;
+}
+
+static obj_t *find_module(obj_t *root, const char *id)
+{
+    obj_t *module;
+    DL_FOREACH(root->children, module) {
+        if (module->id && strcmp(module->id, id) == 0) return module;
+    }
+    return NULL;
+}
+
+int snapshot_load(obj_t *root, const void *data, int size)
+{
+    const uint8_t *ptr = data;
+    const snapshot_header_t *header = data;
+    chunk_header_t chunk;
+    const char *url;
+    int ofs = sizeof(*header), i, ret = 0;
+    obj_t *module;
+
+    if (    size < sizeof(*header) ||
+            memcmp(header->magic, "SWES", 4) != 0 ||
+            header->version != SNAPSHOT_VERSION ||
+            header->byte_order != BYTE_ORDER_MARK) {
+        LOG_W("Invalid or outdated snapshot");
+        return -1;
+    }
+    for (i = 0; i < header->nb; i++) {
+        if (ofs + sizeof(chunk) > size) goto error;
+        memcpy(&chunk, ptr + ofs, sizeof(chunk));
+        ofs += sizeof(chunk);
+        if (    chunk.url_size == 0 ||
+                chunk.url_size > size - ofs ||
+                chunk.size > size - ofs - pad8(chunk.url_size) ||
+                chunk.module[sizeof(chunk.module) - 1] ||
+                chunk.etag[sizeof(chunk.etag) - 1])
+            goto error;
+        url = (const char*)ptr + ofs;
+        if (url[chunk.url_size - 1]) goto error;
+        ofs += pad8(chunk.url_size);
+        module = find_module(root, chunk.module);
+        if (module && module->klass->load_snapshot &&
+                module->klass->load_snapshot(
+                    module, url, *chunk.etag ? chunk.etag : NULL,
+                    chunk.version, ptr + ofs, chunk.size) == 0) {
+            ret++;
+        }
+        ofs += pad8(chunk.size);
+    }
+    return ret;
+
+error:
+    LOG_W("Corrupted snapshot");
+    return ret ?: -1;
+}
+
+int snapshot_save_file(const obj_t *root, const char *path)
+{
+    char tmp[1024];
+    void *data;
+    int size;
+    bool ok;
+    FILE *file;
+
+    data = snapshot_save(root, &size);
+    if (!data) return -1;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    file = fopen(tmp, "wb");
+    if (!file) {
+        free(data);
+        return -1;
+    }
+    ok = fwrite(data, size, 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    free(data);
+    if (!ok || rename(tmp, path) != 0) {
+        LOG_W("Cannot write snapshot %s", path);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_load_file(obj_t *root, const char *path)
+{
+    int ret;
+#ifdef HAS_MMAP
+    int fd;
+    struct stat st;
+    void *map;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > INT_MAX) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file open.
+    if (map == MAP_FAILED) return -1;
+    ret = snapshot_load(root, map, st.st_size);
+    munmap(map, st.st_size);
+#else
+    int size;
+    void *data;
+
+    data = read_file(path, &size);
+    if (!data) return -1;
+    ret = snapshot_load(root, data, size);
+    free(data);
+#endif
+    return ret;
+}
+
+#if COMPILE_TESTS
+
+typedef struct {
+    obj_t       obj;
+    char        data[32];
+    char        url[64];
+    char        etag[64];
+} test_snapshot_t;
+
+static int test_snapshot_save(const obj_t *obj, snapshot_t *snap)
+{
+    const test_snapshot_t *t = (const void*)obj;
+    snapshot_add(snap, "https://data/test", "1234", 2, t->data,
+                 strlen(t->data) + 1);
+    return 0;
+}
+
+static int test_snapshot_load(obj_t *obj, const char *url, const char *etag,
+                              int version, const void *data, int size)
+{
+    test_snapshot_t *t = (void*)obj;
+    if (version != 2) return -1;
+    snprintf(t->data, sizeof(t->data), "%.*s", size, (const char*)data);
+    snprintf(t->url, sizeof(t->url), "%s", url);
+    snprintf(t->etag, sizeof(t->etag), "%s", etag ?: "");
+    return 0;
+}
+
+static obj_klass_t test_snapshot_klass = {
+    .id             = "test_snapshot",
+    .size           = sizeof(test_snapshot_t),
+    .save_snapshot  = test_snapshot_save,
+    .load_snapshot  = test_snapshot_load,
+};
+
+static void test_snapshot(void)
+{
+    obj_t root = {};
+    test_snapshot_t *mod;
+    void *data;
+    int size, r;
+
+    mod = calloc(1, sizeof(*mod));
+    mod->obj.klass = &test_snapshot_klass;
+    mod->obj.id = "test";
+    DL_APPEND(root.children, &mod->obj);
+    strcpy(mod->data, "hello");
+
+    data = snapshot_save(&root, &size);
+    assert(data && size % 8 == 0);
+    memset(mod->data, 0, sizeof(mod->data));
+    r = snapshot_load(&root, data, size);
+    assert(r == 1);
+    assert(strcmp(mod->data, "hello") == 0);
+    assert(strcmp(mod->url, "https://data/test") == 0);
+    assert(strcmp(mod->etag, "1234") == 0);
+
+    // Truncated or outdated data.
+    assert(snapshot_load(&root, data, size - 8) == -1);
+    ((snapshot_header_t*)data)->version++;
+    assert(snapshot_load(&root, data, size) == -1);
+
+    free(data);
+    free(mod);
+}
+
+TEST_REGISTER(NULL, test_snapshot, TEST_AUTO);
+
+#endif
@@ -0,0 +1,98 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+
+typedef struct obj obj_t;
+
+/*
+ * File: snapshot.h
+ * Save the parsed data of the modules into a single binary blob, so that
+ * the next start of the engine can restore it without parsing the sources
+ * again.
+ *
+ * The modules that support it implement the klass save_snapshot and
+ * load_snapshot methods.  Each module adds one or more chunks, containing
+ * the data in its own versioned layout, along with the url and ETag of the
+ * source it parsed them from.  After a restore, the modules still load the
+ * source as usual, but don't parse it again if its ETag didn't change.
+ *
+ * The blob is only meant to be used on the same machine and with the same
+ * build of the engine: any change of the base format version, the byte
+ * order, or the layout version of a module chunk discards the data.
+ *
+ * All the chunks data are aligned to 8 bytes, so that a memory mapped
+ * snapshot file can be read in place.
+ */
+
+typedef struct snapshot snapshot_t;
+
+/*
+ * Function: snapshot_add
+ * Add a chunk of the current module to a snapshot being saved.
+ *
+ * Should only be called from a module save_snapshot method.
+ *
+ * Parameters:
+ *   snap       - The snapshot passed to save_snapshot.
+ *   url        - Url of the source the data comes from.
+ *   etag       - ETag of the source, or NULL if not known.  In that case
+ *                the source is always parsed again after a restore.
+ *   version    - Version of the module data layout.
+ *   data       - The chunk data.
+ *   size       - Size of the data in bytes.
+ */
+void snapshot_add(snapshot_t *snap, const char *url, const char *etag,
+                  int version, const void *data, int size);
+
+/*
+ * Function: snapshot_save
+ * Save the data of all the children modules of an object.
+ *
+ * Parameters:
+ *   root   - Usually the core object.
+ *   size   - Output size of the returned data.
+ *
+ * Return:
+ *   A newly allocated snapshot blob, or NULL if no module had any data to
+ *   save.
+ */
+void *snapshot_save(const obj_t *root, int *size);
+
+/*
+ * Function: snapshot_load
+ * Restore the children modules of an object from a snapshot.
+ *
+ * The data is only read during the call, and can be released after it.
+ * The chunks of unknown or missing modules are ignored.
+ *
+ * Return:
+ *   The number of chunks restored, or -1 if the snapshot is not valid.
+ */
+int snapshot_load(obj_t *root, const void *data, int size);
+
+/*
+ * Function: snapshot_save_file
+ * Same as <snapshot_save>, but directly write into a file.
+ *
+ * The data is first written into a temporary file, so that an interrupted
+ * save never leaves a partial snapshot.
+ */
+int snapshot_save_file(const obj_t *root, const char *path);
+
+/*
+ * Function: snapshot_load_file
+ * Same as <snapshot_load>, using a memory mapping of a file when possible.
+ */
+int snapshot_load_file(obj_t *root, const char *path);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,231 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "static_mesh.h"
+
+#include "utils/gl.h"
+#include "utils/texture.h"
+#include "utils/utils.h"
+#include "utils/vec.h"
+#include "utlist.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Max number of vertices in a batch, so that we can use uint16 indices.
+#define BATCH_MAX_VERTS 65536
+
+// Number of features per row of the texture.
+#define FEATURES_PER_ROW \
+    (STATIC_MESH_TEX_WIDTH / STATIC_MESH_FEATURE_TEXELS)
+
+// List of all the meshes, see static_mesh_on_context_lost.
+static static_mesh_t *g_meshes = NULL;
+
+static_mesh_t *static_mesh_create(void)
+{
+    static_mesh_t *smesh = calloc(1, sizeof(*smesh));
+    smesh->ref = 1;
+    smesh->blink = 1;
+    DL_APPEND(g_meshes, smesh);
+    return smesh;
+}
+
+void static_mesh_on_context_lost(void)
+{
+    int i;
+    static_mesh_t *smesh;
+    DL_FOREACH(g_meshes, smesh) {
+        for (i = 0; i < smesh->batches_count; i++) {
+            smesh->batches[i].vbo = 0;
+            memset(smesh->batches[i].ibos, 0,
+                   sizeof(smesh->batches[i].ibos));
+        }
+    }
+}
+
+void static_mesh_get_memory(const static_mesh_t *smesh,
+                            int64_t *cpu, int64_t *gpu)
+{
+    int i, m;
+    const static_mesh_batch_t *batch;
+
+    *cpu += sizeof(*smesh) +
+            smesh->features_capacity * sizeof(*smesh->features);
+    for (i = 0; i < smesh->batches_count; i++) {
+        batch = &smesh->batches[i];
+        *cpu += batch->verts_capacity * sizeof(*batch->verts);
+        if (batch->vbo) *gpu += batch->verts_count * sizeof(*batch->verts);
+        for (m = 0; m < 3; m++) {
+            *cpu += batch->indices_capacity[m] * sizeof(uint16_t);
+            if (batch->ibos[m])
+                *gpu += batch->indices_count[m] * sizeof(uint16_t);
+        }
+    }
+    if (smesh->tex) *gpu += smesh->tex->size;
+}
+
+void static_mesh_release(static_mesh_t *smesh)
+{
+    int i, m;
+    static_mesh_batch_t *batch;
+
+    if (!smesh) return;
+    smesh->ref--;
+    if (smesh->ref) return;
+    DL_DELETE(g_meshes, smesh);
+    for (i = 0; i < smesh->batches_count; i++) {
+        batch = &smesh->batches[i];
+        // The GPU buffers only exist if the GL renderer created them.
+        if (batch->vbo) GL(glDeleteBuffers(1, &batch->vbo));
+        for (m = 0; m < 3; m++) {
+            if (batch->ibos[m]) GL(glDeleteBuffers(1, &batch->ibos[m]));
+            free(batch->indices[m]);
+        }
+        free(batch->verts);
+    }
+    free(smesh->batches);
+    free(smesh->features);
+    texture_release(smesh->tex);
+    free(smesh);
+}
+
+int static_mesh_add_feature(static_mesh_t *smesh)
+{
+    if (smesh->features_count >= smesh->features_capacity) {
+        smesh->features_capacity = smesh->features_capacity ?
+                                   smesh->features_capacity * 2 : 64;
+        smesh->features = realloc(smesh->features,
+                smesh->features_capacity * sizeof(*smesh->features));
+    }
+    memset(smesh->features[smesh->features_count], 0,
+           sizeof(*smesh->features));
+    smesh->dirty = true;
+    return smesh->features_count++;
+}
+
+// Return a batch that can take n more vertices.
+static static_mesh_batch_t *get_batch(static_mesh_t *smesh, int n)
+{
+    static_mesh_batch_t *batch = NULL;
+
+    if (smesh->batches_count)
+        batch = &smesh->batches[smesh->batches_count - 1];
+    if (batch && batch->verts_count + n <= BATCH_MAX_VERTS)
+        return batch;
+    smesh->batches_count++;
+    smesh->batches = realloc(smesh->batches,
+                             smesh->batches_count * sizeof(*smesh->batches));
+    batch = &smesh->batches[smesh->batches_count - 1];
+    memset(batch, 0, sizeof(*batch));
+    return batch;
+}
+
+static void add_indices(static_mesh_batch_t *batch, int mode, int ofs,
+                        int n, const uint16_t *indices)
+{
+    int i, size;
+
+    if (!n) return;
+    size = batch->indices_count[mode] + n;
+    if (size > batch->indices_capacity[mode]) {
+        while (batch->indices_capacity[mode] < size) {
+            batch->indices_capacity[mode] = batch->indices_capacity[mode] ?
+                                            batch->indices_capacity[mode] * 2 :
+                                            1024;
+        }
+        batch->indices[mode] = realloc(batch->indices[mode],
+                batch->indices_capacity[mode] * sizeof(uint16_t));
+    }
+    for (i = 0; i < n; i++)
+        batch->indices[mode][batch->indices_count[mode]++] = indices[i] + ofs;
+}
+
+void static_mesh_add_mesh(static_mesh_t *smesh, int feature,
+                          const mesh_t *mesh)
+{
+    static_mesh_batch_t *batch;
+    double v[3];
+    int i, ofs;
+
+    assert(mesh->vertices_count <= BATCH_MAX_VERTS);
+    batch = get_batch(smesh, mesh->vertices_count);
+    ofs = batch->verts_count;
+    if (ofs + mesh->vertices_count > batch->verts_capacity) {
+        while (batch->verts_capacity < ofs + mesh->vertices_count) {
+            batch->verts_capacity = batch->verts_capacity ?
+                                    batch->verts_capacity * 2 : 1024;
+        }
+        batch->verts = realloc(batch->verts,
+                               batch->verts_capacity * sizeof(*batch->verts));
+    }
+    for (i = 0; i < mesh->vertices_count; i++) {
+        vec3_normalize(mesh->vertices[i], v);
+        batch->verts[ofs + i][0] = v[0];
+        batch->verts[ofs + i][1] = v[1];
+        batch->verts[ofs + i][2] = v[2];
+        batch->verts[ofs + i][3] = feature;
+    }
+    batch->verts_count += mesh->vertices_count;
+    if (mesh->subdivided) smesh->subdivided = true;
+
+    add_indices(batch, 0, ofs, mesh->triangles_count, mesh->triangles);
+    add_indices(batch, 1, ofs, mesh->lines_count, mesh->lines);
+    add_indices(batch, 2, ofs, mesh->points_count, mesh->points);
+}
+
+static void color_to_texel(const float c[4], uint8_t out[4])
+{
+    int i;
+    for (i = 0; i < 4; i++)
+        out[i] = clamp(c[i], 0, 1) * 255;
+}
+
+void static_mesh_set_feature(static_mesh_t *smesh, int feature,
+                             const float fill[4], const float stroke[4],
+                             bool blink, bool hidden)
+{
+    uint8_t texels[STATIC_MESH_FEATURE_TEXELS][4] = {};
+
+    assert(feature >= 0 && feature < smesh->features_count);
+    color_to_texel(fill, texels[0]);
+    color_to_texel(stroke, texels[1]);
+    texels[2][0] = blink ? 255 : 0;
+    texels[2][1] = hidden ? 255 : 0;
+    if (memcmp(texels, smesh->features[feature], sizeof(texels)) == 0)
+        return;
+    memcpy(smesh->features[feature], texels, sizeof(texels));
+    smesh->dirty = true;
+}
+
+texture_t *static_mesh_get_texture(static_mesh_t *smesh)
+{
+    int rows;
+    uint8_t *data;
+
+    // The texture id is zero if it was lost with the GL context.
+    if (!smesh->dirty && smesh->tex && smesh->tex->id) return smesh->tex;
+    rows = (smesh->features_count + FEATURES_PER_ROW - 1) / FEATURES_PER_ROW;
+    rows = rows ? rows : 1;
+    if (smesh->tex && smesh->tex->h != rows) {
+        texture_release(smesh->tex);
+        smesh->tex = NULL;
+    }
+    if (!smesh->tex) smesh->tex = texture_create(STATIC_MESH_TEX_WIDTH,
+                                                 rows, 4);
+    // The last row is padded with fully transparent features.
+    data = calloc(rows * FEATURES_PER_ROW, sizeof(*smesh->features));
+    memcpy(data, smesh->features,
+           smesh->features_count * sizeof(*smesh->features));
+    texture_set_data(smesh->tex, data, STATIC_MESH_TEX_WIDTH, rows, 4);
+    free(data);
+    smesh->dirty = false;
+    return smesh->tex;
+}
@@ -0,0 +1,154 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef STATIC_MESH_H
+#define STATIC_MESH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils/mesh.h"
+
+typedef struct texture texture_t;
+
+/*
+ * File: static_mesh.h
+ *
+ * Meshes that are uploaded once to the GPU and then rendered in a single
+ * draw call per batch, as used by the geojson layers.
+ *
+ * Each vertex keeps the index of the feature it belongs to, and the
+ * per-feature fill color, stroke color and flags are stored in a small
+ * RGBA texture that the vertex shader reads.  Changing the colors or the
+ * visibility of the features thus only updates this texture, and not the
+ * vertex buffers.
+ */
+
+// Number of texels per feature in the features texture.
+#define STATIC_MESH_FEATURE_TEXELS 4
+// Width of the features texture (a power of two).
+#define STATIC_MESH_TEX_WIDTH 1024
+
+/*
+ * Type: static_mesh_batch_t
+ * Part of a static mesh small enough to be indexed with uint16.
+ *
+ * Attributes:
+ *   verts_count    - Number of vertices.
+ *   verts          - Vertices: xyz position and feature index.
+ *   indices_count  - Number of indices for each mode (MODE_TRIANGLES,
+ *                    MODE_LINES and MODE_POINTS).
+ *   indices        - Indices for each mode.
+ *   vbo            - GPU vertex buffer, set by the renderer.
+ *   ibos           - GPU index buffers, set by the renderer.
+ */
+typedef struct static_mesh_batch {
+    int         verts_count;
+    int         verts_capacity;
+    float       (*verts)[4];
+    int         indices_count[3];
+    int         indices_capacity[3];
+    uint16_t    *indices[3];
+    uint32_t    vbo;
+    uint32_t    ibos[3];
+} static_mesh_batch_t;
+
+/*
+ * Type: static_mesh_t
+ * A set of features meshes, and their attributes texture.
+ *
+ * Attributes:
+ *   ref            - For ref counting, so that the renderer can keep the
+ *                    mesh alive until the end of the frame.
+ *   batches_count  - Number of batches.
+ *   batches        - The geometry, split in batches of at most 65536
+ *                    vertices.
+ *   features_count - Number of features.
+ *   features       - Per-feature texels: fill color, stroke color, flags
+ *                    (blink, hidden) and one unused texel.
+ *   tex            - The features texture, updated lazily.
+ *   dirty          - Set when the texture needs to be updated.
+ *   subdivided     - Set if any of the meshes was subdivided, in which case
+ *                    we render the triangles with the stencil hack.
+ *   blink          - Alpha factor applied to the fill color of the blinking
+ *                    features, set by the user before rendering.
+ */
+typedef struct static_mesh {
+    int                 ref;
+    int                 batches_count;
+    static_mesh_batch_t *batches;
+    int                 features_count;
+    int                 features_capacity;
+    uint8_t             (*features)[STATIC_MESH_FEATURE_TEXELS][4];
+    texture_t           *tex;
+    bool                dirty;
+    bool                subdivided;
+    float               blink;
+    struct static_mesh  *prev, *next; // List of all the meshes.
+} static_mesh_t;
+
+static_mesh_t *static_mesh_create(void);
+
+/*
+ * Function: static_mesh_release
+ * Decrease the ref count of a static mesh, and delete it if needed.
+ */
+void static_mesh_release(static_mesh_t *smesh);
+
+/*
+ * Function: static_mesh_on_context_lost
+ * Forget the GPU buffers of all the meshes, after the GL context was lost.
+ * The renderer uploads them again the next time it renders the meshes.
+ */
+void static_mesh_on_context_lost(void);
+
+/*
+ * Function: static_mesh_get_memory
+ * Add the memory of a static mesh in bytes, on the CPU and on the GPU.
+ */
+void static_mesh_get_memory(const static_mesh_t *smesh,
+                            int64_t *cpu, int64_t *gpu);
+
+/*
+ * Function: static_mesh_add_feature
+ * Add a new feature to a static mesh.
+ *
+ * Return:
+ *   The index of the feature, to be used with <static_mesh_add_mesh> and
+ *   <static_mesh_set_feature>.
+ */
+int static_mesh_add_feature(static_mesh_t *smesh);
+
+/*
+ * Function: static_mesh_add_mesh
+ * Add the geometry of a mesh to a feature.
+ *
+ * The mesh vertices are normalized, as the static meshes are always
+ * rendered at infinity.
+ */
+void static_mesh_add_mesh(static_mesh_t *smesh, int feature,
+                          const mesh_t *mesh);
+
+/*
+ * Function: static_mesh_set_feature
+ * Set the attributes of a feature.
+ *
+ * This only marks the features texture as dirty if the values changed.
+ */
+void static_mesh_set_feature(static_mesh_t *smesh, int feature,
+                             const float fill[4], const float stroke[4],
+                             bool blink, bool hidden);
+
+/*
+ * Function: static_mesh_get_texture
+ * Return the features texture, updated with the latest attributes.
+ */
+texture_t *static_mesh_get_texture(static_mesh_t *smesh);
+
+#endif // STATIC_MESH_H
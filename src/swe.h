@@ -33,15 +33,21 @@
 #include "log.h"
 #include "tests.h"
 
+#include "utils/alloc_track.h"
 #include "utils/cache.h"
 #include "utils/fader.h"
+#include "utils/frame_alloc.h"
 #include "utils/gesture.h"
+#include "utils/img_pool.h"
+#include "utils/profiler.h"
 #include "utils/progressbar.h"
 #include "utils/texture.h"
+#include "utils/trace.h"
 #include "utils/utils.h"
 #include "utils/utils_json.h"
 #include "utils/utf8.h"
 #include "utils/request.h"
+#include "utils/simd.h"
 #include "utils/vec.h"
 #include "utils/worker.h"
 
@@ -49,6 +55,7 @@
 #include "args.h"
 #include "assets.h"
 #include "constants.h"
+#include "occluders.h"
 
 #ifdef __EMSCRIPTEN__
 #   include <emscripten.h>
@@ -98,5 +105,6 @@ void swe_gen_doc(void);
 #include "gui.h"
 #include "symbols.h"
 #include "system.h"
+#include "snapshot.h"
 
 #endif // SWE_H
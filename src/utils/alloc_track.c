@@ -0,0 +1,127 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "alloc_track.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// We need to call the real functions here.
+#undef malloc
+#undef calloc
+#undef realloc
+
+#define NB_SITES 4096 // Must be a power of two.
+
+typedef struct {
+    const char  *file;  // NULL for an unused slot.
+    int         line;
+    uint32_t    count;  // Current frame.
+    uint64_t    bytes;
+    uint32_t    last_count; // Last frame.
+    uint64_t    last_bytes;
+} site_t;
+
+// Open addressing hash table of all the call sites.  The allocations can
+// happen from any thread, so the counters are atomic, and we only take a
+// lock the first time we see a call site.
+static struct {
+    site_t  sites[NB_SITES];
+    bool    lock;
+} g = {};
+
+#if SWE_ALLOC_TRACK
+
+static site_t *get_site(const char *file, int line)
+{
+    uint32_t i, h;
+    site_t *site;
+    const char *f;
+
+    h = (uint32_t)(((uintptr_t)file >> 3) * 31 + line) * 2654435761u;
+    for (i = 0; i < NB_SITES; i++) {
+        site = &g.sites[(h + i) & (NB_SITES - 1)];
+        f = __atomic_load_n(&site->file, __ATOMIC_ACQUIRE);
+        if (f == file && site->line == line) return site;
+        if (f) continue;
+
+        while (__atomic_test_and_set(&g.lock, __ATOMIC_ACQUIRE)) {}
+        if (!site->file) {
+            site->line = line;
+            __atomic_store_n(&site->file, file, __ATOMIC_RELEASE);
+        }
+        __atomic_clear(&g.lock, __ATOMIC_RELEASE);
+        // Check the slot again, another thread might have taken it.
+        if (site->file == file && site->line == line) return site;
+    }
+    return NULL; // Table full.
+}
+
+static void add(const char *file, int line, size_t size)
+{
+    site_t *site = get_site(file, line);
+    if (!site) return;
+    __atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&site->bytes, size, __ATOMIC_RELAXED);
+}
+
+#else
+
+static void add(const char *file, int line, size_t size) {}
+
+#endif // SWE_ALLOC_TRACK
+
+void *alloc_track_malloc(size_t size, const char *file, int line)
+{
+    add(file, line, size);
+    return malloc(size);
+}
+
+void *alloc_track_calloc(size_t n, size_t size, const char *file, int line)
+{
+    add(file, line, n * size);
+    return calloc(n, size);
+}
+
+void *alloc_track_realloc(void *ptr, size_t size, const char *file, int line)
+{
+    add(file, line, size);
+    return realloc(ptr, size);
+}
+
+void alloc_track_frame(void)
+{
+    int i;
+    site_t *site;
+    for (i = 0; i < NB_SITES; i++) {
+        site = &g.sites[i];
+        if (!__atomic_load_n(&site->file, __ATOMIC_ACQUIRE)) continue;
+        site->last_count = __atomic_exchange_n(&site->count, 0,
+                                               __ATOMIC_RELAXED);
+        site->last_bytes = __atomic_exchange_n(&site->bytes, 0,
+                                               __ATOMIC_RELAXED);
+    }
+}
+
+int alloc_track_list(void *user,
+                     void (*callback)(void *user, const char *file, int line,
+                                      int count, double bytes))
+{
+    int i, nb = 0;
+    const site_t *site;
+    for (i = 0; i < NB_SITES; i++) {
+        site = &g.sites[i];
+        if (!site->file || !site->last_count) continue;
+        if (callback) callback(user, site->file, site->line,
+                               site->last_count, site->last_bytes);
+        nb++;
+    }
+    return nb;
+}
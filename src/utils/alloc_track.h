@@ -0,0 +1,58 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef ALLOC_TRACK_H
+#define ALLOC_TRACK_H
+
+#include <stddef.h>
+
+/*
+ * File: alloc_track.h
+ * Optional count of the heap allocations per call site.
+ *
+ * When SWE_ALLOC_TRACK is set (scons alloc_track=1), config.h replaces
+ * malloc, calloc and realloc by the functions below in all the C files, so
+ * that we know how many allocations each line of code does per frame.
+ * Allocations done by external functions like strdup or asprintf are not
+ * counted.
+ *
+ * Without SWE_ALLOC_TRACK nothing is recorded, and alloc_track_list
+ * doesn't return anything.
+ */
+
+void *alloc_track_malloc(size_t size, const char *file, int line);
+void *alloc_track_calloc(size_t n, size_t size, const char *file, int line);
+void *alloc_track_realloc(void *ptr, size_t size, const char *file, int line);
+
+/*
+ * Function: alloc_track_frame
+ * Mark the end of a frame.
+ *
+ * The counts of the frame are kept for alloc_track_list, and the counters
+ * start again from zero.
+ */
+void alloc_track_frame(void);
+
+/*
+ * Function: alloc_track_list
+ * Iter all the call sites that did some allocations in the last frame.
+ *
+ * Parameters:
+ *   user     - Data passed to the callback.
+ *   callback - Called with the source file and line of the call site, the
+ *              number of allocations and the total size in bytes.
+ *
+ * Return:
+ *   The number of call sites.
+ */
+int alloc_track_list(void *user,
+                     void (*callback)(void *user, const char *file, int line,
+                                      int count, double bytes));
+
+#endif // ALLOC_TRACK_H
@@ -9,25 +9,39 @@
 
 #include "cache.h"
 #include "uthash.h"
+#include "utlist.h"
 #include <assert.h>
 #include <sys/time.h>
 
+/*
+ * All the items are stored both in a hash table for the lookup, and in
+ * a doubly linked list sorted by last usage time, with the least recently
+ * used item first.  This way both touching an item and finding the next
+ * item to evict are O(1).
+ */
+
 typedef struct item item_t;
 struct item {
     UT_hash_handle  hh;
-    char            key[256];
+    item_t          *prev, *next; // LRU list.
     void            *data;
     int             cost;
     int             (*delfunc)(void *data);
     // Used to give a grace period before we remove an item from the cache.
-    double          grace_time;
+    double          last_used;
+    char            key[];
 };
 
 struct cache {
-    item_t *items;
+    item_t *items;  // Hash table of all the items.
+    item_t *lru;    // All the items, least recently used first.
     int size;
     int max_size;
     double grace_period;
+    int nb_items;
+    int64_t hits;
+    int64_t misses;
+    int64_t evictions;
 };
 
 static double get_unix_time(void)
@@ -45,26 +59,40 @@ cache_t *cache_create(int size, double grace_period_sec)
     return cache;
 }
 
+// Move an item at the end of the LRU list.
+static void touch(cache_t *cache, item_t *item, double time)
+{
+    item->last_used = time;
+    if (item == cache->lru->prev) return; // Already last.
+    DL_DELETE(cache->lru, item);
+    DL_APPEND(cache->lru, item);
+}
+
 static void cleanup(cache_t *cache)
 {
-    item_t *item, *tmp;
+    item_t *item;
+    int n;
     double time = get_unix_time();
-    HASH_ITER(hh, cache->items, item, tmp) {
-        if (!item->grace_time) {
-            item->grace_time = time;
-            continue;
-        }
-        if (time - item->grace_time < cache->grace_period) continue;
 
+    // Visit each item at most once, since without grace period the kept
+    // items are put back at the end of the list and we would never stop.
+    for (n = cache->nb_items; n > 0; n--) {
+        item = cache->lru;
+        if (!item || cache->size < cache->max_size) return;
+        // Since the list is sorted, all the following items are still in
+        // their grace period too.
+        if (time - item->last_used < cache->grace_period) return;
         if (item->delfunc && item->delfunc(item->data) == CACHE_KEEP) {
-            item->grace_time = 0;
+            // Give it a new grace period.
+            touch(cache, item, time);
             continue;
         }
         HASH_DEL(cache->items, item);
-        assert(item != cache->items);
+        DL_DELETE(cache->lru, item);
         cache->size -= item->cost;
+        cache->nb_items--;
+        cache->evictions++;
         free(item);
-        if (cache->size < cache->max_size) return;
     }
 }
 
@@ -72,26 +100,30 @@ void cache_add(cache_t *cache, const void *key, int len, void *data,
                int cost, int (*delfunc)(void *data))
 {
     item_t *item;
-    assert(len <= sizeof(item->key));
+    assert(len <= 256);
     cache->size += cost;
     if (cache->size >= cache->max_size) cleanup(cache);
-    item = calloc(1, sizeof(*item));
+    item = calloc(1, sizeof(*item) + len);
     memcpy(item->key, key, len);
     item->data = data;
     item->cost = cost;
     item->delfunc = delfunc;
+    item->last_used = get_unix_time();
     HASH_ADD(hh, cache->items, key, len, item);
+    DL_APPEND(cache->lru, item);
+    cache->nb_items++;
 }
 
 void *cache_get(cache_t *cache, const void *key, int keylen)
 {
     item_t *item;
     HASH_FIND(hh, cache->items, key, keylen, item);
-    if (!item) return NULL;
-    item->grace_time = 0;
-    // Reinsert item on top of the hash list so that it stays sorted.
-    HASH_DEL(cache->items, item);
-    HASH_ADD(hh, cache->items, key, keylen, item);
+    if (!item) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    touch(cache, item, get_unix_time());
     return item->data;
 }
 
@@ -114,3 +146,92 @@ int cache_get_current_size(const cache_t *cache)
 {
     return cache->size;
 }
+
+void cache_set_max_size(cache_t *cache, int size)
+{
+    cache->max_size = size;
+    if (cache->size >= cache->max_size) cleanup(cache);
+}
+
+int cache_trim(cache_t *cache, int size)
+{
+    int max_size = cache->max_size, old_size = cache->size;
+    cache->max_size = size;
+    cleanup(cache);
+    cache->max_size = max_size;
+    return old_size - cache->size;
+}
+
+void cache_get_stats(const cache_t *cache, cache_stats_t *stats)
+{
+    stats->nb_items = cache->nb_items;
+    stats->size = cache->size;
+    stats->max_size = cache->max_size;
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+}
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+#include "tests.h"
+
+static int test_del(void *data)
+{
+    int *v = data;
+    return (*v == 1) ? CACHE_KEEP : 0;
+}
+
+static void test_cache_lru(void)
+{
+    cache_t *cache;
+    int i, keys[4] = {0, 1, 2, 3};
+    int values[4] = {0, 0, 0, 0};
+    cache_stats_t stats;
+
+    // No grace period, the cache stays strictly below the max size.
+    cache = cache_create(4, 0);
+    for (i = 0; i < 3; i++)
+        cache_add(cache, &keys[i], sizeof(int), &values[i], 1, test_del);
+    assert(cache_get_current_size(cache) == 3);
+
+    // Access the first item so that the second one is the oldest.
+    assert(cache_get(cache, &keys[0], sizeof(int)) == &values[0]);
+    cache_add(cache, &keys[3], sizeof(int), &values[3], 1, test_del);
+    assert(cache_get(cache, &keys[1], sizeof(int)) == NULL);
+    assert(cache_get(cache, &keys[0], sizeof(int)) == &values[0]);
+    assert(cache_get_current_size(cache) == 3);
+
+    // An item returning CACHE_KEEP is not evicted.
+    values[2] = 1;
+    cache_get(cache, &keys[3], sizeof(int));
+    cache_get(cache, &keys[0], sizeof(int));
+    cache_set_cost(cache, &keys[0], sizeof(int), 2);
+    assert(cache_get(cache, &keys[2], sizeof(int)) == &values[2]);
+    assert(cache_get(cache, &keys[3], sizeof(int)) == NULL);
+    assert(cache_get_current_size(cache) == 3);
+
+    cache_get_stats(cache, &stats);
+    assert(stats.nb_items == 2);
+    assert(stats.evictions == 2);
+    assert(stats.misses == 2);
+
+    // Trim everything but the kept item, without changing the max size.
+    assert(cache_trim(cache, 0) == 2);
+    assert(cache_get(cache, &keys[2], sizeof(int)) == &values[2]);
+    cache_get_stats(cache, &stats);
+    assert(stats.nb_items == 1 && stats.max_size == 4);
+
+    // Cache over budget with only kept items: the cleanup should return.
+    values[0] = 1;
+    cache_add(cache, &keys[0], sizeof(int), &values[0], 4, test_del);
+    assert(cache_get_current_size(cache) == 5);
+    cache_set_max_size(cache, 1);
+    assert(cache_get_current_size(cache) == 5);
+}
+
+TEST_REGISTER(NULL, test_cache_lru, TEST_AUTO);
+
+#endif
@@ -13,6 +13,8 @@
  * Utils to store values in cache.
  */
 
+#include <stdint.h>
+
 /*
  * Enum: CACHE_KEEP
  * The cache delete function callback can return this value to tell the
@@ -26,6 +28,27 @@
  */
 typedef struct cache cache_t;
 
+/*
+ * Type: cache_stats_t
+ * Usage statistics of a cache, as returned by <cache_get_stats>.
+ *
+ * Attributes:
+ *   nb_items   - Number of items currently in the cache.
+ *   size       - Total cost of the items currently in the cache.
+ *   max_size   - Maximum size of the cache.
+ *   hits       - Number of successful calls to <cache_get>.
+ *   misses     - Number of calls to <cache_get> that didn't find the item.
+ *   evictions  - Number of items removed from the cache so far.
+ */
+typedef struct cache_stats {
+    int         nb_items;
+    int         size;
+    int         max_size;
+    int64_t     hits;
+    int64_t     misses;
+    int64_t     evictions;
+} cache_stats_t;
+
 /*
  * Function: cache_create
  * Create a new cache with a given max size.
@@ -82,3 +105,32 @@ void cache_set_cost(cache_t *cache, const void *key, int keylen, int cost);
  */
 int cache_get_current_size(const cache_t *cache);
 
+
+/*
+ * Function: cache_set_max_size
+ * Change the maximum size of a cache.
+ *
+ * If the new size is lower than the current size, the least recently used
+ * items are evicted immediately (as long as they are not in their grace
+ * period).
+ */
+void cache_set_max_size(cache_t *cache, int size);
+
+/*
+ * Function: cache_trim
+ * Evict the least recently used items until the cache size gets below a
+ * given size, without changing the cache max size.
+ *
+ * As for the normal evictions, the items still in their grace period are
+ * kept.
+ *
+ * Return:
+ *   The total cost of the evicted items.
+ */
+int cache_trim(cache_t *cache, int size);
+
+/*
+ * Function: cache_get_stats
+ * Get the usage statistics of a cache.
+ */
+void cache_get_stats(const cache_t *cache, cache_stats_t *stats);
@@ -13,6 +13,8 @@
 
 // XXX: add easing curves support.
 
+// Number of faders that moved since the last call to faders_animating.
+static int g_moving = 0;
 
 static double cmp(float x, float y)
 {
@@ -55,12 +57,21 @@ void fader_init2(fader_t *f, bool v, double duration)
     f->duration = duration;
 }
 
-bool fader_update(fader_t *f, double dt)
+bool fader_move(fader_t *f, double dt)
 {
     double speed;
     if (f->duration <= 0)
         speed = 1. / FADER_DEFAULT_DURATION;
     else
         speed = 1. / f->duration;
-    return move_toward(&f->value, f->target, 0, speed, dt);
+    if (!move_toward(&f->value, f->target, 0, speed, dt)) return false;
+    g_moving++;
+    return true;
+}
+
+bool faders_animating(void)
+{
+    bool ret = g_moving > 0;
+    g_moving = 0;
+    return ret;
 }
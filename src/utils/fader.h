@@ -53,10 +53,16 @@ void fader_init(fader_t *f, bool v);
  */
 void fader_init2(fader_t *f, bool v, double duration);
 
+// Move a fader that is not settled, see <fader_update>.
+bool fader_move(fader_t *f, double dt);
+
 /*
  * Function: fader_update
  * Update a fader value.
  *
+ * This is called for all the faders at each frame, so the settled faders
+ * return directly without any function call.
+ *
  * Parameters:
  *   f        - the fader.
  *   dt       - the time increment (s).
@@ -64,6 +70,20 @@ void fader_init2(fader_t *f, bool v, double duration);
  * Return:
  *   true if the fader value has changed.
  */
-bool fader_update(fader_t *f, double dt);
+static inline bool fader_update(fader_t *f, double dt)
+{
+    if (f->value == (f->target ? 1.0 : 0.0)) return false;
+    return fader_move(f, dt);
+}
+
+/*
+ * Function: faders_animating
+ * Return whether any fader moved since the last call.
+ *
+ * The core checks it once per frame, so that we keep rendering while some
+ * effects are still fading, even if the module that owns the fader doesn't
+ * report it from its update.
+ */
+bool faders_animating(void);
 
 #endif // FADER_H
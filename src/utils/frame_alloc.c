@@ -0,0 +1,152 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "frame_alloc.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#define MIN_BLOCK_SIZE (256 * 1024)
+#define ALIGN 8
+
+// The blocks are seen as a single contiguous range of positions, so that a
+// mark is just a position in this range.
+typedef struct block block_t;
+struct block {
+    block_t *next;
+    size_t  start;  // Position of the first byte in the arena.
+    size_t  size;
+    _Alignas(ALIGN) unsigned char data[];
+};
+
+static struct {
+    block_t *blocks;
+    block_t *cur;
+    size_t  pos;    // Offset in the current block.
+} g = {};
+
+static void free_blocks(block_t *block)
+{
+    block_t *next;
+    for (; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+}
+
+static block_t *new_block(size_t start, size_t size)
+{
+    block_t *block;
+    block = malloc(sizeof(*block) + size);
+    block->next = NULL;
+    block->start = start;
+    block->size = size;
+    return block;
+}
+
+void *frame_alloc(size_t size)
+{
+    block_t *cur = g.cur;
+    size_t start, block_size;
+
+    size = (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+    if (cur && g.pos + size <= cur->size) {
+        g.pos += size;
+        return cur->data + g.pos - size;
+    }
+
+    // Move to the next block, or replace all the next blocks by a new one
+    // large enough.
+    if (!cur || !cur->next || cur->next->size < size) {
+        start = cur ? cur->start + cur->size : 0;
+        if (cur) free_blocks(cur->next);
+        block_size = cur ? cur->size * 2 : 0;
+        if (block_size < MIN_BLOCK_SIZE) block_size = MIN_BLOCK_SIZE;
+        if (block_size < size) block_size = size;
+        if (cur) cur->next = new_block(start, block_size);
+        else g.blocks = new_block(start, block_size);
+    }
+    g.cur = cur ? cur->next : g.blocks;
+    g.pos = size;
+    return g.cur->data;
+}
+
+size_t frame_alloc_mark(void)
+{
+    return g.cur ? g.cur->start + g.pos : 0;
+}
+
+void frame_alloc_rewind(size_t mark)
+{
+    block_t *block;
+    if (!g.cur) return;
+    for (block = g.blocks; block->next; block = block->next) {
+        if (mark <= block->start + block->size) break;
+    }
+    assert(mark >= block->start && mark <= block->start + block->size);
+    g.cur = block;
+    g.pos = mark - block->start;
+}
+
+void frame_alloc_reset(void)
+{
+    size_t size = 0;
+    block_t *block;
+
+    if (g.blocks && g.blocks->next) {
+        for (block = g.blocks; block; block = block->next)
+            size += block->size;
+        free_blocks(g.blocks);
+        g.blocks = new_block(0, size);
+    }
+    g.cur = g.blocks;
+    g.pos = 0;
+}
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+#include "tests.h"
+#include <stdint.h>
+
+static void test_frame_alloc(void)
+{
+    size_t mark;
+    void *a, *b;
+
+    frame_alloc_reset();
+    a = frame_alloc(10);
+    assert(((uintptr_t)a % ALIGN) == 0);
+    mark = frame_alloc_mark();
+    b = frame_alloc(10);
+    assert(b != a);
+    frame_alloc_rewind(mark);
+    assert(frame_alloc(10) == b);
+
+    // Overflow the first block, then rewind into it.
+    mark = frame_alloc_mark();
+    b = frame_alloc(MIN_BLOCK_SIZE);
+    assert(g.blocks->next && g.cur == g.blocks->next);
+    frame_alloc_rewind(mark);
+    assert(g.cur == g.blocks);
+
+    // After a reset the blocks are merged, so the same allocations fit in
+    // a single block.
+    frame_alloc_reset();
+    assert(g.blocks && !g.blocks->next);
+    frame_alloc(20);
+    frame_alloc(MIN_BLOCK_SIZE);
+    assert(!g.blocks->next);
+    frame_alloc_reset();
+}
+
+TEST_REGISTER(NULL, test_frame_alloc, TEST_AUTO);
+
+#endif
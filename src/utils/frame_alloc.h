@@ -0,0 +1,60 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef FRAME_ALLOC_H
+#define FRAME_ALLOC_H
+
+#include <stddef.h>
+
+/*
+ * File: frame_alloc.h
+ * Arena allocator for the transient buffers of a frame.
+ *
+ * The memory is taken from a few large blocks, that are all given back at
+ * once by frame_alloc_reset at the end of each frame (in paint_finish).
+ * Once the arena is large enough for a frame, the next frames don't do any
+ * heap allocation.
+ *
+ * The arena also works as a stack: a function can get a mark, allocate
+ * some scratch buffers, and rewind to the mark when it is done with them.
+ *
+ * This is only safe to use from the main thread.
+ */
+
+/*
+ * Function: frame_alloc
+ * Allocate memory valid until the next reset, or rewind to a previous mark.
+ *
+ * The returned memory is not initialized, and is aligned to 8 bytes.
+ */
+void *frame_alloc(size_t size);
+
+/*
+ * Function: frame_alloc_mark
+ * Return the current position of the arena, to use with frame_alloc_rewind.
+ */
+size_t frame_alloc_mark(void);
+
+/*
+ * Function: frame_alloc_rewind
+ * Give back all the memory allocated since a mark.
+ */
+void frame_alloc_rewind(size_t mark);
+
+/*
+ * Function: frame_alloc_reset
+ * Give back all the memory.  Called by paint_finish, once the renderer
+ * has consumed all the data of the frame.
+ *
+ * If the last frame needed several blocks, they get merged into a single
+ * one large enough for them all.
+ */
+void frame_alloc_reset(void);
+
+#endif // FRAME_ALLOC_H
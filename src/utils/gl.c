@@ -8,6 +8,7 @@
  */
 
 #include "gl.h"
+#include "trace.h"
 
 #include <assert.h>
 #include <stdarg.h>
@@ -19,6 +20,12 @@
 #   define LOG_E
 #endif
 
+// From KHR_parallel_shader_compile (ARB_parallel_shader_compile uses the
+// same value).
+#ifndef GL_COMPLETION_STATUS_KHR
+#   define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 const char *gl_enum_str(int code)
 {
     switch (code) {
@@ -73,12 +80,10 @@ int gl_check_errors(const char *file, int line)
     return errors;
 }
 
-static int compile_shader(int shader, const char *code,
-                          const char *include1,
-                          const char *include2)
+static void compile_shader(int shader, const char *code,
+                           const char *include1,
+                           const char *include2)
 {
-    int status, len;
-    char *log;
 #ifndef GLES2
     // We need GLSL version 1.2 to have gl_PointCoord support in desktop OpenGL
     // It's already included in GLES 2.0
@@ -90,6 +95,12 @@ static int compile_shader(int shader, const char *code,
     const char *sources[] = {pre, include1, include2, code};
     glShaderSource(shader, 4, (const char**)&sources, NULL);
     glCompileShader(shader);
+}
+
+static int check_shader(int shader)
+{
+    int status, len;
+    char *log;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
     if (status != GL_TRUE) {
         glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
@@ -99,44 +110,43 @@ static int compile_shader(int shader, const char *code,
         LOG_E("%s", log);
         free(log);
         assert(false);
+        return -1;
     }
     return 0;
 }
 
 /*
- * Function: gl_shader_create
- * Helper function that compiles an opengl shader.
- *
- * Parameters:
- *   vert       - The vertex shader code.
- *   frag       - The fragment shader code.
- *   include    - Extra includes added to both shaders.
- *   attr_names - NULL terminated list of attribute names that will be binded.
- *
- * Return:
- *   A new gl_shader_t instance.
+ * Return whether we can query the compilation status without blocking.
  */
-gl_shader_t *gl_shader_create(const char *vert, const char *frag,
-                              const char *include, const char **attr_names)
+static bool has_parallel_compile(void)
 {
-    int i, status, len, count;
+    static int ret = -1;
+    const char *exts;
+    if (ret == -1) {
+        exts = (const char*)glGetString(GL_EXTENSIONS);
+        ret = exts && strstr(exts, "_parallel_shader_compile");
+    }
+    return ret;
+}
+
+gl_shader_t *gl_shader_create_async(const char *vert, const char *frag,
+                                    const char *include,
+                                    const char **attr_names)
+{
+    int i;
     int vertex_shader, fragment_shader;
-    char log[1024];
     gl_shader_t *shader;
     GLint prog;
-    gl_uniform_t *uni;
 
+    trace_begin("gl", "shader_compile");
     vertex_shader = glCreateShader(GL_VERTEX_SHADER);
     include = include ? : "";
     assert(vertex_shader);
-    if (compile_shader(vertex_shader, vert,
-                       "#define VERTEX_SHADER\n", include))
-        return NULL;
+    compile_shader(vertex_shader, vert, "#define VERTEX_SHADER\n", include);
     fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
     assert(fragment_shader);
-    if (compile_shader(fragment_shader, frag,
-                       "#define FRAGMENT_SHADER\n", include))
-        return NULL;
+    compile_shader(fragment_shader, frag, "#define FRAGMENT_SHADER\n",
+                   include);
     prog = glCreateProgram();
     glAttachShader(prog, vertex_shader);
     glAttachShader(prog, fragment_shader);
@@ -148,20 +158,43 @@ gl_shader_t *gl_shader_create(const char *vert, const char *frag,
         }
     }
 
+    // Don't query any status here, since it would wait for the compilation.
     glLinkProgram(prog);
-    glGetProgramiv(prog, GL_LINK_STATUS, &status);
+    shader = calloc(1, sizeof(*shader));
+    shader->prog = prog;
+    trace_end("gl", "shader_compile");
+    return shader;
+}
+
+/*
+ * Check the link status and read the uniforms locations.
+ */
+static int shader_finish(gl_shader_t *shader)
+{
+    int i, status, len, count, max;
+    char log[1024];
+    GLuint shaders[2];
+    GLint nb = 0;
+    gl_uniform_t *uni;
+
+    trace_begin("gl", "shader_link");
+    glGetProgramiv(shader->prog, GL_LINK_STATUS, &status);
     if (status != GL_TRUE) {
+        GL(glGetAttachedShaders(shader->prog, 2, &nb, shaders));
+        for (i = 0; i < nb; i++) check_shader(shaders[i]);
         LOG_E("Link Error");
-        glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &len);
-        glGetProgramInfoLog(prog, sizeof(log), NULL, log);
+        glGetProgramiv(shader->prog, GL_INFO_LOG_LENGTH, &len);
+        glGetProgramInfoLog(shader->prog, sizeof(log), NULL, log);
         LOG_E("%s", log);
-        return NULL;
+        shader->failed = true;
+        trace_end("gl", "shader_link");
+        return -1;
     }
 
-    shader = calloc(1, sizeof(*shader));
-    shader->prog = prog;
-
     GL(glGetProgramiv(shader->prog, GL_ACTIVE_UNIFORMS, &count));
+    max = sizeof(shader->uniforms) / sizeof(shader->uniforms[0]) - 1;
+    assert(count <= max);
+    if (count > max) count = max;
     for (i = 0; i < count; i++) {
         uni = &shader->uniforms[i];
         GL(glGetActiveUniform(shader->prog, i, sizeof(uni->name),
@@ -174,7 +207,46 @@ gl_shader_t *gl_shader_create(const char *vert, const char *frag,
         }
         GL(uni->loc = glGetUniformLocation(shader->prog, uni->name));
     }
+    shader->ready = true;
+    trace_end("gl", "shader_link");
+    return 0;
+}
 
+bool gl_shader_is_ready(gl_shader_t *shader, bool wait)
+{
+    GLint done;
+    if (shader->ready) return true;
+    if (shader->failed) return false;
+    if (!wait && has_parallel_compile()) {
+        glGetProgramiv(shader->prog, GL_COMPLETION_STATUS_KHR, &done);
+        if (!done) return false;
+    }
+    shader_finish(shader);
+    return shader->ready;
+}
+
+/*
+ * Function: gl_shader_create
+ * Helper function that compiles an opengl shader.
+ *
+ * Parameters:
+ *   vert       - The vertex shader code.
+ *   frag       - The fragment shader code.
+ *   include    - Extra includes added to both shaders.
+ *   attr_names - NULL terminated list of attribute names that will be binded.
+ *
+ * Return:
+ *   A new gl_shader_t instance.
+ */
+gl_shader_t *gl_shader_create(const char *vert, const char *frag,
+                              const char *include, const char **attr_names)
+{
+    gl_shader_t *shader;
+    shader = gl_shader_create_async(vert, frag, include, attr_names);
+    if (!gl_shader_is_ready(shader, true)) {
+        gl_shader_delete(shader);
+        return NULL;
+    }
     return shader;
 }
 
@@ -314,16 +386,30 @@ void gl_buf_disable(const gl_buf_t *buf)
     }
 }
 
-static const gl_uniform_t *get_uniform(const gl_shader_t *shader,
-                                       const char *name)
+static gl_uniform_t *get_uniform(gl_shader_t *shader, const char *name)
 {
-    const gl_uniform_t *uni;
+    gl_uniform_t *uni;
     for (uni = &shader->uniforms[0]; uni->size; uni++) {
         if (strcmp(uni->name, name) == 0) return uni;
     }
     return NULL;
 }
 
+/*
+ * Check if a new uniform value differs from the last one we uploaded, and
+ * if so store it.  The uniforms values are part of the program state, so
+ * most per-frame values (projection, window size, depth range...) only
+ * need to be sent once per frame and per shader.
+ */
+static bool uniform_changed(gl_uniform_t *uni, const void *v, int size)
+{
+    assert(size <= sizeof(uni->value));
+    if (uni->has_value && memcmp(uni->value, v, size) == 0) return false;
+    memcpy(uni->value, v, size);
+    uni->has_value = true;
+    return true;
+}
+
 bool gl_has_uniform(gl_shader_t *shader, const char *name)
 {
     return get_uniform(shader, name) != NULL;
@@ -334,13 +420,9 @@ void gl_update_uniform_vec3(gl_shader_t *shader, const char *name,
 {
     float vf[3];
     int i;
-    const gl_uniform_t *uni;
 
-    uni = get_uniform(shader, name);
-    if (!uni) return;
-    assert(uni->type == GL_FLOAT_VEC3);
     for (i = 0; i < 3; i++) vf[i] = v[i];
-    GL(glUniform3fv(uni->loc, 1, vf));
+    gl_update_uniform(shader, name, vf);
 }
 
 void gl_update_uniform_mat3(gl_shader_t *shader, const char *name,
@@ -348,14 +430,10 @@ void gl_update_uniform_mat3(gl_shader_t *shader, const char *name,
 {
     float vf[9];
     int i, j;
-    const gl_uniform_t *uni;
 
-    uni = get_uniform(shader, name);
-    if (!uni) return;
-    assert(uni->type == GL_FLOAT_MAT3);
     for (i = 0; i < 3; i++) for (j = 0; j < 3; j++)
         vf[i * 3 + j] = v[i][j];
-    GL(glUniformMatrix4fv(uni->loc, 1, 0, vf));
+    gl_update_uniform(shader, name, vf);
 }
 
 void gl_update_uniform_mat4(gl_shader_t *shader, const char *name,
@@ -363,20 +441,19 @@ void gl_update_uniform_mat4(gl_shader_t *shader, const char *name,
 {
     float vf[16];
     int i, j;
-    const gl_uniform_t *uni;
 
-    uni = get_uniform(shader, name);
-    if (!uni) return;
-    assert(uni->type == GL_FLOAT_MAT4);
     for (i = 0; i < 4; i++) for (j = 0; j < 4; j++)
         vf[i * 4 + j] = v[i][j];
-    GL(glUniformMatrix4fv(uni->loc, 1, 0, vf));
+    gl_update_uniform(shader, name, vf);
 }
 
 void gl_update_uniform(gl_shader_t *shader, const char *name, ...)
 {
-    const gl_uniform_t *uni;
+    gl_uniform_t *uni;
     va_list args;
+    int iv;
+    float fv;
+    const float *v;
 
     uni = get_uniform(shader, name);
     if (!uni) return;
@@ -386,28 +463,43 @@ void gl_update_uniform(gl_shader_t *shader, const char *name, ...)
     case GL_INT:
     case GL_SAMPLER_2D:
     case GL_SAMPLER_CUBE:
-        GL(glUniform1i(uni->loc, va_arg(args, int)));
+        iv = va_arg(args, int);
+        if (uniform_changed(uni, &iv, sizeof(iv)))
+            GL(glUniform1i(uni->loc, iv));
         break;
     case GL_FLOAT:
-        if (uni->size == 1)
-            GL(glUniform1f(uni->loc, va_arg(args, double)));
-        else
+        if (uni->size == 1) {
+            fv = va_arg(args, double);
+            if (uniform_changed(uni, &fv, sizeof(fv)))
+                GL(glUniform1f(uni->loc, fv));
+        } else {
             GL(glUniform1fv(uni->loc, uni->size, va_arg(args, float*)));
+        }
         break;
     case GL_FLOAT_VEC2:
-        GL(glUniform2fv(uni->loc, 1, va_arg(args, const float*)));
+        v = va_arg(args, const float*);
+        if (uniform_changed(uni, v, 2 * sizeof(*v)))
+            GL(glUniform2fv(uni->loc, 1, v));
         break;
     case GL_FLOAT_VEC3:
-        GL(glUniform3fv(uni->loc, 1, va_arg(args, const float*)));
+        v = va_arg(args, const float*);
+        if (uniform_changed(uni, v, 3 * sizeof(*v)))
+            GL(glUniform3fv(uni->loc, 1, v));
         break;
     case GL_FLOAT_VEC4:
-        GL(glUniform4fv(uni->loc, 1, va_arg(args, const float*)));
+        v = va_arg(args, const float*);
+        if (uniform_changed(uni, v, 4 * sizeof(*v)))
+            GL(glUniform4fv(uni->loc, 1, v));
         break;
     case GL_FLOAT_MAT3:
-        GL(glUniformMatrix3fv(uni->loc, 1, 0, va_arg(args, const float*)));
+        v = va_arg(args, const float*);
+        if (uniform_changed(uni, v, 9 * sizeof(*v)))
+            GL(glUniformMatrix3fv(uni->loc, 1, 0, v));
         break;
     case GL_FLOAT_MAT4:
-        GL(glUniformMatrix4fv(uni->loc, 1, 0, va_arg(args, const float*)));
+        v = va_arg(args, const float*);
+        if (uniform_changed(uni, v, 16 * sizeof(*v)))
+            GL(glUniformMatrix4fv(uni->loc, 1, 0, v));
         break;
     default:
         assert(false);
@@ -156,6 +156,10 @@ typedef struct gl_uniform {
     GLint       size;
     GLenum      type;
     GLint       loc;
+    // Last uploaded value, so that we can skip redundant glUniform calls.
+    // Not used for array uniforms.
+    bool        has_value;
+    float       value[16];
 } gl_uniform_t;
 
 /*
@@ -164,6 +168,8 @@ typedef struct gl_uniform {
  */
 typedef struct gl_shader {
     GLint           prog;
+    bool            ready;  // Set once linked and the uniforms are known.
+    bool            failed; // Set if the link failed.
     gl_uniform_t    uniforms[32];
 } gl_shader_t;
 
@@ -183,6 +189,34 @@ typedef struct gl_shader {
 gl_shader_t *gl_shader_create(const char *vert, const char *frag,
                               const char *include, const char **attr_names);
 
+/*
+ * Function: gl_shader_create_async
+ * Same as gl_shader_create, but don't wait for the compilation to finish.
+ *
+ * The returned shader cannot be used until <gl_shader_is_ready> returns
+ * true.  If the driver supports KHR_parallel_shader_compile, the compilation
+ * happens in the background.
+ */
+gl_shader_t *gl_shader_create_async(const char *vert, const char *frag,
+                                    const char *include,
+                                    const char **attr_names);
+
+/*
+ * Function: gl_shader_is_ready
+ * Check if a shader created with gl_shader_create_async is ready to use.
+ *
+ * If the link failed, the error is only logged the first time, and the
+ * shader is never ready.
+ *
+ * Parameters:
+ *   shader - A shader.
+ *   wait   - If set, block until the shader is ready.
+ *
+ * Return:
+ *   true if the shader is ready.
+ */
+bool gl_shader_is_ready(gl_shader_t *shader, bool wait);
+
 void gl_shader_delete(gl_shader_t *shader);
 
 /*
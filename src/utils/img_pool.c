@@ -0,0 +1,161 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "img_pool.h"
+
+#include <stdlib.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// Max total size of the buffers kept in the pool.
+#define POOL_MAX_SIZE (32 * 1024 * 1024)
+
+// Sizes up to this much smaller than a class size also use the class, so
+// that the few extra bytes some decoders ask for don't prevent the reuse.
+#define CLASS_SLACK 4096
+
+// The buffers capacity of each size class.
+static const size_t CLASSES[] = {
+    256 * 256 * 3 + CLASS_SLACK,
+    256 * 256 * 4 + CLASS_SLACK,
+    512 * 512 * 3 + CLASS_SLACK,
+    512 * 512 * 4 + CLASS_SLACK,
+};
+
+#define NB_CLASSES (sizeof(CLASSES) / sizeof(CLASSES[0]))
+
+// The free buffers are linked using their first bytes.
+typedef struct buffer buffer_t;
+struct buffer {
+    buffer_t *next;
+};
+
+static struct {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+    buffer_t        *free[NB_CLASSES];
+    size_t          size; // Total size of the free buffers.
+} g = {
+#ifdef HAVE_PTHREAD
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+static void lock(void)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&g.lock);
+#endif
+}
+
+static void unlock(void)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&g.lock);
+#endif
+}
+
+// Return the size class of a buffer size, or -1.
+static int get_class(size_t size)
+{
+    int i;
+    for (i = 0; i < NB_CLASSES; i++) {
+        if (size <= CLASSES[i] && size + CLASS_SLACK * 2 > CLASSES[i])
+            return i;
+    }
+    return -1;
+}
+
+void *img_pool_alloc(size_t size)
+{
+    int c = get_class(size);
+    buffer_t *buf;
+
+    if (c == -1) return malloc(size);
+    lock();
+    buf = g.free[c];
+    if (buf) {
+        g.free[c] = buf->next;
+        g.size -= CLASSES[c];
+    }
+    unlock();
+    return buf ?: malloc(CLASSES[c]);
+}
+
+void img_pool_release(void *buf_, size_t size)
+{
+    int c = get_class(size);
+    buffer_t *buf = buf_;
+
+    if (!buf) return;
+    if (c == -1) {
+        free(buf);
+        return;
+    }
+    lock();
+    if (g.size + CLASSES[c] <= POOL_MAX_SIZE) {
+        buf->next = g.free[c];
+        g.free[c] = buf;
+        g.size += CLASSES[c];
+        buf = NULL;
+    }
+    unlock();
+    free(buf);
+}
+
+void img_pool_clear(void)
+{
+    int i;
+    buffer_t *buf, *next;
+
+    lock();
+    for (i = 0; i < NB_CLASSES; i++) {
+        for (buf = g.free[i]; buf; buf = next) {
+            next = buf->next;
+            free(buf);
+        }
+        g.free[i] = NULL;
+    }
+    g.size = 0;
+    unlock();
+}
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+#include "tests.h"
+#include <assert.h>
+
+static void test_img_pool(void)
+{
+    void *a, *b;
+
+    img_pool_clear();
+    a = img_pool_alloc(512 * 512 * 4);
+    img_pool_release(a, 512 * 512 * 4);
+    // Reused, even with a slightly different size of the same class.
+    b = img_pool_alloc(512 * 512 * 4 + 1);
+    assert(b == a);
+    img_pool_release(b, 512 * 512 * 4 + 1);
+    b = img_pool_alloc(512 * 512 * 3);
+    assert(b != a);
+    img_pool_release(b, 512 * 512 * 3);
+    // Other sizes are not pooled.
+    assert(get_class(100) == -1);
+    img_pool_clear();
+    assert(g.size == 0);
+}
+
+TEST_REGISTER(NULL, test_img_pool, TEST_AUTO);
+
+#endif
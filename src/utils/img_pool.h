@@ -0,0 +1,57 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef IMG_POOL_H
+#define IMG_POOL_H
+
+#include <stddef.h>
+
+/*
+ * File: img_pool.h
+ * Pool of reusable buffers for the decoded tile images.
+ *
+ * The survey tiles all have the same few sizes (256x256 or 512x512, RGB or
+ * RGBA), so instead of allocating a new buffer for each decoded tile and
+ * freeing it once uploaded to the GPU, we keep the released buffers in a
+ * free list per size class, up to a given total size.
+ *
+ * The pooled buffers are normal heap blocks, so they can also be given
+ * back with free, they are just not reused then.
+ *
+ * The functions are thread safe, since the images are decoded in the
+ * worker pool.
+ */
+
+/*
+ * Function: img_pool_alloc
+ * Allocate a buffer of at least a given size.
+ *
+ * If the size matches one of the pool size classes, the buffer is taken
+ * from the pool if possible.  The returned memory is not initialized.
+ */
+void *img_pool_alloc(size_t size);
+
+/*
+ * Function: img_pool_release
+ * Give back a buffer returned by img_pool_alloc.
+ *
+ * Parameters:
+ *   buf    - A buffer returned by img_pool_alloc, or NULL.
+ *   size   - The size that was passed to img_pool_alloc, or any other size
+ *            of the same size class.
+ */
+void img_pool_release(void *buf, size_t size);
+
+/*
+ * Function: img_pool_clear
+ * Free all the buffers currently in the pool.
+ */
+void img_pool_clear(void);
+
+#endif // IMG_POOL_H
@@ -46,6 +46,14 @@ void mesh_delete(mesh_t *mesh)
     free(mesh);
 }
 
+int mesh_get_size(const mesh_t *mesh)
+{
+    return sizeof(*mesh) +
+           mesh->vertices_count * sizeof(*mesh->vertices) +
+           (mesh->triangles_count + mesh->lines_count + mesh->points_count) *
+           sizeof(uint16_t);
+}
+
 mesh_t *mesh_copy(const mesh_t *mesh)
 {
     mesh_t *ret = calloc(1, sizeof(*ret));
@@ -61,6 +69,11 @@ mesh_t *mesh_copy(const mesh_t *mesh)
            ret->triangles_count * sizeof(*ret->triangles));
     ret->lines = malloc(ret->lines_count * sizeof(*ret->lines));
     memcpy(ret->lines, mesh->lines, ret->lines_count * sizeof(*ret->lines));
+    ret->points_count = mesh->points_count;
+    ret->points = malloc(ret->points_count * sizeof(*ret->points));
+    memcpy(ret->points, mesh->points,
+           ret->points_count * sizeof(*ret->points));
+    ret->subdivided = mesh->subdivided;
     return ret;
 }
 
@@ -414,6 +427,8 @@ static int mesh_subdivide_triangle(mesh_t *mesh, int idx, double max_length)
         assert(i < 3);
         if (sides[i] < max_length * max_length)
             break;
+        // Don't overflow the uint16 indices.
+        if (mesh->vertices_count >= UINT16_MAX) break;
 
         mesh_subdivide_edge(mesh, mesh->triangles[idx + (i + 1) % 3],
                                   mesh->triangles[idx + (i + 2) % 3]);
@@ -422,6 +437,19 @@ static int mesh_subdivide_triangle(mesh_t *mesh, int idx, double max_length)
     return ret;
 }
 
+static int mesh_subdivide_segment(mesh_t *mesh, int idx, double max_length)
+{
+    int ret = 0;
+    while (vec3_dist2(mesh->vertices[mesh->lines[idx + 0]],
+                      mesh->vertices[mesh->lines[idx + 1]]) >=
+           max_length * max_length) {
+        if (mesh->vertices_count >= UINT16_MAX) break;
+        mesh_subdivide_edge(mesh, mesh->lines[idx + 0], mesh->lines[idx + 1]);
+        ret++;
+    }
+    return ret;
+}
+
 /*
  * Function: mesh_subdivide
  * Subdivide edges that are larger than a given length.
@@ -434,9 +462,92 @@ int mesh_subdivide(mesh_t *mesh, double max_length)
     for (i = 0; i < mesh->triangles_count; i += 3) {
         ret += mesh_subdivide_triangle(mesh, i, max_length);
     }
+    // The lines that are not triangles edges.
+    for (i = 0; i < mesh->lines_count; i += 2) {
+        ret += mesh_subdivide_segment(mesh, i, max_length);
+    }
     return ret;
 }
 
+// Angular distance of a point to the great circle arc [a, b].
+static double point_arc_dist(const double p[3], const double a[3],
+                             const double b[3])
+{
+    double n[3];
+    vec3_cross(a, b, n);
+    if (vec3_norm2(n) < 1e-24)
+        return acos(max(-1, min(vec3_dot(p, a), 1)));
+    vec3_normalize(n, n);
+    return asin(min(fabs(vec3_dot(p, n)), 1));
+}
+
+int mesh_simplify_lonlat(int size, const double (*verts)[2], bool loop,
+                         double tolerance, bool *keep)
+{
+    int i, a, b, far, nb = 0, stack_size = 0;
+    int (*stack)[2];
+    double (*pos)[3];
+    double d, dmax;
+
+    if (size <= 2) {
+        for (i = 0; i < size; i++) keep[i] = true;
+        return size;
+    }
+    pos = malloc(size * sizeof(*pos));
+    stack = malloc(size * sizeof(*stack));
+    for (i = 0; i < size; i++) {
+        lonlat2c(verts[i], pos[i]);
+        keep[i] = false;
+    }
+    keep[0] = true;
+    keep[size - 1] = true;
+
+    // For a closed ring, anchor the first point and the point the
+    // farthest from it, and simplify the two halves.
+    far = size - 1;
+    if (loop) {
+        dmax = -1;
+        for (i = 1; i < size; i++) {
+            d = vec3_dot(pos[0], pos[i]);
+            if (-d > dmax) {
+                dmax = -d;
+                far = i;
+            }
+        }
+        keep[far] = true;
+        stack[stack_size][0] = far;
+        stack[stack_size++][1] = size - 1;
+    }
+    stack[stack_size][0] = 0;
+    stack[stack_size++][1] = far;
+
+    while (stack_size) {
+        stack_size--;
+        a = stack[stack_size][0];
+        b = stack[stack_size][1];
+        far = -1;
+        dmax = tolerance;
+        for (i = a + 1; i < b; i++) {
+            d = point_arc_dist(pos[i], pos[a], pos[b]);
+            if (d > dmax) {
+                dmax = d;
+                far = i;
+            }
+        }
+        if (far == -1) continue;
+        keep[far] = true;
+        stack[stack_size][0] = a;
+        stack[stack_size++][1] = far;
+        stack[stack_size][0] = far;
+        stack[stack_size++][1] = b;
+    }
+
+    for (i = 0; i < size; i++) nb += keep[i] ? 1 : 0;
+    free(pos);
+    free(stack);
+    return nb;
+}
+
 static bool segment_intersects_2d_box(const double a[2], const double b[2],
                                       const double box[2][2])
 {
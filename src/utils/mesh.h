@@ -39,6 +39,8 @@ struct mesh {
 mesh_t *mesh_create(void);
 void mesh_delete(mesh_t *mesh);
 mesh_t *mesh_copy(const mesh_t *mesh);
+// Return the memory used by a mesh in bytes.
+int mesh_get_size(const mesh_t *mesh);
 
 void mesh_add_line_lonlat(mesh_t *mesh, int size, const double (*verts)[2],
                           bool loop);
@@ -77,6 +79,25 @@ void mesh_cut_antimeridian(mesh_t *mesh);
  */
 int mesh_subdivide(mesh_t *mesh, double max_length);
 
+/*
+ * Function: mesh_simplify_lonlat
+ * Douglas-Peucker simplification of a line or ring in lon/lat (deg).
+ *
+ * Parameters:
+ *   size      - Number of vertices.
+ *   verts     - The vertices.  For a closed ring the last vertex should
+ *               not repeat the first one.
+ *   loop      - Set to true for a closed ring.
+ *   tolerance - Max angular distance (rad) of the removed vertices to the
+ *               simplified line.
+ *   keep      - Output flag for each vertex, set to true for the vertices
+ *               that we keep.
+ *
+ * Return the number of vertices kept.
+ */
+int mesh_simplify_lonlat(int size, const double (*verts)[2], bool loop,
+                         double tolerance, bool *keep);
+
 bool mesh_intersects_2d_box(const mesh_t *mesh, const double box[2][2]);
 
 #endif // MESH_H
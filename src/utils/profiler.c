@@ -0,0 +1,91 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "profiler.h"
+#include "uthash.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_SAMPLES 64
+
+typedef struct prof_timer prof_timer_t;
+struct prof_timer {
+    UT_hash_handle  hh;
+    char            *id;
+    float           samples[NB_SAMPLES];
+    int             nb;     // Number of valid samples.
+    int             pos;    // Position of the next sample.
+};
+
+// Global hash table of all the timers, in insertion order.
+static prof_timer_t *g_timers = NULL;
+
+void profiler_add(const char *id, double dt)
+{
+    prof_timer_t *timer;
+    HASH_FIND_STR(g_timers, id, timer);
+    if (!timer) {
+        timer = calloc(1, sizeof(*timer));
+        timer->id = strdup(id);
+        HASH_ADD_KEYPTR(hh, g_timers, timer->id, strlen(timer->id), timer);
+    }
+    timer->samples[timer->pos] = dt;
+    timer->pos = (timer->pos + 1) % NB_SAMPLES;
+    if (timer->nb < NB_SAMPLES) timer->nb++;
+}
+
+static void timer_stats(const prof_timer_t *timer, double *avg, double *max)
+{
+    int i;
+    double sum = 0;
+    *max = 0;
+    for (i = 0; i < timer->nb; i++) {
+        sum += timer->samples[i];
+        *max = fmax(*max, timer->samples[i]);
+    }
+    *avg = sum / timer->nb;
+}
+
+int profiler_list(void *user, void (*callback)(void *user, const char *id,
+                                                double last, double avg,
+                                                double max))
+{
+    prof_timer_t *timer;
+    int n = 0;
+    double last, avg, max;
+
+    for (timer = g_timers; timer; timer = timer->hh.next, n++) {
+        timer_stats(timer, &avg, &max);
+        last = timer->samples[(timer->pos + NB_SAMPLES - 1) % NB_SAMPLES];
+        callback(user, timer->id, last, avg, max);
+    }
+    return n;
+}
+
+int profiler_get(const char *id, double *avg, double *max)
+{
+    prof_timer_t *timer;
+    double avg_, max_;
+    HASH_FIND_STR(g_timers, id, timer);
+    if (!timer) return 0;
+    timer_stats(timer, avg ?: &avg_, max ?: &max_);
+    return timer->nb;
+}
+
+void profiler_reset(void)
+{
+    prof_timer_t *timer, *tmp;
+    HASH_ITER(hh, g_timers, timer, tmp) {
+        HASH_DEL(g_timers, timer);
+        free(timer->id);
+        free(timer);
+    }
+}
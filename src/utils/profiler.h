@@ -0,0 +1,65 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/*
+ * File: profiler.h
+ * Simple frame profiler.
+ *
+ * We keep a global list of named timers, each with the durations of its
+ * last samples, so that we can show rolling statistics.  Usually one
+ * sample is added per frame for each timer.
+ */
+
+/*
+ * Function: profiler_add
+ * Add a duration sample to a timer.
+ *
+ * The timer is created the first time we use it.
+ *
+ * Parameters:
+ *   id - Unique id of the timer, e.g. "update/stars".
+ *   dt - Duration of the sample (sec).
+ */
+void profiler_add(const char *id, double dt);
+
+/*
+ * Function: profiler_list
+ * Iter all the timers.
+ *
+ * The callback gets the duration of the last sample, and the average and
+ * max durations over the last samples, all in seconds.
+ */
+int profiler_list(void *user, void (*callback)(void *user, const char *id,
+                                                double last, double avg,
+                                                double max));
+
+/*
+ * Function: profiler_get
+ * Get the average and max durations of a timer over the last samples.
+ *
+ * Parameters:
+ *   id  - Id of the timer.
+ *   avg - Output average duration (sec).  Can be NULL.
+ *   max - Output max duration (sec).  Can be NULL.
+ *
+ * Return:
+ *   The number of samples of the timer, zero if it doesn't exist.
+ */
+int profiler_get(const char *id, double *avg, double *max);
+
+/*
+ * Function: profiler_reset
+ * Remove all the timers.
+ */
+void profiler_reset(void);
+
+#endif // PROFILER_H
@@ -10,6 +10,8 @@
 #ifndef NO_LIBCURL
 
 #include "request.h"
+#include "trace.h"
+#include "uthash.h"
 #include "utstring.h"
 
 #include <assert.h>
@@ -29,13 +31,49 @@
 #   define PATH_MAX 1024
 #endif
 
-#define MAX_NB  16
+// Max number of running requests.  Requests to the same host share the
+// connections (multiplexed with HTTP/2 if possible), and curl queues the
+// ones above the per host limit.
+#define MAX_NB  64
+#define MAX_HOST_CONNECTIONS 6
+// Max number of finished requests we process per update.
+#define MAX_DONE_PER_UPDATE 4
+
+// Max total size of the cached files.  Above that we remove the least
+// recently used ones.
+#define CACHE_MAX_SIZE (1024 * 1024 * 1024)
+
+/*
+ * Type: cache_entry_t
+ * Cache info of a file saved in the cache directory.
+ *
+ * All the entries are stored in a single append only log file
+ * (<cache_dir>/index.log), one line per entry with the format:
+ *
+ *   url<TAB>etag<TAB>expiration<TAB>size
+ *
+ * The last line for a given url wins, and a size of -1 means that the file
+ * has been removed from the cache.  This way we can check the cache state
+ * without touching the files.
+ */
+typedef struct cache_entry {
+    UT_hash_handle  hh;
+    char            *url;
+    char            *etag;
+    double          expiration; // Unix time expiration date.
+    int             size;
+    double          last_used;  // Unix time, only used for the eviction.
+} cache_entry_t;
 
 // static data.
 static struct {
     CURLM        *curlm;
     char         *cache_dir;
     int          nb; // Number of current running handles.
+
+    cache_entry_t *cache;       // Hash of all the cache entries.
+    FILE         *cache_log;    // The index log, opened in append mode.
+    int64_t      cache_size;    // Total size of all the cached files.
 } g = {};
 
 struct request
@@ -127,47 +165,170 @@ static char *create_local_path(const char *url, const char *suffix)
     return ret;
 }
 
+static void cache_entry_delete(cache_entry_t *entry)
+{
+    HASH_DEL(g.cache, entry);
+    g.cache_size -= entry->size;
+    free(entry->url);
+    free(entry->etag);
+    free(entry);
+}
+
+static void cache_clear(void)
+{
+    cache_entry_t *entry, *tmp;
+    HASH_ITER(hh, g.cache, entry, tmp) {
+        cache_entry_delete(entry);
+    }
+    if (g.cache_log) fclose(g.cache_log);
+    g.cache_log = NULL;
+}
+
+static void cache_set(const char *url, const char *etag, double expiration,
+                      int size)
+{
+    cache_entry_t *entry;
+    HASH_FIND_STR(g.cache, url, entry);
+    if (entry) cache_entry_delete(entry);
+    if (size < 0) return;
+    entry = calloc(1, sizeof(*entry));
+    entry->url = strdup(url);
+    entry->etag = strdup(etag);
+    entry->expiration = expiration;
+    entry->size = size;
+    entry->last_used = get_unix_time();
+    HASH_ADD_KEYPTR(hh, g.cache, entry->url, strlen(entry->url), entry);
+    g.cache_size += size;
+}
+
+static void cache_log_write(FILE *file, const char *url, const char *etag,
+                            double expiration, int size)
+{
+    fprintf(file, "%s\t%s\t%.0f\t%d\n", url, etag, expiration, size);
+}
+
+/*
+ * Parse the index log into the cache hash table, and rewrite it if it
+ * contains too many outdated lines.
+ */
+static void cache_load(void)
+{
+    char *path, *tmp_path, *data, *line, *next, *fields[4];
+    int i, size, nb_lines = 0, r;
+    bool truncated;
+    cache_entry_t *entry, *tmp;
+    FILE *file;
+
+    cache_clear();
+    r = asprintf(&path, "%s/index.log", g.cache_dir);
+    if (r == -1) LOG_E("Error");
+    ensure_dir(path);
+    data = read_file(path, &size);
+    for (line = data; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (!next) break; // Incomplete last line.
+        *next++ = '\0';
+        nb_lines++;
+        // Split the tab separated fields in place.
+        fields[0] = line;
+        for (i = 1; i < 4; i++) {
+            fields[i] = strchr(fields[i - 1], '\t');
+            if (!fields[i]) break;
+            *fields[i]++ = '\0';
+        }
+        if (i < 4) continue; // Corrupted line.
+        cache_set(fields[0], fields[1], atof(fields[2]), atoi(fields[3]));
+    }
+    truncated = data && size && data[size - 1] != '\n';
+    free(data);
+
+    // Compact the log.
+    if (nb_lines > 2 * (int)HASH_COUNT(g.cache) + 256) {
+        r = asprintf(&tmp_path, "%s.tmp", path);
+        if (r == -1) LOG_E("Error");
+        file = fopen(tmp_path, "w");
+        if (file) {
+            HASH_ITER(hh, g.cache, entry, tmp) {
+                cache_log_write(file, entry->url, entry->etag,
+                                entry->expiration, entry->size);
+            }
+            fclose(file);
+            rename(tmp_path, path);
+        }
+        free(tmp_path);
+    }
+
+    g.cache_log = fopen(path, "a");
+    // Make sure we don't append to a partially written line.
+    if (g.cache_log && truncated) fputc('\n', g.cache_log);
+    free(path);
+}
+
+static int cache_entry_cmp(const cache_entry_t *a, const cache_entry_t *b)
+{
+    return (a->last_used > b->last_used) - (a->last_used < b->last_used);
+}
+
+/*
+ * Remove the least recently used files until the cache is below 90% of
+ * its max size.
+ */
+static void cache_evict(void)
+{
+    cache_entry_t *entry, *tmp;
+    char *path;
+
+    if (g.cache_size <= CACHE_MAX_SIZE) return;
+    HASH_SORT(g.cache, cache_entry_cmp);
+    HASH_ITER(hh, g.cache, entry, tmp) {
+        if (g.cache_size <= CACHE_MAX_SIZE / 10 * 9) break;
+        path = create_local_path(entry->url, NULL);
+        remove(path);
+        free(path);
+        if (g.cache_log)
+            cache_log_write(g.cache_log, entry->url, "", 0, -1);
+        cache_entry_delete(entry);
+    }
+    if (g.cache_log) fflush(g.cache_log);
+}
+
 void request_init(const char *cache_dir)
 {
     assert(cache_dir);
-    if (!g.curlm) g.curlm = curl_multi_init();
+    if (!g.curlm) {
+        g.curlm = curl_multi_init();
+        curl_multi_setopt(g.curlm, CURLMOPT_MAX_HOST_CONNECTIONS,
+                          (long)MAX_HOST_CONNECTIONS);
+#ifdef CURLPIPE_MULTIPLEX
+        curl_multi_setopt(g.curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+    }
     free(g.cache_dir);
     g.cache_dir = strdup(cache_dir);
+    cache_load();
 }
 
 request_t *request_create(const char *url)
 {
-    char *local_path, *info_path;
-    char etag[128];
-    double expiration;
-    FILE *file;
-    int r;
+    cache_entry_t *entry;
     request_t *req = calloc(1, sizeof(*req));
     req->url = strdup(url);
 
     assert(strchr(url, ':')); // Make sure we have a protocol.
 
-    // Check for cache info.
-    local_path = create_local_path(url, NULL);
-    info_path = create_local_path(url, ".info");
-    if (file_exists(local_path) && file_exists(info_path)) {
-        file = fopen(info_path, "r");
-        r = fscanf(file, "etag: %s\n", etag);
-        if (r == 1) req->etag = strdup(etag);
-        r = fscanf(file, "expiration: %lf\n", &expiration);
-        if (r == 1) req->expiration = expiration;
-        fclose(file);
-
+    // Check for cache info in the index, without touching the files.
+    HASH_FIND_STR(g.cache, url, entry);
+    if (entry) {
+        entry->last_used = get_unix_time();
+        req->etag = strdup(entry->etag);
+        req->expiration = entry->expiration;
         // If the cached version is not expired yet just use it.
-        if (req->expiration && req->expiration > get_unix_time()) {
-            req->local_path = strdup(local_path);
+        if (req->expiration && req->expiration > entry->last_used) {
+            req->local_path = create_local_path(url, NULL);
             req->status_code = 200;
             req->done = true;
         }
     }
-
-    free(local_path);
-    free(info_path);
     return req;
 }
 
@@ -190,19 +351,48 @@ void request_delete(request_t *req)
     free(req);
 }
 
-static void save_cache(const char *url, const char *path, const char *etag,
-                       double expiration)
+static void save_cache(const char *url, const char *etag, double expiration,
+                       int size)
 {
-    char *info_path;
-    FILE *file;
-    int r;
-    r = asprintf(&info_path, "%s.info", path);
-    if (r == -1) LOG_E("Error");
-    file = fopen(info_path, "w");
-    fprintf(file, "etag: %s\n", etag);
-    fprintf(file, "expiration: %.0f\n", expiration);
-    fclose(file);
-    free(info_path);
+    cache_set(url, etag, expiration, size);
+    if (g.cache_log) {
+        cache_log_write(g.cache_log, url, etag, expiration, size);
+        fflush(g.cache_log);
+    }
+    cache_evict();
+}
+
+/*
+ * Forget the cached file of a request, and fetch it again from the server.
+ * Used when the file of an index entry has been removed behind our back.
+ */
+static void request_refetch(request_t *req)
+{
+    cache_entry_t *entry;
+
+    LOG_W("Missing cached file for %s", req->url);
+    HASH_FIND_STR(g.cache, req->url, entry);
+    if (entry) {
+        if (g.cache_log) {
+            cache_log_write(g.cache_log, req->url, "", 0, -1);
+            fflush(g.cache_log);
+        }
+        cache_entry_delete(entry);
+    }
+    free(req->local_path);
+    req->local_path = NULL;
+    free(req->etag);
+    req->etag = NULL;
+    req->expiration = 0;
+    if (req->headers) curl_slist_free_all(req->headers);
+    req->headers = NULL;
+    // Start with new buffers, as the first request_create.
+    utstring_done(&req->data_buf);
+    utstring_done(&req->header_buf);
+    memset(&req->data_buf, 0, sizeof(req->data_buf));
+    memset(&req->header_buf, 0, sizeof(req->header_buf));
+    req->status_code = 0;
+    req->done = false;
 }
 
 static bool header_find(const char *header, const char *re,
@@ -231,14 +421,16 @@ static void on_done(request_t *req)
 {
     char buf[128] = {};
     const char *header;
-    const char *path;
 
     assert(!req->local_path);
 
     // The resource didn't change.
     if (req->status_code / 100 == 3) {
         req->local_path = create_local_path(req->url, NULL);
-        assert(file_exists(req->local_path));
+        if (!file_exists(req->local_path)) {
+            request_refetch(req);
+            return;
+        }
     }
 
     if (req->status_code / 100 != 2) goto end;
@@ -254,11 +446,9 @@ static void on_done(request_t *req)
         req->expiration = get_unix_time() + atof(buf);
     }
     // For the moment we save all the files in the cache as long as they
-    // have an etag.  We also never clean the cache!
-    if (req->etag) {
-        path = request_get_file(req, NULL);
-        save_cache(req->url, path, req->etag, req->expiration);
-    }
+    // have an etag.
+    if (req->etag && request_get_file(req, NULL))
+        save_cache(req->url, req->etag, req->expiration, req->size);
 
 end:
     return;
@@ -266,7 +456,7 @@ end:
 
 static void update(void)
 {
-    int nb, msgs_in_queue;
+    int nb, msgs_in_queue, nb_done = 0;
     CURLMsg *msg;
     CURL *handle;
     request_t *req;
@@ -288,6 +478,7 @@ static void update(void)
             if (!req->status_code && msg->data.result)
                 req->status_code = 598;
             g.nb--;
+            trace_counter("request", "active", g.nb);
             curl_multi_remove_handle(g.curlm, handle);
             curl_easy_cleanup(handle);
             req->handle = NULL;
@@ -301,7 +492,7 @@ static void update(void)
             }
             on_done(req);
             last = get_unix_time();
-            break;
+            if (++nb_done >= MAX_DONE_PER_UPDATE) break;
         }
     }
 }
@@ -334,6 +525,13 @@ static void req_update(request_t *req)
         curl_easy_setopt(req->handle, CURLOPT_FOLLOWLOCATION, 1);
         curl_easy_setopt(req->handle, CURLOPT_SSL_VERIFYPEER, 0);
         curl_easy_setopt(req->handle, CURLOPT_SSL_VERIFYHOST, 0);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+        // Prefer waiting for a connection to multiplex on, rather than
+        // opening a new one.
+        curl_easy_setopt(req->handle, CURLOPT_HTTP_VERSION,
+                         (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(req->handle, CURLOPT_PIPEWAIT, 1L);
+#endif
         // curl_easy_setopt(req->handle, CURLOPT_VERBOSE, 1);
         if (req->etag) {
             r = asprintf(&tmp, "If-None-Match: \"%s\"", req->etag);
@@ -346,6 +544,7 @@ static void req_update(request_t *req)
 
         curl_multi_add_handle(g.curlm, req->handle);
         g.nb++;
+        trace_counter("request", "active", g.nb);
     }
 
     update();
@@ -380,6 +579,10 @@ const void *request_get_data(request_t *req, int *size, int *status_code)
     // Local file, copy it into the data buffer.
     if (!req->data && req->local_path) {
         req->data = read_file(req->local_path, &req->size);
+        if (!req->data) {
+            request_refetch(req);
+            return request_get_data(req, size, status_code);
+        }
     }
     if (size) *size = req->size;
     return req->data;
@@ -391,6 +594,15 @@ void request_make_fresh(request_t *req)
     req->etag = NULL;
 }
 
+const char *request_get_etag(const request_t *req)
+{
+    return req->etag;
+}
+
+void request_set_priority(request_t *req, int priority)
+{
+}
+
 #else // NO_LIBCURL
 
 #ifdef REQUEST_DUMMY
@@ -420,6 +632,10 @@ void request_delete(request_t *req)
 {
     free(req);
 }
+
+void request_set_priority(request_t *req, int priority)
+{
+}
 const void *request_get_data(request_t *req, int *size, int *status_code)
 {
     *size = 0;
@@ -17,3 +17,19 @@ void request_delete(request_t *req);
 const void *request_get_data(request_t *req, int *size, int *status_code);
 // Don't use cache even if we have a local copy.
 void request_make_fresh(request_t *req);
+
+// Return the ETag of the returned data, or NULL if not known.  The js
+// backend leaves the http cache to the browser, so it always returns NULL.
+const char *request_get_etag(const request_t *req);
+
+// Priority hints for request_set_priority.
+enum {
+    REQUEST_PRIORITY_LOW    = -1,
+    REQUEST_PRIORITY_AUTO   = 0,
+    REQUEST_PRIORITY_HIGH   = 1,
+};
+
+// Hint of the network priority of a request, compared to the other running
+// ones.  Only used by the js backend (fetch priority), and only before the
+// request is started.
+void request_set_priority(request_t *req, int priority);
@@ -16,16 +16,39 @@
 struct request
 {
     char        *url;
-    int         handle;
+    int         handle;         // Id of the running fetch, or 0.
+    int         priority;
     int         status_code;
     bool        done;
     void        *data;
     int         size;
+    int         cache_id;       // Id of the running cache lookup, or 0.
+    bool        cache_checked;  // Set once we looked into the cache.
+    bool        revalidate;     // Background update of a cached file.
 };
 
 
 static struct {
     int nb;     // Number of current running requests.
+    int last_id;
+
+    // Network functions, set by the js code (see src/js/request.js).  The
+    // fetches are asynchronous: the result is passed to
+    // request_on_fetch_done.
+    struct {
+        void (*start)(const char *url, int id, request_t *req,
+                      int priority);
+        void (*abort)(int id);
+    } fetch;
+
+    // Persistent cache functions, set by the js code (see
+    // src/js/tiles-cache.js).  The lookups are asynchronous: the result
+    // is passed to request_on_cache_result.
+    struct {
+        void (*get)(const char *url, int id, request_t *req);
+        void (*put)(const char *url, const void *data, int size);
+        void (*cancel)(int id);
+    } cache;
 } g = {};
 
 static bool url_has_extension(const char *str, const char *ext);
@@ -56,7 +79,11 @@ void request_delete(request_t *req)
 {
     if (!req) return;
     if (req->handle) {
-        emscripten_async_wget2_abort(req->handle - 1);
+        g.fetch.abort(req->handle);
+        g.nb--;
+    }
+    if (req->cache_id) {
+        g.cache.cancel(req->cache_id);
         g.nb--;
     }
     free(req->url);
@@ -87,53 +114,129 @@ static bool could_be_str(const request_t *req)
            !url_has_extension(req->url, ".eph");
 }
 
-static void onload(unsigned int _, void *arg, void *data, unsigned int size)
+static bool is_versioned(const request_t *req)
 {
-    char *tmp;
-    request_t *req = arg;
-    req->handle = 0;
-    req->status_code = 200; // XXX: get proper code.
-
-    // Even is the content type is not text, we still add a zero padding
-    // if we suspect the data is going to be interpreted as text.
-    if (could_be_str(req) && ((char*)data)[size] != 0) {
-        tmp = data;
-        data = calloc(1, size + 1);
-        memcpy(data, tmp, size);
-        free(tmp);
-    }
+    return strstr(req->url, "?v=") || strstr(req->url, "&v=");
+}
+
+static bool is_hips_properties(const request_t *req)
+{
+    return url_has_extension(req->url, "/properties");
+}
+
+/*
+ * The tiles and eph files with a HiPS release date version (as added by
+ * hips.c) go in the persistent cache, since we know they never change.
+ *
+ * We also keep the HiPS properties files, so that at startup we can
+ * parse them and start to load the tiles right away.  The ones without a
+ * version are updated in the background for the next time (see
+ * request_on_cache_result).
+ */
+static bool use_persistent_cache(const request_t *req)
+{
+    if (!g.cache.get) return false;
+    if (is_hips_properties(req)) return true;
+    return !could_be_str(req) && is_versioned(req);
+}
+
+static void start_fetch(request_t *req)
+{
+    req->handle = ++g.last_id;
+    g.nb++;
+    trace_counter("request", "active", g.nb);
+    g.fetch.start(req->url, req->handle, req, req->priority);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void request_set_persistent_cache(
+        void (*get)(const char *url, int id, request_t *req),
+        void (*put)(const char *url, const void *data, int size),
+        void (*cancel)(int id))
+{
+    g.cache.get = get;
+    g.cache.put = put;
+    g.cache.cancel = cancel;
+}
 
+// Called by the js code with the result of a cache lookup.  The data,
+// allocated with malloc, is NULL if the url was not in the cache.
+EMSCRIPTEN_KEEPALIVE
+void request_on_cache_result(request_t *req, void *data, int size)
+{
+    request_t *update;
+    req->cache_id = 0;
+    g.nb--;
+    trace_counter("request", "active", g.nb);
+    if (!data) return; // We will do the real request next time.
     req->data = data;
     req->size = size;
+    req->status_code = 200;
     req->done = true;
-    g.nb--;
+
+    // The properties file might have changed since we cached it.
+    if (is_hips_properties(req) && !is_versioned(req)) {
+        update = request_create(req->url);
+        update->revalidate = true;
+        update->priority = REQUEST_PRIORITY_LOW;
+        start_fetch(update);
+    }
 }
 
-static void onerror(unsigned int _, void *arg, int err, const char *msg)
+EMSCRIPTEN_KEEPALIVE
+void request_set_fetch_functions(
+        void (*start)(const char *url, int id, request_t *req, int priority),
+        void (*abort)(int id))
+{
+    g.fetch.start = start;
+    g.fetch.abort = abort;
+}
+
+/*
+ * Called by the js code once a fetch is finished.  The data, allocated
+ * with malloc, always has a zero padding after the given size, in case it
+ * is going to be interpreted as text.  In case of error the data is NULL.
+ */
+EMSCRIPTEN_KEEPALIVE
+void request_on_fetch_done(request_t *req, void *data, int size, int code)
 {
-    request_t *req = arg;
-    // LOG_D("onerror %s %d %s", req->url, err, msg);
     req->handle = 0;
+    if (req->revalidate) {
+        g.nb--;
+        trace_counter("request", "active", g.nb);
+        if (data && code / 100 == 2) g.cache.put(req->url, data, size);
+        free(data);
+        request_delete(req);
+        return;
+    }
     // Use a default error code if we didn't get one...
-    req->status_code = err ?: 499;
+    req->status_code = code ?: 499;
+    req->data = data;
+    req->size = data ? size : 0;
     req->done = true;
     g.nb--;
+    trace_counter("request", "active", g.nb);
+    if (data && code / 100 == 2 && use_persistent_cache(req))
+        g.cache.put(req->url, data, size);
 }
 
-static void onprogress(unsigned int _, void *arg, int nb_bytes, int size)
+void request_set_priority(request_t *req, int priority)
 {
+    req->priority = priority;
 }
 
 const void *request_get_data(request_t *req, int *size, int *status_code)
 {
-    int handle;
-    if (!req->done && !req->handle && g.nb < MAX_NB) {
-        handle = emscripten_async_wget2_data(
-                req->url, "GET", NULL, req, false,
-                onload, onerror, onprogress);
-        req->handle = handle + 1; // So that we cannot get 0.
+    if (!req->done && !req->handle && !req->cache_id && g.nb < MAX_NB &&
+            !req->cache_checked && use_persistent_cache(req)) {
+        req->cache_checked = true;
+        req->cache_id = ++g.last_id;
         g.nb++;
+        trace_counter("request", "active", g.nb);
+        g.cache.get(req->url, req->cache_id, req);
     }
+    if (!req->done && !req->handle && !req->cache_id && g.nb < MAX_NB)
+        start_fetch(req);
     if (size) *size = req->size;
     if (status_code) *status_code= req->status_code;
     return req->data;
@@ -143,4 +246,9 @@ void request_make_fresh(request_t *req)
 {
 }
 
+const char *request_get_etag(const request_t *req)
+{
+    return NULL;
+}
+
 #endif
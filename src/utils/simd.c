@@ -0,0 +1,102 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "simd.h"
+#include "vec.h"
+
+#include <stddef.h>
+
+typedef struct {
+    const char *name;
+    void (*mat3_mul_vec3_n)(const double mat[3][3], int n,
+                            const double (*v)[3], double (*out)[3]);
+    void (*mat4_mul_vec4_n)(const double mat[4][4], int n,
+                            const double (*v)[4], double (*out)[4]);
+} kernels_t;
+
+/*
+ * Define the kernels for a given target.  The vec.h inline functions
+ * get compiled with the instructions of the calling function target.
+ */
+#define DEFINE_KERNELS(suffix, name_, attrs) \
+    attrs static void mat3_mul_vec3_n_##suffix( \
+            const double mat[3][3], int n, \
+            const double (*v)[3], double (*out)[3]) \
+    { \
+        mat3_mul_vec3_n(mat, n, v, out); \
+    } \
+    attrs static void mat4_mul_vec4_n_##suffix( \
+            const double mat[4][4], int n, \
+            const double (*v)[4], double (*out)[4]) \
+    { \
+        mat4_mul_vec4_n(mat, n, v, out); \
+    } \
+    static const kernels_t KERNELS_##suffix = { \
+        .name = name_, \
+        .mat3_mul_vec3_n = mat3_mul_vec3_n_##suffix, \
+        .mat4_mul_vec4_n = mat4_mul_vec4_n_##suffix, \
+    };
+
+#if defined(__wasm_simd128__)
+#   define DEFAULT_NAME "wasm-simd128"
+#elif defined(__ARM_NEON)
+#   define DEFAULT_NAME "neon"
+#elif defined(__AVX2__)
+#   define DEFAULT_NAME "avx2"
+#elif defined(__SSE4_1__)
+#   define DEFAULT_NAME "sse4.1"
+#elif defined(__SSE2__)
+#   define DEFAULT_NAME "sse2"
+#else
+#   define DEFAULT_NAME "scalar"
+#endif
+
+DEFINE_KERNELS(default, DEFAULT_NAME, )
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(__EMSCRIPTEN__)
+#   define HAS_X86_DISPATCH 1
+DEFINE_KERNELS(avx2, "avx2", __attribute__((target("avx2,fma"))))
+DEFINE_KERNELS(sse41, "sse4.1", __attribute__((target("sse4.1"))))
+#endif
+
+static const kernels_t *g_kernels = NULL;
+
+void simd_init(void)
+{
+    if (g_kernels) return;
+    g_kernels = &KERNELS_default;
+#ifdef HAS_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        g_kernels = &KERNELS_avx2;
+    else if (__builtin_cpu_supports("sse4.1"))
+        g_kernels = &KERNELS_sse41;
+#endif
+}
+
+const char *simd_get_name(void)
+{
+    simd_init();
+    return g_kernels->name;
+}
+
+void simd_mat3_mul_vec3_n(const double mat[3][3], int n,
+                          const double (*v)[3], double (*out)[3])
+{
+    simd_init();
+    g_kernels->mat3_mul_vec3_n(mat, n, v, out);
+}
+
+void simd_mat4_mul_vec4_n(const double mat[4][4], int n,
+                          const double (*v)[4], double (*out)[4])
+{
+    simd_init();
+    g_kernels->mat4_mul_vec4_n(mat, n, v, out);
+}
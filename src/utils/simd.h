@@ -0,0 +1,55 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+/*
+ * File: simd.h
+ * Dispatch of the SIMD kernels.
+ *
+ * On the native x86 builds we compile the kernels for several instruction
+ * sets and pick the best one supported by the cpu the first time we use
+ * them (or in simd_init).  On the other targets the instruction set is
+ * known at compile time: NEON on arm64, and wasm SIMD for the js build
+ * made with 'simd=1', the default js build being the scalar fallback for
+ * the browsers without wasm SIMD support.
+ */
+
+/*
+ * Function: simd_init
+ * Select the kernels for the current cpu.
+ *
+ * Called at startup by core_init.
+ */
+void simd_init(void);
+
+/*
+ * Function: simd_get_name
+ * Return the name of the selected instruction set.
+ *
+ * One of "avx2", "sse4.1", "sse2", "neon", "wasm-simd128" or "scalar".
+ */
+const char *simd_get_name(void);
+
+/*
+ * Function: simd_mat3_mul_vec3_n
+ * Dispatched version of <mat3_mul_vec3_n>.
+ */
+void simd_mat3_mul_vec3_n(const double mat[3][3], int n,
+                          const double (*v)[3], double (*out)[3]);
+
+/*
+ * Function: simd_mat4_mul_vec4_n
+ * Dispatched version of <mat4_mul_vec4_n>.
+ */
+void simd_mat4_mul_vec4_n(const double mat[4][4], int n,
+                          const double (*v)[4], double (*out)[4]);
+
+#endif // SIMD_H
@@ -8,6 +8,7 @@
  */
 
 #include "utils.h"
+#include "img_pool.h"
 #include "utstring.h"
 
 #include <assert.h>
@@ -31,6 +32,18 @@
 #define STBI_NO_GIF
 #define STBI_ONLY_JPEG
 #define STBI_ONLY_PNG
+// So that the decoded images come from the pool.
+#define STBI_MALLOC(sz) img_pool_alloc(sz)
+#define STBI_REALLOC(p, sz) realloc(p, sz)
+#define STBI_FREE(p) free(p)
+// stb only enables its SSE2 jpeg decoder on x86, but emscripten also
+// provides the SSE2 intrinsics on top of wasm SIMD.
+#if defined(__EMSCRIPTEN__) && defined(__SSE2__)
+#   define STBI__X64_TARGET
+#endif
+#if defined(__ARM_NEON)
+#   define STBI_NEON
+#endif
 #include "stb_image.h"
 #include "stb_image_write.h"
 
@@ -80,10 +93,17 @@ uint8_t *img_read(const char *path, int *w, int *h, int *bpp)
 uint8_t *img_read_from_mem(const void *data, int size,
                            int *w, int *h, int *bpp)
 {
+    uint8_t *img;
+
     // Check for webp image first since stb doesn't support it.
-    if (WebPGetInfo(data, size, NULL, NULL)) {
+    if (WebPGetInfo(data, size, w, h)) {
         *bpp = 4;
-        return WebPDecodeRGBA(data, size, w, h);
+        img = img_pool_alloc(*w * *h * 4);
+        if (!WebPDecodeRGBAInto(data, size, img, *w * *h * 4, *w * 4)) {
+            free(img);
+            return NULL;
+        }
+        return img;
     }
     return stbi_load_from_memory(data, size, w, h, bpp, *bpp);
 }
@@ -93,6 +113,12 @@ void img_write(const uint8_t *img, int w, int h, int bpp, const char *path)
     stbi_write_png(path, w, h, bpp, img, 0);
 }
 
+uint8_t *img_write_to_mem(const uint8_t *img, int w, int h, int bpp,
+                          int *size)
+{
+    return stbi_write_png_to_mem(img, 0, w, h, bpp, size);
+}
+
 int z_uncompress(void *dest, int dest_size, const void *src, int src_size)
 {
     stbi_zlib_decode_buffer(dest, dest_size, src, src_size);
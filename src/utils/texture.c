@@ -9,18 +9,143 @@
 
 #include "texture.h"
 #include "gl.h"
+#include "img_pool.h"
+#include "utlist.h"
+#include "worker.h"
 
 #include <assert.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
+// GPU compressed formats, in case the GL headers don't define them.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#   define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#   define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#   define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#   define GL_COMPRESSED_RGBA_BPTC_UNORM    0x8E8C
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#   define GL_COMPRESSED_RGB8_ETC2          0x9274
+#   define GL_COMPRESSED_RGBA8_ETC2_EAC     0x9278
+#endif
+#ifndef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+#   define GL_COMPRESSED_RGBA_ASTC_4x4_KHR  0x93B0
+#endif
+
+/*
+ * Supported KTX2 compressed formats.
+ *
+ * Attributes:
+ *   vk_format  - Vulkan format id used in the KTX2 header.
+ *   gl_format  - OpenGL internal format.
+ *   base       - OpenGL base format (GL_RGB or GL_RGBA).
+ *   block_size - Size in bytes of a 4x4 pixels block.
+ *   ext        - Space separated names of the GL extensions that support
+ *                the format, any of them is enough.  Emscripten reports
+ *                the WebGL extensions both with and without a GL_ prefix.
+ */
+#define EXTS_S3TC "WEBGL_compressed_texture_s3tc " \
+                  "GL_WEBGL_compressed_texture_s3tc " \
+                  "GL_EXT_texture_compression_s3tc"
+#define EXTS_BPTC "EXT_texture_compression_bptc " \
+                  "GL_EXT_texture_compression_bptc " \
+                  "GL_ARB_texture_compression_bptc"
+// Note: WEBGL_compressed_texture_etc1 only supports ETC1.
+#define EXTS_ETC2 "WEBGL_compressed_texture_etc " \
+                  "GL_WEBGL_compressed_texture_etc " \
+                  "GL_ARB_ES3_compatibility"
+#define EXTS_ASTC "WEBGL_compressed_texture_astc " \
+                  "GL_WEBGL_compressed_texture_astc " \
+                  "GL_KHR_texture_compression_astc_ldr"
+
+static const struct {
+    int         vk_format;
+    int         gl_format;
+    int         base;
+    int         block_size;
+    const char  *ext;
+} COMPRESSED_FORMATS[] = {
+    {131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,  GL_RGB,  8,  EXTS_S3TC},
+    {133, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, GL_RGBA, 8,  EXTS_S3TC},
+    {137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_RGBA, 16, EXTS_S3TC},
+    {145, GL_COMPRESSED_RGBA_BPTC_UNORM,    GL_RGBA, 16, EXTS_BPTC},
+    {147, GL_COMPRESSED_RGB8_ETC2,          GL_RGB,  8,  EXTS_ETC2},
+    {151, GL_COMPRESSED_RGBA8_ETC2_EAC,     GL_RGBA, 16, EXTS_ETC2},
+    {157, GL_COMPRESSED_RGBA_ASTC_4x4_KHR,  GL_RGBA, 16, EXTS_ASTC},
+};
+
 static struct {
     void *user;
     uint8_t *(*load)(void *user, const char *url, int *code,
                      int *w, int *h, int *bpp);
 } g_callback = {};
 
+// Global GPU memory stats.
+static struct {
+    int64_t size;
+    int     nb;
+} g_stats = {};
+
+// Max number of bytes uploaded per frame with texture_upload_take.
+#define UPLOAD_BUDGET (4 * 1024 * 1024)
+
+// Bytes uploaded in the current frame.
+static int g_upload_size = 0;
+
+// List of all the textures, so that we can forget their GL objects after a
+// context loss.
+static texture_t *g_textures = NULL;
+
+// Set to never call any OpenGL function.
+static struct {
+    bool    enabled;
+    GLuint  last_id; // Fake texture ids.
+} g_headless = {};
+
+static void set_size(texture_t *tex, int size)
+{
+    g_stats.size += size - tex->size;
+    tex->size = size;
+}
+
+static void gen_texture(texture_t *tex)
+{
+    if (g_headless.enabled)
+        tex->id = ++g_headless.last_id;
+    else
+        GL(glGenTextures(1, &tex->id));
+    g_stats.nb++;
+}
+
+static texture_t *texture_new(int flags)
+{
+    texture_t *tex = calloc(1, sizeof(*tex));
+    tex->ref = 1;
+    tex->flags = flags;
+    DL_APPEND(g_textures, tex);
+    return tex;
+}
+
+void texture_set_headless(bool headless)
+{
+    g_headless.enabled = headless;
+}
+
+bool texture_upload_take(int size)
+{
+    if (g_upload_size && g_upload_size + size > UPLOAD_BUDGET) return false;
+    g_upload_size += size;
+    return true;
+}
+
+void texture_upload_new_frame(void)
+{
+    g_upload_size = 0;
+}
+
 static inline bool is_pow2(int n) {return (n & (n - 1)) == 0;}
 static inline int next_pow2(int x) {return pow(2, ceil(log(x) / log(2)));}
 
@@ -50,7 +175,8 @@ void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp)
 {
     uint8_t *buff0 = NULL;
     int data_type = GL_UNSIGNED_BYTE;
-    assert(tex->id);
+    // The texture can have lost its GL object with the context.
+    if (!tex->id) gen_texture(tex);
 
     tex->w = w;
     tex->h = h;
@@ -61,8 +187,10 @@ void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp)
     }[bpp];
     assert(tex->format);
 
+    if (g_headless.enabled) goto end;
     if (!is_pow2(w) || !is_pow2(h)) {
-        buff0 = calloc(bpp, tex->tex_w * tex->tex_h);
+        buff0 = img_pool_alloc(bpp * tex->tex_w * tex->tex_h);
+        memset(buff0, 0, bpp * tex->tex_w * tex->tex_h);
         blit(data, w, h, bpp, buff0, tex->tex_w, tex->tex_h, 0, 0, w, h);
         data = buff0;
     }
@@ -75,36 +203,60 @@ void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp)
     GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
     GL(glTexImage2D(GL_TEXTURE_2D, 0, tex->format, tex->tex_w, tex->tex_h,
                 0, tex->format, data_type, data));
-    free(buff0);
+    img_pool_release(buff0, bpp * tex->tex_w * tex->tex_h);
 
     if (tex->flags & TF_MIPMAP)
         GL(glGenerateMipmap(GL_TEXTURE_2D));
+end:
+    // The mipmaps take an extra third of the memory.
+    set_size(tex, tex->tex_w * tex->tex_h * bpp *
+                  ((tex->flags & TF_MIPMAP) ? 4 : 3) / 3);
 }
 
 texture_t *texture_create(int w, int h, int bpp)
 {
     texture_t *tex;
-    tex = calloc(1, sizeof(*tex));
-    tex->ref = 1;
+    tex = texture_new(0);
     tex->tex_w = next_pow2(w);
     tex->tex_h = next_pow2(h);
     tex->w = w;
     tex->h = h;
     tex->format = (int[]){0, 0, 0, GL_RGB, GL_RGBA}[bpp];
-    GL(glGenTextures(1, &tex->id));
+    gen_texture(tex);
     return tex;
 }
 
-void texture_release(texture_t *tex)
+texture_t *texture_retain(texture_t *tex)
 {
-    if (!tex) return;
-    tex->ref--;
-    if (tex->ref) return;
+    if (tex) __atomic_add_fetch(&tex->ref, 1, __ATOMIC_RELAXED);
+    return tex;
+}
+
+static void texture_delete(void *user)
+{
+    texture_t *tex = user;
+    DL_DELETE(g_textures, tex);
     free(tex->url);
-    if (tex->id) GL(glDeleteTextures(1, &tex->id));
+    free(tex->data);
+    if (tex->id) {
+        if (!g_headless.enabled) GL(glDeleteTextures(1, &tex->id));
+        g_stats.nb--;
+    }
+    set_size(tex, 0);
     free(tex);
 }
 
+void texture_release(texture_t *tex)
+{
+    if (!tex) return;
+    if (__atomic_sub_fetch(&tex->ref, 1, __ATOMIC_ACQ_REL)) return;
+    if (!worker_is_main_thread()) {
+        worker_defer_to_main(texture_delete, tex);
+        return;
+    }
+    texture_delete(tex);
+}
+
 texture_t *texture_from_data(const void *data, int img_w, int img_h, int bpp,
                              int x, int y, int w, int h, int flags)
 {
@@ -112,16 +264,19 @@ texture_t *texture_from_data(const void *data, int img_w, int img_h, int bpp,
     uint8_t *img;
 
     assert(x >= 0 && x + w <= img_w && y >= 0 && y + h <= img_h);
-    tex = calloc(1, sizeof(*tex));
-    tex->ref = 1;
-    tex->flags = flags;
-    GL(glGenTextures(1, &tex->id));
+    tex = texture_new(flags);
+    gen_texture(tex);
 
-    if (x != 0 || y != 0 || w != img_w || h != img_h) {
-        img = calloc(w * h, bpp);
+    if (flags & TF_KEEP_DATA) {
+        tex->data = malloc(w * h * bpp);
+        tex->bpp = bpp;
+        blit(data, img_w, img_h, bpp, tex->data, w, h, x, y, w, h);
+        texture_set_data(tex, tex->data, w, h, bpp);
+    } else if (x != 0 || y != 0 || w != img_w || h != img_h) {
+        img = img_pool_alloc(w * h * bpp);
         blit(data, img_w, img_h, bpp, img, w, h, x, y, w, h);
         texture_set_data(tex, img, w, h, bpp);
-        free(img);
+        img_pool_release(img, w * h * bpp);
     } else {
         texture_set_data(tex, data, w, h, bpp);
     }
@@ -132,10 +287,8 @@ texture_t *texture_from_data(const void *data, int img_w, int img_h, int bpp,
 texture_t *texture_from_url(const char *url, int flags)
 {
     texture_t *tex;
-    tex = calloc(1, sizeof(*tex));
-    tex->ref = 1;
+    tex = texture_new(flags);
     tex->url = strdup(url);
-    tex->flags = flags;
     if (!(flags & TF_LAZY_LOAD)) texture_load(tex, NULL);
     return tex;
 }
@@ -145,12 +298,186 @@ bool texture_load(texture_t *tex, int *code)
     int w, h, bpp = 0;
     void *img;
     if (tex->id) return true;
-    assert(tex->url);
+    // Restore a texture lost with the GL context from our copy.
+    if (tex->data) {
+        texture_set_data(tex, tex->data, tex->w, tex->h, tex->bpp);
+        return true;
+    }
+    if (!tex->url) return false;
     assert(g_callback.load);
     img = g_callback.load(g_callback.user, tex->url, code, &w, &h, &bpp);
     if (!img) return false;
-    GL(glGenTextures(1, &tex->id));
+    gen_texture(tex);
     texture_set_data(tex, img, w, h, bpp);
     free(img);
     return true;
 }
+
+// Test if a space separated list contains a given name.
+static bool list_has_name(const char *list, const char *name, int len)
+{
+    const char *tok;
+    int tok_len;
+    for (tok = list; *tok; tok += tok_len) {
+        tok += strspn(tok, " ");
+        tok_len = strcspn(tok, " ");
+        if (tok_len == len && strncmp(tok, name, len) == 0) return true;
+    }
+    return false;
+}
+
+// Test if a space separated list contains any of the space separated names.
+static bool list_has_any(const char *list, const char *names)
+{
+    const char *name;
+    int len;
+    for (name = names; *name; name += len) {
+        name += strspn(name, " ");
+        len = strcspn(name, " ");
+        if (len && list_has_name(list, name, len)) return true;
+    }
+    return false;
+}
+
+// Test if the GL context has any of the space separated extensions.
+static bool has_extension(const char *names)
+{
+    const char *exts;
+    if (g_headless.enabled) return false;
+    exts = (const char*)glGetString(GL_EXTENSIONS);
+    if (!exts) return false;
+    return list_has_any(exts, names);
+}
+
+bool texture_has_compression_support(void)
+{
+    int i;
+    for (i = 0; i < (int)(sizeof(COMPRESSED_FORMATS) /
+                          sizeof(COMPRESSED_FORMATS[0])); i++) {
+        if (has_extension(COMPRESSED_FORMATS[i].ext)) return true;
+    }
+    return false;
+}
+
+texture_t *texture_from_ktx2(const void *data, int size, int flags)
+{
+    const uint8_t *d = data;
+    const uint8_t MAGIC[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB,
+                               '\r', '\n', 0x1A, '\n'};
+    uint32_t header[9]; // vkFormat to supercompressionScheme.
+    uint64_t level[3];  // byteOffset, byteLength, uncompressedByteLength.
+    int i, w, h, nb_levels, full_levels, level_w, level_h;
+    texture_t *tex;
+    const char *ext = NULL;
+    int gl_format = 0, base = 0, block_size = 0;
+
+    // Header, followed by the index (80 bytes) and the levels index.
+    if (size < 80 || memcmp(d, MAGIC, 12) != 0) return NULL;
+    memcpy(header, d + 12, sizeof(header));
+    for (i = 0; i < (int)(sizeof(COMPRESSED_FORMATS) /
+                          sizeof(COMPRESSED_FORMATS[0])); i++) {
+        if (COMPRESSED_FORMATS[i].vk_format != (int)header[0]) continue;
+        gl_format = COMPRESSED_FORMATS[i].gl_format;
+        base = COMPRESSED_FORMATS[i].base;
+        block_size = COMPRESSED_FORMATS[i].block_size;
+        ext = COMPRESSED_FORMATS[i].ext;
+    }
+    w = header[2];
+    h = header[3];
+    if (w <= 0 || h <= 0) return NULL;
+    nb_levels = header[7] ?: 1;
+    full_levels = 1 + (int)log2(w > h ? w : h);
+    // Only support simple 2d textures, with no supercompression.
+    if (!gl_format || header[4] > 1 || header[5] > 1 || header[6] != 1 ||
+            header[8] != 0 || !is_pow2(w) || !is_pow2(h))
+        return NULL;
+    if (!has_extension(ext)) return NULL;
+    if (nb_levels > full_levels || 80 + nb_levels * 24 > size) return NULL;
+
+    tex = texture_new(flags);
+    tex->w = tex->tex_w = w;
+    tex->h = tex->tex_h = h;
+    tex->format = base;
+    gen_texture(tex);
+    GL(glActiveTexture(GL_TEXTURE0));
+    GL(glBindTexture(GL_TEXTURE_2D, tex->id));
+    GL(glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    // We can only use the mipmaps if the file contains all the levels (we
+    // can't set GL_TEXTURE_MAX_LEVEL with GLES2).
+    GL(glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+            (nb_levels == full_levels) ? GL_LINEAR_MIPMAP_NEAREST :
+                                         GL_LINEAR));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+
+    for (i = 0; i < nb_levels; i++) {
+        memcpy(level, d + 80 + i * 24, sizeof(level));
+        level_w = w >> i ?: 1;
+        level_h = h >> i ?: 1;
+        if (level[0] + level[1] > (uint64_t)size ||
+                level[1] < (uint64_t)(((level_w + 3) / 4) *
+                                      ((level_h + 3) / 4) * block_size)) {
+            texture_release(tex);
+            return NULL;
+        }
+        GL(glCompressedTexImage2D(GL_TEXTURE_2D, i, gl_format,
+                                  level_w, level_h, 0, level[1],
+                                  d + level[0]));
+        set_size(tex, tex->size + level[1]);
+    }
+    return tex;
+}
+
+int64_t texture_get_total_size(int *nb)
+{
+    if (nb) *nb = g_stats.nb;
+    return g_stats.size;
+}
+
+void texture_on_context_lost(void)
+{
+    texture_t *tex;
+    DL_FOREACH(g_textures, tex) {
+        if (!tex->id) continue;
+        tex->id = 0;
+        g_stats.nb--;
+        set_size(tex, 0);
+    }
+}
+
+#if COMPILE_TESTS
+
+#include "tests.h"
+
+static bool has_name(const char *list, const char *name)
+{
+    return list_has_name(list, name, strlen(name));
+}
+
+static void test_extensions_list(void)
+{
+    const char *exts = "GL_OES_element_index_uint "
+                       "WEBGL_compressed_texture_etc1 "
+                       "GL_WEBGL_compressed_texture_etc1 "
+                       "WEBGL_compressed_texture_s3tc";
+    assert(!has_name(exts, "WEBGL_compressed_texture_etc"));
+    assert(has_name(exts, "WEBGL_compressed_texture_etc1"));
+    assert(has_name(exts, "WEBGL_compressed_texture_s3tc"));
+    assert(!has_name(exts, "GL_WEBGL_compressed_texture_s3tc"));
+    assert(has_name(exts, "GL_OES_element_index_uint"));
+
+    // Lists of names, as used by the formats table.
+    assert(list_has_any(exts, EXTS_S3TC));
+    assert(!list_has_any(exts, EXTS_ETC2));
+    assert(!list_has_any(exts, EXTS_BPTC));
+    exts = "GL_ARB_ES3_compatibility GL_ARB_texture_compression_bptc "
+           "GL_KHR_texture_compression_astc_ldr";
+    assert(list_has_any(exts, EXTS_ETC2));
+    assert(list_has_any(exts, EXTS_BPTC));
+    assert(list_has_any(exts, EXTS_ASTC));
+    assert(!list_has_any(exts, EXTS_S3TC));
+}
+
+TEST_REGISTER(NULL, test_extensions_list, TEST_AUTO);
+
+#endif
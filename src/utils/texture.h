@@ -12,7 +12,9 @@
 
 enum {
     TF_MIPMAP           = 1 << 0,
-    TF_LAZY_LOAD        = 1 << 1
+    TF_LAZY_LOAD        = 1 << 1,
+    // Keep a copy of the data, to restore the texture after a context loss.
+    TF_KEEP_DATA        = 1 << 2,
 };
 
 /*
@@ -35,6 +37,9 @@ enum {
  *   format - OpenGL format.
  *   flags  - Configuration bit flags
  *   url    - For async texture: url source of the image.
+ *   size   - Estimated GPU memory used by the texture, in bytes.
+ *   data   - CPU copy of the data, only with the TF_KEEP_DATA flag.
+ *   bpp    - Bytes per pixel of the data.
  */
 typedef struct texture {
     uint32_t        id;
@@ -43,6 +48,10 @@ typedef struct texture {
     int             format;
     int             flags;
     char            *url;
+    int             size;
+    void            *data;
+    int             bpp;
+    struct texture  *prev, *next; // List of all the textures.
 } texture_t;
 
 /*
@@ -67,6 +76,93 @@ texture_t *texture_create(int w, int h, int bpp);
 texture_t *texture_from_data(const void *data, int img_w, int img_h, int bpp,
                              int x, int y, int w, int h, int flags);
 texture_t *texture_from_url(const char *url, int flags);
+
+/*
+ * Function: texture_from_ktx2
+ * Create a texture from a KTX2 file with GPU compressed data.
+ *
+ * Only the BC1, BC3, BC7, ETC2 and ASTC 4x4 formats without
+ * supercompression are supported, and the driver must support the format.
+ * All the mipmap levels of the file are uploaded.
+ *
+ * Return:
+ *   The new texture, or NULL in case of error.
+ */
+texture_t *texture_from_ktx2(const void *data, int size, int flags);
+
+/*
+ * Function: texture_has_compression_support
+ * Return whether the driver supports any of the compressed formats
+ * accepted by <texture_from_ktx2>.
+ */
+bool texture_has_compression_support(void);
 bool texture_load(texture_t *tex, int *code);
 void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp);
+
+/*
+ * Function: texture_retain
+ * Increment the texture ref count, return the texture.
+ */
+texture_t *texture_retain(texture_t *tex);
+
+/*
+ * Function: texture_release
+ * Decrement the texture ref count and delete it if needed.
+ *
+ * The ref count is atomic.  If the last reference is released by a worker,
+ * the GL texture is deleted later on the main thread.
+ */
 void texture_release(texture_t *tex);
+
+/*
+ * Function: texture_get_total_size
+ * Return the estimated GPU memory used by all the textures, in bytes.
+ *
+ * Parameters:
+ *   nb - If not NULL, set to the number of textures.
+ */
+int64_t texture_get_total_size(int *nb);
+
+/*
+ * Function: texture_on_context_lost
+ * Forget the GL objects of all the textures, after the GL context was lost.
+ *
+ * The lost textures get an id of zero.  The textures created from an url
+ * or with the TF_KEEP_DATA flag are then restored by <texture_load>, and
+ * <texture_set_data> can upload new data into any of them.  The other
+ * ones have to be created again by their owner.
+ */
+void texture_on_context_lost(void);
+
+/*
+ * Function: texture_set_headless
+ * Set whether we should never call any OpenGL function.
+ *
+ * In headless mode the textures still get created and keep their size,
+ * but without any GPU data.  Used by the null renderer to run without any
+ * OpenGL context.
+ */
+void texture_set_headless(bool headless);
+
+/*
+ * Function: texture_upload_take
+ * Reserve some of the current frame upload budget.
+ *
+ * Used to spread the upload of many textures, like the survey tiles, over
+ * several frames.  The first request of a frame is always accepted, so
+ * that large textures still get uploaded eventually.
+ *
+ * Parameters:
+ *   size   - Number of bytes we want to upload.
+ *
+ * Return:
+ *   False if the budget of the frame is exhausted, then the upload should
+ *   be done in a later frame.
+ */
+bool texture_upload_take(int size);
+
+/*
+ * Function: texture_upload_new_frame
+ * Reset the upload budget.  Called by paint_finish at the end of each frame.
+ */
+void texture_upload_new_frame(void);
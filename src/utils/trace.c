@@ -0,0 +1,168 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "trace.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __EMSCRIPTEN__
+#   include <emscripten.h>
+#else
+#   define EMSCRIPTEN_KEEPALIVE
+#endif
+
+#define NB_EVENTS (1 << 15) // Must be a power of two.
+
+typedef struct {
+    const char  *cat;
+    const char  *name;
+    double      ts;     // Time in us.
+    double      value;  // For counters.
+    int         tid;
+    char        ph;     // Chrome event phase: 'B', 'E' or 'C'.
+} event_t;
+
+static struct {
+    event_t     *events;
+    uint32_t    pos;    // Total number of events added.
+    int         nb_threads;
+} g = {};
+
+#if SWE_TRACE
+
+static double get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Small unique id for each thread, since pthread_t is opaque.
+static int get_tid(void)
+{
+    static __thread int tid = 0;
+    if (!tid) tid = __atomic_add_fetch(&g.nb_threads, 1, __ATOMIC_RELAXED);
+    return tid;
+}
+
+static void add_event(char ph, const char *cat, const char *name,
+                      double value)
+{
+    event_t *e, *events;
+    uint32_t pos;
+
+    events = __atomic_load_n(&g.events, __ATOMIC_ACQUIRE);
+    if (!events) {
+        events = calloc(NB_EVENTS, sizeof(*events));
+        if (!__atomic_compare_exchange_n(&g.events, &(event_t*){NULL},
+                    events, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(events);
+            events = g.events;
+        }
+    }
+    pos = __atomic_fetch_add(&g.pos, 1, __ATOMIC_RELAXED);
+    e = &events[pos & (NB_EVENTS - 1)];
+    e->cat = cat;
+    e->name = name;
+    e->ts = get_time_us();
+    e->value = value;
+    e->tid = get_tid();
+    e->ph = ph;
+}
+
+void trace_begin(const char *cat, const char *name)
+{
+    add_event('B', cat, name, 0);
+}
+
+void trace_end(const char *cat, const char *name)
+{
+    add_event('E', cat, name, 0);
+}
+
+void trace_counter(const char *cat, const char *name, double value)
+{
+    add_event('C', cat, name, value);
+}
+
+#endif // SWE_TRACE
+
+typedef struct {
+    char    *data;
+    int     size;
+    int     allocated;
+} buf_t;
+
+static void buf_printf(buf_t *buf, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (buf->size + n + 1 > buf->allocated) {
+        buf->allocated = (buf->size + n + 1) * 2;
+        buf->data = realloc(buf->data, buf->allocated);
+    }
+    va_start(args, fmt);
+    vsnprintf(buf->data + buf->size, n + 1, fmt, args);
+    va_end(args);
+    buf->size += n;
+}
+
+EMSCRIPTEN_KEEPALIVE
+char *trace_dump_json(void)
+{
+    buf_t buf = {};
+    uint32_t i, start, end;
+    const event_t *e;
+    bool first = true;
+
+    buf_printf(&buf, "{\"traceEvents\": [");
+    end = __atomic_load_n(&g.pos, __ATOMIC_ACQUIRE);
+    start = end > NB_EVENTS ? end - NB_EVENTS : 0;
+    for (i = start; g.events && i < end; i++) {
+        e = &g.events[i & (NB_EVENTS - 1)];
+        if (!e->ph) continue; // Not written yet.
+        buf_printf(&buf, "%s\n{\"cat\": \"%s\", \"name\": \"%s\", "
+                   "\"ph\": \"%c\", \"ts\": %.1f, \"pid\": 1, \"tid\": %d",
+                   first ? "" : ",", e->cat, e->name, e->ph, e->ts,
+                   e->tid);
+        if (e->ph == 'C')
+            buf_printf(&buf, ", \"args\": {\"value\": %g}", e->value);
+        buf_printf(&buf, "}");
+        first = false;
+    }
+    buf_printf(&buf, "]}\n");
+    return buf.data;
+}
+
+int trace_dump(const char *path)
+{
+    FILE *file;
+    char *json;
+
+    file = fopen(path, "w");
+    if (!file) {
+        LOG_E("Cannot open %s", path);
+        return -1;
+    }
+    json = trace_dump_json();
+    fputs(json, file);
+    fclose(file);
+    free(json);
+    return 0;
+}
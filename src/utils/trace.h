@@ -0,0 +1,75 @@
+/* Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * File: trace.h
+ * Low overhead trace events.
+ *
+ * The events are stored in a global ring buffer, and can be exported in the
+ * chrome trace event JSON format, to be opened with chrome://tracing or
+ * https://ui.perfetto.dev.  This is safe to call from the worker threads.
+ *
+ * The trace functions are compiled out unless SWE_TRACE is set, which is
+ * the default in debug mode (see config.h).
+ *
+ * The category and name arguments are not copied, so they should be static
+ * strings.
+ */
+
+#if SWE_TRACE
+
+/*
+ * Function: trace_begin
+ * Start a duration event on the current thread.
+ */
+void trace_begin(const char *cat, const char *name);
+
+/*
+ * Function: trace_end
+ * End the last duration event started on the current thread.
+ */
+void trace_end(const char *cat, const char *name);
+
+/*
+ * Function: trace_counter
+ * Record the new value of a counter.
+ */
+void trace_counter(const char *cat, const char *name, double value);
+
+#else
+
+#define trace_begin(cat, name) do {} while (0)
+#define trace_end(cat, name) do {} while (0)
+#define trace_counter(cat, name, value) do {} while (0)
+
+#endif
+
+/*
+ * Function: trace_dump_json
+ * Return all the events in the ring buffer as a chrome trace JSON string.
+ *
+ * Return:
+ *   A newly allocated string, that the caller should free.  Without
+ *   SWE_TRACE this is always an empty trace.
+ */
+char *trace_dump_json(void);
+
+/*
+ * Function: trace_dump
+ * Save the events as a chrome trace JSON file.
+ *
+ * Return:
+ *   0 on success.
+ */
+int trace_dump(const char *path);
+
+#endif // TRACE_H
@@ -94,7 +94,10 @@ uint8_t *img_read(const char *path, int *w, int *h, int *bpp);
 
 /*
  * Function: img_read_from_mem
- * Read a png/jpeg image from memory.
+ * Read a png/jpeg/webp image from memory.
+ *
+ * The returned buffer comes from the images pool, and can be given back
+ * with img_pool_release(img, w * h * bpp), or simply freed.
  */
 uint8_t *img_read_from_mem(const void *data, int size,
                            int *w, int *h, int *bpp);
@@ -105,6 +108,15 @@ uint8_t *img_read_from_mem(const void *data, int size,
  */
 void img_write(const uint8_t *img, int w, int h, int bpp, const char *path);
 
+/*
+ * Function: img_write_to_mem
+ * Encode an image into a png buffer.
+ *
+ * Return a newly allocated buffer, to be freed by the caller.
+ */
+uint8_t *img_write_to_mem(const uint8_t *img, int w, int h, int bpp,
+                          int *size);
+
 /*
  * Function: z_uncompress
  * Like zlib uncompress, but using stb instead.
@@ -12,6 +12,7 @@
 
 #include <assert.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 
 json_value *json_get_attr(const json_value *val, const char *attr, int type)
@@ -256,3 +257,298 @@ int jcon_parse(const json_value *v, ...)
     va_end(ap);
     return ret ? -1 : 0;
 }
+
+/******** Streaming parser ************************************************/
+
+static int reader_error(json_reader_t *r)
+{
+    r->type = JSON_TOK_ERROR;
+    return r->type;
+}
+
+static void reader_skip_ws(json_reader_t *r)
+{
+    while (r->pos < r->size && strchr(" \t\r\n", r->data[r->pos]) &&
+           r->data[r->pos])
+        r->pos++;
+}
+
+// Consume a given char, after any leading white space.
+static bool reader_accept(json_reader_t *r, char c)
+{
+    reader_skip_ws(r);
+    if (r->pos >= r->size || r->data[r->pos] != c) return false;
+    r->pos++;
+    return true;
+}
+
+static int reader_parse_string(json_reader_t *r, int type)
+{
+    int start = ++r->pos;
+    char c;
+
+    for (; r->pos < r->size; r->pos++) {
+        c = r->data[r->pos];
+        if (c == '"') break;
+        if ((unsigned char)c < 0x20) return reader_error(r);
+        if (c == '\\') r->pos++;
+    }
+    if (r->pos >= r->size) return reader_error(r);
+    r->str = r->data + start;
+    r->len = r->pos - start;
+    r->pos++;
+    r->done = (type == JSON_TOK_STRING);
+    r->type = type;
+    return type;
+}
+
+static int reader_parse_number(json_reader_t *r)
+{
+    char buf[64], *end;
+    int n = 0;
+
+    while (r->pos < r->size && n < sizeof(buf) - 1 &&
+           r->data[r->pos] && strchr("+-.0123456789eE", r->data[r->pos]))
+        buf[n++] = r->data[r->pos++];
+    buf[n] = '\0';
+    r->number = strtod(buf, &end);
+    if (!n || end != buf + n) return reader_error(r);
+    r->done = true;
+    r->type = JSON_TOK_NUMBER;
+    return r->type;
+}
+
+static int reader_parse_literal(json_reader_t *r)
+{
+    const char *LITERALS[] = {"true", "false", "null"};
+    int i, len;
+
+    for (i = 0; i < 3; i++) {
+        len = strlen(LITERALS[i]);
+        if (r->pos + len <= r->size &&
+            strncmp(r->data + r->pos, LITERALS[i], len) == 0) break;
+    }
+    if (i == 3) return reader_error(r);
+    r->pos += len;
+    r->number = (i == 0);
+    r->done = true;
+    r->type = (i == 2) ? JSON_TOK_NULL : JSON_TOK_BOOL;
+    return r->type;
+}
+
+void json_reader_init(json_reader_t *r, const char *data, int size)
+{
+    memset(r, 0, sizeof(*r));
+    r->data = data;
+    r->size = size;
+    r->type = JSON_TOK_END;
+}
+
+int json_reader_next(json_reader_t *r)
+{
+    char c, top;
+    bool comma = false;
+
+    if (r->type == JSON_TOK_ERROR) return r->type;
+    top = r->depth ? r->stack[r->depth - 1] : 0;
+
+    if (r->type == JSON_TOK_KEY) {
+        if (!reader_accept(r, ':')) return reader_error(r);
+    } else if (r->done && !top) {
+        // End of the root value, only white space can follow.
+        reader_skip_ws(r);
+        if (r->pos < r->size && r->data[r->pos]) return reader_error(r);
+        r->type = JSON_TOK_END;
+        return r->type;
+    } else if (r->done) {
+        comma = reader_accept(r, ',');
+    }
+    reader_skip_ws(r);
+    if (r->pos >= r->size || !r->data[r->pos]) {
+        if (r->depth || r->done || r->type == JSON_TOK_KEY)
+            return reader_error(r);
+        r->type = JSON_TOK_END;
+        return r->type;
+    }
+    c = r->data[r->pos];
+
+    // Containers end, only allowed right after the start or a value.
+    if ((c == '}' && top == 'o') || (c == ']' && top == 'a')) {
+        if (comma || r->type == JSON_TOK_KEY) return reader_error(r);
+        r->pos++;
+        r->depth--;
+        r->done = true;
+        r->type = (c == '}') ? JSON_TOK_OBJECT_END : JSON_TOK_ARRAY_END;
+        return r->type;
+    }
+    // Values must be separated by commas.
+    if (r->done && !comma) return reader_error(r);
+    // Object values must follow a key.
+    if (top == 'o' && r->type != JSON_TOK_KEY) {
+        if (c != '"') return reader_error(r);
+        return reader_parse_string(r, JSON_TOK_KEY);
+    }
+
+    r->done = false;
+    switch (c) {
+    case '{':
+    case '[':
+        if (r->depth == sizeof(r->stack)) return reader_error(r);
+        r->stack[r->depth++] = (c == '{') ? 'o' : 'a';
+        r->pos++;
+        r->type = (c == '{') ? JSON_TOK_OBJECT : JSON_TOK_ARRAY;
+        return r->type;
+    case '"':
+        return reader_parse_string(r, JSON_TOK_STRING);
+    case 't':
+    case 'f':
+    case 'n':
+        return reader_parse_literal(r);
+    default:
+        return reader_parse_number(r);
+    }
+}
+
+int json_reader_skip(json_reader_t *r)
+{
+    int depth;
+
+    if (r->type == JSON_TOK_KEY) json_reader_next(r);
+    if (r->type == JSON_TOK_ERROR) return -1;
+    if (r->type != JSON_TOK_OBJECT && r->type != JSON_TOK_ARRAY) return 0;
+    depth = r->depth;
+    while (r->depth >= depth) {
+        if (json_reader_next(r) <= 0) return -1;
+    }
+    return 0;
+}
+
+bool json_reader_key_is(const json_reader_t *r, const char *key)
+{
+    return r->type == JSON_TOK_KEY && strncmp(r->str, key, r->len) == 0 &&
+           key[r->len] == '\0';
+}
+
+// Append an unicode code point as utf-8.
+static void put_utf8(char *buf, int size, int *n, unsigned int c)
+{
+    char tmp[4];
+    int i, len;
+
+    if (c < 0x80) {
+        tmp[0] = c;
+        len = 1;
+    } else if (c < 0x800) {
+        tmp[0] = 0xc0 | (c >> 6);
+        tmp[1] = 0x80 | (c & 0x3f);
+        len = 2;
+    } else if (c < 0x10000) {
+        tmp[0] = 0xe0 | (c >> 12);
+        tmp[1] = 0x80 | ((c >> 6) & 0x3f);
+        tmp[2] = 0x80 | (c & 0x3f);
+        len = 3;
+    } else {
+        tmp[0] = 0xf0 | (c >> 18);
+        tmp[1] = 0x80 | ((c >> 12) & 0x3f);
+        tmp[2] = 0x80 | ((c >> 6) & 0x3f);
+        tmp[3] = 0x80 | (c & 0x3f);
+        len = 4;
+    }
+    for (i = 0; i < len; i++, (*n)++) {
+        if (*n < size - 1) buf[*n] = tmp[i];
+    }
+}
+
+// Parse the four hex digits of a \u escape.
+static unsigned int parse_hex4(const char *s, const char *end)
+{
+    char buf[5] = {};
+    if (end - s < 4) return 0xfffd;
+    memcpy(buf, s, 4);
+    return strtoul(buf, NULL, 16);
+}
+
+int json_reader_get_str(const json_reader_t *r, char *buf, int size)
+{
+    const char *s = r->str, *end = r->str + r->len, *p;
+    unsigned int c, c2;
+    int n = 0;
+
+    for (; s < end; s++) {
+        c = (unsigned char)*s;
+        if (c == '\\' && s + 1 < end) {
+            s++;
+            c = (unsigned char)*s;
+            if ((p = strchr("b\bf\fn\nr\rt\t", c)) && c) {
+                c = p[1];
+            } else if (c == 'u') {
+                c = parse_hex4(s + 1, end);
+                s += 4;
+                // Surrogate pair.
+                if (c >= 0xd800 && c < 0xdc00 && s + 2 < end &&
+                    s[1] == '\\' && s[2] == 'u') {
+                    c2 = parse_hex4(s + 3, end);
+                    if (c2 >= 0xdc00 && c2 < 0xe000) {
+                        c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+                        s += 6;
+                    }
+                }
+                if (s >= end) break;
+                put_utf8(buf, size, &n, c);
+                continue;
+            }
+        }
+        if (n < size - 1) buf[n] = c;
+        n++;
+    }
+    if (size) buf[n < size ? n : size - 1] = '\0';
+    return n;
+}
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+#include "tests.h"
+
+static void test_json_reader(void)
+{
+    json_reader_t r;
+    char buf[32];
+    int i, n;
+    double x = 0;
+    const char *json = "{\"x\": -1.5e1, \"l\": [1, {\"a\": [true]}, null],"
+                       " \"s\": \"a\\\"\\u00e9\\ud83d\\ude00\\n\"} ";
+    const char *errors[] = {"{\"a\": 1,}", "[1 2]", "{\"a\" 1}", "[1,]",
+                            "{\"a\": 1", "[tru]", "{1: 2}", "[1] 2"};
+
+    json_reader_init(&r, json, strlen(json));
+    assert(json_reader_next(&r) == JSON_TOK_OBJECT);
+    while (json_reader_next(&r) == JSON_TOK_KEY) {
+        if (json_reader_key_is(&r, "x")) {
+            assert(json_reader_next(&r) == JSON_TOK_NUMBER);
+            x = r.number;
+        } else if (json_reader_key_is(&r, "s")) {
+            assert(json_reader_next(&r) == JSON_TOK_STRING);
+            n = json_reader_get_str(&r, buf, sizeof(buf));
+            assert(n == 9 && strcmp(buf, "a\"\xc3\xa9\xf0\x9f\x98\x80\n") == 0);
+            assert(json_reader_get_str(&r, buf, 3) == 9);
+            assert(strcmp(buf, "a\"") == 0);
+        } else {
+            assert(json_reader_skip(&r) == 0);
+        }
+    }
+    assert(r.type == JSON_TOK_OBJECT_END);
+    assert(json_reader_next(&r) == JSON_TOK_END);
+    assert(x == -15);
+
+    for (i = 0; i < sizeof(errors) / sizeof(*errors); i++) {
+        json_reader_init(&r, errors[i], strlen(errors[i]));
+        while ((n = json_reader_next(&r)) > 0) {}
+        assert(n == JSON_TOK_ERROR);
+    }
+}
+
+TEST_REGISTER(NULL, test_json_reader, TEST_AUTO);
+
+#endif
@@ -7,6 +7,9 @@
  * repository.
  */
 
+#ifndef UTILS_JSON_H
+#define UTILS_JSON_H
+
 /*
  * File: utils_json.h
  * Some extra functions that extend the json lib we use.
@@ -98,3 +101,111 @@ int json_parse_vector(const json_value *data, int size, double *out);
 #define JCON_VAL(v) "v", &(v)
 
 int jcon_parse(const json_value *v, ...) __attribute__((warn_unused_result));
+
+/*
+ * Type: json_reader_t
+ * Streaming json parser, that reads the tokens one by one without
+ * building any json_value tree.
+ *
+ * This is faster and uses less memory than json_parse when we only want
+ * a few fields out of large documents, like the lines of a jsonl file.
+ *
+ * e.g:
+ *
+ * json_reader_t r;
+ * json_reader_init(&r, data, size);
+ * if (json_reader_next(&r) != JSON_TOK_OBJECT) goto error;
+ * while (json_reader_next(&r) == JSON_TOK_KEY) {
+ *     if (json_reader_key_is(&r, "x")) {
+ *         if (json_reader_next(&r) != JSON_TOK_NUMBER) goto error;
+ *         x = r.number;
+ *     } else {
+ *         if (json_reader_skip(&r)) goto error;
+ *     }
+ * }
+ * if (r.type != JSON_TOK_OBJECT_END) goto error;
+ *
+ * Attributes:
+ *   type   - Type of the current token, one of the <JSON_TOK> values.
+ *   str    - Raw content of the current key or string token, without the
+ *            quotes and still escaped.  Use json_reader_get_str to
+ *            get the unescaped value.
+ *   len    - Length of str.
+ *   number - Value of the current number or boolean token.
+ */
+typedef struct json_reader {
+    const char  *data;
+    int         size;
+    int         pos;
+    int         depth;
+    char        stack[32];  // Type of the containers we are in.
+    bool        done;       // Set when the last token ends a value.
+    int         type;
+    const char  *str;
+    int         len;
+    double      number;
+} json_reader_t;
+
+/*
+ * Enum: JSON_TOK
+ * The json_reader_t tokens types.
+ */
+enum {
+    JSON_TOK_ERROR      = -1,
+    JSON_TOK_END        = 0,
+    JSON_TOK_OBJECT,
+    JSON_TOK_OBJECT_END,
+    JSON_TOK_ARRAY,
+    JSON_TOK_ARRAY_END,
+    JSON_TOK_KEY,
+    JSON_TOK_STRING,
+    JSON_TOK_NUMBER,
+    JSON_TOK_BOOL,
+    JSON_TOK_NULL,
+};
+
+/*
+ * Function: json_reader_init
+ * Start reading a json document.
+ */
+void json_reader_init(json_reader_t *r, const char *data, int size);
+
+/*
+ * Function: json_reader_next
+ * Read the next token.
+ *
+ * Return:
+ *   The type of the token, JSON_TOK_END at the end of the document, or
+ *   JSON_TOK_ERROR if the document is not valid json.
+ */
+int json_reader_next(json_reader_t *r);
+
+/*
+ * Function: json_reader_skip
+ * Skip the value following the current key, or the remaining of the value
+ * starting at the current token if it is an object or array start.
+ *
+ * Return:
+ *   Zero on success, or -1 in case of error.
+ */
+int json_reader_skip(json_reader_t *r);
+
+/*
+ * Function: json_reader_key_is
+ * Test if the current token is a given key.
+ */
+bool json_reader_key_is(const json_reader_t *r, const char *key);
+
+/*
+ * Function: json_reader_get_str
+ * Copy the unescaped value of the current key or string token.
+ *
+ * The copied string is always null terminated, and truncated if needed.
+ *
+ * Return:
+ *   The length of the unescaped string, that can be larger than the
+ *   buffer size in case of truncation.
+ */
+int json_reader_get_str(const json_reader_t *r, char *buf, int size);
+
+#endif // UTILS_JSON_H
@@ -586,7 +586,31 @@ static void test_caps(void)
                                   VEC(0, 0, 1)));
 }
 
+static void test_mul_n(void)
+{
+    int i;
+    double m3[3][3], m4[4][4], v3[5][3], v4[5][4], r3[5][3], r4[5][4];
+
+    for (i = 0; i < 16; i++) m4[i / 4][i % 4] = sin(i + 1);
+    for (i = 0; i < 9; i++) m3[i / 3][i % 3] = cos(i + 1);
+    for (i = 0; i < 5 * 4; i++) v4[i / 4][i % 4] = sin(2 * i);
+    for (i = 0; i < 5 * 3; i++) v3[i / 3][i % 3] = cos(3 * i);
+
+    for (i = 0; i < 5; i++) {
+        mat3_mul_vec3(m3, v3[i], r3[i]);
+        mat4_mul_vec4(m4, v4[i], r4[i]);
+    }
+    // In place.
+    mat3_mul_vec3_n(m3, 5, (const void*)v3, v3);
+    mat4_mul_vec4_n(m4, 5, (const void*)v4, v4);
+    for (i = 0; i < 5; i++) {
+        assert(vec3_dist(r3[i], v3[i]) < 1e-12);
+        assert(vec3_dist(r4[i], v4[i]) < 1e-12);
+        assert(fabs(r4[i][3] - v4[i][3]) < 1e-12);
+    }
+}
 
 TEST_REGISTER(NULL, test_caps, TEST_AUTO);
+TEST_REGISTER(NULL, test_mul_n, TEST_AUTO);
 
 #endif
@@ -178,6 +178,28 @@ INL void mat4_mul_dir3(const double mat[S 4][4], const double v[S 3],
                        double out[S 3]);
 INL void mat4_copy(const double src[S 4][4], double out[S 4][4]);
 
+/*
+ * Function: mat3_mul_vec3_n
+ * Multiply an array of 3d vectors by a 3x3 matrix.
+ *
+ * Same as calling mat3_mul_vec3 on each vector, but using SIMD
+ * instructions when possible.  The input and output arrays can be the
+ * same.
+ */
+INL void mat3_mul_vec3_n(const double mat[S 3][3], int n,
+                         const double (*v)[3], double (*out)[3]);
+
+/*
+ * Function: mat4_mul_vec4_n
+ * Multiply an array of 4d vectors by a 4x4 matrix.
+ *
+ * Same as calling mat4_mul_vec4 on each vector, but using SIMD
+ * instructions when possible.  The input and output arrays can be the
+ * same.
+ */
+INL void mat4_mul_vec4_n(const double mat[S 4][4], int n,
+                         const double (*v)[4], double (*out)[4]);
+
 void mat4_perspective(double mat[S 4][4], double fovy, double aspect,
                           double nearval, double farval);
 /*
@@ -558,6 +580,74 @@ INL void mat4_mul_vec4(const double mat[S 4][4], const double v[S 4],
     vec4_copy(ret, out);
 }
 
+/*
+ * The batch functions use the GCC vector extensions, that the compiler
+ * maps to the target SIMD instructions: SSE2 or AVX on x86, NEON on ARM,
+ * and wasm SIMD when compiled with -msimd128.  On a target without SIMD
+ * the operations are split back into scalar code, so the only dispatch we
+ * need is the fallback for the compilers without the extensions.
+ */
+#if defined(__GNUC__)
+
+typedef double vec_d2_t_ __attribute__((vector_size(2 * sizeof(double))));
+typedef double vec_d4_t_ __attribute__((vector_size(4 * sizeof(double))));
+
+INL void mat3_mul_vec3_n(const double mat[S 3][3], int n,
+                         const double (*v)[3], double (*out)[3])
+{
+    int i;
+    vec_d2_t_ c0, c1, c2, r;
+    double x, y, z;
+
+    // The first two components of each matrix row, the third one being
+    // computed as a scalar.
+    memcpy(&c0, mat[0], sizeof(c0));
+    memcpy(&c1, mat[1], sizeof(c1));
+    memcpy(&c2, mat[2], sizeof(c2));
+    for (i = 0; i < n; i++) {
+        x = v[i][0];
+        y = v[i][1];
+        z = v[i][2];
+        r = x * c0 + y * c1 + z * c2;
+        out[i][2] = x * mat[0][2] + y * mat[1][2] + z * mat[2][2];
+        memcpy(out[i], &r, sizeof(r));
+    }
+}
+
+INL void mat4_mul_vec4_n(const double mat[S 4][4], int n,
+                         const double (*v)[4], double (*out)[4])
+{
+    int i;
+    vec_d4_t_ c0, c1, c2, c3, r;
+
+    memcpy(&c0, mat[0], sizeof(c0));
+    memcpy(&c1, mat[1], sizeof(c1));
+    memcpy(&c2, mat[2], sizeof(c2));
+    memcpy(&c3, mat[3], sizeof(c3));
+    for (i = 0; i < n; i++) {
+        r = v[i][0] * c0 + v[i][1] * c1 + v[i][2] * c2 + v[i][3] * c3;
+        memcpy(out[i], &r, sizeof(r));
+    }
+}
+
+#else
+
+INL void mat3_mul_vec3_n(const double mat[S 3][3], int n,
+                         const double (*v)[3], double (*out)[3])
+{
+    int i;
+    for (i = 0; i < n; i++) mat3_mul_vec3(mat, v[i], out[i]);
+}
+
+INL void mat4_mul_vec4_n(const double mat[S 4][4], int n,
+                         const double (*v)[4], double (*out)[4])
+{
+    int i;
+    for (i = 0; i < n; i++) mat4_mul_vec4(mat, v[i], out[i]);
+}
+
+#endif
+
 INL void mat4_mul_vec3(const double mat[S 4][4], const double v[S 3],
                        double out[S 3])
 {
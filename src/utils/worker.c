@@ -8,8 +8,54 @@
  */
 
 #include "worker.h"
+#include <stdlib.h>
 #include <string.h>
 
+// Worker states.
+enum {
+    WORKER_IDLE     = 0,
+    WORKER_RUNNING  = 1, // Queued or currently running in a thread.
+    WORKER_DONE     = 2,
+};
+
+/*
+ * Type: deferred_t
+ * A call queued with worker_defer_to_main.
+ *
+ * The queue is a lock free stack, since the workers can push to it while
+ * the main thread runs the calls.
+ */
+typedef struct deferred deferred_t;
+struct deferred {
+    void        (*fn)(void *user);
+    void        *user;
+    deferred_t  *next;
+};
+
+static deferred_t *g_deferred = NULL;
+
+void worker_defer_to_main(void (*fn)(void *user), void *user)
+{
+    deferred_t *d = malloc(sizeof(*d));
+    d->fn = fn;
+    d->user = user;
+    d->next = __atomic_load_n(&g_deferred, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&g_deferred, &d->next, d, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {}
+}
+
+void worker_run_deferred(void)
+{
+    deferred_t *d, *next;
+    d = __atomic_exchange_n(&g_deferred, NULL, __ATOMIC_ACQUIRE);
+    for (; d; d = next) {
+        next = d->next;
+        d->fn(d->user);
+        free(d);
+    }
+}
+
 #ifndef HAVE_PTHREAD
 
 void worker_init(worker_t *w, int (*fn)(worker_t *w))
@@ -21,8 +67,8 @@ void worker_init(worker_t *w, int (*fn)(worker_t *w))
 int worker_iter(worker_t *w)
 {
     if (w->state) return 1;
-    w->fn(w);
-    w->state = 1;
+    w->ret = w->fn(w);
+    w->state = WORKER_DONE;
     return 1;
 }
 
@@ -31,4 +77,178 @@ bool worker_is_running(worker_t *w)
     return false;
 }
 
+bool worker_is_main_thread(void)
+{
+    return true;
+}
+
+int worker_wait(worker_t *w)
+{
+    worker_iter(w);
+    return w->ret;
+}
+
+#else // HAVE_PTHREAD
+
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef __EMSCRIPTEN__
+#   include <emscripten/threading.h>
+#endif
+
+// Max number of threads in the pool.
+#define MAX_THREADS 4
+
+// Global pool.  The queue is a simple FIFO linked list of the workers
+// waiting to be picked up by a thread.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_cond_t  done_cond; // Signaled each time a worker finishes.
+    pthread_t       threads[MAX_THREADS];
+    int             nb_threads;
+    worker_t        *queue_head;
+    worker_t        *queue_tail;
+} g = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+// Set in the pool threads.
+static __thread bool g_in_pool_thread = false;
+
+// Remove a worker from the queue.  Called with the lock held.  Return
+// false if the worker was not in the queue.
+static bool queue_remove(worker_t *w)
+{
+    worker_t *prev = NULL, *it;
+
+    for (it = g.queue_head; it && it != w; it = it->next) prev = it;
+    if (!it) return false;
+    if (prev) prev->next = w->next;
+    else g.queue_head = w->next;
+    if (g.queue_tail == w) g.queue_tail = prev;
+    w->next = NULL;
+    return true;
+}
+
+// Run a worker that has been removed from the queue.
+static void run(worker_t *w)
+{
+    int ret;
+
+    ret = w->fn(w);
+    pthread_mutex_lock(&g.lock);
+    w->ret = ret;
+    w->state = WORKER_DONE;
+    pthread_cond_broadcast(&g.done_cond);
+    pthread_mutex_unlock(&g.lock);
+}
+
+static void *thread_func(void *arg)
+{
+    worker_t *w;
+
+    g_in_pool_thread = true;
+    while (true) {
+        pthread_mutex_lock(&g.lock);
+        while (!g.queue_head)
+            pthread_cond_wait(&g.cond, &g.lock);
+        w = g.queue_head;
+        queue_remove(w);
+        pthread_mutex_unlock(&g.lock);
+        run(w);
+    }
+    return NULL;
+}
+
+static int get_nb_cores(void)
+{
+#ifdef __EMSCRIPTEN__
+    return emscripten_num_logical_cores();
+#else
+    return sysconf(_SC_NPROCESSORS_ONLN);
 #endif
+}
+
+// Start the pool threads.  Called with the lock held.
+static void init_pool(void)
+{
+    int i, n;
+    // Keep one core for the main thread.
+    n = get_nb_cores() - 1;
+    if (n < 1) n = 1;
+    if (n > MAX_THREADS) n = MAX_THREADS;
+    for (i = 0; i < n; i++) {
+        if (pthread_create(&g.threads[i], NULL, thread_func, NULL) != 0)
+            break;
+        pthread_detach(g.threads[i]);
+        g.nb_threads++;
+    }
+}
+
+void worker_init(worker_t *w, int (*fn)(worker_t *w))
+{
+    memset(w, 0, sizeof(*w));
+    w->fn = fn;
+}
+
+int worker_iter(worker_t *w)
+{
+    int state;
+
+    pthread_mutex_lock(&g.lock);
+    if (!g.nb_threads) init_pool();
+    // If we could not start any thread, run the function directly.
+    if (!g.nb_threads && w->state == WORKER_IDLE) {
+        pthread_mutex_unlock(&g.lock);
+        w->ret = w->fn(w);
+        w->state = WORKER_DONE;
+        return 1;
+    }
+    if (w->state == WORKER_IDLE) {
+        w->state = WORKER_RUNNING;
+        w->next = NULL;
+        if (g.queue_tail) g.queue_tail->next = w;
+        else g.queue_head = w;
+        g.queue_tail = w;
+        pthread_cond_signal(&g.cond);
+    }
+    state = w->state;
+    pthread_mutex_unlock(&g.lock);
+    return state == WORKER_DONE;
+}
+
+bool worker_is_running(worker_t *w)
+{
+    bool ret;
+    pthread_mutex_lock(&g.lock);
+    ret = w->state == WORKER_RUNNING;
+    pthread_mutex_unlock(&g.lock);
+    return ret;
+}
+
+int worker_wait(worker_t *w)
+{
+    bool queued;
+
+    worker_iter(w);
+    pthread_mutex_lock(&g.lock);
+    // Take the worker back if no thread picked it up yet, otherwise wait
+    // for the thread running it.
+    queued = queue_remove(w);
+    while (!queued && w->state != WORKER_DONE)
+        pthread_cond_wait(&g.done_cond, &g.lock);
+    pthread_mutex_unlock(&g.lock);
+    if (queued) run(w);
+    return w->ret;
+}
+
+bool worker_is_main_thread(void)
+{
+    return !g_in_pool_thread;
+}
+
+#endif // HAVE_PTHREAD
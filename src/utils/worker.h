@@ -14,6 +14,10 @@
  * A worker is simply a task that run in a thread pool.  We can create a worker
  * with <worker_init> and then run it by calling <worker_iter> as many times
  * as we want, until it returns a non zero value.
+ *
+ * If the code is compiled with HAVE_PTHREAD, the workers are run by a
+ * fixed pool of threads, otherwise the function is directly called by
+ * <worker_iter>.
  */
 
 #ifndef WORKER_H
@@ -29,6 +33,7 @@ struct worker
     void *user;
     int ret;
     int state;
+    worker_t *next; // Used by the thread pool queue.
 };
 
 /*
@@ -59,4 +64,43 @@ int worker_iter(worker_t *worker);
  */
 bool worker_is_running(worker_t *worker);
 
+/*
+ * Function: worker_wait
+ * Run a worker until it has finished.
+ *
+ * If the worker is still waiting in the pool queue, it is removed from the
+ * queue and run directly on the calling thread.  Otherwise we block until
+ * the thread running it is done.  The other queued workers are never run
+ * by the calling thread, so that a wait only costs the work it asked for.
+ *
+ * Return:
+ *   The worker function return value.
+ */
+int worker_wait(worker_t *worker);
+
+/*
+ * Function: worker_is_main_thread
+ * Return whether we are running on the main thread, and not in one of the
+ * pool threads.
+ */
+bool worker_is_main_thread(void);
+
+/*
+ * Function: worker_defer_to_main
+ * Queue a function call to be run on the main thread.
+ *
+ * The queued calls are run by the next call to <worker_run_deferred>.
+ * This is used to delete the objects that were released last by a
+ * worker, since their destructors are usually not thread safe.
+ */
+void worker_defer_to_main(void (*fn)(void *user), void *user);
+
+/*
+ * Function: worker_run_deferred
+ * Run all the calls queued with <worker_defer_to_main>.
+ *
+ * Should be called on the main thread, once per frame.
+ */
+void worker_run_deferred(void);
+
 #endif // WORKER_H
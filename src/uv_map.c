@@ -11,6 +11,7 @@
 #include "uv_map.h"
 
 #include "algos/algos.h"
+#include "utils/utils.h"
 #include "utils/vec.h"
 
 #include <assert.h>
@@ -58,6 +59,12 @@ void uv_map_get_bounding_cap(const uv_map_t *map, double out[4])
     double corners[4][4], d;
     int i;
 
+    // Use the precomputed healpix caps when possible.
+    if (map->type == UV_MAP_HEALPIX && !map->transf) {
+        healpix_get_bounding_cap(1 << map->order, map->pix, out);
+        return;
+    }
+
     uv_map_grid(map, 1, corners, NULL);
     vec4_set(out, 0, 0, 0, 1);
     for (i = 0; i < 4; i++) {
@@ -103,6 +110,23 @@ void uv_map_init_healpix(uv_map_t *map, int order, int pix, bool swap,
     healpix_map_update_mat(map);
 }
 
+static void ring_map(const uv_map_t *map, const double v[2], double out[4])
+{
+    double theta, r;
+    theta = v[0] * 2 * M_PI;
+    r = mix(map->radii[0], map->radii[1], v[1]);
+    vec4_set(out, r * cos(theta), r * sin(theta), 0, 1);
+}
+
+void uv_map_init_ring(uv_map_t *map, double inner, double outer)
+{
+    memset(map, 0, sizeof(*map));
+    map->type = UV_MAP_RING;
+    map->radii[0] = inner;
+    map->radii[1] = outer;
+    map->map = ring_map;
+}
+
 /*
  * Function: uv_map_subdivide
  * Split the mapped shape into four smaller parts.
@@ -27,6 +27,7 @@
 
 enum {
     UV_MAP_HEALPIX = 1,
+    UV_MAP_RING = 2,
 };
 
 
@@ -45,6 +46,9 @@ struct uv_map
     double mat[3][3];
     bool swapped;
     bool at_infinity;
+
+    // Ring specific attributes.
+    double radii[2];
 };
 
 /*
@@ -101,5 +105,19 @@ void uv_map_get_bounding_cap(const uv_map_t *map, double cap[4]);
 void uv_map_init_healpix(uv_map_t *map, int order, int pix, bool swap,
                          bool at_infinity);
 
+/*
+ * Function: uv_map_init_ring
+ * Init an UV mapping for a flat ring in the xy plane.
+ *
+ * The u coordinate maps to the angle around the z axis, and v to the
+ * distance from the center, going from the inner to the outer radius.
+ *
+ * Parameters:
+ *   map    - A mapping struct that will be set.
+ *   inner  - Inner radius of the ring.
+ *   outer  - Outer radius of the ring.
+ */
+void uv_map_init_ring(uv_map_t *map, double inner, double outer);
+
 
 #endif // CELL_H
@@ -0,0 +1,144 @@
+#!/usr/bin/python3
+
+# Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+#
+# This program is licensed under the terms of the GNU AGPL v3, or
+# alternatively under a commercial licence.
+#
+# The terms of the AGPL v3 license can be found in the main directory of this
+# repository.
+
+# Run the apps/simple-html/bench.html benchmark in a headless browser, and
+# print the per phase timings as JSON.
+#
+# Usage:
+#   ./tools/bench.py [--browser chromium] [--out results.json]
+#                    [--baseline baseline.json] [--tolerance 0.1]
+#
+# The engine must have been built first (make js-prof is a good choice to
+# get meaningful timings with symbols).  We serve the repository root, so
+# that the page can load the build files and apps/test-skydata, and wait
+# for the page to post its results back.
+#
+# The browser uses the swiftshader software renderer, so that this can run
+# on machines without a GPU.  The GPU timings are thus not relevant, but
+# the CPU side timings are comparable from one run to the other on the
+# same machine.
+#
+# In profile mode the results also contain the algos microbenchmarks, with
+# the time per call of each function.  With --baseline, we compare them to
+# a previously saved results file, and exit with an error if any function
+# got slower by more than the tolerance.
+
+import argparse
+import functools
+import http.server
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+PAGE = 'apps/simple-html/bench.html'
+BROWSERS = ['chromium', 'chromium-browser', 'google-chrome', 'chrome']
+TIMEOUT = 600 # sec
+
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+
+    results = None
+    done = threading.Event()
+
+    def do_POST(self):
+        size = int(self.headers['Content-Length'])
+        Handler.results = json.loads(self.rfile.read(size))
+        self.send_response(200)
+        self.end_headers()
+        Handler.done.set()
+
+    def log_message(self, format, *args):
+        pass
+
+
+def find_browser(name):
+    for browser in ([name] if name else BROWSERS):
+        path = shutil.which(browser)
+        if path:
+            return path
+    sys.exit('Cannot find a browser, use --browser')
+
+
+def run(args):
+    if not os.path.exists(os.path.join(ROOT, 'build',
+                                       'stellarium-web-engine.js')):
+        sys.exit('Please build the engine first (make js-prof)')
+    handler = functools.partial(Handler, directory=ROOT)
+    server = http.server.ThreadingHTTPServer(('127.0.0.1', 0), handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    url = f'http://127.0.0.1:{server.server_port}/{PAGE}'
+
+    with tempfile.TemporaryDirectory() as profile_dir:
+        browser = subprocess.Popen([
+            find_browser(args.browser),
+            '--headless=new',
+            '--use-angle=swiftshader',
+            '--enable-unsafe-swiftshader',
+            '--force-device-scale-factor=1',
+            '--window-size=1280,720',
+            '--disable-gpu-vsync',
+            '--disable-frame-rate-limit',
+            f'--user-data-dir={profile_dir}',
+            url,
+        ], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            if not Handler.done.wait(TIMEOUT):
+                sys.exit('Timeout')
+        finally:
+            browser.terminate()
+            browser.wait()
+            server.shutdown()
+
+    out = json.dumps(Handler.results, indent=2, sort_keys=True)
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write(out + '\n')
+    print(out)
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if not compare(baseline.get('algos', {}),
+                       Handler.results.get('algos', {}), args.tolerance):
+            sys.exit(1)
+
+
+def compare(baseline, results, tolerance):
+    ok = True
+    for name in sorted(results):
+        if name not in baseline:
+            continue
+        ref = baseline[name]['ns_per_op']
+        val = results[name]['ns_per_op']
+        ratio = val / ref
+        status = 'ok'
+        if ratio > 1 + tolerance:
+            status = 'SLOWER'
+            ok = False
+        elif ratio < 1 - tolerance:
+            status = 'faster'
+        print(f'{name:28} {ref:12.1f} {val:12.1f} ns/op  {ratio:5.2f}x  '
+              f'{status}', file=sys.stderr)
+    return ok
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--browser', help='Browser executable')
+    parser.add_argument('--out', help='Also save the results to a file')
+    parser.add_argument('--baseline',
+                        help='Compare the algos timings to a results file')
+    parser.add_argument('--tolerance', type=float, default=0.1,
+                        help='Max relative slowdown allowed (default 0.1)')
+    run(parser.parse_args())
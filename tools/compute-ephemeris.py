@@ -10,10 +10,22 @@
 
 # Generate a list of ephemerides using pyephem.
 # The output of this script is used in the test in src/swe.c
+#
+# With the --cheb option, generate instead a Chebyshev ephemeris file for the
+# planets and moons, that the planets module can load with the 'eph/cheb'
+# data source key:
+#
+#   ./tools/compute-ephemeris.py --cheb out.eph [start_year end_year]
+#
+# Outside of the file time range the engine uses its analytic theories.
 
 import ephem
 import json
+import numpy as np
 import skyfield.api as sf
+import struct
+import sys
+import zlib
 
 from skyfield.data import hipparcos
 from math import *
@@ -197,6 +209,68 @@ def compute_all():
 
 
 
+# Position of Jupiter relative to the Sun.  The engine uses the center of
+# Jupiter, not the Jovian system barycenter, for the planet and as the origin
+# of the Galilean moons.
+JUPITER = ((de421['jupiter barycenter'] - de421['sun']) +
+           (jup365['jupiter'] - jup365['jupiter barycenter']))
+
+# Bodies of the Chebyshev ephemeris:
+# (id, center id, position, segment length (days), nb coefs)
+# The ids follow JPL HORIZONS, and the position must be relative to the
+# parent body used in the engine.
+CHEB_BODIES = [
+    (199, 10, de421['mercury'] - de421['sun'], 8, 14),
+    (299, 10, de421['venus'] - de421['sun'], 16, 10),
+    (499, 10, de421['mars barycenter'] - de421['sun'], 16, 11),
+    (599, 10, JUPITER, 32, 8),
+    (699, 10, de421['saturn barycenter'] - de421['sun'], 32, 7),
+    (799, 10, de421['uranus barycenter'] - de421['sun'], 32, 6),
+    (899, 10, de421['neptune barycenter'] - de421['sun'], 32, 6),
+    (999, 10, de421['pluto barycenter'] - de421['sun'], 32, 6),
+    (301, 399, de421['moon'] - de421['earth'], 4, 13),
+    (501, 599, jup365['io'] - jup365['jupiter'], 1, 14),
+    (502, 599, jup365['europa'] - jup365['jupiter'], 1, 12),
+    (503, 599, jup365['ganymede'] - jup365['jupiter'], 2, 12),
+    (504, 599, jup365['callisto'] - jup365['jupiter'], 4, 12),
+]
+
+
+def cheb_fit_body(ts, body, start, nb_segs):
+    id, center_id, vector, seg_len, nb = body
+    # Fit each segment on the Chebyshev nodes.
+    x = np.cos(np.pi * (np.arange(nb) + 0.5) / nb)
+    t = start + seg_len * (np.arange(nb_segs)[:, None] + (x[None, :] + 1) / 2)
+    pos = vector.at(ts.tt_jd(t.flatten() + 2400000.5)).position.au
+    pos = pos.reshape(3, nb_segs, nb)
+    tn = np.cos(np.outer(np.arange(nb), np.arccos(x)))  # T_j(x_k)
+    coefs = 2 / nb * np.einsum('ask,jk->saj', pos, tn)
+    coefs[:, :, 0] /= 2
+    return coefs  # [seg][axis][coef]
+
+
+def make_cheb(path, start_year=2020, end_year=2040):
+    ts = sf.load.timescale()
+    out = open(path, 'wb')
+    out.write(b'EPHE' + struct.pack('<i', 2))
+    for body in CHEB_BODIES:
+        id, center_id, _, seg_len, nb = body
+        start = ts.tt(start_year, 1, 1).tt - 2400000.5
+        end = ts.tt(end_year, 1, 1).tt - 2400000.5
+        nb_segs = int(np.ceil((end - start) / seg_len))
+        coefs = cheb_fit_body(ts, body, start, nb_segs)
+        data = coefs.astype('<f8').tobytes()
+        comp = zlib.compress(data, 9)
+        chunk = struct.pack('<iiiddii', 1, id, center_id, start, seg_len,
+                            nb_segs, nb)
+        chunk += struct.pack('<ii', len(data), len(comp)) + comp
+        crc = zlib.crc32(chunk) & 0xffffffff
+        out.write(b'PCHB' + struct.pack('<i', len(chunk)) + chunk +
+                  struct.pack('<I', crc))
+        print(f'{id}: {nb_segs} segments')
+    out.close()
+
+
 def c_format(v):
     if isinstance(v, dict): v = json.dumps(v)
     if isinstance(v, str): return '"{}"'.format(v.replace('"', '\\"'))
@@ -204,6 +278,9 @@ def c_format(v):
     return repr(v)
 
 if __name__ == '__main__':
+    if len(sys.argv) > 2 and sys.argv[1] == '--cheb':
+        make_cheb(sys.argv[2], *[int(x) for x in sys.argv[3:5]])
+        sys.exit(0)
     out = open('./src/ephemeris_tests.inl', 'w')
     print('// Generated from tools/compute-ephemeris.py\n', file=out)
     for d in compute_all():
@@ -0,0 +1,66 @@
+#!/usr/bin/python3
+
+# Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+#
+# This program is licensed under the terms of the GNU AGPL v3, or
+# alternatively under a commercial licence.
+#
+# The terms of the AGPL v3 license can be found in the main directory of this
+# repository.
+
+# Pack all the files of a local directory (usually a HiPS survey) into a
+# single archive that can be mapped in memory with asset_add_archive.
+#
+# Usage:
+#   ./tools/make-archive.py <dir> <out>
+#
+# Format (little endian):
+#   4 bytes magic string:   "SWAR"
+#   4 bytes version:        1
+#   4 bytes files number
+#   Then for each file:
+#     8 bytes: data offset from the start of the archive
+#     4 bytes: data size
+#     2 bytes: path size
+#     n bytes: path, relative to the directory
+#   Then the files data, each followed by a null byte so that text files
+#   are null terminated like with read_file.
+
+import os
+import struct
+import sys
+
+VERSION = 1
+
+
+def run(src, dst):
+    paths = []
+    for root, dirs, files in os.walk(src):
+        dirs.sort()
+        for name in sorted(files):
+            path = os.path.join(root, name)
+            paths.append(os.path.relpath(path, src).replace(os.sep, '/'))
+
+    index_size = 12 + sum(14 + len(p.encode()) for p in paths)
+    index = b'SWAR' + struct.pack('<II', VERSION, len(paths))
+    ofs = index_size
+    sizes = []
+    for path in paths:
+        size = os.path.getsize(os.path.join(src, path))
+        index += struct.pack('<QIH', ofs, size, len(path.encode()))
+        index += path.encode()
+        sizes.append(size)
+        ofs += size + 1
+    assert len(index) == index_size
+
+    with open(dst, 'wb') as out:
+        out.write(index)
+        for path in paths:
+            with open(os.path.join(src, path), 'rb') as f:
+                out.write(f.read())
+            out.write(b'\0')
+    print(f'Wrote {len(paths)} files to {dst}')
+
+
+if __name__ == '__main__':
+    run(sys.argv[1], sys.argv[2])
@@ -0,0 +1,347 @@
+#!/usr/bin/python3
+
+# Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+#
+# This program is licensed under the terms of the GNU AGPL v3, or
+# alternatively under a commercial licence.
+#
+# The terms of the AGPL v3 license can be found in the main directory of this
+# repository.
+
+# Usage:
+#   ./tools/make-geojson-eph.py in.geojson out.eph
+#
+# Convert a geojson FeatureCollection into a binary eph file that the
+# geojson module can load with the setBinaryData method, without parsing
+# any json or triangulating the polygons at runtime.
+#
+# The file contains a single GEOM chunk with:
+#   - A features table (colors, stroke width, title, number of vertices
+#     and indices of each feature).
+#   - The vertices of all the features, as float32 xyz unit vectors.
+#   - The indices of all the features, as uint16, relative to the feature
+#     vertices: triangles, then lines, then points.
+#   - A string table with the titles.
+#
+# The polygons are triangulated by ear clipping in a tangent plane, then
+# the triangles edges longer than 22.5° are subdivided, as done by
+# mesh_add_poly_lonlat in src/utils/mesh.c.  The polygons must thus be
+# smaller than a hemisphere.
+
+import json
+import math
+import struct
+import sys
+import zlib
+
+EPH_FILE_VERSION = 2
+GEOM_VERSION = 3
+MAX_EDGE_LENGTH = math.pi / 8
+MAX_VERTICES = 65536
+
+# name, type, unit
+COLUMNS = [
+    ('fill', 'I', 0),
+    ('strk', 'I', 0),
+    ('strw', 'f', 0),
+    ('nvrt', 'i', 0),
+    ('ntri', 'i', 0),
+    ('nlin', 'i', 0),
+    ('npnt', 'i', 0),
+    ('flag', 'i', 0),
+    ('titl', 'i', 0),
+]
+
+
+class StringTable:
+    def __init__(self):
+        self.data = bytearray(b'\0')  # Offset 0 is the empty string.
+        self.cache = {}
+
+    def add(self, value):
+        if not value:
+            return 0
+        if value not in self.cache:
+            self.cache[value] = len(self.data)
+            self.data += value.encode() + b'\0'
+        return self.cache[value]
+
+
+def compressed_block(data):
+    comp = zlib.compress(bytes(data), 9)
+    return struct.pack('<ii', len(data), len(comp)) + comp
+
+
+def chunk(type, data):
+    crc = zlib.crc32(data) & 0xffffffff
+    return type.encode() + struct.pack('<i', len(data)) + data + \
+        struct.pack('<I', crc)
+
+
+def lonlat2c(p):
+    lon, lat = math.radians(p[0]), math.radians(p[1])
+    return (math.cos(lat) * math.cos(lon), math.cos(lat) * math.sin(lon),
+            math.sin(lat))
+
+
+def normalize(v):
+    n = math.sqrt(sum(x * x for x in v))
+    return tuple(x / n for x in v)
+
+
+def cross(a, b):
+    return (a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+            a[0] * b[1] - a[1] * b[0])
+
+
+def dot(a, b):
+    return sum(x * y for x, y in zip(a, b))
+
+
+def angle(a, b):
+    return math.atan2(math.sqrt(sum(x * x for x in cross(a, b))), dot(a, b))
+
+
+def cross2(o, a, b):
+    return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0])
+
+
+def segments_intersect(a, b, c, d):
+    d1, d2 = cross2(a, b, c), cross2(a, b, d)
+    d3, d4 = cross2(c, d, a), cross2(c, d, b)
+    return d1 * d2 < 0 and d3 * d4 < 0
+
+
+def point_in_triangle(p, a, b, c):
+    return cross2(a, b, p) >= 0 and cross2(b, c, p) >= 0 and \
+        cross2(c, a, p) >= 0
+
+
+def signed_area(ring, pts):
+    return sum(cross2((0, 0), pts[ring[i]], pts[ring[i - 1]])
+               for i in range(len(ring))) * -0.5
+
+
+def bridge_hole(outer, hole, pts):
+    # Connect the hole to the outer ring with a pair of edges between the
+    # hole rightmost vertex and the closest outer vertex visible from it.
+    h = max(range(len(hole)), key=lambda i: pts[hole[i]][0])
+    m = pts[hole[h]]
+    edges = [(outer[i], outer[(i + 1) % len(outer)])
+             for i in range(len(outer))]
+    edges += [(hole[i], hole[(i + 1) % len(hole)]) for i in range(len(hole))]
+    best = None
+    for i, o in enumerate(outer):
+        p = pts[o]
+        dist = (p[0] - m[0]) ** 2 + (p[1] - m[1]) ** 2
+        if best is not None and dist >= best[1]:
+            continue
+        if any(segments_intersect(m, p, pts[a], pts[b]) for a, b in edges):
+            continue
+        best = (i, dist)
+    if best is None:
+        raise ValueError('Cannot bridge polygon hole')
+    i = best[0]
+    hole = hole[h:] + hole[:h + 1]
+    return outer[:i + 1] + hole + outer[i:]
+
+
+def ear_clip(ring, pts):
+    ring = list(ring)
+    ret = []
+    while len(ring) > 3:
+        n = len(ring)
+        for i in range(n):
+            a, b, c = ring[i - 1], ring[i], ring[(i + 1) % n]
+            if cross2(pts[a], pts[b], pts[c]) <= 0:
+                continue
+            if any(point_in_triangle(pts[p], pts[a], pts[b], pts[c])
+                   for p in ring if p not in (a, b, c)):
+                continue
+            ret.append((a, b, c))
+            del ring[i]
+            break
+        else:
+            # Degenerate polygon: clip the first vertex anyway.
+            ret.append((ring[-1], ring[0], ring[1]))
+            del ring[0]
+    ret.append(tuple(ring))
+    return ret
+
+
+class Mesh:
+    def __init__(self):
+        self.verts = []
+        self.triangles = []
+        self.lines = []
+        self.points = []
+        self.subdivided = False
+        self.midpoints = {}
+
+    def add_vert(self, v):
+        self.verts.append(v)
+        return len(self.verts) - 1
+
+    def midpoint(self, a, b):
+        key = (min(a, b), max(a, b))
+        if key not in self.midpoints:
+            v = normalize([x + y for x, y in
+                           zip(self.verts[a], self.verts[b])])
+            self.midpoints[key] = self.add_vert(v)
+        return self.midpoints[key]
+
+    def add_polygon(self, rings):
+        rings = [[lonlat2c(p) for p in r[:-1]] for r in rings if len(r) > 3]
+        if not rings:
+            return
+        # Gnomonic projection on the plane tangent to the outer ring center.
+        z = normalize([sum(v[i] for v in rings[0]) for i in range(3)])
+        x = cross((0, 0, 1), z) if abs(z[2]) < 0.9 else cross((1, 0, 0), z)
+        x = normalize(x)
+        y = cross(z, x)
+        pts = {}
+        indices = []
+        for r in rings:
+            ring = []
+            for v in r:
+                i = self.add_vert(v)
+                d = dot(v, z)
+                if d <= 0:
+                    raise ValueError('Polygon larger than a hemisphere')
+                pts[i] = (dot(v, x) / d, dot(v, y) / d)
+                ring.append(i)
+            indices.append(ring)
+            for j in range(len(ring)):
+                self.lines += [ring[j - 1], ring[j]]
+        # Outer ring counter clockwise, holes clockwise.
+        for j, ring in enumerate(indices):
+            if (signed_area(ring, pts) > 0) != (j == 0):
+                ring.reverse()
+        outer = indices[0]
+        for hole in sorted(indices[1:],
+                           key=lambda r: -max(pts[i][0] for i in r)):
+            outer = bridge_hole(outer, hole, pts)
+        for tri in ear_clip(outer, pts):
+            self.add_triangle(*tri)
+
+    def add_triangle(self, a, b, c):
+        # Split the longest edge until all are small enough.
+        tri = [a, b, c]
+        lengths = [angle(self.verts[tri[i]], self.verts[tri[(i + 1) % 3]])
+                   for i in range(3)]
+        i = max(range(3), key=lambda i: lengths[i])
+        if lengths[i] <= MAX_EDGE_LENGTH:
+            # Same winding as mesh_fix_triangles_culling.
+            u = cross(self.verts[a], self.verts[b])
+            self.triangles += [a, c, b] if dot(u, self.verts[c]) > 0 \
+                else [a, b, c]
+            return
+        self.subdivided = True
+        m = self.midpoint(tri[i], tri[(i + 1) % 3])
+        self.add_triangle(tri[i], m, tri[(i + 2) % 3])
+        self.add_triangle(m, tri[(i + 1) % 3], tri[(i + 2) % 3])
+
+    def add_line(self, coordinates):
+        ofs = len(self.verts)
+        for p in coordinates:
+            self.add_vert(lonlat2c(p))
+        for i in range(len(coordinates) - 1):
+            self.lines += [ofs + i, ofs + i + 1]
+
+    def add_point(self, p):
+        self.points.append(self.add_vert(lonlat2c(p)))
+
+    def add_geometry(self, geo):
+        type = geo['type']
+        if type == 'Polygon':
+            self.add_polygon(geo['coordinates'])
+        elif type == 'MultiPolygon':
+            for poly in geo['coordinates']:
+                self.add_polygon(poly)
+        elif type == 'LineString':
+            self.add_line(geo['coordinates'])
+        elif type == 'Point':
+            self.add_point(geo['coordinates'])
+        else:
+            raise ValueError(f'Unsupported geometry {type}')
+
+
+def parse_color(value, opacity):
+    # Same as parse_color in src/geojson_parser.c.
+    r = g = b = 0
+    if isinstance(value, str) and value.startswith('#'):
+        r, g, b = (int(value[i:i + 2], 16) for i in (1, 3, 5))
+    a = round(max(0.0, min(1.0, opacity)) * 255)
+    return r << 24 | g << 16 | b << 8 | a
+
+
+def make_eph(src, dst):
+    features = json.load(open(src))['features']
+    strs = StringTable()
+    rows = []
+    verts = bytearray()
+    indices = bytearray()
+    nb_err = 0
+    for feature in features:
+        props = feature.get('properties') or {}
+        mesh = Mesh()
+        try:
+            mesh.add_geometry(feature['geometry'])
+        except ValueError as e:
+            print(f'Feature {len(rows) + nb_err}: {e}', file=sys.stderr)
+            nb_err += 1
+            continue
+        if len(mesh.verts) > MAX_VERTICES:
+            print(f'Feature {len(rows) + nb_err}: too many vertices',
+                  file=sys.stderr)
+            nb_err += 1
+            continue
+        for v in mesh.verts:
+            verts += struct.pack('<fff', *v)
+        for i in mesh.triangles + mesh.lines + mesh.points:
+            indices += struct.pack('<H', i)
+        rows.append(dict(
+            fill=parse_color(props.get('fill'),
+                             props.get('fill-opacity', 0.5)),
+            strk=parse_color(props.get('stroke'),
+                             props.get('stroke-opacity', 1)),
+            strw=props.get('stroke-width', 1),
+            nvrt=len(mesh.verts),
+            ntri=len(mesh.triangles),
+            nlin=len(mesh.lines),
+            npnt=len(mesh.points),
+            flag=1 if mesh.subdivided else 0,
+            titl=strs.add(props.get('title')),
+        ))
+
+    row_fmt = '<' + ''.join(t for _, t, _ in COLUMNS)
+    row_size = struct.calcsize(row_fmt)
+    table = b''.join(struct.pack(row_fmt, *[r[c[0]] for c in COLUMNS])
+                     for r in rows)
+    # Shuffle the bytes for better compression (flag 1).
+    table = b''.join(table[i::row_size] for i in range(row_size))
+
+    header = struct.pack('<iiiii', GEOM_VERSION, 1, row_size, len(COLUMNS),
+                         len(rows))
+    start = 0
+    for name, type, unit in COLUMNS:
+        size = struct.calcsize('<' + type)
+        # The unsigned colors are read as int.
+        type = 'i' if type == 'I' else type
+        header += name.encode().ljust(4, b'\0')
+        header += type.encode().ljust(4, b'\0')
+        header += struct.pack('<iii', unit, start, size)
+        start += size
+
+    data = header + compressed_block(table) + compressed_block(verts) + \
+        compressed_block(indices) + compressed_block(strs.data)
+    with open(dst, 'wb') as out:
+        out.write(b'EPHE' + struct.pack('<i', EPH_FILE_VERSION))
+        out.write(chunk('GEOM', data))
+    print(f'Wrote {len(rows)} features to {dst} ({nb_err} errors)')
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.exit('Usage: make-geojson-eph.py in.geojson out.eph')
+    make_eph(sys.argv[1], sys.argv[2])
@@ -0,0 +1,88 @@
+#!/usr/bin/python3
+
+# Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+#
+# This program is licensed under the terms of the GNU AGPL v3, or
+# alternatively under a commercial licence.
+#
+# The terms of the AGPL v3 license can be found in the main directory of this
+# repository.
+
+# Usage:
+#   ./tools/make-hips-bundles.py [--order N] hipsdir
+#
+# Pack all the tiles of a HiPS survey up to a given order (default 3) into
+# one bundle file per order zero pixel: hipsdir/Bundle/Npix<pix>.bundle,
+# and set the hips_bundle_order property, so that the engine gets the low
+# order tiles with 12 requests at most instead of one per tile.
+#
+# The individual tiles files are kept, so the survey still works with
+# other clients.  See bundle_get_tile in src/hips.c for the format.
+
+import argparse
+import os
+import re
+import struct
+
+
+def read_tile(hipsdir, order, pix, ext):
+    path = os.path.join(hipsdir, f'Norder{order}',
+                        f'Dir{pix // 10000 * 10000}', f'Npix{pix}.{ext}')
+    if not os.path.exists(path):
+        return None
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def make_bundle(hipsdir, pix0, max_order, min_order, ext):
+    tiles = []
+    for order in range(min_order, max_order + 1):
+        n = 1 << (2 * order)
+        for pix in range(pix0 * n, (pix0 + 1) * n):
+            data = read_tile(hipsdir, order, pix, ext)
+            if data is not None:
+                tiles.append((order, pix, data))
+    offset = 12 + 16 * len(tiles)
+    index = b''
+    for order, pix, data in tiles:
+        index += struct.pack('<IIII', order, pix, offset, len(data))
+        offset += len(data)
+    ret = b'HBDL' + struct.pack('<II', 1, len(tiles)) + index
+    return ret + b''.join(data for _, _, data in tiles), len(tiles)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--order', type=int, default=3)
+    parser.add_argument('hipsdir')
+    args = parser.parse_args()
+
+    path = os.path.join(args.hipsdir, 'properties')
+    with open(path) as f:
+        properties = f.read()
+    get = lambda name, default: (
+        re.search(rf'^{name}\s*=\s*(\S+)', properties, re.M) or
+        [None, default])[1]
+    min_order = int(get('hips_order_min', 3))
+    ext = get('hips_tile_format', 'png').split()[0]
+    ext = {'jpeg': 'jpg'}.get(ext, ext)
+
+    os.makedirs(os.path.join(args.hipsdir, 'Bundle'), exist_ok=True)
+    total = 0
+    for pix in range(12):
+        data, nb = make_bundle(args.hipsdir, pix, args.order, min_order, ext)
+        total += nb
+        with open(os.path.join(args.hipsdir, 'Bundle', f'Npix{pix}.bundle'),
+                  'wb') as out:
+            out.write(data)
+
+    properties = re.sub(r'^hips_bundle_order\s*=.*\n', '', properties,
+                        flags=re.M)
+    properties += f'hips_bundle_order        = {args.order}\n'
+    with open(path, 'w') as f:
+        f.write(properties)
+    print(f'Bundled {total} tiles')
+
+
+if __name__ == '__main__':
+    main()
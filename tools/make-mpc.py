@@ -8,13 +8,56 @@
 # The terms of the AGPL v3 license can be found in the main directory of this
 # repository.
 
+# Usage:
+#   ./tools/make-mpc.py
+#       Generate the apps/test-skydata/mpcorb.dat test file with the 500
+#       brightest asteroids.
+#
+#   ./tools/make-mpc.py --eph out.eph
+#       Convert the full catalog into a binary eph file that the minor
+#       planets module can load without any parsing, using the 'eph/mpc'
+#       data source key.  The file contains a single MPCO chunk with the
+#       orbit elements table, and a string table with the names and
+#       designations.
+
+import datetime
 import os
 import gzip
 import requests
+import struct
+import sys
+import zlib
 
 URL = 'https://minorplanetcenter.net/Extended_Files/mpcorb_extended.dat.gz'
 
-def run():
+EPH_FILE_VERSION = 2
+MPCO_VERSION = 3
+EPH_RAD = 1 << 16
+EPH_VMAG = 3 << 16
+
+# name, type, unit
+COLUMNS = [
+    ('numb', 'i', 0),
+    ('type', 'i', 0),
+    ('epoc', 'd', 0),
+    ('h',    'f', EPH_VMAG),
+    ('g',    'f', 0),
+    ('m',    'f', EPH_RAD),
+    ('w',    'f', EPH_RAD),
+    ('o',    'f', EPH_RAD),
+    ('i',    'f', EPH_RAD),
+    ('e',    'f', 0),
+    ('n',    'f', EPH_RAD),
+    ('a',    'f', 0),
+    ('name', 'i', 0),
+    ('desg', 'i', 0),
+]
+
+MJD0 = datetime.date(1858, 11, 17)
+DD2R = 3.141592653589793 / 180
+
+
+def get_lines():
     path = '/tmp/mpcorb_extended.dat.gz'
     if not os.path.exists(path):
         print(f'download {URL}')
@@ -25,6 +68,119 @@ def run():
     lines = [x for x in lines if len(x) > 162]
     # Remove Pluto (we have it as a planet)
     lines = [x for x in lines if x[175:180] != 'Pluto']
+    return lines
+
+
+def unpack_char(c):
+    if c.isdigit():
+        return ord(c) - ord('0')
+    if 'A' <= c <= 'Z':
+        return 10 + ord(c) - ord('A')
+    return 36 + ord(c) - ord('a')
+
+
+def unpack_epoch(epoch):
+    year = (ord(epoch[0]) - ord('I') + 18) * 100 + int(epoch[1:3])
+    date = datetime.date(year, unpack_char(epoch[3]), unpack_char(epoch[4]))
+    return float((date - MJD0).days)
+
+
+def parse_line(line):
+    # Same as mpc_parse_line in src/mpc.c.
+    number = 0
+    if line[5] == ' ':
+        for c in line[0:5]:
+            number = number * 10 + unpack_char(c)
+    name = desig = ''
+    if line[175] != ' ' and not line[175].isdigit():
+        name = line[175:194].rstrip()
+    else:
+        desig = line[175:194].rstrip()
+    if not desig and len(line) >= 227:
+        desig = line[217:227].rstrip()
+    return dict(
+        numb=number,
+        type=int(line[161:165], 16) & 0x3f,
+        epoc=unpack_epoch(line[20:25]),
+        h=float(line[8:14]),
+        g=float(line[14:20]),
+        m=float(line[26:36]) * DD2R,
+        w=float(line[37:47]) * DD2R,
+        o=float(line[48:58]) * DD2R,
+        i=float(line[59:69]) * DD2R,
+        e=float(line[70:80]),
+        n=float(line[80:92]) * DD2R,
+        a=float(line[92:104]),
+        name=name,
+        desg=desig,
+    )
+
+
+class StringTable:
+    def __init__(self):
+        self.data = bytearray(b'\0')  # Offset 0 is the empty string.
+        self.cache = {}
+
+    def add(self, value):
+        if not value:
+            return 0
+        if value not in self.cache:
+            self.cache[value] = len(self.data)
+            self.data += value.encode() + b'\0'
+        return self.cache[value]
+
+
+def compressed_block(data):
+    comp = zlib.compress(bytes(data), 9)
+    return struct.pack('<ii', len(data), len(comp)) + comp
+
+
+def chunk(type, data):
+    crc = zlib.crc32(data) & 0xffffffff
+    return type.encode() + struct.pack('<i', len(data)) + data + \
+        struct.pack('<I', crc)
+
+
+def make_eph(lines, dst):
+    strs = StringTable()
+    rows = []
+    nb_err = 0
+    for line in lines:
+        try:
+            row = parse_line(line.rstrip('\n'))
+        except ValueError:
+            nb_err += 1
+            continue
+        row['name'] = strs.add(row['name'])
+        row['desg'] = strs.add(row['desg'])
+        rows.append(row)
+
+    row_fmt = '<' + ''.join(t for _, t, _ in COLUMNS)
+    row_size = struct.calcsize(row_fmt)
+    table = b''.join(struct.pack(row_fmt, *[r[c[0]] for c in COLUMNS])
+                     for r in rows)
+    # Shuffle the bytes for better compression (flag 1).
+    table = b''.join(table[i::row_size] for i in range(row_size))
+
+    header = struct.pack('<iiiii', MPCO_VERSION, 1, row_size, len(COLUMNS),
+                         len(rows))
+    start = 0
+    for name, type, unit in COLUMNS:
+        size = struct.calcsize('<' + type)
+        header += name.encode().ljust(4, b'\0')
+        header += type.encode().ljust(4, b'\0')
+        header += struct.pack('<iii', unit, start, size)
+        start += size
+
+    data = header + compressed_block(table) + compressed_block(strs.data)
+    with open(dst, 'wb') as out:
+        out.write(b'EPHE' + struct.pack('<i', EPH_FILE_VERSION))
+        out.write(chunk('MPCO', data))
+    print(f'Wrote {len(rows)} minor planets to {dst} ({nb_err} errors)')
+
+
+def run():
+    lines = get_lines()
     # Sort by magnitude.
     lines = sorted(lines, key=lambda x: float(x[8:14].strip() or 'inf'))
     # Keep only 500 first.
@@ -36,4 +192,7 @@ def run():
 
 
 if __name__ == '__main__':
-    run()
+    if len(sys.argv) > 2 and sys.argv[1] == '--eph':
+        make_eph(get_lines(), sys.argv[2])
+    else:
+        run()
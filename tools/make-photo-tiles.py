@@ -0,0 +1,89 @@
+#!/usr/bin/python3
+
+# Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+#
+# This program is licensed under the terms of the GNU AGPL v3, or
+# alternatively under a commercial licence.
+#
+# The terms of the AGPL v3 license can be found in the main directory of this
+# repository.
+
+# Usage:
+#   ./tools/make-photo-tiles.py [--tile-width N] [--format jpg] image outdir
+#
+# Cut a large photo into a tiles pyramid that the photos module can stream
+# with the 'tiles_url' attribute, instead of loading the full image as a
+# single texture.
+#
+# The pyramid uses the HiPS directory layout and properties file, so that
+# the engine loads it with the same code as the surveys, but the tiles are
+# a plain quadtree over the image: at order N the image is covered by
+# 2^N x 2^N square tiles, with the tile (x, y) (x to the right, y down)
+# stored as the pixel whose index interleaves the bits of x and y (x in
+# the odd bits).  The image is aligned on the top left corner of the
+# pyramid, and the tiles fully outside it are not written.  The image size
+# is given by the photo_width and photo_height properties.
+
+import argparse
+import math
+import os
+
+from PIL import Image
+
+Image.MAX_IMAGE_PIXELS = None
+
+
+def morton(x, y, order):
+    ret = 0
+    for i in range(order):
+        ret |= ((x >> i) & 1) << (2 * i + 1)
+        ret |= ((y >> i) & 1) << (2 * i)
+    return ret
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--tile-width', type=int, default=512)
+    parser.add_argument('--format', default='jpg',
+                        choices=['jpg', 'png', 'webp'])
+    parser.add_argument('image')
+    parser.add_argument('outdir')
+    args = parser.parse_args()
+
+    img = Image.open(args.image)
+    img = img.convert('RGBA' if args.format != 'jpg' else 'RGB')
+    w, h = img.size
+    tw = args.tile_width
+    max_order = max(0, math.ceil(math.log2(max(w, h) / tw)))
+
+    for order in range(max_order, -1, -1):
+        scale = 1 << (max_order - order)
+        level = img.resize((math.ceil(w / scale), math.ceil(h / scale)),
+                           Image.LANCZOS) if scale > 1 else img
+        n = 0
+        for y in range(math.ceil(level.height / tw)):
+            for x in range(math.ceil(level.width / tw)):
+                tile = Image.new(level.mode, (tw, tw))
+                tile.paste(level.crop((x * tw, y * tw,
+                                       (x + 1) * tw, (y + 1) * tw)))
+                pix = morton(x, y, order)
+                path = os.path.join(args.outdir, f'Norder{order}',
+                                    f'Dir{pix // 10000 * 10000}')
+                os.makedirs(path, exist_ok=True)
+                tile.save(os.path.join(path, f'Npix{pix}.{args.format}'))
+                n += 1
+        print(f'Order {order}: {n} tiles')
+
+    formats = {'jpg': 'jpeg', 'png': 'png', 'webp': 'webp'}
+    with open(os.path.join(args.outdir, 'properties'), 'w') as f:
+        f.write('hips_version = 1.4\n')
+        f.write(f'hips_order = {max_order}\n')
+        f.write('hips_order_min = 0\n')
+        f.write(f'hips_tile_width = {tw}\n')
+        f.write(f'hips_tile_format = {formats[args.format]}\n')
+        f.write(f'photo_width = {w}\n')
+        f.write(f'photo_height = {h}\n')
+
+
+if __name__ == '__main__':
+    main()
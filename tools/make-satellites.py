@@ -0,0 +1,174 @@
+#!/usr/bin/python3
+
+# Stellarium Web Engine - Copyright (c) 2018 - Noctua Software Ltd
+#
+# This program is licensed under the terms of the GNU AGPL v3, or
+# alternatively under a commercial licence.
+#
+# The terms of the AGPL v3 license can be found in the main directory of this
+# repository.
+
+# Convert a satellites jsonl file (noctuasky server format) into a binary
+# eph file that the satellites module can load without any parsing, using
+# the 'eph/sat' data source key.
+#
+# Usage:
+#   ./tools/make-satellites.py tle_satellite.jsonl.gz out.eph
+#
+# The file contains a single SATS chunk with the SGP4 mean elements already
+# converted to the units used by sgp4init, and a string table with the names
+# and otypes.
+
+import datetime
+import gzip
+import json
+import math
+import struct
+import sys
+import zlib
+
+EPH_FILE_VERSION = 2
+SATS_VERSION = 3
+EPH_RAD = 1 << 16
+EPH_VMAG = 3 << 16
+
+# name, type, unit
+COLUMNS = [
+    ('nora', 'i', 0),
+    ('epoc', 'd', 0),
+    ('bstr', 'd', 0),
+    ('ndot', 'd', 0),
+    ('nddt', 'd', 0),
+    ('ecco', 'd', 0),
+    ('argp', 'd', EPH_RAD),
+    ('incl', 'd', EPH_RAD),
+    ('mo',   'd', EPH_RAD),
+    ('no',   'd', 0),
+    ('node', 'd', EPH_RAD),
+    ('vmag', 'f', EPH_VMAG),
+    ('laun', 'd', 0),
+    ('deca', 'd', 0),
+    ('name', 'i', 0),
+    ('type', 'i', 0),
+]
+
+MJD0 = datetime.date(1858, 11, 17)
+
+
+def date_to_mjd(date):
+    return (date - MJD0).days
+
+
+def parse_date(str):
+    if not str:
+        return 0.0
+    return float(date_to_mjd(datetime.date.fromisoformat(str)))
+
+
+def parse_exp(str):
+    # Parse a TLE value with assumed decimal point, like ' 15749-3'.
+    str = str.strip()
+    if not str:
+        return 0.0
+    sign = -1 if str[0] == '-' else 1
+    str = str.lstrip('+-')
+    return sign * float('0.' + str[:-2]) * 10 ** int(str[-2:])
+
+
+def parse_tle(tle1, tle2):
+    # Return the elements in the units expected by sgp4init (same
+    # conversions as in SGP4Funcs::twoline2rv).
+    xpdotp = 1440.0 / (2.0 * math.pi)
+    deg2rad = math.pi / 180
+    yr = int(tle1[18:20])
+    year = yr + 2000 if yr < 57 else yr + 1900
+    epoch = date_to_mjd(datetime.date(year, 1, 1)) - 1 + float(tle1[20:32])
+    ndot = float(tle1[33:43])
+    nddot = parse_exp(tle1[44:52])
+    bstar = parse_exp(tle1[53:61])
+    return dict(
+        epoc=epoch,
+        bstr=bstar,
+        ndot=ndot / (xpdotp * 1440.0),
+        nddt=nddot / (xpdotp * 1440.0 * 1440),
+        incl=float(tle2[8:16]) * deg2rad,
+        node=float(tle2[17:25]) * deg2rad,
+        ecco=float('0.' + tle2[26:33].strip()),
+        argp=float(tle2[34:42]) * deg2rad,
+        mo=float(tle2[43:51]) * deg2rad,
+        no=float(tle2[52:63]) / xpdotp,
+    )
+
+
+class StringTable:
+    def __init__(self):
+        self.data = bytearray(b'\0')  # Offset 0 is the empty list.
+        self.cache = {}
+
+    def add_list(self, values):
+        # Add a list of null terminated strings ending with an empty string.
+        values = tuple(values)
+        if not values:
+            return 0
+        if values not in self.cache:
+            self.cache[values] = len(self.data)
+            for v in values:
+                self.data += v.encode() + b'\0'
+            self.data += b'\0'
+        return self.cache[values]
+
+
+def compressed_block(data):
+    comp = zlib.compress(bytes(data), 9)
+    return struct.pack('<ii', len(data), len(comp)) + comp
+
+
+def chunk(type, data):
+    crc = zlib.crc32(data) & 0xffffffff
+    return type.encode() + struct.pack('<i', len(data)) + data + \
+        struct.pack('<I', crc)
+
+
+def run(src, dst):
+    strs = StringTable()
+    rows = []
+    for line in gzip.open(src, 'rt'):
+        if not line.strip():
+            continue
+        sat = json.loads(line)
+        model = sat['model_data']
+        row = parse_tle(*model['tle'])
+        row['nora'] = model['norad_number']
+        row['vmag'] = model.get('mag', float('nan'))
+        row['laun'] = parse_date(model.get('launch_date'))
+        row['deca'] = parse_date(model.get('decay_date'))
+        row['name'] = strs.add_list(sat.get('names', []))
+        row['type'] = strs.add_list(sat.get('types', []))
+        rows.append(row)
+
+    row_fmt = '<' + ''.join(t for _, t, _ in COLUMNS)
+    row_size = struct.calcsize(row_fmt)
+    table = b''.join(struct.pack(row_fmt, *[r[c[0]] for c in COLUMNS])
+                     for r in rows)
+    # Shuffle the bytes for better compression (flag 1).
+    table = b''.join(table[i::row_size] for i in range(row_size))
+
+    header = struct.pack('<iiiii', SATS_VERSION, 1, row_size, len(COLUMNS),
+                         len(rows))
+    start = 0
+    for name, type, unit in COLUMNS:
+        size = struct.calcsize('<' + type)
+        header += name.encode().ljust(4, b'\0')
+        header += type.encode().ljust(4, b'\0')
+        header += struct.pack('<iii', unit, start, size)
+        start += size
+
+    data = header + compressed_block(table) + compressed_block(strs.data)
+    with open(dst, 'wb') as out:
+        out.write(b'EPHE' + struct.pack('<i', EPH_FILE_VERSION))
+        out.write(chunk('SATS', data))
+    print(f'Wrote {len(rows)} satellites to {dst}')
+
+
+if __name__ == '__main__':
+    run(sys.argv[1], sys.argv[2])
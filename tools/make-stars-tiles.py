@@ -0,0 +1,296 @@
+#!/usr/bin/python3
+
+# Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+#
+# This program is licensed under the terms of the GNU AGPL v3, or
+# alternatively under a commercial licence.
+#
+# The terms of the AGPL v3 license can be found in the main directory of this
+# repository.
+
+# Usage:
+#   ./tools/make-stars-tiles.py [options] in.csv outdir
+#
+# Build a stars HiPS survey that can be added with the stars module
+# add_data_source method, from a csv catalog with a header line.
+#
+# Recognised csv columns (all optional except ra, de and vmag):
+#   ra, de      - ICRS position at the epoch (deg).
+#   vmag        - Visual magnitude.
+#   plx         - Parallax (mas).
+#   pm_ra       - Proper motion in ra, multiplied by cos(de) (mas/year).
+#   pm_de       - Proper motion in de (mas/year).
+#   epoch       - Epoch of the position (year, default to 2000).
+#   bv          - B-V color index.
+#   gaia, hip   - Gaia and HIP catalog numbers.
+#   ids         - Extra designations separated by '|'.
+#
+# The stars are sorted by magnitude and then distributed from the lowest
+# order: each tile gets the brightest stars of its area not already in a
+# parent tile, up to --tile-size stars, and the rest goes to the children.
+# So the tiles of a given order cover a magnitude range, and the renderer
+# only loads the children once the tile max magnitude is reached.
+#
+# With --quantize, the float columns are stored as 16 or 32 bits integers
+# relative to the tile values range, with just enough precision.  The
+# positions get the given precision, the magnitudes and B-V 0.001, and the
+# parallaxes and proper motions 0.01 mas (/year).
+#
+# With --slice-size, each tile is split into several STAR chunks of
+# increasing magnitude, each with its own compressed table, so that the
+# renderer only decodes the faint slices when it needs them.
+#
+# The tiles are written by a pool of processes, the table data shuffled and
+# compressed as done by the other eph tools.
+
+import argparse
+import csv
+import multiprocessing
+import os
+import struct
+import zlib
+
+import healpy
+import numpy as np
+
+EPH_FILE_VERSION = 2
+STAR_VERSION = 3
+EPH_RAD = 1 << 16
+EPH_ARCSEC = EPH_RAD | 1 | 2 | 4
+EPH_VMAG = 3 << 16
+EPH_RAD_PER_YEAR = 6 << 16
+EPH_YEAR = 7 << 16
+
+MAS2RAD = np.pi / 180 / 3600 / 1000
+
+# name, csv name, type, unit, numpy type, default value
+COLUMNS = [
+    ('gaia', 'gaia',  'Q', 0,                '<u8',  0),
+    ('hip',  'hip',   'i', 0,                '<i4',  0),
+    ('vmag', 'vmag',  'f', EPH_VMAG,         '<f4',  None),
+    ('ra',   'ra',    'f', EPH_RAD,          '<f4',  None),
+    ('de',   'de',    'f', EPH_RAD,          '<f4',  None),
+    ('plx',  'plx',   'f', EPH_ARCSEC,       '<f4',  0),
+    ('pra',  'pm_ra', 'f', EPH_RAD_PER_YEAR, '<f4',  0),
+    ('pde',  'pm_de', 'f', EPH_RAD_PER_YEAR, '<f4',  0),
+    ('epoc', 'epoch', 'f', EPH_YEAR,         '<f4',  2000),
+    ('bv',   'bv',    'f', 0,                '<f4',  float('nan')),
+    ('ids',  'ids',   's', 0,                'S256', ''),
+]
+
+
+def load_catalog(path):
+    with open(path, newline='') as f:
+        reader = csv.reader(f)
+        header = next(reader)
+        columns = [c for c in COLUMNS if c[1] in header]
+        for c in ('ra', 'de', 'vmag'):
+            if c not in header:
+                raise SystemExit(f'Missing column {c}')
+        keys = [header.index(c[1]) for c in columns]
+        values = [[] for c in columns]
+        for row in reader:
+            for v, k in zip(values, keys):
+                v.append(row[k])
+    data = {}
+    for (name, key, type, _, dtype, default), v in zip(columns, values):
+        if default is None and '' in v:
+            raise SystemExit(f'Missing {key} value')
+        if type == 's':
+            v = [x.encode() for x in v]
+        else:
+            parse = int if type in 'iQ' else float
+            v = [parse(x) if x != '' else default for x in v]
+        data[name] = np.array(v, dtype=dtype)
+    data['ra'] = np.radians(data['ra'].astype(float))
+    data['de'] = np.radians(data['de'].astype(float))
+    if 'plx' in data:
+        data['plx'] = data['plx'] / 1000
+    for name in ('pra', 'pde'):
+        if name in data:
+            data[name] = data[name] * MAS2RAD
+    return columns, data
+
+
+def split_tiles(vmag, pix, min_order, max_order, tile_size):
+    '''Return the tile order of each star, given the stars sorted by vmag
+    and their nested pixel at max_order'''
+    order = np.full(len(vmag), max_order, dtype=np.int8)
+    left = np.arange(len(vmag))
+    for o in range(min_order, max_order):
+        p = pix[left] >> (2 * (max_order - o))
+        # Stable sort, so that each group stays sorted by vmag.
+        idx = np.argsort(p, kind='stable')
+        p = p[idx]
+        rank = np.arange(len(p)) - np.searchsorted(p, p, side='left')
+        order[left[idx[rank < tile_size]]] = o
+        left = left[np.sort(idx[rank >= tile_size])]
+    return order
+
+
+def quantize(name, values, steps):
+    '''Return the type, scale, offset and integer values of a quantized
+    column, or None if the column cannot be quantized'''
+    if name not in steps or not len(values):
+        return None
+    v = values.astype(float)
+    valid = ~np.isnan(v)
+    if not valid.any():
+        return None
+    if name == 'ra':
+        # Keep the values continuous around ra = 0.
+        ref = v[valid][0]
+        v = ref + (v - ref + np.pi) % (2 * np.pi) - np.pi
+    lo, hi = np.min(v[valid]), np.max(v[valid])
+    offset = (lo + hi) / 2
+    scale = steps[name]
+    for type, dtype, bits in (('h', '<i2', 16), ('i', '<i4', 32)):
+        vmax = (1 << (bits - 1)) - 1
+        if (hi - lo) / 2 / scale < vmax:
+            break
+    else:
+        return None
+    q = np.full(len(v), -vmax - 1, dtype=dtype)
+    q[valid] = np.round((v[valid] - offset) / scale)
+    return type, scale, offset, q
+
+
+def make_table(columns, data, rows, steps=None):
+    '''Encode an eph table.  If steps is set, it gives the wanted
+    precision of the quantized columns'''
+    columns = [list(c) for c in columns]
+    values = {}
+    for c in columns:
+        values[c[0]] = data[c[0]][rows]
+        c.append((0, 0))
+        r = quantize(c[0], values[c[0]], steps or {})
+        if r:
+            c[2], c[4], c[6] = r[0], r[3].dtype.str, r[1:3]
+            values[c[0]] = r[3]
+    fmt = [(c[0], c[4]) for c in columns]
+    table = np.zeros(len(rows), dtype=fmt)
+    for c in columns:
+        table[c[0]] = values[c[0]]
+    row_size = table.dtype.itemsize
+    raw = table.tobytes()
+    # Shuffle the bytes for better compression (flag 1), and set the
+    # quantized columns flag (2).
+    raw = np.frombuffer(raw, dtype=np.uint8).reshape(-1, row_size).T.tobytes()
+    flags = 1 | (2 if steps else 0)
+    header = struct.pack('<iiii', flags, row_size, len(columns), len(rows))
+    start = 0
+    for name, _, type, unit, dtype, _, quant in columns:
+        size = np.dtype(dtype).itemsize
+        header += name.encode().ljust(4, b'\0')
+        header += type.encode().ljust(4, b'\0')
+        header += struct.pack('<iii', unit, start, size)
+        if steps:
+            header += struct.pack('<dd', *quant)
+        start += size
+    comp = zlib.compress(raw, 9)
+    return header + struct.pack('<ii', len(raw), len(comp)) + comp
+
+
+def chunk(type, data):
+    crc = zlib.crc32(data) & 0xffffffff
+    return type.encode() + struct.pack('<i', len(data)) + data + \
+        struct.pack('<I', crc)
+
+
+def write_tile(args):
+    outdir, order, pix, children_mask, slice_size, steps, columns, data = args
+    nuniq = 4 * (1 << (2 * order)) + pix
+    nb = len(data['vmag'])
+    slice_size = slice_size or max(nb, 1)
+    json = '{"children_mask": %d}' % children_mask
+    path = os.path.join(outdir, f'Norder{order}',
+                        f'Dir{pix // 10000 * 10000}')
+    os.makedirs(path, exist_ok=True)
+    with open(os.path.join(path, f'Npix{pix}.eph'), 'wb') as out:
+        out.write(b'EPHE' + struct.pack('<i', EPH_FILE_VERSION))
+        out.write(chunk('JSON', json.encode()))
+        # The rows are already sorted by vmag.
+        for start in range(0, max(nb, 1), slice_size):
+            rows = np.arange(start, min(start + slice_size, nb))
+            star = struct.pack('<iQ', STAR_VERSION, nuniq) + \
+                make_table(columns, data, rows, steps)
+            out.write(chunk('STAR', star))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build a stars survey')
+    parser.add_argument('input')
+    parser.add_argument('outdir')
+    parser.add_argument('--tile-size', type=int, default=1024,
+                        help='Max number of stars per tile, except at the '
+                             'max order')
+    parser.add_argument('--slice-size', type=int, default=0,
+                        help='Split the tiles into magnitude slices of '
+                             'this number of stars')
+    parser.add_argument('--quantize', type=float, metavar='ARCSEC',
+                        help='Store the positions as integers relative to '
+                             'the tile, with this precision')
+    parser.add_argument('--min-order', type=int, default=0)
+    parser.add_argument('--max-order', type=int, default=11)
+    parser.add_argument('--jobs', type=int, default=os.cpu_count())
+    args = parser.parse_args()
+
+    columns, data = load_catalog(args.input)
+    steps = None
+    if args.quantize:
+        steps = {
+            'ra': args.quantize / 3600 * np.pi / 180,
+            'de': args.quantize / 3600 * np.pi / 180,
+            'vmag': 0.001,
+            'bv': 0.001,
+            'plx': 0.01 / 1000,
+            'pra': 0.01 * MAS2RAD,
+            'pde': 0.01 * MAS2RAD,
+        }
+    sort = np.argsort(data['vmag'], kind='stable')
+    data = {k: v[sort] for k, v in data.items()}
+    pix = healpy.ang2pix(1 << args.max_order, np.pi / 2 - data['de'],
+                         data['ra'], nest=True)
+    order = split_tiles(data['vmag'], pix, args.min_order, args.max_order,
+                        args.tile_size)
+    tile_pix = pix >> (2 * (args.max_order - order.astype(np.int64)))
+
+    # Group the stars per tile, keeping them sorted by vmag.
+    key = order.astype(np.int64) << 40 | tile_pix
+    idx = np.argsort(key, kind='stable')
+    keys, starts = np.unique(key[idx], return_index=True)
+    tiles = {(int(k >> 40), int(k & ((1 << 40) - 1))): rows
+             for k, rows in zip(keys, np.split(idx, starts[1:]))}
+
+    def get_children_mask(o, p):
+        return sum(1 << i for i in range(4) if (o + 1, p * 4 + i) in tiles)
+
+    # Also create the empty parents of the deeper tiles, so that the
+    # renderer can reach them.
+    for o, p in list(tiles):
+        while o > args.min_order:
+            o, p = o - 1, p // 4
+            if (o, p) in tiles:
+                break
+            tiles[(o, p)] = []
+
+    jobs = ((args.outdir, o, p, get_children_mask(o, p), args.slice_size,
+             steps, columns, {k: v[rows] for k, v in data.items()})
+            for (o, p), rows in sorted(tiles.items()))
+    with multiprocessing.Pool(args.jobs) as pool:
+        for _ in pool.imap_unordered(write_tile, jobs, chunksize=16):
+            pass
+
+    with open(os.path.join(args.outdir, 'properties'), 'w') as out:
+        out.write(f'hips_order_min           = {args.min_order}\n')
+        out.write(f'hips_order               = {int(order.max())}\n')
+        out.write(f'min_vmag                 = {data["vmag"][0]:.2f}\n')
+        out.write(f'max_vmag                 = {data["vmag"][-1]:.2f}\n')
+        out.write('type                     = stars\n')
+        out.write('hips_tile_format         = eph\n')
+        out.write('hips_frame               = equatorial\n')
+    print(f'Wrote {len(tiles)} tiles with {len(order)} stars')
+
+
+if __name__ == '__main__':
+    main()